@@ -284,6 +284,8 @@ int main(int argc, char **argv) {
 
 cleanup:
 
+	DumpCounters(ksi);
+
 	if (logFile != NULL) fclose(logFile);
 
 	if (res != KSI_OK && ksi != NULL) {
@@ -0,0 +1,372 @@
+/*
+ * Copyright 2013-2016 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ksi/ksi.h>
+#include <ksi/blocksigner.h>
+#include <ksi/multi_signature.h>
+#include <ksi/compatibility.h>
+#include "ksi_common.h"
+
+typedef struct BulkSigner_st {
+	KSI_CTX *ksi;
+	KSI_BlockSigner *bs;
+	FileList *files;
+	/* Output container, NULL to write a signature file for every input file. */
+	KSI_MultiSignature *ms;
+	/* Indices of the files in the current block. */
+	size_t *block;
+	size_t block_len;
+	size_t block_size;
+	/* Index of the next signature in the current block. */
+	size_t next;
+	size_t blocks;
+	size_t signedFiles;
+	size_t failedFiles;
+} BulkSigner;
+
+static int writeToFile(const char *name, KSI_Signature *sig) {
+	int res = KSI_UNKNOWN_ERROR;
+
+	FILE *out = NULL;
+	unsigned char *raw = NULL;
+	size_t raw_len;
+
+	/* Output file. */
+	out = fopen(name, "wb");
+	if (out == NULL) {
+		fprintf(stderr, "%s: Unable to open output file.\n", name);
+		res = KSI_IO_ERROR;
+		goto cleanup;
+	}
+
+	/* Serialize the signature. */
+	res = KSI_Signature_serialize(sig, &raw, &raw_len);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Unable to serialize signature.\n");
+		goto cleanup;
+	}
+
+	/* Write the signature to file. */
+	if (!fwrite(raw, 1, raw_len, out)) {
+		fprintf(stderr, "%s: Unable to write output file.\n", name);
+		res = KSI_IO_ERROR;
+		goto cleanup;
+	}
+
+cleanup:
+	if (out != NULL) fclose(out);
+
+	KSI_free(raw);
+
+	return res;
+}
+
+static int writeMultiSignature(const char *name, KSI_MultiSignature *ms) {
+	int res = KSI_UNKNOWN_ERROR;
+
+	FILE *out = NULL;
+	unsigned char *raw = NULL;
+	size_t raw_len;
+
+	out = fopen(name, "wb");
+	if (out == NULL) {
+		fprintf(stderr, "%s: Unable to open output file.\n", name);
+		res = KSI_IO_ERROR;
+		goto cleanup;
+	}
+
+	res = KSI_MultiSignature_serialize(ms, &raw, &raw_len);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Unable to serialize multi signature container.\n");
+		goto cleanup;
+	}
+
+	if (!fwrite(raw, 1, raw_len, out)) {
+		fprintf(stderr, "%s: Unable to write output file.\n", name);
+		res = KSI_IO_ERROR;
+		goto cleanup;
+	}
+
+cleanup:
+	if (out != NULL) fclose(out);
+
+	KSI_free(raw);
+
+	return res;
+}
+
+/* Receives the signatures of a closed block in the order the leafs were added. */
+static int storeSignature(void *c, KSI_BlockSignerHandle *handle, KSI_Signature *sig) {
+	int res = KSI_UNKNOWN_ERROR;
+	BulkSigner *signer = c;
+	const char *name = signer->files->names[signer->block[signer->next++]];
+	char buf[4096];
+
+	if (signer->ms != NULL) {
+		res = KSI_MultiSignature_add(signer->ms, sig);
+		if (res != KSI_OK) {
+			fprintf(stderr, "%s: Unable to add the signature to the container.\n", name);
+			goto cleanup;
+		}
+	} else {
+		KSI_snprintf(buf, sizeof(buf), "%s.ksig", name);
+
+		res = writeToFile(buf, sig);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	signer->signedFiles++;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_Signature_free(sig);
+
+	return res;
+}
+
+/* Signs the root of the current block with a single request and stores the signatures. */
+static int signBlock(BulkSigner *signer) {
+	int res = KSI_UNKNOWN_ERROR;
+
+	if (signer->block_len == 0) return KSI_OK;
+
+	res = KSI_BlockSigner_close(signer->bs, NULL);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Unable to sign the root of block %lu.\n", (unsigned long)signer->blocks);
+		goto cleanup;
+	}
+
+	signer->next = 0;
+	res = KSI_BlockSigner_getSignatures(signer->bs, storeSignature, signer);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Unable to extract the signatures of block %lu.\n", (unsigned long)signer->blocks);
+		goto cleanup;
+	}
+
+	res = KSI_BlockSigner_reset(signer->bs);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Unable to reset the block signer.\n");
+		goto cleanup;
+	}
+
+	signer->block_len = 0;
+	signer->blocks++;
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+/* Receives the file hashes from the worker pool in the order of the input files. */
+static int addHash(void *c, size_t index, int status, KSI_DataHash *hsh) {
+	int res = KSI_UNKNOWN_ERROR;
+	BulkSigner *signer = c;
+
+	if (status != KSI_OK) {
+		fprintf(stderr, "%s: Failed to calculate the hash.\n", signer->files->names[index]);
+		signer->failedFiles++;
+		res = KSI_OK;
+		goto cleanup;
+	}
+
+	res = KSI_BlockSigner_addLeaf(signer->bs, hsh, 0, NULL, NULL);
+	if (res != KSI_OK) {
+		fprintf(stderr, "%s: Unable to add data hash to the block signer.\n", signer->files->names[index]);
+		goto cleanup;
+	}
+	signer->block[signer->block_len++] = index;
+
+	if (signer->block_len == signer->block_size) {
+		res = signBlock(signer);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_DataHash_free(hsh);
+
+	return res;
+}
+
+static void printHelp(char *exec) {
+	fprintf(stderr, "Usage:\n"
+			"  %s <ksi+http://<user>:<pass>@<aggregator-uri>> <pub-file url> [-j <threads>] [-n <files per block>] [-o <multi-signature file>] <file | directory | @list-file> [...]\n"
+			"\n"
+			"  Hashes the files on <threads> worker threads (default 4), aggregates the hashes\n"
+			"  of every <files per block> files (default 1024) locally and signs the root of\n"
+			"  each block with a single request. The signatures are written next to the input\n"
+			"  files with the extension .ksig, or into a single multi-signature container.\n", exec);
+}
+
+int main(int argc, char **argv) {
+	int res = KSI_UNKNOWN_ERROR;
+
+	BulkSigner signer;
+	FileList files;
+	FILE *logFile = NULL;
+	size_t workers = 4;
+	const char *msFile = NULL;
+	double start;
+	int i;
+
+	const KSI_CertConstraint pubFileCertConstr[] = {
+			{ KSI_CERT_EMAIL, "publications@guardtime.com"},
+			{ NULL, NULL }
+	};
+
+	memset(&signer, 0, sizeof(signer));
+	memset(&files, 0, sizeof(files));
+	signer.block_size = 1024;
+	signer.files = &files;
+
+	/* Handle command line parameters */
+	if (argc < 4) {
+		printHelp(argv[0]);
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	for (i = 3; i < argc; i++) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			workers = (size_t)atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			signer.block_size = (size_t)atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			msFile = argv[++i];
+		} else if (argv[i][0] == '@') {
+			res = CollectFilesFromList(&files, argv[i] + 1);
+			if (res != KSI_OK) goto cleanup;
+		} else {
+			res = CollectFiles(&files, argv[i]);
+			if (res != KSI_OK) goto cleanup;
+		}
+	}
+
+	if (signer.block_size == 0 || files.names_len == 0) {
+		printHelp(argv[0]);
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	signer.block = malloc(signer.block_size * sizeof(size_t));
+	if (signer.block == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	/* Create new KSI context. */
+	res = KSI_CTX_new(&signer.ksi);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Unable to create context.\n");
+		goto cleanup;
+	}
+
+	res = KSI_CTX_setDefaultPubFileCertConstraints(signer.ksi, pubFileCertConstr);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Unable to configure publications file cert constraints.\n");
+		goto cleanup;
+	}
+
+	/* Configure the logger. */
+	res = OpenLogging(signer.ksi, "ksi_bulk_sign.log", &logFile);
+	if (res != KSI_OK) goto cleanup;
+
+	KSI_LOG_info(signer.ksi, "Using KSI version: '%s'.", KSI_getVersion());
+
+	res = KSI_CTX_setAggregator(signer.ksi, argv[1], NULL, NULL);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Unable to set aggregator.\n");
+		goto cleanup;
+	}
+
+	res = KSI_CTX_setPublicationUrl(signer.ksi, argv[2]);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Unable to set publications file url.\n");
+		goto cleanup;
+	}
+
+	/* The worker threads use the context together with the main thread. */
+	res = KSI_CTX_setFlag(signer.ksi, KSI_CTX_FLAG_SHARED, (void *)1);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Unable to share the context.\n");
+		goto cleanup;
+	}
+
+	res = KSI_BlockSigner_new(signer.ksi, KSI_getHashAlgorithmByName("default"), NULL, NULL, &signer.bs);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Failed to create new block-signer instance.\n");
+		goto cleanup;
+	}
+
+	if (msFile != NULL) {
+		res = KSI_MultiSignature_new(signer.ksi, &signer.ms);
+		if (res != KSI_OK) {
+			fprintf(stderr, "Unable to create multi signature container.\n");
+			goto cleanup;
+		}
+	}
+
+	start = GetTimeSeconds();
+
+	/* Hash the files in parallel, blocks are signed as they fill up. */
+	res = KSI_DataHash_createFromFiles(signer.ksi, files.names, files.names_len, KSI_getHashAlgorithmByName("default"), workers, addHash, &signer);
+	if (res != KSI_OK) goto cleanup;
+
+	/* Sign the last partial block. */
+	res = signBlock(&signer);
+	if (res != KSI_OK) goto cleanup;
+
+	if (signer.ms != NULL) {
+		res = writeMultiSignature(msFile, signer.ms);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	PrintThroughput("Signed", signer.signedFiles, files.bytes, GetTimeSeconds() - start);
+	printf("Aggregation requests: %lu, failed files: %lu.\n", (unsigned long)signer.blocks, (unsigned long)signer.failedFiles);
+
+	res = signer.failedFiles == 0 ? KSI_OK : KSI_IO_ERROR;
+
+cleanup:
+
+	DumpCounters(signer.ksi);
+
+	if (logFile != NULL) fclose(logFile);
+
+	if (res != KSI_OK && signer.ksi != NULL) {
+		KSI_ERR_statusDump(signer.ksi, stderr);
+	}
+
+	free(signer.block);
+	FreeFileList(&files);
+	KSI_MultiSignature_free(signer.ms);
+	KSI_BlockSigner_free(signer.bs);
+	KSI_CTX_free(signer.ksi);
+
+	return res;
+}
@@ -0,0 +1,392 @@
+/*
+ * Copyright 2013-2016 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <pthread.h>
+#endif
+
+#include <ksi/ksi.h>
+#include <ksi/policy.h>
+#include <ksi/compatibility.h>
+#include "ksi_common.h"
+
+#ifdef _WIN32
+typedef HANDLE worker_t;
+typedef CRITICAL_SECTION lock_t;
+#  define LOCK_INIT(l) (InitializeCriticalSection(l), 0)
+#  define LOCK(l) EnterCriticalSection(l)
+#  define UNLOCK(l) LeaveCriticalSection(l)
+#  define LOCK_FREE(l) DeleteCriticalSection(l)
+#  define WORKER_FN(fn, arg) DWORD WINAPI fn(LPVOID arg)
+#  define WORKER_RETURN return 0
+#  define WORKER_START(w, fn, arg) (((*(w) = CreateThread(NULL, 0, (fn), (arg), 0, NULL)) != NULL) ? 0 : -1)
+#  define WORKER_JOIN(w) (WaitForSingleObject((w), INFINITE), CloseHandle(w))
+#else
+typedef pthread_t worker_t;
+typedef pthread_mutex_t lock_t;
+#  define LOCK_INIT(l) pthread_mutex_init((l), NULL)
+#  define LOCK(l) pthread_mutex_lock(l)
+#  define UNLOCK(l) pthread_mutex_unlock(l)
+#  define LOCK_FREE(l) pthread_mutex_destroy(l)
+#  define WORKER_FN(fn, arg) void *fn(void *arg)
+#  define WORKER_RETURN return NULL
+#  define WORKER_START(w, fn, arg) pthread_create((w), NULL, (fn), (arg))
+#  define WORKER_JOIN(w) pthread_join((w), NULL)
+#endif
+
+#define RULE_PREFIX "KSI_VerificationRule_"
+#define MAX_RULES 64
+
+typedef struct RuleStats_st {
+	const char *ruleName;
+	size_t na;
+	size_t fail;
+} RuleStats;
+
+typedef struct BulkVerifier_st {
+	KSI_CTX *ksi;
+	FileList *files;
+	lock_t lock;
+	/* Index of the next file to be verified. */
+	size_t next;
+	/* Per-rule statistics of the results other than OK. */
+	RuleStats rules[MAX_RULES];
+	size_t rules_len;
+	/* Final results. */
+	size_t ok;
+	size_t na;
+	size_t fail;
+	/* Files that could not be verified due to an error. */
+	size_t errors;
+} BulkVerifier;
+
+static void countRule(BulkVerifier *verifier, KSI_RuleVerificationResult *rule) {
+	size_t i;
+
+	if (rule->resultCode == KSI_VER_RES_OK || rule->ruleName == NULL) return;
+
+	for (i = 0; i < verifier->rules_len; i++) {
+		if (strcmp(verifier->rules[i].ruleName, rule->ruleName) == 0) break;
+	}
+
+	if (i == verifier->rules_len) {
+		if (i == MAX_RULES) return;
+		verifier->rules[i].ruleName = rule->ruleName;
+		verifier->rules_len++;
+	}
+
+	if (rule->resultCode == KSI_VER_RES_FAIL) {
+		verifier->rules[i].fail++;
+	} else {
+		verifier->rules[i].na++;
+	}
+}
+
+/* Adds the result of a single signature to the statistics. */
+static void countResult(BulkVerifier *verifier, const char *name, KSI_PolicyVerificationResult *result) {
+	size_t i;
+
+	LOCK(&verifier->lock);
+
+	for (i = 0; i < KSI_RuleVerificationResultList_length(result->ruleResults); i++) {
+		KSI_RuleVerificationResult *tmp = NULL;
+
+		if (KSI_RuleVerificationResultList_elementAt(result->ruleResults, i, &tmp) == KSI_OK && tmp != NULL) {
+			countRule(verifier, tmp);
+		}
+	}
+
+	switch (result->finalResult.resultCode) {
+		case KSI_VER_RES_OK:
+			verifier->ok++;
+			break;
+		case KSI_VER_RES_NA:
+			verifier->na++;
+			fprintf(stderr, "%s: Verification inconclusive with code %d.\n", name, result->finalResult.errorCode);
+			break;
+		default:
+			verifier->fail++;
+			fprintf(stderr, "%s: Verification failed with code %d.\n", name, result->finalResult.errorCode);
+			break;
+	}
+
+	UNLOCK(&verifier->lock);
+}
+
+/* Verifies the document against the signature stored next to it. */
+static int verifyFile(BulkVerifier *verifier, char *name) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_Signature *sig = NULL;
+	KSI_DataHash *hsh = NULL;
+	KSI_VerificationContext context;
+	KSI_PolicyVerificationResult *result = NULL;
+	char sigName[4096];
+
+	KSI_snprintf(sigName, sizeof(sigName), "%s.ksig", name);
+
+	/* The internal verification is part of the general policy, skip it while parsing. */
+	res = KSI_Signature_fromFileWithPolicy(verifier->ksi, sigName, KSI_VERIFICATION_POLICY_EMPTY, NULL, &sig);
+	if (res != KSI_OK) {
+		fprintf(stderr, "%s: Unable to read signature (%s).\n", sigName, KSI_getErrorString(res));
+		goto cleanup;
+	}
+
+	res = GetDocumentHash(name, sig, &hsh);
+	if (res != KSI_OK) {
+		fprintf(stderr, "%s: Unable to get document hash.\n", name);
+		goto cleanup;
+	}
+
+	res = KSI_VerificationContext_init(&context, verifier->ksi);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Failed to create verification context.\n");
+		goto cleanup;
+	}
+
+	context.signature = sig;
+	context.documentHash = hsh;
+	context.extendingAllowed = 1;
+
+	res = KSI_SignatureVerifier_verify(KSI_VERIFICATION_POLICY_GENERAL, &context, &result);
+	KSI_VerificationContext_clean(&context);
+	if (res != KSI_OK) {
+		fprintf(stderr, "%s: Failed to complete verification due to an error 0x%x (%s).\n", name, res, KSI_getErrorString(res));
+		goto cleanup;
+	}
+
+	countResult(verifier, name, result);
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_PolicyVerificationResult_free(result);
+	KSI_DataHash_free(hsh);
+	KSI_Signature_free(sig);
+
+	return res;
+}
+
+static WORKER_FN(verifyWorker, arg) {
+	BulkVerifier *verifier = arg;
+	size_t i;
+
+	for (;;) {
+		LOCK(&verifier->lock);
+		i = verifier->next++;
+		UNLOCK(&verifier->lock);
+
+		if (i >= verifier->files->names_len) break;
+
+		if (verifyFile(verifier, verifier->files->names[i]) != KSI_OK) {
+			LOCK(&verifier->lock);
+			verifier->errors++;
+			UNLOCK(&verifier->lock);
+		}
+	}
+
+	WORKER_RETURN;
+}
+
+static void printStatistics(BulkVerifier *verifier) {
+	size_t i;
+	size_t prefix = strlen(RULE_PREFIX);
+
+	if (verifier->rules_len > 0) {
+		printf("Rules not passed:\n");
+		printf("%8s %8s  %s\n", "FAIL", "NA", "RULE");
+		for (i = 0; i < verifier->rules_len; i++) {
+			const char *name = verifier->rules[i].ruleName;
+
+			/* Print the rule name without the prefix. */
+			if (strncmp(name, RULE_PREFIX, prefix) == 0) name += prefix;
+			printf("%8lu %8lu  %s\n", (unsigned long)verifier->rules[i].fail, (unsigned long)verifier->rules[i].na, name);
+		}
+	}
+
+	printf("Final results: %lu OK, %lu NA, %lu FAIL, %lu errors.\n",
+			(unsigned long)verifier->ok, (unsigned long)verifier->na, (unsigned long)verifier->fail, (unsigned long)verifier->errors);
+}
+
+static void printHelp(char *exec) {
+	fprintf(stderr, "Usage:\n"
+			"  %s <extender url> <pub-file url> [-j <threads>] <file | directory | @list-file> [...]\n"
+			"\n"
+			"  Verifies the files against the signatures stored next to them with the\n"
+			"  extension .ksig on <threads> worker threads (default 4) using the general\n"
+			"  verification policy. The publications file is downloaded once and the\n"
+			"  signatures created in the same second share a single extender request.\n", exec);
+}
+
+int main(int argc, char **argv) {
+	int res = KSI_UNKNOWN_ERROR;
+
+	BulkVerifier verifier;
+	FileList files;
+	FILE *logFile = NULL;
+	size_t workers = 4;
+	size_t started = 0;
+	worker_t *threads = NULL;
+	KSI_PublicationsFile *pubFile = NULL;
+	int locked = 0;
+	double start;
+	size_t i;
+
+	const KSI_CertConstraint pubFileCertConstr[] = {
+			{ KSI_CERT_EMAIL, "publications@guardtime.com"},
+			{ NULL, NULL }
+	};
+
+	memset(&verifier, 0, sizeof(verifier));
+	memset(&files, 0, sizeof(files));
+	verifier.files = &files;
+
+	/* Handle command line parameters */
+	if (argc < 4) {
+		printHelp(argv[0]);
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	for (i = 3; i < (size_t)argc; i++) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < (size_t)argc) {
+			workers = (size_t)atoi(argv[++i]);
+		} else if (argv[i][0] == '@') {
+			res = CollectFilesFromList(&files, argv[i] + 1);
+			if (res != KSI_OK) goto cleanup;
+		} else {
+			res = CollectFiles(&files, argv[i]);
+			if (res != KSI_OK) goto cleanup;
+		}
+	}
+
+	if (workers == 0 || files.names_len == 0) {
+		printHelp(argv[0]);
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	threads = malloc(workers * sizeof(worker_t));
+	if (threads == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	if (LOCK_INIT(&verifier.lock) != 0) {
+		res = KSI_UNKNOWN_ERROR;
+		goto cleanup;
+	}
+	locked = 1;
+
+	/* Create new KSI context. */
+	res = KSI_CTX_new(&verifier.ksi);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Unable to create context.\n");
+		goto cleanup;
+	}
+
+	res = KSI_CTX_setDefaultPubFileCertConstraints(verifier.ksi, pubFileCertConstr);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Unable to configure publications file cert constraints.\n");
+		goto cleanup;
+	}
+
+	/* Configure the logger. */
+	res = OpenLogging(verifier.ksi, "ksi_bulk_verify.log", &logFile);
+	if (res != KSI_OK) goto cleanup;
+
+	KSI_LOG_info(verifier.ksi, "Using KSI version: '%s'.", KSI_getVersion());
+
+	res = KSI_CTX_setExtender(verifier.ksi, argv[1], "anon", "anon");
+	if (res != KSI_OK) {
+		fprintf(stderr, "Unable to set extender parameters.\n");
+		goto cleanup;
+	}
+
+	res = KSI_CTX_setPublicationUrl(verifier.ksi, argv[2]);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Unable to set publications file url.\n");
+		goto cleanup;
+	}
+
+	/* The worker threads use the context together with the main thread. */
+	res = KSI_CTX_setFlag(verifier.ksi, KSI_CTX_FLAG_EXTENDED_CHAIN_CACHE, (void *)1);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Unable to enable the extended chain cache.\n");
+		goto cleanup;
+	}
+
+	res = KSI_CTX_setFlag(verifier.ksi, KSI_CTX_FLAG_SHARED, (void *)1);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Unable to share the context.\n");
+		goto cleanup;
+	}
+
+	/* Download the publications file once, before the workers need it. */
+	res = KSI_receivePublicationsFile(verifier.ksi, &pubFile);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Unable to receive publications file.\n");
+		goto cleanup;
+	}
+
+	start = GetTimeSeconds();
+
+	for (started = 0; started < workers; started++) {
+		if (WORKER_START(&threads[started], verifyWorker, &verifier) != 0) {
+			fprintf(stderr, "Unable to start worker thread.\n");
+			res = KSI_UNKNOWN_ERROR;
+			break;
+		}
+	}
+
+	/* The files are shared among the workers that were started. */
+	for (i = 0; i < started; i++) {
+		WORKER_JOIN(threads[i]);
+	}
+
+	if (started == 0) goto cleanup;
+
+	printStatistics(&verifier);
+	PrintThroughput("Verified", verifier.ok + verifier.na + verifier.fail, files.bytes, GetTimeSeconds() - start);
+
+	res = (verifier.errors == 0 && verifier.fail == 0) ? KSI_OK : KSI_VERIFICATION_FAILURE;
+
+cleanup:
+
+	DumpCounters(verifier.ksi);
+
+	if (logFile != NULL) fclose(logFile);
+
+	if (res != KSI_OK && verifier.ksi != NULL) {
+		KSI_ERR_statusDump(verifier.ksi, stderr);
+	}
+
+	if (locked) LOCK_FREE(&verifier.lock);
+	free(threads);
+	FreeFileList(&files);
+	KSI_PublicationsFile_free(pubFile);
+	KSI_CTX_free(verifier.ksi);
+
+	return res;
+}
@@ -18,9 +18,21 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <ksi/ksi.h>
 #include <ksi/policy.h>
+#include <ksi/compatibility.h>
+#include "ksi_common.h"
+
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <dirent.h>
+#  include <sys/time.h>
+#endif
 
 int OpenLogging(KSI_CTX *ksi, char *fileName, FILE **logFile) {
 	int res = KSI_UNKNOWN_ERROR;
@@ -62,8 +74,6 @@ int GetDocumentHash(char *fileName, KSI_Signature *sig, KSI_DataHash **hsh) {
 	KSI_DataHash *tmp = NULL;
 	KSI_DataHasher *hsr = NULL;
 	FILE *in = NULL;
-	unsigned char buf[1024];
-	size_t buf_len;
 
 	if (fileName == NULL || sig == NULL || hsh == NULL) {
 		res = KSI_INVALID_ARGUMENT;
@@ -81,17 +91,15 @@ int GetDocumentHash(char *fileName, KSI_Signature *sig, KSI_DataHash **hsh) {
 	in = fopen(fileName, "rb");
 	if (in == NULL) {
 		fprintf(stderr, "Unable to open data file '%s'.\n", fileName);
+		res = KSI_IO_ERROR;
 		goto cleanup;
 	}
 
-	/* Calculate the hash of the document. */
-	while (!feof(in)) {
-		buf_len = fread(buf, 1, sizeof(buf), in);
-		res = KSI_DataHasher_add(hsr, buf, buf_len);
-		if (res != KSI_OK) {
-			fprintf(stderr, "Unable hash the document.\n");
-			goto cleanup;
-		}
+	/* Calculate the hash of the document, the library reads the file in constant memory. */
+	res = KSI_DataHasher_addFile(hsr, fileno(in));
+	if (res != KSI_OK) {
+		fprintf(stderr, "Unable hash the document.\n");
+		goto cleanup;
 	}
 
 	/* Finalize the hash computation. */
@@ -152,3 +160,235 @@ cleanup:
 
 	return res;
 }
+
+int DumpCounters(KSI_CTX *ksi) {
+	int res = KSI_UNKNOWN_ERROR;
+	const char *fileName = NULL;
+	KSI_Counters *counters = NULL;
+	FILE *f = NULL;
+
+	fileName = getenv("KSI_COUNTERS_FILE");
+	if (ksi == NULL || fileName == NULL || *fileName == '\0') {
+		res = KSI_OK;
+		goto cleanup;
+	}
+
+	res = KSI_CTX_getCounters(ksi, &counters);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Unable to get the performance counters.\n");
+		goto cleanup;
+	}
+
+	if (strcmp(fileName, "-") == 0) {
+		f = stdout;
+	} else {
+		f = fopen(fileName, "w");
+		if (f == NULL) {
+			fprintf(stderr, "Unable to open counters file '%s'.\n", fileName);
+			res = KSI_IO_ERROR;
+			goto cleanup;
+		}
+	}
+
+	res = KSI_Counters_writePrometheus(counters, f);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Unable to write the performance counters.\n");
+		goto cleanup;
+	}
+
+cleanup:
+
+	if (f != NULL && f != stdout) fclose(f);
+	KSI_Counters_free(counters);
+
+	return res;
+}
+
+static int appendFile(FileList *list, const char *name, KSI_uint64_t size) {
+	int res = KSI_UNKNOWN_ERROR;
+	size_t len = strlen(name);
+	char *tmp = NULL;
+
+	/* Skip the signature files of earlier runs. */
+	if (len >= 5 && strcmp(name + len - 5, ".ksig") == 0) {
+		res = KSI_OK;
+		goto cleanup;
+	}
+
+	if (list->names_len == list->names_size) {
+		size_t size = list->names_size == 0 ? 64 : list->names_size * 2;
+		char **names = realloc(list->names, size * sizeof(char *));
+		if (names == NULL) {
+			res = KSI_OUT_OF_MEMORY;
+			goto cleanup;
+		}
+		list->names = names;
+		list->names_size = size;
+	}
+
+	tmp = malloc(len + 1);
+	if (tmp == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+	memcpy(tmp, name, len + 1);
+
+	list->names[list->names_len++] = tmp;
+	list->bytes += size;
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+int CollectFiles(FileList *list, const char *path) {
+	int res = KSI_UNKNOWN_ERROR;
+	struct stat st;
+	char sub[4096];
+#ifdef _WIN32
+	HANDLE dir = INVALID_HANDLE_VALUE;
+	WIN32_FIND_DATAA entry;
+#else
+	DIR *dir = NULL;
+	struct dirent *entry = NULL;
+#endif
+
+	if (list == NULL || path == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	if (stat(path, &st) != 0) {
+		fprintf(stderr, "%s: Unable to access file.\n", path);
+		res = KSI_IO_ERROR;
+		goto cleanup;
+	}
+
+	if ((st.st_mode & S_IFMT) != S_IFDIR) {
+		res = appendFile(list, path, (KSI_uint64_t)st.st_size);
+		goto cleanup;
+	}
+
+#ifdef _WIN32
+	KSI_snprintf(sub, sizeof(sub), "%s\\*", path);
+	dir = FindFirstFileA(sub, &entry);
+	if (dir == INVALID_HANDLE_VALUE) {
+		fprintf(stderr, "%s: Unable to open directory.\n", path);
+		res = KSI_IO_ERROR;
+		goto cleanup;
+	}
+
+	do {
+		if (strcmp(entry.cFileName, ".") == 0 || strcmp(entry.cFileName, "..") == 0) continue;
+
+		KSI_snprintf(sub, sizeof(sub), "%s\\%s", path, entry.cFileName);
+		res = CollectFiles(list, sub);
+		if (res != KSI_OK) goto cleanup;
+	} while (FindNextFileA(dir, &entry));
+#else
+	dir = opendir(path);
+	if (dir == NULL) {
+		fprintf(stderr, "%s: Unable to open directory.\n", path);
+		res = KSI_IO_ERROR;
+		goto cleanup;
+	}
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+		KSI_snprintf(sub, sizeof(sub), "%s/%s", path, entry->d_name);
+		res = CollectFiles(list, sub);
+		if (res != KSI_OK) goto cleanup;
+	}
+#endif
+
+	res = KSI_OK;
+
+cleanup:
+
+#ifdef _WIN32
+	if (dir != INVALID_HANDLE_VALUE) FindClose(dir);
+#else
+	if (dir != NULL) closedir(dir);
+#endif
+
+	return res;
+}
+
+int CollectFilesFromList(FileList *list, const char *fileName) {
+	int res = KSI_UNKNOWN_ERROR;
+	FILE *f = NULL;
+	char line[4096];
+
+	if (list == NULL || fileName == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	f = fopen(fileName, "r");
+	if (f == NULL) {
+		fprintf(stderr, "%s: Unable to open file list.\n", fileName);
+		res = KSI_IO_ERROR;
+		goto cleanup;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		size_t len = strlen(line);
+
+		/* Strip the line ending. */
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+		if (len == 0) continue;
+
+		res = CollectFiles(list, line);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	if (f != NULL) fclose(f);
+
+	return res;
+}
+
+void FreeFileList(FileList *list) {
+	size_t i;
+
+	if (list == NULL) return;
+
+	for (i = 0; i < list->names_len; i++) {
+		free(list->names[i]);
+	}
+	free(list->names);
+
+	memset(list, 0, sizeof(FileList));
+}
+
+double GetTimeSeconds(void) {
+#ifdef _WIN32
+	LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+
+	return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return (double)now.tv_sec + (double)now.tv_usec / 1000000.0;
+#endif
+}
+
+void PrintThroughput(const char *action, size_t files, KSI_uint64_t bytes, double seconds) {
+	if (seconds <= 0) seconds = 1e-6;
+
+	printf("%s %lu files (%.1f MiB) in %.3f s: %.1f files/s, %.1f MiB/s.\n",
+			action, (unsigned long)files, (double)bytes / (1 << 20), seconds,
+			(double)files / seconds, (double)bytes / (1 << 20) / seconds);
+}
@@ -60,6 +60,70 @@ int GetDocumentHash(char *fileName, KSI_Signature *sig, KSI_DataHash **hsh);
  */
 int PrintVerificationInfo(KSI_PolicyVerificationResult *result);
 
+/**
+ * Writes the performance counters of the context in the Prometheus text format to the file
+ * named by the environment variable \c KSI_COUNTERS_FILE, or to the standard output if the
+ * value is "-". Does nothing if the variable is not set.
+ * \param[in]		ksi			KSI context.
+ *
+ * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+ */
+int DumpCounters(KSI_CTX *ksi);
+
+/**
+ * A growing list of file names.
+ */
+typedef struct FileList_st {
+	/** File names. */
+	char **names;
+	/** Number of file names. */
+	size_t names_len;
+	/** Allocated size of \c names. */
+	size_t names_size;
+	/** Total size of the files in bytes. */
+	KSI_uint64_t bytes;
+} FileList;
+
+/**
+ * Adds the file or, for a directory, all the files in the directory tree to the list.
+ * Signature files (with the extension ".ksig") are skipped.
+ * \param[in]		list		File list, initialized with zeros.
+ * \param[in]		path		Name of the file or directory.
+ *
+ * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+ */
+int CollectFiles(FileList *list, const char *path);
+
+/**
+ * Adds the files and directory trees named on the lines of the given file to the list.
+ * \param[in]		list		File list, initialized with zeros.
+ * \param[in]		fileName	Name of the file containing the list.
+ *
+ * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+ * \see #CollectFiles
+ */
+int CollectFilesFromList(FileList *list, const char *fileName);
+
+/**
+ * Releases the names of the list and resets it.
+ * \param[in]		list		File list.
+ */
+void FreeFileList(FileList *list);
+
+/**
+ * Returns the wall clock time in seconds with a sub-millisecond resolution.
+ */
+double GetTimeSeconds(void);
+
+/**
+ * Prints the number of processed files and bytes per second.
+ * \param[in]		action		Description of the processing, e.g. "Signed".
+ * \param[in]		files		Number of processed files.
+ * \param[in]		bytes		Number of processed bytes.
+ * \param[in]		seconds		Time spent.
+ */
+void PrintThroughput(const char *action, size_t files, KSI_uint64_t bytes, double seconds);
+
 #ifdef __cplusplus
 }
 #endif
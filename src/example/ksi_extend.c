@@ -135,6 +135,8 @@ int main(int argc, char **argv) {
 
 cleanup:
 
+	DumpCounters(ksi);
+
 	if (logFile != NULL) fclose(logFile);
 	if (out != NULL) fclose(out);
 	KSI_Signature_free(sig);
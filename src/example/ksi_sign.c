@@ -28,19 +28,14 @@ int main(int argc, char **argv) {
 	KSI_CTX *ksi = NULL;
 	int res = KSI_UNKNOWN_ERROR;
 
-	FILE *in = NULL;
 	FILE *out = NULL;
 
-	KSI_DataHasher *hsr = NULL;
 	KSI_DataHash *hsh = NULL;
 	KSI_Signature *sign = NULL;
 
 	unsigned char *raw = NULL;
 	size_t raw_len;
 
-	unsigned char buf[1024];
-	size_t buf_len;
-
 	char *signerIdentity = NULL;
 
 	FILE *logFile = NULL;
@@ -59,14 +54,6 @@ int main(int argc, char **argv) {
 		goto cleanup;
 	}
 
-	/* Input file */
-	in = fopen(argv[1], "rb");
-	if (in == NULL) {
-		fprintf(stderr, "Unable to open input file '%s'\n", argv[1]);
-		res = KSI_IO_ERROR;
-		goto cleanup;
-	}
-
 	/* Create new KSI context for this thread. */
 	res = KSI_CTX_new(&ksi);
 	if (res != KSI_OK) {
@@ -97,29 +84,10 @@ int main(int argc, char **argv) {
 		goto cleanup;
 	}
 
-	/* Create a data hasher using default algorithm. */
-	res = KSI_DataHasher_open(ksi, KSI_getHashAlgorithmByName("default"), &hsr);
+	/* Calculate the hash of the input file using the default algorithm. */
+	res = KSI_DataHash_createFromFile(ksi, argv[1], KSI_getHashAlgorithmByName("default"), &hsh);
 	if (res != KSI_OK) {
-		fprintf(stderr, "Unable to create hasher.\n");
-		goto cleanup;
-	}
-
-	/* Read the input file and calculate the hash of its contents. */
-	while (!feof(in)) {
-		buf_len = fread(buf, 1, sizeof(buf), in);
-
-		/* Add  next block to the calculation. */
-		res = KSI_DataHasher_add(hsr, buf, buf_len);
-		if (res != KSI_OK) {
-			fprintf(stderr, "Unable to add data to hasher.\n");
-			goto cleanup;
-		}
-	}
-
-	/* Close the data hasher and retreive the data hash. */
-	res = KSI_DataHasher_close(hsr, &hsh);
-	if (res != KSI_OK) {
-		fprintf(stderr, "Unable to create hash.\n");
+		fprintf(stderr, "Unable to hash input file '%s'.\n", argv[1]);
 		goto cleanup;
 	}
 
@@ -175,20 +143,20 @@ int main(int argc, char **argv) {
 
 cleanup:
 
+	DumpCounters(ksi);
+
 	if (logFile != NULL) fclose(logFile);
 
 	if (res != KSI_OK && ksi != NULL) {
 		KSI_ERR_statusDump(ksi, stderr);
 	}
 
-	if (in != NULL) fclose(in);
 	if (out != NULL) fclose(out);
 
 	KSI_free(signerIdentity);
 
 	KSI_Signature_free(sign);
 	KSI_DataHash_free(hsh);
-	KSI_DataHasher_free(hsr);
 
 	KSI_free(raw);
 
@@ -145,6 +145,8 @@ int main(int argc, char **argv) {
 
 cleanup:
 
+	DumpCounters(ksi);
+
 	if (logFile != NULL) fclose(logFile);
 	if (res != KSI_OK && ksi != NULL) {
 		KSI_ERR_statusDump(ksi, stderr);
@@ -27,6 +27,7 @@
 #include "ctx_impl.h"
 #include "pkitruststore.h"
 #include "policy.h"
+#include "counters_impl.h"
 
 KSI_IMPLEMENT_LIST(GlobalCleanupFn, NULL);
 
@@ -200,16 +201,41 @@ int KSI_CTX_new(KSI_CTX **context) {
 	ctx->requestHeaderCB = NULL;
 	ctx->flags[KSI_CTX_FLAG_AGGR_PDU_VER] = KSI_AGGREGATION_PDU_VERSION;
 	ctx->flags[KSI_CTX_FLAG_EXT_PDU_VER] = KSI_EXTENDING_PDU_VERSION;
+	ctx->flags[KSI_CTX_FLAG_SHARED] = 0;
+	ctx->flags[KSI_CTX_FLAG_EXTENDED_CHAIN_CACHE] = 0;
+	ctx->flags[KSI_CTX_FLAG_MAP_FILES] = 0;
 	ctx->loggerCtx = NULL;
+	ctx->traceCB = NULL;
+	ctx->traceCtx = NULL;
 	ctx->certConstraints = NULL;
 	ctx->freeCertConstraintsArray = freeCertConstraintsArray;
 	ctx->lastFailedSignature = NULL;
+	ctx->rootCache = NULL;
+	ctx->extChainCache = NULL;
+	memset(ctx->policyPrograms, 0, sizeof(ctx->policyPrograms));
+	memset(ctx->policyCacheRules, 0, sizeof(ctx->policyCacheRules));
+	memset(ctx->policyCachePrograms, 0, sizeof(ctx->policyCachePrograms));
+	ctx->threadState = NULL;
+	ctx->lock = NULL;
+	ctx->pubFileCond = NULL;
+	ctx->pubFileLoading = 0;
+	ctx->counters = NULL;
+	ctx->countersLock = NULL;
 	KSI_ERR_clearErrors(ctx);
 
 	/* Create global cleanup list as the first thing. */
 	res = KSI_List_new(NULL, &ctx->cleanupFnList);
 	if (res != KSI_OK) goto cleanup;
 
+	res = KSI_CalendarRootCache_new(ctx, &ctx->rootCache);
+	if (res != KSI_OK) goto cleanup;
+
+	ctx->counters = KSI_Counters_new();
+	if (ctx->counters == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
 	/* Create and set the logger. */
 	res = KSI_CTX_setLoggerCallback(ctx, KSI_LOG_StreamLogger, stdout);
 	if (res != KSI_OK) goto cleanup;
@@ -299,6 +325,8 @@ static void globalCleanup(KSI_CTX *ctx) {
  *
  */
 void KSI_CTX_free(KSI_CTX *ctx) {
+	size_t i;
+
 	if (ctx != NULL) {
 		/* Call cleanup methods. */
 		globalCleanup(ctx);
@@ -315,6 +343,23 @@ void KSI_CTX_free(KSI_CTX *ctx) {
 
 		freeCertConstraintsArray(ctx->certConstraints);
 		KSI_Signature_free(ctx->lastFailedSignature);
+		KSI_CalendarRootCache_free(ctx->rootCache);
+		KSI_ExtendedChainCache_free(ctx->extChainCache);
+		for (i = 0; i < POLICY_NUM_OF_PREDEFINED; i++) {
+			PolicyProgram_free(ctx->policyPrograms[i]);
+		}
+		for (i = 0; i < POLICY_NUM_OF_CACHED; i++) {
+			PolicyProgram_free(ctx->policyCachePrograms[i]);
+		}
+		KSI_ThreadLocal_free(ctx->threadState);
+		KSI_Cond_free(ctx->pubFileCond);
+		KSI_Mutex_free(ctx->lock);
+		KSI_Mutex_free(ctx->countersLock);
+		while (ctx->counters != NULL) {
+			KSI_Counters *next = ctx->counters->next;
+			KSI_Counters_free(ctx->counters);
+			ctx->counters = next;
+		}
 
 		KSI_free(ctx);
 	}
@@ -414,6 +459,7 @@ int KSI_receivePublicationsFile(KSI_CTX *ctx, KSI_PublicationsFile **pubFile) {
 	const unsigned char *raw = NULL;
 	size_t raw_len = 0;
 	KSI_PublicationsFile *tmp = NULL;
+	int loading = 0;
 
 	KSI_ERR_clearErrors(ctx);
 	if (ctx == NULL || pubFile == NULL) {
@@ -421,8 +467,21 @@ int KSI_receivePublicationsFile(KSI_CTX *ctx, KSI_PublicationsFile **pubFile) {
 		goto cleanup;
 	}
 
-	/* TODO! Implement mechanism for reloading (e.g cache timeout) */
+	/* A shared context loads the publications file only once. The download is done without
+	 * holding the lock, the other threads needing the file wait for it to finish. */
+	KSI_Mutex_lock(ctx->lock);
+	while (ctx->publicationsFile == NULL && ctx->pubFileLoading) {
+		KSI_Cond_wait(ctx->pubFileCond, ctx->lock);
+	}
 	if (ctx->publicationsFile == NULL) {
+		ctx->pubFileLoading = loading = 1;
+	} else {
+		*pubFile = KSI_PublicationsFile_ref(ctx->publicationsFile);
+	}
+	KSI_Mutex_unlock(ctx->lock);
+
+	/* TODO! Implement mechanism for reloading (e.g cache timeout) */
+	if (loading) {
 		KSI_LOG_debug(ctx, "Receiving publications file.");
 
 		res = KSI_sendPublicationRequest(ctx, NULL, 0, &handle);
@@ -449,18 +508,31 @@ int KSI_receivePublicationsFile(KSI_CTX *ctx, KSI_PublicationsFile **pubFile) {
 			goto cleanup;
 		}
 
-		ctx->publicationsFile = tmp;
-		tmp = NULL;
+		KSI_Mutex_lock(ctx->lock);
+		/* The file may have been set meanwhile with #KSI_CTX_setPublicationsFile. */
+		if (ctx->publicationsFile == NULL) {
+			ctx->publicationsFile = tmp;
+			tmp = NULL;
+			KSI_CalendarRootCache_invalidate(ctx->rootCache);
+		}
+		*pubFile = KSI_PublicationsFile_ref(ctx->publicationsFile);
+		KSI_Mutex_unlock(ctx->lock);
 
 		KSI_LOG_debug(ctx, "Publications file received.");
 	}
 
-	*pubFile = KSI_PublicationsFile_ref(ctx->publicationsFile);
-
 	res = KSI_OK;
 
 cleanup:
 
+	/* On failure, one of the waiting threads tries again. */
+	if (loading) {
+		KSI_Mutex_lock(ctx->lock);
+		ctx->pubFileLoading = 0;
+		KSI_Cond_broadcast(ctx->pubFileCond);
+		KSI_Mutex_unlock(ctx->lock);
+	}
+
 	KSI_RequestHandle_free(handle);
 	KSI_PublicationsFile_free(tmp);
 
@@ -510,8 +582,8 @@ static int KSI_SignatureVerifier_verifySignature(KSI_Signature *sig, KSI_CTX *ct
 
 	context.signature = sig;
 	context.documentHash = hsh;
-
-	res = KSI_SignatureVerifier_verify(KSI_VERIFICATION_POLICY_GENERAL, &context, &result);
+	/* Only the final result is used. */
+	res = KSI_SignatureVerifier_verifyWithDetail(KSI_VERIFICATION_POLICY_GENERAL, &context, KSI_VER_DETAIL_POLICIES, &result);
 	if (res != KSI_OK) {
 		KSI_pushError(ctx, res, "Signature verification aborted due to an error.");
 		goto cleanup;
@@ -685,8 +757,144 @@ cleanup:
 	return res;
 }
 
+static void CtxThreadState_free(void *p) {
+	CtxThreadState *state = p;
+
+	if (state != NULL) {
+		KSI_Signature_free(state->lastFailedSignature);
+		KSI_free(state);
+	}
+}
+
+static CtxThreadState *getThreadState(KSI_ThreadLocal *threadState) {
+	CtxThreadState *state = NULL;
+
+	state = KSI_ThreadLocal_get(threadState);
+	if (state == NULL) {
+		state = KSI_new(CtxThreadState);
+		if (state == NULL) return NULL;
+
+		state->errors_count = 0;
+		state->lastFailedSignature = NULL;
+		state->counters = NULL;
+
+		if (KSI_ThreadLocal_set(threadState, state) != KSI_OK) {
+			CtxThreadState_free(state);
+			return NULL;
+		}
+	}
+
+	return state;
+}
+
+/* Returns the error stack of the calling thread, or NULL if it is not available. */
+static KSI_ERR *getErrors(KSI_CTX *ctx, size_t **count) {
+	CtxThreadState *state = NULL;
+
+	if (ctx->threadState == NULL) {
+		*count = &ctx->errors_count;
+		return ctx->errors;
+	}
+
+	state = getThreadState(ctx->threadState);
+	if (state == NULL) return NULL;
+
+	*count = &state->errors_count;
+	return state->errors;
+}
+
+KSI_Signature **KSI_CTX_lastFailedSignature(KSI_CTX *ctx) {
+	CtxThreadState *state = NULL;
+
+	if (ctx == NULL) return NULL;
+	if (ctx->threadState == NULL) return &ctx->lastFailedSignature;
+
+	state = getThreadState(ctx->threadState);
+	return state != NULL ? &state->lastFailedSignature : NULL;
+}
+
+KSI_Counters *KSI_CTX_counters(KSI_CTX *ctx) {
+	CtxThreadState *state = NULL;
+	KSI_Counters *counters = NULL;
+
+	if (ctx == NULL) return NULL;
+	if (ctx->threadState == NULL) return ctx->counters;
+
+	state = getThreadState(ctx->threadState);
+	if (state == NULL) return NULL;
+
+	if (state->counters == NULL) {
+		counters = KSI_Counters_new();
+		if (counters == NULL) return NULL;
+
+		/* The counters are owned by the context, so the values are kept after the thread exits. */
+		KSI_Mutex_lock(ctx->countersLock);
+		counters->next = ctx->counters;
+		ctx->counters = counters;
+		KSI_Mutex_unlock(ctx->countersLock);
+
+		state->counters = counters;
+	}
+
+	return state->counters;
+}
+
+static int setShared(KSI_CTX *ctx) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_ThreadLocal *threadState = NULL;
+	KSI_Mutex *lock = NULL;
+	KSI_Mutex *countersLock = NULL;
+	KSI_Cond *pubFileCond = NULL;
+	CtxThreadState *state = NULL;
+
+	res = KSI_Mutex_new(ctx, &lock);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Mutex_new(ctx, &countersLock);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Cond_new(ctx, &pubFileCond);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_ThreadLocal_new(ctx, CtxThreadState_free, &threadState);
+	if (res != KSI_OK) goto cleanup;
+
+	/* The state of the calling thread receives the last failed signature. */
+	state = getThreadState(threadState);
+	if (state == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	/* Nothing below can fail, so the context is only modified once it can be fully shared. */
+	state->lastFailedSignature = ctx->lastFailedSignature;
+	ctx->lastFailedSignature = NULL;
+
+	ctx->lock = lock;
+	lock = NULL;
+	ctx->countersLock = countersLock;
+	countersLock = NULL;
+	ctx->pubFileCond = pubFileCond;
+	pubFileCond = NULL;
+	ctx->threadState = threadState;
+	threadState = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_ThreadLocal_free(threadState);
+	KSI_Cond_free(pubFileCond);
+	KSI_Mutex_free(countersLock);
+	KSI_Mutex_free(lock);
+
+	return res;
+}
+
 void KSI_ERR_push(KSI_CTX *ctx, int statusCode, long extErrorCode, const char *fileName, unsigned int lineNr, const char *message) {
 	KSI_ERR *ctxErr = NULL;
+	KSI_ERR *errors = NULL;
+	size_t *count = NULL;
 	const char *tmp = NULL;
 
 	/* Do nothing if the context is missing. */
@@ -695,8 +903,11 @@ void KSI_ERR_push(KSI_CTX *ctx, int statusCode, long extErrorCode, const char *f
 	/* Do nothing if there's no error. */
 	if (statusCode == KSI_OK) return;
 
+	errors = getErrors(ctx, &count);
+	if (errors == NULL) return;
+
 	/* Get the error container to use for storage. */
-	ctxErr = &ctx->errors[ctx->errors_count % ctx->errors_size];
+	ctxErr = &errors[*count % ctx->errors_size];
 
 	ctxErr->statusCode = statusCode;
 	ctxErr->extErrorCode = extErrorCode;
@@ -706,18 +917,22 @@ void KSI_ERR_push(KSI_CTX *ctx, int statusCode, long extErrorCode, const char *f
 	tmp = KSI_strnvl(message);
 	KSI_strncpy(ctxErr->message, tmp, sizeof(ctxErr->message));
 
-	ctx->errors_count++;
+	(*count)++;
 }
 
 void KSI_ERR_clearErrors(KSI_CTX *ctx) {
-	if (ctx != NULL) {
-		ctx->errors_count = 0;
+	size_t *count = NULL;
+
+	if (ctx != NULL && getErrors(ctx, &count) != NULL) {
+		*count = 0;
 	}
 }
 
 static int ksi_err_toPrinter(KSI_CTX *ctx, void *to, size_t buf_len, void* (*printer)(void *to, size_t to_len, size_t *count, const char *format, ...)) {
 	int res = KSI_UNKNOWN_ERROR;
 	KSI_ERR *err = NULL;
+	KSI_ERR *errors = NULL;
+	size_t *errors_count = NULL;
 	size_t i;
 	size_t count = 0;
 	void *nextWrite = to;
@@ -727,21 +942,27 @@ static int ksi_err_toPrinter(KSI_CTX *ctx, void *to, size_t buf_len, void* (*pri
 		goto cleanup;
 	}
 
+	errors = getErrors(ctx, &errors_count);
+	if (errors == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
 	nextWrite = printer(nextWrite, buf_len - count, &count, "KSI error trace:\n");
-	if (ctx->errors_count == 0) {
+	if (*errors_count == 0) {
 		nextWrite = printer(nextWrite, buf_len - count, &count, "No errors.\n");
 		res = KSI_OK;
 		goto cleanup;
 	}
 
 	/* List all errors, starting from the most general. */
-	for (i = 0; i < ctx->errors_count && i < ctx->errors_size; i++) {
-		err = ctx->errors + ((ctx->errors_count - i - 1) % ctx->errors_size);
-		nextWrite = printer(nextWrite, buf_len - count, &count, "  %3lu) %s:%u - (%d/%ld) %s\n", ctx->errors_count - i, err->fileName, err->lineNr,err->statusCode, err->extErrorCode, *err->message != '\0' ? err->message : KSI_getErrorString(err->statusCode));
+	for (i = 0; i < *errors_count && i < ctx->errors_size; i++) {
+		err = errors + ((*errors_count - i - 1) % ctx->errors_size);
+		nextWrite = printer(nextWrite, buf_len - count, &count, "  %3lu) %s:%u - (%d/%ld) %s\n", *errors_count - i, err->fileName, err->lineNr,err->statusCode, err->extErrorCode, *err->message != '\0' ? err->message : KSI_getErrorString(err->statusCode));
 	}
 
 	/* If there where more errors than buffers for the errors, indicate the fact */
-	if (ctx->errors_count > ctx->errors_size) {
+	if (*errors_count > ctx->errors_size) {
 		printer(nextWrite, buf_len - count, &count, "  ... (more errors)\n");
 	}
 
@@ -782,14 +1003,18 @@ char *KSI_ERR_toString(KSI_CTX *ctx, char *buf, size_t buf_len) {
 
 int KSI_ERR_getBaseErrorMessage(KSI_CTX *ctx, char *buf, size_t len, int *error, int *ext){
 	KSI_ERR *err = NULL;
+	size_t *count = NULL;
 
 	if (ctx == NULL || buf == NULL){
 		return KSI_INVALID_ARGUMENT;
 	}
 
-	err = ctx->errors;
+	err = getErrors(ctx, &count);
+	if (err == NULL) {
+		return KSI_OUT_OF_MEMORY;
+	}
 
-	if (ctx->errors_count) {
+	if (*count) {
 		KSI_strncpy(buf, err->message, len);
 		if (error != NULL)	*error = err->statusCode;
 		if (ext != NULL)	*ext = err->extErrorCode;
@@ -803,10 +1028,16 @@ int KSI_ERR_getBaseErrorMessage(KSI_CTX *ctx, char *buf, size_t len, int *error,
 }
 
 void *KSI_malloc(size_t size) {
+#ifdef KSI_ALLOC_COUNTERS
+	KSI_Counters_addAllocation(size);
+#endif
 	return malloc(size);
 }
 
 void *KSI_calloc(size_t num, size_t size) {
+#ifdef KSI_ALLOC_COUNTERS
+	KSI_Counters_addAllocation(num * size);
+#endif
 	return calloc(num, size);
 }
 
@@ -854,7 +1085,10 @@ int KSI_CTX_setAggregator(KSI_CTX *ctx, const char *uri, const char *loginId, co
 }
 
 int KSI_CTX_setExtender(KSI_CTX *ctx, const char *uri, const char *loginId, const char *key){
-	return KSI_CTX_setUri(ctx, uri, loginId, key, KSI_UriClient_setExtender);
+	int res = KSI_CTX_setUri(ctx, uri, loginId, key, KSI_UriClient_setExtender);
+	/* Chains received from the previous extender must not be reused. */
+	if (res == KSI_OK) KSI_ExtendedChainCache_invalidate(ctx->extChainCache);
+	return res;
 }
 
 int KSI_CTX_setPublicationUrl(KSI_CTX *ctx, const char *uri){
@@ -870,6 +1104,44 @@ int KSI_CTX_setFlag(KSI_CTX *ctx, enum KSI_CtxFlag flag, void *param)
 		goto cleanup;
 	}
 
+	if (flag == KSI_CTX_FLAG_SHARED) {
+		if ((size_t)param > 1 || ((size_t)param == 0 && ctx->threadState != NULL)) {
+			KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, "A shared context can not be turned back to unshared.");
+			goto cleanup;
+		}
+
+		if ((size_t)param == 1 && ctx->threadState == NULL) {
+			res = setShared(ctx);
+			if (res != KSI_OK) {
+				KSI_pushError(ctx, res, NULL);
+				goto cleanup;
+			}
+		}
+	}
+
+	if (flag == KSI_CTX_FLAG_EXTENDED_CHAIN_CACHE) {
+		if ((size_t)param > 1) {
+			KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
+			goto cleanup;
+		}
+
+		if ((size_t)param == 1 && ctx->extChainCache == NULL) {
+			res = KSI_ExtendedChainCache_new(ctx, &ctx->extChainCache);
+			if (res != KSI_OK) {
+				KSI_pushError(ctx, res, NULL);
+				goto cleanup;
+			}
+		} else if ((size_t)param == 0) {
+			KSI_ExtendedChainCache_free(ctx->extChainCache);
+			ctx->extChainCache = NULL;
+		}
+	}
+
+	if (flag == KSI_CTX_FLAG_MAP_FILES && (size_t)param > 1) {
+		KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
+		goto cleanup;
+	}
+
 	ctx->flags[flag] = (size_t)param;
 
 	res = KSI_OK;
@@ -928,6 +1200,8 @@ int KSI_CTX_set##nam(KSI_CTX *ctx, typ *var) { 												\
 		fre(ctx->var);																		\
 	}																						\
 	ctx->var = var;																			\
+	/* Roots proven with the previous trust settings must be proven again. */				\
+	KSI_CalendarRootCache_invalidate(ctx->rootCache);										\
 	res = KSI_OK;																			\
 cleanup:																					\
 	return res;																				\
@@ -955,6 +1229,7 @@ CTX_GET_SET_VALUE(publicationsFile, PublicationsFile, KSI_PublicationsFile, KSI_
 
 int KSI_CTX_getLastFailedSignature(KSI_CTX *ctx, KSI_Signature **lastFailedSignature) {
 	int res = KSI_UNKNOWN_ERROR;
+	KSI_Signature **slot = NULL;
 
 	if (ctx == NULL || lastFailedSignature == NULL) {
 		res = KSI_INVALID_ARGUMENT;
@@ -963,7 +1238,13 @@ int KSI_CTX_getLastFailedSignature(KSI_CTX *ctx, KSI_Signature **lastFailedSigna
 
 	KSI_ERR_clearErrors(ctx);
 
-	*lastFailedSignature = KSI_Signature_ref(ctx->lastFailedSignature);
+	slot = KSI_CTX_lastFailedSignature(ctx);
+	if (slot == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	*lastFailedSignature = KSI_Signature_ref(*slot);
 
 	res = KSI_OK;
 
@@ -975,12 +1256,17 @@ cleanup:
 int KSI_CTX_getPKITruststore(KSI_CTX *ctx, KSI_PKITruststore **pki) {
 	int res = KSI_UNKNOWN_ERROR;
 	KSI_PKITruststore *pkiTruststore = NULL;
+	int locked = 0;
 
 	if (ctx == NULL || pki == NULL){
 		res = KSI_INVALID_ARGUMENT;
 		goto cleanup;
 	}
 
+	/* A shared context creates the default truststore only once. */
+	KSI_Mutex_lock(ctx->lock);
+	locked = 1;
+
 	/* In case the PKI truststore is not available, create a default */
 	if (ctx->pkiTruststore == NULL) {
 		/* Create and set the PKI truststore */
@@ -995,6 +1281,7 @@ int KSI_CTX_getPKITruststore(KSI_CTX *ctx, KSI_PKITruststore **pki) {
 	res = KSI_OK;
 
 cleanup:
+	if (locked) KSI_Mutex_unlock(ctx->lock);
 	KSI_PKITruststore_free(pkiTruststore);
 
 	return res;
@@ -1015,6 +1302,7 @@ int KSI_CTX_setNetworkProvider(KSI_CTX *ctx, KSI_NetworkClient *netProvider){
 
 	ctx->netProvider = netProvider;
 	ctx->isCustomNetProvider = 1;
+	KSI_ExtendedChainCache_invalidate(ctx->extChainCache);
 	res = KSI_OK;
 
 cleanup:
@@ -1055,6 +1343,23 @@ cleanup:
 	return res;
 }
 
+int KSI_CTX_setTraceCallback(KSI_CTX *ctx, KSI_TraceCallback cb, void *traceCtx) {
+	int res = KSI_UNKNOWN_ERROR;
+	if (ctx == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	ctx->traceCB = cb;
+	ctx->traceCtx = traceCtx;
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
 
 int KSI_CTX_setPublicationCertEmail(KSI_CTX *ctx, const char *email) {
 	int res = KSI_UNKNOWN_ERROR;
@@ -1148,6 +1453,7 @@ int KSI_CTX_setDefaultPubFileCertConstraints(KSI_CTX *ctx, const KSI_CertConstra
 
 	/* Free the existing constraints. */
 	freeCertConstraintsArray(ctx->certConstraints);
+	KSI_CalendarRootCache_invalidate(ctx->rootCache);
 
 	ctx->certConstraints = tmp;
 	tmp = NULL;
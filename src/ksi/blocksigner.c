@@ -21,9 +21,16 @@
 #ifndef BLOCKSIGNER_C_
 #define BLOCKSIGNER_C_
 
+#include <string.h>
+
 #include "internal.h"
 #include "blocksigner.h"
 #include "tree_builder.h"
+#include "thread.h"
+#include "ctx_impl.h"
+
+/* For optimization reasons, we need need access to KSI_DataHasher->closeExisting() function. */
+#include "hash_impl.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,6 +38,23 @@ extern "C" {
 
 KSI_IMPLEMENT_LIST(KSI_BlockSignerHandle, KSI_BlockSignerHandle_free);
 
+/* Number of leafs the mask stage may run ahead of the tree. */
+#define MASK_QUEUE_LEN 1024
+
+/* A leaf in the queue of the mask stage, the digests are stored inline. */
+typedef struct MaskSlot_st {
+	/* Imprint of the input hash value. */
+	unsigned char hash[KSI_MAX_IMPRINT_LEN];
+	size_t hash_len;
+	/* Level of the input hash value. */
+	unsigned char level;
+	/* Imprints of the mask and of the masked leaf in the tree, set by the mask stage. */
+	unsigned char mask[KSI_MAX_IMPRINT_LEN];
+	size_t mask_len;
+	unsigned char leaf[KSI_MAX_IMPRINT_LEN];
+	size_t leaf_len;
+} MaskSlot;
+
 
 struct KSI_BlockSigner_st {
 	KSI_CTX *ctx;
@@ -45,6 +69,44 @@ struct KSI_BlockSigner_st {
 
 	KSI_TreeBuilderLeafProcessor metaDataProcessor;
 	KSI_TreeBuilderLeafProcessor maskingProcessor;
+
+	/* The mask stage. The masks form a chain over the input hash values, which does not
+	 * depend on the tree, so on a shared context the chain is computed by a separate thread
+	 * while the calling thread builds the tree. Otherwise it is computed on demand. The
+	 * hasher, the output hash and the buffer are used only by the stage. */
+	KSI_DataHasher *maskHsr;
+	KSI_DataHash *maskOut;
+
+	/* Input of the mask: the imprint of the previous leaf, right aligned in the first
+	 * #KSI_MAX_IMPRINT_LEN bytes, followed by the IV, which is copied in once. */
+	unsigned char *maskBuf;
+	size_t maskPrev_len;
+	size_t maskIv_len;
+
+	/* Ring of the queued leafs, the handles of the leafs are in the same order in \c leafList. */
+	MaskSlot *maskQueue;
+	KSI_Thread *maskTask;
+	KSI_Mutex *maskLock;
+	KSI_Cond *maskCond;
+	/* Guarded by \c maskLock while the thread is running. */
+	size_t maskQueued;
+	size_t maskDone;
+	int maskIdle;
+	int maskStop;
+	int maskResult;
+	/* Used only by the calling thread. */
+	size_t maskInserted;
+	size_t maskSynced;
+	const MaskSlot *maskSlot;
+
+	/* State of the background signing task started by #KSI_BlockSigner_closeAsync. */
+	KSI_Thread *signTask;
+	KSI_CTX *signCtx;
+	KSI_DataHash *signRoot;
+	unsigned signLevel;
+	unsigned char *signRaw;
+	size_t signRaw_len;
+	int signResult;
 };
 
 struct KSI_BlockSignerHandle_st {
@@ -52,14 +114,22 @@ struct KSI_BlockSignerHandle_st {
 	size_t ref;
 	KSI_TreeLeafHandle *leafHandle;
 	KSI_BlockSigner *signer;
+	/* Input of a masked leaf, until it is added to the tree. */
+	KSI_DataHash *hash;
+	KSI_MetaData *metaData;
+	int level;
 };
 
+static int finishAsyncSign(KSI_BlockSigner *signer);
+
 static KSI_DEFINE_REF(KSI_BlockSignerHandle);
 static KSI_IMPLEMENT_REF(KSI_BlockSignerHandle);
 
 void KSI_BlockSignerHandle_free(KSI_BlockSignerHandle *handle) {
-	if (handle != NULL && --handle->ref == 0) {
+	if (handle != NULL && KSI_REF_DECREMENT(handle) == 0) {
 		KSI_TreeLeafHandle_free(handle->leafHandle);
+		KSI_DataHash_free(handle->hash);
+		KSI_MetaData_free(handle->metaData);
 		KSI_free(handle);
 	}
 }
@@ -82,6 +152,9 @@ static int KSI_BlockSignerHandle_new(KSI_CTX *ctx, KSI_BlockSignerHandle **out)
 	tmp->ctx = ctx;
 	tmp->leafHandle = NULL;
 	tmp->signer = NULL;
+	tmp->hash = NULL;
+	tmp->metaData = NULL;
+	tmp->level = 0;
 	tmp->ref = 1;
 
 	*out = tmp;
@@ -130,11 +203,9 @@ static int maskingProcessor(KSI_TreeNode *in, void *c, KSI_TreeNode **out) {
 	int res = KSI_UNKNOWN_ERROR;
 	KSI_BlockSigner *signer = c;
 	KSI_TreeNode *tmp = NULL;
+	KSI_TreeNode *maskNode = NULL;
 	KSI_DataHash *mask = NULL;
-	KSI_DataHasher *maskHsr = NULL;
-	KSI_DataHasher *leafHsr = NULL;
-	KSI_DataHash *leafHash = NULL;
-	unsigned char tmpLvl;
+	KSI_DataHash *leaf = NULL;
 
 	if (in == NULL || c == NULL || out == NULL) {
 		res = KSI_INVALID_ARGUMENT;
@@ -143,87 +214,55 @@ static int maskingProcessor(KSI_TreeNode *in, void *c, KSI_TreeNode **out) {
 
 	KSI_ERR_clearErrors(signer->ctx);
 
-	if (signer->iv != NULL && signer->prevLeaf != NULL) {
+	if (signer->iv != NULL) {
 		/* For now only masking real hash values is supported. */
 		if (in->hash == NULL) {
 			KSI_pushError(signer->ctx, res = KSI_INVALID_STATE, "Only a tree node with a hash value may be used for masking.");
 			goto cleanup;
 		}
 
-		/* Calculate the mask value. */
-		res = KSI_DataHasher_open(signer->ctx, signer->builder->algo, &maskHsr);
-		if (res != KSI_OK) {
-			KSI_pushError(signer->ctx, res, NULL);
-			goto cleanup;
-		}
-
-		/* Change here, if there is a need, to add previous values that are not nodes containing hash values. */
-		res = KSI_DataHasher_addImprint(maskHsr, signer->prevLeaf);
-		if (res != KSI_OK) {
-			KSI_pushError(signer->ctx, res, NULL);
-			goto cleanup;
-		}
-
-		res = KSI_DataHasher_addOctetString(maskHsr, signer->iv);
-		if (res != KSI_OK) {
-			KSI_pushError(signer->ctx, res, NULL);
-			goto cleanup;
-		}
-
-		res = KSI_DataHasher_close(maskHsr, &mask);
-		if (res != KSI_OK) {
-			KSI_pushError(signer->ctx, res, NULL);
-			goto cleanup;
-		}
-
-		/* Add the mask as left link of the calculation. */
-		res = KSI_TreeNode_new(signer->ctx, mask, NULL, in->level, &tmp);
-		if (res != KSI_OK) {
-			KSI_pushError(signer->ctx, res, NULL);
+		if (!KSI_IS_VALID_TREE_LEVEL(in->level + 1)) {
+			KSI_pushError(signer->ctx, res = KSI_INVALID_STATE, "The tree height is too large.");
 			goto cleanup;
 		}
 
-		/* Calculate the actual leaf value. */
-		res = KSI_DataHasher_open(signer->ctx, signer->builder->algo, &leafHsr);
-		if (res != KSI_OK) {
-			KSI_pushError(signer->ctx, res, NULL);
+		/* The hash values have been calculated by the mask stage. */
+		if (signer->maskSlot == NULL) {
+			KSI_pushError(signer->ctx, res = KSI_INVALID_STATE, "The leaf has not been masked.");
 			goto cleanup;
 		}
 
-		res = KSI_DataHasher_addImprint(leafHsr, mask);
+		res = KSI_DataHash_fromImprint(signer->ctx, signer->maskSlot->mask, signer->maskSlot->mask_len, &mask);
 		if (res != KSI_OK) {
 			KSI_pushError(signer->ctx, res, NULL);
 			goto cleanup;
 		}
 
-		res = KSI_DataHasher_addImprint(leafHsr, in->hash);
+		res = KSI_DataHash_fromImprint(signer->ctx, signer->maskSlot->leaf, signer->maskSlot->leaf_len, &leaf);
 		if (res != KSI_OK) {
 			KSI_pushError(signer->ctx, res, NULL);
 			goto cleanup;
 		}
 
-		if (!KSI_IS_VALID_TREE_LEVEL(in->level + 1)) {
-			KSI_pushError(signer->ctx, res = KSI_INVALID_STATE, "The tree height is too large.");
-			goto cleanup;
-		}
-
-		tmpLvl = (unsigned char)(in->level + 1);
-
-		res = KSI_DataHasher_add(leafHsr, &tmpLvl, 1);
+		/* Add the mask as the right link of the calculation. */
+		res = KSI_TreeNode_new(signer->ctx, mask, NULL, in->level, &maskNode);
 		if (res != KSI_OK) {
 			KSI_pushError(signer->ctx, res, NULL);
 			goto cleanup;
 		}
 
-		res = KSI_DataHasher_close(leafHsr, &leafHash);
+		res = KSI_TreeNode_new(signer->ctx, leaf, NULL, in->level + 1, &tmp);
 		if (res != KSI_OK) {
 			KSI_pushError(signer->ctx, res, NULL);
 			goto cleanup;
 		}
 
-		/* Swap the previous leaf hash value. */
-		KSI_DataHash_free(signer->prevLeaf);
-		signer->prevLeaf = KSI_DataHash_ref(leafHash);
+		/* Return the joined node, so the tree builder does not hash it again. */
+		tmp->leftChild = in;
+		tmp->rightChild = maskNode;
+		in->parent = tmp;
+		maskNode->parent = tmp;
+		maskNode = NULL;
 
 		*out = tmp;
 		tmp = NULL;
@@ -235,281 +274,1129 @@ static int maskingProcessor(KSI_TreeNode *in, void *c, KSI_TreeNode **out) {
 
 cleanup:
 
-	KSI_DataHasher_free(leafHsr);
-	KSI_DataHasher_free(maskHsr);
 	KSI_DataHash_free(mask);
-	KSI_DataHash_free(leafHash);
-
+	KSI_DataHash_free(leaf);
+	KSI_TreeNode_free(maskNode);
 	KSI_TreeNode_free(tmp);
 
 	return res;
 }
 
-int KSI_BlockSigner_new(KSI_CTX *ctx, KSI_HashAlgorithm algoId, KSI_DataHash *prevLeaf, KSI_OctetString *initVal, KSI_BlockSigner **signer) {
+/* Sets the previous leaf value of the mask stage. */
+static int setMaskPrevLeaf(KSI_BlockSigner *signer, KSI_DataHash *prevLeaf) {
 	int res = KSI_UNKNOWN_ERROR;
-	KSI_BlockSigner *tmp = NULL;
+	const unsigned char *imprint = NULL;
+	size_t imprint_len = 0;
 
-	KSI_ERR_clearErrors(ctx);
-
-	if (ctx == NULL || signer == NULL || (prevLeaf == NULL && initVal != NULL) || (prevLeaf != NULL && initVal == NULL)) {
-		KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
+	res = KSI_DataHash_getImprint(prevLeaf, &imprint, &imprint_len);
+	if (res != KSI_OK || imprint_len > KSI_MAX_IMPRINT_LEN) {
+		KSI_pushError(signer->ctx, res = (res != KSI_OK ? res : KSI_INVALID_ARGUMENT), NULL);
 		goto cleanup;
 	}
 
-	tmp = KSI_new(KSI_BlockSigner);
-	if (tmp == NULL) {
-		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
-		goto cleanup;
-	}
+	memcpy(signer->maskBuf + KSI_MAX_IMPRINT_LEN - imprint_len, imprint, imprint_len);
+	signer->maskPrev_len = imprint_len;
 
-	tmp->ctx = ctx;
-	tmp->ref = 1;
-	tmp->builder = NULL;
-	tmp->leafList = NULL;
-	tmp->signature = NULL;
-	tmp->prevLeaf = NULL;
-	tmp->origPrevLeaf = NULL;
-	tmp->iv = NULL;
-	tmp->metaData = NULL;
+	res = KSI_OK;
 
-	tmp->metaDataProcessor.c = tmp;
-	tmp->metaDataProcessor.fn = metaDataProcessor;
+cleanup:
 
-	tmp->maskingProcessor.c = tmp;
-	tmp->maskingProcessor.fn = maskingProcessor;
+	return res;
+}
 
-	res = KSI_TreeBuilder_new(ctx, algoId, &tmp->builder);
-	if (res != KSI_OK) goto cleanup;
+/* Calculates the masks of the queued leafs [from, to), the masked leafs and the values chaining them.
+ * Runs on the mask stage thread, if there is one, so the errors are only returned. */
+static int maskLeafs(KSI_BlockSigner *signer, size_t from, size_t to) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_DataHash *out = signer->maskOut;
+	size_t i;
 
-	res = KSI_BlockSignerHandleList_new(&tmp->leafList);
-	if (res != KSI_OK) goto cleanup;
+	for (i = from; i < to; i++) {
+		MaskSlot *slot = &signer->maskQueue[i % MASK_QUEUE_LEN];
+		unsigned char lvl = (unsigned char)(slot->level + 1);
 
-	tmp->prevLeaf = KSI_DataHash_ref(prevLeaf);
-	tmp->origPrevLeaf = KSI_DataHash_ref(prevLeaf);
-	tmp->iv = KSI_OctetString_ref(initVal);
+		/* mask = H(prevLeaf || IV), the previous leaf is stored right before the IV. */
+		res = KSI_DataHasher_reset(signer->maskHsr);
+		if (res != KSI_OK) goto cleanup;
 
-	/* Add the masking handle. */
-	res = KSI_TreeBuilderLeafProcessorList_append(tmp->builder->cbList, &tmp->maskingProcessor);
-	if (res != KSI_OK) {
-		KSI_pushError(ctx, res, NULL);
-		goto cleanup;
-	}
+		res = KSI_DataHasher_add(signer->maskHsr, signer->maskBuf + KSI_MAX_IMPRINT_LEN - signer->maskPrev_len, signer->maskPrev_len + signer->maskIv_len);
+		if (res != KSI_OK) goto cleanup;
 
-	/* Add the client id handle. */
-	res = KSI_TreeBuilderLeafProcessorList_append(tmp->builder->cbList, &tmp->metaDataProcessor);
-	if (res != KSI_OK) {
-		KSI_pushError(ctx, res, NULL);
-		goto cleanup;
-	}
+		res = signer->maskHsr->closeExisting(signer->maskHsr, out);
+		if (res != KSI_OK) goto cleanup;
 
-	*signer = tmp;
-	tmp = NULL;
+		memcpy(slot->mask, out->imprint, out->imprint_length);
+		slot->mask_len = out->imprint_length;
+
+		/* The masked leaf in the tree: H(hash || mask || level + 1). */
+		res = KSI_DataHasher_reset(signer->maskHsr);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_DataHasher_add(signer->maskHsr, slot->hash, slot->hash_len);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_DataHasher_add(signer->maskHsr, slot->mask, slot->mask_len);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_DataHasher_add(signer->maskHsr, &lvl, 1);
+		if (res != KSI_OK) goto cleanup;
+
+		res = signer->maskHsr->closeExisting(signer->maskHsr, out);
+		if (res != KSI_OK) goto cleanup;
+
+		memcpy(slot->leaf, out->imprint, out->imprint_length);
+		slot->leaf_len = out->imprint_length;
+
+		/* The next mask is chained to H(mask || hash || level + 1). */
+		res = KSI_DataHasher_reset(signer->maskHsr);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_DataHasher_add(signer->maskHsr, slot->mask, slot->mask_len);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_DataHasher_add(signer->maskHsr, slot->hash, slot->hash_len);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_DataHasher_add(signer->maskHsr, &lvl, 1);
+		if (res != KSI_OK) goto cleanup;
+
+		res = signer->maskHsr->closeExisting(signer->maskHsr, out);
+		if (res != KSI_OK) goto cleanup;
+
+		memcpy(signer->maskBuf + KSI_MAX_IMPRINT_LEN - out->imprint_length, out->imprint, out->imprint_length);
+		signer->maskPrev_len = out->imprint_length;
+	}
 
 	res = KSI_OK;
 
 cleanup:
 
-	KSI_BlockSigner_free(tmp);
-
 	return res;
 }
 
-void KSI_BlockSigner_free(KSI_BlockSigner *signer) {
-	if (signer != NULL && --signer->ref == 0) {
-		KSI_TreeBuilder_free(signer->builder);
-		KSI_BlockSignerHandleList_free(signer->leafList);
-		KSI_Signature_free(signer->signature);
-		KSI_OctetString_free(signer->iv);
-		KSI_DataHash_free(signer->prevLeaf);
-		KSI_DataHash_free(signer->origPrevLeaf);
-		KSI_free(signer);
+static int maskTask(void *arg) {
+	KSI_BlockSigner *signer = arg;
+	size_t from;
+	size_t to;
+	int res;
+
+	KSI_Mutex_lock(signer->maskLock);
+
+	for (;;) {
+		while (!signer->maskStop && signer->maskDone == signer->maskQueued) {
+			signer->maskIdle = 1;
+			KSI_Cond_wait(signer->maskCond, signer->maskLock);
+		}
+		signer->maskIdle = 0;
+
+		if (signer->maskStop) break;
+
+		/* Take all the queued leafs at once. */
+		from = signer->maskDone;
+		to = signer->maskQueued;
+
+		KSI_Mutex_unlock(signer->maskLock);
+		res = maskLeafs(signer, from, to);
+		KSI_Mutex_lock(signer->maskLock);
+
+		if (res != KSI_OK) {
+			signer->maskResult = res;
+		} else {
+			signer->maskDone = to;
+		}
+		KSI_Cond_broadcast(signer->maskCond);
+
+		if (res != KSI_OK) break;
 	}
+
+	res = signer->maskResult;
+
+	KSI_Mutex_unlock(signer->maskLock);
+
+	return res;
 }
 
-int KSI_BlockSigner_close(KSI_BlockSigner *signer, KSI_MultiSignature **ms) {
+/* Starts the mask stage thread, if the context may be used by several threads. */
+static int startMaskTask(KSI_BlockSigner *signer) {
 	int res = KSI_UNKNOWN_ERROR;
-	KSI_MultiSignature *tmp = NULL;
-	KSI_Signature *sig = NULL;
 
-	if (signer == NULL) {
-		res = KSI_INVALID_ARGUMENT;
+	if (signer->maskTask != NULL || !signer->ctx->flags[KSI_CTX_FLAG_SHARED]) {
+		res = KSI_OK;
 		goto cleanup;
 	}
 
-	KSI_ERR_clearErrors(signer->ctx);
+	if (signer->maskLock == NULL) {
+		res = KSI_Mutex_new(signer->ctx, &signer->maskLock);
+		if (res != KSI_OK) {
+			KSI_pushError(signer->ctx, res, NULL);
+			goto cleanup;
+		}
+	}
 
-	KSI_LOG_debug(signer->ctx, "Closing block signer instance.");
+	if (signer->maskCond == NULL) {
+		res = KSI_Cond_new(signer->ctx, &signer->maskCond);
+		if (res != KSI_OK) {
+			KSI_pushError(signer->ctx, res, NULL);
+			goto cleanup;
+		}
+	}
 
-	/* Finalize the tree. */
-	res = KSI_TreeBuilder_close(signer->builder);
+	signer->maskStop = 0;
+	signer->maskIdle = 0;
+
+	res = KSI_Thread_start(signer->ctx, maskTask, signer, &signer->maskTask);
 	if (res != KSI_OK) {
 		KSI_pushError(signer->ctx, res, NULL);
 		goto cleanup;
 	}
 
-	KSI_LOG_debug(signer->ctx, "Signing the root hash value of the block signer.");
-	/* Sign the root hash. */
-	res = KSI_Signature_signAggregated(signer->ctx, signer->builder->rootNode->hash, signer->builder->rootNode->level, &signer->signature);
-	if (res != KSI_OK) {
-		KSI_pushError(signer->ctx, res, NULL);
-		goto cleanup;
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+/* Stops the mask stage thread, the leafs it has not masked yet are left in the queue. */
+static void stopMaskTask(KSI_BlockSigner *signer) {
+	if (signer->maskTask != NULL) {
+		KSI_Mutex_lock(signer->maskLock);
+		signer->maskStop = 1;
+		KSI_Cond_broadcast(signer->maskCond);
+		KSI_Mutex_unlock(signer->maskLock);
+
+		KSI_Thread_free(signer->maskTask);
+		signer->maskTask = NULL;
 	}
+}
 
-	/* If the output parameter is set, populate the multi signature container. */
-	if (ms != NULL) {
-		size_t i;
+/* Drops the queued leafs and restarts the mask chain from the given leaf value. */
+static int resetMaskStage(KSI_BlockSigner *signer, KSI_DataHash *prevLeaf) {
+	int res = KSI_UNKNOWN_ERROR;
 
-		KSI_LOG_debug(signer->ctx, "Creating a multi signature output value for the block signer.");
+	stopMaskTask(signer);
 
-		res = KSI_MultiSignature_new(signer->ctx, &tmp);
-		if (res != KSI_OK) {
-			KSI_pushError(signer->ctx, res, NULL);
+	signer->maskQueued = 0;
+	signer->maskDone = 0;
+	signer->maskInserted = 0;
+	signer->maskSynced = 0;
+	signer->maskResult = KSI_OK;
+	signer->maskSlot = NULL;
+
+	if (signer->maskBuf != NULL) {
+		res = setMaskPrevLeaf(signer, prevLeaf);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+/* Adds the masked leafs up to the given count to the tree. */
+static int insertMaskedLeafs(KSI_BlockSigner *signer, size_t count) {
+	int res = KSI_UNKNOWN_ERROR;
+
+	while (signer->maskInserted < count) {
+		KSI_BlockSignerHandle *hndl = NULL;
+
+		res = KSI_BlockSignerHandleList_elementAt(signer->leafList, signer->maskInserted, &hndl);
+		if (res != KSI_OK || hndl == NULL) {
+			KSI_pushError(signer->ctx, res = (res != KSI_OK ? res : KSI_INVALID_STATE), NULL);
 			goto cleanup;
 		}
 
-		for (i = 0; i < KSI_BlockSignerHandleList_length(signer->leafList); i++) {
-			KSI_BlockSignerHandle *hndl = NULL;
+		/* The processors pick up the mask and the meta-data of the leaf. */
+		signer->maskSlot = &signer->maskQueue[signer->maskInserted % MASK_QUEUE_LEN];
+		signer->metaData = hndl->metaData;
 
-			/* Extract the element from the list. */
-			res = KSI_BlockSignerHandleList_elementAt(signer->leafList, i, &hndl);
-			if (res != KSI_OK) {
-				KSI_pushError(signer->ctx, res, NULL);
-				goto cleanup;
-			}
+		res = KSI_TreeBuilder_addDataHash(signer->builder, hndl->hash, hndl->level, &hndl->leafHandle);
 
-			/* Create a proper signature. */
-			res = KSI_BlockSignerHandle_getSignature(hndl, &sig);
-			if (res != KSI_OK) {
-				KSI_pushError(signer->ctx, res, NULL);
-				goto cleanup;
-			}
-
-			/* Add the signature to the multi signature container. */
-			res = KSI_MultiSignature_add(tmp, sig);
-			if (res != KSI_OK) {
-				KSI_pushError(signer->ctx, res, NULL);
-				goto cleanup;
-			}
+		signer->maskSlot = NULL;
+		signer->metaData = NULL;
 
-			/* Free the signature, as it is no longer needed. */
-			KSI_Signature_free(sig);
-			sig = NULL;
+		if (res != KSI_OK) {
+			KSI_pushError(signer->ctx, res, NULL);
+			goto cleanup;
 		}
 
-		*ms = tmp;
-		tmp = NULL;
+		KSI_DataHash_free(hndl->hash);
+		hndl->hash = NULL;
+		KSI_MetaData_free(hndl->metaData);
+		hndl->metaData = NULL;
+
+		signer->maskInserted++;
 	}
 
 	res = KSI_OK;
 
 cleanup:
 
-	KSI_MultiSignature_free(tmp);
-
 	return res;
 }
 
-int KSI_BlockSigner_reset(KSI_BlockSigner *signer) {
+/* Adds the leafs masked so far to the tree, waiting until at least \c count leafs have been added. */
+static int drainMaskStage(KSI_BlockSigner *signer, size_t count) {
 	int res = KSI_UNKNOWN_ERROR;
-	KSI_TreeBuilder *builder = NULL;
-	KSI_LIST(KSI_BlockSignerHandle) *leafList = NULL;
+	size_t done = 0;
 
-	if (signer == NULL) {
-		res = KSI_INVALID_ARGUMENT;
-		goto cleanup;
+	if (signer->maskTask == NULL) {
+		/* Without the thread, all the queued leafs are masked right away. */
+		if (signer->maskResult == KSI_OK && signer->maskDone < signer->maskQueued) {
+			signer->maskResult = maskLeafs(signer, signer->maskDone, signer->maskQueued);
+			if (signer->maskResult == KSI_OK) signer->maskDone = signer->maskQueued;
+		}
+		res = signer->maskResult;
+		done = signer->maskDone;
+	} else {
+		KSI_Mutex_lock(signer->maskLock);
+		while (signer->maskResult == KSI_OK && signer->maskDone < count) {
+			KSI_Cond_wait(signer->maskCond, signer->maskLock);
+		}
+		res = signer->maskResult;
+		done = signer->maskDone;
+		KSI_Mutex_unlock(signer->maskLock);
 	}
 
-	KSI_ERR_clearErrors(signer->ctx);
-
-	res = KSI_TreeBuilder_new(signer->ctx, signer->builder->algo, &builder);
 	if (res != KSI_OK) {
-		KSI_pushError(signer->ctx, res, NULL);
+		KSI_pushError(signer->ctx, res, "Unable to mask the leafs.");
 		goto cleanup;
 	}
 
-	res = KSI_BlockSignerHandleList_new(&leafList);
+	res = insertMaskedLeafs(signer, done);
 	if (res != KSI_OK) {
 		KSI_pushError(signer->ctx, res, NULL);
+
+		/* The tree is incomplete, refuse to continue. */
+		KSI_Mutex_lock(signer->maskLock);
+		signer->maskResult = res;
+		KSI_Mutex_unlock(signer->maskLock);
 		goto cleanup;
 	}
 
-	KSI_Signature_free(signer->signature);
-	signer->signature = NULL;
+	res = KSI_OK;
 
-	KSI_TreeBuilder_free(signer->builder);
-	signer->builder = builder;
-	builder = NULL;
+cleanup:
 
-	KSI_BlockSignerHandleList_free(signer->leafList);
-	signer->leafList = leafList;
-	leafList = NULL;
+	return res;
+}
 
-	/* Add the masking handle. */
-	res = KSI_TreeBuilderLeafProcessorList_append(signer->builder->cbList, &signer->maskingProcessor);
-	if (res != KSI_OK) {
-		KSI_pushError(signer->ctx, res, NULL);
+/* Adds all the queued leafs to the tree and updates the previous leaf value. */
+static int flushMaskStage(KSI_BlockSigner *signer) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_DataHash *prevLeaf = NULL;
+
+	if (signer->iv == NULL) {
+		res = KSI_OK;
 		goto cleanup;
 	}
 
-	/* Add the client id handle. */
-	res = KSI_TreeBuilderLeafProcessorList_append(signer->builder->cbList, &signer->metaDataProcessor);
+	res = drainMaskStage(signer, signer->maskQueued);
 	if (res != KSI_OK) {
 		KSI_pushError(signer->ctx, res, NULL);
 		goto cleanup;
 	}
 
-	KSI_DataHash_free(signer->prevLeaf);
-	signer->prevLeaf = KSI_DataHash_ref(signer->origPrevLeaf);
+	/* The stage is idle until new leafs are queued, so its leaf value may be read. */
+	if (signer->maskSynced != signer->maskInserted) {
+		res = KSI_DataHash_fromImprint(signer->ctx, signer->maskBuf + KSI_MAX_IMPRINT_LEN - signer->maskPrev_len, signer->maskPrev_len, &prevLeaf);
+		if (res != KSI_OK) {
+			KSI_pushError(signer->ctx, res, NULL);
+			goto cleanup;
+		}
+
+		KSI_DataHash_free(signer->prevLeaf);
+		signer->prevLeaf = prevLeaf;
+		prevLeaf = NULL;
+
+		signer->maskSynced = signer->maskInserted;
+	}
+
 	res = KSI_OK;
 
 cleanup:
 
-	KSI_TreeBuilder_free(builder);
-	KSI_BlockSignerHandleList_free(leafList);
+	KSI_DataHash_free(prevLeaf);
 
 	return res;
 }
 
-int KSI_BlockSigner_addLeaf(KSI_BlockSigner *signer, KSI_DataHash *hsh, int level, KSI_MetaData *metaData, KSI_BlockSignerHandle **handle) {
+/* Queues a leaf for the mask stage. */
+static int addMaskedLeaf(KSI_BlockSigner *signer, KSI_DataHash *hsh, int level, KSI_MetaData *metaData, KSI_BlockSignerHandle *hndl) {
 	int res = KSI_UNKNOWN_ERROR;
-	KSI_TreeLeafHandle *leafHandle = NULL;
-	KSI_BlockSignerHandle *tmp = NULL;
+	MaskSlot *slot = NULL;
+	const unsigned char *imprint = NULL;
+	size_t imprint_len = 0;
+	int wake;
 
-	if (signer == NULL || hsh == NULL) {
+	if (!KSI_IS_VALID_TREE_LEVEL(level) || !KSI_IS_VALID_TREE_LEVEL(level + 1)) {
+		KSI_pushError(signer->ctx, res = KSI_INVALID_STATE, "The tree height is too large.");
+		goto cleanup;
+	}
+
+	res = KSI_DataHash_getImprint(hsh, &imprint, &imprint_len);
+	if (res != KSI_OK || imprint_len > KSI_MAX_IMPRINT_LEN) {
+		KSI_pushError(signer->ctx, res = (res != KSI_OK ? res : KSI_INVALID_ARGUMENT), NULL);
+		goto cleanup;
+	}
+
+	if (signer->builder->rootNode != NULL) {
+		KSI_pushError(signer->ctx, res = KSI_INVALID_STATE, "The tree has been finished, new leafs may not be added.");
+		goto cleanup;
+	}
+
+	/* Wait for room in the queue. */
+	if (signer->maskQueued - signer->maskInserted == MASK_QUEUE_LEN) {
+		res = drainMaskStage(signer, signer->maskInserted + 1);
+		if (res != KSI_OK) {
+			KSI_pushError(signer->ctx, res, NULL);
+			goto cleanup;
+		}
+	}
+
+	res = startMaskTask(signer);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	hndl->hash = KSI_DataHash_ref(hsh);
+	hndl->metaData = KSI_MetaData_ref(metaData);
+	hndl->level = level;
+
+	res = KSI_BlockSignerHandleList_append(signer->leafList, KSI_BlockSignerHandle_ref(hndl));
+	if (res != KSI_OK) {
+		KSI_BlockSignerHandle_free(hndl);
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	slot = &signer->maskQueue[signer->maskQueued % MASK_QUEUE_LEN];
+	memcpy(slot->hash, imprint, imprint_len);
+	slot->hash_len = imprint_len;
+	slot->level = (unsigned char)level;
+
+	KSI_Mutex_lock(signer->maskLock);
+	signer->maskQueued++;
+	wake = signer->maskIdle;
+	KSI_Mutex_unlock(signer->maskLock);
+
+	if (wake) KSI_Cond_broadcast(signer->maskCond);
+
+	/* The caller may change the meta-data after this call, so the leaf is added to the tree right away. */
+	res = drainMaskStage(signer, metaData != NULL ? signer->maskQueued : 0);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+int KSI_BlockSigner_new(KSI_CTX *ctx, KSI_HashAlgorithm algoId, KSI_DataHash *prevLeaf, KSI_OctetString *initVal, KSI_BlockSigner **signer) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_BlockSigner *tmp = NULL;
+	const unsigned char *iv = NULL;
+	size_t iv_len = 0;
+
+	KSI_ERR_clearErrors(ctx);
+
+	if (ctx == NULL || signer == NULL || (prevLeaf == NULL && initVal != NULL) || (prevLeaf != NULL && initVal == NULL)) {
+		KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
+		goto cleanup;
+	}
+
+	tmp = KSI_new(KSI_BlockSigner);
+	if (tmp == NULL) {
+		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+	tmp->ctx = ctx;
+	tmp->ref = 1;
+	tmp->builder = NULL;
+	tmp->leafList = NULL;
+	tmp->signature = NULL;
+	tmp->prevLeaf = NULL;
+	tmp->origPrevLeaf = NULL;
+	tmp->iv = NULL;
+	tmp->metaData = NULL;
+	tmp->maskHsr = NULL;
+	tmp->maskOut = NULL;
+	tmp->maskBuf = NULL;
+	tmp->maskPrev_len = 0;
+	tmp->maskIv_len = 0;
+	tmp->maskQueue = NULL;
+	tmp->maskTask = NULL;
+	tmp->maskLock = NULL;
+	tmp->maskCond = NULL;
+	tmp->maskQueued = 0;
+	tmp->maskDone = 0;
+	tmp->maskIdle = 0;
+	tmp->maskStop = 0;
+	tmp->maskResult = KSI_OK;
+	tmp->maskInserted = 0;
+	tmp->maskSynced = 0;
+	tmp->maskSlot = NULL;
+	tmp->signTask = NULL;
+	tmp->signCtx = NULL;
+	tmp->signRoot = NULL;
+	tmp->signLevel = 0;
+	tmp->signRaw = NULL;
+	tmp->signRaw_len = 0;
+	tmp->signResult = KSI_OK;
+
+	tmp->metaDataProcessor.c = tmp;
+	tmp->metaDataProcessor.fn = metaDataProcessor;
+
+	tmp->maskingProcessor.c = tmp;
+	tmp->maskingProcessor.fn = maskingProcessor;
+
+	res = KSI_TreeBuilder_new(ctx, algoId, &tmp->builder);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_BlockSignerHandleList_new(&tmp->leafList);
+	if (res != KSI_OK) goto cleanup;
+
+	tmp->prevLeaf = KSI_DataHash_ref(prevLeaf);
+	tmp->origPrevLeaf = KSI_DataHash_ref(prevLeaf);
+	tmp->iv = KSI_OctetString_ref(initVal);
+
+	if (initVal != NULL) {
+		res = KSI_OctetString_extract(initVal, &iv, &iv_len);
+		if (res != KSI_OK) {
+			KSI_pushError(ctx, res, NULL);
+			goto cleanup;
+		}
+
+		tmp->maskBuf = KSI_malloc(KSI_MAX_IMPRINT_LEN + iv_len);
+		if (tmp->maskBuf == NULL) {
+			KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
+			goto cleanup;
+		}
+
+		memcpy(tmp->maskBuf + KSI_MAX_IMPRINT_LEN, iv, iv_len);
+		tmp->maskIv_len = iv_len;
+
+		res = setMaskPrevLeaf(tmp, prevLeaf);
+		if (res != KSI_OK) goto cleanup;
+
+		tmp->maskQueue = KSI_calloc(MASK_QUEUE_LEN, sizeof(MaskSlot));
+		if (tmp->maskQueue == NULL) {
+			KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
+			goto cleanup;
+		}
+
+		/* The same hasher is used for all the leafs, as opening one is expensive. */
+		res = KSI_DataHasher_open(ctx, algoId, &tmp->maskHsr);
+		if (res != KSI_OK) {
+			KSI_pushError(ctx, res, NULL);
+			goto cleanup;
+		}
+
+		res = KSI_DataHash_createZero(ctx, algoId, &tmp->maskOut);
+		if (res != KSI_OK) {
+			KSI_pushError(ctx, res, NULL);
+			goto cleanup;
+		}
+	}
+
+	/* Add the masking handle. */
+	res = KSI_TreeBuilderLeafProcessorList_append(tmp->builder->cbList, &tmp->maskingProcessor);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	/* Add the client id handle. */
+	res = KSI_TreeBuilderLeafProcessorList_append(tmp->builder->cbList, &tmp->metaDataProcessor);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	*signer = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_BlockSigner_free(tmp);
+
+	return res;
+}
+
+static void discardAsyncSign(KSI_BlockSigner *signer) {
+	/* Wait for the background task, as it still uses the signer. */
+	KSI_Thread_free(signer->signTask);
+	signer->signTask = NULL;
+
+	KSI_DataHash_free(signer->signRoot);
+	signer->signRoot = NULL;
+
+	KSI_free(signer->signRaw);
+	signer->signRaw = NULL;
+	signer->signRaw_len = 0;
+
+	signer->signCtx = NULL;
+	signer->signResult = KSI_OK;
+}
+
+void KSI_BlockSigner_free(KSI_BlockSigner *signer) {
+	if (signer != NULL && KSI_REF_DECREMENT(signer) == 0) {
+		discardAsyncSign(signer);
+		stopMaskTask(signer);
+		KSI_TreeBuilder_free(signer->builder);
+		KSI_BlockSignerHandleList_free(signer->leafList);
+		KSI_Signature_free(signer->signature);
+		KSI_OctetString_free(signer->iv);
+		KSI_DataHash_free(signer->prevLeaf);
+		KSI_DataHash_free(signer->origPrevLeaf);
+		KSI_DataHasher_free(signer->maskHsr);
+		KSI_DataHash_free(signer->maskOut);
+		KSI_free(signer->maskBuf);
+		KSI_free(signer->maskQueue);
+		KSI_Mutex_free(signer->maskLock);
+		KSI_Cond_free(signer->maskCond);
+		KSI_free(signer);
+	}
+}
+
+struct KSI_BlockSignerChainCtx_st {
+	KSI_BlockSigner *signer;
+	KSI_BlockSignerSignatureCallback fn;
+	void *c;
+};
+
+static int blockSignerChainCallback(void *c, size_t index, KSI_AggregationHashChain *chain) {
+	int res = KSI_UNKNOWN_ERROR;
+	struct KSI_BlockSignerChainCtx_st *chainCtx = c;
+	KSI_BlockSigner *signer = chainCtx->signer;
+	KSI_BlockSignerHandle *hndl = NULL;
+	KSI_Signature *tmp = NULL;
+
+	res = KSI_BlockSignerHandleList_elementAt(signer->leafList, index, &hndl);
+	if (res != KSI_OK || hndl == NULL) {
+		KSI_pushError(signer->ctx, res = (res != KSI_OK ? res : KSI_INVALID_STATE), NULL);
+		goto cleanup;
+	}
+
+	/* Create a hard copy of the signature. */
+	res = KSI_Signature_clone(signer->signature, &tmp);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	/* Append the aggregation hash chain to the signature. */
+	res = KSI_Signature_appendAggregationChain(tmp, chain);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	/* The ownership of the signature is passed to the callback. */
+	res = chainCtx->fn(chainCtx->c, hndl, tmp);
+	tmp = NULL;
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_Signature_free(tmp);
+	KSI_AggregationHashChain_free(chain);
+
+	return res;
+}
+
+int KSI_BlockSigner_getSignatures(KSI_BlockSigner *signer, KSI_BlockSignerSignatureCallback fn, void *c) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_LIST(KSI_TreeLeafHandle) *leafs = NULL;
+	struct KSI_BlockSignerChainCtx_st chainCtx;
+	size_t i;
+
+	if (signer == NULL || fn == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	KSI_ERR_clearErrors(signer->ctx);
+
+	/* Resolve the signature of an asynchronously closed block. */
+	res = finishAsyncSign(signer);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	if (signer->signature == NULL) {
+		KSI_pushError(signer->ctx, res = KSI_INVALID_STATE, "The blocksigner is not closed.");
+		goto cleanup;
+	}
+
+	res = KSI_TreeLeafHandleList_new(&leafs);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	for (i = 0; i < KSI_BlockSignerHandleList_length(signer->leafList); i++) {
+		KSI_BlockSignerHandle *hndl = NULL;
+		KSI_TreeLeafHandle *ref = NULL;
+
+		res = KSI_BlockSignerHandleList_elementAt(signer->leafList, i, &hndl);
+		if (res != KSI_OK || hndl == NULL) {
+			KSI_pushError(signer->ctx, res = (res != KSI_OK ? res : KSI_INVALID_STATE), NULL);
+			goto cleanup;
+		}
+
+		res = KSI_TreeLeafHandleList_append(leafs, ref = KSI_TreeLeafHandle_ref(hndl->leafHandle));
+		if (res != KSI_OK) {
+			/* Cleanup the reference. */
+			KSI_TreeLeafHandle_free(ref);
+
+			KSI_pushError(signer->ctx, res, NULL);
+			goto cleanup;
+		}
+	}
+
+	chainCtx.signer = signer;
+	chainCtx.fn = fn;
+	chainCtx.c = c;
+
+	/* Extract all the aggregation chains in a single pass over the tree. */
+	res = KSI_TreeBuilder_getAggregationChains(signer->builder, leafs, blockSignerChainCallback, &chainCtx);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_TreeLeafHandleList_free(leafs);
+
+	return res;
+}
+
+static int multiSignatureCallback(void *c, KSI_BlockSignerHandle *handle, KSI_Signature *sig) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_MultiSignature *ms = c;
+
+	/* Add the signature to the multi signature container. */
+	res = KSI_MultiSignature_add(ms, sig);
+
+	/* Free the signature, as it is no longer needed. */
+	KSI_Signature_free(sig);
+
+	return res;
+}
+
+static int createMultiSignature(KSI_BlockSigner *signer, KSI_MultiSignature **ms) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_MultiSignature *tmp = NULL;
+
+	KSI_LOG_debug(signer->ctx, "Creating a multi signature output value for the block signer.");
+
+	res = KSI_MultiSignature_new(signer->ctx, &tmp);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_BlockSigner_getSignatures(signer, multiSignatureCallback, tmp);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	*ms = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_MultiSignature_free(tmp);
+
+	return res;
+}
+
+int KSI_BlockSigner_close(KSI_BlockSigner *signer, KSI_MultiSignature **ms) {
+	int res = KSI_UNKNOWN_ERROR;
+
+	if (signer == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	KSI_ERR_clearErrors(signer->ctx);
+
+	if (signer->signTask != NULL) {
+		KSI_pushError(signer->ctx, res = KSI_INVALID_STATE, "The block signer is being closed asynchronously.");
+		goto cleanup;
+	}
+
+	KSI_LOG_debug(signer->ctx, "Closing block signer instance.");
+
+	/* Add the leafs still in the mask stage. */
+	res = flushMaskStage(signer);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+	stopMaskTask(signer);
+
+	/* Finalize the tree. */
+	res = KSI_TreeBuilder_close(signer->builder);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	KSI_LOG_debug(signer->ctx, "Signing the root hash value of the block signer.");
+	/* Sign the root hash. */
+	res = KSI_Signature_signAggregated(signer->ctx, signer->builder->rootNode->hash, signer->builder->rootNode->level, &signer->signature);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	/* If the output parameter is set, populate the multi signature container. */
+	if (ms != NULL) {
+		res = createMultiSignature(signer, ms);
+		if (res != KSI_OK) {
+			KSI_pushError(signer->ctx, res, NULL);
+			goto cleanup;
+		}
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+static int asyncSignTask(void *arg) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_BlockSigner *signer = arg;
+	KSI_Signature *sig = NULL;
+
+	/* Only the signing context may be used in this thread. */
+	res = KSI_Signature_signAggregated(signer->signCtx, signer->signRoot, signer->signLevel, &sig);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Signature_serialize(sig, &signer->signRaw, &signer->signRaw_len);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_Signature_free(sig);
+
+	return res;
+}
+
+static int finishAsyncSign(KSI_BlockSigner *signer) {
+	int res = KSI_UNKNOWN_ERROR;
+
+	if (signer->signTask != NULL) {
+		KSI_LOG_debug(signer->ctx, "Waiting for the block signature.");
+
+		res = KSI_Thread_join(signer->signTask, &signer->signResult);
+		if (res != KSI_OK) {
+			KSI_pushError(signer->ctx, res, "Unable to join the signing thread.");
+			goto cleanup;
+		}
+
+		KSI_Thread_free(signer->signTask);
+		signer->signTask = NULL;
+
+		KSI_DataHash_free(signer->signRoot);
+		signer->signRoot = NULL;
+
+		if (signer->signResult == KSI_OK) {
+			/* Move the signature from the signing context to the context of the signer. The
+			 * signature was already verified during signing. */
+			res = KSI_Signature_parseWithPolicy(signer->ctx, signer->signRaw, signer->signRaw_len, KSI_VERIFICATION_POLICY_EMPTY, NULL, &signer->signature);
+			if (res != KSI_OK) signer->signResult = res;
+		}
+
+		KSI_free(signer->signRaw);
+		signer->signRaw = NULL;
+		signer->signRaw_len = 0;
+	}
+
+	if (signer->signResult != KSI_OK) {
+		KSI_pushError(signer->ctx, res = signer->signResult, "Asynchronous signing of the block failed.");
+		goto cleanup;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+int KSI_BlockSigner_closeAsync(KSI_BlockSigner *signer, KSI_CTX *signCtx, KSI_BlockSigner **next) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_BlockSigner *tmp = NULL;
+	KSI_DataHash *root = NULL;
+	const unsigned char *imprint = NULL;
+	size_t imprint_len = 0;
+
+	if (signer == NULL || signCtx == NULL || signCtx == signer->ctx) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	KSI_ERR_clearErrors(signer->ctx);
+
+	if (signer->signTask != NULL || signer->signature != NULL) {
+		KSI_pushError(signer->ctx, res = KSI_INVALID_STATE, "The block signer is already closed.");
+		goto cleanup;
+	}
+
+	KSI_LOG_debug(signer->ctx, "Closing block signer instance asynchronously.");
+
+	/* Add the leafs still in the mask stage. */
+	res = flushMaskStage(signer);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+	stopMaskTask(signer);
+
+	/* Finalize the tree. */
+	res = KSI_TreeBuilder_close(signer->builder);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	/* Create the successor chained to the last leaf of this block. */
+	if (next != NULL) {
+		res = KSI_BlockSigner_new(signer->ctx, signer->builder->algo, signer->prevLeaf, signer->iv, &tmp);
+		if (res != KSI_OK) {
+			KSI_pushError(signer->ctx, res, NULL);
+			goto cleanup;
+		}
+	}
+
+	/* The root hash must belong to the context used by the signing thread. */
+	res = KSI_DataHash_getImprint(signer->builder->rootNode->hash, &imprint, &imprint_len);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_DataHash_fromImprint(signCtx, imprint, imprint_len, &root);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	signer->signCtx = signCtx;
+	signer->signRoot = root;
+	signer->signLevel = signer->builder->rootNode->level;
+	signer->signResult = KSI_OK;
+	root = NULL;
+
+	res = KSI_Thread_start(signer->ctx, asyncSignTask, signer, &signer->signTask);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		discardAsyncSign(signer);
+		goto cleanup;
+	}
+
+	if (next != NULL) {
+		*next = tmp;
+		tmp = NULL;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_DataHash_free(root);
+	KSI_BlockSigner_free(tmp);
+
+	return res;
+}
+
+int KSI_BlockSigner_wait(KSI_BlockSigner *signer, KSI_MultiSignature **ms) {
+	int res = KSI_UNKNOWN_ERROR;
+
+	if (signer == NULL) {
 		res = KSI_INVALID_ARGUMENT;
 		goto cleanup;
 	}
 
 	KSI_ERR_clearErrors(signer->ctx);
 
-	/* Set the pointer to the meta data value. */
-	signer->metaData = metaData;
+	res = finishAsyncSign(signer);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	if (signer->signature == NULL) {
+		KSI_pushError(signer->ctx, res = KSI_INVALID_STATE, "The blocksigner is not closed.");
+		goto cleanup;
+	}
+
+	if (ms != NULL) {
+		res = createMultiSignature(signer, ms);
+		if (res != KSI_OK) {
+			KSI_pushError(signer->ctx, res, NULL);
+			goto cleanup;
+		}
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+int KSI_BlockSigner_reset(KSI_BlockSigner *signer) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_TreeBuilder *builder = NULL;
+	KSI_LIST(KSI_BlockSignerHandle) *leafList = NULL;
+
+	if (signer == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	KSI_ERR_clearErrors(signer->ctx);
+
+	/* Cancel the pending asynchronous close, if any. */
+	discardAsyncSign(signer);
+
+	/* The mask stage must not touch the queue while it is dropped. */
+	stopMaskTask(signer);
+
+	res = KSI_TreeBuilder_new(signer->ctx, signer->builder->algo, &builder);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_BlockSignerHandleList_new(&leafList);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	KSI_Signature_free(signer->signature);
+	signer->signature = NULL;
+
+	KSI_TreeBuilder_free(signer->builder);
+	signer->builder = builder;
+	builder = NULL;
+
+	KSI_BlockSignerHandleList_free(signer->leafList);
+	signer->leafList = leafList;
+	leafList = NULL;
+
+	/* Add the masking handle. */
+	res = KSI_TreeBuilderLeafProcessorList_append(signer->builder->cbList, &signer->maskingProcessor);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	/* Add the client id handle. */
+	res = KSI_TreeBuilderLeafProcessorList_append(signer->builder->cbList, &signer->metaDataProcessor);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
 
-	res = KSI_TreeBuilder_addDataHash(signer->builder, hsh, level, &leafHandle);
+	KSI_DataHash_free(signer->prevLeaf);
+	signer->prevLeaf = KSI_DataHash_ref(signer->origPrevLeaf);
+
+	res = resetMaskStage(signer, signer->origPrevLeaf);
 	if (res != KSI_OK) {
 		KSI_pushError(signer->ctx, res, NULL);
 		goto cleanup;
 	}
 
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_TreeBuilder_free(builder);
+	KSI_BlockSignerHandleList_free(leafList);
+
+	return res;
+}
+
+int KSI_BlockSigner_addLeaf(KSI_BlockSigner *signer, KSI_DataHash *hsh, int level, KSI_MetaData *metaData, KSI_BlockSignerHandle **handle) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_TreeLeafHandle *leafHandle = NULL;
+	KSI_BlockSignerHandle *tmp = NULL;
+
+	if (signer == NULL || hsh == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	KSI_ERR_clearErrors(signer->ctx);
+
 	res = KSI_BlockSignerHandle_new(signer->ctx, &tmp);
 	if (res != KSI_OK) {
 		KSI_pushError(signer->ctx, res, NULL);
 		goto cleanup;
 	}
 
-	tmp->leafHandle = leafHandle;
 	tmp->signer = signer;
 
-	res = KSI_BlockSignerHandleList_append(signer->leafList, tmp);
-	if (res != KSI_OK) goto cleanup;
+	if (signer->iv != NULL) {
+		/* The leaf is added to the tree once its mask has been calculated. */
+		res = addMaskedLeaf(signer, hsh, level, metaData, tmp);
+		if (res != KSI_OK) {
+			KSI_pushError(signer->ctx, res, NULL);
+			goto cleanup;
+		}
+	} else {
+		/* Set the pointer to the meta data value. */
+		signer->metaData = metaData;
 
-	if (handle != NULL) {
-		*handle = KSI_BlockSignerHandle_ref(tmp);
-	}
+		res = KSI_TreeBuilder_addDataHash(signer->builder, hsh, level, &leafHandle);
+		if (res != KSI_OK) {
+			KSI_pushError(signer->ctx, res, NULL);
+			goto cleanup;
+		}
 
-	tmp = NULL;
+		tmp->leafHandle = leafHandle;
+		leafHandle = NULL;
+
+		res = KSI_BlockSignerHandleList_append(signer->leafList, KSI_BlockSignerHandle_ref(tmp));
+		if (res != KSI_OK) {
+			KSI_BlockSignerHandle_free(tmp);
+			goto cleanup;
+		}
+	}
 
-	leafHandle = NULL;
+	if (handle != NULL) {
+		*handle = tmp;
+		tmp = NULL;
+	}
 
 	res = KSI_OK;
 
@@ -536,6 +1423,13 @@ int KSI_BlockSigner_getPrevLeaf(KSI_BlockSigner *signer, KSI_DataHash **prevLeaf
 
 	KSI_ERR_clearErrors(signer->ctx);
 
+	/* The value must follow the last leaf added. */
+	res = flushMaskStage(signer);
+	if (res != KSI_OK) {
+		KSI_pushError(signer->ctx, res, NULL);
+		goto cleanup;
+	}
+
 	*prevLeaf = KSI_DataHash_ref(signer->prevLeaf);
 
 	res = KSI_OK;
@@ -557,6 +1451,13 @@ int KSI_BlockSignerHandle_getSignature(KSI_BlockSignerHandle *handle, KSI_Signat
 
 	KSI_ERR_clearErrors(handle->ctx);
 
+	/* Resolve the signature of an asynchronously closed block. */
+	res = finishAsyncSign(handle->signer);
+	if (res != KSI_OK) {
+		KSI_pushError(handle->ctx, res, NULL);
+		goto cleanup;
+	}
+
 	if (handle->signer->signature == NULL) {
 		KSI_pushError(handle->ctx, res = KSI_INVALID_STATE, "The blocksigner is not closed.");
 		goto cleanup;
@@ -49,6 +49,9 @@ KSI_DEFINE_LIST(KSI_BlockSignerHandle);
  * \param[in]	initVal		The initial value for masking.
  * \param[out]	signer		Pointer to the receiving pointer.
  * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+ * \note With masking on a context shared by several threads (see #KSI_CTX_FLAG_SHARED), the
+ * masks are calculated by a separate thread while the leafs are added, so a masking error
+ * may be returned by a later call.
  */
 int KSI_BlockSigner_new(KSI_CTX *ctx, KSI_HashAlgorithm algoId, KSI_DataHash *prevLeaf, KSI_OctetString *initVal, KSI_BlockSigner **signer);
 
@@ -66,6 +69,30 @@ void KSI_BlockSigner_free(KSI_BlockSigner *signer);
  */
 int KSI_BlockSigner_close(KSI_BlockSigner *signer, KSI_MultiSignature **ms);
 
+/**
+ * Finalizes the computation of the tree and starts signing the root hash value in a
+ * background thread, so new leafs can be added to the next block while waiting for the
+ * aggregator response. The signature is collected with #KSI_BlockSigner_wait or implicitly
+ * by #KSI_BlockSignerHandle_getSignature.
+ * \param[in]	signer		Instance of the #KSI_BlockSigner.
+ * \param[in]	signCtx		KSI context used exclusively by the signing thread until the signature is collected.
+ * \param[out]	next		Pointer to the receiving pointer of the next block signer, which is
+ * 							chained to the last leaf of this block (can be \c NULL).
+ * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+ * \note As #KSI_CTX is not thread safe, \c signCtx must not be the context of the signer and must
+ * not be used by the caller before the signature has been collected. Errors of the signing
+ * itself are stored in the error stack of \c signCtx.
+ */
+int KSI_BlockSigner_closeAsync(KSI_BlockSigner *signer, KSI_CTX *signCtx, KSI_BlockSigner **next);
+
+/**
+ * Waits until the signing started by #KSI_BlockSigner_closeAsync has finished.
+ * \param[in]	signer		Instance of the #KSI_BlockSigner.
+ * \param[out]	ms			Pointer to the receiving pointer, may be \c NULL.
+ * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+ */
+int KSI_BlockSigner_wait(KSI_BlockSigner *signer, KSI_MultiSignature **ms);
+
 /**
  * Resets the block signer to its initial state. This will invalidate all the
  * #KSI_BlockSignerHandle instances still remaining.
@@ -115,6 +142,27 @@ int KSI_BlockSigner_getPrevLeaf(KSI_BlockSigner *signer, KSI_DataHash **prevLeaf
  */
 int KSI_BlockSignerHandle_getSignature(KSI_BlockSignerHandle *handle, KSI_Signature **sig);
 
+/**
+ * Callback for receiving the signatures of a closed block.
+ * \param[in]	c			The callback context.
+ * \param[in]	handle		Handle of the leaf the signature belongs to.
+ * \param[in]	sig			The signature; the callee is responsible for freeing it.
+ * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+ */
+typedef int (*KSI_BlockSignerSignatureCallback)(void *c, KSI_BlockSignerHandle *handle, KSI_Signature *sig);
+
+/**
+ * Creates the signatures for all the leafs of a closed block in the order the leafs were added.
+ * The aggregation chains are extracted in a single pass over the tree, which is considerably
+ * faster than calling #KSI_BlockSignerHandle_getSignature for every handle.
+ * \param[in]	signer		Instance of the #KSI_BlockSigner.
+ * \param[in]	fn			Callback receiving the signatures.
+ * \param[in]	c			Callback context.
+ * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+ * \see #KSI_BlockSigner_close, #KSI_BlockSigner_wait.
+ */
+int KSI_BlockSigner_getSignatures(KSI_BlockSigner *signer, KSI_BlockSignerSignatureCallback fn, void *c);
+
 /**
  * Cleanup method for the handle.
  * \param[in]	handle		Instance of the #KSI_BlockSignerHandle
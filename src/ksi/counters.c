@@ -0,0 +1,364 @@
+/*
+ * Copyright 2013-2016 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+
+#include <string.h>
+
+#include "internal.h"
+#include "ctx_impl.h"
+#include "counters_impl.h"
+
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <time.h>
+#endif
+
+/** Upper bounds of the latency histogram buckets in milliseconds, the last bucket is unbounded. */
+static const KSI_uint64_t latencyBounds[KSI_COUNTER_LATENCY_BUCKETS] = {
+	1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 0
+};
+
+static const char *serviceNames[KSI_NUMBER_OF_COUNTER_SERVICES] = {
+	"aggregator",
+	"extender",
+	"publications_file"
+};
+
+#ifdef KSI_ALLOC_COUNTERS
+/* Allocations are not related to any context, so they are counted for the whole process. */
+static volatile size_t allocCount = 0;
+static volatile size_t allocBytes = 0;
+
+void KSI_Counters_addAllocation(size_t size) {
+	KSI_Atomic_increment(&allocCount);
+	KSI_Atomic_add(&allocBytes, size);
+}
+#else
+void KSI_Counters_addAllocation(size_t size) {
+	(void)size;
+}
+#endif
+
+KSI_uint64_t KSI_Counters_clock(void) {
+#ifdef _WIN32
+	LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	if (!QueryPerformanceFrequency(&freq) || !QueryPerformanceCounter(&now) || freq.QuadPart == 0) return 0;
+	return (KSI_uint64_t)(now.QuadPart / freq.QuadPart) * 1000000 + (KSI_uint64_t)(now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+#else
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) != 0) return 0;
+	return (KSI_uint64_t)now.tv_sec * 1000000 + (KSI_uint64_t)now.tv_nsec / 1000;
+#endif
+}
+
+KSI_Counters *KSI_Counters_new(void) {
+	return KSI_calloc(1, sizeof(KSI_Counters));
+}
+
+void KSI_Counters_free(KSI_Counters *counters) {
+	KSI_free(counters);
+}
+
+/* Returns the counters of the rule, or NULL if the rule table is full. */
+static CounterRule *findRule(KSI_Counters *counters, const char *name) {
+	size_t i = (((size_t)name >> 3) * 2654435761u) & (COUNTER_RULE_INDEX_SIZE - 1);
+	CounterRule *rule = NULL;
+
+	while (counters->rulesIndex[i] != 0) {
+		rule = &counters->rules[counters->rulesIndex[i] - 1];
+		if (rule->name == name) return rule;
+		i = (i + 1) & (COUNTER_RULE_INDEX_SIZE - 1);
+	}
+
+	if (counters->rules_len >= KSI_COUNTER_MAX_RULES) return NULL;
+
+	rule = &counters->rules[counters->rules_len++];
+	rule->name = name;
+	rule->executed = 0;
+	rule->failed = 0;
+	counters->rulesIndex[i] = (unsigned char)counters->rules_len;
+
+	return rule;
+}
+
+void KSI_Counters_add(KSI_CTX *ctx, int counter, KSI_uint64_t value) {
+	KSI_Counters *counters = KSI_CTX_counters(ctx);
+
+	if (counters != NULL && counter >= 0 && counter < KSI_NUMBER_OF_COUNTERS) {
+		counters->values[counter] += value;
+	}
+}
+
+void KSI_Counters_addHash(KSI_CTX *ctx, KSI_HashAlgorithm algo_id) {
+	KSI_Counters *counters = KSI_CTX_counters(ctx);
+
+	if (counters != NULL && algo_id >= 0 && algo_id < KSI_NUMBER_OF_KNOWN_HASHALGS) {
+		counters->hashes[algo_id]++;
+	}
+}
+
+void KSI_Counters_addRequest(KSI_CTX *ctx, int service, int isFailed, KSI_uint64_t latency) {
+	KSI_Counters *counters = KSI_CTX_counters(ctx);
+	size_t i;
+
+	if (counters == NULL || service < 0 || service >= KSI_NUMBER_OF_COUNTER_SERVICES) return;
+
+	counters->sent[service]++;
+	if (isFailed) {
+		counters->failed[service]++;
+	} else {
+		counters->received[service]++;
+	}
+
+	for (i = 0; i < KSI_COUNTER_LATENCY_BUCKETS - 1; i++) {
+		if (latency <= latencyBounds[i] * 1000) break;
+	}
+	counters->latency[service][i]++;
+	counters->latencySum[service] += latency;
+}
+
+void KSI_Counters_addRule(KSI_CTX *ctx, const char *ruleName, int isFailed) {
+	KSI_Counters *counters = KSI_CTX_counters(ctx);
+	CounterRule *rule = NULL;
+
+	if (counters == NULL || ruleName == NULL) return;
+
+	rule = findRule(counters, ruleName);
+	if (rule != NULL) {
+		rule->executed++;
+		if (isFailed) rule->failed++;
+	}
+}
+
+static void mergeCounters(KSI_Counters *to, const KSI_Counters *from) {
+	size_t i;
+	size_t j;
+	CounterRule *rule = NULL;
+
+	for (i = 0; i < KSI_NUMBER_OF_COUNTERS; i++) {
+		to->values[i] += from->values[i];
+	}
+
+	for (i = 0; i < KSI_NUMBER_OF_KNOWN_HASHALGS; i++) {
+		to->hashes[i] += from->hashes[i];
+	}
+
+	for (i = 0; i < KSI_NUMBER_OF_COUNTER_SERVICES; i++) {
+		to->sent[i] += from->sent[i];
+		to->received[i] += from->received[i];
+		to->failed[i] += from->failed[i];
+		to->latencySum[i] += from->latencySum[i];
+		for (j = 0; j < KSI_COUNTER_LATENCY_BUCKETS; j++) {
+			to->latency[i][j] += from->latency[i][j];
+		}
+	}
+
+	for (i = 0; i < from->rules_len; i++) {
+		rule = findRule(to, from->rules[i].name);
+		if (rule != NULL) {
+			rule->executed += from->rules[i].executed;
+			rule->failed += from->rules[i].failed;
+		}
+	}
+}
+
+int KSI_CTX_getCounters(KSI_CTX *ctx, KSI_Counters **counters) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_Counters *tmp = NULL;
+	KSI_Counters *ptr = NULL;
+	int locked = 0;
+
+	KSI_ERR_clearErrors(ctx);
+	if (ctx == NULL || counters == NULL) {
+		KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
+		goto cleanup;
+	}
+
+	tmp = KSI_Counters_new();
+	if (tmp == NULL) {
+		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+	/* The lock only protects the list, the values of other threads are read as they are. */
+	KSI_Mutex_lock(ctx->countersLock);
+	locked = 1;
+
+	for (ptr = ctx->counters; ptr != NULL; ptr = ptr->next) {
+		mergeCounters(tmp, ptr);
+	}
+
+#ifdef KSI_ALLOC_COUNTERS
+	tmp->values[KSI_COUNTER_ALLOCATIONS] = allocCount;
+	tmp->values[KSI_COUNTER_ALLOCATED_BYTES] = allocBytes;
+#endif
+
+	*counters = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	if (locked) KSI_Mutex_unlock(ctx->countersLock);
+	KSI_Counters_free(tmp);
+
+	return res;
+}
+
+KSI_uint64_t KSI_Counters_get(const KSI_Counters *counters, int counter) {
+	if (counters == NULL || counter < 0 || counter >= KSI_NUMBER_OF_COUNTERS) return 0;
+	return counters->values[counter];
+}
+
+KSI_uint64_t KSI_Counters_getHashCount(const KSI_Counters *counters, KSI_HashAlgorithm algo_id) {
+	if (counters == NULL || algo_id < 0 || algo_id >= KSI_NUMBER_OF_KNOWN_HASHALGS) return 0;
+	return counters->hashes[algo_id];
+}
+
+int KSI_Counters_getService(const KSI_Counters *counters, int service, KSI_uint64_t *sent, KSI_uint64_t *received, KSI_uint64_t *failed, KSI_uint64_t *latency) {
+	if (counters == NULL || service < 0 || service >= KSI_NUMBER_OF_COUNTER_SERVICES) return KSI_INVALID_ARGUMENT;
+
+	if (sent != NULL) *sent = counters->sent[service];
+	if (received != NULL) *received = counters->received[service];
+	if (failed != NULL) *failed = counters->failed[service];
+	if (latency != NULL) *latency = counters->latencySum[service];
+
+	return KSI_OK;
+}
+
+int KSI_Counters_getLatency(const KSI_Counters *counters, int service, size_t bucket, KSI_uint64_t *upperBound, KSI_uint64_t *count) {
+	if (counters == NULL || service < 0 || service >= KSI_NUMBER_OF_COUNTER_SERVICES || bucket >= KSI_COUNTER_LATENCY_BUCKETS) return KSI_INVALID_ARGUMENT;
+
+	if (upperBound != NULL) *upperBound = latencyBounds[bucket];
+	if (count != NULL) *count = counters->latency[service][bucket];
+
+	return KSI_OK;
+}
+
+size_t KSI_Counters_getRuleCount(const KSI_Counters *counters) {
+	return counters != NULL ? counters->rules_len : 0;
+}
+
+int KSI_Counters_getRule(const KSI_Counters *counters, size_t index, const char **ruleName, KSI_uint64_t *executed, KSI_uint64_t *failed) {
+	if (counters == NULL || index >= counters->rules_len) return KSI_INVALID_ARGUMENT;
+
+	if (ruleName != NULL) *ruleName = counters->rules[index].name;
+	if (executed != NULL) *executed = counters->rules[index].executed;
+	if (failed != NULL) *failed = counters->rules[index].failed;
+
+	return KSI_OK;
+}
+
+static void writeLabel(FILE *f, const char *value) {
+	for (; *value != '\0'; value++) {
+		if (*value == '\\' || *value == '"') {
+			fputc('\\', f);
+			fputc(*value, f);
+		} else if (*value == '\n') {
+			fputs("\\n", f);
+		} else {
+			fputc(*value, f);
+		}
+	}
+}
+
+static void writeCounter(FILE *f, const char *name, const char *help, KSI_uint64_t value) {
+	fprintf(f, "# HELP ksi_%s %s\n# TYPE ksi_%s counter\nksi_%s %llu\n", name, help, name, name, (unsigned long long)value);
+}
+
+int KSI_Counters_writePrometheus(const KSI_Counters *counters, FILE *f) {
+	int res = KSI_UNKNOWN_ERROR;
+	size_t i;
+	size_t j;
+	int k;
+	KSI_uint64_t cumulative;
+	const char *name = NULL;
+
+	if (counters == NULL || f == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	writeCounter(f, "hashed_bytes_total", "Bytes added to data hashers.", counters->values[KSI_COUNTER_HASHED_BYTES]);
+	writeCounter(f, "tlv_parsed_total", "TLV blobs parsed.", counters->values[KSI_COUNTER_TLV_PARSED]);
+	writeCounter(f, "tlv_serialized_total", "TLVs serialized.", counters->values[KSI_COUNTER_TLV_SERIALIZED]);
+	writeCounter(f, "allocations_total", "Allocations made by the library.", counters->values[KSI_COUNTER_ALLOCATIONS]);
+	writeCounter(f, "allocated_bytes_total", "Bytes allocated by the library.", counters->values[KSI_COUNTER_ALLOCATED_BYTES]);
+
+	fprintf(f, "# HELP ksi_hashes_total Hash values computed.\n# TYPE ksi_hashes_total counter\n");
+	for (k = 0; k < KSI_NUMBER_OF_KNOWN_HASHALGS; k++) {
+		name = KSI_getHashAlgorithmName(k);
+		if (name == NULL || counters->hashes[k] == 0) continue;
+		fprintf(f, "ksi_hashes_total{algorithm=\"%s\"} %llu\n", name, (unsigned long long)counters->hashes[k]);
+	}
+
+	fprintf(f, "# HELP ksi_requests_total Requests sent.\n# TYPE ksi_requests_total counter\n");
+	for (i = 0; i < KSI_NUMBER_OF_COUNTER_SERVICES; i++) {
+		fprintf(f, "ksi_requests_total{service=\"%s\"} %llu\n", serviceNames[i], (unsigned long long)counters->sent[i]);
+	}
+
+	fprintf(f, "# HELP ksi_responses_total Responses received.\n# TYPE ksi_responses_total counter\n");
+	for (i = 0; i < KSI_NUMBER_OF_COUNTER_SERVICES; i++) {
+		fprintf(f, "ksi_responses_total{service=\"%s\"} %llu\n", serviceNames[i], (unsigned long long)counters->received[i]);
+	}
+
+	fprintf(f, "# HELP ksi_request_failures_total Requests failed on the transport level.\n# TYPE ksi_request_failures_total counter\n");
+	for (i = 0; i < KSI_NUMBER_OF_COUNTER_SERVICES; i++) {
+		fprintf(f, "ksi_request_failures_total{service=\"%s\"} %llu\n", serviceNames[i], (unsigned long long)counters->failed[i]);
+	}
+
+	fprintf(f, "# HELP ksi_request_latency_seconds Request round-trip time.\n# TYPE ksi_request_latency_seconds histogram\n");
+	for (i = 0; i < KSI_NUMBER_OF_COUNTER_SERVICES; i++) {
+		cumulative = 0;
+		for (j = 0; j < KSI_COUNTER_LATENCY_BUCKETS; j++) {
+			cumulative += counters->latency[i][j];
+			if (latencyBounds[j] != 0) {
+				fprintf(f, "ksi_request_latency_seconds_bucket{service=\"%s\",le=\"%g\"} %llu\n", serviceNames[i], latencyBounds[j] / 1000.0, (unsigned long long)cumulative);
+			} else {
+				fprintf(f, "ksi_request_latency_seconds_bucket{service=\"%s\",le=\"+Inf\"} %llu\n", serviceNames[i], (unsigned long long)cumulative);
+			}
+		}
+		fprintf(f, "ksi_request_latency_seconds_sum{service=\"%s\"} %g\n", serviceNames[i], counters->latencySum[i] / 1000000.0);
+		fprintf(f, "ksi_request_latency_seconds_count{service=\"%s\"} %llu\n", serviceNames[i], (unsigned long long)cumulative);
+	}
+
+	fprintf(f, "# HELP ksi_rule_executions_total Verification rules executed.\n# TYPE ksi_rule_executions_total counter\n");
+	for (i = 0; i < counters->rules_len; i++) {
+		fprintf(f, "ksi_rule_executions_total{rule=\"");
+		writeLabel(f, counters->rules[i].name);
+		fprintf(f, "\"} %llu\n", (unsigned long long)counters->rules[i].executed);
+	}
+
+	fprintf(f, "# HELP ksi_rule_failures_total Verification rules failed or not completed.\n# TYPE ksi_rule_failures_total counter\n");
+	for (i = 0; i < counters->rules_len; i++) {
+		fprintf(f, "ksi_rule_failures_total{rule=\"");
+		writeLabel(f, counters->rules[i].name);
+		fprintf(f, "\"} %llu\n", (unsigned long long)counters->rules[i].failed);
+	}
+
+	res = ferror(f) ? KSI_IO_ERROR : KSI_OK;
+
+cleanup:
+
+	return res;
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright 2013-2016 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+
+#ifndef KSI_COUNTERS_H_
+#define KSI_COUNTERS_H_
+
+#include <stdio.h>
+#include "types_base.h"
+#include "hash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \addtogroup counters Performance counters
+	 * Every #KSI_CTX keeps a set of counters about the work done by the library. The counters
+	 * are updated by the thread doing the work without any synchronization, so keeping them
+	 * costs only a few additions. A consistent copy of the values is taken with #KSI_CTX_getCounters.
+	 * @{
+	 */
+
+	/**
+	 * Performance counters of a context, see #KSI_CTX_getCounters.
+	 */
+	typedef struct KSI_Counters_st KSI_Counters;
+
+	/**
+	 * Plain counters.
+	 */
+	enum KSI_Counter_en {
+		/** Number of bytes added to data hashers. */
+		KSI_COUNTER_HASHED_BYTES = 0x00,
+
+		/** Number of TLV blobs parsed. */
+		KSI_COUNTER_TLV_PARSED,
+
+		/** Number of TLVs serialized. */
+		KSI_COUNTER_TLV_SERIALIZED,
+
+		/** Number of allocations made with #KSI_malloc and #KSI_calloc by the whole process. Only
+		 * available when the library is built with \c KSI_ALLOC_COUNTERS, 0 otherwise. */
+		KSI_COUNTER_ALLOCATIONS,
+
+		/** Number of bytes allocated with #KSI_malloc and #KSI_calloc by the whole process. Only
+		 * available when the library is built with \c KSI_ALLOC_COUNTERS, 0 otherwise. */
+		KSI_COUNTER_ALLOCATED_BYTES,
+
+		/** Number of plain counters. */
+		KSI_NUMBER_OF_COUNTERS
+	};
+
+	/**
+	 * Services the network counters are kept for.
+	 */
+	enum KSI_CounterService_en {
+		/** Aggregator requests. */
+		KSI_COUNTER_SERVICE_AGGREGATOR = 0x00,
+
+		/** Extender requests. */
+		KSI_COUNTER_SERVICE_EXTENDER,
+
+		/** Publications file downloads. */
+		KSI_COUNTER_SERVICE_PUBLICATIONS_FILE,
+
+		/** Number of services. */
+		KSI_NUMBER_OF_COUNTER_SERVICES
+	};
+
+	/**
+	 * Number of buckets in the request round-trip latency histograms.
+	 */
+	#define KSI_COUNTER_LATENCY_BUCKETS 14
+
+	/**
+	 * Number of distinct verification rules the counters are kept for. The executions of
+	 * the rules exceeding this limit are not counted.
+	 */
+	#define KSI_COUNTER_MAX_RULES 64
+
+	/**
+	 * Takes a snapshot of the performance counters of the context. The counters of all the
+	 * threads using a shared context are summed up.
+	 * \param[in]	ctx			KSI context.
+	 * \param[out]	counters	Pointer to the receiving pointer.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 * \note The counters of other threads are read without synchronization, so the values
+	 * may slightly lag behind the work those threads are doing at the same time.
+	 * \see #KSI_Counters_free
+	 */
+	int KSI_CTX_getCounters(KSI_CTX *ctx, KSI_Counters **counters);
+
+	/**
+	 * Cleanup method for the #KSI_Counters.
+	 * \param[in]	counters	Instance of #KSI_Counters.
+	 */
+	void KSI_Counters_free(KSI_Counters *counters);
+
+	/**
+	 * Returns the value of a plain counter.
+	 * \param[in]	counters	Instance of #KSI_Counters.
+	 * \param[in]	counter		Counter id, see #KSI_Counter_en.
+	 * \return The value of the counter, or 0 if the counter id is not known.
+	 */
+	KSI_uint64_t KSI_Counters_get(const KSI_Counters *counters, int counter);
+
+	/**
+	 * Returns the number of hash values computed with the given algorithm.
+	 * \param[in]	counters	Instance of #KSI_Counters.
+	 * \param[in]	algo_id		Hash algorithm.
+	 * \return The number of hash values, or 0 if the algorithm is not known.
+	 */
+	KSI_uint64_t KSI_Counters_getHashCount(const KSI_Counters *counters, KSI_HashAlgorithm algo_id);
+
+	/**
+	 * Getter for the request counters of a service. Every output parameter may be \c NULL.
+	 * \param[in]	counters	Instance of #KSI_Counters.
+	 * \param[in]	service		Service id, see #KSI_CounterService_en.
+	 * \param[out]	sent		Number of requests sent.
+	 * \param[out]	received	Number of responses received.
+	 * \param[out]	failed		Number of requests that failed on the transport level.
+	 * \param[out]	latency		Sum of the round-trip times of the requests in microseconds.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_Counters_getService(const KSI_Counters *counters, int service, KSI_uint64_t *sent, KSI_uint64_t *received, KSI_uint64_t *failed, KSI_uint64_t *latency);
+
+	/**
+	 * Getter for a bucket of the round-trip latency histogram of a service. Every request
+	 * is counted in exactly one bucket.
+	 * \param[in]	counters	Instance of #KSI_Counters.
+	 * \param[in]	service		Service id, see #KSI_CounterService_en.
+	 * \param[in]	bucket		Bucket index, less than #KSI_COUNTER_LATENCY_BUCKETS.
+	 * \param[out]	upperBound	Upper bound of the bucket in milliseconds, 0 for the last unbounded bucket. May be \c NULL.
+	 * \param[out]	count		Number of requests in the bucket. May be \c NULL.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_Counters_getLatency(const KSI_Counters *counters, int service, size_t bucket, KSI_uint64_t *upperBound, KSI_uint64_t *count);
+
+	/**
+	 * Returns the number of verification rules with counters.
+	 * \param[in]	counters	Instance of #KSI_Counters.
+	 * \return The number of rules.
+	 */
+	size_t KSI_Counters_getRuleCount(const KSI_Counters *counters);
+
+	/**
+	 * Getter for the counters of a verification rule. Every output parameter may be \c NULL.
+	 * \param[in]	counters	Instance of #KSI_Counters.
+	 * \param[in]	index		Index of the rule, less than #KSI_Counters_getRuleCount.
+	 * \param[out]	ruleName	Name of the rule.
+	 * \param[out]	executed	Number of times the rule was executed.
+	 * \param[out]	failed		Number of times the rule failed or could not be completed.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_Counters_getRule(const KSI_Counters *counters, size_t index, const char **ruleName, KSI_uint64_t *executed, KSI_uint64_t *failed);
+
+	/**
+	 * Writes the counters to the stream in the Prometheus text exposition format. All the
+	 * metric names are prefixed with \c ksi_.
+	 * \param[in]	counters	Instance of #KSI_Counters.
+	 * \param[in]	f			Output stream.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_Counters_writePrometheus(const KSI_Counters *counters, FILE *f);
+
+/**
+ * @}
+ */
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KSI_COUNTERS_H_ */
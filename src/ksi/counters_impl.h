@@ -0,0 +1,125 @@
+/*
+ * Copyright 2013-2016 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+
+#ifndef COUNTERS_IMPL_H_
+#define COUNTERS_IMPL_H_
+
+#include "counters.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/** Counters of a single verification rule. */
+	typedef struct CounterRule_st {
+		/** Name of the rule, the pointer is used as the key. */
+		const char *name;
+		KSI_uint64_t executed;
+		KSI_uint64_t failed;
+	} CounterRule;
+
+	/** Size of the open addressing index of #KSI_Counters_st::rules, a power of two. */
+	#define COUNTER_RULE_INDEX_SIZE (2 * KSI_COUNTER_MAX_RULES)
+
+	/**
+	 * The same structure is used both for the counters of a single thread and for the
+	 * snapshots returned to the user.
+	 */
+	struct KSI_Counters_st {
+		/** Plain counters, see #KSI_Counter_en. */
+		KSI_uint64_t values[KSI_NUMBER_OF_COUNTERS];
+
+		/** Number of hash values computed per algorithm. */
+		KSI_uint64_t hashes[KSI_NUMBER_OF_KNOWN_HASHALGS];
+
+		/** Requests sent, responses received and transport failures per service. */
+		KSI_uint64_t sent[KSI_NUMBER_OF_COUNTER_SERVICES];
+		KSI_uint64_t received[KSI_NUMBER_OF_COUNTER_SERVICES];
+		KSI_uint64_t failed[KSI_NUMBER_OF_COUNTER_SERVICES];
+
+		/** Round-trip latency histograms and their sums in microseconds. */
+		KSI_uint64_t latency[KSI_NUMBER_OF_COUNTER_SERVICES][KSI_COUNTER_LATENCY_BUCKETS];
+		KSI_uint64_t latencySum[KSI_NUMBER_OF_COUNTER_SERVICES];
+
+		/** Verification rules in the order of their first execution. */
+		CounterRule rules[KSI_COUNTER_MAX_RULES];
+		size_t rules_len;
+
+		/** Maps the hash of the rule name pointer to the position in #rules plus one. */
+		unsigned char rulesIndex[COUNTER_RULE_INDEX_SIZE];
+
+		/** Next counters of the same shared context. */
+		KSI_Counters *next;
+	};
+
+	/**
+	 * Allocates a zeroed instance of #KSI_Counters.
+	 * \return The new instance, or \c NULL if out of memory.
+	 */
+	KSI_Counters *KSI_Counters_new(void);
+
+	/**
+	 * Adds \c value to a plain counter of the calling thread.
+	 * \param[in]	ctx			KSI context.
+	 * \param[in]	counter		Counter id, see #KSI_Counter_en.
+	 * \param[in]	value		Value to be added.
+	 */
+	void KSI_Counters_add(KSI_CTX *ctx, int counter, KSI_uint64_t value);
+
+	/**
+	 * Counts a hash value computed with the given algorithm.
+	 * \param[in]	ctx			KSI context.
+	 * \param[in]	algo_id		Hash algorithm.
+	 */
+	void KSI_Counters_addHash(KSI_CTX *ctx, KSI_HashAlgorithm algo_id);
+
+	/**
+	 * Counts a performed request.
+	 * \param[in]	ctx			KSI context.
+	 * \param[in]	service		Service id, see #KSI_CounterService_en.
+	 * \param[in]	isFailed	Non-zero if the request failed on the transport level.
+	 * \param[in]	latency		Round-trip time in microseconds.
+	 */
+	void KSI_Counters_addRequest(KSI_CTX *ctx, int service, int isFailed, KSI_uint64_t latency);
+
+	/**
+	 * Counts an executed verification rule.
+	 * \param[in]	ctx			KSI context.
+	 * \param[in]	ruleName	Name of the rule, a string with static storage duration.
+	 * \param[in]	isFailed	Non-zero if the rule failed or could not be completed.
+	 */
+	void KSI_Counters_addRule(KSI_CTX *ctx, const char *ruleName, int isFailed);
+
+	/**
+	 * Counts an allocation of the process, used by #KSI_malloc and #KSI_calloc when the
+	 * library is built with \c KSI_ALLOC_COUNTERS.
+	 * \param[in]	size		Number of bytes allocated.
+	 */
+	void KSI_Counters_addAllocation(size_t size);
+
+	/**
+	 * Returns the value of a monotonic clock in microseconds, for measuring latencies.
+	 */
+	KSI_uint64_t KSI_Counters_clock(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COUNTERS_IMPL_H_ */
@@ -21,6 +21,12 @@
 #define CTX_IMPL_H_
 
 #include "types.h"
+#include "rootcache.h"
+#include "extcache.h"
+#include "policy_impl.h"
+#include "thread.h"
+#include "counters_impl.h"
+#include "trace.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -28,11 +34,50 @@ extern "C" {
 
 #define KSI_ERR_STACK_LEN 16
 
+/**
+ * Evaluates to non-zero if a message of the given level would be written by the logger of
+ * the context. Callers should use it to guard log statements with costly arguments.
+ */
+#define KSI_LOG_ENABLED(ctx, level) ((ctx) != NULL && (ctx)->loggerCB != NULL && (level) <= (ctx)->logLevel)
+
+/**
+ * Evaluates to non-zero if the context has a trace callback.
+ */
+#define KSI_TRACE_ENABLED(ctx) ((ctx) != NULL && (ctx)->traceCB != NULL)
+
+/**
+ * Reports a trace event with the given timestamp. The arguments are not evaluated if tracing is off.
+ */
+#define KSI_TRACE_AT(ctx, phase, event, requestId, timestamp) \
+	do { \
+		if (KSI_TRACE_ENABLED(ctx)) (ctx)->traceCB((ctx)->traceCtx, (phase), (event), (requestId), (timestamp)); \
+	} while (0)
+
+/**
+ * Reports a trace event at the current time.
+ */
+#define KSI_TRACE(ctx, phase, event, requestId) KSI_TRACE_AT((ctx), (phase), (event), (requestId), KSI_Counters_clock())
+
 	typedef void (*GlobalCleanupFn)(void);
 	typedef int (*GlobalInitFn)(void);
 
 	KSI_DEFINE_LIST(GlobalCleanupFn)
 
+	/** State kept separately for every thread using a shared context. */
+	typedef struct CtxThreadState_st {
+		/** Array of errors. */
+		KSI_ERR errors[KSI_ERR_STACK_LEN];
+
+		/** Count of errors. */
+		size_t errors_count;
+
+		/** Pointer to the last signature that failed background verification. */
+		KSI_Signature *lastFailedSignature;
+
+		/** Performance counters of the thread, owned by the context. */
+		KSI_Counters *counters;
+	} CtxThreadState;
+
 	struct KSI_CTX_st {
 
 		/******************
@@ -57,6 +102,12 @@ extern "C" {
 		/** Logger context. */
 		void *loggerCtx;
 
+		/** Trace callback function, \c NULL if tracing is off. */
+		KSI_TraceCallback traceCB;
+
+		/** Trace context. */
+		void *traceCtx;
+
 		/************
 		 * TRANSPORT.
 		 ************/
@@ -97,8 +148,60 @@ extern "C" {
 		/** Pointer to the last signature that failed background verification. */
 		KSI_Signature *lastFailedSignature;
 
+		/** Calendar roots already proven by the current publications file and trust settings. */
+		KSI_CalendarRootCache *rootCache;
+
+		/** Calendar hash chains already received from the extender. */
+		KSI_ExtendedChainCache *extChainCache;
+
+		/** Programs of the predefined verification policies, compiled on first use. */
+		PolicyProgram *policyPrograms[POLICY_NUM_OF_PREDEFINED];
+
+		/** Rules of the policies built by hand, whose programs are kept in #policyCachePrograms. */
+		const KSI_Rule *policyCacheRules[POLICY_NUM_OF_CACHED];
+
+		/** Programs compiled from #policyCacheRules on first use. */
+		PolicyProgram *policyCachePrograms[POLICY_NUM_OF_CACHED];
+
+		/*****************
+		 * SHARED CONTEXT.
+		 *****************/
+
+		/** Per-thread #CtxThreadState of a shared context, \c NULL if the context is not shared. */
+		KSI_ThreadLocal *threadState;
+
+		/** Lock for the lazily initialized members of a shared context, \c NULL if the context is not shared. */
+		KSI_Mutex *lock;
+
+		/** Signalled with #lock when the download of the publications file has finished, \c NULL if the context is not shared. */
+		KSI_Cond *pubFileCond;
+
+		/** Set while a thread is downloading the publications file. */
+		int pubFileLoading;
+
+		/** Performance counters, linked with #KSI_Counters_st::next for every thread of a shared context. */
+		KSI_Counters *counters;
+
+		/** Lock for the list of #counters, \c NULL if the context is not shared. It is separate from #lock,
+		 * as the counters of a thread are created on its first event, which may happen with #lock held. */
+		KSI_Mutex *countersLock;
+
 	};
 
+	/**
+	 * Returns the last failed signature slot of the calling thread.
+	 * \param[in]	ctx		KSI context.
+	 * \return Pointer to the slot or \c NULL if the per-thread state could not be allocated.
+	 */
+	KSI_Signature **KSI_CTX_lastFailedSignature(KSI_CTX *ctx);
+
+	/**
+	 * Returns the performance counters of the calling thread.
+	 * \param[in]	ctx		KSI context.
+	 * \return Pointer to the counters or \c NULL if the per-thread state could not be allocated.
+	 */
+	KSI_Counters *KSI_CTX_counters(KSI_CTX *ctx);
+
 #ifdef __cplusplus
 }
 #endif
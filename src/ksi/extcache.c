@@ -0,0 +1,222 @@
+/*
+ * Copyright 2013-2016 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+
+#include <string.h>
+
+#include "internal.h"
+#include "extcache.h"
+#include "hashchain.h"
+#include "tlv_template.h"
+#include "thread.h"
+
+KSI_IMPORT_TLV_TEMPLATE(KSI_CalendarHashChain);
+
+typedef struct KSI_ExtendedChainCacheEntry_st {
+	KSI_uint64_t aggrTime;
+	KSI_uint64_t pubTime;
+	/* Serialized chain, every reader parses a private copy. */
+	unsigned char *raw;
+	size_t raw_len;
+	/* Set while a thread is requesting the chain. */
+	int pending;
+	int used;
+} KSI_ExtendedChainCacheEntry;
+
+struct KSI_ExtendedChainCache_st {
+	KSI_CTX *ctx;
+	KSI_Mutex *lock;
+	KSI_Cond *cond;
+	KSI_ExtendedChainCacheEntry entries[KSI_EXTENDED_CHAIN_CACHE_SIZE];
+};
+
+int KSI_ExtendedChainCache_new(KSI_CTX *ctx, KSI_ExtendedChainCache **cache) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_ExtendedChainCache *tmp = NULL;
+
+	if (ctx == NULL || cache == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	tmp = KSI_new(KSI_ExtendedChainCache);
+	if (tmp == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	memset(tmp, 0, sizeof(KSI_ExtendedChainCache));
+	tmp->ctx = ctx;
+
+	res = KSI_Mutex_new(ctx, &tmp->lock);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Cond_new(ctx, &tmp->cond);
+	if (res != KSI_OK) goto cleanup;
+
+	*cache = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_ExtendedChainCache_free(tmp);
+
+	return res;
+}
+
+void KSI_ExtendedChainCache_free(KSI_ExtendedChainCache *cache) {
+	size_t i;
+
+	if (cache != NULL) {
+		for (i = 0; i < KSI_EXTENDED_CHAIN_CACHE_SIZE; i++) {
+			KSI_free(cache->entries[i].raw);
+		}
+		KSI_Cond_free(cache->cond);
+		KSI_Mutex_free(cache->lock);
+		KSI_free(cache);
+	}
+}
+
+void KSI_ExtendedChainCache_invalidate(KSI_ExtendedChainCache *cache) {
+	size_t i;
+
+	if (cache != NULL) {
+		KSI_Mutex_lock(cache->lock);
+		for (i = 0; i < KSI_EXTENDED_CHAIN_CACHE_SIZE; i++) {
+			/* Pending entries are completed by their owners. */
+			if (cache->entries[i].pending) continue;
+
+			KSI_free(cache->entries[i].raw);
+			memset(&cache->entries[i], 0, sizeof(KSI_ExtendedChainCacheEntry));
+		}
+		KSI_Mutex_unlock(cache->lock);
+	}
+}
+
+static KSI_ExtendedChainCacheEntry *getEntry(KSI_ExtendedChainCache *cache, KSI_uint64_t aggrTime, KSI_uint64_t pubTime) {
+	return &cache->entries[(size_t)((aggrTime * 31 + pubTime) % KSI_EXTENDED_CHAIN_CACHE_SIZE)];
+}
+
+int KSI_ExtendedChainCache_get(KSI_ExtendedChainCache *cache, KSI_CTX *ctx, KSI_uint64_t aggrTime, KSI_uint64_t pubTime, KSI_CalendarHashChain **chain, int *claimed) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_ExtendedChainCacheEntry *entry = NULL;
+	unsigned char *raw = NULL;
+	size_t raw_len = 0;
+	KSI_CalendarHashChain *tmp = NULL;
+
+	if (cache == NULL || ctx == NULL || chain == NULL || claimed == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	*chain = NULL;
+	*claimed = 0;
+
+	KSI_Mutex_lock(cache->lock);
+	entry = getEntry(cache, aggrTime, pubTime);
+	for (;;) {
+		int isSame = entry->used && entry->aggrTime == aggrTime && entry->pubTime == pubTime;
+
+		if (isSame && entry->pending) {
+			/* Another thread is requesting the same chain. */
+			KSI_Cond_wait(cache->cond, cache->lock);
+			continue;
+		}
+
+		if (isSame) {
+			raw = KSI_malloc(entry->raw_len);
+			if (raw != NULL) {
+				memcpy(raw, entry->raw, entry->raw_len);
+				raw_len = entry->raw_len;
+			}
+		} else if (!entry->pending) {
+			/* Replace the older entry of the slot. */
+			KSI_free(entry->raw);
+			memset(entry, 0, sizeof(KSI_ExtendedChainCacheEntry));
+			entry->aggrTime = aggrTime;
+			entry->pubTime = pubTime;
+			entry->pending = 1;
+			entry->used = 1;
+			*claimed = 1;
+		}
+		break;
+	}
+	KSI_Mutex_unlock(cache->lock);
+
+	if (raw != NULL) {
+		res = KSI_CalendarHashChain_new(ctx, &tmp);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_TlvTemplate_parse(ctx, raw, raw_len, KSI_TLV_TEMPLATE(KSI_CalendarHashChain), tmp);
+		if (res != KSI_OK) goto cleanup;
+
+		*chain = tmp;
+		tmp = NULL;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_free(raw);
+	KSI_CalendarHashChain_free(tmp);
+
+	return res;
+}
+
+void KSI_ExtendedChainCache_add(KSI_ExtendedChainCache *cache, KSI_CTX *ctx, KSI_uint64_t aggrTime, KSI_uint64_t pubTime, KSI_CalendarHashChain *chain) {
+	unsigned char *raw = NULL;
+	size_t raw_len = 0;
+	KSI_ExtendedChainCacheEntry *entry = NULL;
+
+	if (cache == NULL || chain == NULL) return;
+
+	if (KSI_TlvTemplate_serializeObject(ctx, chain, 0x0802, 0, 0, KSI_TLV_TEMPLATE(KSI_CalendarHashChain), &raw, &raw_len) != KSI_OK) {
+		KSI_ExtendedChainCache_release(cache, aggrTime, pubTime);
+		return;
+	}
+
+	KSI_Mutex_lock(cache->lock);
+	entry = getEntry(cache, aggrTime, pubTime);
+	if (entry->pending && entry->aggrTime == aggrTime && entry->pubTime == pubTime) {
+		entry->raw = raw;
+		entry->raw_len = raw_len;
+		entry->pending = 0;
+		raw = NULL;
+	}
+	KSI_Cond_broadcast(cache->cond);
+	KSI_Mutex_unlock(cache->lock);
+
+	KSI_free(raw);
+}
+
+void KSI_ExtendedChainCache_release(KSI_ExtendedChainCache *cache, KSI_uint64_t aggrTime, KSI_uint64_t pubTime) {
+	KSI_ExtendedChainCacheEntry *entry = NULL;
+
+	if (cache == NULL) return;
+
+	KSI_Mutex_lock(cache->lock);
+	entry = getEntry(cache, aggrTime, pubTime);
+	if (entry->pending && entry->aggrTime == aggrTime && entry->pubTime == pubTime) {
+		memset(entry, 0, sizeof(KSI_ExtendedChainCacheEntry));
+	}
+	KSI_Cond_broadcast(cache->cond);
+	KSI_Mutex_unlock(cache->lock);
+}
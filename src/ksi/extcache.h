@@ -0,0 +1,101 @@
+/*
+ * Copyright 2013-2016 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+
+#ifndef KSI_EXTCACHE_H_
+#define KSI_EXTCACHE_H_
+
+#include "ksi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef KSI_EXTENDED_CHAIN_CACHE_SIZE
+/** Number of slots in the extended calendar hash chain cache. */
+#  define KSI_EXTENDED_CHAIN_CACHE_SIZE 256
+#endif
+
+	/**
+	 * Cache of the calendar hash chains returned by the extender, keyed by the aggregation
+	 * time and the publication time. All the signatures created in the same second are
+	 * extended to a publication with the same calendar hash chain, so verifying an archive
+	 * needs a single extender request per second instead of one per signature. When
+	 * several threads need the same chain at the same time, only one of them sends the
+	 * request and the others wait for the result.
+	 */
+	typedef struct KSI_ExtendedChainCache_st KSI_ExtendedChainCache;
+
+	/**
+	 * Creates a new empty cache.
+	 * \param[in]	ctx		KSI context.
+	 * \param[out]	cache	Pointer to the receiving pointer.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_ExtendedChainCache_new(KSI_CTX *ctx, KSI_ExtendedChainCache **cache);
+
+	/**
+	 * Releases the cache.
+	 * \param[in]	cache	The cache.
+	 */
+	void KSI_ExtendedChainCache_free(KSI_ExtendedChainCache *cache);
+
+	/**
+	 * Removes all the entries, e.g. when the extender changes.
+	 * \param[in]	cache	The cache.
+	 */
+	void KSI_ExtendedChainCache_invalidate(KSI_ExtendedChainCache *cache);
+
+	/**
+	 * Looks up the calendar hash chain. If the chain is being requested by another thread,
+	 * waits until the request has finished. If the chain is not cached, \c chain is set to
+	 * \c NULL and, if \c claimed is set to 1, the caller must request the chain and
+	 * complete the entry with #KSI_ExtendedChainCache_add or #KSI_ExtendedChainCache_release.
+	 * \param[in]	cache		The cache.
+	 * \param[in]	ctx			KSI context of the calling thread.
+	 * \param[in]	aggrTime	Aggregation time of the signature.
+	 * \param[in]	pubTime		Publication time the signature is extended to.
+	 * \param[out]	chain		Pointer to the receiving pointer of a private copy of the chain.
+	 * \param[out]	claimed		Set to 1, if the caller has to complete the entry.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_ExtendedChainCache_get(KSI_ExtendedChainCache *cache, KSI_CTX *ctx, KSI_uint64_t aggrTime, KSI_uint64_t pubTime, KSI_CalendarHashChain **chain, int *claimed);
+
+	/**
+	 * Completes a claimed entry with the chain received from the extender.
+	 * \param[in]	cache		The cache.
+	 * \param[in]	ctx			KSI context of the calling thread.
+	 * \param[in]	aggrTime	Aggregation time of the signature.
+	 * \param[in]	pubTime		Publication time the signature is extended to.
+	 * \param[in]	chain		The chain, a copy is stored.
+	 */
+	void KSI_ExtendedChainCache_add(KSI_ExtendedChainCache *cache, KSI_CTX *ctx, KSI_uint64_t aggrTime, KSI_uint64_t pubTime, KSI_CalendarHashChain *chain);
+
+	/**
+	 * Releases a claimed entry after a failed request, so another thread may retry.
+	 * \param[in]	cache		The cache.
+	 * \param[in]	aggrTime	Aggregation time of the signature.
+	 * \param[in]	pubTime		Publication time the signature is extended to.
+	 */
+	void KSI_ExtendedChainCache_release(KSI_ExtendedChainCache *cache, KSI_uint64_t aggrTime, KSI_uint64_t pubTime);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KSI_EXTCACHE_H_ */
@@ -72,7 +72,7 @@ static struct KSI_hashAlgorithmInfo_st {
  */
 
 void KSI_DataHash_free(KSI_DataHash *hash) {
-	if (hash != NULL && --hash->ref == 0) {
+	if (hash != NULL && KSI_REF_DECREMENT(hash) == 0) {
 		KSI_free(hash);
 	}
 }
@@ -327,7 +327,7 @@ int KSI_DataHash_clone(KSI_DataHash *from, KSI_DataHash **to) {
 	}
 	KSI_ERR_clearErrors(from->ctx);
 
-	from->ref++;
+	KSI_REF_INCREMENT(from);
 	*to = from;
 
 	res = KSI_OK;
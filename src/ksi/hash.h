@@ -138,6 +138,20 @@ extern "C" {
 	 */
 	int KSI_DataHasher_addOctetString(KSI_DataHasher *hasher, KSI_OctetString *data);
 
+	/**
+	 * Adds the contents of the file from the current position to the end of the file to
+	 * the hash computation. The file is read ahead in a separate thread or, if enabled with
+	 * #KSI_CTX_FLAG_MAP_FILES, a large regular file is mapped into memory a window at a time,
+	 * so the memory use does not depend on the size of the file.
+	 * \param[in]	hasher				Hasher object.
+	 * \param[in]	fd					Descriptor of a file opened for reading.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 * \note The descriptor is left at the end of the file and is not closed. A mapped file
+	 * must not be truncated while it is hashed, see #KSI_CTX_FLAG_MAP_FILES.
+	 * \see #KSI_DataHash_createFromFile
+	 */
+	int KSI_DataHasher_addFile(KSI_DataHasher *hasher, int fd);
+
 	/**
 	 * Finalizes a hash computation.
 	 * \param[in]	hasher			Hasher object.
@@ -148,6 +162,18 @@ extern "C" {
 	 */
 	int KSI_DataHasher_close(KSI_DataHasher *hasher, KSI_DataHash **hash);
 
+	/**
+	 * Creates an independent copy of a hasher, including all the data added so far. This
+	 * makes it possible to absorb a common prefix once and continue the computation from
+	 * that state as many times as needed.
+	 * \param[in]	from			Hasher object to be copied.
+	 * \param[out]	to				Pointer that will receive pointer to the copy.
+	 *
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 * \see #KSI_DataHasher_open, #KSI_DataHasher_free
+	 */
+	int KSI_DataHasher_clone(const KSI_DataHasher *from, KSI_DataHasher **to);
+
 	/**
 	 * Frees the data hasher object.
 	 * \param[in]		hasher			Hasher object.
@@ -179,6 +205,48 @@ extern "C" {
 	 */
 	int KSI_DataHash_create(KSI_CTX *ctx, const void *data, size_t data_length, KSI_HashAlgorithm algo_id, KSI_DataHash **hash);
 
+	/**
+	 * Calculates the data hash object of the contents of a file.
+	 *
+	 * \param[in]	ctx				KSI context.
+	 * \param[in]	fileName		Name of the file.
+	 * \param[in]	algo_id			Hash algorithm id.
+	 * \param[out]	hash			Pointer to the pointer receiving the data hash object.
+	 *
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 * \see #KSI_DataHasher_addFile, #KSI_DataHash_free
+	 */
+	int KSI_DataHash_createFromFile(KSI_CTX *ctx, const char *fileName, KSI_HashAlgorithm algo_id, KSI_DataHash **hash);
+
+	/**
+	 * Callback for receiving the hashes of the files.
+	 * \param[in]	c			The callback context.
+	 * \param[in]	index		Index of the file in the input list.
+	 * \param[in]	status		Status of hashing the file (#KSI_OK, when the file was hashed).
+	 * \param[in]	hsh			Hash of the file, \c NULL if hashing failed; the callee is responsible for freeing it.
+	 * \return status code (#KSI_OK to continue, otherwise an error code to stop hashing).
+	 */
+	typedef int (*KSI_FileHashCallback)(void *c, size_t index, int status, KSI_DataHash *hsh);
+
+	/**
+	 * Calculates the hashes of a list of files on a pool of worker threads. The results are
+	 * passed to the callback in the calling thread and in the order of the input list, so
+	 * the callback may process the results (e.g. add them to a #KSI_BlockSigner) while the
+	 * workers continue with the next files.
+	 * \param[in]	ctx				KSI context.
+	 * \param[in]	fileNames		Names of the files.
+	 * \param[in]	fileNames_len	Number of files.
+	 * \param[in]	algo_id			Hash algorithm id.
+	 * \param[in]	workers			Number of worker threads, 0 to hash the files in the calling thread.
+	 * \param[in]	fn				Callback receiving the hashes.
+	 * \param[in]	c				Callback context.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code). Failing to
+	 * hash a single file is reported only to the callback.
+	 * \note When worker threads are used, the context has to be shared (see #KSI_CTX_FLAG_SHARED).
+	 * \see #KSI_DataHash_createFromFile
+	 */
+	int KSI_DataHash_createFromFiles(KSI_CTX *ctx, char **fileNames, size_t fileNames_len, KSI_HashAlgorithm algo_id, size_t workers, KSI_FileHashCallback fn, void *c);
+
 	/**
 	 * Creates a clone of the data hash.
 	 *
@@ -19,6 +19,7 @@
 
 #include "internal.h"
 #include "hash_impl.h"
+#include "counters_impl.h"
 
 #if KSI_HASH_IMPL == KSI_IMPL_CRYPTOAPI
 
@@ -32,8 +33,8 @@ typedef struct CRYPTO_HASH_CTX_st {
 
 static void CRYPTO_HASH_CTX_free(CRYPTO_HASH_CTX *cryptoCtxt){
 	if (cryptoCtxt != NULL){
-		/* All hash objects that have been created by using a specific CSP must be  destroyed before that CSP
-		 * handle is released with the CryptReleaseContext function. */
+		/* All hash objects that have been created by using a specific CSP must be  destroyed before that CSP
+		 * handle is released with the CryptReleaseContext function. */
 		if (cryptoCtxt->pt_hHash) CryptDestroyHash(cryptoCtxt->pt_hHash);
 		if (cryptoCtxt->pt_CSP) CryptReleaseContext(cryptoCtxt->pt_CSP, 0);
 		KSI_free(cryptoCtxt);
@@ -130,6 +131,8 @@ static int closeExisting(KSI_DataHasher *hasher, KSI_DataHash *data_hash) {
 	data_hash->imprint[0] = (unsigned char) hasher->algorithm;
 	data_hash->imprint_length = digest_length + 1;
 
+	KSI_Counters_addHash(hasher->ctx, hasher->algorithm);
+
 	res = KSI_OK;
 
 cleanup:
@@ -315,6 +318,8 @@ int KSI_DataHasher_add(KSI_DataHasher *hasher, const void *data, size_t data_len
 		goto cleanup;
 	}
 
+	KSI_Counters_add(ctx, KSI_COUNTER_HASHED_BYTES, data_length);
+
 	res = KSI_OK;
 
 cleanup:
@@ -322,4 +327,67 @@ cleanup:
 	return res;
 }
 
+int KSI_DataHasher_clone(const KSI_DataHasher *from, KSI_DataHasher **to) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_DataHasher *tmp_hasher = NULL;
+	CRYPTO_HASH_CTX *tmp_cryptoCTX = NULL;
+	CRYPTO_HASH_CTX *pCryptoCTX = NULL;
+
+	if (from == NULL || to == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+	KSI_ERR_clearErrors(from->ctx);
+
+	pCryptoCTX = (CRYPTO_HASH_CTX*)from->hashContext;
+
+	tmp_hasher = KSI_new(KSI_DataHasher);
+	if (tmp_hasher == NULL) {
+		KSI_pushError(from->ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+	tmp_hasher->hashContext = NULL;
+	tmp_hasher->ctx = from->ctx;
+	tmp_hasher->algorithm = from->algorithm;
+	tmp_hasher->closeExisting = closeExisting;
+
+	res = CRYPTO_HASH_CTX_new(&tmp_cryptoCTX);
+	if (res != KSI_OK) {
+		KSI_pushError(from->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	/* The duplicate hash object belongs to the same CSP, so keep it alive as long as the copy exists. */
+	if (!CryptContextAddRef(pCryptoCTX->pt_CSP, NULL, 0)) {
+		char errm[1024];
+		KSI_snprintf(errm, sizeof(errm), "Wincrypt Error (%d)", GetLastError());
+		KSI_pushError(from->ctx, res = KSI_CRYPTO_FAILURE, errm);
+		goto cleanup;
+	}
+	tmp_cryptoCTX->pt_CSP = pCryptoCTX->pt_CSP;
+
+	if (!CryptDuplicateHash(pCryptoCTX->pt_hHash, NULL, 0, &tmp_cryptoCTX->pt_hHash)) {
+		char errm[1024];
+		KSI_snprintf(errm, sizeof(errm), "Wincrypt Error (%d)", GetLastError());
+		KSI_pushError(from->ctx, res = KSI_CRYPTO_FAILURE, errm);
+		goto cleanup;
+	}
+
+	tmp_hasher->hashContext = tmp_cryptoCTX;
+	tmp_cryptoCTX = NULL;
+
+	*to = tmp_hasher;
+	tmp_hasher = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	CRYPTO_HASH_CTX_free(tmp_cryptoCTX);
+	KSI_DataHasher_free(tmp_hasher);
+
+	return res;
+}
+
 #endif
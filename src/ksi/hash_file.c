@@ -0,0 +1,582 @@
+/*
+ * Copyright 2013-2016 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#  include <io.h>
+#  define read_fd(fd, buf, len) _read((fd), (buf), (unsigned)(len))
+#  define open_fd(name) _open((name), _O_RDONLY | _O_BINARY)
+#  define close_fd(fd) _close(fd)
+#  define seek_fd(fd, off, whence) _lseeki64((fd), (off), (whence))
+#  define stat_fd(fd, st) _fstati64((fd), (st))
+typedef __int64 file_off_t;
+typedef struct _stati64 file_stat_t;
+#else
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  define read_fd(fd, buf, len) read((fd), (buf), (len))
+#  define open_fd(name) open((name), O_RDONLY)
+#  define close_fd(fd) close(fd)
+#  define seek_fd(fd, off, whence) lseek((fd), (off), (whence))
+#  define stat_fd(fd, st) fstat((fd), (st))
+typedef off_t file_off_t;
+typedef struct stat file_stat_t;
+#endif
+
+#include "internal.h"
+#include "hash_impl.h"
+#include "ctx_impl.h"
+#include "thread.h"
+
+/* Size of a single read-ahead buffer. */
+#define KSI_FILE_READ_BLOCK (1 << 20)
+
+/* Size of the file region mapped into memory at a time. */
+#define KSI_FILE_MAP_WINDOW (64 << 20)
+
+typedef struct FileReader_st {
+	int fd;
+	unsigned char *buf[2];
+	size_t len[2];
+	/* Number of blocks read and hashed, the block is stored in buf[n % 2]. */
+	size_t produced;
+	size_t consumed;
+	/* Set by the reader after the last block. */
+	int done;
+	int ioError;
+	/* Set by the hasher to stop the reader. */
+	int stop;
+	KSI_Mutex *mutex;
+	KSI_Cond *cond;
+} FileReader;
+
+typedef struct FileHashJob_st {
+	int status;
+	KSI_DataHash *hsh;
+	int done;
+} FileHashJob;
+
+typedef struct FileHashPool_st {
+	KSI_CTX *ctx;
+	char **fileNames;
+	KSI_HashAlgorithm algo_id;
+	FileHashJob *jobs;
+	size_t jobs_len;
+	/* Index of the next file to be taken by a worker. */
+	size_t next;
+	int stop;
+	KSI_Mutex *mutex;
+	KSI_Cond *cond;
+} FileHashPool;
+
+/* Reads until the buffer is full or the end of file is reached. */
+static int readBlock(int fd, unsigned char *buf, size_t size, size_t *len) {
+	size_t count = 0;
+
+	while (count < size) {
+		int c = (int)read_fd(fd, buf + count, size - count);
+		if (c < 0) {
+			if (errno == EINTR) continue;
+			return KSI_IO_ERROR;
+		}
+		if (c == 0) break;
+		count += (size_t)c;
+	}
+
+	*len = count;
+	return KSI_OK;
+}
+
+static int readAhead(void *arg) {
+	FileReader *rdr = arg;
+
+	for (;;) {
+		unsigned char *buf = NULL;
+		size_t len = 0;
+		int stop;
+		int res;
+
+		KSI_Mutex_lock(rdr->mutex);
+		while (rdr->produced - rdr->consumed == 2 && !rdr->stop) {
+			KSI_Cond_wait(rdr->cond, rdr->mutex);
+		}
+		buf = rdr->buf[rdr->produced % 2];
+		stop = rdr->stop;
+		KSI_Mutex_unlock(rdr->mutex);
+
+		if (stop) break;
+
+		res = readBlock(rdr->fd, buf, KSI_FILE_READ_BLOCK, &len);
+
+		KSI_Mutex_lock(rdr->mutex);
+		rdr->len[rdr->produced % 2] = len;
+		rdr->produced++;
+		if (res != KSI_OK) rdr->ioError = 1;
+		if (res != KSI_OK || len < KSI_FILE_READ_BLOCK) rdr->done = 1;
+		KSI_Cond_broadcast(rdr->cond);
+		KSI_Mutex_unlock(rdr->mutex);
+
+		if (rdr->done) break;
+	}
+
+	return KSI_OK;
+}
+
+/* Hashes the file with a reader thread filling one buffer while the other one is hashed. */
+static int addReadAhead(KSI_DataHasher *hasher, int fd) {
+	int res = KSI_UNKNOWN_ERROR;
+	FileReader rdr;
+	KSI_Thread *thread = NULL;
+
+	memset(&rdr, 0, sizeof(rdr));
+	rdr.fd = fd;
+
+	rdr.buf[0] = KSI_malloc(KSI_FILE_READ_BLOCK);
+	rdr.buf[1] = KSI_malloc(KSI_FILE_READ_BLOCK);
+	if (rdr.buf[0] == NULL || rdr.buf[1] == NULL) {
+		KSI_pushError(hasher->ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_Mutex_new(hasher->ctx, &rdr.mutex);
+	if (res != KSI_OK) {
+		KSI_pushError(hasher->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_Cond_new(hasher->ctx, &rdr.cond);
+	if (res != KSI_OK) {
+		KSI_pushError(hasher->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_Thread_start(hasher->ctx, readAhead, &rdr, &thread);
+	if (res != KSI_OK) {
+		KSI_pushError(hasher->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	for (;;) {
+		size_t slot;
+
+		KSI_Mutex_lock(rdr.mutex);
+		while (rdr.consumed == rdr.produced && !rdr.done) {
+			KSI_Cond_wait(rdr.cond, rdr.mutex);
+		}
+		if (rdr.consumed == rdr.produced) {
+			KSI_Mutex_unlock(rdr.mutex);
+			break;
+		}
+		slot = rdr.consumed % 2;
+		KSI_Mutex_unlock(rdr.mutex);
+
+		if (rdr.len[slot] > 0) {
+			res = KSI_DataHasher_add(hasher, rdr.buf[slot], rdr.len[slot]);
+			if (res != KSI_OK) {
+				KSI_pushError(hasher->ctx, res, NULL);
+				goto cleanup;
+			}
+		}
+
+		KSI_Mutex_lock(rdr.mutex);
+		rdr.consumed++;
+		KSI_Cond_broadcast(rdr.cond);
+		KSI_Mutex_unlock(rdr.mutex);
+	}
+
+	if (rdr.ioError) {
+		KSI_pushError(hasher->ctx, res = KSI_IO_ERROR, "Unable to read file.");
+		goto cleanup;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	if (thread != NULL) {
+		KSI_Mutex_lock(rdr.mutex);
+		rdr.stop = 1;
+		KSI_Cond_broadcast(rdr.cond);
+		KSI_Mutex_unlock(rdr.mutex);
+
+		KSI_Thread_join(thread, NULL);
+		KSI_Thread_free(thread);
+	}
+	KSI_Cond_free(rdr.cond);
+	KSI_Mutex_free(rdr.mutex);
+	KSI_free(rdr.buf[0]);
+	KSI_free(rdr.buf[1]);
+
+	return res;
+}
+
+/* Hashes small inputs and non-regular files with a single buffer. */
+static int addRead(KSI_DataHasher *hasher, int fd) {
+	int res = KSI_UNKNOWN_ERROR;
+	unsigned char *buf = NULL;
+	size_t len = 0;
+
+	buf = KSI_malloc(KSI_FILE_READ_BLOCK);
+	if (buf == NULL) {
+		KSI_pushError(hasher->ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+	do {
+		res = readBlock(fd, buf, KSI_FILE_READ_BLOCK, &len);
+		if (res != KSI_OK) {
+			KSI_pushError(hasher->ctx, res, "Unable to read file.");
+			goto cleanup;
+		}
+
+		if (len > 0) {
+			res = KSI_DataHasher_add(hasher, buf, len);
+			if (res != KSI_OK) {
+				KSI_pushError(hasher->ctx, res, NULL);
+				goto cleanup;
+			}
+		}
+	} while (len == KSI_FILE_READ_BLOCK);
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_free(buf);
+
+	return res;
+}
+
+#ifndef _WIN32
+/* Hashes the region [offset, end) of a regular file by mapping it into memory a window at a time.
+ * Stops early if a window can not be mapped or the size of the file is no longer \c end, as
+ * touching a mapped page past the end of a truncated file raises SIGBUS. Sets \c pos to the
+ * end of the hashed part and the file position to \c pos, so the caller can read the rest. */
+static int addMapped(KSI_DataHasher *hasher, int fd, file_off_t offset, file_off_t end, file_off_t *pos) {
+	int res = KSI_UNKNOWN_ERROR;
+	long pageSize = sysconf(_SC_PAGESIZE);
+	file_off_t cur = offset;
+
+	if (pageSize <= 0) pageSize = 4096;
+
+	while (cur < end) {
+		/* The mapping has to start at a page boundary. */
+		file_off_t base = cur - cur % pageSize;
+		size_t skip = (size_t)(cur - base);
+		size_t len = (end - base > KSI_FILE_MAP_WINDOW) ? KSI_FILE_MAP_WINDOW : (size_t)(end - base);
+		file_stat_t st;
+		void *map = NULL;
+
+		if (stat_fd(fd, &st) != 0 || st.st_size != end) break;
+
+		map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, base);
+		if (map == MAP_FAILED) break;
+
+#ifdef MADV_SEQUENTIAL
+		madvise(map, len, MADV_SEQUENTIAL);
+#endif
+
+		res = KSI_DataHasher_add(hasher, (unsigned char *)map + skip, len - skip);
+		munmap(map, len);
+		if (res != KSI_OK) {
+			KSI_pushError(hasher->ctx, res, NULL);
+			goto cleanup;
+		}
+
+		cur = base + (file_off_t)len;
+	}
+
+	/* Leave the file position after the hashed part, as reading would. */
+	if (seek_fd(fd, cur, SEEK_SET) == (file_off_t)-1) {
+		KSI_pushError(hasher->ctx, res = KSI_IO_ERROR, "Unable to seek file.");
+		goto cleanup;
+	}
+
+	*pos = cur;
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+#endif
+
+int KSI_DataHasher_addFile(KSI_DataHasher *hasher, int fd) {
+	int res = KSI_UNKNOWN_ERROR;
+	file_stat_t st;
+	file_off_t offset = 0;
+	int isRegular = 0;
+	KSI_uint64_t remaining = 0;
+
+	if (hasher == NULL || fd < 0) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+	KSI_ERR_clearErrors(hasher->ctx);
+
+	/* The size of the rest of a regular file is known in advance. */
+	if (stat_fd(fd, &st) == 0 && (st.st_mode & S_IFMT) == S_IFREG) {
+		offset = seek_fd(fd, 0, SEEK_CUR);
+		if (offset >= 0 && st.st_size >= offset) {
+			isRegular = 1;
+			remaining = (KSI_uint64_t)(st.st_size - offset);
+		}
+	}
+
+	/* Not worth a thread or a mapping. */
+	if (isRegular && remaining <= KSI_FILE_READ_BLOCK) {
+		res = addRead(hasher, fd);
+		if (res != KSI_OK) {
+			KSI_pushError(hasher->ctx, res, NULL);
+		}
+		goto cleanup;
+	}
+
+#ifndef _WIN32
+	if (isRegular && hasher->ctx->flags[KSI_CTX_FLAG_MAP_FILES]) {
+		file_off_t end = offset + (file_off_t)remaining;
+		file_off_t pos = offset;
+
+		res = addMapped(hasher, fd, offset, end, &pos);
+		if (res != KSI_OK) {
+			KSI_pushError(hasher->ctx, res, NULL);
+			goto cleanup;
+		}
+
+		/* The rest of the file is read if the mapping stopped early. */
+		if (pos == end) goto cleanup;
+	}
+#endif
+
+	res = addReadAhead(hasher, fd);
+	if (res != KSI_OK) {
+		KSI_pushError(hasher->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+int KSI_DataHash_createFromFile(KSI_CTX *ctx, const char *fileName, KSI_HashAlgorithm algo_id, KSI_DataHash **hash) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_DataHasher *hsr = NULL;
+	KSI_DataHash *tmp = NULL;
+	int fd = -1;
+
+	KSI_ERR_clearErrors(ctx);
+	if (ctx == NULL || fileName == NULL || hash == NULL) {
+		KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
+		goto cleanup;
+	}
+
+	fd = open_fd(fileName);
+	if (fd < 0) {
+		KSI_pushError(ctx, res = KSI_IO_ERROR, "Unable to open file.");
+		goto cleanup;
+	}
+
+	res = KSI_DataHasher_open(ctx, algo_id, &hsr);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_DataHasher_addFile(hsr, fd);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_DataHasher_close(hsr, &tmp);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	*hash = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	if (fd >= 0) close_fd(fd);
+	KSI_DataHasher_free(hsr);
+	KSI_DataHash_free(tmp);
+
+	return res;
+}
+
+static int fileHashWorker(void *arg) {
+	FileHashPool *pool = arg;
+
+	for (;;) {
+		size_t i;
+		int status;
+		KSI_DataHash *hsh = NULL;
+
+		KSI_Mutex_lock(pool->mutex);
+		if (pool->stop || pool->next >= pool->jobs_len) {
+			KSI_Mutex_unlock(pool->mutex);
+			break;
+		}
+		i = pool->next++;
+		KSI_Mutex_unlock(pool->mutex);
+
+		status = KSI_DataHash_createFromFile(pool->ctx, pool->fileNames[i], pool->algo_id, &hsh);
+
+		KSI_Mutex_lock(pool->mutex);
+		pool->jobs[i].status = status;
+		pool->jobs[i].hsh = hsh;
+		pool->jobs[i].done = 1;
+		KSI_Cond_broadcast(pool->cond);
+		KSI_Mutex_unlock(pool->mutex);
+	}
+
+	return KSI_OK;
+}
+
+int KSI_DataHash_createFromFiles(KSI_CTX *ctx, char **fileNames, size_t fileNames_len, KSI_HashAlgorithm algo_id, size_t workers, KSI_FileHashCallback fn, void *c) {
+	int res = KSI_UNKNOWN_ERROR;
+	FileHashPool pool;
+	KSI_Thread **threads = NULL;
+	size_t threads_len = 0;
+	size_t i;
+
+	memset(&pool, 0, sizeof(pool));
+
+	KSI_ERR_clearErrors(ctx);
+	if (ctx == NULL || (fileNames == NULL && fileNames_len > 0) || fn == NULL) {
+		KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
+		goto cleanup;
+	}
+
+	/* Hash in the calling thread. */
+	if (workers == 0) {
+		for (i = 0; i < fileNames_len; i++) {
+			KSI_DataHash *hsh = NULL;
+			int status = KSI_DataHash_createFromFile(ctx, fileNames[i], algo_id, &hsh);
+
+			/* The ownership of the hash is passed to the callback. */
+			res = fn(c, i, status, hsh);
+			if (res != KSI_OK) goto cleanup;
+		}
+
+		res = KSI_OK;
+		goto cleanup;
+	}
+
+	if (ctx->lock == NULL) {
+		KSI_pushError(ctx, res = KSI_INVALID_STATE, "Hashing in worker threads requires a shared context.");
+		goto cleanup;
+	}
+
+	pool.ctx = ctx;
+	pool.fileNames = fileNames;
+	pool.algo_id = algo_id;
+	pool.jobs_len = fileNames_len;
+
+	if (fileNames_len > 0) {
+		pool.jobs = KSI_calloc(fileNames_len, sizeof(FileHashJob));
+		if (pool.jobs == NULL) {
+			KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
+			goto cleanup;
+		}
+	}
+
+	threads = KSI_calloc(workers, sizeof(KSI_Thread *));
+	if (threads == NULL) {
+		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_Mutex_new(ctx, &pool.mutex);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_Cond_new(ctx, &pool.cond);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	for (threads_len = 0; threads_len < workers; threads_len++) {
+		res = KSI_Thread_start(ctx, fileHashWorker, &pool, &threads[threads_len]);
+		if (res != KSI_OK) {
+			KSI_pushError(ctx, res, NULL);
+			goto cleanup;
+		}
+	}
+
+	/* Report the results in the order of the input, while the workers continue with the next files. */
+	for (i = 0; i < fileNames_len; i++) {
+		KSI_DataHash *hsh = NULL;
+
+		KSI_Mutex_lock(pool.mutex);
+		while (!pool.jobs[i].done) {
+			KSI_Cond_wait(pool.cond, pool.mutex);
+		}
+		hsh = pool.jobs[i].hsh;
+		pool.jobs[i].hsh = NULL;
+		KSI_Mutex_unlock(pool.mutex);
+
+		/* The ownership of the hash is passed to the callback. */
+		res = fn(c, i, pool.jobs[i].status, hsh);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	if (threads != NULL) {
+		KSI_Mutex_lock(pool.mutex);
+		pool.stop = 1;
+		KSI_Mutex_unlock(pool.mutex);
+
+		for (i = 0; i < threads_len; i++) {
+			KSI_Thread_join(threads[i], NULL);
+			KSI_Thread_free(threads[i]);
+		}
+		KSI_free(threads);
+	}
+
+	if (pool.jobs != NULL) {
+		for (i = 0; i < pool.jobs_len; i++) {
+			KSI_DataHash_free(pool.jobs[i].hsh);
+		}
+		KSI_free(pool.jobs);
+	}
+	KSI_Cond_free(pool.cond);
+	KSI_Mutex_free(pool.mutex);
+
+	return res;
+}
@@ -19,6 +19,7 @@
 
 #include "internal.h"
 #include "hash_impl.h"
+#include "counters_impl.h"
 #include "hash.h"
 
 #if KSI_HASH_IMPL == KSI_IMPL_OPENSSL
@@ -87,6 +88,8 @@ static int closeExisting(KSI_DataHasher *hasher, KSI_DataHash *data_hash) {
 	data_hash->imprint[0] = (0xff & hasher->algorithm);
 	data_hash->imprint_length = hash_length + 1;
 
+	KSI_Counters_addHash(hasher->ctx, hasher->algorithm);
+
 	res = KSI_OK;
 
 cleanup:
@@ -206,6 +209,7 @@ int KSI_DataHasher_add(KSI_DataHasher *hasher, const void *data, size_t data_len
 
 	if (data_length > 0) {
 		EVP_DigestUpdate(hasher->hashContext, data, data_length);
+		KSI_Counters_add(hasher->ctx, KSI_COUNTER_HASHED_BYTES, data_length);
 	}
 
 	res = KSI_OK;
@@ -215,4 +219,53 @@ cleanup:
 	return res;
 }
 
+int KSI_DataHasher_clone(const KSI_DataHasher *from, KSI_DataHasher **to) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_DataHasher *tmp_hasher = NULL;
+	void *context = NULL;
+
+	if (from == NULL || to == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+	KSI_ERR_clearErrors(from->ctx);
+
+	tmp_hasher = KSI_new(KSI_DataHasher);
+	if (tmp_hasher == NULL) {
+		KSI_pushError(from->ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+	tmp_hasher->hashContext = NULL;
+	tmp_hasher->ctx = from->ctx;
+	tmp_hasher->algorithm = from->algorithm;
+	tmp_hasher->closeExisting = closeExisting;
+
+	context = KSI_new(EVP_MD_CTX);
+	if (context == NULL) {
+		KSI_pushError(from->ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+	EVP_MD_CTX_init(context);
+
+	tmp_hasher->hashContext = context;
+
+	if (!EVP_MD_CTX_copy_ex(context, from->hashContext)) {
+		KSI_pushError(from->ctx, res = KSI_CRYPTO_FAILURE, NULL);
+		goto cleanup;
+	}
+
+	*to = tmp_hasher;
+	tmp_hasher = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_DataHasher_free(tmp_hasher);
+
+	return res;
+}
+
 #endif
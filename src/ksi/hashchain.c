@@ -25,6 +25,7 @@
 #include "tlv.h"
 #include "tlv_template.h"
 #include "hashchain_impl.h"
+#include "ctx_impl.h"
 #include "impl/meta_data_element_impl.h"
 
 /* For optimization reasons, we need need access to KSI_DataHasher->closeExisting() function. */
@@ -186,8 +187,10 @@ static int aggregateChain(KSI_CTX *ctx, KSI_LIST(KSI_HashChainLink) *chain, cons
 		}
 	}
 
-	sprintf(logMsg, "Starting %s hash chain aggregation with input hash.", isCalendar ? "calendar": "aggregation");
-	KSI_LOG_logDataHash(ctx, KSI_LOG_DEBUG, logMsg, inputHash);
+	if (KSI_LOG_ENABLED(ctx, KSI_LOG_DEBUG)) {
+		sprintf(logMsg, "Starting %s hash chain aggregation with input hash.", isCalendar ? "calendar": "aggregation");
+		KSI_LOG_logDataHash(ctx, KSI_LOG_DEBUG, logMsg, inputHash);
+	}
 
 	/* Loop over all the links in the chain. */
 	for (i = 0; i < KSI_HashChainLinkList_length(chain); i++) {
@@ -296,8 +299,10 @@ static int aggregateChain(KSI_CTX *ctx, KSI_LIST(KSI_HashChainLink) *chain, cons
 		}
 	}
 
-	sprintf(logMsg, "Finished %s hash chain aggregation with output hash.", isCalendar ? "calendar": "aggregation");
-	KSI_LOG_logDataHash(ctx, KSI_LOG_DEBUG, logMsg, hsh);
+	if (KSI_LOG_ENABLED(ctx, KSI_LOG_DEBUG)) {
+		sprintf(logMsg, "Finished %s hash chain aggregation with output hash.", isCalendar ? "calendar": "aggregation");
+		KSI_LOG_logDataHash(ctx, KSI_LOG_DEBUG, logMsg, hsh);
+	}
 
 	if (endLevel != NULL) *endLevel = level;
 	if (outputHash != NULL) *outputHash = hsh;
@@ -391,7 +396,7 @@ int KSI_HashChain_aggregateCalendar(KSI_CTX *ctx, KSI_LIST(KSI_HashChainLink) *c
  * KSI_CalendarHashChain
  */
 void KSI_CalendarHashChain_free(KSI_CalendarHashChain *t) {
-	if (t != NULL && --t->ref == 0) {
+	if (t != NULL && KSI_REF_DECREMENT(t) == 0) {
 		KSI_Integer_free(t->publicationTime);
 		KSI_Integer_free(t->aggregationTime);
 		KSI_DataHash_free(t->inputHash);
@@ -22,6 +22,8 @@
 #include "internal.h"
 #include "hmac.h"
 #include "hmac_impl.h"
+#include "hash_impl.h"
+#include "thread.h"
 
 int KSI_HMAC_create(KSI_CTX *ctx, KSI_HashAlgorithm algo_id, const char *key, const unsigned char *data, size_t data_len, KSI_DataHash **hmac) {
 	int res = KSI_UNKNOWN_ERROR;
@@ -64,9 +66,18 @@ cleanup:
 	return res;
 }
 
+static void HmacKeyState_free(KSI_HmacKeyState *key) {
+	if (key != NULL && KSI_Atomic_decrement(&key->ref) == 0) {
+		KSI_DataHasher_free(key->innerHasher);
+		KSI_DataHasher_free(key->outerHasher);
+		KSI_free(key);
+	}
+}
+
 int KSI_HmacHasher_open(KSI_CTX *ctx, KSI_HashAlgorithm algo_id, const char *key, KSI_HmacHasher **hasher) {
 	int res = KSI_UNKNOWN_ERROR;
 	KSI_HmacHasher *tmp_hasher = NULL;
+	KSI_DataHasher *keyHasher = NULL;
 	KSI_DataHash *hashedKey = NULL;
 	unsigned blockSize = 0;
 
@@ -76,6 +87,8 @@ int KSI_HmacHasher_open(KSI_CTX *ctx, KSI_HashAlgorithm algo_id, const char *key
 	const unsigned char *digest = NULL;
 	size_t digest_len = 0;
 	size_t i;
+	unsigned char ipadXORkey[MAX_BUF_LEN];
+	unsigned char opadXORkey[MAX_BUF_LEN];
 
 	KSI_ERR_clearErrors(ctx);
 	if (ctx == NULL || key == NULL || hasher == NULL) {
@@ -106,26 +119,37 @@ int KSI_HmacHasher_open(KSI_CTX *ctx, KSI_HashAlgorithm algo_id, const char *key
 		goto cleanup;
 	}
 
-	/* Open the data hasher. */
-	res = KSI_DataHasher_open(ctx, algo_id, &tmp_hasher->dataHasher);
-	if (res != KSI_OK) {
-		KSI_pushError(ctx, res, NULL);
+	tmp_hasher->ctx = ctx;
+	tmp_hasher->blockSize = blockSize;
+	tmp_hasher->dataHasher = NULL;
+	tmp_hasher->key = NULL;
+
+	tmp_hasher->key = KSI_new(KSI_HmacKeyState);
+	if (tmp_hasher->key == NULL) {
+		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
 		goto cleanup;
 	}
 
-	tmp_hasher->ctx = ctx;
-	tmp_hasher->blockSize = blockSize;
+	tmp_hasher->key->ref = 1;
+	tmp_hasher->key->innerHasher = NULL;
+	tmp_hasher->key->outerHasher = NULL;
 
 	/* Prepare the key for hashing. */
 	/* If the key is longer than 64, hash it. If the key or its hash is shorter than 64 bit, append zeros. */
 	if (key_len > blockSize) {
-		res = KSI_DataHasher_add(tmp_hasher->dataHasher, key, key_len);
+		res = KSI_DataHasher_open(ctx, algo_id, &keyHasher);
+		if (res != KSI_OK) {
+			KSI_pushError(ctx, res, NULL);
+			goto cleanup;
+		}
+
+		res = KSI_DataHasher_add(keyHasher, key, key_len);
 		if (res != KSI_OK) {
 			KSI_pushError(ctx, res, NULL);
 			goto cleanup;
 		}
 
-		res = KSI_DataHasher_close(tmp_hasher->dataHasher, &hashedKey);
+		res = KSI_DataHasher_close(keyHasher, &hashedKey);
 		if (res != KSI_OK) {
 			KSI_pushError(ctx, res, NULL);
 			goto cleanup;
@@ -150,16 +174,35 @@ int KSI_HmacHasher_open(KSI_CTX *ctx, KSI_HashAlgorithm algo_id, const char *key
 	}
 
 	for (i = 0; i < buf_len; i++) {
-		tmp_hasher->ipadXORkey[i] = 0x36 ^ bufKey[i];
-		tmp_hasher->opadXORkey[i] = 0x5c ^ bufKey[i];
+		ipadXORkey[i] = 0x36 ^ bufKey[i];
+		opadXORkey[i] = 0x5c ^ bufKey[i];
 	}
 
 	for (; i < blockSize; i++) {
-		tmp_hasher->ipadXORkey[i] = 0x36;
-		tmp_hasher->opadXORkey[i] = 0x5c;
+		ipadXORkey[i] = 0x36;
+		opadXORkey[i] = 0x5c;
+	}
+
+	/* Absorb the key blocks once, so every message can continue from the prepared states. */
+	res = KSI_DataHasher_open(ctx, algo_id, &tmp_hasher->key->innerHasher);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_DataHasher_add(tmp_hasher->key->innerHasher, ipadXORkey, blockSize);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_DataHasher_open(ctx, algo_id, &tmp_hasher->key->outerHasher);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
 	}
 
-	res = KSI_HmacHasher_reset(tmp_hasher);
+	res = KSI_DataHasher_add(tmp_hasher->key->outerHasher, opadXORkey, blockSize);
 	if (res != KSI_OK) {
 		KSI_pushError(ctx, res, NULL);
 		goto cleanup;
@@ -172,6 +215,7 @@ int KSI_HmacHasher_open(KSI_CTX *ctx, KSI_HashAlgorithm algo_id, const char *key
 cleanup:
 
 	KSI_DataHash_free(hashedKey);
+	KSI_DataHasher_free(keyHasher);
 	KSI_HmacHasher_free(tmp_hasher);
 
 	return res;
@@ -186,24 +230,58 @@ int KSI_HmacHasher_reset(KSI_HmacHasher *hasher) {
 	}
 	KSI_ERR_clearErrors(hasher->ctx);
 
-	res = KSI_DataHasher_reset(hasher->dataHasher);
-	if (res != KSI_OK) {
-		KSI_pushError(hasher->ctx, res, NULL);
+	/* The inner key state is copied when the next data is added. */
+	KSI_DataHasher_free(hasher->dataHasher);
+	hasher->dataHasher = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+int KSI_HmacHasher_clone(const KSI_HmacHasher *from, KSI_HmacHasher **to) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_HmacHasher *tmp_hasher = NULL;
+
+	if (from == NULL || to == NULL) {
+		res = KSI_INVALID_ARGUMENT;
 		goto cleanup;
 	}
+	KSI_ERR_clearErrors(from->ctx);
 
-	/* Hash inner data. */
-	KSI_LOG_logBlob(hasher->ctx, KSI_LOG_DEBUG, "Adding ipad", hasher->ipadXORkey, hasher->blockSize);
-	res = KSI_DataHasher_add(hasher->dataHasher, hasher->ipadXORkey, hasher->blockSize);
-	if (res != KSI_OK) {
-		KSI_pushError(hasher->ctx, res, NULL);
+	tmp_hasher = KSI_new(KSI_HmacHasher);
+	if (tmp_hasher == NULL) {
+		KSI_pushError(from->ctx, res = KSI_OUT_OF_MEMORY, NULL);
 		goto cleanup;
 	}
 
+	tmp_hasher->ctx = from->ctx;
+	tmp_hasher->blockSize = from->blockSize;
+	tmp_hasher->dataHasher = NULL;
+
+	/* The key states are immutable, only the data added so far needs a copy. */
+	KSI_Atomic_increment(&from->key->ref);
+	tmp_hasher->key = from->key;
+
+	if (from->dataHasher != NULL) {
+		res = KSI_DataHasher_clone(from->dataHasher, &tmp_hasher->dataHasher);
+		if (res != KSI_OK) {
+			KSI_pushError(from->ctx, res, NULL);
+			goto cleanup;
+		}
+	}
+
+	*to = tmp_hasher;
+	tmp_hasher = NULL;
+
 	res = KSI_OK;
 
 cleanup:
 
+	KSI_HmacHasher_free(tmp_hasher);
+
 	return res;
 }
 
@@ -216,6 +294,15 @@ int KSI_HmacHasher_add(KSI_HmacHasher *hasher, const void *data, size_t data_len
 	}
 	KSI_ERR_clearErrors(hasher->ctx);
 
+	/* Continue from the state where the inner key block has already been hashed. */
+	if (hasher->dataHasher == NULL) {
+		res = KSI_DataHasher_clone(hasher->key->innerHasher, &hasher->dataHasher);
+		if (res != KSI_OK) {
+			KSI_pushError(hasher->ctx, res, NULL);
+			goto cleanup;
+		}
+	}
+
 	res = KSI_DataHasher_add(hasher->dataHasher, data, data_length);
 	if (res != KSI_OK) {
 		KSI_pushError(hasher->ctx, res, NULL);
@@ -231,11 +318,9 @@ cleanup:
 
 int KSI_HmacHasher_close(KSI_HmacHasher *hasher, KSI_DataHash **hmac) {
 	int res = KSI_UNKNOWN_ERROR;
-	KSI_DataHash *innerHash = NULL;
+	KSI_DataHash innerHash;
 	KSI_DataHash *outerHash = NULL;
-
-	const unsigned char *digest = NULL;
-	size_t digest_len = 0;
+	KSI_DataHasher *outerHasher = NULL;
 
 	if (hasher == NULL || hmac == NULL) {
 		res = KSI_INVALID_ARGUMENT;
@@ -245,34 +330,30 @@ int KSI_HmacHasher_close(KSI_HmacHasher *hasher, KSI_DataHash **hmac) {
 
 	KSI_LOG_debug(hasher->ctx, "Closing inner hasher");
 
-	res = KSI_DataHasher_close(hasher->dataHasher, &innerHash);
-	if (res != KSI_OK) {
-		KSI_pushError(hasher->ctx, res, NULL);
-		goto cleanup;
-	}
-
-	/* Hash outer data. */
-	res = KSI_DataHasher_reset(hasher->dataHasher);
-	if (res != KSI_OK) {
-		KSI_pushError(hasher->ctx, res, NULL);
-		goto cleanup;
+	if (hasher->dataHasher == NULL) {
+		res = KSI_DataHasher_clone(hasher->key->innerHasher, &hasher->dataHasher);
+		if (res != KSI_OK) {
+			KSI_pushError(hasher->ctx, res, NULL);
+			goto cleanup;
+		}
 	}
 
-	KSI_LOG_logBlob(hasher->ctx, KSI_LOG_DEBUG, "Adding opad", hasher->opadXORkey, hasher->blockSize);
-	res = KSI_DataHasher_add(hasher->dataHasher, hasher->opadXORkey, hasher->blockSize);
+	/* The inner hash is only an intermediate value, so it is not allocated. */
+	res = hasher->dataHasher->closeExisting(hasher->dataHasher, &innerHash);
 	if (res != KSI_OK) {
 		KSI_pushError(hasher->ctx, res, NULL);
 		goto cleanup;
 	}
 
-	res = KSI_DataHash_extract(innerHash, NULL, &digest, &digest_len);
+	/* Hash outer data, continuing from the state where the outer key block has already been hashed. */
+	res = KSI_DataHasher_clone(hasher->key->outerHasher, &outerHasher);
 	if (res != KSI_OK) {
 		KSI_pushError(hasher->ctx, res, NULL);
 		goto cleanup;
 	}
 
-	KSI_LOG_logBlob(hasher->ctx, KSI_LOG_DEBUG, "Adding inner hash", digest, digest_len);
-	res = KSI_DataHasher_add(hasher->dataHasher, digest, digest_len);
+	KSI_LOG_logBlob(hasher->ctx, KSI_LOG_DEBUG, "Adding inner hash", innerHash.imprint + 1, innerHash.imprint_length - 1);
+	res = KSI_DataHasher_add(outerHasher, innerHash.imprint + 1, innerHash.imprint_length - 1);
 	if (res != KSI_OK) {
 		KSI_pushError(hasher->ctx, res, NULL);
 		goto cleanup;
@@ -280,20 +361,21 @@ int KSI_HmacHasher_close(KSI_HmacHasher *hasher, KSI_DataHash **hmac) {
 
 	KSI_LOG_debug(hasher->ctx, "Closing outer hasher");
 
-	res = KSI_DataHasher_close(hasher->dataHasher, &outerHash);
+	res = KSI_DataHasher_close(outerHasher, &outerHash);
 	if (res != KSI_OK) {
 		KSI_pushError(hasher->ctx, res, NULL);
 		goto cleanup;
 	}
 
-	*hmac = KSI_DataHash_ref(outerHash);
+	*hmac = outerHash;
+	outerHash = NULL;
 
 	res = KSI_OK;
 
 cleanup:
 
-	KSI_DataHash_free(innerHash);
 	KSI_DataHash_free(outerHash);
+	KSI_DataHasher_free(outerHasher);
 
 	return res;
 }
@@ -301,6 +383,7 @@ cleanup:
 void KSI_HmacHasher_free(KSI_HmacHasher *hasher) {
 	if (hasher != NULL) {
 		KSI_DataHasher_free(hasher->dataHasher);
+		HmacKeyState_free(hasher->key);
 		KSI_free(hasher);
 	}
 }
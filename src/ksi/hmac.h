@@ -72,6 +72,19 @@ extern "C" {
 	 */
 	int KSI_HmacHasher_reset(KSI_HmacHasher *hasher);
 
+	/**
+	 * Creates an independent copy of an HMAC computation. The key dependent states are
+	 * prepared by #KSI_HmacHasher_open and shared by the copies, so copying a freshly opened
+	 * (or reset) hasher is the cheap way of computing many HMAC values with the same key.
+	 * The copies may be used and freed by different threads.
+	 * \param[in]	from			Hasher object to be copied.
+	 * \param[out]	to				Pointer that will receive pointer to the copy.
+	 *
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 * \see #KSI_HmacHasher_open, #KSI_HmacHasher_free
+	 */
+	int KSI_HmacHasher_clone(const KSI_HmacHasher *from, KSI_HmacHasher **to);
+
 	/**
 	 * Adds data to an open HMAC computation.
 	 *
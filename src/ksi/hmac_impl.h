@@ -31,18 +31,30 @@ extern "C" {
 	*/
 	#define MAX_BUF_LEN 128
 
+	/**
+	 * Key dependent states of a HMAC computation, shared by an opened hasher and its clones.
+	 * The states are never modified after they have been prepared.
+	 */
+	typedef struct KSI_HmacKeyState_st {
+		/** Reference count, updated atomically as the clones may be used by different threads. */
+		volatile size_t ref;
+
+		/** Hasher state after absorbing the inner XOR-ed key block. */
+		KSI_DataHasher *innerHasher;
+
+		/** Hasher state after absorbing the outer XOR-ed key block. */
+		KSI_DataHasher *outerHasher;
+	} KSI_HmacKeyState;
+
 	struct KSI_HmacHasher_st {
 		/** KSI context */
 		KSI_CTX *ctx;
 
-		/** Data hasher */
+		/** Data hasher, \c NULL until data is added after opening or resetting the hasher. */
 		KSI_DataHasher *dataHasher;
 
-		/** Inner buffer for XOR-ed key, padded with zeros. */
-		unsigned char ipadXORkey[MAX_BUF_LEN];
-
-		/** Outer buffer for XOR-ed key, padded with zeros. */
-		unsigned char opadXORkey[MAX_BUF_LEN];
+		/** Prepared key dependent states. */
+		KSI_HmacKeyState *key;
 
 		/** Block size of algorithm. */
 		unsigned blockSize;
@@ -34,8 +34,13 @@ extern "C" {
 		KSI_Integer *sequenceNr;
 		KSI_Integer *reqTimeInMicros;
 
+		/** Serialized payload (including the padding), cached on first use and discarded by the setters. */
+		unsigned char *raw;
+		size_t raw_len;
+
 		int (*toMetaDataElement)(KSI_MetaData *in, KSI_MetaDataElement **out);
 		int (*serializePayload)(KSI_MetaData *t, unsigned char *buf, size_t buf_size, size_t *buf_len);
+		int (*getPayload)(KSI_MetaData *t, const unsigned char **buf, size_t *buf_len);
 	};
 
 #ifdef __cplusplus
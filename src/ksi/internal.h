@@ -26,6 +26,7 @@
 #include "ksi.h"
 #include "err.h"
 #include "compatibility.h"
+#include "thread.h"
 
 #define KSI_TLV_MASK_TLV16 0x80u
 #define KSI_TLV_MASK_LENIENT 0x40u
@@ -148,9 +149,25 @@ cleanup:																	\
 	return res;																\
 }																			\
 
+/**
+ * Reference counter updates. When the library is configured with \c KSI_ATOMIC_REFCOUNT
+ * the counters are updated atomically, so that immutable objects may be shared between
+ * threads without cloning them. Both macros evaluate to the new value of the counter, and
+ * #KSI_REF_COUNT to its current value.
+ */
+#ifdef KSI_ATOMIC_REFCOUNT
+#  define KSI_REF_INCREMENT(o) KSI_Atomic_increment(&(o)->ref)
+#  define KSI_REF_DECREMENT(o) KSI_Atomic_decrement(&(o)->ref)
+#  define KSI_REF_COUNT(o) KSI_Atomic_add(&(o)->ref, 0)
+#else
+#  define KSI_REF_INCREMENT(o) (++(o)->ref)
+#  define KSI_REF_DECREMENT(o) (--(o)->ref)
+#  define KSI_REF_COUNT(o) ((o)->ref)
+#endif
+
 #define KSI_IMPLEMENT_REF(baseType)											\
 KSI_DEFINE_REF(baseType) {													\
-	if (o != NULL) o->ref++;												\
+	if (o != NULL) KSI_REF_INCREMENT(o);									\
 	return o;																\
 }																			\
 
@@ -28,6 +28,8 @@
 #include "hash.h"
 #include "publicationsfile.h"
 #include "log.h"
+#include "counters.h"
+#include "trace.h"
 #include "signature.h"
 #include "verification.h"
 #include "policy.h"
@@ -315,6 +317,41 @@ enum KSI_CtxFlag {
 	 * Range:		KSI_PDU_VERSION_1 .. KSI_PDU_VERSION_2
 	 */
 	KSI_CTX_FLAG_EXT_PDU_VER,
+	/**
+	 * Description:	Makes the context safe to be shared by several threads. Every thread gets
+	 * 				its own error stack and last failed signature, the request counters are
+	 * 				incremented atomically and the publications file, the PKI truststore and
+	 * 				the verification policies are initialized only once. The configuration
+	 * 				of the context (setters) must be done before the context is shared and
+	 * 				the flag can not be turned off.
+	 * Type:		size_t.
+	 * Range:		0 .. 1
+	 */
+	KSI_CTX_FLAG_SHARED,
+	/**
+	 * Description:	Keeps the calendar hash chains received from the extender during the
+	 * 				verification, so the signatures with the same aggregation time extended
+	 * 				to the same publication need a single extender request. On a shared
+	 * 				context, a thread needing a chain that is already being requested waits
+	 * 				for the result instead of sending another request. The chains are
+	 * 				dropped when the extender or the network provider is changed.
+	 * Type:		size_t.
+	 * Range:		0 .. 1, disabled by default.
+	 */
+	KSI_CTX_FLAG_EXTENDED_CHAIN_CACHE,
+	/**
+	 * Description:	Lets #KSI_DataHasher_addFile map large regular files into memory instead
+	 * 				of reading them. \b Warning: if a mapped file is truncated by another
+	 * 				process while it is hashed, the operating system raises \c SIGBUS in the
+	 * 				hashing process, which terminates it unless the application handles the
+	 * 				signal. The size of the file is checked before every mapped window and the
+	 * 				rest is read if it has changed, but this does not close the window
+	 * 				completely. Only enable the flag when the hashed files cannot be truncated
+	 * 				concurrently. Ignored on Windows, where the files are always read.
+	 * Type:		size_t.
+	 * Range:		0 .. 1, disabled by default.
+	 */
+	KSI_CTX_FLAG_MAP_FILES,
 
 	KSI_CTX_NUM_OF_FLAGS,
 };
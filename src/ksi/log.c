@@ -44,7 +44,7 @@ static int writeLog(KSI_CTX *ctx, int logLevel, char *format, va_list va) {
 		res = KSI_INVALID_ARGUMENT;
 		goto cleanup;
 	}
-	if (ctx->loggerCB == NULL || ctx->logLevel < logLevel) {
+	if (!KSI_LOG_ENABLED(ctx, logLevel)) {
 		/* Do not perform logging. */
 		res = KSI_OK;
 		goto cleanup;
@@ -70,10 +70,13 @@ static int KSI_LOG_log(KSI_CTX *ctx, int level, char *format, ...) {
 	return res;
 }
 
+/* The level is checked before entering #writeLog, so disabled messages never touch its buffer. */
 #define KSI_LOG_FN(suffix, level) \
 int KSI_LOG_##suffix(KSI_CTX *ctx, char *format, ...) { \
 	int res; \
 	va_list va; \
+	if (ctx == NULL || format == NULL) return KSI_INVALID_ARGUMENT; \
+	if (!KSI_LOG_ENABLED(ctx, KSI_LOG_##level)) return KSI_OK; \
 	va_start(va, format); \
 	res = writeLog(ctx, KSI_LOG_##level, format, va); \
 	va_end(va); \
@@ -86,11 +89,14 @@ KSI_LOG_FN(notice, NOTICE);
 KSI_LOG_FN(warn, WARN);
 KSI_LOG_FN(error, ERROR);
 
+int KSI_LOG_isEnabled(KSI_CTX *ctx, int level) {
+	return KSI_LOG_ENABLED(ctx, level);
+}
+
 int KSI_LOG_logBlob(KSI_CTX *ctx, int level, const char *prefix, const unsigned char *data, size_t data_len) {
+	static const char hex[] = "0123456789abcdef";
 	int res = KSI_UNKNOWN_ERROR;
 	char *logStr = NULL;
-	size_t logStr_size = 0;
-	size_t logStr_len = 0;
 	size_t i;
 
 	if (ctx == NULL || (data == NULL && data_len != 0) || (data != NULL && data_len == 0)) {
@@ -98,25 +104,22 @@ int KSI_LOG_logBlob(KSI_CTX *ctx, int level, const char *prefix, const unsigned
 		goto cleanup;
 	}
 
-	if (level < ctx->logLevel) goto cleanup;
-
-	logStr_size = data_len * 2 + 1;
+	if (!KSI_LOG_ENABLED(ctx, level)) {
+		res = KSI_OK;
+		goto cleanup;
+	}
 
-	logStr = KSI_calloc(logStr_size, 1);
+	logStr = KSI_malloc(data_len * 2 + 1);
 	if (logStr == NULL) {
 		res = KSI_OUT_OF_MEMORY;
 		goto cleanup;
 	}
 
 	for (i = 0; i < data_len; i++) {
-		size_t written;
-		written = KSI_snprintf(logStr + logStr_len, logStr_size - logStr_len, "%02x", data[i]);
-		if (written == 0 || (size_t) written > logStr_size - logStr_len) {
-			res = KSI_BUFFER_OVERFLOW;
-			goto cleanup;
-		}
-		logStr_len += (unsigned)written;
+		logStr[2 * i] = hex[data[i] >> 4];
+		logStr[2 * i + 1] = hex[data[i] & 0x0f];
 	}
+	logStr[2 * data_len] = '\0';
 
 	res = KSI_LOG_log(ctx, level, "%s (len = %lld): %s", prefix, (long long)data_len, logStr);
 	if (res != KSI_OK) goto cleanup;
@@ -132,15 +135,23 @@ cleanup:
 
 int KSI_LOG_logTlv(KSI_CTX *ctx, int level, const char *prefix, const KSI_TLV *tlv) {
 	int res = KSI_UNKNOWN_ERROR;
-	char serialized[0x1ffff];
+	char *serialized = NULL;
+	const size_t serialized_size = 0x1ffff;
 
-	if (level < ctx->logLevel) {
+	if (!KSI_LOG_ENABLED(ctx, level)) {
 		res = KSI_OK;
 		goto cleanup;
 	}
 
 	if (tlv != NULL) {
-		KSI_TLV_toString(tlv, serialized, sizeof(serialized));
+		/* The textual form of a TLV can be large, so it is only formatted when it is going to be written. */
+		serialized = KSI_malloc(serialized_size);
+		if (serialized == NULL) {
+			res = KSI_OUT_OF_MEMORY;
+			goto cleanup;
+		}
+
+		KSI_TLV_toString(tlv, serialized, serialized_size);
 		res = KSI_LOG_log(ctx, level, "%s:\n%s", prefix, serialized);
 	} else {
 		res = KSI_LOG_log(ctx, level, "%s:\n%s", prefix, "(null)");
@@ -152,6 +163,8 @@ cleanup:
 		KSI_LOG_log(ctx, level, "%s: Unable to log tlv value - %s", prefix, KSI_getErrorString(res));
 	}
 
+	KSI_free(serialized);
+
 	return res;
 }
 
@@ -160,7 +173,7 @@ int KSI_LOG_logDataHash(KSI_CTX *ctx, int level, const char *prefix, const KSI_D
 	const unsigned char *imprint = NULL;
 	size_t imprint_len = 0;
 
-	if (level < ctx->logLevel) {
+	if (!KSI_LOG_ENABLED(ctx, level)) {
 		res = KSI_OK;
 		goto cleanup;
 	}
@@ -192,7 +205,7 @@ int KSI_LOG_logCtxError(KSI_CTX *ctx, int level) {
 
 	if(ctx == NULL) goto cleanup;
 
-	if (level < ctx->logLevel) {
+	if (!KSI_LOG_ENABLED(ctx, level)) {
 		res = KSI_OK;
 		goto cleanup;
 	}
@@ -241,3 +254,202 @@ int KSI_LOG_StreamLogger(void *logCtx, int logLevel, const char *message) {
 	return KSI_OK;
 }
 
+typedef struct AsyncLogEntry_st {
+	int level;
+	char *message;
+} AsyncLogEntry;
+
+struct KSI_AsyncLogger_st {
+	/** The logger the messages are passed to by the writer thread. */
+	KSI_LoggerCallback sink;
+	void *sinkCtx;
+
+	/** Ring buffer of pending messages. */
+	AsyncLogEntry *ring;
+	size_t capacity;
+	size_t head;
+	size_t count;
+
+	/** Number of messages dropped since the last report, because the ring buffer was full. */
+	size_t dropped;
+
+	int stop;
+
+	KSI_Mutex *lock;
+	KSI_Cond *cond;
+	KSI_Thread *writer;
+};
+
+static int asyncLoggerMain(void *arg) {
+	KSI_AsyncLogger *logger = arg;
+	AsyncLogEntry entry;
+	size_t dropped;
+	char buf[64];
+
+	for (;;) {
+		KSI_Mutex_lock(logger->lock);
+		while (logger->count == 0 && logger->dropped == 0 && !logger->stop) {
+			KSI_Cond_wait(logger->cond, logger->lock);
+		}
+
+		/* Only exit after all the pending messages have been written. */
+		if (logger->count == 0 && logger->dropped == 0) {
+			KSI_Mutex_unlock(logger->lock);
+			break;
+		}
+
+		entry.level = KSI_LOG_NONE;
+		entry.message = NULL;
+		if (logger->count > 0) {
+			entry = logger->ring[logger->head];
+			logger->head = (logger->head + 1) % logger->capacity;
+			logger->count--;
+		}
+
+		dropped = logger->dropped;
+		logger->dropped = 0;
+		KSI_Mutex_unlock(logger->lock);
+
+		/* The sink is called without holding the lock, so a slow sink never blocks the callers. */
+		if (dropped > 0) {
+			KSI_snprintf(buf, sizeof(buf), "%llu log messages dropped.", (unsigned long long)dropped);
+			logger->sink(logger->sinkCtx, KSI_LOG_WARN, buf);
+		}
+
+		if (entry.message != NULL) {
+			logger->sink(logger->sinkCtx, entry.level, entry.message);
+			KSI_free(entry.message);
+		}
+	}
+
+	return KSI_OK;
+}
+
+int KSI_AsyncLogger_new(KSI_CTX *ctx, size_t capacity, KSI_LoggerCallback sink, void *sinkCtx, KSI_AsyncLogger **logger) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_AsyncLogger *tmp = NULL;
+
+	KSI_ERR_clearErrors(ctx);
+	if (ctx == NULL || capacity == 0 || sink == NULL || logger == NULL) {
+		KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
+		goto cleanup;
+	}
+
+	tmp = KSI_new(KSI_AsyncLogger);
+	if (tmp == NULL) {
+		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+	tmp->sink = sink;
+	tmp->sinkCtx = sinkCtx;
+	tmp->ring = NULL;
+	tmp->capacity = capacity;
+	tmp->head = 0;
+	tmp->count = 0;
+	tmp->dropped = 0;
+	tmp->stop = 0;
+	tmp->lock = NULL;
+	tmp->cond = NULL;
+	tmp->writer = NULL;
+
+	tmp->ring = KSI_calloc(capacity, sizeof(AsyncLogEntry));
+	if (tmp->ring == NULL) {
+		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_Mutex_new(ctx, &tmp->lock);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_Cond_new(ctx, &tmp->cond);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_Thread_start(ctx, asyncLoggerMain, tmp, &tmp->writer);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	*logger = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_AsyncLogger_free(tmp);
+
+	return res;
+}
+
+int KSI_LOG_AsyncLogger(void *logCtx, int logLevel, const char *message) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_AsyncLogger *logger = logCtx;
+	AsyncLogEntry *entry = NULL;
+	char *copy = NULL;
+
+	if (logger == NULL || message == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	/* Copy before taking the lock to keep the critical section short. */
+	res = KSI_strdup(message, &copy);
+	if (res != KSI_OK) goto cleanup;
+
+	KSI_Mutex_lock(logger->lock);
+	if (logger->count < logger->capacity) {
+		entry = &logger->ring[(logger->head + logger->count) % logger->capacity];
+		entry->level = logLevel;
+		entry->message = copy;
+		copy = NULL;
+		logger->count++;
+	} else {
+		/* Never stall the caller, the writer reports the number of lost messages instead. */
+		logger->dropped++;
+	}
+	KSI_Cond_broadcast(logger->cond);
+	KSI_Mutex_unlock(logger->lock);
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_free(copy);
+
+	return res;
+}
+
+void KSI_AsyncLogger_free(KSI_AsyncLogger *logger) {
+	size_t i;
+
+	if (logger != NULL) {
+		if (logger->writer != NULL) {
+			KSI_Mutex_lock(logger->lock);
+			logger->stop = 1;
+			KSI_Cond_broadcast(logger->cond);
+			KSI_Mutex_unlock(logger->lock);
+
+			/* Waits until the pending messages have been written. */
+			KSI_Thread_free(logger->writer);
+		}
+
+		if (logger->ring != NULL) {
+			for (i = 0; i < logger->count; i++) {
+				KSI_free(logger->ring[(logger->head + i) % logger->capacity].message);
+			}
+			KSI_free(logger->ring);
+		}
+
+		KSI_Cond_free(logger->cond);
+		KSI_Mutex_free(logger->lock);
+		KSI_free(logger);
+	}
+}
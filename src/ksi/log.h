@@ -21,6 +21,7 @@
 #define KSI_LOG_H_
 
 #include "common.h"
+#include "types_base.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -100,6 +101,16 @@ extern "C" {
 	 */
 	int KSI_LOG_error(KSI_CTX *ctx, char *format, ...);
 
+	/**
+	 * Checks if a message of the given level would be passed to the logger of the context.
+	 * Use this to guard log statements whose arguments are costly to compute, as the arguments
+	 * are evaluated before the log functions are called.
+	 * \param[in]	ctx			KSI context.
+	 * \param[in]	level		Log level.
+	 * \return Non-zero if the messages of the level are logged, 0 otherwise.
+	 */
+	int KSI_LOG_isEnabled(KSI_CTX *ctx, int level);
+
 	/**
 	 * A helper function for logging raw data. The log message will be prefixed with \c prefix and
 	 * the binary data is logged as hex.
@@ -156,6 +167,44 @@ extern "C" {
 	 */
 	int KSI_LOG_StreamLogger(void *logCtx, int logLevel, const char *message);
 
+	/**
+	 * Asynchronous logger, which queues the log messages in a fixed size ring buffer and passes
+	 * them to another logger from a background thread.
+	 */
+	typedef struct KSI_AsyncLogger_st KSI_AsyncLogger;
+
+	/**
+	 * Creates a new asynchronous logger and starts its writer thread.
+	 * \param[in]	ctx			KSI context.
+	 * \param[in]	capacity	Maximum number of pending messages.
+	 * \param[in]	sink		Logger the messages are passed to (e.g. #KSI_LOG_StreamLogger).
+	 * \param[in]	sinkCtx		Context of \c sink.
+	 * \param[out]	logger		Pointer to the receiving pointer.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 * \note \c sink is called only from the writer thread.
+	 */
+	int KSI_AsyncLogger_new(KSI_CTX *ctx, size_t capacity, KSI_LoggerCallback sink, void *sinkCtx, KSI_AsyncLogger **logger);
+
+	/**
+	 * Logging call-back to be used with #KSI_CTX_setLoggerCallback and a #KSI_AsyncLogger as the
+	 * logger context. The message is queued and the call returns without waiting for the sink.
+	 * If the queue is full, the message is dropped and the number of dropped messages is
+	 * later reported to the sink with a warning.
+	 * \param[in]	logCtx		Instance of #KSI_AsyncLogger.
+	 * \param[in]	logLevel	Log level.
+	 * \param[in]	message		Formatted log message.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 * \see #KSI_CTX_setLoggerCallback, #KSI_LoggerCallback
+	 */
+	int KSI_LOG_AsyncLogger(void *logCtx, int logLevel, const char *message);
+
+	/**
+	 * Writes the pending messages, stops the writer thread and frees the logger.
+	 * \param[in]	logger		Instance of #KSI_AsyncLogger.
+	 * \note The logger must be detached from all the contexts using it before it is freed.
+	 */
+	void KSI_AsyncLogger_free(KSI_AsyncLogger *logger);
+
 /**
  * @}
  */
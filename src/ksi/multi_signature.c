@@ -584,7 +584,7 @@ static int addPublication(KSI_PublicationRecord *pub, void *fctx) {
 			KSI_CalendarAuthRec_free(tm->calendarAuthRec);
 			tm->calendarAuthRec = NULL;
 		}
-	} else {
+	} else if (KSI_LOG_ENABLED(pub->ctx, KSI_LOG_DEBUG)) {
 		char buf[1024];
 		/* TODO! We could try merging the publication records instead. */
 		KSI_LOG_debug(pub->ctx, "Discarding publication as a value already present: %s", KSI_PublicationRecord_toString(pub, buf, sizeof(buf)));
@@ -863,6 +863,9 @@ int KSI_MultiSignature_get(KSI_MultiSignature *ms, const KSI_DataHash *hsh, KSI_
 	tmp->aggregationAuthRec = NULL;
 	tmp->aggregationChainList = NULL;
 	tmp->baseTlv = NULL;
+	tmp->calendarChainReplaced = 0;
+	tmp->authRecordsReplaced = 0;
+	tmp->aggregationChainsPrepended = 0;
 	tmp->calendarAuthRec = NULL;
 	tmp->calendarChain = NULL;
 	tmp->publication = NULL;
@@ -22,6 +22,7 @@
 #include "http_parser.h"
 #include "internal.h"
 #include "net_impl.h"
+#include "counters_impl.h"
 #include "tlv.h"
 #include "ctx_impl.h"
 
@@ -234,6 +235,9 @@ void KSI_NetEndpoint_free(KSI_NetEndpoint *endPoint) {
 
 	KSI_free(endPoint->ksi_pass);
 	KSI_free(endPoint->ksi_user);
+	KSI_HmacHasher_free(endPoint->hmacHasher);
+	KSI_free(endPoint->hmacKey);
+	KSI_Mutex_free(endPoint->hmacLock);
 
 	if (endPoint->implCtx_free != NULL) {
 		endPoint->implCtx_free(endPoint->implCtx);
@@ -262,6 +266,14 @@ int KSI_AbstractNetEndpoint_new(KSI_CTX *ctx, KSI_NetEndpoint **endPoint) {
 	tmp->ksi_user = NULL;
 	tmp->implCtx = NULL;
 	tmp->implCtx_free = NULL;
+	tmp->hmacHasher = NULL;
+	tmp->hmacKey = NULL;
+	tmp->hmacAlgorithm = KSI_HASHALG_INVALID;
+	tmp->hmacLock = NULL;
+
+	/* The context may be shared after the endpoint has been configured. */
+	res = KSI_Mutex_new(ctx, &tmp->hmacLock);
+	if (res != KSI_OK) goto cleanup;
 
 	*endPoint = tmp;
 	tmp = NULL;
@@ -275,6 +287,135 @@ cleanup:
 	return res;
 }
 
+int KSI_NetEndpoint_getHmacHasher(KSI_NetEndpoint *endp, KSI_HashAlgorithm algo_id, KSI_HmacHasher **hasher) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_HmacHasher *prepared = NULL;
+	char *key = NULL;
+	int locked = 0;
+
+	if (endp == NULL || hasher == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+	KSI_ERR_clearErrors(endp->ctx);
+
+	if (endp->ksi_pass == NULL) {
+		KSI_pushError(endp->ctx, res = KSI_INVALID_ARGUMENT, "Missing service password.");
+		goto cleanup;
+	}
+
+	/* A shared context may use the endpoint from several threads. */
+	if (endp->ctx->flags[KSI_CTX_FLAG_SHARED]) {
+		KSI_Mutex_lock(endp->hmacLock);
+		locked = 1;
+	}
+
+	/* The password may be changed by the setters at any time, so the key is compared every time. */
+	if (endp->hmacHasher == NULL || endp->hmacAlgorithm != algo_id || strcmp(endp->hmacKey, endp->ksi_pass) != 0) {
+		res = KSI_HmacHasher_open(endp->ctx, algo_id, endp->ksi_pass, &prepared);
+		if (res != KSI_OK) {
+			KSI_pushError(endp->ctx, res, NULL);
+			goto cleanup;
+		}
+
+		res = KSI_strdup(endp->ksi_pass, &key);
+		if (res != KSI_OK) {
+			KSI_pushError(endp->ctx, res, NULL);
+			goto cleanup;
+		}
+
+		KSI_HmacHasher_free(endp->hmacHasher);
+		KSI_free(endp->hmacKey);
+
+		endp->hmacHasher = prepared;
+		endp->hmacKey = key;
+		endp->hmacAlgorithm = algo_id;
+		prepared = NULL;
+		key = NULL;
+	}
+
+	res = KSI_HmacHasher_clone(endp->hmacHasher, hasher);
+	if (res != KSI_OK) {
+		KSI_pushError(endp->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	if (locked) KSI_Mutex_unlock(endp->hmacLock);
+
+	KSI_HmacHasher_free(prepared);
+	KSI_free(key);
+
+	return res;
+}
+
+int KSI_NetEndpoint_serializeExtendReq(KSI_NetEndpoint *endp, KSI_ExtendReq *req, unsigned char **raw, size_t *raw_len) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_HmacHasher *hasher = NULL;
+	KSI_HashAlgorithm algo_id = KSI_getHashAlgorithmByName("default");
+
+	if (endp == NULL || req == NULL || raw == NULL || raw_len == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+	KSI_ERR_clearErrors(endp->ctx);
+
+	res = KSI_NetEndpoint_getHmacHasher(endp, algo_id, &hasher);
+	if (res != KSI_OK) {
+		KSI_pushError(endp->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_ExtendReq_serializeWithHmac(req, endp->ksi_user, algo_id, hasher, raw, raw_len);
+	if (res != KSI_OK) {
+		KSI_pushError(endp->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_HmacHasher_free(hasher);
+
+	return res;
+}
+
+int KSI_NetEndpoint_serializeAggregationReq(KSI_NetEndpoint *endp, KSI_AggregationReq *req, unsigned char **raw, size_t *raw_len) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_HmacHasher *hasher = NULL;
+	KSI_HashAlgorithm algo_id = KSI_getHashAlgorithmByName("default");
+
+	if (endp == NULL || req == NULL || raw == NULL || raw_len == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+	KSI_ERR_clearErrors(endp->ctx);
+
+	res = KSI_NetEndpoint_getHmacHasher(endp, algo_id, &hasher);
+	if (res != KSI_OK) {
+		KSI_pushError(endp->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_AggregationReq_serializeWithHmac(req, endp->ksi_user, algo_id, hasher, raw, raw_len);
+	if (res != KSI_OK) {
+		KSI_pushError(endp->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_HmacHasher_free(hasher);
+
+	return res;
+}
+
 int KSI_NetEndpoint_setImplContext(KSI_NetEndpoint *endPoint, void *implCtx, void (*implCtx_free)(void *)) {
 	int res;
 
@@ -342,6 +483,11 @@ int KSI_RequestHandle_new(KSI_CTX *ctx, const unsigned char *request, size_t req
 	memset(tmp->err.errm, 0, sizeof(tmp->err.errm));
 	tmp->err.res = KSI_UNKNOWN_ERROR;
 	tmp->status = NULL;
+	tmp->service = -1;
+	tmp->requestId = 0;
+	tmp->recorder = NULL;
+	tmp->aggrResp = NULL;
+	tmp->extResp = NULL;
 
 	tmp->client = NULL;
 
@@ -385,10 +531,12 @@ cleanup:
  *
  */
 void KSI_RequestHandle_free(KSI_RequestHandle *handle) {
-	if (handle != NULL && --handle->ref == 0) {
+	if (handle != NULL && KSI_REF_DECREMENT(handle) == 0) {
 		if (handle->implCtx_free != NULL) {
 			handle->implCtx_free(handle->implCtx);
 		}
+		KSI_AggregationResp_free(handle->aggrResp);
+		KSI_ExtendResp_free(handle->extResp);
 		KSI_free(handle->request);
 		KSI_free(handle->response);
 		KSI_free(handle);
@@ -398,6 +546,7 @@ void KSI_RequestHandle_free(KSI_RequestHandle *handle) {
 int KSI_NetworkClient_sendSignRequest(KSI_NetworkClient *provider, KSI_AggregationReq *request, KSI_RequestHandle **handle) {
 	int res = KSI_UNKNOWN_ERROR;
 	KSI_RequestHandle *tmp = NULL;
+	KSI_Integer *reqId = NULL;
 
 	if (provider == NULL) {
 		res = KSI_INVALID_ARGUMENT;
@@ -421,6 +570,19 @@ int KSI_NetworkClient_sendSignRequest(KSI_NetworkClient *provider, KSI_Aggregati
 		goto cleanup;
 	}
 
+	tmp->service = KSI_COUNTER_SERVICE_AGGREGATOR;
+
+	/* Wrapping clients return the handles of the inner clients, the outermost recorder applies. */
+	if (provider->recorder != NULL) tmp->recorder = provider->recorder;
+
+	/* The request ID is assigned by the client. */
+	res = KSI_AggregationReq_getRequestId(request, &reqId);
+	if (res != KSI_OK) {
+		KSI_pushError(provider->ctx, res, NULL);
+		goto cleanup;
+	}
+	tmp->requestId = KSI_Integer_getUInt64(reqId);
+
 	*handle = tmp;
 	tmp = NULL;
 	res = KSI_OK;
@@ -435,6 +597,7 @@ cleanup:
 int KSI_NetworkClient_sendExtendRequest(KSI_NetworkClient *provider, KSI_ExtendReq *request, KSI_RequestHandle **handle) {
 	int res;
 	KSI_RequestHandle *tmp = NULL;
+	KSI_Integer *reqId = NULL;
 
 	if (provider == NULL) {
 		res = KSI_INVALID_ARGUMENT;
@@ -460,6 +623,19 @@ int KSI_NetworkClient_sendExtendRequest(KSI_NetworkClient *provider, KSI_ExtendR
 		goto cleanup;
 	}
 
+	tmp->service = KSI_COUNTER_SERVICE_EXTENDER;
+
+	/* Wrapping clients return the handles of the inner clients, the outermost recorder applies. */
+	if (provider->recorder != NULL) tmp->recorder = provider->recorder;
+
+	/* The request ID is assigned by the client. */
+	res = KSI_ExtendReq_getRequestId(request, &reqId);
+	if (res != KSI_OK) {
+		KSI_pushError(provider->ctx, res, NULL);
+		goto cleanup;
+	}
+	tmp->requestId = KSI_Integer_getUInt64(reqId);
+
 	*handle = tmp;
 	tmp = NULL;
 	res = KSI_OK;
@@ -499,6 +675,11 @@ int KSI_NetworkClient_sendPublicationsFileRequest(KSI_NetworkClient *provider, K
 		goto cleanup;
 	}
 
+	tmp->service = KSI_COUNTER_SERVICE_PUBLICATIONS_FILE;
+
+	/* Wrapping clients return the handles of the inner clients, the outermost recorder applies. */
+	if (provider->recorder != NULL) tmp->recorder = provider->recorder;
+
 	*handle = tmp;
 	tmp = NULL;
 	res = KSI_OK;
@@ -548,6 +729,12 @@ int KSI_RequestHandle_setResponse(KSI_RequestHandle *handle, const unsigned char
 	handle->response = resp;
 	handle->response_length = response_len;
 
+	/* A response parsed earlier no longer applies. */
+	KSI_AggregationResp_free(handle->aggrResp);
+	handle->aggrResp = NULL;
+	KSI_ExtendResp_free(handle->extResp);
+	handle->extResp = NULL;
+
 	resp = NULL;
 
 	res = KSI_OK;
@@ -623,6 +810,8 @@ cleanup:
 
 int KSI_RequestHandle_perform(KSI_RequestHandle *handle) {
 	int res;
+	KSI_uint64_t start;
+	KSI_uint64_t elapsed;
 
 	if (handle == NULL) {
 		res = KSI_INVALID_ARGUMENT;
@@ -636,13 +825,23 @@ int KSI_RequestHandle_perform(KSI_RequestHandle *handle) {
 		goto cleanup;
 	}
 
-
+	start = KSI_Counters_clock();
 	res = handle->readResponse(handle);
+	elapsed = KSI_Counters_clock() - start;
+	KSI_Counters_addRequest(handle->ctx, handle->service, res != KSI_OK, elapsed);
 	if (res != KSI_OK) {
 		KSI_pushError(handle->ctx, res, NULL);
 		goto cleanup;
 	}
 
+	if (handle->recorder != NULL) {
+		res = KSI_NetRecorder_add(handle->recorder, handle, elapsed);
+		if (res != KSI_OK) {
+			KSI_pushError(handle->ctx, res, NULL);
+			goto cleanup;
+		}
+	}
+
 	handle->completed = true;
 
 	res = KSI_OK;
@@ -694,14 +893,15 @@ cleanup:
 	return res;
 }
 
-int pdu_verify_hmac(KSI_CTX *ctx, KSI_DataHash *hmac,const char *key, int (*calculateHmac)(void*, int, const char*, KSI_DataHash**) ,void *PDU){
+static int pdu_verify_hmac(KSI_CTX *ctx, KSI_DataHash *hmac, KSI_NetEndpoint *endp, int (*calculateHmac)(void*, KSI_HashAlgorithm, const KSI_HmacHasher*, KSI_DataHash**), void *PDU){
 	int res;
 	KSI_DataHash *actualHmac = NULL;
+	KSI_HmacHasher *hasher = NULL;
 	KSI_HashAlgorithm algo_id;
 
 	KSI_ERR_clearErrors(ctx);
 
-	if (ctx == NULL || hmac == NULL || key == NULL || calculateHmac == NULL || PDU == NULL) {
+	if (ctx == NULL || hmac == NULL || endp == NULL || calculateHmac == NULL || PDU == NULL) {
 		KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
 		goto cleanup;
 	}
@@ -714,7 +914,13 @@ int pdu_verify_hmac(KSI_CTX *ctx, KSI_DataHash *hmac,const char *key, int (*calc
 		goto cleanup;
 	}
 
-	res = calculateHmac(PDU, algo_id, key, &actualHmac);
+	res = KSI_NetEndpoint_getHmacHasher(endp, algo_id, &hasher);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = calculateHmac(PDU, algo_id, hasher, &actualHmac);
 	if (res != KSI_OK) {
 		KSI_pushError(ctx, res, NULL);
 		goto cleanup;
@@ -732,6 +938,7 @@ int pdu_verify_hmac(KSI_CTX *ctx, KSI_DataHash *hmac,const char *key, int (*calc
 
 cleanup:
 
+	KSI_HmacHasher_free(hasher);
 	KSI_DataHash_free(actualHmac);
 
 	return res;
@@ -746,6 +953,7 @@ int KSI_RequestHandle_getExtendResponse(KSI_RequestHandle *handle, KSI_ExtendRes
 	KSI_ExtendResp *tmp = NULL;
 	const unsigned char *raw = NULL;
 	size_t len = 0;
+	int traced = 0;
 
 	if (handle == NULL) {
 		res = KSI_INVALID_ARGUMENT;
@@ -759,6 +967,17 @@ int KSI_RequestHandle_getExtendResponse(KSI_RequestHandle *handle, KSI_ExtendRes
 		goto cleanup;
 	}
 
+	KSI_TRACE(handle->ctx, KSI_TRACE_RESPONSE, KSI_TRACE_START, handle->requestId);
+	traced = 1;
+
+	/* The response has already been parsed and its HMAC verified. */
+	if (handle->extResp != NULL) {
+		*resp = handle->extResp;
+		handle->extResp = NULL;
+		res = KSI_OK;
+		goto cleanup;
+	}
+
 	res = KSI_RequestHandle_getResponse(handle, &raw, &len);
 	if (res != KSI_OK) {
 		KSI_pushError(handle->ctx, res, NULL);
@@ -836,8 +1055,8 @@ int KSI_RequestHandle_getExtendResponse(KSI_RequestHandle *handle, KSI_ExtendRes
 		goto cleanup;
 	}
 
-	res = pdu_verify_hmac(handle->ctx, respHmac, handle->client->extender->ksi_pass,
-			(int (*)(void*, int, const char*, KSI_DataHash**))KSI_ExtendPdu_calculateHmac,
+	res = pdu_verify_hmac(handle->ctx, respHmac, handle->client->extender,
+			(int (*)(void*, KSI_HashAlgorithm, const KSI_HmacHasher*, KSI_DataHash**))KSI_ExtendPdu_calculateHmacWithHasher,
 			(void*)pdu);
 
 	if (res != KSI_OK) {
@@ -858,6 +1077,8 @@ int KSI_RequestHandle_getExtendResponse(KSI_RequestHandle *handle, KSI_ExtendRes
 
 cleanup:
 
+	if (traced) KSI_TRACE(handle->ctx, KSI_TRACE_RESPONSE, KSI_TRACE_END, handle->requestId);
+
 	KSI_ExtendPdu_free(pdu);
 
 	return res;
@@ -873,6 +1094,7 @@ int KSI_RequestHandle_getAggregationResponse(KSI_RequestHandle *handle, KSI_Aggr
 	KSI_AggregationResp *tmp = NULL;
 	const unsigned char *raw = NULL;
 	size_t len;
+	int traced = 0;
 
 	if (handle == NULL) {
 		res = KSI_INVALID_ARGUMENT;
@@ -886,6 +1108,17 @@ int KSI_RequestHandle_getAggregationResponse(KSI_RequestHandle *handle, KSI_Aggr
 		goto cleanup;
 	}
 
+	KSI_TRACE(handle->ctx, KSI_TRACE_RESPONSE, KSI_TRACE_START, handle->requestId);
+	traced = 1;
+
+	/* The response has already been parsed and its HMAC verified. */
+	if (handle->aggrResp != NULL) {
+		*resp = handle->aggrResp;
+		handle->aggrResp = NULL;
+		res = KSI_OK;
+		goto cleanup;
+	}
+
 	res = KSI_RequestHandle_getResponse(handle, &raw, &len);
 	if (res != KSI_OK) {
 		KSI_pushError(handle->ctx, res, NULL);
@@ -960,8 +1193,8 @@ int KSI_RequestHandle_getAggregationResponse(KSI_RequestHandle *handle, KSI_Aggr
 		goto cleanup;
 	}
 
-	res = pdu_verify_hmac(handle->ctx, respHmac, handle->client->aggregator->ksi_pass,
-			(int (*)(void*, int, const char*, KSI_DataHash**))KSI_AggregationPdu_calculateHmac,
+	res = pdu_verify_hmac(handle->ctx, respHmac, handle->client->aggregator,
+			(int (*)(void*, KSI_HashAlgorithm, const KSI_HmacHasher*, KSI_DataHash**))KSI_AggregationPdu_calculateHmacWithHasher,
 			(void*)pdu);
 
 	if (res != KSI_OK) {
@@ -982,6 +1215,8 @@ int KSI_RequestHandle_getAggregationResponse(KSI_RequestHandle *handle, KSI_Aggr
 
 cleanup:
 
+	if (traced) KSI_TRACE(handle->ctx, KSI_TRACE_RESPONSE, KSI_TRACE_END, handle->requestId);
+
 	KSI_DataHash_free(actualHmac);
 	KSI_AggregationPdu_free(pdu);
 
@@ -1060,6 +1295,10 @@ cleanup:
 
 }
 
+int KSI_NetworkClient_isConcurrent(const KSI_NetworkClient *client) {
+	return client != NULL && client->performAll != NULL && client->performAll != simplePerformAll;
+}
+
 int KSI_AbstractNetworkClient_new(KSI_CTX *ctx, KSI_NetworkClient **client) {
 	int res = KSI_UNKNOWN_ERROR;
 	KSI_NetworkClient *tmp = NULL;
@@ -1086,6 +1325,7 @@ int KSI_AbstractNetworkClient_new(KSI_CTX *ctx, KSI_NetworkClient **client) {
 	tmp->sendSignRequest = NULL;
 	tmp->requestCount = 0;
 	tmp->performAll = simplePerformAll;
+	tmp->recorder = NULL;
 
 	/* Configure private helper functions. */
 	tmp->setStringParam = setStringParam;
@@ -1171,6 +1411,10 @@ int KSI_UriSplitBasic(const char *uri, char **scheme, char **host, unsigned *por
 
 int KSI_NetworkClient_performAll(KSI_NetworkClient *client, KSI_RequestHandle **arr, size_t arr_len) {
 	int res = KSI_UNKNOWN_ERROR;
+	KSI_uint64_t start;
+	KSI_uint64_t elapsed;
+	size_t i;
+
 	if (client == NULL || (arr == NULL && arr_len != 0)) {
 		res = KSI_INVALID_ARGUMENT;
 		goto cleanup;
@@ -1182,11 +1426,36 @@ int KSI_NetworkClient_performAll(KSI_NetworkClient *client, KSI_RequestHandle **
 	}
 
 	if (arr != NULL && arr_len != 0) {
+		start = KSI_Counters_clock();
 		res = client->performAll(client, arr, arr_len);
+		elapsed = KSI_Counters_clock() - start;
+
+		/* The simple implementation counts the requests one by one in #KSI_RequestHandle_perform. As
+		 * the concurrent implementations run the requests side by side, they are counted with the
+		 * time of the whole batch. */
+		if (client->performAll != simplePerformAll) {
+			for (i = 0; i < arr_len; i++) {
+				KSI_Counters_addRequest(client->ctx, arr[i]->service, arr[i]->response == NULL, elapsed);
+			}
+		}
+
 		if (res != KSI_OK) {
 			KSI_pushError(client->ctx, res, NULL);
 			goto cleanup;
 		}
+
+		/* The simple implementation also records the requests in #KSI_RequestHandle_perform. */
+		if (client->performAll != simplePerformAll) {
+			for (i = 0; i < arr_len; i++) {
+				if (arr[i]->recorder == NULL || arr[i]->response == NULL) continue;
+
+				res = KSI_NetRecorder_add(arr[i]->recorder, arr[i], elapsed);
+				if (res != KSI_OK) {
+					KSI_pushError(client->ctx, res, NULL);
+					goto cleanup;
+				}
+			}
+		}
 	}
 
 	res = KSI_OK;
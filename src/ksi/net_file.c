@@ -146,8 +146,9 @@ cleanup:
 }
 
 static int prepareRequest(KSI_NetworkClient *client,
-						  void *pdu,
-						  int (*serialize)(void *, unsigned char **, size_t *),
+						  KSI_NetEndpoint *endpoint,
+						  void *req,
+						  int (*serialize)(KSI_NetEndpoint *, void *, unsigned char **, size_t *),
 						  KSI_RequestHandle **handle,
 						  FsClient_Endpoint *endp,
 						  const char *desc) {
@@ -157,7 +158,7 @@ static int prepareRequest(KSI_NetworkClient *client,
 	unsigned char *raw = NULL;
 	size_t raw_len = 0;
 
-	if (client == NULL || pdu == NULL || handle == NULL) {
+	if (client == NULL || endpoint == NULL || req == NULL || handle == NULL) {
 		res = KSI_INVALID_ARGUMENT;
 		goto cleanup;
 	}
@@ -166,7 +167,7 @@ static int prepareRequest(KSI_NetworkClient *client,
 
 	KSI_LOG_debug(client->ctx, "File: %s", desc);
 
-	res = serialize(pdu, &raw, &raw_len);
+	res = serialize(endpoint, req, &raw, &raw_len);
 	if (res != KSI_OK) {
 		KSI_pushError(client->ctx, res, NULL);
 		goto cleanup;
@@ -209,7 +210,6 @@ static int prepareExtendRequest(KSI_NetworkClient *client, KSI_ExtendReq *req, K
 	FsClient_Endpoint *endp = NULL;
 	KSI_Integer *pReqId = NULL;
 	KSI_Integer *reqId = NULL;
-	KSI_ExtendPdu *pdu = NULL;
 
 	if (client == NULL || req == NULL || handle == NULL) {
 		res = KSI_INVALID_ARGUMENT;
@@ -227,7 +227,7 @@ static int prepareExtendRequest(KSI_NetworkClient *client, KSI_ExtendReq *req, K
 	if (res != KSI_OK) goto cleanup;
 
 	if (pReqId == NULL) {
-		res = KSI_Integer_new(client->ctx, ++client->ctx->netProvider->requestCount, &reqId);
+		res = KSI_Integer_new(client->ctx, KSI_Atomic_increment(&client->ctx->netProvider->requestCount), &reqId);
 		if (res != KSI_OK) goto cleanup;
 
 		res = KSI_ExtendReq_setRequestId(req, reqId);
@@ -236,13 +236,11 @@ static int prepareExtendRequest(KSI_NetworkClient *client, KSI_ExtendReq *req, K
 		reqId = NULL;
 	}
 
-	res = KSI_ExtendReq_enclose(req, client->extender->ksi_user, client->extender->ksi_pass, &pdu);
-	if (res != KSI_OK) goto cleanup;
-
 	res = prepareRequest(
 			  client,
-			  pdu,
-			  (int (*)(void *, unsigned char **, size_t *))KSI_ExtendPdu_serialize,
+			  client->extender,
+			  req,
+			  (int (*)(KSI_NetEndpoint *, void *, unsigned char **, size_t *))KSI_NetEndpoint_serializeExtendReq,
 			  handle,
 			  endp,
 			  "Extend request");
@@ -251,8 +249,6 @@ static int prepareExtendRequest(KSI_NetworkClient *client, KSI_ExtendReq *req, K
 
 cleanup:
 	KSI_Integer_free(reqId);
-	KSI_ExtendPdu_setRequest(pdu, NULL);
-	KSI_ExtendPdu_free(pdu);
 
 	return res;
 }
@@ -262,7 +258,6 @@ static int prepareAggregationRequest(KSI_NetworkClient *client, KSI_AggregationR
 	FsClient_Endpoint *endp = NULL;
 	KSI_Integer *pReqId = NULL;
 	KSI_Integer *reqId = NULL;
-	KSI_AggregationPdu *pdu = NULL;
 
 	if (client == NULL || req == NULL || handle == NULL) {
 		res = KSI_INVALID_ARGUMENT;
@@ -280,7 +275,7 @@ static int prepareAggregationRequest(KSI_NetworkClient *client, KSI_AggregationR
 	if (res != KSI_OK) goto cleanup;
 
 	if (pReqId == NULL) {
-		res = KSI_Integer_new(client->ctx, ++client->ctx->netProvider->requestCount, &reqId);
+		res = KSI_Integer_new(client->ctx, KSI_Atomic_increment(&client->ctx->netProvider->requestCount), &reqId);
 		if (res != KSI_OK) goto cleanup;
 
 		res = KSI_AggregationReq_setRequestId(req, reqId);
@@ -289,13 +284,11 @@ static int prepareAggregationRequest(KSI_NetworkClient *client, KSI_AggregationR
 		reqId = NULL;
 	}
 
-	res = KSI_AggregationReq_enclose(req, client->aggregator->ksi_user, client->aggregator->ksi_pass, &pdu);
-	if (res != KSI_OK) goto cleanup;
-
 	res = prepareRequest(
 			  client,
-			  pdu,
-			  (int (*)(void *, unsigned char **, size_t *))KSI_AggregationPdu_serialize,
+			  client->aggregator,
+			  req,
+			  (int (*)(KSI_NetEndpoint *, void *, unsigned char **, size_t *))KSI_NetEndpoint_serializeAggregationReq,
 			  handle,
 			  endp,
 			  "Aggregation request");
@@ -305,8 +298,6 @@ static int prepareAggregationRequest(KSI_NetworkClient *client, KSI_AggregationR
 
 cleanup:
 	KSI_Integer_free(reqId);
-	KSI_AggregationPdu_setRequest(pdu, NULL);
-	KSI_AggregationPdu_free(pdu);
 
 	return res;
 }
@@ -51,8 +51,9 @@ static int setIntParam(int *param, int val) {
 
 static int prepareRequest(
 		KSI_NetworkClient *client,
-		void *pdu,
-		int (*serialize)(void *, unsigned char **, size_t *),
+		KSI_NetEndpoint *endpoint,
+		void *req,
+		int (*serialize)(KSI_NetEndpoint *, void *, unsigned char **, size_t *),
 		KSI_RequestHandle **handle,
 		char *url,
 		const char *desc) {
@@ -62,13 +63,13 @@ static int prepareRequest(
 	unsigned char *raw = NULL;
 	size_t raw_len = 0;
 
-	if (client == NULL || pdu == NULL || handle == NULL) {
+	if (client == NULL || endpoint == NULL || req == NULL || handle == NULL) {
 		res = KSI_INVALID_ARGUMENT;
 		goto cleanup;
 	}
 	KSI_ERR_clearErrors(client->ctx);
 
-	res = serialize(pdu, &raw, &raw_len);
+	res = serialize(endpoint, req, &raw, &raw_len);
 	if (res != KSI_OK) {
 		KSI_pushError(client->ctx, res, NULL);
 		goto cleanup;
@@ -109,7 +110,6 @@ cleanup:
 
 static int prepareExtendRequest(KSI_NetworkClient *client, KSI_ExtendReq *req, KSI_RequestHandle **handle) {
 	int res = KSI_UNKNOWN_ERROR;
-	KSI_ExtendPdu *pdu = NULL;
 	KSI_Integer *pReqId = NULL;
 	KSI_Integer *reqId = NULL;
 	HttpClient_Endpoint *endp = NULL;
@@ -130,7 +130,7 @@ static int prepareExtendRequest(KSI_NetworkClient *client, KSI_ExtendReq *req, K
 	if (res != KSI_OK) goto cleanup;
 
 	if (pReqId == NULL) {
-		res = KSI_Integer_new(client->ctx, ++client->requestCount, &reqId);
+		res = KSI_Integer_new(client->ctx, KSI_Atomic_increment(&client->requestCount), &reqId);
 		if (res != KSI_OK) goto cleanup;
 
 		res = KSI_ExtendReq_setRequestId(req, reqId);
@@ -139,13 +139,11 @@ static int prepareExtendRequest(KSI_NetworkClient *client, KSI_ExtendReq *req, K
 		reqId = NULL;
 	}
 
-	res = KSI_ExtendReq_enclose(req, client->extender->ksi_user, client->extender->ksi_pass, &pdu);
-	if (res != KSI_OK) goto cleanup;
-
 	res = prepareRequest(
 			client,
-			pdu,
-			(int (*)(void *, unsigned char **, size_t *))KSI_ExtendPdu_serialize,
+			client->extender,
+			req,
+			(int (*)(KSI_NetEndpoint *, void *, unsigned char **, size_t *))KSI_NetEndpoint_serializeExtendReq,
 			handle,
 			endp->url,
 			"Extend request");
@@ -157,15 +155,12 @@ static int prepareExtendRequest(KSI_NetworkClient *client, KSI_ExtendReq *req, K
 cleanup:
 
 	KSI_Integer_free(reqId);
-	KSI_ExtendPdu_setRequest(pdu, NULL);
-	KSI_ExtendPdu_free(pdu);
 
 	return res;
 }
 
 static int prepareAggregationRequest(KSI_NetworkClient *client, KSI_AggregationReq *req, KSI_RequestHandle **handle) {
 	int res = KSI_UNKNOWN_ERROR;
-	KSI_AggregationPdu *pdu = NULL;
 	KSI_Integer *pReqId = NULL;
 	KSI_Integer *reqId = NULL;
 	HttpClient_Endpoint *endp = NULL;
@@ -186,7 +181,7 @@ static int prepareAggregationRequest(KSI_NetworkClient *client, KSI_AggregationR
 	if (res != KSI_OK) goto cleanup;
 
 	if (pReqId == NULL) {
-		res = KSI_Integer_new(client->ctx, ++client->requestCount, &reqId);
+		res = KSI_Integer_new(client->ctx, KSI_Atomic_increment(&client->requestCount), &reqId);
 		if (res != KSI_OK) goto cleanup;
 
 		res = KSI_AggregationReq_setRequestId(req, reqId);
@@ -195,21 +190,17 @@ static int prepareAggregationRequest(KSI_NetworkClient *client, KSI_AggregationR
 		reqId = NULL;
 	}
 
-	res = KSI_AggregationReq_enclose(req, client->aggregator->ksi_user, client->aggregator->ksi_pass, &pdu);
-	if (res != KSI_OK) goto cleanup;
-
 	res = prepareRequest(
 			client,
-			pdu,
-			(int (*)(void *, unsigned char **, size_t *))KSI_AggregationPdu_serialize,
+			client->aggregator,
+			req,
+			(int (*)(KSI_NetEndpoint *, void *, unsigned char **, size_t *))KSI_NetEndpoint_serializeAggregationReq,
 			handle,
 			endp->url,
 			"Aggregation request");
 cleanup:
 
 	KSI_Integer_free(reqId);
-	KSI_AggregationPdu_setRequest(pdu, NULL);
-	KSI_AggregationPdu_free(pdu);
 
 	return res;
 }
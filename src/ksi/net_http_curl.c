@@ -26,6 +26,7 @@
 
 #include "net_http_impl.h"
 #include "net_impl.h"
+#include "ctx_impl.h"
 
 static size_t curlGlobal_initCount = 0;
 
@@ -169,10 +170,36 @@ cleanup:
 	return res;
 }
 
+/* Reports the phases of a completed transfer, using the times measured by cURL from the given start. */
+static void traceTransfer(KSI_RequestHandle *handle, KSI_uint64_t start) {
+	CurlNetHandleCtx *impl = handle->implCtx;
+	double lookup = 0;
+	double connect = 0;
+	double pretransfer = 0;
+	double total = 0;
+
+	if (!KSI_TRACE_ENABLED(handle->ctx) || impl == NULL) return;
+
+	curl_easy_getinfo(impl->curl, CURLINFO_NAMELOOKUP_TIME, &lookup);
+	curl_easy_getinfo(impl->curl, CURLINFO_CONNECT_TIME, &connect);
+	curl_easy_getinfo(impl->curl, CURLINFO_PRETRANSFER_TIME, &pretransfer);
+	curl_easy_getinfo(impl->curl, CURLINFO_TOTAL_TIME, &total);
+
+	KSI_TRACE_AT(handle->ctx, KSI_TRACE_DNS, KSI_TRACE_START, handle->requestId, start);
+	KSI_TRACE_AT(handle->ctx, KSI_TRACE_DNS, KSI_TRACE_END, handle->requestId, start + (KSI_uint64_t)(lookup * 1000000));
+	KSI_TRACE_AT(handle->ctx, KSI_TRACE_CONNECT, KSI_TRACE_START, handle->requestId, start + (KSI_uint64_t)(lookup * 1000000));
+	KSI_TRACE_AT(handle->ctx, KSI_TRACE_CONNECT, KSI_TRACE_END, handle->requestId, start + (KSI_uint64_t)(connect * 1000000));
+	KSI_TRACE_AT(handle->ctx, KSI_TRACE_SEND, KSI_TRACE_START, handle->requestId, start + (KSI_uint64_t)(connect * 1000000));
+	KSI_TRACE_AT(handle->ctx, KSI_TRACE_SEND, KSI_TRACE_END, handle->requestId, start + (KSI_uint64_t)(pretransfer * 1000000));
+	KSI_TRACE_AT(handle->ctx, KSI_TRACE_WAIT, KSI_TRACE_START, handle->requestId, start + (KSI_uint64_t)(pretransfer * 1000000));
+	KSI_TRACE_AT(handle->ctx, KSI_TRACE_WAIT, KSI_TRACE_END, handle->requestId, start + (KSI_uint64_t)(total * 1000000));
+}
+
 static int curlReceive(KSI_RequestHandle *handle) {
 	int res = KSI_UNKNOWN_ERROR;
 	CurlNetHandleCtx *implCtx = NULL;
 	long httpCode;
+	KSI_uint64_t start;
 
 	if (handle == NULL || handle->client == NULL || handle->implCtx == NULL) {
 		res = KSI_INVALID_ARGUMENT;
@@ -184,7 +211,9 @@ static int curlReceive(KSI_RequestHandle *handle) {
 
 	KSI_LOG_debug(handle->ctx, "Sending request.");
 
+	start = KSI_Counters_clock();
 	res = curl_easy_perform(implCtx->curl);
+	traceTransfer(handle, start);
 	KSI_LOG_debug(handle->ctx, "Received %llu bytes.", (unsigned long long)implCtx->len);
 
 	if (curl_easy_getinfo(implCtx->curl, CURLINFO_HTTP_CODE, &httpCode) == CURLE_OK) {
@@ -307,6 +336,7 @@ static int performN(KSI_NetworkClient *client, KSI_RequestHandle **arr, size_t a
 	fd_set fdexcep;
 	int maxfd = -1;
 	struct timeval timeout;
+	KSI_uint64_t start;
 
 	FD_ZERO(&fdread);
 	FD_ZERO(&fdwrite);
@@ -342,6 +372,8 @@ static int performN(KSI_NetworkClient *client, KSI_RequestHandle **arr, size_t a
 
 	curl_multi_setopt(cm, CURLMOPT_PIPELINING, 1);
 
+	start = KSI_Counters_clock();
+
 	do {
 		cres  = curl_multi_fdset(cm, &fdread, &fdwrite, &fdexcep, &maxfd);
 		if (cres != CURLM_OK) {
@@ -377,6 +409,8 @@ static int performN(KSI_NetworkClient *client, KSI_RequestHandle **arr, size_t a
 
 		res = updateStatus(arr[i]);
 		if (res != KSI_OK) goto cleanup;
+
+		traceTransfer(arr[i], start);
 	}
 
 	KSI_LOG_debug(client->ctx, "Finished cURL multi perform.");
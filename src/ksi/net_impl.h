@@ -21,7 +21,9 @@
 #define NET_IMPL_H_
 
 #include "net.h"
+#include "net_replay.h"
 #include "internal.h"
+#include "hmac.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -41,6 +43,18 @@ extern "C" {
 		
 		/** Cleanup for implementation. */
 		void (*implCtx_free)(void *);
+
+		/** Prepared HMAC state for \c ksi_pass, cloned for every message; \c NULL until first used. */
+		KSI_HmacHasher *hmacHasher;
+
+		/** Copy of the key the #hmacHasher was prepared with. */
+		char *hmacKey;
+
+		/** Hash algorithm the #hmacHasher was prepared with. */
+		KSI_HashAlgorithm hmacAlgorithm;
+
+		/** Protects the prepared HMAC state when the context is shared. */
+		KSI_Mutex *hmacLock;
 	};
 	
 	
@@ -69,6 +83,9 @@ extern "C" {
 
 		int (*performAll)(KSI_NetworkClient *client, KSI_RequestHandle **arr, size_t arr_len);
 
+		/** Recorder of the completed requests, not owned by the client; \c NULL if not recording. */
+		KSI_NetRecorder *recorder;
+
 		/** Private helper functions. */
 		int (*setStringParam)(char **param, const char *val);
 		int (*uriSplit)(const char *uri, char **scheme, char **user, char **pass, char **host, unsigned *port, char **path, char **query, char **fragment);
@@ -108,8 +125,102 @@ extern "C" {
 		/** Function to retrieve the status of the last perform call. Will return #KSI_REQUEST_PENDING if
 		 * the request has not been performed. */
 		int (*status)(KSI_RequestHandle *);
+
+		/** Service the request is counted for, see #KSI_CounterService_en; -1 if not known. */
+		int service;
+
+		/** Request ID of the PDU, used for tracing; 0 if not known. */
+		KSI_uint64_t requestId;
+
+		/** Recorder of the client the request was sent with, \c NULL if not recording. */
+		KSI_NetRecorder *recorder;
+
+		/** Response already parsed and authenticated by the pool client, handed over by the next
+		 * #KSI_RequestHandle_getAggregationResponse call; \c NULL if none. */
+		KSI_AggregationResp *aggrResp;
+
+		/** Same as #aggrResp, for #KSI_RequestHandle_getExtendResponse. */
+		KSI_ExtendResp *extResp;
 	};
 
+	/**
+	 * Appends the request and the response of a completed handle to the log of the recorder.
+	 * \param[in]	rec			The recorder.
+	 * \param[in]	handle		Completed request handle.
+	 * \param[in]	latency		Time the request took in microseconds.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_NetRecorder_add(KSI_NetRecorder *rec, const KSI_RequestHandle *handle, KSI_uint64_t latency);
+
+	/**
+	 * Tells whether the client performs the requests of #KSI_NetworkClient_performAll side by side
+	 * rather than one by one with #KSI_RequestHandle_perform.
+	 * \param[in]	client		Network client.
+	 * \return non-zero, if the client has a concurrent implementation.
+	 */
+	int KSI_NetworkClient_isConcurrent(const KSI_NetworkClient *client);
+
+	/**
+	 * Returns a fresh HMAC computation keyed with the password of the endpoint. The key dependent
+	 * state is prepared once per endpoint and referenced by the returned hasher, so only the
+	 * inner state is copied when the message is hashed.
+	 * \param[in]	endp		Network endpoint.
+	 * \param[in]	algo_id		Hash algorithm of the HMAC.
+	 * \param[out]	hasher		Pointer to the receiving pointer, must be freed by the caller.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_NetEndpoint_getHmacHasher(KSI_NetEndpoint *endp, KSI_HashAlgorithm algo_id, KSI_HmacHasher **hasher);
+
+	/**
+	 * Serializes the extension request for sending to the endpoint, see #KSI_ExtendReq_serializeWithHmac.
+	 * \param[in]	endp		Extender endpoint.
+	 * \param[in]	req			Extension request, the ownership is not taken.
+	 * \param[out]	raw			Pointer to the receiving pointer of the serialized PDU.
+	 * \param[out]	raw_len		Length of the serialized PDU.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_NetEndpoint_serializeExtendReq(KSI_NetEndpoint *endp, KSI_ExtendReq *req, unsigned char **raw, size_t *raw_len);
+
+	/**
+	 * \see #KSI_NetEndpoint_serializeExtendReq
+	 */
+	int KSI_NetEndpoint_serializeAggregationReq(KSI_NetEndpoint *endp, KSI_AggregationReq *req, unsigned char **raw, size_t *raw_len);
+
+	/**
+	 * Encloses the request into a PDU and serializes it, computing the HMAC over the serialized
+	 * bytes with a copy of \c hmacState instead of serializing the PDU a second time.
+	 */
+	int KSI_ExtendReq_serializeWithHmac(KSI_ExtendReq *req, const char *loginId, KSI_HashAlgorithm algo_id, const KSI_HmacHasher *hmacState, unsigned char **raw, size_t *raw_len);
+
+	/**
+	 * \see #KSI_ExtendReq_serializeWithHmac
+	 */
+	int KSI_AggregationReq_serializeWithHmac(KSI_AggregationReq *req, const char *loginId, KSI_HashAlgorithm algo_id, const KSI_HmacHasher *hmacState, unsigned char **raw, size_t *raw_len);
+
+	/**
+	 * Calculates the HMAC of a serialized PDU which ends with an HMAC of \c algo_id and writes
+	 * it over the previous digest, so the PDU does not have to be serialized again.
+	 * \param[in]	ctx			KSI context.
+	 * \param[in]	version		PDU version, see #KSI_PDU_VERSION_1 and #KSI_PDU_VERSION_2.
+	 * \param[in]	algo_id		Hash algorithm of the HMAC.
+	 * \param[in]	hmacState	Prepared HMAC state, see #KSI_NetEndpoint_getHmacHasher.
+	 * \param[in,out]	raw		The serialized PDU.
+	 * \param[in]	raw_len		Length of the serialized PDU.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_Pdu_updateSerializedHmac(KSI_CTX *ctx, int version, KSI_HashAlgorithm algo_id, const KSI_HmacHasher *hmacState, unsigned char *raw, size_t raw_len);
+
+	/**
+	 * Calculates the HMAC of the PDU with a copy of the prepared \c hmacState.
+	 * \see #KSI_ExtendPdu_calculateHmac
+	 */
+	int KSI_ExtendPdu_calculateHmacWithHasher(KSI_ExtendPdu *t, KSI_HashAlgorithm algo_id, const KSI_HmacHasher *hmacState, KSI_DataHash **hmac);
+
+	/**
+	 * \see #KSI_ExtendPdu_calculateHmacWithHasher
+	 */
+	int KSI_AggregationPdu_calculateHmacWithHasher(KSI_AggregationPdu *t, KSI_HashAlgorithm algo_id, const KSI_HmacHasher *hmacState, KSI_DataHash **hmac);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,1250 @@
+/*
+ * Copyright 2013-2016 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include "internal.h"
+#include "net_impl.h"
+#include "net_pool.h"
+#include "net_uri.h"
+#include "counters.h"
+#include "counters_impl.h"
+#include "thread.h"
+#include "ctx_impl.h"
+
+/** Maximum number of endpoints per service. */
+#define POOL_MAX_ENDPOINTS 16
+
+/** Maximum number of endpoints a single request is tried with. */
+#define POOL_MAX_ATTEMPTS 3
+
+/** Weight of the latest observation in the moving averages. */
+#define POOL_EWMA_WEIGHT 0.2
+
+/** Extra weight of the error rate in the score of an endpoint. */
+#define POOL_ERROR_PENALTY 4.0
+
+/** The ejection time is doubled on every failed probe, up to 2^#POOL_MAX_EJECT_SHIFT times the initial value. */
+#define POOL_MAX_EJECT_SHIFT 3
+
+/** Number of the services with endpoint pools, indexed by #KSI_CounterService_en. */
+#define POOL_SERVICE_COUNT 2
+
+/** Number of the recent response times the hedging delay is computed from. */
+#define POOL_HEDGE_SAMPLES 64
+
+/** Minimum number of measured response times before the requests are hedged. */
+#define POOL_HEDGE_MIN_SAMPLES 5
+
+/** Maximum number of hedged requests the unused budget may accumulate to. */
+#define POOL_HEDGE_BURST 5.0
+
+typedef struct PoolEndpoint_st {
+	/** URI client of the endpoint. */
+	KSI_NetworkClient *client;
+	/** URI of the endpoint, for logging. */
+	char *uri;
+	/** Moving average of the response time in microseconds, 0 if not measured. */
+	double latency;
+	/** Moving average of the share of failed requests. */
+	double errorRate;
+	/** Number of requests in progress. */
+	size_t inflight;
+	/** Number of consecutive failed requests. */
+	unsigned failures;
+	/** Number of consecutive ejections, for the back-off. */
+	unsigned ejections;
+	/** Clock value until the endpoint is ejected, 0 if it is healthy. */
+	KSI_uint64_t ejectedUntil;
+	/** Set while the request probing an ejected endpoint is in progress. */
+	int probing;
+} PoolEndpoint;
+
+typedef struct PoolService_st {
+	PoolEndpoint endpoint[POOL_MAX_ENDPOINTS];
+	size_t count;
+	/** Ring buffer of the recent response times in microseconds. */
+	KSI_uint64_t sample[POOL_HEDGE_SAMPLES];
+	size_t sample_count;
+	size_t sample_next;
+} PoolService;
+
+struct PoolRace_st;
+
+struct KSI_PoolClient_st {
+	PoolService service[POOL_SERVICE_COUNT];
+	KSI_NetworkClient *pubClient;
+	unsigned maxFailures;
+	unsigned ejectSeconds;
+	/** Timeouts applied to the endpoints, -1 if not set. */
+	int transferTimeout;
+	int connectTimeout;
+	/** Percentile of the response times after which the requests are hedged, 0 if disabled. */
+	unsigned hedgePercentile;
+	/** Number of hedged requests allowed per 100 requests. */
+	unsigned hedgeBudget;
+	/** Number of hedged requests currently allowed. */
+	double hedgeTokens;
+	size_t hedged;
+	size_t hedgesWon;
+	/** Hedged requests whose losing attempts are still running. */
+	struct PoolRace_st *orphans;
+	/** Protects the state of the endpoints and the hedging, as the hedged attempts run in threads. */
+	KSI_Mutex *mutex;
+};
+
+/** Implementation context of the handles, holding the request prepared for the chosen endpoints. */
+typedef struct PoolRequest_st {
+	KSI_PoolClient *pool;
+	int service;
+	/** Endpoint indices in the order of preference. */
+	size_t endpoint[POOL_MAX_ATTEMPTS];
+	/** Handles of the endpoint clients. */
+	KSI_RequestHandle *handle[POOL_MAX_ATTEMPTS];
+	size_t count;
+	/** The attempt to be performed next. */
+	size_t next;
+	/** Set while the endpoint of the next attempt counts the request as in progress. */
+	int dispatched;
+} PoolRequest;
+
+/** An attempt of a hedged request, running in its own thread. */
+typedef struct PoolAttempt_st {
+	struct PoolRace_st *race;
+	KSI_RequestHandle *handle;
+	PoolEndpoint *ep;
+	KSI_Thread *thread;
+	int res;
+	int done;
+} PoolAttempt;
+
+/** A hedged request: the attempt to the primary endpoint and possibly the hedge to the next one. */
+typedef struct PoolRace_st {
+	KSI_PoolClient *pool;
+	PoolService *svc;
+	/** Signalled with the pool mutex when an attempt is done. */
+	KSI_Cond *cond;
+	/** Service of the request, see #KSI_CounterService_en. */
+	int service;
+	PoolAttempt attempt[2];
+	size_t count;
+	/** Index of the first successful attempt, -1 if none yet. */
+	int winner;
+	/** Index of the first attempt the service rejected, -1 if none. */
+	int rejected;
+	struct PoolRace_st *next;
+} PoolRace;
+
+static PoolEndpoint *requestEndpoint(PoolRequest *pr, size_t attempt) {
+	return &pr->pool->service[pr->service].endpoint[pr->endpoint[attempt]];
+}
+
+static void PoolRequest_free(PoolRequest *pr) {
+	size_t i;
+
+	if (pr != NULL) {
+		/* A request that was never performed is no longer in progress. */
+		if (pr->dispatched) {
+			PoolEndpoint *ep = requestEndpoint(pr, pr->next);
+			KSI_Mutex_lock(pr->pool->mutex);
+			ep->inflight--;
+			ep->probing = 0;
+			KSI_Mutex_unlock(pr->pool->mutex);
+		}
+		for (i = 0; i < pr->count; i++) {
+			KSI_RequestHandle_free(pr->handle[i]);
+		}
+		KSI_free(pr);
+	}
+}
+
+/** Outcomes of a completed attempt, see #attemptOutcome. */
+#define ATTEMPT_FAILED 0
+#define ATTEMPT_REJECTED 1
+#define ATTEMPT_OK 2
+
+/* The functions below up to #attemptOutcome are called with the pool mutex held. */
+
+/** Score of an available endpoint, lower is better. */
+static double endpointScore(const PoolEndpoint *ep) {
+	return (ep->latency + 1.0) * (double)(ep->inflight + 1) * (1.0 + POOL_ERROR_PENALTY * ep->errorRate);
+}
+
+/**
+ * Orders the endpoints of the service by preference. An ejected endpoint due for probing comes
+ * first, followed by the healthy endpoints by their score. The other ejected endpoints are only
+ * used as the last resort, the one to be probed soonest first.
+ */
+static size_t rankEndpoints(PoolService *svc, KSI_uint64_t now, size_t *order, size_t max) {
+	size_t i;
+	size_t j;
+	size_t len = 0;
+	double key[POOL_MAX_ENDPOINTS];
+	int rank[POOL_MAX_ENDPOINTS];
+	size_t tmp[POOL_MAX_ENDPOINTS];
+
+	for (i = 0; i < svc->count; i++) {
+		const PoolEndpoint *ep = &svc->endpoint[i];
+		int r;
+		double k;
+
+		if (ep->ejectedUntil == 0) {
+			r = 1;
+			k = endpointScore(ep);
+		} else if (now >= ep->ejectedUntil && !ep->probing) {
+			r = 0;
+			k = 0;
+		} else {
+			r = 2;
+			k = (double)ep->ejectedUntil;
+		}
+
+		/* Insertion sort, the pools are small. */
+		for (j = len; j > 0 && (rank[j - 1] > r || (rank[j - 1] == r && key[j - 1] > k)); j--) {
+			rank[j] = rank[j - 1];
+			key[j] = key[j - 1];
+			tmp[j] = tmp[j - 1];
+		}
+		rank[j] = r;
+		key[j] = k;
+		tmp[j] = i;
+		len++;
+	}
+
+	if (len > max) len = max;
+	memcpy(order, tmp, len * sizeof(size_t));
+
+	return len;
+}
+
+static void endpointDispatch(PoolEndpoint *ep) {
+	ep->inflight++;
+	if (ep->ejectedUntil != 0) ep->probing = 1;
+}
+
+static void endpointResult(KSI_CTX *ctx, KSI_PoolClient *pool, PoolService *svc, PoolEndpoint *ep, int outcome, KSI_uint64_t elapsed) {
+	KSI_uint64_t now = KSI_Counters_clock();
+	int wasProbing = ep->probing;
+
+	ep->inflight--;
+	ep->probing = 0;
+
+	if (outcome != ATTEMPT_FAILED) {
+		/* A rejection shows the endpoint is working, but its response time is not representative. */
+		if (outcome == ATTEMPT_OK) {
+			ep->latency = ep->latency == 0 ? (double)elapsed : ep->latency + POOL_EWMA_WEIGHT * ((double)elapsed - ep->latency);
+
+			svc->sample[svc->sample_next] = elapsed;
+			svc->sample_next = (svc->sample_next + 1) % POOL_HEDGE_SAMPLES;
+			if (svc->sample_count < POOL_HEDGE_SAMPLES) svc->sample_count++;
+		}
+
+		ep->errorRate -= POOL_EWMA_WEIGHT * ep->errorRate;
+		ep->failures = 0;
+
+		if (ep->ejectedUntil != 0) {
+			KSI_LOG_info(ctx, "Pool: endpoint '%s' has recovered.", ep->uri);
+			ep->ejectedUntil = 0;
+			ep->ejections = 0;
+		}
+	} else {
+		ep->errorRate += POOL_EWMA_WEIGHT * (1.0 - ep->errorRate);
+		ep->failures++;
+
+		if (wasProbing || (ep->ejectedUntil == 0 && ep->failures >= pool->maxFailures)) {
+			unsigned shift = ep->ejections < POOL_MAX_EJECT_SHIFT ? ep->ejections : POOL_MAX_EJECT_SHIFT;
+
+			ep->ejectedUntil = now + ((KSI_uint64_t)pool->ejectSeconds * 1000000 << shift);
+			ep->ejections++;
+			KSI_LOG_warn(ctx, "Pool: ejecting endpoint '%s' for %u seconds.", ep->uri, pool->ejectSeconds << shift);
+		}
+	}
+}
+
+static int compareSample(const void *a, const void *b) {
+	KSI_uint64_t x = *(const KSI_uint64_t *)a;
+	KSI_uint64_t y = *(const KSI_uint64_t *)b;
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/**
+ * Returns the time in milliseconds after which the request is hedged, or 0 if it is not hedged:
+ * hedging is disabled, the budget is used up, there is no other endpoint to send the request to or
+ * too few response times have been measured yet.
+ */
+static unsigned hedgeDelay(PoolRequest *pr) {
+	KSI_PoolClient *pool = pr->pool;
+	PoolService *svc = &pool->service[pr->service];
+	KSI_uint64_t sorted[POOL_HEDGE_SAMPLES];
+	size_t i;
+
+	if (pool->hedgePercentile == 0 || pool->hedgeTokens < 1.0 || pr->next + 1 >= pr->count || svc->sample_count < POOL_HEDGE_MIN_SAMPLES) return 0;
+
+	memcpy(sorted, svc->sample, svc->sample_count * sizeof(KSI_uint64_t));
+	qsort(sorted, svc->sample_count, sizeof(KSI_uint64_t), compareSample);
+	i = ((svc->sample_count - 1) * pool->hedgePercentile + 50) / 100;
+
+	return (unsigned)(sorted[i] / 1000) + 1;
+}
+
+/* Tells whether the service found the request itself invalid, so the other endpoints would reject it as well. */
+static int isRequestError(int res) {
+	switch (res) {
+		case KSI_SERVICE_INVALID_REQUEST:
+		case KSI_SERVICE_INVALID_PAYLOAD:
+		case KSI_SERVICE_EXTENDER_INVALID_TIME_RANGE:
+		case KSI_SERVICE_EXTENDER_REQUEST_TIME_TOO_OLD:
+		case KSI_SERVICE_EXTENDER_REQUEST_TIME_TOO_NEW:
+		case KSI_SERVICE_EXTENDER_REQUEST_TIME_IN_FUTURE:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/**
+ * Classifies a completed attempt. The attempt is successful, if a response was received that is not
+ * a server error and, for the aggregator and the extender, parses as a PDU with a valid HMAC and
+ * without an error status. The parsed response is kept on the handle, so it is not parsed and
+ * authenticated again when the caller reads it. The publications file is verified by the caller.
+ * \param[in]		handle		Handle of the attempt.
+ * \param[in]		service		Service of the request, see #KSI_CounterService_en.
+ * \param[in,out]	res			Result of reading the response, replaced with the error of the service.
+ * \return #ATTEMPT_OK, #ATTEMPT_REJECTED if the service found the request invalid, otherwise #ATTEMPT_FAILED.
+ */
+static int attemptOutcome(KSI_RequestHandle *handle, int service, int *res) {
+	KSI_AggregationResp *aggrResp = NULL;
+	KSI_ExtendResp *extResp = NULL;
+	KSI_Integer *status = NULL;
+
+	if (*res != KSI_OK || handle->response == NULL || handle->err.code >= 500) return ATTEMPT_FAILED;
+
+	switch (service) {
+		case KSI_COUNTER_SERVICE_AGGREGATOR:
+			*res = KSI_RequestHandle_getAggregationResponse(handle, &aggrResp);
+			if (*res == KSI_OK) *res = KSI_AggregationResp_getStatus(aggrResp, &status);
+			if (*res == KSI_OK) *res = KSI_convertAggregatorStatusCode(status);
+			handle->aggrResp = aggrResp;
+			break;
+		case KSI_COUNTER_SERVICE_EXTENDER:
+			*res = KSI_RequestHandle_getExtendResponse(handle, &extResp);
+			if (*res == KSI_OK) *res = KSI_ExtendResp_getStatus(extResp, &status);
+			if (*res == KSI_OK) *res = KSI_convertExtenderStatusCode(status);
+			handle->extResp = extResp;
+			break;
+		default:
+			break;
+	}
+
+	if (*res == KSI_OK) return ATTEMPT_OK;
+
+	return isRequestError(*res) ? ATTEMPT_REJECTED : ATTEMPT_FAILED;
+}
+
+/* Takes over the response of the attempt, together with the response parsed from it. */
+static int adoptResponse(KSI_RequestHandle *handle, KSI_RequestHandle *inner) {
+	int res;
+
+	res = KSI_RequestHandle_setResponse(handle, inner->response, inner->response_length);
+	if (res != KSI_OK) goto cleanup;
+
+	handle->aggrResp = inner->aggrResp;
+	inner->aggrResp = NULL;
+	handle->extResp = inner->extResp;
+	inner->extResp = NULL;
+
+	handle->err = inner->err;
+	/* The response is authenticated with the key of the endpoint that sent it. */
+	handle->client = inner->client;
+	handle->completed = true;
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+static int raceAttempt(void *arg) {
+	PoolAttempt *a = arg;
+	PoolRace *race = a->race;
+	KSI_uint64_t start;
+	int res;
+	int outcome;
+
+	start = KSI_Counters_clock();
+	res = a->handle->readResponse(a->handle);
+	outcome = attemptOutcome(a->handle, race->service, &res);
+
+	KSI_Mutex_lock(race->pool->mutex);
+	endpointResult(a->handle->ctx, race->pool, race->svc, a->ep, outcome, KSI_Counters_clock() - start);
+	a->res = outcome != ATTEMPT_FAILED ? KSI_OK : res == KSI_OK ? KSI_NETWORK_ERROR : res;
+	a->done = 1;
+	/* Only a successful response wins the race, a rejection is used if no endpoint succeeds. */
+	if (outcome == ATTEMPT_OK && race->winner < 0) race->winner = (int)(a - race->attempt);
+	if (outcome == ATTEMPT_REJECTED && race->rejected < 0) race->rejected = (int)(a - race->attempt);
+	KSI_Cond_broadcast(race->cond);
+	KSI_Mutex_unlock(race->pool->mutex);
+
+	return res;
+}
+
+static void PoolRace_free(PoolRace *race) {
+	size_t i;
+
+	if (race != NULL) {
+		for (i = 0; i < race->count; i++) {
+			KSI_Thread_free(race->attempt[i].thread);
+			KSI_RequestHandle_free(race->attempt[i].handle);
+		}
+		KSI_Cond_free(race->cond);
+		KSI_free(race);
+	}
+}
+
+/* Checks if all the attempts of the race are done, called with the pool mutex held. */
+static int raceFinished(const PoolRace *race) {
+	size_t i;
+
+	for (i = 0; i < race->count; i++) {
+		if (!race->attempt[i].done) return 0;
+	}
+
+	return 1;
+}
+
+/* Releases the races whose losing attempts have finished, waiting for all of them if requested. */
+static void reapOrphans(KSI_PoolClient *pool, int wait) {
+	PoolRace **pp;
+	PoolRace *done = NULL;
+	PoolRace *race;
+
+	KSI_Mutex_lock(pool->mutex);
+	pp = &pool->orphans;
+	while (*pp != NULL) {
+		race = *pp;
+		if (wait || raceFinished(race)) {
+			*pp = race->next;
+			race->next = done;
+			done = race;
+		} else {
+			pp = &race->next;
+		}
+	}
+	KSI_Mutex_unlock(pool->mutex);
+
+	while (done != NULL) {
+		race = done;
+		done = race->next;
+		PoolRace_free(race);
+	}
+}
+
+/* Takes the next attempt of the request to the race and starts it, called with the pool mutex held. */
+static void raceStart(KSI_CTX *ctx, PoolRace *race, PoolRequest *pr) {
+	PoolAttempt *a = &race->attempt[race->count++];
+	int res;
+
+	a->race = race;
+	a->handle = pr->handle[pr->next];
+	a->ep = requestEndpoint(pr, pr->next);
+	a->thread = NULL;
+	a->res = KSI_UNKNOWN_ERROR;
+	a->done = 0;
+
+	if (!pr->dispatched) endpointDispatch(a->ep);
+	pr->handle[pr->next] = NULL;
+	pr->dispatched = 0;
+	pr->next++;
+
+	KSI_Mutex_unlock(race->pool->mutex);
+	res = KSI_Thread_start(ctx, raceAttempt, a, &a->thread);
+	/* Without a thread, the attempt is performed right away. */
+	if (res != KSI_OK) raceAttempt(a);
+	KSI_Mutex_lock(race->pool->mutex);
+}
+
+/**
+ * Performs the next attempt of the request, sending the request also to the following endpoint if
+ * no response has arrived after the given delay and the budget allows it. The attempts that are
+ * still running when the result is known are left to finish in the background.
+ */
+static int raceAttempts(KSI_RequestHandle *handle, PoolRequest *pr, unsigned delay) {
+	int res;
+	KSI_PoolClient *pool = pr->pool;
+	PoolRace *race = NULL;
+	KSI_uint64_t deadline;
+	KSI_uint64_t now;
+
+	race = KSI_new(PoolRace);
+	if (race == NULL) {
+		KSI_pushError(handle->ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+	race->pool = pool;
+	race->svc = &pool->service[pr->service];
+	race->cond = NULL;
+	race->service = pr->service;
+	race->count = 0;
+	race->winner = -1;
+	race->rejected = -1;
+	race->next = NULL;
+
+	res = KSI_Cond_new(handle->ctx, &race->cond);
+	if (res != KSI_OK) {
+		KSI_pushError(handle->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	KSI_Mutex_lock(pool->mutex);
+
+	raceStart(handle->ctx, race, pr);
+
+	deadline = KSI_Counters_clock() + (KSI_uint64_t)delay * 1000;
+	while (!race->attempt[0].done && (now = KSI_Counters_clock()) < deadline) {
+		KSI_Cond_timedWait(race->cond, pool->mutex, (unsigned)((deadline - now + 999) / 1000));
+	}
+
+	if (!race->attempt[0].done && pool->hedgeTokens >= 1.0) {
+		pool->hedgeTokens -= 1.0;
+		pool->hedged++;
+		KSI_LOG_debug(handle->ctx, "Pool: no response from '%s' in %u ms, hedging the request.", race->attempt[0].ep->uri, delay);
+		raceStart(handle->ctx, race, pr);
+	}
+
+	while (race->winner < 0 && !raceFinished(race)) {
+		KSI_Cond_wait(race->cond, pool->mutex);
+	}
+
+	if (race->winner > 0) pool->hedgesWon++;
+
+	if (race->winner >= 0) {
+		res = adoptResponse(handle, race->attempt[race->winner].handle);
+	} else if (race->rejected >= 0) {
+		res = adoptResponse(handle, race->attempt[race->rejected].handle);
+	} else {
+		res = race->attempt[race->count - 1].res;
+	}
+
+	/* The losing attempt may still be running. */
+	if (!raceFinished(race)) {
+		race->next = pool->orphans;
+		pool->orphans = race;
+		race = NULL;
+	}
+
+	KSI_Mutex_unlock(pool->mutex);
+
+cleanup:
+
+	PoolRace_free(race);
+
+	return res;
+}
+
+/* Performs the remaining attempts one by one, until one of them succeeds. */
+static int readResponse(KSI_RequestHandle *handle) {
+	int res = KSI_NETWORK_ERROR;
+	PoolRequest *pr = NULL;
+	unsigned delay;
+
+	if (handle == NULL || handle->implCtx == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	pr = handle->implCtx;
+
+	while (pr->next < pr->count) {
+		KSI_RequestHandle *inner = pr->handle[pr->next];
+		PoolEndpoint *ep = requestEndpoint(pr, pr->next);
+		KSI_uint64_t start;
+		int outcome;
+
+		KSI_Mutex_lock(pr->pool->mutex);
+		delay = hedgeDelay(pr);
+		if (delay == 0 && !pr->dispatched) endpointDispatch(ep);
+		KSI_Mutex_unlock(pr->pool->mutex);
+
+		if (delay != 0) {
+			size_t attempt = pr->next;
+
+			res = raceAttempts(handle, pr, delay);
+			if (handle->completed) goto cleanup;
+			/* The race could not be started. */
+			if (pr->next == attempt) break;
+			continue;
+		}
+
+		start = KSI_Counters_clock();
+		res = inner->readResponse(inner);
+		outcome = attemptOutcome(inner, pr->service, &res);
+
+		KSI_Mutex_lock(pr->pool->mutex);
+		endpointResult(handle->ctx, pr->pool, &pr->pool->service[pr->service], ep, outcome, KSI_Counters_clock() - start);
+		KSI_Mutex_unlock(pr->pool->mutex);
+
+		pr->dispatched = 0;
+		pr->next++;
+
+		if (outcome != ATTEMPT_FAILED) {
+			KSI_ERR_clearErrors(handle->ctx);
+			res = adoptResponse(handle, inner);
+			goto cleanup;
+		}
+
+		if (res == KSI_OK) res = KSI_NETWORK_ERROR;
+		if (pr->next < pr->count) {
+			KSI_LOG_debug(handle->ctx, "Pool: request to '%s' failed, trying the next endpoint.", ep->uri);
+		}
+	}
+
+	KSI_pushError(handle->ctx, res, "None of the endpoints of the pool could serve the request.");
+
+cleanup:
+
+	return res;
+}
+
+static int sendRequest(KSI_NetworkClient *client, int service, void *req, KSI_RequestHandle **handle) {
+	int res;
+	KSI_PoolClient *pool = client->impl;
+	PoolRequest *pr = NULL;
+	KSI_RequestHandle *tmp = NULL;
+	size_t order[POOL_MAX_ATTEMPTS];
+	size_t len;
+	size_t i;
+
+	reapOrphans(pool, 0);
+
+	KSI_Mutex_lock(pool->mutex);
+	len = rankEndpoints(&pool->service[service], KSI_Counters_clock(), order, POOL_MAX_ATTEMPTS);
+	KSI_Mutex_unlock(pool->mutex);
+
+	if (len == 0) {
+		res = service == KSI_COUNTER_SERVICE_AGGREGATOR ? KSI_AGGREGATOR_NOT_CONFIGURED : KSI_EXTENDER_NOT_CONFIGURED;
+		goto cleanup;
+	}
+
+	pr = KSI_new(PoolRequest);
+	if (pr == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	pr->pool = pool;
+	pr->service = service;
+	pr->count = 0;
+	pr->next = 0;
+	pr->dispatched = 0;
+
+	/* Prepare the request for all the candidates, as it may be freed before it is performed. */
+	for (i = 0; i < len; i++) {
+		KSI_NetworkClient *epClient = pool->service[service].endpoint[order[i]].client;
+		KSI_RequestHandle *inner = NULL;
+
+		if (service == KSI_COUNTER_SERVICE_AGGREGATOR) {
+			res = KSI_NetworkClient_sendSignRequest(epClient, req, &inner);
+		} else {
+			res = KSI_NetworkClient_sendExtendRequest(epClient, req, &inner);
+		}
+		if (res != KSI_OK) {
+			KSI_LOG_debug(client->ctx, "Pool: unable to prepare the request for '%s'.", pool->service[service].endpoint[order[i]].uri);
+			continue;
+		}
+
+		pr->endpoint[pr->count] = order[i];
+		pr->handle[pr->count] = inner;
+		pr->count++;
+	}
+
+	if (pr->count == 0) goto cleanup;
+
+	res = KSI_RequestHandle_new(client->ctx, pr->handle[0]->request, pr->handle[0]->request_length, &tmp);
+	if (res != KSI_OK) goto cleanup;
+
+	tmp->readResponse = readResponse;
+	tmp->client = client;
+
+	res = KSI_RequestHandle_setImplContext(tmp, pr, (void (*)(void *))PoolRequest_free);
+	if (res != KSI_OK) goto cleanup;
+
+	KSI_Mutex_lock(pool->mutex);
+	endpointDispatch(requestEndpoint(pr, 0));
+	if (pool->hedgePercentile != 0) {
+		pool->hedgeTokens += pool->hedgeBudget / 100.0;
+		if (pool->hedgeTokens > POOL_HEDGE_BURST) pool->hedgeTokens = POOL_HEDGE_BURST;
+	}
+	KSI_Mutex_unlock(pool->mutex);
+	pr->dispatched = 1;
+	pr = NULL;
+
+	*handle = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	PoolRequest_free(pr);
+	KSI_RequestHandle_free(tmp);
+
+	return res;
+}
+
+static int prepareAggregationRequest(KSI_NetworkClient *client, KSI_AggregationReq *req, KSI_RequestHandle **handle) {
+	int res;
+	KSI_Integer *pReqId = NULL;
+	KSI_Integer *reqId = NULL;
+
+	if (client == NULL || req == NULL || handle == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	res = KSI_AggregationReq_getRequestId(req, &pReqId);
+	if (res != KSI_OK) goto cleanup;
+
+	/* All the endpoints get the request id of the pool. */
+	if (pReqId == NULL) {
+		res = KSI_Integer_new(client->ctx, KSI_Atomic_increment(&client->requestCount), &reqId);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_AggregationReq_setRequestId(req, reqId);
+		if (res != KSI_OK) goto cleanup;
+
+		reqId = NULL;
+	}
+
+	res = sendRequest(client, KSI_COUNTER_SERVICE_AGGREGATOR, req, handle);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_Integer_free(reqId);
+
+	return res;
+}
+
+static int prepareExtendRequest(KSI_NetworkClient *client, KSI_ExtendReq *req, KSI_RequestHandle **handle) {
+	int res;
+	KSI_Integer *pReqId = NULL;
+	KSI_Integer *reqId = NULL;
+
+	if (client == NULL || req == NULL || handle == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	res = KSI_ExtendReq_getRequestId(req, &pReqId);
+	if (res != KSI_OK) goto cleanup;
+
+	if (pReqId == NULL) {
+		res = KSI_Integer_new(client->ctx, KSI_Atomic_increment(&client->requestCount), &reqId);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_ExtendReq_setRequestId(req, reqId);
+		if (res != KSI_OK) goto cleanup;
+
+		reqId = NULL;
+	}
+
+	res = sendRequest(client, KSI_COUNTER_SERVICE_EXTENDER, req, handle);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_Integer_free(reqId);
+
+	return res;
+}
+
+static int sendPublicationRequest(KSI_NetworkClient *client, KSI_RequestHandle **handle) {
+	KSI_PoolClient *pool = client->impl;
+
+	if (pool->pubClient == NULL) return KSI_PUBLICATIONS_FILE_NOT_CONFIGURED;
+
+	return KSI_NetworkClient_sendPublicationsFileRequest(pool->pubClient, handle);
+}
+
+/**
+ * Performs the first attempts of the handles with the concurrent implementations of the endpoint
+ * transports, grouped by the transport. The failed requests are retried one by one.
+ */
+static int performAll(KSI_NetworkClient *client, KSI_RequestHandle **arr, size_t arr_len) {
+	int res;
+	KSI_RequestHandle **group = NULL;
+	size_t group_len;
+	size_t i;
+	size_t j;
+	KSI_uint64_t start;
+	KSI_uint64_t elapsed;
+
+	if (client == NULL || (arr == NULL && arr_len != 0)) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	group = KSI_calloc(arr_len + 1, sizeof(KSI_RequestHandle *));
+	if (group == NULL) {
+		KSI_pushError(client->ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+	for (i = 0; i < arr_len; i++) {
+		PoolRequest *pr = arr[i]->implCtx;
+		KSI_NetworkClient *transport;
+
+		if (arr[i]->readResponse != readResponse || arr[i]->completed || pr->next != 0 || pr->dispatched != 1) continue;
+
+		transport = pr->handle[0]->client;
+		if (!KSI_NetworkClient_isConcurrent(transport)) continue;
+
+		/* Collect the pending first attempts sharing the transport. */
+		group_len = 0;
+		for (j = i; j < arr_len; j++) {
+			PoolRequest *other = arr[j]->implCtx;
+			if (arr[j]->readResponse != readResponse || arr[j]->completed || other->next != 0 || other->dispatched != 1) continue;
+			if (other->handle[0]->client != transport) continue;
+			group[group_len++] = other->handle[0];
+			/* Marks the attempt as taken. */
+			other->dispatched = 2;
+		}
+
+		start = KSI_Counters_clock();
+		res = transport->performAll(transport, group, group_len);
+		elapsed = KSI_Counters_clock() - start;
+
+		for (j = i; j < arr_len; j++) {
+			PoolRequest *other = arr[j]->implCtx;
+			int attemptRes = res;
+			int outcome;
+
+			if (arr[j]->readResponse != readResponse || other->dispatched != 2) continue;
+
+			outcome = attemptOutcome(other->handle[0], other->service, &attemptRes);
+			KSI_Mutex_lock(other->pool->mutex);
+			endpointResult(client->ctx, other->pool, &other->pool->service[other->service], requestEndpoint(other, 0), outcome, elapsed);
+			KSI_Mutex_unlock(other->pool->mutex);
+			other->dispatched = 0;
+			other->next = 1;
+
+			if (outcome != ATTEMPT_FAILED) {
+				arr[j]->err.res = adoptResponse(arr[j], other->handle[0]);
+			}
+		}
+	}
+
+	/* The remaining attempts, including the ones of the sequential transports. */
+	for (i = 0; i < arr_len; i++) {
+		if (!arr[i]->completed) {
+			arr[i]->err.res = readResponse(arr[i]);
+		}
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_free(group);
+
+	return res;
+}
+
+static void endpointsFree(PoolService *svc) {
+	size_t i;
+
+	for (i = 0; i < svc->count; i++) {
+		KSI_NetworkClient_free(svc->endpoint[i].client);
+		KSI_free(svc->endpoint[i].uri);
+	}
+	svc->count = 0;
+}
+
+static void poolClient_free(KSI_PoolClient *pool) {
+	size_t i;
+
+	if (pool != NULL) {
+		/* The losing attempts use the endpoint clients. */
+		reapOrphans(pool, 1);
+		for (i = 0; i < POOL_SERVICE_COUNT; i++) {
+			endpointsFree(&pool->service[i]);
+		}
+		KSI_NetworkClient_free(pool->pubClient);
+		KSI_Mutex_free(pool->mutex);
+		KSI_free(pool);
+	}
+}
+
+int KSI_PoolClient_new(KSI_CTX *ctx, KSI_NetworkClient **client) {
+	int res;
+	KSI_NetworkClient *tmp = NULL;
+	KSI_PoolClient *pool = NULL;
+	size_t i;
+
+	KSI_ERR_clearErrors(ctx);
+
+	if (ctx == NULL || client == NULL) {
+		KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_AbstractNetworkClient_new(ctx, &tmp);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	pool = KSI_new(KSI_PoolClient);
+	if (pool == NULL) {
+		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+	for (i = 0; i < POOL_SERVICE_COUNT; i++) {
+		pool->service[i].count = 0;
+		pool->service[i].sample_count = 0;
+		pool->service[i].sample_next = 0;
+	}
+	pool->pubClient = NULL;
+	pool->maxFailures = 3;
+	pool->ejectSeconds = 10;
+	pool->transferTimeout = -1;
+	pool->connectTimeout = -1;
+	pool->hedgePercentile = 0;
+	pool->hedgeBudget = 0;
+	pool->hedgeTokens = 0;
+	pool->hedged = 0;
+	pool->hedgesWon = 0;
+	pool->orphans = NULL;
+	pool->mutex = NULL;
+
+	res = KSI_Mutex_new(ctx, &pool->mutex);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	tmp->sendSignRequest = prepareAggregationRequest;
+	tmp->sendExtendRequest = prepareExtendRequest;
+	tmp->sendPublicationRequest = sendPublicationRequest;
+	tmp->performAll = performAll;
+	tmp->requestCount = 0;
+
+	tmp->impl = pool;
+	tmp->implFree = (void (*)(void *))poolClient_free;
+	pool = NULL;
+
+	*client = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_NetworkClient_free(tmp);
+	poolClient_free(pool);
+
+	return res;
+}
+
+/* Checks that the client is a pool client. */
+static int getPool(KSI_NetworkClient *client, KSI_PoolClient **pool) {
+	if (client == NULL || client->impl == NULL || client->sendSignRequest != prepareAggregationRequest) return KSI_INVALID_ARGUMENT;
+	*pool = client->impl;
+	return KSI_OK;
+}
+
+static int applyTimeouts(KSI_PoolClient *pool, KSI_NetworkClient *epClient) {
+	int res = KSI_OK;
+
+	if (pool->transferTimeout >= 0) {
+		res = KSI_UriClient_setTransferTimeoutSeconds(epClient, pool->transferTimeout);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	if (pool->connectTimeout >= 0) {
+		res = KSI_UriClient_setConnectionTimeoutSeconds(epClient, pool->connectTimeout);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+cleanup:
+
+	return res;
+}
+
+static int addEndpoint(KSI_NetworkClient *client, int service, const char *uri, const char *loginId, const char *key,
+		int (*setService)(KSI_NetworkClient *, const char *, const char *, const char *)) {
+	int res;
+	KSI_PoolClient *pool = NULL;
+	PoolService *svc = NULL;
+	KSI_NetworkClient *tmp = NULL;
+	char *tmpUri = NULL;
+	PoolEndpoint *ep = NULL;
+
+	res = getPool(client, &pool);
+	if (res != KSI_OK || uri == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	KSI_ERR_clearErrors(client->ctx);
+
+	svc = &pool->service[service];
+	if (svc->count >= POOL_MAX_ENDPOINTS) {
+		KSI_pushError(client->ctx, res = KSI_BUFFER_OVERFLOW, "Too many endpoints in the pool.");
+		goto cleanup;
+	}
+
+	res = KSI_UriClient_new(client->ctx, &tmp);
+	if (res != KSI_OK) {
+		KSI_pushError(client->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = setService(tmp, uri, loginId, key);
+	if (res != KSI_OK) {
+		KSI_pushError(client->ctx, res, "Unable to configure the endpoint.");
+		goto cleanup;
+	}
+
+	res = applyTimeouts(pool, tmp);
+	if (res != KSI_OK) {
+		KSI_pushError(client->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_strdup(uri, &tmpUri);
+	if (res != KSI_OK) {
+		KSI_pushError(client->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	ep = &svc->endpoint[svc->count++];
+	ep->client = tmp;
+	ep->uri = tmpUri;
+	ep->latency = 0;
+	ep->errorRate = 0;
+	ep->inflight = 0;
+	ep->failures = 0;
+	ep->ejections = 0;
+	ep->ejectedUntil = 0;
+	ep->probing = 0;
+
+	tmp = NULL;
+	tmpUri = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_NetworkClient_free(tmp);
+	KSI_free(tmpUri);
+
+	return res;
+}
+
+int KSI_PoolClient_addAggregator(KSI_NetworkClient *client, const char *uri, const char *loginId, const char *key) {
+	return addEndpoint(client, KSI_COUNTER_SERVICE_AGGREGATOR, uri, loginId, key, KSI_UriClient_setAggregator);
+}
+
+int KSI_PoolClient_addExtender(KSI_NetworkClient *client, const char *uri, const char *loginId, const char *key) {
+	return addEndpoint(client, KSI_COUNTER_SERVICE_EXTENDER, uri, loginId, key, KSI_UriClient_setExtender);
+}
+
+int KSI_PoolClient_setPublicationUrl(KSI_NetworkClient *client, const char *val) {
+	int res;
+	KSI_PoolClient *pool = NULL;
+
+	res = getPool(client, &pool);
+	if (res != KSI_OK || val == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	if (pool->pubClient == NULL) {
+		res = KSI_UriClient_new(client->ctx, &pool->pubClient);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	res = KSI_UriClient_setPublicationUrl(pool->pubClient, val);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+int KSI_PoolClient_setMaxFailures(KSI_NetworkClient *client, unsigned count) {
+	int res;
+	KSI_PoolClient *pool = NULL;
+
+	res = getPool(client, &pool);
+	if (res != KSI_OK || count == 0) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	pool->maxFailures = count;
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+int KSI_PoolClient_setEjectSeconds(KSI_NetworkClient *client, unsigned seconds) {
+	int res;
+	KSI_PoolClient *pool = NULL;
+
+	res = getPool(client, &pool);
+	if (res != KSI_OK) goto cleanup;
+
+	pool->ejectSeconds = seconds;
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+static int setTimeout(KSI_NetworkClient *client, int timeout, int transfer) {
+	int res;
+	KSI_PoolClient *pool = NULL;
+	size_t i;
+	size_t j;
+
+	res = getPool(client, &pool);
+	if (res != KSI_OK || timeout < 0) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	if (transfer) {
+		pool->transferTimeout = timeout;
+	} else {
+		pool->connectTimeout = timeout;
+	}
+
+	for (i = 0; i < POOL_SERVICE_COUNT; i++) {
+		for (j = 0; j < pool->service[i].count; j++) {
+			res = applyTimeouts(pool, pool->service[i].endpoint[j].client);
+			if (res != KSI_OK) goto cleanup;
+		}
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+int KSI_PoolClient_setTransferTimeoutSeconds(KSI_NetworkClient *client, int timeout) {
+	return setTimeout(client, timeout, 1);
+}
+
+int KSI_PoolClient_setConnectionTimeoutSeconds(KSI_NetworkClient *client, int timeout) {
+	return setTimeout(client, timeout, 0);
+}
+
+int KSI_PoolClient_setHedging(KSI_NetworkClient *client, unsigned percentile, unsigned budget) {
+	int res;
+	KSI_PoolClient *pool = NULL;
+
+	res = getPool(client, &pool);
+	if (res != KSI_OK || percentile > 100 || budget > 100) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	KSI_ERR_clearErrors(client->ctx);
+
+	/* The attempts run in threads of their own, which need the per-thread state of a shared context. */
+	if (percentile != 0 && !client->ctx->flags[KSI_CTX_FLAG_SHARED]) {
+		KSI_pushError(client->ctx, res = KSI_INVALID_STATE, "Hedging needs a shared context.");
+		goto cleanup;
+	}
+
+	KSI_Mutex_lock(pool->mutex);
+	pool->hedgePercentile = percentile;
+	pool->hedgeBudget = budget;
+	pool->hedgeTokens = 0;
+	KSI_Mutex_unlock(pool->mutex);
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+int KSI_PoolClient_getHedgeStats(KSI_NetworkClient *client, size_t *hedged, size_t *won) {
+	int res;
+	KSI_PoolClient *pool = NULL;
+
+	res = getPool(client, &pool);
+	if (res != KSI_OK) goto cleanup;
+
+	KSI_Mutex_lock(pool->mutex);
+	if (hedged != NULL) *hedged = pool->hedged;
+	if (won != NULL) *won = pool->hedgesWon;
+	KSI_Mutex_unlock(pool->mutex);
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+int KSI_PoolClient_getEndpointStatus(KSI_NetworkClient *client, int service, size_t index, KSI_uint64_t *latency, double *errorRate, int *healthy) {
+	int res;
+	KSI_PoolClient *pool = NULL;
+	const PoolEndpoint *ep = NULL;
+
+	res = getPool(client, &pool);
+	if (res != KSI_OK || service < 0 || service >= POOL_SERVICE_COUNT || index >= pool->service[service].count) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	ep = &pool->service[service].endpoint[index];
+
+	KSI_Mutex_lock(pool->mutex);
+	if (latency != NULL) *latency = (KSI_uint64_t)ep->latency;
+	if (errorRate != NULL) *errorRate = ep->errorRate;
+	if (healthy != NULL) *healthy = ep->ejectedUntil == 0;
+	KSI_Mutex_unlock(pool->mutex);
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2013-2016 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+
+#ifndef KSI_NET_POOL_H_
+#define KSI_NET_POOL_H_
+
+#include "net.h"
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * Network client spreading the requests over several aggregators and extenders. Every
+	 * request is routed to the endpoint of the service with the best score, which is computed
+	 * from the moving averages of the response time and the error rate and from the number of
+	 * requests the endpoint is already serving. When the request fails with a network error or
+	 * a service error, it is retried on the next best endpoint. Only the requests the service
+	 * finds invalid (#KSI_SERVICE_INVALID_REQUEST, #KSI_SERVICE_INVALID_PAYLOAD and the time range
+	 * errors of the extender) are not retried.
+	 *
+	 * An endpoint failing several requests in a row is ejected from the pool for a while. After
+	 * that, a single request is used to probe it: on success the endpoint rejoins the pool,
+	 * otherwise it is ejected again for twice as long, up to eight times the initial period.
+	 *
+	 * Optionally, a request still waiting for the response after a percentile of the recent
+	 * response times is sent to the next best endpoint as well and the first successful response
+	 * is used, see #KSI_PoolClient_setHedging.
+	 */
+	typedef struct KSI_PoolClient_st KSI_PoolClient;
+
+	/**
+	 * Creates a new pool client without endpoints.
+	 * \param[in]	ctx			KSI context.
+	 * \param[out]	client		Pointer to the receiving pointer.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_PoolClient_new(KSI_CTX *ctx, KSI_NetworkClient **client);
+
+	/**
+	 * Adds an aggregator to the pool. The URI may have any scheme supported by #KSI_UriClient_setAggregator.
+	 * \param[in]	client		Pool client.
+	 * \param[in]	uri			Aggregator URI.
+	 * \param[in]	loginId		Login id of the aggregator, \c NULL to take it from the URI.
+	 * \param[in]	key			HMAC key of the aggregator, \c NULL to take it from the URI.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_PoolClient_addAggregator(KSI_NetworkClient *client, const char *uri, const char *loginId, const char *key);
+
+	/**
+	 * Adds an extender to the pool.
+	 * \see #KSI_PoolClient_addAggregator
+	 */
+	int KSI_PoolClient_addExtender(KSI_NetworkClient *client, const char *uri, const char *loginId, const char *key);
+
+	/**
+	 * Setter for the publications file URL.
+	 * \param[in]	client		Pool client.
+	 * \param[in]	val			Publications file URL.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_PoolClient_setPublicationUrl(KSI_NetworkClient *client, const char *val);
+
+	/**
+	 * Sets the number of consecutive failed requests after which an endpoint is ejected.
+	 * \param[in]	client		Pool client.
+	 * \param[in]	count		Number of failures, the default is 3.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_PoolClient_setMaxFailures(KSI_NetworkClient *client, unsigned count);
+
+	/**
+	 * Sets the time an endpoint is ejected for the first time before it is probed again.
+	 * \param[in]	client		Pool client.
+	 * \param[in]	seconds		Ejection time in seconds, the default is 10.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_PoolClient_setEjectSeconds(KSI_NetworkClient *client, unsigned seconds);
+
+	/**
+	 * Sets the transfer timeout of all the current and future endpoints.
+	 * \see #KSI_UriClient_setTransferTimeoutSeconds
+	 */
+	int KSI_PoolClient_setTransferTimeoutSeconds(KSI_NetworkClient *client, int timeout);
+
+	/**
+	 * Sets the connection timeout of all the current and future endpoints.
+	 * \see #KSI_UriClient_setConnectionTimeoutSeconds
+	 */
+	int KSI_PoolClient_setConnectionTimeoutSeconds(KSI_NetworkClient *client, int timeout);
+
+	/**
+	 * Enables hedged requests. When no response has arrived within the given percentile of the
+	 * recent response times of the service, the request is also sent to the next best endpoint
+	 * and the first successful response is used. The other attempt is left to finish in the
+	 * background. Hedging applies to the requests performed one at a time, as by
+	 * #KSI_RequestHandle_perform, and needs at least two endpoints of the service. A response
+	 * wins only when it parses and its HMAC matches the key of the endpoint that sent it.
+	 *
+	 * As the attempts are performed in threads of their own, hedging can only be enabled when
+	 * the context of the client is shared, see #KSI_CTX_FLAG_SHARED; otherwise #KSI_INVALID_STATE
+	 * is returned.
+	 * \param[in]	client		Pool client.
+	 * \param[in]	percentile	Percentile of the response times, 0 to disable hedging (the default).
+	 * \param[in]	budget		Maximum number of hedged requests per 100 requests.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_PoolClient_setHedging(KSI_NetworkClient *client, unsigned percentile, unsigned budget);
+
+	/**
+	 * Returns the hedging statistics of the pool.
+	 * \param[in]	client		Pool client.
+	 * \param[out]	hedged		Number of the hedged requests; may be \c NULL.
+	 * \param[out]	won			Number of the hedged requests answered first by the second endpoint; may be \c NULL.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_PoolClient_getHedgeStats(KSI_NetworkClient *client, size_t *hedged, size_t *won);
+
+	/**
+	 * Returns the state of an endpoint of the pool.
+	 * \param[in]	client		Pool client.
+	 * \param[in]	service		#KSI_COUNTER_SERVICE_AGGREGATOR or #KSI_COUNTER_SERVICE_EXTENDER.
+	 * \param[in]	index		Index of the endpoint in the order the endpoints were added.
+	 * \param[out]	latency		Moving average of the response time in microseconds, 0 if not measured; may be \c NULL.
+	 * \param[out]	errorRate	Moving average of the share of failed requests; may be \c NULL.
+	 * \param[out]	healthy		0 if the endpoint is ejected; may be \c NULL.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_PoolClient_getEndpointStatus(KSI_NetworkClient *client, int service, size_t index, KSI_uint64_t *latency, double *errorRate, int *healthy);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KSI_NET_POOL_H_ */
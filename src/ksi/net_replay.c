@@ -0,0 +1,848 @@
+/*
+ * Copyright 2013-2016 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "internal.h"
+#include "net_impl.h"
+#include "net_replay.h"
+#include "counters.h"
+#include "fast_tlv.h"
+#include "thread.h"
+
+/*
+ * The log starts with a magic value followed by the records. Every record consists of
+ * a header with the service id (1 byte), the time the request took in microseconds, the
+ * length of the request and the length of the response (4 bytes each, big-endian),
+ * followed by the request and the response PDUs.
+ */
+#define REPLAY_MAGIC "KSINETR1"
+#define REPLAY_MAGIC_LEN 8
+#define REPLAY_RECORD_HDR_LEN 13
+
+struct KSI_NetRecorder_st {
+	KSI_CTX *ctx;
+	FILE *file;
+	KSI_Mutex *lock;
+};
+
+typedef struct ReplayEntry_st {
+	int service;
+	/** Content of the request without the parts differing between the sessions. */
+	unsigned char *key;
+	size_t key_len;
+	/** Time the request took in microseconds. */
+	KSI_uint64_t latency;
+	const unsigned char *response;
+	size_t response_len;
+	/** Position in the log. */
+	size_t seq;
+	/** Number of responses served, only kept in the first entry of equal requests. */
+	size_t turn;
+} ReplayEntry;
+
+typedef struct ReplayClient_st {
+	/** Contents of the log, the entries point into it. */
+	unsigned char *data;
+	ReplayEntry *entries;
+	size_t entries_len;
+	double speed;
+} ReplayClient;
+
+static void writeUint32(unsigned char *buf, KSI_uint64_t val) {
+	if (val > 0xffffffff) val = 0xffffffff;
+	buf[0] = (unsigned char)(val >> 24);
+	buf[1] = (unsigned char)(val >> 16);
+	buf[2] = (unsigned char)(val >> 8);
+	buf[3] = (unsigned char)val;
+}
+
+static size_t readUint32(const unsigned char *buf) {
+	return ((size_t)buf[0] << 24) | ((size_t)buf[1] << 16) | ((size_t)buf[2] << 8) | (size_t)buf[3];
+}
+
+int KSI_NetRecorder_new(KSI_CTX *ctx, const char *path, KSI_NetRecorder **rec) {
+	int res;
+	KSI_NetRecorder *tmp = NULL;
+
+	KSI_ERR_clearErrors(ctx);
+	if (ctx == NULL || path == NULL || rec == NULL) {
+		KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
+		goto cleanup;
+	}
+
+	tmp = KSI_new(KSI_NetRecorder);
+	if (tmp == NULL) {
+		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+	tmp->ctx = ctx;
+	tmp->file = NULL;
+	tmp->lock = NULL;
+
+	res = KSI_Mutex_new(ctx, &tmp->lock);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	tmp->file = fopen(path, "wb");
+	if (tmp->file == NULL) {
+		KSI_pushError(ctx, res = KSI_IO_ERROR, "Unable to open the network log for writing.");
+		goto cleanup;
+	}
+
+	if (fwrite(REPLAY_MAGIC, 1, REPLAY_MAGIC_LEN, tmp->file) != REPLAY_MAGIC_LEN) {
+		KSI_pushError(ctx, res = KSI_IO_ERROR, "Unable to write the network log.");
+		goto cleanup;
+	}
+
+	*rec = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_NetRecorder_free(tmp);
+
+	return res;
+}
+
+void KSI_NetRecorder_free(KSI_NetRecorder *rec) {
+	if (rec != NULL) {
+		if (rec->file != NULL) fclose(rec->file);
+		KSI_Mutex_free(rec->lock);
+		KSI_free(rec);
+	}
+}
+
+int KSI_NetRecorder_add(KSI_NetRecorder *rec, const KSI_RequestHandle *handle, KSI_uint64_t latency) {
+	int res;
+	unsigned char hdr[REPLAY_RECORD_HDR_LEN];
+	int ok;
+
+	if (rec == NULL || handle == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	/* Only the requests of the known services can be replayed. */
+	if (handle->service < 0 || handle->service >= KSI_NUMBER_OF_COUNTER_SERVICES || handle->response == NULL) {
+		res = KSI_OK;
+		goto cleanup;
+	}
+
+	if (handle->request_length > 0xffffffff || handle->response_length > 0xffffffff) {
+		KSI_pushError(handle->ctx, res = KSI_INVALID_ARGUMENT, "PDU too large for the network log.");
+		goto cleanup;
+	}
+
+	hdr[0] = (unsigned char)handle->service;
+	writeUint32(hdr + 1, latency);
+	writeUint32(hdr + 5, handle->request_length);
+	writeUint32(hdr + 9, handle->response_length);
+
+	/* The record is written as a whole, as the recorder may be shared between threads. */
+	KSI_Mutex_lock(rec->lock);
+	ok = fwrite(hdr, 1, sizeof(hdr), rec->file) == sizeof(hdr) &&
+			(handle->request_length == 0 || fwrite(handle->request, 1, handle->request_length, rec->file) == handle->request_length) &&
+			fwrite(handle->response, 1, handle->response_length, rec->file) == handle->response_length;
+	KSI_Mutex_unlock(rec->lock);
+
+	if (!ok) {
+		KSI_pushError(handle->ctx, res = KSI_IO_ERROR, "Unable to write the network log.");
+		goto cleanup;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+int KSI_NetworkClient_setRecorder(KSI_NetworkClient *client, KSI_NetRecorder *rec) {
+	if (client == NULL) return KSI_INVALID_ARGUMENT;
+	client->recorder = rec;
+	return KSI_OK;
+}
+
+/**
+ * Extracts the content of the request PDU the response depends on: the PDU tag and the
+ * elements of the request payload except the request id. The header and the HMAC are
+ * left out, as they differ between the sessions.
+ */
+static int requestKey(int service, const unsigned char *raw, size_t raw_len, unsigned char **key, size_t *key_len) {
+	int res;
+	unsigned char *tmp = NULL;
+	size_t len = 0;
+	KSI_FTLV pdu;
+	KSI_FTLV payload;
+	KSI_FTLV elem;
+	size_t pos;
+	size_t end;
+	size_t epos;
+	size_t eend;
+
+	tmp = KSI_malloc(raw_len + 3);
+	if (tmp == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	tmp[len++] = (unsigned char)service;
+
+	if (raw != NULL && raw_len > 0) {
+		res = KSI_FTLV_memRead(raw, raw_len, &pdu);
+		if (res != KSI_OK) goto cleanup;
+
+		tmp[len++] = (unsigned char)(pdu.tag >> 8);
+		tmp[len++] = (unsigned char)pdu.tag;
+
+		pos = pdu.hdr_len;
+		end = pdu.hdr_len + pdu.dat_len;
+		while (pos < end) {
+			res = KSI_FTLV_memRead(raw + pos, end - pos, &payload);
+			if (res != KSI_OK) goto cleanup;
+
+			if (payload.tag != 0x01 && payload.tag != 0x1f) {
+				tmp[len++] = (unsigned char)(payload.tag >> 8);
+				tmp[len++] = (unsigned char)payload.tag;
+
+				epos = pos + payload.hdr_len;
+				eend = epos + payload.dat_len;
+				while (epos < eend) {
+					res = KSI_FTLV_memRead(raw + epos, eend - epos, &elem);
+					if (res != KSI_OK) goto cleanup;
+
+					if (elem.tag != 0x01) {
+						memcpy(tmp + len, raw + epos, elem.hdr_len + elem.dat_len);
+						len += elem.hdr_len + elem.dat_len;
+					}
+					epos += elem.hdr_len + elem.dat_len;
+				}
+			}
+			pos += payload.hdr_len + payload.dat_len;
+		}
+	}
+
+	*key = tmp;
+	*key_len = len;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_free(tmp);
+
+	return res;
+}
+
+static int compareKey(const ReplayEntry *a, const unsigned char *key, size_t key_len) {
+	if (a->key_len != key_len) return a->key_len < key_len ? -1 : 1;
+	return memcmp(a->key, key, key_len);
+}
+
+static int compareEntries(const void *a, const void *b) {
+	const ReplayEntry *x = a;
+	const ReplayEntry *y = b;
+	int c = compareKey(x, y->key, y->key_len);
+
+	if (c != 0) return c;
+	return x->seq < y->seq ? -1 : (x->seq > y->seq ? 1 : 0);
+}
+
+/* Returns the position of the first entry not less than the key, or greater than the key if \c upper is set. */
+static size_t findBound(const ReplayClient *replay, const unsigned char *key, size_t key_len, int upper) {
+	size_t lo = 0;
+	size_t hi = replay->entries_len;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int c = compareKey(&replay->entries[mid], key, key_len);
+
+		if (c < 0 || (upper && c == 0)) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+static void ReplayClient_free(ReplayClient *replay) {
+	size_t i;
+
+	if (replay != NULL) {
+		if (replay->entries != NULL) {
+			for (i = 0; i < replay->entries_len; i++) {
+				KSI_free(replay->entries[i].key);
+			}
+			KSI_free(replay->entries);
+		}
+		KSI_free(replay->data);
+		KSI_free(replay);
+	}
+}
+
+static int readLog(KSI_CTX *ctx, const char *path, unsigned char **data, size_t *data_len) {
+	int res;
+	FILE *f = NULL;
+	long size;
+	unsigned char *tmp = NULL;
+
+	f = fopen(path, "rb");
+	if (f == NULL) {
+		KSI_pushError(ctx, res = KSI_IO_ERROR, "Unable to open the network log.");
+		goto cleanup;
+	}
+
+	if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0) {
+		KSI_pushError(ctx, res = KSI_IO_ERROR, "Unable to read the network log.");
+		goto cleanup;
+	}
+
+	tmp = KSI_malloc((size_t)size + 1);
+	if (tmp == NULL) {
+		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+	if (fread(tmp, 1, (size_t)size, f) != (size_t)size) {
+		KSI_pushError(ctx, res = KSI_IO_ERROR, "Unable to read the network log.");
+		goto cleanup;
+	}
+
+	*data = tmp;
+	*data_len = (size_t)size;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	if (f != NULL) fclose(f);
+	KSI_free(tmp);
+
+	return res;
+}
+
+/* Reads the log and indexes the records by the content of the requests. */
+static int ReplayClient_load(KSI_CTX *ctx, const char *path, ReplayClient *replay) {
+	int res;
+	size_t data_len = 0;
+	size_t pos;
+	size_t count = 0;
+	size_t req_len;
+	size_t resp_len;
+	ReplayEntry *e = NULL;
+
+	res = readLog(ctx, path, &replay->data, &data_len);
+	if (res != KSI_OK) goto cleanup;
+
+	if (data_len < REPLAY_MAGIC_LEN || memcmp(replay->data, REPLAY_MAGIC, REPLAY_MAGIC_LEN) != 0) {
+		KSI_pushError(ctx, res = KSI_INVALID_FORMAT, "Not a network log.");
+		goto cleanup;
+	}
+
+	/* Validate the records and count them. */
+	for (pos = REPLAY_MAGIC_LEN; pos < data_len; count++) {
+		if (data_len - pos < REPLAY_RECORD_HDR_LEN) {
+			KSI_pushError(ctx, res = KSI_INVALID_FORMAT, "Truncated network log.");
+			goto cleanup;
+		}
+
+		req_len = readUint32(replay->data + pos + 5);
+		resp_len = readUint32(replay->data + pos + 9);
+		pos += REPLAY_RECORD_HDR_LEN;
+
+		if (replay->data[pos - REPLAY_RECORD_HDR_LEN] >= KSI_NUMBER_OF_COUNTER_SERVICES || data_len - pos < req_len || data_len - pos - req_len < resp_len) {
+			KSI_pushError(ctx, res = KSI_INVALID_FORMAT, "Truncated network log.");
+			goto cleanup;
+		}
+		pos += req_len + resp_len;
+	}
+
+	if (count > 0) {
+		replay->entries = KSI_calloc(count, sizeof(ReplayEntry));
+		if (replay->entries == NULL) {
+			KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
+			goto cleanup;
+		}
+	}
+
+	for (pos = REPLAY_MAGIC_LEN; pos < data_len; replay->entries_len++) {
+		e = &replay->entries[replay->entries_len];
+
+		e->service = replay->data[pos];
+		e->latency = readUint32(replay->data + pos + 1);
+		req_len = readUint32(replay->data + pos + 5);
+		e->response_len = readUint32(replay->data + pos + 9);
+		e->seq = replay->entries_len;
+		e->turn = 0;
+		pos += REPLAY_RECORD_HDR_LEN;
+
+		res = requestKey(e->service, replay->data + pos, req_len, &e->key, &e->key_len);
+		if (res != KSI_OK) {
+			KSI_pushError(ctx, res, "Malformed request in the network log.");
+			goto cleanup;
+		}
+
+		e->response = replay->data + pos + req_len;
+		pos += req_len + e->response_len;
+	}
+
+	if (replay->entries_len > 1) {
+		qsort(replay->entries, replay->entries_len, sizeof(ReplayEntry), compareEntries);
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+/* Writes a TLV header with the flags of the original first header byte \c first. */
+static size_t writeHeader(unsigned char *buf, unsigned char first, unsigned tag, size_t len) {
+	unsigned char flags = first & (KSI_TLV_MASK_LENIENT | KSI_TLV_MASK_FORWARD);
+
+	if (tag <= KSI_TLV_MASK_TLV8_TYPE && len <= 0xff) {
+		buf[0] = (unsigned char)(flags | tag);
+		buf[1] = (unsigned char)len;
+		return 2;
+	}
+
+	buf[0] = (unsigned char)(KSI_TLV_MASK_TLV16 | flags | ((tag >> 8) & KSI_TLV_MASK_TLV8_TYPE));
+	buf[1] = (unsigned char)tag;
+	buf[2] = (unsigned char)(len >> 8);
+	buf[3] = (unsigned char)len;
+	return 4;
+}
+
+/**
+ * Gives the recorded response the request id of the new request and authenticates it again
+ * with the key of \c endpoint. The bytes are patched rather than serialized again, so the
+ * response keeps the element order it was recorded with. Responses without a request id or
+ * an HMAC, such as error responses, are not modified and \c raw is set to \c NULL.
+ */
+static int rewriteResponse(KSI_RequestHandle *handle, KSI_NetEndpoint *endpoint, const ReplayEntry *e, unsigned char **raw, size_t *raw_len) {
+	int res;
+	KSI_FTLV pdu;
+	KSI_FTLV payload;
+	KSI_FTLV elem;
+	size_t pos;
+	size_t end;
+	size_t payload_off = 0;
+	size_t id_off = 0;
+	size_t id_len = 0;
+	size_t hmac_off = 0;
+	unsigned payload_tag;
+	int version;
+	unsigned char id[10];
+	size_t id_tlv_len = 0;
+	KSI_uint64_t val;
+	unsigned char tmpId[8];
+	size_t tmpId_len = 0;
+	unsigned char *tmp = NULL;
+	size_t len = 0;
+	size_t payload_len;
+	size_t pdu_len;
+	KSI_HmacHasher *hasher = NULL;
+
+	*raw = NULL;
+	*raw_len = 0;
+
+	res = KSI_FTLV_memRead(e->response, e->response_len, &pdu);
+	if (res != KSI_OK) goto cleanup;
+
+	if (pdu.tag == 0x221 || pdu.tag == 0x321) {
+		version = KSI_PDU_VERSION_2;
+		payload_tag = 0x02;
+	} else {
+		version = KSI_PDU_VERSION_1;
+		payload_tag = pdu.tag + 0x02;
+	}
+
+	/* Locate the response payload, its request id and the trailing HMAC. */
+	pos = pdu.hdr_len;
+	end = pdu.hdr_len + pdu.dat_len;
+	while (pos < end) {
+		res = KSI_FTLV_memRead(e->response + pos, end - pos, &payload);
+		if (res != KSI_OK) goto cleanup;
+
+		if (payload.tag == payload_tag && payload_off == 0) {
+			size_t epos = pos + payload.hdr_len;
+			size_t eend = epos + payload.dat_len;
+
+			payload_off = pos;
+			while (epos < eend) {
+				res = KSI_FTLV_memRead(e->response + epos, eend - epos, &elem);
+				if (res != KSI_OK) goto cleanup;
+
+				if (elem.tag == 0x01 && id_len == 0) {
+					id_off = epos;
+					id_len = elem.hdr_len + elem.dat_len;
+				}
+				epos += elem.hdr_len + elem.dat_len;
+			}
+		} else if (payload.tag == 0x1f) {
+			hmac_off = pos;
+		}
+		pos += payload.hdr_len + payload.dat_len;
+	}
+
+	if (payload_off == 0 || id_len == 0 || hmac_off == 0 || e->response_len - hmac_off < 3) {
+		res = KSI_OK;
+		goto cleanup;
+	}
+
+	res = KSI_FTLV_memRead(e->response + payload_off, e->response_len - payload_off, &payload);
+	if (res != KSI_OK) goto cleanup;
+
+	/* Encode the new request id the way integers are serialized. */
+	val = handle->requestId;
+	while (val != 0) {
+		tmpId[7 - tmpId_len++] = (unsigned char)(val & 0xff);
+		val >>= 8;
+	}
+	id_tlv_len = writeHeader(id, e->response[id_off], 0x01, tmpId_len);
+	memcpy(id + id_tlv_len, tmpId + 8 - tmpId_len, tmpId_len);
+	id_tlv_len += tmpId_len;
+
+	payload_len = payload.dat_len - id_len + id_tlv_len;
+	pdu_len = pdu.dat_len - payload.dat_len + payload_len;
+	if (payload_len > 0xffff || pdu_len > 0xffff) {
+		res = KSI_INVALID_FORMAT;
+		goto cleanup;
+	}
+
+	/* The headers may grow by two bytes each. */
+	tmp = KSI_malloc(e->response_len + id_tlv_len + 4);
+	if (tmp == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	len = writeHeader(tmp, e->response[0], pdu.tag, pdu_len);
+	memcpy(tmp + len, e->response + pdu.hdr_len, payload_off - pdu.hdr_len);
+	len += payload_off - pdu.hdr_len;
+	len += writeHeader(tmp + len, e->response[payload_off], payload.tag, payload_len);
+	memcpy(tmp + len, e->response + payload_off + payload.hdr_len, id_off - payload_off - payload.hdr_len);
+	len += id_off - payload_off - payload.hdr_len;
+	memcpy(tmp + len, id, id_tlv_len);
+	len += id_tlv_len;
+	memcpy(tmp + len, e->response + id_off + id_len, e->response_len - id_off - id_len);
+	len += e->response_len - id_off - id_len;
+
+	/* The algorithm id follows the header of the HMAC element. */
+	res = KSI_NetEndpoint_getHmacHasher(endpoint, (KSI_HashAlgorithm)e->response[hmac_off + 2], &hasher);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Pdu_updateSerializedHmac(handle->ctx, version, (KSI_HashAlgorithm)e->response[hmac_off + 2], hasher, tmp, len);
+	if (res != KSI_OK) goto cleanup;
+
+	*raw = tmp;
+	*raw_len = len;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_HmacHasher_free(hasher);
+	KSI_free(tmp);
+
+	return res;
+}
+
+static int readResponse(KSI_RequestHandle *handle) {
+	int res;
+	ReplayClient *replay = NULL;
+	unsigned char *key = NULL;
+	size_t key_len = 0;
+	size_t first;
+	size_t last;
+	ReplayEntry *e = NULL;
+	unsigned char *raw = NULL;
+	size_t raw_len = 0;
+
+	if (handle == NULL || handle->client == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	KSI_ERR_clearErrors(handle->ctx);
+
+	replay = handle->client->impl;
+
+	res = requestKey(handle->service, handle->request, handle->request_length, &key, &key_len);
+	if (res != KSI_OK) {
+		KSI_pushError(handle->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	first = findBound(replay, key, key_len, 0);
+	last = findBound(replay, key, key_len, 1);
+	if (first == last) {
+		KSI_pushError(handle->ctx, res = KSI_NETWORK_ERROR, "No recorded response matches the request.");
+		goto cleanup;
+	}
+
+	/* Equal requests are answered with their recorded responses in turn. */
+	e = &replay->entries[first + replay->entries[first].turn++ % (last - first)];
+
+	if (replay->speed > 0) {
+		double delay = (double)e->latency / 1000.0 / replay->speed;
+		if (delay >= 1.0) KSI_Thread_sleep((unsigned)delay);
+	}
+
+	res = KSI_OK;
+	if (handle->service == KSI_COUNTER_SERVICE_AGGREGATOR) {
+		res = rewriteResponse(handle, handle->client->aggregator, e, &raw, &raw_len);
+	} else if (handle->service == KSI_COUNTER_SERVICE_EXTENDER) {
+		res = rewriteResponse(handle, handle->client->extender, e, &raw, &raw_len);
+	}
+	if (res != KSI_OK) {
+		KSI_pushError(handle->ctx, res, "Unable to replay the recorded response.");
+		goto cleanup;
+	}
+
+	if (raw != NULL) {
+		res = KSI_RequestHandle_setResponse(handle, raw, raw_len);
+	} else {
+		res = KSI_RequestHandle_setResponse(handle, e->response, e->response_len);
+	}
+	if (res != KSI_OK) {
+		KSI_pushError(handle->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_free(raw);
+	KSI_free(key);
+
+	return res;
+}
+
+static int prepareRequest(KSI_NetworkClient *client,
+						  KSI_NetEndpoint *endpoint,
+						  void *req,
+						  int (*serialize)(KSI_NetEndpoint *, void *, unsigned char **, size_t *),
+						  KSI_RequestHandle **handle,
+						  const char *desc) {
+	int res;
+	KSI_RequestHandle *tmp = NULL;
+	unsigned char *raw = NULL;
+	size_t raw_len = 0;
+
+	KSI_ERR_clearErrors(client->ctx);
+
+	KSI_LOG_debug(client->ctx, "Replay: %s", desc);
+
+	if (req != NULL) {
+		res = serialize(endpoint, req, &raw, &raw_len);
+		if (res != KSI_OK) {
+			KSI_pushError(client->ctx, res, NULL);
+			goto cleanup;
+		}
+		KSI_LOG_logBlob(client->ctx, KSI_LOG_DEBUG, desc, raw, raw_len);
+	}
+
+	res = KSI_RequestHandle_new(client->ctx, raw, raw_len, &tmp);
+	if (res != KSI_OK) {
+		KSI_pushError(client->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	tmp->readResponse = readResponse;
+	tmp->client = client;
+
+	*handle = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_RequestHandle_free(tmp);
+	KSI_free(raw);
+
+	return res;
+}
+
+static int prepareExtendRequest(KSI_NetworkClient *client, KSI_ExtendReq *req, KSI_RequestHandle **handle) {
+	int res;
+	KSI_Integer *pReqId = NULL;
+	KSI_Integer *reqId = NULL;
+
+	if (client == NULL || req == NULL || handle == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	res = KSI_ExtendReq_getRequestId(req, &pReqId);
+	if (res != KSI_OK) goto cleanup;
+
+	if (pReqId == NULL) {
+		res = KSI_Integer_new(client->ctx, KSI_Atomic_increment(&client->requestCount), &reqId);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_ExtendReq_setRequestId(req, reqId);
+		if (res != KSI_OK) goto cleanup;
+
+		reqId = NULL;
+	}
+
+	res = prepareRequest(
+			  client,
+			  client->extender,
+			  req,
+			  (int (*)(KSI_NetEndpoint *, void *, unsigned char **, size_t *))KSI_NetEndpoint_serializeExtendReq,
+			  handle,
+			  "Extend request");
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_Integer_free(reqId);
+
+	return res;
+}
+
+static int prepareAggregationRequest(KSI_NetworkClient *client, KSI_AggregationReq *req, KSI_RequestHandle **handle) {
+	int res;
+	KSI_Integer *pReqId = NULL;
+	KSI_Integer *reqId = NULL;
+
+	if (client == NULL || req == NULL || handle == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	res = KSI_AggregationReq_getRequestId(req, &pReqId);
+	if (res != KSI_OK) goto cleanup;
+
+	if (pReqId == NULL) {
+		res = KSI_Integer_new(client->ctx, KSI_Atomic_increment(&client->requestCount), &reqId);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_AggregationReq_setRequestId(req, reqId);
+		if (res != KSI_OK) goto cleanup;
+
+		reqId = NULL;
+	}
+
+	res = prepareRequest(
+			  client,
+			  client->aggregator,
+			  req,
+			  (int (*)(KSI_NetEndpoint *, void *, unsigned char **, size_t *))KSI_NetEndpoint_serializeAggregationReq,
+			  handle,
+			  "Aggregation request");
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_Integer_free(reqId);
+
+	return res;
+}
+
+static int preparePublicationRequest(KSI_NetworkClient *client, KSI_RequestHandle **handle) {
+	if (client == NULL || handle == NULL) return KSI_INVALID_ARGUMENT;
+	return prepareRequest(client, client->publicationsFile, NULL, NULL, handle, "Publications file request");
+}
+
+int KSI_ReplayClient_new(KSI_CTX *ctx, const char *path, KSI_NetworkClient **client) {
+	int res;
+	KSI_NetworkClient *tmp = NULL;
+	ReplayClient *replay = NULL;
+
+	KSI_ERR_clearErrors(ctx);
+
+	if (ctx == NULL || path == NULL || client == NULL) {
+		KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_AbstractNetworkClient_new(ctx, &tmp);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	replay = KSI_new(ReplayClient);
+	if (replay == NULL) {
+		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+	replay->data = NULL;
+	replay->entries = NULL;
+	replay->entries_len = 0;
+	replay->speed = 0;
+
+	res = ReplayClient_load(ctx, path, replay);
+	if (res != KSI_OK) goto cleanup;
+
+	tmp->sendExtendRequest = prepareExtendRequest;
+	tmp->sendSignRequest = prepareAggregationRequest;
+	tmp->sendPublicationRequest = preparePublicationRequest;
+
+	tmp->impl = replay;
+	tmp->implFree = (void (*)(void *))ReplayClient_free;
+	replay = NULL;
+
+	*client = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	ReplayClient_free(replay);
+	KSI_NetworkClient_free(tmp);
+
+	return res;
+}
+
+int KSI_ReplayClient_setSpeed(KSI_NetworkClient *client, double speed) {
+	if (client == NULL || client->sendSignRequest != prepareAggregationRequest || speed < 0) return KSI_INVALID_ARGUMENT;
+	((ReplayClient *)client->impl)->speed = speed;
+	return KSI_OK;
+}
+
+int KSI_ReplayClient_getCount(KSI_NetworkClient *client, size_t *count) {
+	if (client == NULL || client->sendSignRequest != prepareAggregationRequest || count == NULL) return KSI_INVALID_ARGUMENT;
+	*count = ((ReplayClient *)client->impl)->entries_len;
+	return KSI_OK;
+}
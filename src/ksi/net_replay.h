@@ -0,0 +1,102 @@
+/*
+ * Copyright 2013-2016 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+
+#ifndef KSI_NET_REPLAY_H_
+#define KSI_NET_REPLAY_H_
+
+#include "net.h"
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * Recorder of the request and response PDU pairs of network clients. Every
+	 * completed request is appended to the log file together with the time it took,
+	 * so the session can later be served offline by a client created with #KSI_ReplayClient_new.
+	 */
+	typedef struct KSI_NetRecorder_st KSI_NetRecorder;
+
+	/**
+	 * Creates a new recorder writing to the given file. An existing file is truncated.
+	 * \param[in]	ctx			KSI context.
+	 * \param[in]	path		Path to the log file.
+	 * \param[out]	rec			Pointer to the receiving pointer.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 * \note The recorder may be shared by the network clients of several contexts, also
+	 * from different threads.
+	 */
+	int KSI_NetRecorder_new(KSI_CTX *ctx, const char *path, KSI_NetRecorder **rec);
+
+	/**
+	 * Flushes and closes the log file and releases the recorder. The recorder must not
+	 * be in use by any network client.
+	 * \param[in]	rec			The recorder.
+	 */
+	void KSI_NetRecorder_free(KSI_NetRecorder *rec);
+
+	/**
+	 * Starts recording the requests of the network client. The ownership of the recorder
+	 * is not taken, it must outlive the client or be detached by setting it to \c NULL.
+	 * \param[in]	client		Network client, typically an HTTP or a TCP client.
+	 * \param[in]	rec			The recorder, \c NULL to stop recording.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_NetworkClient_setRecorder(KSI_NetworkClient *client, KSI_NetRecorder *rec);
+
+	/**
+	 * Creates a network client serving the responses of a log written by #KSI_NetRecorder.
+	 * Aggregation and extension requests are matched with the recorded requests by their
+	 * content, ignoring the request id. The response is given the request id of the new
+	 * request and authenticated with the key configured for the service, see
+	 * #KSI_NetworkClient_setAggregatorUser and friends. Requests of equal content are
+	 * answered with their recorded responses in turn.
+	 * \param[in]	ctx			KSI context.
+	 * \param[in]	path		Path to the log file.
+	 * \param[out]	client		Pointer to the receiving pointer.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 * \note The requests are sent with the PDU version configured for the context, so only
+	 * the responses recorded with the same version can be matched.
+	 */
+	int KSI_ReplayClient_new(KSI_CTX *ctx, const char *path, KSI_NetworkClient **client);
+
+	/**
+	 * Sets the pace of the replay. With the value 1 every response is delayed by the time
+	 * the recorded request took, greater values accelerate the replay accordingly. With the
+	 * default value 0 the responses are served without delay.
+	 * \param[in]	client		Replay client.
+	 * \param[in]	speed		Speed factor, not negative.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_ReplayClient_setSpeed(KSI_NetworkClient *client, double speed);
+
+	/**
+	 * Returns the number of request and response pairs loaded by the replay client.
+	 * \param[in]	client		Replay client.
+	 * \param[out]	count		Number of the recorded pairs.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_ReplayClient_getCount(KSI_NetworkClient *client, size_t *count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KSI_NET_REPLAY_H_ */
@@ -18,6 +18,7 @@
  */
 
 #include <string.h>
+#include <time.h>
 #include "internal.h"
 #include "net_http_impl.h"
 #include "ctx_impl.h"
@@ -27,10 +28,15 @@
 #include "io.h"
 #include "tlv.h"
 #include "fast_tlv.h"
+#include "thread.h"
+#include "counters_impl.h"
 
 #ifndef _WIN32
 #  include <unistd.h>
+#  include <errno.h>
+#  include <fcntl.h>
 #  include <sys/socket.h>
+#  include <sys/select.h>
 #  include <netinet/in.h>
 #  ifndef __USE_MISC
 #    define __USE_MISC
@@ -40,15 +46,260 @@
 #    include <netdb.h>
 #  endif
 #  include <sys/time.h>
+#  define SOCKET_IN_PROGRESS() (errno == EINPROGRESS)
+#  define SOCKET_INTERRUPTED() (errno == EINTR)
 #else
 #  include <winsock2.h>
 #  include <ws2tcpip.h>
 #  define close(soc) closesocket(soc)
+#  define SOCKET_IN_PROGRESS() (WSAGetLastError() == WSAEWOULDBLOCK)
+#  define SOCKET_INTERRUPTED() (WSAGetLastError() == WSAEINTR)
 #endif
 
+/** Maximum number of addresses kept for a host. */
+#define TCP_MAX_ADDRESSES 8
+
+/** Delay before the next address is tried while the previous connection attempts are still pending. */
+#define TCP_CONNECT_STAGGER_MS 250
+
 typedef struct TcpClient_Endpoint_st TcpClientCtx, TcpClient_Endpoint;
+typedef struct TcpClient_AddressCache_st TcpClient_AddressCache;
+
+/**
+ * Resolved addresses of an endpoint. The host is resolved by a background thread, so the requests
+ * only have to wait for the resolver when no addresses are known yet. Expired addresses are used
+ * while they are being refreshed.
+ */
+struct TcpClient_AddressCache_st {
+	KSI_CTX *ctx;
+	KSI_Mutex *lock;
+	/** Signalled when the resolver finishes. */
+	KSI_Cond *done;
+	/** The last resolver thread, \c NULL if none has been started. */
+	KSI_Thread *resolver;
+	int running;
+
+	char *host;
+	unsigned port;
+	/** Incremented when the host changes, so a running resolver knows to start over. */
+	unsigned generation;
+	int cacheSeconds;
+
+	struct sockaddr_storage addr[TCP_MAX_ADDRESSES];
+	socklen_t addr_len[TCP_MAX_ADDRESSES];
+	size_t addr_count;
+	time_t expires;
+	/** Status of the last resolution. */
+	int status;
+};
+
+static void TcpClient_AddressCache_free(TcpClient_AddressCache *cache) {
+	if (cache != NULL) {
+		/* Wait for the resolver, as it refers to the cache. */
+		KSI_Thread_free(cache->resolver);
+		KSI_Cond_free(cache->done);
+		KSI_Mutex_free(cache->lock);
+		KSI_free(cache->host);
+		KSI_free(cache);
+	}
+}
+
+static int TcpClient_AddressCache_new(KSI_CTX *ctx, TcpClient_AddressCache **cache) {
+	int res;
+	TcpClient_AddressCache *tmp = NULL;
+
+	tmp = KSI_new(TcpClient_AddressCache);
+	if (tmp == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	tmp->ctx = ctx;
+	tmp->lock = NULL;
+	tmp->done = NULL;
+	tmp->resolver = NULL;
+	tmp->running = 0;
+	tmp->host = NULL;
+	tmp->port = 0;
+	tmp->generation = 0;
+	tmp->cacheSeconds = 0;
+	tmp->addr_count = 0;
+	tmp->expires = 0;
+	tmp->status = KSI_OK;
+
+	res = KSI_Mutex_new(ctx, &tmp->lock);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Cond_new(ctx, &tmp->done);
+	if (res != KSI_OK) goto cleanup;
+
+	*cache = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	TcpClient_AddressCache_free(tmp);
+
+	return res;
+}
+
+/* Resolver thread entry point. */
+static int addressCache_resolve(void *arg) {
+	int res;
+	TcpClient_AddressCache *cache = arg;
+	char *host = NULL;
+	char port[16];
+	unsigned generation;
+	struct addrinfo hints;
+	struct addrinfo *list = NULL;
+	struct addrinfo *ai = NULL;
+	struct sockaddr_storage addr[TCP_MAX_ADDRESSES];
+	socklen_t addr_len[TCP_MAX_ADDRESSES];
+	size_t count;
+
+	for (;;) {
+		count = 0;
+
+		KSI_Mutex_lock(cache->lock);
+		generation = cache->generation;
+		res = KSI_strdup(cache->host, &host);
+		KSI_snprintf(port, sizeof(port), "%u", cache->port);
+		KSI_Mutex_unlock(cache->lock);
+
+		if (res == KSI_OK) {
+			memset(&hints, 0, sizeof(hints));
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+
+			if (getaddrinfo(host, port, &hints, &list) == 0) {
+				for (ai = list; ai != NULL && count < TCP_MAX_ADDRESSES; ai = ai->ai_next) {
+					if ((size_t)ai->ai_addrlen > sizeof(struct sockaddr_storage)) continue;
+					memcpy(&addr[count], ai->ai_addr, ai->ai_addrlen);
+					addr_len[count] = (socklen_t)ai->ai_addrlen;
+					count++;
+				}
+				freeaddrinfo(list);
+				list = NULL;
+			}
+
+			res = count > 0 ? KSI_OK : KSI_NETWORK_ERROR;
+		}
+
+		KSI_free(host);
+		host = NULL;
+
+		KSI_Mutex_lock(cache->lock);
+		if (generation == cache->generation) break;
+		/* The host was changed meanwhile, resolve the new one. */
+		KSI_Mutex_unlock(cache->lock);
+	}
 
-static int TcpClient_Endpoint_new(TcpClient_Endpoint **t) {
+	/* A failed refresh keeps the previous addresses, the next request will try again. */
+	if (res == KSI_OK) {
+		memcpy(cache->addr, addr, count * sizeof(addr[0]));
+		memcpy(cache->addr_len, addr_len, count * sizeof(addr_len[0]));
+		cache->addr_count = count;
+		cache->expires = time(NULL) + cache->cacheSeconds;
+	}
+	cache->status = res;
+	cache->running = 0;
+	KSI_Cond_broadcast(cache->done);
+	KSI_Mutex_unlock(cache->lock);
+
+	return res;
+}
+
+/* Starts the resolver unless it is already running. Must be called with the lock held. */
+static int addressCache_refresh(TcpClient_AddressCache *cache) {
+	int res;
+
+	if (cache->running || cache->host == NULL) return KSI_OK;
+
+	/* The previous resolver has finished, joining it does not block. */
+	KSI_Thread_free(cache->resolver);
+	cache->resolver = NULL;
+
+	cache->running = 1;
+	res = KSI_Thread_start(cache->ctx, addressCache_resolve, cache, &cache->resolver);
+	if (res != KSI_OK) cache->running = 0;
+
+	return res;
+}
+
+/* Sets a new host and starts resolving it in the background. */
+static int addressCache_setHost(TcpClient_AddressCache *cache, const char *host, unsigned port, int cacheSeconds) {
+	int res;
+	char *tmp = NULL;
+
+	res = KSI_strdup(host, &tmp);
+	if (res != KSI_OK) goto cleanup;
+
+	KSI_Mutex_lock(cache->lock);
+	KSI_free(cache->host);
+	cache->host = tmp;
+	cache->port = port;
+	cache->cacheSeconds = cacheSeconds;
+	cache->generation++;
+	cache->addr_count = 0;
+	cache->expires = 0;
+	cache->status = KSI_OK;
+	/* A running resolver notices the change and starts over. */
+	res = addressCache_refresh(cache);
+	KSI_Mutex_unlock(cache->lock);
+	tmp = NULL;
+
+cleanup:
+
+	KSI_free(tmp);
+
+	return res;
+}
+
+/* Copies the addresses of the host, waiting for the resolver only if there are none yet. */
+static int addressCache_get(TcpClient_AddressCache *cache, int cacheSeconds, struct sockaddr_storage *addr, socklen_t *addr_len, size_t *count) {
+	int res;
+
+	KSI_Mutex_lock(cache->lock);
+
+	cache->cacheSeconds = cacheSeconds;
+	if (cache->addr_count == 0 || time(NULL) >= cache->expires) {
+		res = addressCache_refresh(cache);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	while (cache->addr_count == 0 && cache->running) {
+		KSI_Cond_wait(cache->done, cache->lock);
+	}
+
+	if (cache->addr_count == 0) {
+		res = cache->status != KSI_OK ? cache->status : KSI_NETWORK_ERROR;
+		goto cleanup;
+	}
+
+	memcpy(addr, cache->addr, cache->addr_count * sizeof(addr[0]));
+	memcpy(addr_len, cache->addr_len, cache->addr_count * sizeof(addr_len[0]));
+	*count = cache->addr_count;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_Mutex_unlock(cache->lock);
+
+	return res;
+}
+
+/* Makes the next request resolve the host again, e.g. when none of the addresses accepted a connection. */
+static void addressCache_expire(TcpClient_AddressCache *cache) {
+	KSI_Mutex_lock(cache->lock);
+	cache->expires = 0;
+	KSI_Mutex_unlock(cache->lock);
+}
+
+static int TcpClient_Endpoint_new(KSI_CTX *ctx, TcpClient_Endpoint **t) {
+	int res;
 	TcpClient_Endpoint *tmp = NULL;
 	if (t == NULL) return KSI_INVALID_ARGUMENT;
 
@@ -57,6 +308,13 @@ static int TcpClient_Endpoint_new(TcpClient_Endpoint **t) {
 
 	tmp->host = NULL;
 	tmp->port = 0;
+	tmp->addrCache = NULL;
+
+	res = TcpClient_AddressCache_new(ctx, &tmp->addrCache);
+	if (res != KSI_OK) {
+		KSI_free(tmp);
+		return res;
+	}
 
 	*t = tmp;
 	return KSI_OK;
@@ -64,6 +322,7 @@ static int TcpClient_Endpoint_new(TcpClient_Endpoint **t) {
 
 static void TcpClientCtx_free(TcpClientCtx *t) {
 	if (t != NULL) {
+		TcpClient_AddressCache_free(t->addrCache);
 		KSI_free(t->host);
 		KSI_free(t);
 	}
@@ -71,13 +330,149 @@ static void TcpClientCtx_free(TcpClientCtx *t) {
 
 #define TcpClient_Endpoint_free TcpClientCtx_free
 
+static int setBlocking(int sockfd, int blocking) {
+#ifdef _WIN32
+	u_long mode = blocking ? 0 : 1;
+	return ioctlsocket(sockfd, FIONBIO, &mode) == 0 ? KSI_OK : KSI_NETWORK_ERROR;
+#else
+	int flags = fcntl(sockfd, F_GETFL, 0);
+	if (flags < 0) return KSI_NETWORK_ERROR;
+	flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+	return fcntl(sockfd, F_SETFL, flags) == 0 ? KSI_OK : KSI_NETWORK_ERROR;
+#endif
+}
+
+/**
+ * Connects to the first address accepting the connection. A new attempt is started every
+ * #TCP_CONNECT_STAGGER_MS or as soon as the previous one fails, without giving up the pending
+ * ones, so an unreachable address delays the connection only by the stagger interval.
+ */
+static int connectAny(const struct sockaddr_storage *addr, const socklen_t *addr_len, size_t count, int timeoutSeconds, int *sockfd) {
+	int res;
+	int socks[TCP_MAX_ADDRESSES];
+	size_t started = 0;
+	size_t pending = 0;
+	size_t i;
+	int winner = -1;
+	KSI_uint64_t now = KSI_Counters_clock();
+	KSI_uint64_t deadline = now + (KSI_uint64_t)timeoutSeconds * 1000000;
+	KSI_uint64_t nextStart = now;
+
+	for (i = 0; i < count; i++) socks[i] = -1;
+
+	while (winner < 0) {
+		fd_set wset;
+		fd_set eset;
+		struct timeval tv;
+		KSI_uint64_t wait;
+		int maxfd = -1;
+		int rc;
+
+		now = KSI_Counters_clock();
+
+		if (started < count && now >= nextStart) {
+			int s = (int)socket(addr[started].ss_family, SOCK_STREAM, 0);
+#ifndef _WIN32
+			if (s >= FD_SETSIZE) {
+				close(s);
+				s = -1;
+			}
+#endif
+			nextStart = now;
+			if (s >= 0 && setBlocking(s, 0) == KSI_OK) {
+				if (connect(s, (const struct sockaddr *)&addr[started], addr_len[started]) == 0) {
+					winner = (int)started;
+				} else if (SOCKET_IN_PROGRESS()) {
+					pending++;
+					nextStart = now + TCP_CONNECT_STAGGER_MS * 1000;
+				} else {
+					close(s);
+					s = -1;
+				}
+			} else if (s >= 0) {
+				close(s);
+				s = -1;
+			}
+			socks[started++] = s;
+			continue;
+		}
+
+		if (pending == 0) {
+			if (started < count) continue;
+			res = KSI_NETWORK_ERROR;
+			goto cleanup;
+		}
+
+		if (timeoutSeconds > 0 && now >= deadline) {
+			res = KSI_NETWORK_CONNECTION_TIMEOUT;
+			goto cleanup;
+		}
+
+		wait = timeoutSeconds > 0 ? deadline - now : 1000000;
+		if (started < count && nextStart - now < wait) wait = nextStart - now;
+
+		FD_ZERO(&wset);
+		FD_ZERO(&eset);
+		for (i = 0; i < started; i++) {
+			if (socks[i] < 0) continue;
+			FD_SET(socks[i], &wset);
+			FD_SET(socks[i], &eset);
+			if (socks[i] > maxfd) maxfd = socks[i];
+		}
+
+		tv.tv_sec = (long)(wait / 1000000);
+		tv.tv_usec = (long)(wait % 1000000);
+
+		rc = select(maxfd + 1, NULL, &wset, &eset, &tv);
+		if (rc < 0) {
+			if (SOCKET_INTERRUPTED()) continue;
+			res = KSI_NETWORK_ERROR;
+			goto cleanup;
+		}
+
+		for (i = 0; i < started && winner < 0; i++) {
+			int err = 0;
+			socklen_t err_len = sizeof(err);
+
+			if (socks[i] < 0 || (!FD_ISSET(socks[i], &wset) && !FD_ISSET(socks[i], &eset))) continue;
+
+			if (getsockopt(socks[i], SOL_SOCKET, SO_ERROR, (void *)&err, &err_len) == 0 && err == 0) {
+				winner = (int)i;
+			} else {
+				close(socks[i]);
+				socks[i] = -1;
+				pending--;
+				/* Try the next address right away. */
+				nextStart = now;
+			}
+		}
+	}
+
+	res = setBlocking(socks[winner], 1);
+	if (res != KSI_OK) goto cleanup;
+
+	*sockfd = socks[winner];
+	socks[winner] = -1;
+
+	res = KSI_OK;
+
+cleanup:
+
+	for (i = 0; i < started; i++) {
+		if (socks[i] >= 0) close(socks[i]);
+	}
+
+	return res;
+}
+
 static int readResponse(KSI_RequestHandle *handle) {
 	int res;
-	TcpClientCtx *tcp = NULL;
+	TcpClient_Endpoint *endp = NULL;
 	KSI_TcpClient *client = NULL;
 	int sockfd = -1;
-	struct sockaddr_in serv_addr;
-	struct hostent *server = NULL;
+	struct sockaddr_storage addr[TCP_MAX_ADDRESSES];
+	socklen_t addr_len[TCP_MAX_ADDRESSES];
+	size_t addr_count = 0;
 	size_t count;
 	unsigned char buffer[0xffff + 4];
 	KSI_FTLV ftlv;
@@ -94,14 +489,27 @@ static int readResponse(KSI_RequestHandle *handle) {
 
 	KSI_ERR_clearErrors(handle->ctx);
 
-	tcp = handle->implCtx;
+	endp = handle->implCtx;
 	client = handle->client->impl;
 
-	sockfd = (int)socket(AF_INET, SOCK_STREAM, 0);
-	if (sockfd < 0) {
-		KSI_pushError(handle->ctx, res = KSI_NETWORK_ERROR, "Unable to open socket.");
+	KSI_TRACE(handle->ctx, KSI_TRACE_DNS, KSI_TRACE_START, handle->requestId);
+	res = addressCache_get(endp->addrCache, client->addressCacheSeconds, addr, addr_len, &addr_count);
+	KSI_TRACE(handle->ctx, KSI_TRACE_DNS, KSI_TRACE_END, handle->requestId);
+	if (res != KSI_OK) {
+		KSI_pushError(handle->ctx, res, "Unable to resolve host.");
+		goto cleanup;
+	}
+
+	KSI_TRACE(handle->ctx, KSI_TRACE_CONNECT, KSI_TRACE_START, handle->requestId);
+	res = connectAny(addr, addr_len, addr_count, client->connectTimeoutSeconds, &sockfd);
+	KSI_TRACE(handle->ctx, KSI_TRACE_CONNECT, KSI_TRACE_END, handle->requestId);
+	if (res != KSI_OK) {
+		/* The host may have moved. */
+		addressCache_expire(endp->addrCache);
+		KSI_pushError(handle->ctx, res, "Unable to connect.");
 		goto cleanup;
 	}
+
 #ifdef _WIN32
 	transferTimeout = client->transferTimeoutSeconds * 1000;
 #else
@@ -113,26 +521,8 @@ static int readResponse(KSI_RequestHandle *handle) {
 	setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (void*)&transferTimeout, sizeof(transferTimeout));
 	setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, (void*)&transferTimeout, sizeof(transferTimeout));
 
-	server = gethostbyname(tcp->host);
-	if (server == NULL) {
-		KSI_pushError(handle->ctx, res = KSI_NETWORK_ERROR, "Unable to open host.");
-		goto cleanup;
-	}
-
-	memset((char *) &serv_addr, 0, sizeof(serv_addr));
-	serv_addr.sin_family = AF_INET;
-
-	memmove((char *)&serv_addr.sin_addr.s_addr, (char *)server->h_addr, server->h_length);
-
-	serv_addr.sin_port = htons(tcp->port);
-
-	if ((res = connect(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr))) < 0) {
-		KSI_ERR_push(handle->ctx, KSI_NETWORK_ERROR, res, __FILE__, __LINE__, "Unable to connect.");
-		res = KSI_NETWORK_ERROR;
-		goto cleanup;
-	}
-
 	KSI_LOG_logBlob(handle->ctx, KSI_LOG_DEBUG, "Sending request", handle->request, handle->request_length);
+	KSI_TRACE(handle->ctx, KSI_TRACE_SEND, KSI_TRACE_START, handle->requestId);
 	count = 0;
 	while (count < handle->request_length) {
 		int c;
@@ -147,13 +537,17 @@ static int readResponse(KSI_RequestHandle *handle) {
 		c = send(sockfd, (char *) handle->request, handle->request_length, 0);
 #endif
 		if (c < 0) {
+			KSI_TRACE(handle->ctx, KSI_TRACE_SEND, KSI_TRACE_END, handle->requestId);
 			KSI_pushError(handle->ctx, res = KSI_NETWORK_ERROR, "Unable to write to socket.");
 			goto cleanup;
 		}
 		count += c;
 	}
+	KSI_TRACE(handle->ctx, KSI_TRACE_SEND, KSI_TRACE_END, handle->requestId);
 
+	KSI_TRACE(handle->ctx, KSI_TRACE_WAIT, KSI_TRACE_START, handle->requestId);
 	res = KSI_FTLV_socketRead(sockfd, buffer, sizeof(buffer), &count, &ftlv);
+	KSI_TRACE(handle->ctx, KSI_TRACE_WAIT, KSI_TRACE_END, handle->requestId);
 	if (res != KSI_OK || count == 0) {
 		KSI_pushError(handle->ctx, res = KSI_INVALID_ARGUMENT, "Unable to read TLV from socket.");
 		goto cleanup;
@@ -183,9 +577,8 @@ cleanup:
 	return res;
 }
 
-static int sendRequest(KSI_NetworkClient *client, KSI_RequestHandle *handle, char *host, unsigned port) {
+static int sendRequest(KSI_NetworkClient *client, KSI_RequestHandle *handle, TcpClient_Endpoint *endp) {
 	int res;
-	TcpClientCtx *tc = NULL;
 
 	if (handle == NULL) {
 		res = KSI_INVALID_ARGUMENT;
@@ -194,56 +587,37 @@ static int sendRequest(KSI_NetworkClient *client, KSI_RequestHandle *handle, cha
 
 	KSI_ERR_clearErrors(handle->ctx);
 
-	if (client == NULL || host == NULL) {
+	if (client == NULL || endp == NULL || endp->host == NULL) {
 		KSI_pushError(handle->ctx, res = KSI_INVALID_ARGUMENT, NULL);
 		goto cleanup;
 	}
 
-	tc = KSI_new(TcpClientCtx);
-	if (tc == NULL) {
-		KSI_pushError(handle->ctx, res = KSI_OUT_OF_MEMORY, NULL);
-		goto cleanup;
-	}
-	tc->host = NULL;
-	tc->port = 0;
-
-	KSI_LOG_debug(handle->ctx, "Tcp: Sending request to: %s:%u", host, port);
-
-	res = KSI_strdup(host, &tc->host);
-	if (res != KSI_OK) {
-		KSI_pushError(handle->ctx, res, NULL);
-		goto cleanup;
-	}
-	tc->port = port;
-
+	KSI_LOG_debug(handle->ctx, "Tcp: Sending request to: %s:%u", endp->host, endp->port);
 
 	handle->readResponse = readResponse;
 	handle->client = client;
 
-	res = KSI_RequestHandle_setImplContext(handle, tc, (void (*)(void *))TcpClientCtx_free);
+	/* The endpoint is owned by the client, the handle only uses its address cache. */
+	res = KSI_RequestHandle_setImplContext(handle, endp, NULL);
 	if (res != KSI_OK) {
 		KSI_pushError(handle->ctx, res, NULL);
 		goto cleanup;
 	}
 
-	tc = NULL;
-
 	res = KSI_OK;
 
 cleanup:
 
-	TcpClientCtx_free(tc);
-
 	return res;
 }
 
 static int prepareRequest(
 		KSI_NetworkClient *client,
-		void *pdu,
-		int (*serialize)(void *, unsigned char **, size_t *),
+		KSI_NetEndpoint *endpoint,
+		void *req,
+		int (*serialize)(KSI_NetEndpoint *, void *, unsigned char **, size_t *),
 		KSI_RequestHandle **handle,
-		char *host,
-		unsigned port,
+		TcpClient_Endpoint *endp,
 		const char *desc) {
 	int res;
 	KSI_TcpClient *tcp = client->impl;
@@ -258,12 +632,12 @@ static int prepareRequest(
 
 	KSI_ERR_clearErrors(client->ctx);
 
-	if (pdu == NULL || handle == NULL) {
+	if (endpoint == NULL || req == NULL || handle == NULL) {
 		KSI_pushError(client->ctx, res = KSI_INVALID_ARGUMENT, NULL);
 		goto cleanup;
 	}
 
-	res = serialize(pdu, &raw, &raw_len);
+	res = serialize(endpoint, req, &raw, &raw_len);
 	if (res != KSI_OK) {
 		KSI_pushError(client->ctx, res, NULL);
 		goto cleanup;
@@ -283,7 +657,7 @@ static int prepareRequest(
 		goto cleanup;
 	}
 
-	res = tcp->sendRequest(client, tmp, host, port);
+	res = tcp->sendRequest(client, tmp, endp);
 	if (res != KSI_OK) {
 		KSI_pushError(client->ctx, res, NULL);
 		goto cleanup;
@@ -304,7 +678,6 @@ cleanup:
 
 static int prepareExtendRequest(KSI_NetworkClient *client, KSI_ExtendReq *req, KSI_RequestHandle **handle) {
 	int res = KSI_UNKNOWN_ERROR;
-	KSI_ExtendPdu *pdu = NULL;
 	KSI_Integer *pReqId = NULL;
 	KSI_Integer *reqId = NULL;
 	TcpClient_Endpoint *endp = NULL;
@@ -325,7 +698,7 @@ static int prepareExtendRequest(KSI_NetworkClient *client, KSI_ExtendReq *req, K
 	if (res != KSI_OK) goto cleanup;
 
 	if (pReqId == NULL) {
-		res = KSI_Integer_new(client->ctx, ++client->requestCount, &reqId);
+		res = KSI_Integer_new(client->ctx, KSI_Atomic_increment(&client->requestCount), &reqId);
 		if (res != KSI_OK) goto cleanup;
 
 		res = KSI_ExtendReq_setRequestId(req, reqId);
@@ -334,31 +707,25 @@ static int prepareExtendRequest(KSI_NetworkClient *client, KSI_ExtendReq *req, K
 		reqId = NULL;
 	}
 
-	res = KSI_ExtendReq_enclose(req, client->extender->ksi_user, client->extender->ksi_pass, &pdu);
-	if (res != KSI_OK) goto cleanup;
-
 	res = prepareRequest(
 			client,
-			pdu,
-			(int (*)(void *, unsigned char **, size_t *))KSI_ExtendPdu_serialize,
+			client->extender,
+			req,
+			(int (*)(KSI_NetEndpoint *, void *, unsigned char **, size_t *))KSI_NetEndpoint_serializeExtendReq,
 			handle,
-			endp->host,
-			endp->port,
+			endp,
 			"Extend request");
 	if (res != KSI_OK) goto cleanup;
 	res = KSI_OK;
 
 cleanup:
 
-	KSI_ExtendPdu_setRequest(pdu, NULL);
-	KSI_ExtendPdu_free(pdu);
 
 	return res;
 }
 
 static int prepareAggregationRequest(KSI_NetworkClient *client, KSI_AggregationReq *req, KSI_RequestHandle **handle) {
 	int res = KSI_UNKNOWN_ERROR;
-	KSI_AggregationPdu *pdu = NULL;
 	KSI_Integer *pReqId = NULL;
 	KSI_Integer *reqId = NULL;
 	TcpClient_Endpoint *endp = NULL;
@@ -379,7 +746,7 @@ static int prepareAggregationRequest(KSI_NetworkClient *client, KSI_AggregationR
 	if (res != KSI_OK) goto cleanup;
 
 	if (pReqId == NULL) {
-		res = KSI_Integer_new(client->ctx, ++client->requestCount, &reqId);
+		res = KSI_Integer_new(client->ctx, KSI_Atomic_increment(&client->requestCount), &reqId);
 		if (res != KSI_OK) goto cleanup;
 
 		res = KSI_AggregationReq_setRequestId(req, reqId);
@@ -388,16 +755,13 @@ static int prepareAggregationRequest(KSI_NetworkClient *client, KSI_AggregationR
 		reqId = NULL;
 	}
 
-	res = KSI_AggregationReq_enclose(req, client->aggregator->ksi_user, client->aggregator->ksi_pass, &pdu);
-	if (res != KSI_OK) goto cleanup;
-
 	res = prepareRequest(
 			client,
-			pdu,
-			(int (*)(void *, unsigned char **, size_t *))KSI_AggregationPdu_serialize,
+			client->aggregator,
+			req,
+			(int (*)(KSI_NetEndpoint *, void *, unsigned char **, size_t *))KSI_NetEndpoint_serializeAggregationReq,
 			handle,
-			endp->host,
-			endp->port,
+			endp,
 			"Aggregation request");
 	if (res != KSI_OK) goto cleanup;
 
@@ -405,8 +769,6 @@ static int prepareAggregationRequest(KSI_NetworkClient *client, KSI_AggregationR
 
 cleanup:
 
-	KSI_AggregationPdu_setRequest(pdu, NULL);
-	KSI_AggregationPdu_free(pdu);
 
 	return res;
 }
@@ -464,6 +826,8 @@ int KSI_TcpClient_new(KSI_CTX *ctx, KSI_NetworkClient **tcp) {
 
 	t->sendRequest = sendRequest;
 	t->transferTimeoutSeconds = 10;
+	t->connectTimeoutSeconds = 10;
+	t->addressCacheSeconds = 60;
 	t->http = NULL;
 
 	res = KSI_HttpClient_new(ctx, &t->http);
@@ -473,19 +837,19 @@ int KSI_TcpClient_new(KSI_CTX *ctx, KSI_NetworkClient **tcp) {
 	}
 
 	/* Create implementations for abstract endpoints. */
-	res = TcpClient_Endpoint_new(&endp_aggr);
+	res = TcpClient_Endpoint_new(ctx, &endp_aggr);
 	if (res != KSI_OK) {
 		KSI_pushError(ctx, res, NULL);
 		goto cleanup;
 	}
 
-	res = TcpClient_Endpoint_new(&endp_ext);
+	res = TcpClient_Endpoint_new(ctx, &endp_ext);
 	if (res != KSI_OK) {
 		KSI_pushError(ctx, res, NULL);
 		goto cleanup;
 	}
 
-	res = TcpClient_Endpoint_new(&endp_pub);
+	res = TcpClient_Endpoint_new(ctx, &endp_pub);
 	if (res != KSI_OK) {
 		KSI_pushError(ctx, res, NULL);
 		goto cleanup;
@@ -554,6 +918,10 @@ static int ksi_TcpClient_setService(KSI_NetworkClient *client, KSI_NetEndpoint *
 
 	endp->port = port;
 
+	/* Resolve the host before the first request needs it. */
+	res = addressCache_setHost(endp->addrCache, host, port, ((KSI_TcpClient *)client->impl)->addressCacheSeconds);
+	if (res != KSI_OK) goto cleanup;
+
 	res = client->setStringParam(&abs_endp->ksi_user, user);
 	if (res != KSI_OK) goto cleanup;
 
@@ -616,3 +984,43 @@ cleanup:
 
 	return res;
 }
+
+int KSI_TcpClient_setConnectTimeoutSeconds(KSI_NetworkClient *client, int connectTimeoutSeconds) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_TcpClient *tcp = NULL;
+
+	if (client == NULL || connectTimeoutSeconds < 0) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	tcp = client->impl;
+
+	tcp->connectTimeoutSeconds = connectTimeoutSeconds;
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+int KSI_TcpClient_setAddressCacheSeconds(KSI_NetworkClient *client, int addressCacheSeconds) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_TcpClient *tcp = NULL;
+
+	if (client == NULL || addressCacheSeconds < 0) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	tcp = client->impl;
+
+	tcp->addressCacheSeconds = addressCacheSeconds;
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
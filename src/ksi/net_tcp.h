@@ -77,6 +77,27 @@ extern "C" {
 	 */
 	int KSI_TcpClient_setTransferTimeoutSeconds(KSI_NetworkClient *client, int val);
 
+	/**
+	 * Setter for the connection timeout in seconds. The time limit is shared by all the addresses
+	 * of the host, which are tried concurrently.
+	 * \param[in]	client		Pointer to the tcp client.
+	 * \param[in]	val			Timeout in seconds, 0 for no limit.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_TcpClient_setConnectTimeoutSeconds(KSI_NetworkClient *client, int val);
+
+	/**
+	 * Setter for the time the resolved addresses of the aggregator and the extender are used
+	 * before the host names are resolved again. The host names are resolved in the background
+	 * when the service is configured and when the addresses expire, so the requests do not
+	 * wait for the name resolution unless no address is known yet.
+	 * \param[in]	client		Pointer to the tcp client.
+	 * \param[in]	val			Time in seconds, the default is 60.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 * \note The value applies to the services configured after the call and to the next refresh.
+	 */
+	int KSI_TcpClient_setAddressCacheSeconds(KSI_NetworkClient *client, int val);
+
 #ifdef __cplusplus
 }
 #endif
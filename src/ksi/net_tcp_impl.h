@@ -32,13 +32,22 @@ extern "C" {
 	struct TcpClient_Endpoint_st {
 		char *host;
 		unsigned port;
+
+		/** Addresses of \c host, resolved in the background. */
+		struct TcpClient_AddressCache_st *addrCache;
 	};
 
 	struct KSI_TcpClient_st {
 		/* TODO: Is it required to be a signed int? */
 		int transferTimeoutSeconds;
 
-		int (*sendRequest)(KSI_NetworkClient *, KSI_RequestHandle *, char *host, unsigned port);
+		/** Time limit for establishing the connection, 0 for no limit. */
+		int connectTimeoutSeconds;
+
+		/** Time the resolved addresses are used before resolving the host again. */
+		int addressCacheSeconds;
+
+		int (*sendRequest)(KSI_NetworkClient *, KSI_RequestHandle *, struct TcpClient_Endpoint_st *endp);
 		KSI_NetworkClient *http;
 	};
 
@@ -0,0 +1,228 @@
+/*
+ * Copyright 2013-2015 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+
+#include <string.h>
+
+#include "internal.h"
+#include "pkicache.h"
+#include "thread.h"
+
+typedef struct KSI_PKIVerificationCacheEntry_st {
+	KSI_PKIVerificationKey key;
+	size_t generation;
+	int used;
+} KSI_PKIVerificationCacheEntry;
+
+struct KSI_PKIVerificationCache_st {
+	KSI_CTX *ctx;
+	KSI_Mutex *lock;
+	/* Generation of the trust anchors, entries from earlier generations are stale. */
+	size_t generation;
+	/* Index of the entry to be replaced next. */
+	size_t next;
+	/* Number of successful lookups. */
+	size_t hits;
+	KSI_PKIVerificationCacheEntry entries[KSI_PKI_VERIFICATION_CACHE_SIZE];
+};
+
+int KSI_PKIVerificationCache_new(KSI_CTX *ctx, KSI_PKIVerificationCache **cache) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_PKIVerificationCache *tmp = NULL;
+
+	KSI_ERR_clearErrors(ctx);
+
+	if (ctx == NULL || cache == NULL) {
+		KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
+		goto cleanup;
+	}
+
+	tmp = KSI_new(KSI_PKIVerificationCache);
+	if (tmp == NULL) {
+		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+	memset(tmp, 0, sizeof(KSI_PKIVerificationCache));
+	tmp->ctx = ctx;
+
+	res = KSI_Mutex_new(ctx, &tmp->lock);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	*cache = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_PKIVerificationCache_free(tmp);
+
+	return res;
+}
+
+void KSI_PKIVerificationCache_free(KSI_PKIVerificationCache *cache) {
+	if (cache != NULL) {
+		KSI_Mutex_free(cache->lock);
+		KSI_free(cache);
+	}
+}
+
+void KSI_PKIVerificationCache_invalidate(KSI_PKIVerificationCache *cache) {
+	if (cache != NULL) {
+		KSI_Mutex_lock(cache->lock);
+		cache->generation++;
+		KSI_Mutex_unlock(cache->lock);
+	}
+}
+
+static int addLengthPrefixed(KSI_DataHasher *hsr, const void *data, size_t data_len) {
+	int res = KSI_UNKNOWN_ERROR;
+	unsigned char len[8];
+	size_t i;
+
+	/* The length prefix keeps the field boundaries unambiguous. */
+	for (i = 0; i < sizeof(len); i++) {
+		len[i] = (unsigned char)(((KSI_uint64_t)data_len >> (8 * (sizeof(len) - i - 1))) & 0xff);
+	}
+
+	res = KSI_DataHasher_add(hsr, len, sizeof(len));
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_DataHasher_add(hsr, data, data_len);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+int KSI_PKIVerificationCache_getKey(KSI_PKIVerificationCache *cache, const unsigned char *data, size_t data_len, const char *algoOid,
+		const unsigned char *signature, size_t signature_len, const KSI_PKICertificate *cert, KSI_PKIVerificationKey *key) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_DataHasher *hsr = NULL;
+	KSI_DataHash *hsh = NULL;
+	unsigned char *der = NULL;
+	size_t der_len = 0;
+	const unsigned char *imprint = NULL;
+	size_t imprint_len = 0;
+
+	if (cache == NULL || data == NULL || algoOid == NULL || signature == NULL || cert == NULL || key == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	res = KSI_PKICertificate_serialize((KSI_PKICertificate *)cert, &der, &der_len);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_DataHasher_open(cache->ctx, KSI_HASHALG_SHA2_256, &hsr);
+	if (res != KSI_OK) goto cleanup;
+
+	res = addLengthPrefixed(hsr, algoOid, strlen(algoOid));
+	if (res != KSI_OK) goto cleanup;
+
+	res = addLengthPrefixed(hsr, data, data_len);
+	if (res != KSI_OK) goto cleanup;
+
+	res = addLengthPrefixed(hsr, signature, signature_len);
+	if (res != KSI_OK) goto cleanup;
+
+	res = addLengthPrefixed(hsr, der, der_len);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_DataHasher_close(hsr, &hsh);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_DataHash_getImprint(hsh, &imprint, &imprint_len);
+	if (res != KSI_OK) goto cleanup;
+
+	if (imprint_len > sizeof(key->imprint)) {
+		res = KSI_BUFFER_OVERFLOW;
+		goto cleanup;
+	}
+
+	memcpy(key->imprint, imprint, imprint_len);
+	key->imprint_len = imprint_len;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_free(der);
+	KSI_DataHash_free(hsh);
+	KSI_DataHasher_free(hsr);
+
+	return res;
+}
+
+static int KSI_PKIVerificationKey_equals(const KSI_PKIVerificationKey *left, const KSI_PKIVerificationKey *right) {
+	return left->imprint_len == right->imprint_len && !memcmp(left->imprint, right->imprint, left->imprint_len);
+}
+
+int KSI_PKIVerificationCache_contains(KSI_PKIVerificationCache *cache, const KSI_PKIVerificationKey *key) {
+	int found = 0;
+	size_t i;
+
+	if (cache == NULL || key == NULL) goto cleanup;
+
+	KSI_Mutex_lock(cache->lock);
+	for (i = 0; i < KSI_PKI_VERIFICATION_CACHE_SIZE; i++) {
+		KSI_PKIVerificationCacheEntry *entry = &cache->entries[i];
+		if (entry->used && entry->generation == cache->generation && KSI_PKIVerificationKey_equals(&entry->key, key)) {
+			found = 1;
+			cache->hits++;
+			break;
+		}
+	}
+	KSI_Mutex_unlock(cache->lock);
+
+cleanup:
+
+	return found;
+}
+
+void KSI_PKIVerificationCache_add(KSI_PKIVerificationCache *cache, const KSI_PKIVerificationKey *key) {
+	KSI_PKIVerificationCacheEntry *entry = NULL;
+
+	if (cache == NULL || key == NULL) return;
+
+	KSI_Mutex_lock(cache->lock);
+	entry = &cache->entries[cache->next];
+	entry->key = *key;
+	entry->generation = cache->generation;
+	entry->used = 1;
+	cache->next = (cache->next + 1) % KSI_PKI_VERIFICATION_CACHE_SIZE;
+	KSI_Mutex_unlock(cache->lock);
+}
+
+size_t KSI_PKIVerificationCache_getHits(KSI_PKIVerificationCache *cache) {
+	size_t hits = 0;
+
+	if (cache == NULL) return 0;
+
+	KSI_Mutex_lock(cache->lock);
+	hits = cache->hits;
+	KSI_Mutex_unlock(cache->lock);
+
+	return hits;
+}
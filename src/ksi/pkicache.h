@@ -0,0 +1,119 @@
+/*
+ * Copyright 2013-2015 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+
+#ifndef KSI_PKICACHE_H_
+#define KSI_PKICACHE_H_
+
+#include "ksi.h"
+#include "pkitruststore.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef KSI_PKI_VERIFICATION_CACHE_SIZE
+/** Maximum number of successful verifications remembered by a single cache. */
+#  define KSI_PKI_VERIFICATION_CACHE_SIZE 64
+#endif
+
+	/**
+	 * Bounded cache of successful raw PKI signature verifications. An entry is keyed
+	 * by a digest over the signature algorithm, the signed data, the signature value
+	 * and the DER encoded certificate, and is only valid for the trust anchor
+	 * generation it was recorded with. The cache may be accessed from several threads.
+	 */
+	typedef struct KSI_PKIVerificationCache_st KSI_PKIVerificationCache;
+
+	/**
+	 * Lookup key of a cache entry.
+	 */
+	typedef struct KSI_PKIVerificationKey_st {
+		unsigned char imprint[KSI_MAX_IMPRINT_LEN];
+		size_t imprint_len;
+	} KSI_PKIVerificationKey;
+
+	/**
+	 * Creates a new empty cache.
+	 * \param[in]	ctx		KSI context.
+	 * \param[out]	cache	Pointer to the receiving pointer.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_PKIVerificationCache_new(KSI_CTX *ctx, KSI_PKIVerificationCache **cache);
+
+	/**
+	 * Releases the cache and all its entries.
+	 * \param[in]	cache	The cache.
+	 */
+	void KSI_PKIVerificationCache_free(KSI_PKIVerificationCache *cache);
+
+	/**
+	 * Starts a new trust anchor generation, all the existing entries become invalid.
+	 * \param[in]	cache	The cache.
+	 */
+	void KSI_PKIVerificationCache_invalidate(KSI_PKIVerificationCache *cache);
+
+	/**
+	 * Calculates the lookup key for a raw signature verification.
+	 * \param[in]	cache			The cache.
+	 * \param[in]	data			Signed data.
+	 * \param[in]	data_len		Length of the signed data.
+	 * \param[in]	algoOid			Signature algorithm OID.
+	 * \param[in]	signature		Signature value.
+	 * \param[in]	signature_len	Length of the signature value.
+	 * \param[in]	cert			Signing certificate.
+	 * \param[out]	key				The calculated key.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_PKIVerificationCache_getKey(KSI_PKIVerificationCache *cache, const unsigned char *data, size_t data_len, const char *algoOid,
+			const unsigned char *signature, size_t signature_len, const KSI_PKICertificate *cert, KSI_PKIVerificationKey *key);
+
+	/**
+	 * Checks if a successful verification with the given key has been recorded in the current generation.
+	 * \param[in]	cache	The cache.
+	 * \param[in]	key		The lookup key.
+	 * \return 1 if the entry is present, 0 otherwise.
+	 */
+	int KSI_PKIVerificationCache_contains(KSI_PKIVerificationCache *cache, const KSI_PKIVerificationKey *key);
+
+	/**
+	 * Records a successful verification. When the cache is full, the oldest entry is replaced.
+	 * \param[in]	cache	The cache.
+	 * \param[in]	key		The lookup key.
+	 */
+	void KSI_PKIVerificationCache_add(KSI_PKIVerificationCache *cache, const KSI_PKIVerificationKey *key);
+
+	/**
+	 * Returns the number of lookups answered from the cache.
+	 * \param[in]	cache	The cache.
+	 * \return Count of the successful #KSI_PKIVerificationCache_contains calls.
+	 */
+	size_t KSI_PKIVerificationCache_getHits(KSI_PKIVerificationCache *cache);
+
+	/**
+	 * Returns the verification cache of the truststore.
+	 * \param[in]	trust	PKI truststore.
+	 * \return Pointer to the cache owned by the truststore or \c NULL.
+	 */
+	KSI_PKIVerificationCache *KSI_PKITruststore_getVerificationCache(const KSI_PKITruststore *trust);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KSI_PKICACHE_H_ */
@@ -30,6 +30,7 @@
 #include "pkitruststore.h"
 #include "ctx_impl.h"
 #include "crc32.h"
+#include "pkicache.h"
 
 
 const char* getMSError(DWORD error, char *buf, size_t len){
@@ -65,6 +66,7 @@ static int KSI_PKITruststore_global_initCount = 0;
 struct KSI_PKITruststore_st {
 	KSI_CTX *ctx;
 	HCERTSTORE collectionStore;
+	KSI_PKIVerificationCache *verCache;
 };
 
 struct KSI_PKICertificate_st {
@@ -113,10 +115,15 @@ void KSI_PKITruststore_free(KSI_PKITruststore *trust) {
 				KSI_LOG_debug(trust->ctx, "%s", getMSError(GetLastError(), buf, sizeof(buf)));
 			}
 		}
+		KSI_PKIVerificationCache_free(trust->verCache);
 		KSI_free(trust);
 	}
 }
 
+KSI_PKIVerificationCache *KSI_PKITruststore_getVerificationCache(const KSI_PKITruststore *trust) {
+	return trust != NULL ? trust->verCache : NULL;
+}
+
 /*TODO: Not supported*/
 int KSI_PKITruststore_addLookupDir(KSI_PKITruststore *trust, const char *path) {
 	KSI_LOG_debug(trust->ctx, "CryptoAPI: Not implemented.");
@@ -152,6 +159,9 @@ int KSI_PKITruststore_addLookupFile(KSI_PKITruststore *trust, const char *path)
 		goto cleanup;
 	}
 
+	/* The trust anchors have changed. */
+	KSI_PKIVerificationCache_invalidate(trust->verCache);
+
 	res = KSI_OK;
 
 cleanup:
@@ -200,6 +210,13 @@ int KSI_PKITruststore_new(KSI_CTX *ctx, int setDefaults, KSI_PKITruststore **tru
 
 	tmp->ctx = ctx;
 	tmp->collectionStore = collectionStore;
+	tmp->verCache = NULL;
+
+	res = KSI_PKIVerificationCache_new(ctx, &tmp->verCache);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
 
 	*trust = tmp;
 	tmp = NULL;
@@ -1135,6 +1152,8 @@ int KSI_PKITruststore_verifyRawSignature(KSI_CTX *ctx, const unsigned char *data
 	DWORD pkcs1_len = 0;
 	HCRYPTHASH hash = 0;
 	char buf[1024];
+	KSI_PKIVerificationCache *cache = NULL;
+	KSI_PKIVerificationKey cacheKey;
 
 	KSI_ERR_clearErrors(ctx);
 	if (ctx == NULL || data == NULL || signature == NULL || algoOid == NULL || certificate == NULL) {
@@ -1152,6 +1171,17 @@ int KSI_PKITruststore_verifyRawSignature(KSI_CTX *ctx, const unsigned char *data
 		goto cleanup;
 	}
 
+	/* Skip the asymmetric crypto, if the same signature has already been verified. */
+	if (ctx->pkiTruststore != NULL) {
+		cache = ctx->pkiTruststore->verCache;
+		if (KSI_PKIVerificationCache_getKey(cache, data, data_len, algoOid, signature, signature_len, certificate, &cacheKey) != KSI_OK) {
+			cache = NULL;
+		} else if (KSI_PKIVerificationCache_contains(cache, &cacheKey)) {
+			KSI_LOG_debug(ctx, "CryptoAPI: PKI signature verification result found in cache.");
+			res = KSI_OK;
+			goto cleanup;
+		}
+	}
 
 	algorithm = algIdFromOID(algoOid);
 	if (algorithm == 0) {
@@ -1219,6 +1249,8 @@ int KSI_PKITruststore_verifyRawSignature(KSI_CTX *ctx, const unsigned char *data
 
 	KSI_LOG_debug(certificate->ctx, "CryptoAPI: PKI signature verified successfully.");
 
+	KSI_PKIVerificationCache_add(cache, &cacheKey);
+
 	res = KSI_OK;
 
 cleanup:
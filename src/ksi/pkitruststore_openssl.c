@@ -33,6 +33,7 @@
 #include "ctx_impl.h"
 #include "compatibility.h"
 #include "crc32.h"
+#include "pkicache.h"
 
 
 static const char *defaultCaFile =
@@ -55,6 +56,7 @@ static int KSI_PKITruststore_global_initCount = 0;
 struct KSI_PKITruststore_st {
 	KSI_CTX *ctx;
 	X509_STORE *store;
+	KSI_PKIVerificationCache *verCache;
 };
 
 struct KSI_PKICertificate_st {
@@ -109,10 +111,15 @@ static int KSI_MD2hashAlg(EVP_MD *hash_alg) {
 void KSI_PKITruststore_free(KSI_PKITruststore *trust) {
 	if (trust != NULL) {
 		if (trust->store != NULL) X509_STORE_free(trust->store);
+		KSI_PKIVerificationCache_free(trust->verCache);
 		KSI_free(trust);
 	}
 }
 
+KSI_PKIVerificationCache *KSI_PKITruststore_getVerificationCache(const KSI_PKITruststore *trust) {
+	return trust != NULL ? trust->verCache : NULL;
+}
+
 int KSI_PKITruststore_addLookupFile(KSI_PKITruststore *trust, const char *path) {
 	int res;
 	X509_LOOKUP *lookup = NULL;
@@ -142,6 +149,9 @@ int KSI_PKITruststore_addLookupFile(KSI_PKITruststore *trust, const char *path)
 		goto cleanup;
 	}
 
+	/* The trust anchors have changed. */
+	KSI_PKIVerificationCache_invalidate(trust->verCache);
+
 	res = KSI_OK;
 
 cleanup:
@@ -176,6 +186,9 @@ int KSI_PKITruststore_addLookupDir(KSI_PKITruststore *trust, const char *path) {
 		goto cleanup;
 	}
 
+	/* The trust anchors have changed. */
+	KSI_PKIVerificationCache_invalidate(trust->verCache);
+
 	res = KSI_OK;
 
 cleanup:
@@ -212,6 +225,7 @@ int KSI_PKITruststore_new(KSI_CTX *ctx, int setDefaults, KSI_PKITruststore **tru
 
 	tmp->ctx = ctx;
 	tmp->store = NULL;
+	tmp->verCache = NULL;
 
 	tmp->store = X509_STORE_new();
 	if (tmp->store == NULL) {
@@ -219,6 +233,12 @@ int KSI_PKITruststore_new(KSI_CTX *ctx, int setDefaults, KSI_PKITruststore **tru
 		goto cleanup;
 	}
 
+	res = KSI_PKIVerificationCache_new(ctx, &tmp->verCache);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
 	if (setDefaults) {
 		/* Set system default paths. */
 		if (!X509_STORE_set_default_paths(tmp->store)) {
@@ -1024,6 +1044,8 @@ int KSI_PKITruststore_verifyRawSignature(KSI_CTX *ctx, const unsigned char *data
 	X509 *x509 = NULL;
 	const EVP_MD *evp_md;
 	EVP_PKEY *pubKey = NULL;
+	KSI_PKIVerificationCache *cache = NULL;
+	KSI_PKIVerificationKey cacheKey;
 
 	/* Needs to be initialized before jumping to cleanup. */
 	EVP_MD_CTX_init(&md_ctx);
@@ -1042,6 +1064,18 @@ int KSI_PKITruststore_verifyRawSignature(KSI_CTX *ctx, const unsigned char *data
 
 	KSI_LOG_debug(ctx, "Verifying PKI signature.");
 
+	/* Skip the asymmetric crypto, if the same signature has already been verified. */
+	if (ctx->pkiTruststore != NULL) {
+		cache = ctx->pkiTruststore->verCache;
+		if (KSI_PKIVerificationCache_getKey(cache, data, data_len, algoOid, signature, signature_len, certificate, &cacheKey) != KSI_OK) {
+			cache = NULL;
+		} else if (KSI_PKIVerificationCache_contains(cache, &cacheKey)) {
+			KSI_LOG_debug(ctx, "PKI signature verification result found in cache.");
+			res = KSI_OK;
+			goto cleanup;
+		}
+	}
+
 	x509 = certificate->x509;
 
 	algorithm = OBJ_txt2obj(algoOid, 1);
@@ -1091,6 +1125,8 @@ int KSI_PKITruststore_verifyRawSignature(KSI_CTX *ctx, const unsigned char *data
 
 	KSI_LOG_debug(certificate->ctx, "PKI signature verified successfully.");
 
+	KSI_PKIVerificationCache_add(cache, &cacheKey);
+
 	res = KSI_OK;
 
 cleanup:
@@ -23,6 +23,7 @@
 #include "hashchain.h"
 #include "signature_impl.h"
 #include "ctx_impl.h"
+#include "counters_impl.h"
 
 #include <string.h>
 
@@ -32,6 +33,39 @@ static void VerificationTempData_clear(VerificationTempData *tmp);
 KSI_IMPLEMENT_LIST(KSI_RuleVerificationResult, RuleVerificationResult_free);
 KSI_IMPLEMENT_REF(KSI_PolicyVerificationResult);
 
+/** Capacity of the #RuleNameSet. */
+#define RULE_NAME_SET_SIZE 64
+
+/**
+ * Set of rule name pointers already present in the rule results. Once the set is full, the
+ * remaining names are looked up from the result list itself.
+ */
+typedef struct RuleNameSet_st {
+	const char *names[RULE_NAME_SET_SIZE];
+	size_t count;
+} RuleNameSet;
+
+/**
+ * A single step of a compiled policy. As composite rules only decide which rule is evaluated
+ * next, they are resolved at compile time into the jump targets of the basic rules.
+ */
+typedef struct PolicyInstruction_st {
+	/** The basic rule, \c NULL if the step aborts the verification with \c error. */
+	Verifier verifier;
+	/** Status code returned by an aborting step. */
+	int error;
+	/** Index of the next step, if the rule result is #KSI_VER_RES_OK. */
+	size_t onOk;
+	/** Index of the next step, if the rule result is #KSI_VER_RES_NA. */
+	size_t onNa;
+} PolicyInstruction;
+
+struct PolicyProgram_st {
+	/** The steps, the program ends by jumping to \c steps_len. */
+	PolicyInstruction *steps;
+	size_t steps_len;
+};
+
 static int isDuplicateRuleResult(KSI_RuleVerificationResultList *resultList, KSI_RuleVerificationResult *result) {
 	int return_value = 0;
 	size_t i;
@@ -53,16 +87,46 @@ cleanup:
 	return return_value;
 }
 
-static int PolicyVerificationResult_addLatestRuleResult(KSI_PolicyVerificationResult *result) {
+/**
+ * Checks if the rule name is in the set and adds it otherwise. Returns 1 if the name was
+ * already present, 0 if it was added and -1 if the set was not able to answer.
+ */
+static int RuleNameSet_add(RuleNameSet *set, const char *name) {
+	size_t i;
+
+	if (set == NULL || name == NULL) return -1;
+
+	i = ((size_t)name >> 3) % RULE_NAME_SET_SIZE;
+	while (set->names[i] != NULL) {
+		if (set->names[i] == name) return 1;
+		i = (i + 1) % RULE_NAME_SET_SIZE;
+	}
+
+	/* Keep one slot empty to terminate the probing. */
+	if (set->count + 1 >= RULE_NAME_SET_SIZE) return -1;
+
+	set->names[i] = name;
+	set->count++;
+
+	return 0;
+}
+
+static int PolicyVerificationResult_addLatestRuleResult(KSI_PolicyVerificationResult *result, RuleNameSet *names) {
 	int res = KSI_UNKNOWN_ERROR;
 	KSI_RuleVerificationResult *tmp = NULL;
+	int isDuplicate;
 
 	if (result == NULL) {
 		res = KSI_INVALID_ARGUMENT;
 		goto cleanup;
 	}
 
-	if (isDuplicateRuleResult(result->ruleResults, &result->finalResult) == 0) {
+	isDuplicate = RuleNameSet_add(names, result->finalResult.ruleName);
+	if (isDuplicate < 0) {
+		isDuplicate = isDuplicateRuleResult(result->ruleResults, &result->finalResult);
+	}
+
+	if (isDuplicate == 0) {
 		tmp = KSI_new(KSI_RuleVerificationResult);
 		if (tmp == NULL) {
 			res = KSI_OUT_OF_MEMORY;
@@ -81,46 +145,158 @@ cleanup:
 	return res;
 }
 
-static int Rule_verify(const KSI_Rule *rule, KSI_VerificationContext *context, KSI_PolicyVerificationResult *policyResult) {
-	int res = KSI_UNKNOWN_ERROR;
-	const KSI_Rule *currentRule = NULL;
+/* Returns the number of steps the rule list is compiled into. */
+static size_t RuleList_countSteps(const KSI_Rule *rules);
 
-	if (rule == NULL || context == NULL || policyResult == NULL) {
-		res = KSI_INVALID_ARGUMENT;
-		goto cleanup;
+static size_t Rule_countSteps(const KSI_Rule *rule) {
+	if (rule->type == KSI_RULE_TYPE_COMPOSITE_AND || rule->type == KSI_RULE_TYPE_COMPOSITE_OR) {
+		return RuleList_countSteps((const KSI_Rule *)rule->rule);
 	}
+	return 1;
+}
+
+static size_t RuleList_countSteps(const KSI_Rule *rules) {
+	size_t count = 0;
+	const KSI_Rule *currentRule;
+
+	for (currentRule = rules; currentRule->rule != NULL; currentRule++) {
+		count += Rule_countSteps(currentRule);
+	}
+
+	/* An empty list is an error step. */
+	return count > 0 ? count : 1;
+}
+
+static void PolicyInstruction_setError(PolicyInstruction *step, int error) {
+	step->verifier = NULL;
+	step->error = error;
+	step->onOk = 0;
+	step->onNa = 0;
+}
+
+/**
+ * Compiles the rule list into the steps starting at \c pos. The list is left for \c onOk or
+ * \c onNa, depending on the result it ends with - the same way #KSI_RULE_TYPE_BASIC and the
+ * composite rules stop or continue the evaluation of the list they are in.
+ */
+static void RuleList_compile(const KSI_Rule *rules, PolicyInstruction *steps, size_t pos, size_t onOk, size_t onNa) {
+	const KSI_Rule *currentRule;
+
+	if (rules->rule == NULL) {
+		PolicyInstruction_setError(&steps[pos], KSI_UNKNOWN_ERROR);
+		return;
+	}
+
+	for (currentRule = rules; currentRule->rule != NULL; currentRule++) {
+		size_t next = pos + Rule_countSteps(currentRule);
+		int isLast = (currentRule + 1)->rule == NULL;
+		/* If a rule succeeds, the following OR-type rules should be skipped. */
+		size_t okTarget = (isLast || currentRule->type == KSI_RULE_TYPE_COMPOSITE_OR) ? onOk : next;
+		/* If an OR-type rule result is not conclusive, the next rule should be processed. */
+		size_t naTarget = (isLast || currentRule->type != KSI_RULE_TYPE_COMPOSITE_OR) ? onNa : next;
 
-	currentRule = rule;
-	while (currentRule->rule) {
-		policyResult->finalResult.resultCode = KSI_VER_RES_NA;
-		policyResult->finalResult.errorCode = KSI_VER_ERR_GEN_2;
 		switch (currentRule->type) {
 			case KSI_RULE_TYPE_BASIC:
-				res = ((Verifier)(currentRule->rule))(context, &policyResult->finalResult);
-				KSI_LOG_debug(context->ctx, "Rule result: 0x%x 0x%x 0x%x %s %s",
-							  res,
-							  policyResult->finalResult.resultCode,
-							  policyResult->finalResult.errorCode,
-							  policyResult->finalResult.ruleName,
-							  policyResult->finalResult.policyName);
+				steps[pos].verifier = (Verifier)(currentRule->rule);
+				steps[pos].error = KSI_OK;
+				steps[pos].onOk = okTarget;
+				steps[pos].onNa = naTarget;
 				break;
 
 			case KSI_RULE_TYPE_COMPOSITE_AND:
 			case KSI_RULE_TYPE_COMPOSITE_OR:
-				res = Rule_verify((KSI_Rule *)currentRule->rule, context, policyResult);
+				RuleList_compile((const KSI_Rule *)currentRule->rule, steps, pos, okTarget, naTarget);
 				break;
 
 			default:
-				res = KSI_INVALID_ARGUMENT;
+				PolicyInstruction_setError(&steps[pos], KSI_INVALID_ARGUMENT);
 				break;
 		}
 
+		pos = next;
+	}
+}
+
+static int PolicyProgram_compile(const KSI_Rule *rules, PolicyProgram **program) {
+	int res = KSI_UNKNOWN_ERROR;
+	PolicyProgram *tmp = NULL;
+
+	if (rules == NULL || program == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	tmp = KSI_new(PolicyProgram);
+	if (tmp == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	tmp->steps_len = RuleList_countSteps(rules);
+	tmp->steps = KSI_calloc(tmp->steps_len, sizeof(PolicyInstruction));
+	if (tmp->steps == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	RuleList_compile(rules, tmp->steps, 0, tmp->steps_len, tmp->steps_len);
+
+	*program = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	PolicyProgram_free(tmp);
+
+	return res;
+}
+
+void PolicyProgram_free(PolicyProgram *program) {
+	if (program != NULL) {
+		KSI_free(program->steps);
+		KSI_free(program);
+	}
+}
+
+static int PolicyProgram_run(const PolicyProgram *program, KSI_VerificationContext *context, KSI_PolicyVerificationResult *policyResult, RuleNameSet *names) {
+	int res = KSI_UNKNOWN_ERROR;
+	size_t pos = 0;
+
+	if (program == NULL || context == NULL || policyResult == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	while (pos < program->steps_len) {
+		const PolicyInstruction *step = &program->steps[pos];
+
+		policyResult->finalResult.resultCode = KSI_VER_RES_NA;
+		policyResult->finalResult.errorCode = KSI_VER_ERR_GEN_2;
+
+		if (step->verifier == NULL) {
+			policyResult->resultCode = policyResult->finalResult.resultCode;
+			res = step->error;
+			break;
+		}
+
+		res = step->verifier(context, &policyResult->finalResult);
+		KSI_Counters_addRule(context->ctx, policyResult->finalResult.ruleName,
+				res != KSI_OK || policyResult->finalResult.resultCode == KSI_VER_RES_FAIL);
+		KSI_LOG_debug(context->ctx, "Rule result: 0x%x 0x%x 0x%x %s %s",
+					  res,
+					  policyResult->finalResult.resultCode,
+					  policyResult->finalResult.errorCode,
+					  policyResult->finalResult.ruleName,
+					  policyResult->finalResult.policyName);
+
 		/* Duplicate the value for ease of use. */
 		policyResult->resultCode = policyResult->finalResult.resultCode;
 
-		if (currentRule->type == KSI_RULE_TYPE_BASIC && !(res == KSI_OK && policyResult->resultCode == KSI_VER_RES_NA)) {
+		if (((VerificationTempData *)context->tempData)->resultDetail == KSI_VER_DETAIL_RULES && !(res == KSI_OK && policyResult->resultCode == KSI_VER_RES_NA)) {
 			/* For better readability, only add results of basic rules which do not confirm lack or existence of a component. */
-			PolicyVerificationResult_addLatestRuleResult(policyResult);
+			PolicyVerificationResult_addLatestRuleResult(policyResult, names);
 		}
 
 		if (res != KSI_OK) {
@@ -129,18 +305,9 @@ static int Rule_verify(const KSI_Rule *rule, KSI_VerificationContext *context, K
 		} else if (policyResult->resultCode == KSI_VER_RES_FAIL) {
 			/* If a rule fails, no more rules in the policy should be processed. */
 			break;
-		} else if (policyResult->resultCode == KSI_VER_RES_OK) {
-			/* If a rule succeeds, the following OR-type rules should be skipped. */
-			if (currentRule->type == KSI_RULE_TYPE_COMPOSITE_OR) {
-				break;
-			}
-		} else /* if (ruleResult.resultCode == VER_RES_NA) */ {
-			/* If an OR-type rule result is not conclusive, the next rule should be processed. */
-			if (currentRule->type == KSI_RULE_TYPE_BASIC || currentRule->type == KSI_RULE_TYPE_COMPOSITE_AND) {
-				break;
-			}
 		}
-		currentRule++;
+
+		pos = (policyResult->resultCode == KSI_VER_RES_OK) ? step->onOk : step->onNa;
 	}
 
 cleanup:
@@ -167,7 +334,8 @@ static const KSI_Rule emptyRules[] = {
 static const KSI_Policy PolicyEmpty = {
 	emptyRules,
 	NULL,
-	"EmptyPolicy"
+	"EmptyPolicy",
+	NULL
 };
 
 const KSI_Policy* KSI_VERIFICATION_POLICY_EMPTY = &PolicyEmpty;
@@ -265,7 +433,8 @@ static const KSI_Rule internalRules[] = {
 static const KSI_Policy PolicyInternal = {
 	internalRules,
 	NULL,
-	"InternalPolicy"
+	"InternalPolicy",
+	NULL
 };
 
 const KSI_Policy* KSI_VERIFICATION_POLICY_INTERNAL = &PolicyInternal;
@@ -323,7 +492,8 @@ static const KSI_Rule calendarBasedRules[] = {
 static const KSI_Policy PolicyCalendarBased = {
 	calendarBasedRules,
 	NULL,
-	"CalendarBasedPolicy"
+	"CalendarBasedPolicy",
+	NULL
 };
 
 const KSI_Policy* KSI_VERIFICATION_POLICY_CALENDAR_BASED = &PolicyCalendarBased;
@@ -344,7 +514,8 @@ static const KSI_Rule keyBasedRules[] = {
 static const KSI_Policy PolicyKeyBased = {
 	keyBasedRules,
 	NULL,
-	"KeyBasedPolicy"
+	"KeyBasedPolicy",
+	NULL
 };
 
 const KSI_Policy* KSI_VERIFICATION_POLICY_KEY_BASED = &PolicyKeyBased;
@@ -383,7 +554,8 @@ static const KSI_Rule publicationsFileBasedRules[] = {
 static const KSI_Policy PolicyPublicationsFileBased = {
 	publicationsFileBasedRules,
 	NULL,
-	"PublicationsFileBasedPolicy"
+	"PublicationsFileBasedPolicy",
+	NULL
 };
 
 const KSI_Policy* KSI_VERIFICATION_POLICY_PUBLICATIONS_FILE_BASED = &PolicyPublicationsFileBased;
@@ -423,7 +595,8 @@ static const KSI_Rule userProvidedPublicationBasedRules[] = {
 static const KSI_Policy PolicyUserPublicationBased = {
 	userProvidedPublicationBasedRules,
 	NULL,
-	"UserProvidedPublicationBasedPolicy"
+	"UserProvidedPublicationBasedPolicy",
+	NULL
 };
 
 const KSI_Policy* KSI_VERIFICATION_POLICY_USER_PUBLICATION_BASED = &PolicyUserPublicationBased;
@@ -445,7 +618,8 @@ static const KSI_Rule generalRules[] = {
 static const KSI_Policy PolicyGeneral = {
 	generalRules,
 	NULL,
-	"GeneralPolicy"
+	"GeneralPolicy",
+	NULL
 };
 
 const KSI_Policy* KSI_VERIFICATION_POLICY_GENERAL = &PolicyGeneral;
@@ -522,6 +696,14 @@ int KSI_Policy_create(KSI_CTX *ctx, const KSI_Rule *rules, const char *name, KSI
 	tmp->rules = rules;
 	tmp->policyName = name;
 	tmp->fallbackPolicy = NULL;
+	tmp->program = NULL;
+
+	res = PolicyProgram_compile(rules, &tmp->program);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
 	*policy = tmp;
 	tmp = NULL;
 
@@ -552,6 +734,14 @@ int KSI_Policy_clone(KSI_CTX *ctx, const KSI_Policy *policy, KSI_Policy **clone)
 	tmp->rules = policy->rules;
 	tmp->fallbackPolicy = policy->fallbackPolicy;
 	tmp->policyName = policy->policyName;
+	tmp->program = NULL;
+
+	res = PolicyProgram_compile(tmp->rules, &tmp->program);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
 	*clone = tmp;
 	tmp = NULL;
 
@@ -632,15 +822,68 @@ cleanup:
 	return res;
 }
 
-static int Policy_verifySignature(const KSI_Policy *policy, KSI_VerificationContext *context, KSI_PolicyVerificationResult *policyResult) {
+static const KSI_Policy *predefinedPolicies[POLICY_NUM_OF_PREDEFINED] = {
+	&PolicyEmpty,
+	&PolicyInternal,
+	&PolicyCalendarBased,
+	&PolicyKeyBased,
+	&PolicyPublicationsFileBased,
+	&PolicyUserPublicationBased,
+	&PolicyGeneral
+};
+
+static int Policy_verifySignature(const KSI_Policy *policy, KSI_VerificationContext *context, KSI_PolicyVerificationResult *policyResult, RuleNameSet *names) {
 	int res = KSI_UNKNOWN_ERROR;
+	const PolicyProgram *program = NULL;
+	PolicyProgram *tmp = NULL;
+	size_t i;
 
 	if (policy == NULL || policy->rules == NULL || context == NULL || context->ctx == NULL || policyResult == NULL) {
 		res = KSI_INVALID_ARGUMENT;
 		goto cleanup;
 	}
 
-	res = Rule_verify(policy->rules, context, policyResult);
+	program = policy->program;
+	if (program == NULL) {
+		/* The predefined policies are constant, so their programs are kept in the context. */
+		for (i = 0; i < POLICY_NUM_OF_PREDEFINED; i++) {
+			if (policy != predefinedPolicies[i]) continue;
+
+			KSI_Mutex_lock(context->ctx->lock);
+			if (context->ctx->policyPrograms[i] == NULL) {
+				res = PolicyProgram_compile(policy->rules, &context->ctx->policyPrograms[i]);
+			}
+			program = context->ctx->policyPrograms[i];
+			KSI_Mutex_unlock(context->ctx->lock);
+
+			if (program == NULL) goto cleanup;
+			break;
+		}
+	}
+
+	if (program == NULL) {
+		/* Not created with KSI_Policy_create nor KSI_Policy_clone, look up the program by the rules. */
+		KSI_Mutex_lock(context->ctx->lock);
+		for (i = 0; i < POLICY_NUM_OF_CACHED; i++) {
+			if (context->ctx->policyCacheRules[i] == policy->rules) break;
+			if (context->ctx->policyCacheRules[i] == NULL) {
+				res = PolicyProgram_compile(policy->rules, &context->ctx->policyCachePrograms[i]);
+				if (res == KSI_OK) context->ctx->policyCacheRules[i] = policy->rules;
+				break;
+			}
+		}
+		if (i < POLICY_NUM_OF_CACHED) program = context->ctx->policyCachePrograms[i];
+		KSI_Mutex_unlock(context->ctx->lock);
+	}
+
+	if (program == NULL) {
+		/* The cache is full, compile for this run only. */
+		res = PolicyProgram_compile(policy->rules, &tmp);
+		if (res != KSI_OK) goto cleanup;
+		program = tmp;
+	}
+
+	res = PolicyProgram_run(program, context, policyResult, names);
 	KSI_LOG_debug(context->ctx, "Policy result: 0x%x 0x%x 0x%x %s %s",
 				  res,
 				  policyResult->finalResult.resultCode,
@@ -651,6 +894,8 @@ static int Policy_verifySignature(const KSI_Policy *policy, KSI_VerificationCont
 
 cleanup:
 
+	PolicyProgram_free(tmp);
+
 	return res;
 }
 
@@ -672,16 +917,24 @@ cleanup:
 }
 
 int KSI_SignatureVerifier_verify(const KSI_Policy *policy, KSI_VerificationContext *context, KSI_PolicyVerificationResult **result) {
+	return KSI_SignatureVerifier_verifyWithDetail(policy, context, KSI_VER_DETAIL_RULES, result);
+}
+
+int KSI_SignatureVerifier_verifyWithDetail(const KSI_Policy *policy, KSI_VerificationContext *context, int detail, KSI_PolicyVerificationResult **result) {
 	const KSI_Policy *currentPolicy;
 	int res = KSI_UNKNOWN_ERROR;
 	KSI_CTX *ctx = NULL;
 	KSI_PolicyVerificationResult *tmp = NULL;
 	VerificationTempData tempData;
+	RuleNameSet names;
+	KSI_Signature **lastFailedSignature = NULL;
 
 	memset(&tempData, 0, sizeof(tempData));
+	memset(&names, 0, sizeof(names));
 	tempData.aggregationOutputHash = NULL;
 	tempData.calendarChain = NULL;
 	tempData.publicationsFile = NULL;
+	tempData.resultDetail = detail;
 
 	if (policy == NULL || context == NULL || context->ctx == NULL || result == NULL) {
 		res = KSI_INVALID_ARGUMENT;
@@ -694,11 +947,17 @@ int KSI_SignatureVerifier_verify(const KSI_Policy *policy, KSI_VerificationConte
 	ctx = context->ctx;
 	KSI_ERR_clearErrors(ctx);
 
-	KSI_Signature_free(ctx->lastFailedSignature);
-	ctx->lastFailedSignature = KSI_Signature_ref(context->signature);
-	if (ctx->lastFailedSignature != NULL) {
-		KSI_PolicyVerificationResult_free(ctx->lastFailedSignature->policyVerificationResult);
-		ctx->lastFailedSignature->policyVerificationResult = NULL;
+	lastFailedSignature = KSI_CTX_lastFailedSignature(ctx);
+	if (lastFailedSignature == NULL) {
+		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+	KSI_Signature_free(*lastFailedSignature);
+	*lastFailedSignature = KSI_Signature_ref(context->signature);
+	if (*lastFailedSignature != NULL) {
+		KSI_PolicyVerificationResult_free((*lastFailedSignature)->policyVerificationResult);
+		(*lastFailedSignature)->policyVerificationResult = NULL;
 	}
 
 	res = PolicyVerificationResult_create(&tmp);
@@ -717,7 +976,7 @@ int KSI_SignatureVerifier_verify(const KSI_Policy *policy, KSI_VerificationConte
 	currentPolicy = policy;
 	while (currentPolicy != NULL) {
 		tmp->finalResult.policyName = currentPolicy->policyName;
-		res = Policy_verifySignature(currentPolicy, context, tmp);
+		res = Policy_verifySignature(currentPolicy, context, tmp, &names);
 		if (res != KSI_OK) {
 			/* Stop verifying the policy whenever there is an internal error (invalid arguments, out of memory, etc). */
 			KSI_pushError(ctx, res, NULL);
@@ -733,7 +992,9 @@ int KSI_SignatureVerifier_verify(const KSI_Policy *policy, KSI_VerificationConte
 		if (tmp->finalResult.resultCode != KSI_VER_RES_OK) {
 			currentPolicy = currentPolicy->fallbackPolicy;
 			if (currentPolicy != NULL) {
-				VerificationTempData_clear(context->tempData);
+				/* The fallback policy may extend the signature to another time, but the memoized values are kept. */
+				KSI_CalendarHashChain_free(tempData.calendarChain);
+				tempData.calendarChain = NULL;
 				KSI_LOG_debug(ctx, "Verifying fallback policy.");
 			}
 		} else {
@@ -742,12 +1003,12 @@ int KSI_SignatureVerifier_verify(const KSI_Policy *policy, KSI_VerificationConte
 	}
 
 	if (tmp->finalResult.resultCode != KSI_VER_RES_OK) {
-		if (ctx->lastFailedSignature != NULL) {
-			ctx->lastFailedSignature->policyVerificationResult = KSI_PolicyVerificationResult_ref(tmp);
+		if (*lastFailedSignature != NULL) {
+			(*lastFailedSignature)->policyVerificationResult = KSI_PolicyVerificationResult_ref(tmp);
 		}
 	} else {
-		KSI_Signature_free(ctx->lastFailedSignature);
-		ctx->lastFailedSignature = NULL;
+		KSI_Signature_free(*lastFailedSignature);
+		*lastFailedSignature = NULL;
 	}
 
 	*result = tmp;
@@ -767,11 +1028,14 @@ cleanup:
 }
 
 void KSI_Policy_free(KSI_Policy *policy) {
-	KSI_free(policy);
+	if (policy != NULL) {
+		PolicyProgram_free(policy->program);
+		KSI_free(policy);
+	}
 }
 
 void KSI_PolicyVerificationResult_free(KSI_PolicyVerificationResult *result) {
-	if (result != NULL && --result->ref == 0) {
+	if (result != NULL && KSI_REF_DECREMENT(result) == 0) {
 		KSI_RuleVerificationResultList_free(result->ruleResults);
 		KSI_RuleVerificationResultList_free(result->policyResults);
 		KSI_free(result);
@@ -788,9 +1052,40 @@ static void VerificationTempData_clear(VerificationTempData *tmp) {
 
 		KSI_PublicationsFile_free(tmp->publicationsFile);
 		tmp->publicationsFile = NULL;
+
+		VerificationMemo_clear(&tmp->memo);
 	}
 }
 
+void VerificationMemo_clear(VerificationMemo *memo) {
+	size_t i;
+
+	if (memo != NULL) {
+		KSI_DataHash_free(memo->calendarRootHash);
+		for (i = 0; i < memo->extendedChains_count; i++) {
+			KSI_CalendarHashChain_free(memo->extendedChains[i]);
+		}
+		KSI_PublicationRecord_free(memo->nearestPublication);
+
+		memset(memo, 0, sizeof(VerificationMemo));
+	}
+}
+
+VerificationMemo *VerificationTempData_getMemo(KSI_VerificationContext *context) {
+	VerificationTempData *tempData = NULL;
+
+	if (context == NULL || context->tempData == NULL) return NULL;
+	tempData = context->tempData;
+
+	if (tempData->memo.signature != context->signature || tempData->memo.docAggrLevel != context->docAggrLevel) {
+		VerificationMemo_clear(&tempData->memo);
+		tempData->memo.signature = context->signature;
+		tempData->memo.docAggrLevel = context->docAggrLevel;
+	}
+
+	return &tempData->memo;
+}
+
 void KSI_VerificationContext_clean(KSI_VerificationContext *context) {
 	if (context != NULL) {
 		if (context->tempData != NULL) {
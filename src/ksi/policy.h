@@ -194,7 +194,9 @@ extern "C" {
 	/**
 	 * Creates a policy based on user defined rules. User gets ownership of the policy and
 	 * is responsible for freeing the policy later with #KSI_Policy_free. As the policy owner,
-	 * the user is free to set a fallback policy with #KSI_Policy_setFallback.
+	 * the user is free to set a fallback policy with #KSI_Policy_setFallback. The rules are
+	 * compiled into a flat evaluation program when the policy is created, so the rules may not
+	 * be changed afterwards.
 	 *
 	 * \param[in]	ctx		KSI context.
 	 * \param[in]	rules	Pointer to user defined rules to be assigned to the policy.
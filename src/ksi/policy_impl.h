@@ -30,12 +30,74 @@ extern "C" {
 
 typedef int (*Verifier)(KSI_VerificationContext *, KSI_RuleVerificationResult *);
 
+/** Flat evaluation program compiled from the nested rules of a policy. */
+typedef struct PolicyProgram_st PolicyProgram;
+
+/** Number of predefined policies, whose programs are kept in the #KSI_CTX. */
+#define POLICY_NUM_OF_PREDEFINED 7
+
+/** Number of policies built by hand from the struct, whose programs are kept in the #KSI_CTX. */
+#define POLICY_NUM_OF_CACHED 8
+
+/**
+ * Enumeration of the levels of detail of the #KSI_PolicyVerificationResult.
+ */
+typedef enum VerificationResultDetail_en {
+	/** The results of the individual rules are collected into \c ruleResults. */
+	KSI_VER_DETAIL_RULES = 0,
+	/** Only the final result and the results of the individual policies are collected. */
+	KSI_VER_DETAIL_POLICIES = 1,
+} VerificationResultDetail;
+
 struct KSI_Policy_st {
 	const KSI_Rule *rules;
 	const KSI_Policy *fallbackPolicy;
 	const char *policyName;
+	/** Compiled rules of a user created or cloned policy, \c NULL for predefined policies and the
+	 * ones built by hand. The programs of the latter are kept in the #KSI_CTX by their \c rules,
+	 * so such rules may not be changed while the context is in use. */
+	PolicyProgram *program;
 };
 
+/** Number of extender responses remembered during a single verification. */
+#define VERIFICATION_MEMO_EXT_CHAINS 4
+
+/**
+ * Values derived from the signature, which are shared by all the policies of a fallback chain.
+ * The values are only valid for the signature and aggregation level they were computed for.
+ */
+typedef struct VerificationMemo_st {
+	/** The signature the values belong to. */
+	const KSI_Signature *signature;
+
+	/** The initial aggregation level the values were computed with. */
+	KSI_uint64_t docAggrLevel;
+
+	/** Set, if the aggregation hash chains have been verified to aggregate into \c aggregationOutputHash. */
+	int aggregationChainVerified;
+
+	/** Root hash of the signature calendar hash chain. */
+	KSI_DataHash *calendarRootHash;
+
+	/** Calendar hash chains received from the extender. */
+	KSI_CalendarHashChain *extendedChains[VERIFICATION_MEMO_EXT_CHAINS];
+
+	/** Publication times the chains were extended to, 0 for the calendar head. */
+	KSI_uint64_t extendedChainTimes[VERIFICATION_MEMO_EXT_CHAINS];
+
+	/** Number of the extended chains. */
+	size_t extendedChains_count;
+
+	/** Publication record found from the publications file for \c nearestPublicationTime. */
+	KSI_PublicationRecord *nearestPublication;
+
+	/** Time used for looking up the \c nearestPublication. */
+	KSI_uint64_t nearestPublicationTime;
+
+	/** Publications file the \c nearestPublication was found from. */
+	const KSI_PublicationsFile *nearestPublicationFile;
+} VerificationMemo;
+
 typedef struct VerificationTempData_st {
 
 	/** Temporary extended signature calendar hash chain. */
@@ -46,8 +108,38 @@ typedef struct VerificationTempData_st {
 
 	/** Signature aggregation output hash (calendar chain input hash) */
 	KSI_DataHash *aggregationOutputHash;
+
+	/** Memoized values, which are kept when switching to a fallback policy. */
+	VerificationMemo memo;
+
+	/** Level of detail of the verification result, see #VerificationResultDetail. */
+	int resultDetail;
 } VerificationTempData;
 
+void PolicyProgram_free(PolicyProgram *program);
+
+/**
+ * Verifies the signature like #KSI_SignatureVerifier_verify, collecting the results with the
+ * given level of detail. The library uses #KSI_VER_DETAIL_POLICIES when only the final result
+ * is looked at.
+ * \param[in]	policy		Policy to be verified.
+ * \param[in]	context		Verification context.
+ * \param[in]	detail		Level of detail of the result, see #VerificationResultDetail.
+ * \param[out]	result		Verification result.
+ * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+ */
+int KSI_SignatureVerifier_verifyWithDetail(const KSI_Policy *policy, KSI_VerificationContext *context, int detail, KSI_PolicyVerificationResult **result);
+
+/**
+ * Returns the memoized values of the temporary data, resetting them if they were computed
+ * for another signature or aggregation level than the one in \c context.
+ */
+VerificationMemo *VerificationTempData_getMemo(KSI_VerificationContext *context);
+
+/**
+ * Frees the memoized values of the temporary data.
+ */
+void VerificationMemo_clear(VerificationMemo *memo);
 
 #ifdef	__cplusplus
 }
@@ -510,7 +510,7 @@ cleanup:
 }
 
 void KSI_PublicationsFile_free(KSI_PublicationsFile *t) {
-	if (t != NULL && --t->ref == 0) {
+	if (t != NULL && KSI_REF_DECREMENT(t) == 0) {
 		KSI_PublicationsHeader_free(t->header);
 		KSI_CertificateRecordList_free(t->certificates);
 		KSI_PublicationRecordList_free(t->publications);
@@ -1203,7 +1203,7 @@ cleanup:
  * KSI_PublicationData
  */
 void KSI_PublicationData_free(KSI_PublicationData *t) {
-	if (t != NULL && --t->ref == 0) {
+	if (t != NULL && KSI_REF_DECREMENT(t) == 0) {
 		KSI_Integer_free(t->time);
 		KSI_DataHash_free(t->imprint);
 		KSI_TLV_free(t->baseTlv);
@@ -1303,7 +1303,7 @@ KSI_IMPLEMENT_TOTLV(KSI_PublicationData);
  * KSI_PublicationRecord
  */
 void KSI_PublicationRecord_free(KSI_PublicationRecord *t) {
-	if (t != NULL && --t->ref == 0) {
+	if (t != NULL && KSI_REF_DECREMENT(t) == 0) {
 		KSI_PublicationData_free(t->publishedData);
 		KSI_Utf8StringList_free(t->publicationRef);
 		KSI_Utf8StringList_free(t->repositoryUriList);
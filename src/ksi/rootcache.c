@@ -0,0 +1,191 @@
+/*
+ * Copyright 2013-2015 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+
+#include <string.h>
+
+#include "internal.h"
+#include "rootcache.h"
+#include "thread.h"
+
+typedef struct KSI_CalendarRootCacheEntry_st {
+	KSI_uint64_t time;
+	unsigned char imprint[KSI_MAX_IMPRINT_LEN];
+	size_t imprint_len;
+	int proof;
+	unsigned char aux[KSI_MAX_IMPRINT_LEN];
+	size_t aux_len;
+	size_t generation;
+	int used;
+} KSI_CalendarRootCacheEntry;
+
+struct KSI_CalendarRootCache_st {
+	KSI_CTX *ctx;
+	KSI_Mutex *lock;
+	/* Generation of the publications file, entries from earlier generations are stale. */
+	size_t generation;
+	KSI_CalendarRootCacheEntry entries[KSI_CALENDAR_ROOT_CACHE_SIZE];
+};
+
+int KSI_CalendarRootCache_new(KSI_CTX *ctx, KSI_CalendarRootCache **cache) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_CalendarRootCache *tmp = NULL;
+
+	if (ctx == NULL || cache == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	tmp = KSI_new(KSI_CalendarRootCache);
+	if (tmp == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	memset(tmp, 0, sizeof(KSI_CalendarRootCache));
+	tmp->ctx = ctx;
+
+	res = KSI_Mutex_new(ctx, &tmp->lock);
+	if (res != KSI_OK) goto cleanup;
+
+	*cache = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_CalendarRootCache_free(tmp);
+
+	return res;
+}
+
+void KSI_CalendarRootCache_free(KSI_CalendarRootCache *cache) {
+	if (cache != NULL) {
+		KSI_Mutex_free(cache->lock);
+		KSI_free(cache);
+	}
+}
+
+void KSI_CalendarRootCache_invalidate(KSI_CalendarRootCache *cache) {
+	if (cache != NULL) {
+		KSI_Mutex_lock(cache->lock);
+		cache->generation++;
+		KSI_Mutex_unlock(cache->lock);
+	}
+}
+
+static int getEntryKey(const KSI_PublicationData *pubData, const KSI_DataHash *aux, KSI_CalendarRootCacheEntry *key) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_Integer *time = NULL;
+	KSI_DataHash *hsh = NULL;
+	const unsigned char *imprint = NULL;
+	size_t imprint_len = 0;
+
+	res = KSI_PublicationData_getTime(pubData, &time);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_PublicationData_getImprint(pubData, &hsh);
+	if (res != KSI_OK) goto cleanup;
+
+	if (time == NULL || hsh == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	res = KSI_DataHash_getImprint(hsh, &imprint, &imprint_len);
+	if (res != KSI_OK) goto cleanup;
+
+	if (imprint_len > sizeof(key->imprint)) {
+		res = KSI_BUFFER_OVERFLOW;
+		goto cleanup;
+	}
+
+	key->time = KSI_Integer_getUInt64(time);
+	memcpy(key->imprint, imprint, imprint_len);
+	key->imprint_len = imprint_len;
+	key->aux_len = 0;
+
+	if (aux != NULL) {
+		res = KSI_DataHash_getImprint(aux, &imprint, &imprint_len);
+		if (res != KSI_OK) goto cleanup;
+
+		if (imprint_len > sizeof(key->aux)) {
+			res = KSI_BUFFER_OVERFLOW;
+			goto cleanup;
+		}
+
+		memcpy(key->aux, imprint, imprint_len);
+		key->aux_len = imprint_len;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+static size_t getSlot(const KSI_CalendarRootCacheEntry *key) {
+	size_t slot = (size_t)key->time;
+	size_t i;
+
+	/* Mix in the tail of the root hash, as several roots may share a publication time. */
+	for (i = key->imprint_len > 4 ? key->imprint_len - 4 : 0; i < key->imprint_len; i++) {
+		slot = slot * 31 + key->imprint[i];
+	}
+
+	return (slot + (size_t)key->proof) % KSI_CALENDAR_ROOT_CACHE_SIZE;
+}
+
+int KSI_CalendarRootCache_contains(KSI_CalendarRootCache *cache, const KSI_PublicationData *pubData, int proof, const KSI_DataHash *aux) {
+	int found = 0;
+	KSI_CalendarRootCacheEntry key;
+	const KSI_CalendarRootCacheEntry *entry = NULL;
+
+	if (cache == NULL || pubData == NULL) goto cleanup;
+
+	if (getEntryKey(pubData, aux, &key) != KSI_OK) goto cleanup;
+	key.proof = proof;
+
+	KSI_Mutex_lock(cache->lock);
+	entry = &cache->entries[getSlot(&key)];
+	found = entry->used && entry->generation == cache->generation && entry->proof == proof && entry->time == key.time &&
+			entry->imprint_len == key.imprint_len && !memcmp(entry->imprint, key.imprint, key.imprint_len) &&
+			entry->aux_len == key.aux_len && !memcmp(entry->aux, key.aux, key.aux_len);
+	KSI_Mutex_unlock(cache->lock);
+
+cleanup:
+
+	return found;
+}
+
+void KSI_CalendarRootCache_add(KSI_CalendarRootCache *cache, const KSI_PublicationData *pubData, int proof, const KSI_DataHash *aux) {
+	KSI_CalendarRootCacheEntry key;
+
+	if (cache == NULL || pubData == NULL) return;
+
+	if (getEntryKey(pubData, aux, &key) != KSI_OK) return;
+	key.proof = proof;
+
+	KSI_Mutex_lock(cache->lock);
+	key.generation = cache->generation;
+	key.used = 1;
+	cache->entries[getSlot(&key)] = key;
+	KSI_Mutex_unlock(cache->lock);
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2013-2015 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+
+#ifndef KSI_ROOTCACHE_H_
+#define KSI_ROOTCACHE_H_
+
+#include "ksi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef KSI_CALENDAR_ROOT_CACHE_SIZE
+/** Number of slots in the trusted calendar root cache. */
+#  define KSI_CALENDAR_ROOT_CACHE_SIZE 256
+#endif
+
+/** The calendar root was found in the publications file. */
+#define KSI_CALENDAR_ROOT_PROOF_PUBFILE		1
+/** The calendar root was signed by a calendar authentication record. */
+#define KSI_CALENDAR_ROOT_PROOF_AUTHREC		2
+
+	/**
+	 * Cache of calendar roots, i.e. (publication time, root hash) pairs, that have
+	 * already been proven trustworthy during the current publications file
+	 * generation. Every entry records how the root was proven, so a rule only
+	 * reuses the results of the same kind of proof. The cache may be accessed
+	 * from several threads.
+	 */
+	typedef struct KSI_CalendarRootCache_st KSI_CalendarRootCache;
+
+	/**
+	 * Creates a new empty cache.
+	 * \param[in]	ctx		KSI context.
+	 * \param[out]	cache	Pointer to the receiving pointer.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_CalendarRootCache_new(KSI_CTX *ctx, KSI_CalendarRootCache **cache);
+
+	/**
+	 * Releases the cache.
+	 * \param[in]	cache	The cache.
+	 */
+	void KSI_CalendarRootCache_free(KSI_CalendarRootCache *cache);
+
+	/**
+	 * Starts a new publications file generation, all the existing entries become invalid.
+	 * \param[in]	cache	The cache.
+	 */
+	void KSI_CalendarRootCache_invalidate(KSI_CalendarRootCache *cache);
+
+	/**
+	 * Checks if the calendar root has been proven in the current generation.
+	 * \param[in]	cache	The cache.
+	 * \param[in]	pubData	Publication time and root hash.
+	 * \param[in]	proof	Kind of the proof (#KSI_CALENDAR_ROOT_PROOF_PUBFILE or #KSI_CALENDAR_ROOT_PROOF_AUTHREC).
+	 * \param[in]	aux		Optional digest of the proof data, must match the value given to #KSI_CalendarRootCache_add.
+	 * 						For #KSI_CALENDAR_ROOT_PROOF_AUTHREC it is the digest of the serialized authentication record.
+	 * \return 1 if the root is trusted, 0 otherwise.
+	 */
+	int KSI_CalendarRootCache_contains(KSI_CalendarRootCache *cache, const KSI_PublicationData *pubData, int proof, const KSI_DataHash *aux);
+
+	/**
+	 * Records a proven calendar root. An older entry occupying the same slot is replaced.
+	 * \param[in]	cache	The cache.
+	 * \param[in]	pubData	Publication time and root hash.
+	 * \param[in]	proof	Kind of the proof (#KSI_CALENDAR_ROOT_PROOF_PUBFILE or #KSI_CALENDAR_ROOT_PROOF_AUTHREC).
+	 * \param[in]	aux		Optional digest of the proof data.
+	 */
+	void KSI_CalendarRootCache_add(KSI_CalendarRootCache *cache, const KSI_PublicationData *pubData, int proof, const KSI_DataHash *aux);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KSI_ROOTCACHE_H_ */
@@ -28,6 +28,7 @@
 #include "tlv_template.h"
 #include "hashchain.h"
 #include "net.h"
+#include "net_impl.h"
 #include "pkitruststore.h"
 #include "policy.h"
 #include "signature_builder.h"
@@ -36,6 +37,7 @@
 typedef struct headerRec_st HeaderRec;
 
 KSI_IMPORT_TLV_TEMPLATE(KSI_Signature);
+KSI_IMPORT_TLV_TEMPLATE(KSI_CalendarHashChain);
 KSI_IMPORT_TLV_TEMPLATE(KSI_PublicationRecord);
 KSI_IMPORT_TLV_TEMPLATE(KSI_AggregationHashChain);
 KSI_IMPORT_TLV_TEMPLATE(KSI_AggregationAuthRec);
@@ -48,7 +50,7 @@ KSI_IMPLEMENT_REF(KSI_Signature);
  * KSI_AggregationHashChain
  */
 void KSI_AggregationHashChain_free(KSI_AggregationHashChain *aggr) {
-	if (aggr != NULL && --aggr->ref == 0) {
+	if (aggr != NULL && KSI_REF_DECREMENT(aggr) == 0) {
 		KSI_Integer_free(aggr->aggrHashId);
 		KSI_Integer_free(aggr->aggregationTime);
 		KSI_IntegerList_free(aggr->chainIndex);
@@ -115,7 +117,6 @@ int KSI_Signature_appendAggregationChain(KSI_Signature *sig, KSI_AggregationHash
 	KSI_AggregationHashChain *pCurrent = NULL;
 	size_t listLen;
 	size_t i;
-	KSI_TLV *tlv = NULL;
 
 	if (sig == NULL || aggr == NULL) {
 		res = KSI_INVALID_ARGUMENT;
@@ -183,6 +184,15 @@ int KSI_Signature_appendAggregationChain(KSI_Signature *sig, KSI_AggregationHash
 		}
 
 
+		/* Keep the order of the elements in the serialized signature as if the changes were applied one by one. */
+		if (sig->calendarChainReplaced || sig->authRecordsReplaced) {
+			res = KSI_Signature_rebuildBaseTlv(sig);
+			if (res != KSI_OK) {
+				KSI_pushError(sig->ctx, res, NULL);
+				goto cleanup;
+			}
+		}
+
 		/* Prepend the aggregation hash chain to the signature. */
 		{
 			KSI_AggregationHashChain *ref = NULL;
@@ -196,34 +206,14 @@ int KSI_Signature_appendAggregationChain(KSI_Signature *sig, KSI_AggregationHash
 			}
 		}
 
-		res = KSI_TLV_new(sig->ctx, 0x0801, 0, 0, &tlv);
-		if (res != KSI_OK) {
-			KSI_pushError(sig->ctx, res, NULL);
-			goto cleanup;
-		}
-
-
-		/** Serialize and append the TLV structure to the signature. */
-		res = KSI_TlvTemplate_construct(sig->ctx, tlv, aggr, KSI_TLV_TEMPLATE(KSI_AggregationHashChain));
-		if (res != KSI_OK) {
-			KSI_pushError(sig->ctx, res, NULL);
-			goto cleanup;
-		}
-
-		res = KSI_TLV_appendNestedTlv(sig->baseTlv, tlv);
-		if (res != KSI_OK) {
-			KSI_pushError(sig->ctx, res, NULL);
-			goto cleanup;
-		}
-		tlv = NULL;
+		/* The base TLV is updated when the signature is serialized. */
+		sig->aggregationChainsPrepended++;
 	}
 
 	res = KSI_OK;
 
 cleanup:
 
-	KSI_TLV_free(tlv);
-
 	return res;
 }
 
@@ -357,7 +347,7 @@ KSI_IMPLEMENT_SETTER(KSI_AggregationHashChain, KSI_LIST(KSI_HashChainLink) *, ch
  * KSI_AggregationAuthRec
  */
 void KSI_AggregationAuthRec_free(KSI_AggregationAuthRec *aar) {
-	if (aar != NULL && --aar->ref == 0) {
+	if (aar != NULL && KSI_REF_DECREMENT(aar) == 0) {
 		KSI_Integer_free(aar->aggregationTime);
 		KSI_IntegerList_free(aar->chainIndexesList);
 		KSI_DataHash_free(aar->inputHash);
@@ -425,7 +415,7 @@ KSI_IMPLEMENT_LIST(KSI_AggregationAuthRec, KSI_AggregationAuthRec_free);
  */
 
 void KSI_CalendarAuthRec_free(KSI_CalendarAuthRec *calAuth) {
-	if (calAuth != NULL && --calAuth->ref == 0) {
+	if (calAuth != NULL && KSI_REF_DECREMENT(calAuth) == 0) {
 		KSI_PublicationData_free(calAuth->pubData);
 		KSI_PKISignedData_free(calAuth->signatureData);
 
@@ -483,7 +473,7 @@ KSI_IMPLEMENT_LIST(KSI_CalendarAuthRec, KSI_CalendarAuthRec_free);
  * KSI_RFC3161
  */
 void KSI_RFC3161_free(KSI_RFC3161 *rfc) {
-	if (rfc != NULL && --rfc->ref == 0) {
+	if (rfc != NULL && KSI_REF_DECREMENT(rfc) == 0) {
 		KSI_Integer_free(rfc->aggregationTime);
 		KSI_IntegerList_free(rfc->chainIndex);
 		KSI_DataHash_free(rfc->inputHash);
@@ -800,66 +790,184 @@ cleanup:
 }
 
 
-static int removeCalAuthAndPublication(KSI_Signature *sig) {
-	KSI_LIST(KSI_TLV) *nested = NULL;
+static int appendObjectTlv(KSI_CTX *ctx, KSI_TLV *parent, unsigned tag, const void *obj, const KSI_TlvTemplate *tmpl) {
+	int res = KSI_UNKNOWN_ERROR;
 	KSI_TLV *tlv = NULL;
-	int res;
-	int i;
 
-	if (sig == NULL) {
-		res = KSI_INVALID_ARGUMENT;
+	res = KSI_TLV_new(ctx, tag, 0, 0, &tlv);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_TlvTemplate_construct(ctx, tlv, obj, tmpl);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_TLV_appendNestedTlv(parent, tlv);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+	tlv = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_TLV_free(tlv);
+
+	return res;
+}
+
+/**
+ * Creates a new base TLV by applying the pending changes of the signature to its
+ * (possibly shared) base TLV. The elements of the base TLV are copied in the original
+ * order, a replaced calendar hash chain takes the place of the old one and the replaced
+ * auth records and prepended aggregation hash chains are appended to the end.
+ * If \c share is set, the unchanged elements are referenced instead of copied. As they
+ * point into the buffer of the base TLV, the result must then not outlive the base TLV.
+ */
+static int buildBaseTlv(KSI_Signature *sig, int share, KSI_TLV **out) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_TLV *tmp = NULL;
+	KSI_TLV *copy = NULL;
+	KSI_LIST(KSI_TLV) *nested = NULL;
+	int calendarChainAdded = 0;
+	size_t i;
+
+	res = KSI_TLV_new(sig->ctx, KSI_TLV_getTag(sig->baseTlv), KSI_TLV_isNonCritical(sig->baseTlv), KSI_TLV_isForward(sig->baseTlv), &tmp);
+	if (res != KSI_OK) {
+		KSI_pushError(sig->ctx, res, NULL);
 		goto cleanup;
 	}
-	KSI_ERR_clearErrors(sig->ctx);
 
 	res = KSI_TLV_getNestedList(sig->baseTlv, &nested);
 	if (res != KSI_OK) {
 		KSI_pushError(sig->ctx, res, NULL);
 		goto cleanup;
 	}
-	/* By looping in reverse order, we can safely remove elements
-	 * and continue. */
-	for (i = (int)KSI_TLVList_length(nested) - 1; i >= 0; i--) {
+
+	for (i = 0; i < KSI_TLVList_length(nested); i++) {
+		KSI_TLV *el = NULL;
 		unsigned tag;
 
-		res = KSI_TLVList_elementAt(nested, (unsigned)i, &tlv);
-		if (res != KSI_OK) {
-			KSI_pushError(sig->ctx, res, NULL);
+		res = KSI_TLVList_elementAt(nested, i, &el);
+		if (res != KSI_OK || el == NULL) {
+			KSI_pushError(sig->ctx, res = (res != KSI_OK ? res : KSI_INVALID_SIGNATURE), "Signature TLV element missing.");
 			goto cleanup;
 		}
 
-		tag = KSI_TLV_getTag(tlv);
+		tag = KSI_TLV_getTag(el);
 
-		if (tag == 0x0803 || tag == 0x0805) {
-			res = KSI_TLVList_remove(nested, (unsigned)i, NULL);
+		if (sig->calendarChainReplaced && tag == 0x0802) {
+			if (!calendarChainAdded && sig->calendarChain != NULL) {
+				res = appendObjectTlv(sig->ctx, tmp, 0x0802, sig->calendarChain, KSI_TLV_TEMPLATE(KSI_CalendarHashChain));
+				if (res != KSI_OK) goto cleanup;
+			}
+			calendarChainAdded = 1;
+			continue;
+		}
+
+		if (sig->authRecordsReplaced && (tag == 0x0803 || tag == 0x0805)) continue;
+
+		if (share) {
+			copy = KSI_TLV_ref(el);
+		} else {
+			res = KSI_TLV_clone(el, &copy);
 			if (res != KSI_OK) {
 				KSI_pushError(sig->ctx, res, NULL);
 				goto cleanup;
 			}
-			tlv = NULL;
 		}
+
+		res = KSI_TLV_appendNestedTlv(tmp, copy);
+		if (res != KSI_OK) {
+			KSI_pushError(sig->ctx, res, NULL);
+			goto cleanup;
+		}
+		copy = NULL;
 	}
 
-	KSI_CalendarAuthRec_free(sig->calendarAuthRec);
-	sig->calendarAuthRec = NULL;
+	if (sig->calendarChainReplaced && !calendarChainAdded && sig->calendarChain != NULL) {
+		res = appendObjectTlv(sig->ctx, tmp, 0x0802, sig->calendarChain, KSI_TLV_TEMPLATE(KSI_CalendarHashChain));
+		if (res != KSI_OK) goto cleanup;
+	}
 
-	KSI_PublicationRecord_free(sig->publication);
-	sig->publication = NULL;
+	if (sig->authRecordsReplaced) {
+		if (sig->publication != NULL) {
+			res = appendObjectTlv(sig->ctx, tmp, 0x0803, sig->publication, KSI_TLV_TEMPLATE(KSI_PublicationRecord));
+			if (res != KSI_OK) goto cleanup;
+		}
+
+		if (sig->calendarAuthRec != NULL) {
+			res = appendObjectTlv(sig->ctx, tmp, 0x0805, sig->calendarAuthRec, KSI_TLV_TEMPLATE(KSI_CalendarAuthRec));
+			if (res != KSI_OK) goto cleanup;
+		}
+	}
+
+	/* The prepended aggregation hash chains are in reverse order of adding them. */
+	for (i = sig->aggregationChainsPrepended; i > 0; i--) {
+		KSI_AggregationHashChain *aggr = NULL;
+
+		res = KSI_AggregationHashChainList_elementAt(sig->aggregationChainList, i - 1, &aggr);
+		if (res != KSI_OK || aggr == NULL) {
+			KSI_pushError(sig->ctx, res = (res != KSI_OK ? res : KSI_INVALID_STATE), NULL);
+			goto cleanup;
+		}
+
+		res = appendObjectTlv(sig->ctx, tmp, 0x0801, aggr, KSI_TLV_TEMPLATE(KSI_AggregationHashChain));
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	*out = tmp;
+	tmp = NULL;
 
 	res = KSI_OK;
 
 cleanup:
 
 	KSI_nofree(nested);
-	KSI_nofree(tlv);
+	KSI_TLV_free(copy);
+	KSI_TLV_free(tmp);
 
 	return res;
 }
 
-int KSI_Signature_replacePublicationRecord(KSI_Signature *sig, KSI_PublicationRecord *pubRec) {
-	KSI_TLV *newPubTlv = NULL;
+int KSI_Signature_rebuildBaseTlv(KSI_Signature *sig) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_TLV *tlv = NULL;
+
+	if (sig == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	if (sig->baseTlv != NULL && (sig->calendarChainReplaced || sig->authRecordsReplaced || sig->aggregationChainsPrepended > 0)) {
+		res = buildBaseTlv(sig, 0, &tlv);
+		if (res != KSI_OK) goto cleanup;
+
+		KSI_TLV_free(sig->baseTlv);
+		sig->baseTlv = tlv;
+		tlv = NULL;
+	}
+
+	sig->calendarChainReplaced = 0;
+	sig->authRecordsReplaced = 0;
+	sig->aggregationChainsPrepended = 0;
+
+	res = KSI_OK;
 
-	KSI_LIST(KSI_TLV) *nestedList = NULL;
+cleanup:
+
+	KSI_TLV_free(tlv);
+
+	return res;
+}
+
+static int removeCalAuthAndPublication(KSI_Signature *sig) {
 	int res;
 
 	if (sig == NULL) {
@@ -868,45 +976,48 @@ int KSI_Signature_replacePublicationRecord(KSI_Signature *sig, KSI_PublicationRe
 	}
 	KSI_ERR_clearErrors(sig->ctx);
 
-
-	if (pubRec != NULL) {
-		/* Remove auth records. */
-		res = removeCalAuthAndPublication(sig);
+	/* Keep the order of the elements in the serialized signature as if the changes were applied one by one. */
+	if (sig->aggregationChainsPrepended > 0) {
+		res = KSI_Signature_rebuildBaseTlv(sig);
 		if (res != KSI_OK) {
 			KSI_pushError(sig->ctx, res, NULL);
 			goto cleanup;
 		}
+	}
 
-		/* Create a new TLV object */
-		res = KSI_TLV_new(sig->ctx, 0x0803, 0, 0, &newPubTlv);
-		if (res != KSI_OK) {
-			KSI_pushError(sig->ctx, res, NULL);
-			goto cleanup;
-		}
+	KSI_CalendarAuthRec_free(sig->calendarAuthRec);
+	sig->calendarAuthRec = NULL;
 
-		/* Evaluate the TLV object */
-		res = KSI_TlvTemplate_construct(sig->ctx, newPubTlv, pubRec, KSI_TLV_TEMPLATE(KSI_PublicationRecord));
-		if (res != KSI_OK) {
-			KSI_pushError(sig->ctx, res, NULL);
-			goto cleanup;
-		}
+	KSI_PublicationRecord_free(sig->publication);
+	sig->publication = NULL;
 
-		/* Find previous publication */
-		res = KSI_TLV_getNestedList(sig->baseTlv, &nestedList);
-		if (res != KSI_OK) {
-			KSI_pushError(sig->ctx, res, NULL);
-			goto cleanup;
-		}
+	/* The base TLV is updated when the signature is serialized. */
+	sig->authRecordsReplaced = 1;
 
-		res = KSI_TLVList_append(nestedList, newPubTlv);
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+int KSI_Signature_replacePublicationRecord(KSI_Signature *sig, KSI_PublicationRecord *pubRec) {
+	int res;
+
+	if (sig == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+	KSI_ERR_clearErrors(sig->ctx);
+
+	if (pubRec != NULL) {
+		/* Remove auth records. */
+		res = removeCalAuthAndPublication(sig);
 		if (res != KSI_OK) {
 			KSI_pushError(sig->ctx, res, NULL);
 			goto cleanup;
 		}
 
-		if (sig->publication != NULL) {
-			KSI_PublicationRecord_free(sig->publication);
-		}
 		sig->publication = pubRec;
 	}
 
@@ -1097,10 +1208,12 @@ cleanup:
 	return res;
 }
 
-static int KSI_SignatureVerifier_verifyWithPolicy(KSI_CTX *ctx, KSI_Signature *sig, KSI_uint64_t rootLevel, KSI_DataHash *docHsh, const KSI_Policy *policy, KSI_VerificationContext *verificationContext) {
+static int KSI_SignatureVerifier_verifyWithPolicy(KSI_CTX *ctx, KSI_Signature *sig, KSI_uint64_t rootLevel, KSI_DataHash *docHsh, const KSI_Policy *policy, KSI_VerificationContext *verificationContext, KSI_uint64_t requestId) {
 	int res;
 	KSI_VerificationContext context;
 	KSI_PolicyVerificationResult *result = NULL;
+	int detail = KSI_VER_DETAIL_RULES;
+	int traced = 0;
 
 	KSI_ERR_clearErrors(ctx);
 
@@ -1109,6 +1222,9 @@ static int KSI_SignatureVerifier_verifyWithPolicy(KSI_CTX *ctx, KSI_Signature *s
 		goto cleanup;
 	}
 
+	KSI_TRACE(ctx, KSI_TRACE_VERIFY, KSI_TRACE_START, requestId);
+	traced = 1;
+
 	if (rootLevel > 0xff) {
 		KSI_pushError(ctx, res = KSI_INVALID_FORMAT, "Aggregation level can't be larger than 0xff.");
 		goto cleanup;
@@ -1123,12 +1239,14 @@ static int KSI_SignatureVerifier_verifyWithPolicy(KSI_CTX *ctx, KSI_Signature *s
 	if (verificationContext == NULL) {
 		context.docAggrLevel = rootLevel;
 		context.documentHash = docHsh;
+		/* Only the final result is used. */
+		detail = KSI_VER_DETAIL_POLICIES;
 	} else {
 		context = *verificationContext;
 	}
 	context.signature = sig;
 
-	res = KSI_SignatureVerifier_verify(policy, &context, &result);
+	res = KSI_SignatureVerifier_verifyWithDetail(policy, &context, detail, &result);
 	if (res != KSI_OK) {
 		KSI_pushError(ctx, res, "Internal verification of signature aborted due to an error.");
 		goto cleanup;
@@ -1144,12 +1262,14 @@ static int KSI_SignatureVerifier_verifyWithPolicy(KSI_CTX *ctx, KSI_Signature *s
 
 cleanup:
 
+	if (traced) KSI_TRACE(ctx, KSI_TRACE_VERIFY, KSI_TRACE_END, requestId);
+
 	KSI_PolicyVerificationResult_free(result);
 
 	return res;
 }
 
-#define KSI_SignatureVerifier_verifyInternally(ctx, sig, rootLevel, docHsh) KSI_SignatureVerifier_verifyWithPolicy(ctx, sig, rootLevel, docHsh, KSI_VERIFICATION_POLICY_INTERNAL, NULL)
+#define KSI_SignatureVerifier_verifyInternally(ctx, sig, rootLevel, docHsh) KSI_SignatureVerifier_verifyWithPolicy(ctx, sig, rootLevel, docHsh, KSI_VERIFICATION_POLICY_INTERNAL, NULL, 0)
 
 int KSI_Signature_signAggregatedWithPolicy(KSI_CTX *ctx, KSI_DataHash *rootHash, KSI_uint64_t rootLevel, const KSI_Policy *policy, KSI_VerificationContext *context, KSI_Signature **signature) {
 	int res;
@@ -1199,13 +1319,15 @@ int KSI_Signature_signAggregatedWithPolicy(KSI_CTX *ctx, KSI_DataHash *rootHash,
 		goto cleanup;
 	}
 
+	KSI_TRACE(ctx, KSI_TRACE_SIGNATURE, KSI_TRACE_START, handle->requestId);
 	res = parseAggregationResponse(ctx, rootLevel, response, &sign);
+	KSI_TRACE(ctx, KSI_TRACE_SIGNATURE, KSI_TRACE_END, handle->requestId);
 	if (res != KSI_OK) {
 		KSI_pushError(ctx, res, NULL);
 		goto cleanup;
 	}
 
-	res = KSI_SignatureVerifier_verifyWithPolicy(ctx, sign, rootLevel, rootHash, policy, context);
+	res = KSI_SignatureVerifier_verifyWithPolicy(ctx, sign, rootLevel, rootHash, policy, context, handle->requestId);
 	if (res != KSI_OK) {
 		KSI_pushError(ctx, res, NULL);
 		goto cleanup;
@@ -1271,7 +1393,7 @@ cleanup:
 	return res;
 }
 
-static int KSI_signature_extendToWithoutVerification(const KSI_Signature *sig, KSI_CTX *ctx, KSI_Integer *to, KSI_Signature **extended) {
+static int KSI_signature_extendToWithoutVerification(const KSI_Signature *sig, KSI_CTX *ctx, KSI_Integer *to, KSI_Signature **extended, KSI_uint64_t *requestId) {
 	int res = KSI_UNKNOWN_ERROR;
 	KSI_ExtendReq *req = NULL;
 	KSI_Integer *signTime = NULL;
@@ -1366,6 +1488,8 @@ static int KSI_signature_extendToWithoutVerification(const KSI_Signature *sig, K
 	*extended = tmp;
 	tmp = NULL;
 
+	if (requestId != NULL) *requestId = handle->requestId;
+
 	res = KSI_OK;
 
 cleanup:
@@ -1381,6 +1505,7 @@ cleanup:
 int KSI_Signature_extendToWithPolicy(const KSI_Signature *sig, KSI_CTX *ctx, KSI_Integer *to, const KSI_Policy *policy, KSI_VerificationContext *context, KSI_Signature **extended) {
 	int res = KSI_UNKNOWN_ERROR;
 	KSI_Signature *tmp = NULL;
+	KSI_uint64_t requestId = 0;
 
 
 	KSI_ERR_clearErrors(ctx);
@@ -1389,13 +1514,13 @@ int KSI_Signature_extendToWithPolicy(const KSI_Signature *sig, KSI_CTX *ctx, KSI
 		goto cleanup;
 	}
 
-	res = KSI_signature_extendToWithoutVerification(sig, ctx, to, &tmp);
+	res = KSI_signature_extendToWithoutVerification(sig, ctx, to, &tmp, &requestId);
 	if (res != KSI_OK) {
 		KSI_pushError(ctx, res, NULL);
 		goto cleanup;
 	}
 
-	res = KSI_SignatureVerifier_verifyWithPolicy(ctx, tmp, 0, NULL, policy, context);
+	res = KSI_SignatureVerifier_verifyWithPolicy(ctx, tmp, 0, NULL, policy, context, requestId);
 	if (res != KSI_OK) {
 		KSI_pushError(ctx, res, NULL);
 		goto cleanup;
@@ -1418,6 +1543,7 @@ int KSI_Signature_extendWithPolicy(const KSI_Signature *signature, KSI_CTX *ctx,
 	KSI_Integer *pubTime = NULL;
 	KSI_PublicationRecord *pubRecClone = NULL;
 	KSI_Signature *tmp = NULL;
+	KSI_uint64_t requestId = 0;
 
 	KSI_ERR_clearErrors(ctx);
 	if (signature == NULL || ctx == NULL || extended == NULL) {
@@ -1453,7 +1579,7 @@ int KSI_Signature_extendWithPolicy(const KSI_Signature *signature, KSI_CTX *ctx,
 	}
 
 	/* Perform the actual extension. */
-	res = KSI_signature_extendToWithoutVerification(signature, ctx, pubTime, &tmp);
+	res = KSI_signature_extendToWithoutVerification(signature, ctx, pubTime, &tmp, &requestId);
 	if (res != KSI_OK) {
 		KSI_pushError(ctx, res, NULL);
 		goto cleanup;
@@ -1467,7 +1593,7 @@ int KSI_Signature_extendWithPolicy(const KSI_Signature *signature, KSI_CTX *ctx,
 	}
 	pubRecClone = NULL;
 
-	res = KSI_SignatureVerifier_verifyWithPolicy(ctx, tmp, 0, NULL, policy, context);
+	res = KSI_SignatureVerifier_verifyWithPolicy(ctx, tmp, 0, NULL, policy, context, requestId);
 	if (res != KSI_OK && res) {
 		KSI_pushError(ctx, res, NULL);
 		goto cleanup;
@@ -1487,7 +1613,7 @@ cleanup:
 }
 
 void KSI_Signature_free(KSI_Signature *sig) {
-	if (sig != NULL && --sig->ref == 0) {
+	if (sig != NULL && KSI_REF_DECREMENT(sig) == 0) {
 		KSI_TLV_free(sig->baseTlv);
 		KSI_CalendarHashChain_free(sig->calendarChain);
 		KSI_AggregationHashChainList_free(sig->aggregationChainList);
@@ -1585,8 +1711,8 @@ cleanup:
 }
 
 int KSI_Signature_clone(const KSI_Signature *sig, KSI_Signature **clone) {
-	KSI_TLV *tlv = NULL;
 	KSI_Signature *tmp = NULL;
+	size_t i;
 	int res;
 
 	if (sig == NULL || clone == NULL) {
@@ -1595,21 +1721,52 @@ int KSI_Signature_clone(const KSI_Signature *sig, KSI_Signature **clone) {
 	}
 	KSI_ERR_clearErrors(sig->ctx);
 
-
-	res = KSI_TLV_clone(sig->baseTlv, &tlv);
+	res = KSI_Signature_new(sig->ctx, &tmp);
 	if (res != KSI_OK) {
 		KSI_pushError(sig->ctx, res, NULL);
 		goto cleanup;
 	}
 
-	res = extractSignature(sig->ctx, tlv, &tmp);
-	if (res != KSI_OK) {
-		KSI_pushError(sig->ctx, res, NULL);
-		goto cleanup;
+	/* The components are not modified after parsing, so they are shared with the clone
+	 * instead of copying them. Only the list of aggregation hash chains is owned by the clone. */
+	if (sig->aggregationChainList != NULL) {
+		res = KSI_AggregationHashChainList_new(&tmp->aggregationChainList);
+		if (res != KSI_OK) {
+			KSI_pushError(sig->ctx, res, NULL);
+			goto cleanup;
+		}
+
+		for (i = 0; i < KSI_AggregationHashChainList_length(sig->aggregationChainList); i++) {
+			KSI_AggregationHashChain *aggr = NULL;
+			KSI_AggregationHashChain *ref = NULL;
+
+			res = KSI_AggregationHashChainList_elementAt(sig->aggregationChainList, i, &aggr);
+			if (res != KSI_OK) {
+				KSI_pushError(sig->ctx, res, NULL);
+				goto cleanup;
+			}
+
+			res = KSI_AggregationHashChainList_append(tmp->aggregationChainList, ref = KSI_AggregationHashChain_ref(aggr));
+			if (res != KSI_OK) {
+				/* Cleanup the reference. */
+				KSI_AggregationHashChain_free(ref);
+
+				KSI_pushError(sig->ctx, res, NULL);
+				goto cleanup;
+			}
+		}
 	}
 
-	tmp->baseTlv = tlv;
-	tlv = NULL;
+	tmp->baseTlv = KSI_TLV_ref(sig->baseTlv);
+	tmp->calendarChainReplaced = sig->calendarChainReplaced;
+	tmp->authRecordsReplaced = sig->authRecordsReplaced;
+	tmp->aggregationChainsPrepended = sig->aggregationChainsPrepended;
+
+	tmp->calendarChain = KSI_CalendarHashChain_ref(sig->calendarChain);
+	tmp->calendarAuthRec = KSI_CalendarAuthRec_ref(sig->calendarAuthRec);
+	tmp->aggregationAuthRec = KSI_AggregationAuthRec_ref(sig->aggregationAuthRec);
+	tmp->publication = KSI_PublicationRecord_ref(sig->publication);
+	tmp->rfc3161 = KSI_RFC3161_ref(sig->rfc3161);
 
 	*clone = tmp;
 	tmp = NULL;
@@ -1618,7 +1775,6 @@ int KSI_Signature_clone(const KSI_Signature *sig, KSI_Signature **clone) {
 
 cleanup:
 
-	KSI_TLV_free(tlv);
 	KSI_Signature_free(tmp);
 
 	return res;
@@ -1647,7 +1803,7 @@ int KSI_Signature_parseWithPolicy(KSI_CTX *ctx, unsigned char *raw, size_t raw_l
 		goto cleanup;
 	}
 
-	res = KSI_SignatureVerifier_verifyWithPolicy(ctx, tmp, 0, NULL, policy, context);
+	res = KSI_SignatureVerifier_verifyWithPolicy(ctx, tmp, 0, NULL, policy, context, 0);
 	if (res != KSI_OK) {
 		KSI_pushError(ctx, res, NULL);
 		goto cleanup;
@@ -1674,6 +1830,7 @@ int KSI_Signature_serialize(KSI_Signature *sig, unsigned char **raw, size_t *raw
 	int res;
 	unsigned char *tmp = NULL;
 	size_t tmp_len;
+	KSI_TLV *tlv = NULL;
 
 	if (sig == NULL || raw == NULL || raw_len == NULL) {
 		res = KSI_INVALID_ARGUMENT;
@@ -1681,8 +1838,21 @@ int KSI_Signature_serialize(KSI_Signature *sig, unsigned char **raw, size_t *raw
 	}
 	KSI_ERR_clearErrors(sig->ctx);
 
-	if (sig->baseTlv != NULL) {
-		/* We assume that the baseTlv tree is up to date! */
+	if (sig->baseTlv != NULL && (sig->calendarChainReplaced || sig->authRecordsReplaced || sig->aggregationChainsPrepended > 0)) {
+		/* Apply the pending changes to a temporary TLV, as the base TLV may be shared. The
+		 * unchanged elements are only referenced, the temporary TLV is freed before returning. */
+		res = buildBaseTlv(sig, 1, &tlv);
+		if (res != KSI_OK) {
+			KSI_pushError(sig->ctx, res, NULL);
+			goto cleanup;
+		}
+
+		res = KSI_TLV_serialize(tlv, &tmp, &tmp_len);
+		if (res != KSI_OK) {
+			KSI_pushError(sig->ctx, res, NULL);
+			goto cleanup;
+		}
+	} else if (sig->baseTlv != NULL) {
 		res = KSI_TLV_serialize(sig->baseTlv, &tmp, &tmp_len);
 		if (res != KSI_OK) {
 			KSI_pushError(sig->ctx, res, NULL);
@@ -1705,6 +1875,7 @@ int KSI_Signature_serialize(KSI_Signature *sig, unsigned char **raw, size_t *raw
 
 cleanup:
 
+	KSI_TLV_free(tlv);
 	KSI_free(tmp);
 
 	return res;
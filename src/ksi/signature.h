@@ -43,11 +43,19 @@ extern "C" {
 	void KSI_Signature_free(KSI_Signature *signature);
 
 	/**
-	 * Creates a clone of the signature object.
+	 * Creates a clone of the signature object. The clone shares the hash chains and the
+	 * records with the original signature, changing the clone (e.g. extending it) replaces
+	 * only the affected parts and leaves the original signature intact.
 	 * \param[in]		sig			Signature to be cloned.
 	 * \param[out]		clone		Pointer to the receiving pointer.
 	 *
 	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 * \note Once parsed, the signature and the objects reachable through its getters are not
+	 * modified by the library, except by #KSI_Signature_replacePublicationRecord, the deprecated
+	 * \c KSI_Signature_verify* functions and a failed #KSI_SignatureVerifier_verify, which
+	 * attaches the verification result to the signature. When the library is configured with
+	 * \c --enable-atomic-refcount, a signature may therefore be shared between threads with
+	 * #KSI_Signature_ref instead of cloning it.
 	 */
 	int KSI_Signature_clone(const KSI_Signature *sig, KSI_Signature **clone);
 
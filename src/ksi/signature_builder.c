@@ -20,6 +20,7 @@
 #include "signature_builder_impl.h"
 #include "internal.h"
 #include "signature_impl.h"
+#include "policy_impl.h"
 #include "tlv.h"
 #include "tlv_template.h"
 #include "hashchain.h"
@@ -55,11 +56,6 @@ KSI_END_TLV_TEMPLATE
 
 static int replaceCalendarChain(KSI_Signature *sig, KSI_CalendarHashChain *calendarHashChain) {
 	int res;
-	KSI_DataHash *aggrOutputHash = NULL;
-	KSI_TLV *oldCalChainTlv = NULL;
-	KSI_TLV *newCalChainTlv = NULL;
-	KSI_LIST(KSI_TLV) *nestedList = NULL;
-	size_t i;
 
 	if (sig == NULL || calendarHashChain == NULL) {
 		res = KSI_INVALID_ARGUMENT;
@@ -67,74 +63,30 @@ static int replaceCalendarChain(KSI_Signature *sig, KSI_CalendarHashChain *calen
 	}
 	KSI_ERR_clearErrors(sig->ctx);
 
-	res = KSI_TLV_getNestedList(sig->baseTlv, &nestedList);
-	if (res != KSI_OK) {
-		KSI_pushError(sig->ctx, res, NULL);
-		goto cleanup;
-	}
-
-	if (sig->calendarChain != NULL) {
-		for (i = 0; i < KSI_TLVList_length(nestedList); i++) {
-			res = KSI_TLVList_elementAt(nestedList,i, &oldCalChainTlv);
-			if (res != KSI_OK) {
-				KSI_pushError(sig->ctx, res, NULL);
-				goto cleanup;
-			}
-
-			if (oldCalChainTlv == NULL) {
-				KSI_pushError(sig->ctx, res = KSI_INVALID_SIGNATURE, "Signature TLV element missing.");
-				goto cleanup;
-			}
-
-			if (KSI_TLV_getTag(oldCalChainTlv) == 0x0802) break;
+	/* Keep the order of the elements in the serialized signature as if the changes were applied one by one. */
+	if (sig->authRecordsReplaced || sig->aggregationChainsPrepended > 0) {
+		res = KSI_Signature_rebuildBaseTlv(sig);
+		if (res != KSI_OK) {
+			KSI_pushError(sig->ctx, res, NULL);
+			goto cleanup;
 		}
 	}
 
-	res = KSI_TLV_new(sig->ctx, 0x0802, 0, 0, &newCalChainTlv);
-	if (res != KSI_OK) {
-		KSI_pushError(sig->ctx, res, NULL);
-		goto cleanup;
-	}
-
-	res = KSI_TlvTemplate_construct(sig->ctx, newCalChainTlv, calendarHashChain, KSI_TLV_TEMPLATE(KSI_CalendarHashChain));
-	if (res != KSI_OK) {
-		KSI_pushError(sig->ctx, res, NULL);
-		goto cleanup;
-	}
-
-	res = (sig->calendarChain == NULL) ?
-			/* In case there is no calendar hash chain attached, append a new one. */
-			KSI_TLV_appendNestedTlv(sig->baseTlv, newCalChainTlv) :
-			/* Otherwise replace the calendar hash chain. */
-			KSI_TLV_replaceNestedTlv(sig->baseTlv, oldCalChainTlv, newCalChainTlv);
-	if (res != KSI_OK) {
-		KSI_pushError(sig->ctx, res, NULL);
-		goto cleanup;
-	}
-
-	newCalChainTlv = NULL;
-
-	/* The memory was freed within KSI_TLV_replaceNestedTlv. */
-	oldCalChainTlv = NULL;
-
 	KSI_CalendarHashChain_free(sig->calendarChain);
 	sig->calendarChain = calendarHashChain;
 
+	/* The base TLV is updated when the signature is serialized. */
+	sig->calendarChainReplaced = 1;
 
 	res = KSI_OK;
 
 cleanup:
 
-	KSI_nofree(nestedList);
-
-	KSI_DataHash_free(aggrOutputHash);
-	KSI_TLV_free(newCalChainTlv);
-
 	return res;
 }
 
 
-static int KSI_Signature_new(KSI_CTX *ctx, KSI_Signature **sig) {
+int KSI_Signature_new(KSI_CTX *ctx, KSI_Signature **sig) {
 	int res = KSI_UNKNOWN_ERROR;
 	KSI_Signature *tmp = NULL;
 
@@ -154,6 +106,9 @@ static int KSI_Signature_new(KSI_CTX *ctx, KSI_Signature **sig) {
 	tmp->ref = 1;
 	tmp->calendarChain = NULL;
 	tmp->baseTlv = NULL;
+	tmp->calendarChainReplaced = 0;
+	tmp->authRecordsReplaced = 0;
+	tmp->aggregationChainsPrepended = 0;
 	tmp->publication = NULL;
 	tmp->aggregationChainList = NULL;
 	tmp->aggregationAuthRec = NULL;
@@ -306,8 +261,8 @@ int KSI_SignatureBuilder_close(KSI_SignatureBuilder *builder, KSI_uint64_t rootL
 
 		context.signature = builder->sig;
 		context.docAggrLevel = rootLevel;
-
-		res = KSI_SignatureVerifier_verify(KSI_VERIFICATION_POLICY_INTERNAL, &context, &result);
+		/* Only the final result is used. */
+		res = KSI_SignatureVerifier_verifyWithDetail(KSI_VERIFICATION_POLICY_INTERNAL, &context, KSI_VER_DETAIL_POLICIES, &result);
 		if (res != KSI_OK) {
 			KSI_pushError(builder->ctx, res, NULL);
 			goto cleanup;
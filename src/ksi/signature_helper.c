@@ -20,6 +20,7 @@
 #include "ksi.h"
 #include "internal.h"
 #include "signature_impl.h"
+#include "policy_impl.h"
 
 int KSI_Signature_getHashAlgorithm(KSI_Signature *sig, KSI_HashAlgorithm *algo_id) {
 	KSI_DataHash *hsh = NULL;
@@ -91,11 +92,44 @@ cleanup:
 	return res;
 }
 
-int KSI_Signature_verifyDocument(KSI_Signature *sig, KSI_CTX *ctx, void *doc, size_t doc_len) {
+static int verifyDocumentHash(KSI_Signature *sig, KSI_CTX *ctx, KSI_DataHash *hsh) {
 	int res;
-	KSI_DataHash *hsh = NULL;
 	KSI_VerificationContext context;
 	KSI_PolicyVerificationResult *result = NULL;
+
+	res = KSI_VerificationContext_init(&context, ctx);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	context.signature = sig;
+	context.documentHash = hsh;
+	/* Only the final result is used. */
+	res = KSI_SignatureVerifier_verifyWithDetail(KSI_VERIFICATION_POLICY_GENERAL, &context, KSI_VER_DETAIL_POLICIES, &result);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, "Verification of signature not completed.");
+		goto cleanup;
+	}
+
+	if (result->finalResult.resultCode != KSI_VER_RES_OK) {
+		res = KSI_VERIFICATION_FAILURE;
+		KSI_pushError(ctx, res, "Verification of signature failed.");
+		goto cleanup;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_PolicyVerificationResult_free(result);
+
+	return res;
+}
+
+int KSI_Signature_verifyDocument(KSI_Signature *sig, KSI_CTX *ctx, void *doc, size_t doc_len) {
+	int res;
+	KSI_DataHash *hsh = NULL;
 	KSI_HashAlgorithm algo_id = -1;
 
 	KSI_ERR_clearErrors(ctx);
@@ -116,24 +150,92 @@ int KSI_Signature_verifyDocument(KSI_Signature *sig, KSI_CTX *ctx, void *doc, si
 		goto cleanup;
 	}
 
-	res = KSI_VerificationContext_init(&context, ctx);
+	res = verifyDocumentHash(sig, ctx, hsh);
 	if (res != KSI_OK) {
 		KSI_pushError(ctx, res, NULL);
 		goto cleanup;
 	}
 
-	context.signature = sig;
-	context.documentHash = hsh;
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_DataHash_free(hsh);
+
+	return res;
+}
+
+int KSI_Signature_verifyDocumentFd(KSI_Signature *sig, KSI_CTX *ctx, int fd) {
+	int res;
+	KSI_DataHasher *hsr = NULL;
+	KSI_DataHash *hsh = NULL;
+
+	KSI_ERR_clearErrors(ctx);
+	if (sig == NULL || ctx == NULL || fd < 0) {
+		KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
+		goto cleanup;
+	}
 
-	res = KSI_SignatureVerifier_verify(KSI_VERIFICATION_POLICY_GENERAL, &context, &result);
+	res = KSI_Signature_createDataHasher(sig, &hsr);
 	if (res != KSI_OK) {
-		KSI_pushError(ctx, res, "Verification of signature not completed.");
+		KSI_pushError(ctx, res, NULL);
 		goto cleanup;
 	}
 
-	if (result->finalResult.resultCode != KSI_VER_RES_OK) {
-		res = KSI_VERIFICATION_FAILURE;
-		KSI_pushError(ctx, res, "Verification of signature failed.");
+	res = KSI_DataHasher_addFile(hsr, fd);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_DataHasher_close(hsr, &hsh);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = verifyDocumentHash(sig, ctx, hsh);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_DataHasher_free(hsr);
+	KSI_DataHash_free(hsh);
+
+	return res;
+}
+
+int KSI_Signature_verifyDocumentFile(KSI_Signature *sig, KSI_CTX *ctx, const char *fileName) {
+	int res;
+	KSI_DataHash *hsh = NULL;
+	KSI_HashAlgorithm algo_id = -1;
+
+	KSI_ERR_clearErrors(ctx);
+	if (sig == NULL || ctx == NULL || fileName == NULL) {
+		KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_Signature_getHashAlgorithm(sig, &algo_id);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_DataHash_createFromFile(ctx, fileName, algo_id, &hsh);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = verifyDocumentHash(sig, ctx, hsh);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
 		goto cleanup;
 	}
 
@@ -141,7 +243,6 @@ int KSI_Signature_verifyDocument(KSI_Signature *sig, KSI_CTX *ctx, void *doc, si
 
 cleanup:
 
-	KSI_PolicyVerificationResult_free(result);
 	KSI_DataHash_free(hsh);
 
 	return res;
@@ -59,6 +59,28 @@ extern "C" {
 	 */
 	int KSI_Signature_verifyDocument(KSI_Signature *sig, KSI_CTX *ctx, void *doc, size_t doc_len);
 
+	/**
+	 * Verifies that the contents of the file from the current position to the end of the
+	 * file match the signature. The file is hashed in constant memory.
+	 * \param[in]	sig			KSI signature.
+	 * \param[in]	ctx			KSI context.
+	 * \param[in]	fd			Descriptor of the document opened for reading.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 * \see #KSI_DataHasher_addFile
+	 */
+	int KSI_Signature_verifyDocumentFd(KSI_Signature *sig, KSI_CTX *ctx, int fd);
+
+	/**
+	 * Verifies that the contents of the file match the signature. The file is hashed in
+	 * constant memory.
+	 * \param[in]	sig			KSI signature.
+	 * \param[in]	ctx			KSI context.
+	 * \param[in]	fileName	Name of the document.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 * \see #KSI_DataHash_createFromFile
+	 */
+	int KSI_Signature_verifyDocumentFile(KSI_Signature *sig, KSI_CTX *ctx, const char *fileName);
+
 	/**
 	 * A convenience function for reading a signature from a file.
 	 * The signature is verified with the provided policy and context.
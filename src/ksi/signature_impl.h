@@ -83,8 +83,15 @@ extern "C" {
 		KSI_CTX *ctx;
 		/** Reference counter. */
 		size_t ref;
-		/** Base TLV - when serialized, this value will be used. */
+		/** Base TLV - when serialized, this value will be used. It may be shared with the copies of
+		 * the signature, so it is never modified; the changes below are applied when serializing. */
 		KSI_TLV *baseTlv;
+		/** Set when the calendar hash chain in \c baseTlv has been replaced. */
+		int calendarChainReplaced;
+		/** Set when the calendar auth record and publication in \c baseTlv have been replaced. */
+		int authRecordsReplaced;
+		/** Number of aggregation hash chains prepended to \c aggregationChainList, but missing in \c baseTlv. */
+		size_t aggregationChainsPrepended;
 		/** Calendar hash chain. */
 		KSI_CalendarHashChain *calendarChain;
 		/** List of aggregation hash chains. */
@@ -106,6 +113,21 @@ extern "C" {
 		int (*replaceCalendarChain)(KSI_Signature *sig, KSI_CalendarHashChain *calendarHashChain);
 	};
 
+	/**
+	 * Creates an empty signature object.
+	 * \param[in]	ctx			KSI context.
+	 * \param[out]	sig			Pointer to the receiving pointer.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_Signature_new(KSI_CTX *ctx, KSI_Signature **sig);
+
+	/**
+	 * Applies the pending changes of the signature to a private copy of its base TLV.
+	 * \param[in]	sig			The signature.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_Signature_rebuildBaseTlv(KSI_Signature *sig);
+
 
 #ifdef __cplusplus
 }
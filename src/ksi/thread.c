@@ -0,0 +1,580 @@
+/*
+ * Copyright 2013-2015 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+
+#include "internal.h"
+#include "thread.h"
+
+#ifdef _WIN32
+#  include <windows.h>
+#  include <process.h>
+#else
+#  include <pthread.h>
+#  include <time.h>
+#  include <errno.h>
+#endif
+
+struct KSI_Thread_st {
+	KSI_CTX *ctx;
+	KSI_ThreadFn fn;
+	void *arg;
+	int result;
+	int joined;
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif
+};
+
+struct KSI_Mutex_st {
+#ifdef _WIN32
+	CRITICAL_SECTION cs;
+#else
+	pthread_mutex_t mutex;
+#endif
+};
+
+struct KSI_Cond_st {
+#ifdef _WIN32
+	CONDITION_VARIABLE cv;
+#else
+	pthread_cond_t cv;
+#endif
+};
+
+typedef struct ThreadLocalValue_st ThreadLocalValue;
+
+/* Values of all the threads are linked, so they can be released with the storage. */
+struct ThreadLocalValue_st {
+	KSI_ThreadLocal *owner;
+	void *value;
+	ThreadLocalValue *prev;
+	ThreadLocalValue *next;
+};
+
+struct KSI_ThreadLocal_st {
+	void (*valueFree)(void *);
+	KSI_Mutex *lock;
+	ThreadLocalValue *values;
+#ifdef _WIN32
+	DWORD key;
+#else
+	pthread_key_t key;
+#endif
+};
+
+#ifdef _WIN32
+static unsigned __stdcall threadMain(void *p) {
+	KSI_Thread *thread = p;
+	thread->result = thread->fn(thread->arg);
+	return 0;
+}
+#else
+static void *threadMain(void *p) {
+	KSI_Thread *thread = p;
+	thread->result = thread->fn(thread->arg);
+	return NULL;
+}
+#endif
+
+int KSI_Thread_start(KSI_CTX *ctx, KSI_ThreadFn fn, void *arg, KSI_Thread **thread) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_Thread *tmp = NULL;
+
+	KSI_ERR_clearErrors(ctx);
+
+	if (ctx == NULL || fn == NULL || thread == NULL) {
+		KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
+		goto cleanup;
+	}
+
+	tmp = KSI_new(KSI_Thread);
+	if (tmp == NULL) {
+		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+	tmp->ctx = ctx;
+	tmp->fn = fn;
+	tmp->arg = arg;
+	tmp->result = KSI_UNKNOWN_ERROR;
+	tmp->joined = 0;
+
+#ifdef _WIN32
+	tmp->handle = (HANDLE)_beginthreadex(NULL, 0, threadMain, tmp, 0, NULL);
+	if (tmp->handle == 0) {
+		KSI_pushError(ctx, res = KSI_UNKNOWN_ERROR, "Unable to start a thread.");
+		goto cleanup;
+	}
+#else
+	if (pthread_create(&tmp->handle, NULL, threadMain, tmp) != 0) {
+		KSI_pushError(ctx, res = KSI_UNKNOWN_ERROR, "Unable to start a thread.");
+		goto cleanup;
+	}
+#endif
+
+	*thread = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	/* The thread was not started, so the structure can be released directly. */
+	KSI_free(tmp);
+
+	return res;
+}
+
+int KSI_Thread_join(KSI_Thread *thread, int *result) {
+	int res = KSI_UNKNOWN_ERROR;
+
+	if (thread == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	if (!thread->joined) {
+#ifdef _WIN32
+		if (WaitForSingleObject(thread->handle, INFINITE) != WAIT_OBJECT_0) {
+			res = KSI_UNKNOWN_ERROR;
+			goto cleanup;
+		}
+		CloseHandle(thread->handle);
+#else
+		if (pthread_join(thread->handle, NULL) != 0) {
+			res = KSI_UNKNOWN_ERROR;
+			goto cleanup;
+		}
+#endif
+		thread->joined = 1;
+	}
+
+	if (result != NULL) *result = thread->result;
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+void KSI_Thread_free(KSI_Thread *thread) {
+	if (thread != NULL) {
+		KSI_Thread_join(thread, NULL);
+		KSI_free(thread);
+	}
+}
+
+void KSI_Thread_sleep(unsigned ms) {
+#ifdef _WIN32
+	Sleep(ms);
+#else
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (long)(ms % 1000) * 1000000;
+	/* Continue with the remaining time when interrupted by a signal. */
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+#endif
+}
+
+int KSI_Mutex_new(KSI_CTX *ctx, KSI_Mutex **mutex) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_Mutex *tmp = NULL;
+
+	KSI_ERR_clearErrors(ctx);
+
+	if (ctx == NULL || mutex == NULL) {
+		KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
+		goto cleanup;
+	}
+
+	tmp = KSI_new(KSI_Mutex);
+	if (tmp == NULL) {
+		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+#ifdef _WIN32
+	InitializeCriticalSection(&tmp->cs);
+#else
+	if (pthread_mutex_init(&tmp->mutex, NULL) != 0) {
+		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, "Unable to initialize mutex.");
+		goto cleanup;
+	}
+#endif
+
+	*mutex = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	/* The mutex was not initialized, so the structure can be released directly. */
+	KSI_free(tmp);
+
+	return res;
+}
+
+void KSI_Mutex_lock(KSI_Mutex *mutex) {
+	if (mutex != NULL) {
+#ifdef _WIN32
+		EnterCriticalSection(&mutex->cs);
+#else
+		pthread_mutex_lock(&mutex->mutex);
+#endif
+	}
+}
+
+void KSI_Mutex_unlock(KSI_Mutex *mutex) {
+	if (mutex != NULL) {
+#ifdef _WIN32
+		LeaveCriticalSection(&mutex->cs);
+#else
+		pthread_mutex_unlock(&mutex->mutex);
+#endif
+	}
+}
+
+void KSI_Mutex_free(KSI_Mutex *mutex) {
+	if (mutex != NULL) {
+#ifdef _WIN32
+		DeleteCriticalSection(&mutex->cs);
+#else
+		pthread_mutex_destroy(&mutex->mutex);
+#endif
+		KSI_free(mutex);
+	}
+}
+
+int KSI_Cond_new(KSI_CTX *ctx, KSI_Cond **cond) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_Cond *tmp = NULL;
+
+	KSI_ERR_clearErrors(ctx);
+
+	if (ctx == NULL || cond == NULL) {
+		KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
+		goto cleanup;
+	}
+
+	tmp = KSI_new(KSI_Cond);
+	if (tmp == NULL) {
+		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+#ifdef _WIN32
+	InitializeConditionVariable(&tmp->cv);
+#else
+	if (pthread_cond_init(&tmp->cv, NULL) != 0) {
+		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, "Unable to initialize condition variable.");
+		goto cleanup;
+	}
+#endif
+
+	*cond = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	/* The condition variable was not initialized, so the structure can be released directly. */
+	KSI_free(tmp);
+
+	return res;
+}
+
+void KSI_Cond_wait(KSI_Cond *cond, KSI_Mutex *mutex) {
+	if (cond != NULL && mutex != NULL) {
+#ifdef _WIN32
+		SleepConditionVariableCS(&cond->cv, &mutex->cs, INFINITE);
+#else
+		pthread_cond_wait(&cond->cv, &mutex->mutex);
+#endif
+	}
+}
+
+void KSI_Cond_timedWait(KSI_Cond *cond, KSI_Mutex *mutex, unsigned ms) {
+	if (cond != NULL && mutex != NULL) {
+#ifdef _WIN32
+		SleepConditionVariableCS(&cond->cv, &mutex->cs, ms);
+#else
+		struct timespec ts;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += ms / 1000;
+		ts.tv_nsec += (long)(ms % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&cond->cv, &mutex->mutex, &ts);
+#endif
+	}
+}
+
+void KSI_Cond_broadcast(KSI_Cond *cond) {
+	if (cond != NULL) {
+#ifdef _WIN32
+		WakeAllConditionVariable(&cond->cv);
+#else
+		pthread_cond_broadcast(&cond->cv);
+#endif
+	}
+}
+
+void KSI_Cond_free(KSI_Cond *cond) {
+	if (cond != NULL) {
+#ifndef _WIN32
+		pthread_cond_destroy(&cond->cv);
+#endif
+		KSI_free(cond);
+	}
+}
+
+static void ThreadLocalValue_free(ThreadLocalValue *node) {
+	if (node != NULL) {
+		if (node->owner->valueFree != NULL) {
+			node->owner->valueFree(node->value);
+		}
+		KSI_free(node);
+	}
+}
+
+/* The caller must hold the lock of the storage. */
+static void ThreadLocalValue_unlink(ThreadLocalValue *node) {
+	KSI_ThreadLocal *tl = node->owner;
+
+	if (node->prev != NULL) {
+		node->prev->next = node->next;
+	} else {
+		tl->values = node->next;
+	}
+	if (node->next != NULL) {
+		node->next->prev = node->prev;
+	}
+	node->prev = NULL;
+	node->next = NULL;
+}
+
+#ifndef _WIN32
+static void threadLocalDestructor(void *p) {
+	ThreadLocalValue *node = p;
+
+	KSI_Mutex_lock(node->owner->lock);
+	ThreadLocalValue_unlink(node);
+	KSI_Mutex_unlock(node->owner->lock);
+
+	ThreadLocalValue_free(node);
+}
+#endif
+
+int KSI_ThreadLocal_new(KSI_CTX *ctx, void (*valueFree)(void *), KSI_ThreadLocal **tl) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_ThreadLocal *tmp = NULL;
+	int hasKey = 0;
+
+	KSI_ERR_clearErrors(ctx);
+
+	if (ctx == NULL || tl == NULL) {
+		KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
+		goto cleanup;
+	}
+
+	tmp = KSI_new(KSI_ThreadLocal);
+	if (tmp == NULL) {
+		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+	tmp->valueFree = valueFree;
+	tmp->lock = NULL;
+	tmp->values = NULL;
+
+	res = KSI_Mutex_new(ctx, &tmp->lock);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+#ifdef _WIN32
+	tmp->key = TlsAlloc();
+	if (tmp->key == TLS_OUT_OF_INDEXES) {
+		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, "Unable to allocate thread local storage.");
+		goto cleanup;
+	}
+#else
+	if (pthread_key_create(&tmp->key, threadLocalDestructor) != 0) {
+		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, "Unable to allocate thread local storage.");
+		goto cleanup;
+	}
+#endif
+	hasKey = 1;
+
+	*tl = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	if (tmp != NULL && !hasKey) {
+		KSI_Mutex_free(tmp->lock);
+		KSI_free(tmp);
+	}
+
+	return res;
+}
+
+void *KSI_ThreadLocal_get(KSI_ThreadLocal *tl) {
+	ThreadLocalValue *node = NULL;
+
+	if (tl == NULL) return NULL;
+
+#ifdef _WIN32
+	node = TlsGetValue(tl->key);
+#else
+	node = pthread_getspecific(tl->key);
+#endif
+
+	return node != NULL ? node->value : NULL;
+}
+
+int KSI_ThreadLocal_set(KSI_ThreadLocal *tl, void *value) {
+	int res = KSI_UNKNOWN_ERROR;
+	ThreadLocalValue *node = NULL;
+	ThreadLocalValue *tmp = NULL;
+
+	if (tl == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+#ifdef _WIN32
+	node = TlsGetValue(tl->key);
+#else
+	node = pthread_getspecific(tl->key);
+#endif
+
+	if (node != NULL) {
+		if (node->value != value && tl->valueFree != NULL) {
+			tl->valueFree(node->value);
+		}
+		node->value = value;
+		res = KSI_OK;
+		goto cleanup;
+	}
+
+	tmp = KSI_new(ThreadLocalValue);
+	if (tmp == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	tmp->owner = tl;
+	tmp->value = value;
+	tmp->prev = NULL;
+
+#ifdef _WIN32
+	if (!TlsSetValue(tl->key, tmp)) {
+#else
+	if (pthread_setspecific(tl->key, tmp) != 0) {
+#endif
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	KSI_Mutex_lock(tl->lock);
+	tmp->next = tl->values;
+	if (tl->values != NULL) {
+		tl->values->prev = tmp;
+	}
+	tl->values = tmp;
+	KSI_Mutex_unlock(tl->lock);
+
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_free(tmp);
+
+	return res;
+}
+
+void KSI_ThreadLocal_free(KSI_ThreadLocal *tl) {
+	ThreadLocalValue *node = NULL;
+
+	if (tl != NULL) {
+#ifdef _WIN32
+		TlsFree(tl->key);
+#else
+		pthread_key_delete(tl->key);
+#endif
+
+		while ((node = tl->values) != NULL) {
+			ThreadLocalValue_unlink(node);
+			ThreadLocalValue_free(node);
+		}
+
+		KSI_Mutex_free(tl->lock);
+		KSI_free(tl);
+	}
+}
+
+size_t KSI_Atomic_increment(volatile size_t *value) {
+#ifdef _WIN32
+#  ifdef _WIN64
+	return (size_t)InterlockedIncrement64((volatile LONG64 *)value);
+#  else
+	return (size_t)InterlockedIncrement((volatile LONG *)value);
+#  endif
+#else
+	return __sync_add_and_fetch(value, 1);
+#endif
+}
+
+size_t KSI_Atomic_decrement(volatile size_t *value) {
+#ifdef _WIN32
+#  ifdef _WIN64
+	return (size_t)InterlockedDecrement64((volatile LONG64 *)value);
+#  else
+	return (size_t)InterlockedDecrement((volatile LONG *)value);
+#  endif
+#else
+	return __sync_sub_and_fetch(value, 1);
+#endif
+}
+
+size_t KSI_Atomic_add(volatile size_t *value, size_t delta) {
+#ifdef _WIN32
+#  ifdef _WIN64
+	return (size_t)InterlockedExchangeAdd64((volatile LONG64 *)value, (LONG64)delta) + delta;
+#  else
+	return (size_t)InterlockedExchangeAdd((volatile LONG *)value, (LONG)delta) + delta;
+#  endif
+#else
+	return __sync_add_and_fetch(value, delta);
+#endif
+}
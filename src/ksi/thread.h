@@ -0,0 +1,213 @@
+/*
+ * Copyright 2013-2015 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+
+#ifndef KSI_THREAD_H_
+#define KSI_THREAD_H_
+
+#include "ksi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * Minimal platform independent worker thread used internally by the SDK for
+	 * background tasks. The thread function receives the user argument and
+	 * returns a KSI status code, which is made available by #KSI_Thread_join.
+	 */
+	typedef struct KSI_Thread_st KSI_Thread;
+
+	/**
+	 * Thread entry point.
+	 * \param[in]	arg		User argument passed to #KSI_Thread_start.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	typedef int (*KSI_ThreadFn)(void *arg);
+
+	/**
+	 * Starts a new thread executing \c fn with the argument \c arg.
+	 * \param[in]	ctx		KSI context.
+	 * \param[in]	fn		Thread entry point.
+	 * \param[in]	arg		Argument for the thread entry point.
+	 * \param[out]	thread	Pointer to the receiving pointer.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_Thread_start(KSI_CTX *ctx, KSI_ThreadFn fn, void *arg, KSI_Thread **thread);
+
+	/**
+	 * Waits for the thread to finish. Calling this function more than once is
+	 * allowed, the consecutive calls return immediately.
+	 * \param[in]	thread	The thread.
+	 * \param[out]	result	The status code returned by the thread function, may be \c NULL.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_Thread_join(KSI_Thread *thread, int *result);
+
+	/**
+	 * Joins the thread, if still running, and releases the resources.
+	 * \param[in]	thread	The thread.
+	 */
+	void KSI_Thread_free(KSI_Thread *thread);
+
+	/**
+	 * Suspends the calling thread.
+	 * \param[in]	ms		Time to sleep in milliseconds.
+	 */
+	void KSI_Thread_sleep(unsigned ms);
+
+	/**
+	 * Non-recursive mutual exclusion lock for protecting state shared between threads.
+	 */
+	typedef struct KSI_Mutex_st KSI_Mutex;
+
+	/**
+	 * Creates a new mutex.
+	 * \param[in]	ctx		KSI context.
+	 * \param[out]	mutex	Pointer to the receiving pointer.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_Mutex_new(KSI_CTX *ctx, KSI_Mutex **mutex);
+
+	/**
+	 * Blocks until the mutex is acquired by the calling thread.
+	 * \param[in]	mutex	The mutex.
+	 */
+	void KSI_Mutex_lock(KSI_Mutex *mutex);
+
+	/**
+	 * Releases the mutex held by the calling thread.
+	 * \param[in]	mutex	The mutex.
+	 */
+	void KSI_Mutex_unlock(KSI_Mutex *mutex);
+
+	/**
+	 * Releases the resources of an unlocked mutex.
+	 * \param[in]	mutex	The mutex.
+	 */
+	void KSI_Mutex_free(KSI_Mutex *mutex);
+
+	/**
+	 * Condition variable for waiting until another thread changes the state protected by a #KSI_Mutex.
+	 */
+	typedef struct KSI_Cond_st KSI_Cond;
+
+	/**
+	 * Creates a new condition variable.
+	 * \param[in]	ctx		KSI context.
+	 * \param[out]	cond	Pointer to the receiving pointer.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_Cond_new(KSI_CTX *ctx, KSI_Cond **cond);
+
+	/**
+	 * Atomically releases the mutex held by the calling thread and blocks until the condition
+	 * is signalled. The mutex is held again when the function returns. As wakeups may be spurious,
+	 * the caller must check the state it is waiting for in a loop.
+	 * \param[in]	cond	The condition variable.
+	 * \param[in]	mutex	The mutex held by the calling thread.
+	 */
+	void KSI_Cond_wait(KSI_Cond *cond, KSI_Mutex *mutex);
+
+	/**
+	 * Same as #KSI_Cond_wait, but returns after at most the given time even if the condition
+	 * was not signalled.
+	 * \param[in]	cond	The condition variable.
+	 * \param[in]	mutex	The mutex held by the calling thread.
+	 * \param[in]	ms		Maximum time to wait in milliseconds.
+	 */
+	void KSI_Cond_timedWait(KSI_Cond *cond, KSI_Mutex *mutex, unsigned ms);
+
+	/**
+	 * Wakes up all the threads waiting for the condition.
+	 * \param[in]	cond	The condition variable.
+	 */
+	void KSI_Cond_broadcast(KSI_Cond *cond);
+
+	/**
+	 * Releases the resources of a condition variable nobody is waiting for.
+	 * \param[in]	cond	The condition variable.
+	 */
+	void KSI_Cond_free(KSI_Cond *cond);
+
+	/**
+	 * Storage holding a separate value for every thread. The values are released
+	 * with the destructor given to #KSI_ThreadLocal_new when the thread exits or,
+	 * at the latest, when the storage itself is freed.
+	 */
+	typedef struct KSI_ThreadLocal_st KSI_ThreadLocal;
+
+	/**
+	 * Creates a new thread local storage.
+	 * \param[in]	ctx			KSI context.
+	 * \param[in]	valueFree	Destructor for the values, may be \c NULL.
+	 * \param[out]	tl			Pointer to the receiving pointer.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_ThreadLocal_new(KSI_CTX *ctx, void (*valueFree)(void *), KSI_ThreadLocal **tl);
+
+	/**
+	 * Returns the value of the calling thread.
+	 * \param[in]	tl			The thread local storage.
+	 * \return The value or \c NULL if the calling thread has not set it.
+	 */
+	void *KSI_ThreadLocal_get(KSI_ThreadLocal *tl);
+
+	/**
+	 * Sets the value of the calling thread. On success the storage takes ownership
+	 * of the value and releases the previous value of the thread.
+	 * \param[in]	tl			The thread local storage.
+	 * \param[in]	value		The new value.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_ThreadLocal_set(KSI_ThreadLocal *tl, void *value);
+
+	/**
+	 * Releases the storage together with the values of all the threads.
+	 * \param[in]	tl			The thread local storage.
+	 * \note No other thread may use the storage during or after this call.
+	 */
+	void KSI_ThreadLocal_free(KSI_ThreadLocal *tl);
+
+	/**
+	 * Atomically increments the value.
+	 * \param[in]	value		Pointer to the value.
+	 * \return The incremented value.
+	 */
+	size_t KSI_Atomic_increment(volatile size_t *value);
+
+	/**
+	 * Atomically decrements the value.
+	 * \param[in]	value		Pointer to the value.
+	 * \return The decremented value.
+	 */
+	size_t KSI_Atomic_decrement(volatile size_t *value);
+
+	/**
+	 * Atomically adds \c delta to the value.
+	 * \param[in]	value		Pointer to the value.
+	 * \param[in]	delta		Value to be added.
+	 * \return The new value.
+	 */
+	size_t KSI_Atomic_add(volatile size_t *value, size_t delta);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KSI_THREAD_H_ */
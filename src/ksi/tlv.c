@@ -23,6 +23,7 @@
 #include "fast_tlv.h"
 #include "tlv.h"
 #include "io.h"
+#include "counters_impl.h"
 
 #define KSI_BUFFER_SIZE 0xffff + 1
 
@@ -30,6 +31,9 @@ struct KSI_TLV_st {
 	/** Context. */
 	KSI_CTX *ctx;
 
+	/** Reference counter. */
+	size_t ref;
+
 	/** Flags */
 	int isNonCritical;
 	int isForwardable;
@@ -55,6 +59,7 @@ struct KSI_TLV_st {
 };
 
 KSI_IMPLEMENT_LIST(KSI_TLV, KSI_TLV_free);
+KSI_IMPLEMENT_REF(KSI_TLV);
 
 /**
  *
@@ -335,6 +340,7 @@ int KSI_TLV_new(KSI_CTX *ctx, unsigned tag, int isLenient, int isForward, KSI_TL
 
 	/* Initialize context. */
 	tmp->ctx = ctx;
+	tmp->ref = 1;
 	tmp->tag = tag;
 	/* Make sure the values are *only* 1 or 0. */
 	tmp->isNonCritical = isLenient ? 1 : 0;
@@ -368,7 +374,7 @@ cleanup:
  *
  */
 void KSI_TLV_free(KSI_TLV *tlv) {
-	if (tlv != NULL) {
+	if (tlv != NULL && KSI_REF_DECREMENT(tlv) == 0) {
 		KSI_free(tlv->buffer);
 		/* Free nested data */
 
@@ -456,6 +462,8 @@ int KSI_TLV_parseBlob2(KSI_CTX *ctx, unsigned char *data, size_t data_length, in
 		tmp->buffer_size = data_length;
 	}
 
+	KSI_Counters_add(ctx, KSI_COUNTER_TLV_PARSED, 1);
+
 	*tlv = tmp;
 	tmp = NULL;
 
@@ -806,6 +814,9 @@ int KSI_TLV_writeBytes(const KSI_TLV *tlv, unsigned char *buf, size_t buf_size,
 		}
 	}
 
+	/* A call without the buffer only calculates the length. */
+	if (buf != NULL) KSI_Counters_add(tlv->ctx, KSI_COUNTER_TLV_SERIALIZED, 1);
+
 	*buf_len = len;
 
 	res = KSI_OK;
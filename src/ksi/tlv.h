@@ -255,6 +255,15 @@ extern "C" {
 	 */
 	int KSI_TLV_clone(const KSI_TLV *tlv, KSI_TLV **clone);
 
+	/**
+	 * Increases the reference count of the TLV. A TLV shared this way must not be
+	 * modified by any of its owners.
+	 * \param[in]	tlv			The TLV object.
+	 * \return Returns the input pointer.
+	 * \see #KSI_TLV_free
+	 */
+	KSI_TLV *KSI_TLV_ref(KSI_TLV *tlv);
+
 	/**
 	 * Set a raw value to the TLV object.
 	 * \param[in]	tlv			The TLV object.
@@ -184,17 +184,17 @@ cleanup:
 
 void KSI_TlvElement_free(KSI_TlvElement *t) {
 	if (t != NULL) {
-		if (t->ref <= 1) {
+		/* When ref_count == 0 we assume this is a stacked instance of the object. */
+		int stacked = (t->ref == 0);
+
+		if (stacked || KSI_REF_DECREMENT(t) == 0) {
 			KSI_TlvElementList_free(t->subList);
 
 			if (t->ptr_own) KSI_free(t->ptr);
 
-			/* When ref_count == 0 we assume this is a stacked instance of the object. */
-			if (t->ref != 0) {
+			if (!stacked) {
 				KSI_free(t);
 			}
-		} else {
-			--t->ref;
 		}
 	}
 }
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2013-2016 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+
+#ifndef KSI_TRACE_H_
+#define KSI_TRACE_H_
+
+#include "types_base.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * \addtogroup trace Tracing
+	 * The trace callback of a #KSI_CTX receives a start and an end event for every phase of
+	 * the requests and verifications performed with the context, so the time spent in each
+	 * phase can be measured without rebuilding the library.
+	 * @{
+	 */
+
+	/**
+	 * Traced phases.
+	 */
+	enum KSI_TracePhase_en {
+		/** Resolving the host name of the service. */
+		KSI_TRACE_DNS = 0x01,
+
+		/** Connecting to the service. */
+		KSI_TRACE_CONNECT,
+
+		/** Sending the request. */
+		KSI_TRACE_SEND,
+
+		/** Waiting for and receiving the response. */
+		KSI_TRACE_WAIT,
+
+		/** Parsing the response PDU and checking its HMAC. */
+		KSI_TRACE_RESPONSE,
+
+		/** Creating the signature from the aggregation response. */
+		KSI_TRACE_SIGNATURE,
+
+		/** Verifying the signature. */
+		KSI_TRACE_VERIFY
+	};
+
+	/**
+	 * Trace events.
+	 */
+	enum KSI_TraceEvent_en {
+		/** The phase started. */
+		KSI_TRACE_START = 0x00,
+
+		/** The phase ended, successfully or not. */
+		KSI_TRACE_END = 0x01
+	};
+
+	/**
+	 * Trace callback.
+	 * \param[in]	traceCtx	Trace context set with #KSI_CTX_setTraceCallback.
+	 * \param[in]	phase		Phase of the request, see #KSI_TracePhase_en.
+	 * \param[in]	event		Start or end of the phase, see #KSI_TraceEvent_en.
+	 * \param[in]	requestId	Request ID of the PDU the phase belongs to, 0 if the phase is not related
+	 * 							to a request (e.g. verification of a signature read from a file).
+	 * \param[in]	timestamp	Time of the event in microseconds of a monotonic clock with an unspecified origin.
+	 * \note The callback is called from the thread doing the work. The phases of the transport
+	 * implementations that do not expose the intermediate steps (e.g. cURL) are reported after
+	 * the transfer has completed, with the timestamps measured by the implementation.
+	 */
+	typedef void (*KSI_TraceCallback)(void *traceCtx, int phase, int event, KSI_uint64_t requestId, KSI_uint64_t timestamp);
+
+	/**
+	 * Sets the trace callback of the context.
+	 * \param[in]	ctx			KSI context.
+	 * \param[in]	cb			Trace callback, \c NULL to turn tracing off.
+	 * \param[in]	traceCtx	Context of the callback, may be \c NULL.
+	 * \return status code (#KSI_OK, when operation succeeded, otherwise an error code).
+	 */
+	int KSI_CTX_setTraceCallback(KSI_CTX *ctx, KSI_TraceCallback cb, void *traceCtx);
+
+/**
+ * @}
+ */
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KSI_TRACE_H_ */
@@ -24,6 +24,9 @@
 #include "hashchain.h"
 #include "impl/meta_data_impl.h"
 
+/* For optimization reasons, we need need access to KSI_DataHasher->closeExisting() function. */
+#include "hash_impl.h"
+
 KSI_IMPLEMENT_LIST(KSI_TreeBuilderLeafProcessor, NULL);
 
 struct KSI_TreeLeafHandle_st {
@@ -97,10 +100,11 @@ static int KSI_DataHasher_addTreeNode(KSI_DataHasher *hsr, KSI_TreeNode *node) {
 		res = KSI_DataHasher_addImprint(hsr, node->hash);
 		if (res != KSI_OK) goto cleanup;
 	} else if (node->metaData != NULL) {
-		unsigned char buf[0xffff + 4];
+		const unsigned char *buf = NULL;
 		size_t len;
 
-		res = node->metaData->serializePayload(node->metaData, buf, sizeof(buf), &len);
+		/* The serialized payload is cached by the metadata object, so shared metadata is serialized only once. */
+		res = node->metaData->getPayload(node->metaData, &buf, &len);
 		if (res != KSI_OK) goto cleanup;
 
 		res = KSI_DataHasher_add(hsr, buf, len);
@@ -285,7 +289,7 @@ cleanup:
 }
 
 void KSI_TreeBuilder_free(KSI_TreeBuilder *builder) {
-	if (builder != NULL && --builder->ref == 0) {
+	if (builder != NULL && KSI_REF_DECREMENT(builder) == 0) {
 		size_t i;
 		KSI_TreeNode_free(builder->rootNode);
 
@@ -381,8 +385,14 @@ static int processAndInsertNode(KSI_TreeBuilder *builder, KSI_TreeNode *node) {
 		if (res != KSI_OK) goto cleanup;
 
 		if (tmp != NULL) {
-			res = KSI_TreeNode_join(builder->ctx, builder->algo, localRoot == NULL ? node : localRoot, tmp, &localRoot);
-			if (res != KSI_OK) goto cleanup;
+			if (tmp->leftChild == (localRoot == NULL ? node : localRoot)) {
+				/* The processor has joined the nodes itself. */
+				localRoot = tmp;
+				tmp = NULL;
+			} else {
+				res = KSI_TreeNode_join(builder->ctx, builder->algo, localRoot == NULL ? node : localRoot, tmp, &localRoot);
+				if (res != KSI_OK) goto cleanup;
+			}
 		}
 	}
 
@@ -516,170 +526,222 @@ cleanup:
 }
 
 void KSI_TreeLeafHandle_free(KSI_TreeLeafHandle *handle) {
-	if (handle != NULL && --handle->ref == 0) {
+	if (handle != NULL && KSI_REF_DECREMENT(handle) == 0) {
 		KSI_free(handle);
 	}
 }
 
-static int getHashChainLinks(KSI_TreeNode *node, KSI_LIST(KSI_HashChainLink) *links) {
+/**
+ * Parameters of the hash chain link connecting a node to its parent.
+ */
+struct KSI_TreeLinkInfo_st {
+	/** The child node of the link. */
+	KSI_TreeNode *node;
+	bool isLeft;
+	KSI_DataHash *imprint;
+	KSI_MetaDataElement *metaData;
+	KSI_Integer *levelCorrection;
+};
+
+static void KSI_TreeLinkInfo_clear(struct KSI_TreeLinkInfo_st *info) {
+	if (info != NULL) {
+		KSI_DataHash_free(info->imprint);
+		KSI_MetaDataElement_free(info->metaData);
+		KSI_Integer_free(info->levelCorrection);
+		memset(info, 0, sizeof(*info));
+	}
+}
+
+static int getLinkInfo(KSI_TreeNode *node, struct KSI_TreeLinkInfo_st *info) {
 	int res = KSI_UNKNOWN_ERROR;
-	KSI_HashChainLink *link = NULL;
 	bool isLeft;
 	unsigned levelGap = 0;
 	KSI_Integer *levelCorrection = NULL;
 	KSI_TreeNode *pSibling = NULL;
 	KSI_MetaDataElement *mdEl = NULL;
 
-	if (node == NULL || links == NULL) {
+	if (node == NULL || node->parent == NULL || info == NULL) {
 		res = KSI_INVALID_ARGUMENT;
 		goto cleanup;
 	}
 
-	if (node->parent != NULL) {
-
-		res = KSI_HashChainLink_new(node->ctx, &link);
-		if (res != KSI_OK) goto cleanup;
-
+	if (node->parent->leftChild == node) {
+		isLeft = true;
+	} else if (node->parent->rightChild == node) {
+		isLeft = false;
+	} else {
+		/* Just in case there is a mess with the tree. */
+		res = KSI_INVALID_STATE;
+		goto cleanup;
+	}
 
-		if (node->parent->leftChild == node) {
-			isLeft = true;
-		} else if (node->parent->rightChild == node) {
-			isLeft = false;
-		} else {
-			/* Just in case there is a mess with the tree. */
+	if (isLeft) {
+		if (node->parent->rightChild == NULL) {
+			res = KSI_INVALID_STATE;
+			goto cleanup;
+		}
+		pSibling = node->parent->rightChild;
+	} else {
+		if (node->parent->leftChild == NULL) {
 			res = KSI_INVALID_STATE;
 			goto cleanup;
 		}
+		pSibling = node->parent->leftChild;
+	}
+
+	/* Sanity check. */
+	if ((pSibling->hash == NULL && pSibling->metaData == NULL) || (pSibling->hash != NULL && pSibling->metaData != NULL)) {
+		res = KSI_INVALID_STATE;
+		goto cleanup;
+	}
 
-		res = KSI_HashChainLink_setIsLeft(link, isLeft);
+	/* Convert the meta-data to the internal representation. */
+	if (pSibling->metaData != NULL) {
+		res = pSibling->metaData->toMetaDataElement(pSibling->metaData, &mdEl);
 		if (res != KSI_OK) goto cleanup;
+	}
 
-		if (isLeft) {
-			if (node->parent->rightChild == NULL) {
-				res = KSI_INVALID_STATE;
-				goto cleanup;
-			}
-			pSibling = node->parent->rightChild;
-		} else {
-			if (node->parent->leftChild == NULL) {
-				res = KSI_INVALID_STATE;
-				goto cleanup;
-			}
-			pSibling = node->parent->leftChild;
-		}
+	/* Sanity check. */
+	if (node->parent->level <= node->level) {
+		res = KSI_INVALID_STATE;
+		goto cleanup;
+	}
 
-		/* Sanity check. */
-		if ((pSibling->hash == NULL && pSibling->metaData == NULL) || (pSibling->hash != NULL && pSibling->metaData != NULL)) {
-			res = KSI_INVALID_STATE;
-			goto cleanup;
-		}
+	/* Calculate the level correction. */
+	levelGap = node->parent->level - node->level - 1;
 
-		/* Add the hash value. */
-		{
-			KSI_DataHash *ref = NULL;
+	if (levelGap > 0) {
+		res = KSI_Integer_new(node->ctx, levelGap, &levelCorrection);
+		if (res != KSI_OK) goto cleanup;
+	}
 
-			res = KSI_HashChainLink_setImprint(link, ref = KSI_DataHash_ref(pSibling->hash));
-			if (res != KSI_OK) {
-				/* Cleanup the reference. */
-				KSI_DataHash_free(ref);
+	info->node = node;
+	info->isLeft = isLeft;
+	info->imprint = KSI_DataHash_ref(pSibling->hash);
+	info->metaData = mdEl;
+	info->levelCorrection = levelCorrection;
 
-				goto cleanup;
-			}
-		}
+	mdEl = NULL;
+	levelCorrection = NULL;
 
-		/* Add the meta-data. */
-		if (pSibling->metaData != NULL) {
-			KSI_MetaDataElement *ref = NULL;
+	res = KSI_OK;
 
-			/* Convert the element to the internal representation. */
-			res = pSibling->metaData->toMetaDataElement(pSibling->metaData, &mdEl);
-			if (res != KSI_OK) goto cleanup;
+cleanup:
 
-			res = KSI_HashChainLink_setMetaData(link, ref = KSI_MetaDataElement_ref(mdEl));
-			if (res != KSI_OK) {
-				/* Cleanup the reference. */
-				KSI_MetaDataElement_free(ref);
+	KSI_MetaDataElement_free(mdEl);
+	KSI_Integer_free(levelCorrection);
 
-				goto cleanup;
-			}
-		}
+	return res;
+}
+
+static int appendLink(KSI_CTX *ctx, struct KSI_TreeLinkInfo_st *info, KSI_LIST(KSI_HashChainLink) *links) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_HashChainLink *link = NULL;
+
+	res = KSI_HashChainLink_new(ctx, &link);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_HashChainLink_setIsLeft(link, info->isLeft);
+	if (res != KSI_OK) goto cleanup;
+
+	/* Add the hash value. */
+	{
+		KSI_DataHash *ref = NULL;
+
+		res = KSI_HashChainLink_setImprint(link, ref = KSI_DataHash_ref(info->imprint));
+		if (res != KSI_OK) {
+			/* Cleanup the reference. */
+			KSI_DataHash_free(ref);
 
-		/* Sanity check. */
-		if (node->parent->level <= node->level) {
-			res = KSI_INVALID_STATE;
 			goto cleanup;
 		}
+	}
 
-		/* Calculate the level correction. */
-		levelGap = node->parent->level - node->level - 1;
-
-		if (levelGap > 0) {
-			res = KSI_Integer_new(node->ctx, levelGap, &levelCorrection);
-			if (res != KSI_OK) goto cleanup;
+	/* Add the meta-data. */
+	if (info->metaData != NULL) {
+		KSI_MetaDataElement *ref = NULL;
 
-			res = KSI_HashChainLink_setLevelCorrection(link, levelCorrection);
-			if (res != KSI_OK) goto cleanup;
+		res = KSI_HashChainLink_setMetaData(link, ref = KSI_MetaDataElement_ref(info->metaData));
+		if (res != KSI_OK) {
+			/* Cleanup the reference. */
+			KSI_MetaDataElement_free(ref);
 
-			levelCorrection = NULL;
+			goto cleanup;
 		}
+	}
 
-		res = KSI_HashChainLinkList_append(links, link);
-		if (res != KSI_OK) goto cleanup;
-		link = NULL;
+	/* Add the level correction. */
+	if (info->levelCorrection != NULL) {
+		KSI_Integer *ref = NULL;
 
-		res = getHashChainLinks(node->parent, links);
-		if (res != KSI_OK) goto cleanup;
+		res = KSI_HashChainLink_setLevelCorrection(link, ref = KSI_Integer_ref(info->levelCorrection));
+		if (res != KSI_OK) {
+			/* Cleanup the reference. */
+			KSI_Integer_free(ref);
+
+			goto cleanup;
+		}
 	}
 
+	res = KSI_HashChainLinkList_append(links, link);
+	if (res != KSI_OK) goto cleanup;
+	link = NULL;
+
 	res = KSI_OK;
 
 cleanup:
 
-	KSI_MetaDataElement_free(mdEl);
-	KSI_Integer_free(levelCorrection);
-
 	KSI_HashChainLink_free(link);
 
 	return res;
 }
 
-
-int KSI_TreeLeafHandle_getAggregationChain(KSI_TreeLeafHandle *handle, KSI_AggregationHashChain **chain) {
+static int getHashChainLinks(KSI_TreeNode *node, KSI_LIST(KSI_HashChainLink) *links) {
 	int res = KSI_UNKNOWN_ERROR;
-	KSI_AggregationHashChain *tmp = NULL;
-	KSI_LIST(KSI_HashChainLink) *links = NULL;
-	KSI_Integer *algoId = NULL;
+	struct KSI_TreeLinkInfo_st info;
 
-	if (handle == NULL || chain == NULL) {
+	memset(&info, 0, sizeof(info));
+
+	if (node == NULL || links == NULL) {
 		res = KSI_INVALID_ARGUMENT;
 		goto cleanup;
 	}
 
-	/* Create new object. */
-	res = KSI_AggregationHashChain_new(handle->pBuilder->ctx, &tmp);
-	if (res != KSI_OK) {
-		KSI_pushError(handle->pBuilder->ctx, res, NULL);
-		goto cleanup;
-	}
+	for (; node->parent != NULL; node = node->parent) {
+		res = getLinkInfo(node, &info);
+		if (res != KSI_OK) goto cleanup;
 
-	/* Create new list. */
-	res = KSI_HashChainLinkList_new(&links);
-	if (res != KSI_OK) {
-		KSI_pushError(handle->pBuilder->ctx, res, NULL);
-		goto cleanup;
+		res = appendLink(node->ctx, &info, links);
+		if (res != KSI_OK) goto cleanup;
+
+		KSI_TreeLinkInfo_clear(&info);
 	}
 
-	/* Extract the hash chain links. */
-	res = getHashChainLinks(handle->leafNode, links);
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_TreeLinkInfo_clear(&info);
+
+	return res;
+}
+
+static int createAggregationChain(KSI_TreeBuilder *builder, KSI_TreeNode *leafNode, KSI_LIST(KSI_HashChainLink) *links, KSI_AggregationHashChain **chain) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_AggregationHashChain *tmp = NULL;
+	KSI_Integer *algoId = NULL;
+
+	/* Create new object. */
+	res = KSI_AggregationHashChain_new(builder->ctx, &tmp);
 	if (res != KSI_OK) {
-		KSI_pushError(handle->pBuilder->ctx, res, NULL);
+		KSI_pushError(builder->ctx, res, NULL);
 		goto cleanup;
 	}
 
 	/* Set the hash chain links to the container. */
 	res = KSI_AggregationHashChain_setChain(tmp, links);
 	if (res != KSI_OK) {
-		KSI_pushError(handle->pBuilder->ctx, res, NULL);
+		KSI_pushError(builder->ctx, res, NULL);
 		goto cleanup;
 	}
 
@@ -687,26 +749,26 @@ int KSI_TreeLeafHandle_getAggregationChain(KSI_TreeLeafHandle *handle, KSI_Aggre
 	{
 		KSI_DataHash *ref = NULL;
 
-		res = KSI_AggregationHashChain_setInputHash(tmp, ref = KSI_DataHash_ref(handle->leafNode->hash));
+		res = KSI_AggregationHashChain_setInputHash(tmp, ref = KSI_DataHash_ref(leafNode->hash));
 		if (res != KSI_OK) {
 			/* Cleanup the reference. */
 			KSI_DataHash_free(ref);
 
-			KSI_pushError(handle->pBuilder->ctx, res, NULL);
+			KSI_pushError(builder->ctx, res, NULL);
 			goto cleanup;
 		}
 	}
 
 	/* Set the aggregation algorithm. */
-	res = KSI_Integer_new(handle->pBuilder->ctx, handle->pBuilder->algo, &algoId);
+	res = KSI_Integer_new(builder->ctx, builder->algo, &algoId);
 	if (res != KSI_OK) {
-		KSI_pushError(handle->pBuilder->ctx, res, NULL);
+		KSI_pushError(builder->ctx, res, NULL);
 		goto cleanup;
 	}
 
 	res = KSI_AggregationHashChain_setAggrHashId(tmp, algoId);
 	if (res != KSI_OK) {
-		KSI_pushError(handle->pBuilder->ctx, res, NULL);
+		KSI_pushError(builder->ctx, res, NULL);
 		goto cleanup;
 	}
 	algoId = NULL;
@@ -724,3 +786,835 @@ cleanup:
 	return res;
 }
 
+int KSI_TreeLeafHandle_getAggregationChain(KSI_TreeLeafHandle *handle, KSI_AggregationHashChain **chain) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_LIST(KSI_HashChainLink) *links = NULL;
+
+	if (handle == NULL || chain == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	/* Create new list. */
+	res = KSI_HashChainLinkList_new(&links);
+	if (res != KSI_OK) {
+		KSI_pushError(handle->pBuilder->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	/* Extract the hash chain links. */
+	res = getHashChainLinks(handle->leafNode, links);
+	if (res != KSI_OK) {
+		KSI_pushError(handle->pBuilder->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = createAggregationChain(handle->pBuilder, handle->leafNode, links, chain);
+	if (res != KSI_OK) {
+		KSI_pushError(handle->pBuilder->ctx, res, NULL);
+		goto cleanup;
+	}
+	links = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_HashChainLinkList_free(links);
+
+	return res;
+}
+
+int KSI_TreeBuilder_getAggregationChains(KSI_TreeBuilder *builder, KSI_LIST(KSI_TreeLeafHandle) *leafs, KSI_TreeLeafChainCallback fn, void *c) {
+	int res = KSI_UNKNOWN_ERROR;
+	/* The links from the previous and the current leaf to the root, bottom up. As the levels
+	 * of the nodes are strictly increasing towards the root, the paths fit into the buffers. */
+	struct KSI_TreeLinkInfo_st pathBuf[2][KSI_TREE_BUILDER_STACK_LEN + 1];
+	struct KSI_TreeLinkInfo_st *prev = pathBuf[0];
+	struct KSI_TreeLinkInfo_st *cur = pathBuf[1];
+	size_t prev_len = 0;
+	size_t cur_len = 0;
+	KSI_LIST(KSI_HashChainLink) *links = NULL;
+	KSI_AggregationHashChain *chain = NULL;
+	size_t i;
+	size_t j;
+
+	memset(pathBuf, 0, sizeof(pathBuf));
+
+	if (builder == NULL || fn == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	KSI_ERR_clearErrors(builder->ctx);
+
+	if (builder->rootNode == NULL) {
+		KSI_pushError(builder->ctx, res = KSI_INVALID_STATE, "The tree is not closed.");
+		goto cleanup;
+	}
+
+	for (i = 0; i < KSI_TreeLeafHandleList_length(leafs); i++) {
+		KSI_TreeLeafHandle *handle = NULL;
+		KSI_TreeNode *node = NULL;
+		size_t shared = prev_len;
+
+		res = KSI_TreeLeafHandleList_elementAt(leafs, i, &handle);
+		if (res != KSI_OK || handle == NULL) {
+			KSI_pushError(builder->ctx, res = (res != KSI_OK ? res : KSI_INVALID_STATE), NULL);
+			goto cleanup;
+		}
+
+		if (handle->pBuilder != builder) {
+			KSI_pushError(builder->ctx, res = KSI_INVALID_ARGUMENT, "The leaf does not belong to the tree.");
+			goto cleanup;
+		}
+
+		/* Walk up until a node on the path of the previous leaf is reached. */
+		for (node = handle->leafNode; node->parent != NULL; node = node->parent) {
+			for (shared = 0; shared < prev_len && prev[shared].node != node; shared++);
+			if (shared < prev_len) break;
+
+			if (cur_len > KSI_TREE_BUILDER_STACK_LEN) {
+				KSI_pushError(builder->ctx, res = KSI_INVALID_STATE, "Tree too large.");
+				goto cleanup;
+			}
+
+			res = getLinkInfo(node, &cur[cur_len]);
+			if (res != KSI_OK) {
+				KSI_pushError(builder->ctx, res, NULL);
+				goto cleanup;
+			}
+			cur_len++;
+		}
+
+		/* Reuse the upper part of the previous path. */
+		for (j = 0; j < prev_len; j++) {
+			if (j >= shared && node->parent != NULL) {
+				cur[cur_len++] = prev[j];
+				memset(&prev[j], 0, sizeof(prev[j]));
+			} else {
+				KSI_TreeLinkInfo_clear(&prev[j]);
+			}
+		}
+		prev_len = 0;
+
+		res = KSI_HashChainLinkList_new(&links);
+		if (res != KSI_OK) {
+			KSI_pushError(builder->ctx, res, NULL);
+			goto cleanup;
+		}
+
+		for (j = 0; j < cur_len; j++) {
+			res = appendLink(builder->ctx, &cur[j], links);
+			if (res != KSI_OK) {
+				KSI_pushError(builder->ctx, res, NULL);
+				goto cleanup;
+			}
+		}
+
+		res = createAggregationChain(builder, handle->leafNode, links, &chain);
+		if (res != KSI_OK) {
+			KSI_pushError(builder->ctx, res, NULL);
+			goto cleanup;
+		}
+		links = NULL;
+
+		/* The ownership of the chain is passed to the callback. */
+		res = fn(c, i, chain);
+		chain = NULL;
+		if (res != KSI_OK) {
+			KSI_pushError(builder->ctx, res, NULL);
+			goto cleanup;
+		}
+
+		/* The current path becomes the previous one. */
+		{
+			struct KSI_TreeLinkInfo_st *swp = prev;
+			prev = cur;
+			cur = swp;
+			prev_len = cur_len;
+			cur_len = 0;
+		}
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	for (j = 0; j < KSI_TREE_BUILDER_STACK_LEN + 1; j++) {
+		KSI_TreeLinkInfo_clear(&pathBuf[0][j]);
+		KSI_TreeLinkInfo_clear(&pathBuf[1][j]);
+	}
+
+	KSI_AggregationHashChain_free(chain);
+	KSI_HashChainLinkList_free(links);
+
+	return res;
+}
+
+
+/* Flat tree builder. */
+
+struct KSI_FlatTreeLevel_st {
+	/** Imprints of the nodes stored back to back. */
+	unsigned char *buf;
+	/** Length of a single imprint. */
+	size_t stride;
+	/** Number of the nodes on this level. */
+	size_t count;
+	/** Number of the nodes the buffer can hold. */
+	size_t size;
+};
+
+struct KSI_FlatTreeSpine_st {
+	/** Height of the complete subtree root joined into the spine. */
+	size_t height;
+	/** The imprint of the spine node (the root of the subtrees joined so far). */
+	unsigned char imprint[KSI_MAX_IMPRINT_LEN];
+	/** Length of the imprint. */
+	size_t imprint_len;
+	/** The aggregation level of the spine node. */
+	unsigned level;
+};
+
+struct KSI_FlatTreeBuilder_st {
+	KSI_CTX *ctx;
+	size_t ref;
+	/** Hashing algorithm for the internal nodes. */
+	KSI_HashAlgorithm algo;
+	/** The level of all the leafs. */
+	unsigned leafLevel;
+	/** Complete subtree nodes grouped by the height, index 0 holds the leafs. */
+	struct KSI_FlatTreeLevel_st levels[KSI_TREE_BUILDER_STACK_LEN];
+	/** Number of used levels. */
+	size_t levels_count;
+	/** Nodes joining the complete subtrees into a single tree, lowest first. Filled by #KSI_FlatTreeBuilder_close. */
+	struct KSI_FlatTreeSpine_st spine[KSI_TREE_BUILDER_STACK_LEN];
+	/** Number of used spine entries, 0 until the tree is closed. */
+	size_t spine_count;
+	/** Reused hasher for the internal nodes. */
+	KSI_DataHasher *hsr;
+};
+
+static unsigned char *flatNode(KSI_FlatTreeBuilder *builder, size_t height, size_t index) {
+	return builder->levels[height].buf + index * builder->levels[height].stride;
+}
+
+static int flatAppend(KSI_FlatTreeBuilder *builder, size_t height, const unsigned char *imprint, size_t imprint_len) {
+	int res = KSI_UNKNOWN_ERROR;
+	struct KSI_FlatTreeLevel_st *lvl = NULL;
+	unsigned char *tmp = NULL;
+
+	if (height >= KSI_TREE_BUILDER_STACK_LEN || builder->leafLevel + height > 0xff) {
+		KSI_pushError(builder->ctx, res = KSI_INVALID_STATE, "Tree too large.");
+		goto cleanup;
+	}
+
+	lvl = &builder->levels[height];
+
+	if (lvl->stride == 0) {
+		lvl->stride = imprint_len;
+	} else if (lvl->stride != imprint_len) {
+		KSI_pushError(builder->ctx, res = KSI_INVALID_ARGUMENT, "All leafs must have the same hash algorithm.");
+		goto cleanup;
+	}
+
+	/* Grow the buffer when needed. */
+	if (lvl->count == lvl->size) {
+		size_t size = lvl->size == 0 ? 0x40 : lvl->size * 2;
+
+		tmp = KSI_malloc(size * lvl->stride);
+		if (tmp == NULL) {
+			KSI_pushError(builder->ctx, res = KSI_OUT_OF_MEMORY, NULL);
+			goto cleanup;
+		}
+
+		if (lvl->buf != NULL) {
+			memcpy(tmp, lvl->buf, lvl->count * lvl->stride);
+			KSI_free(lvl->buf);
+		}
+
+		lvl->buf = tmp;
+		lvl->size = size;
+		tmp = NULL;
+	}
+
+	memcpy(lvl->buf + lvl->count * lvl->stride, imprint, imprint_len);
+	lvl->count++;
+
+	if (height >= builder->levels_count) builder->levels_count = height + 1;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_free(tmp);
+
+	return res;
+}
+
+static int flatJoin(KSI_FlatTreeBuilder *builder, const unsigned char *left, size_t left_len, const unsigned char *right, size_t right_len, unsigned level, KSI_DataHash *out) {
+	int res = KSI_UNKNOWN_ERROR;
+	unsigned char l;
+
+	if (!KSI_IS_VALID_TREE_LEVEL(level)) {
+		KSI_pushError(builder->ctx, res = KSI_INVALID_STATE, "Tree too large.");
+		goto cleanup;
+	}
+
+	l = (unsigned char) level;
+
+	res = KSI_DataHasher_reset(builder->hsr);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_DataHasher_add(builder->hsr, left, left_len);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_DataHasher_add(builder->hsr, right, right_len);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_DataHasher_add(builder->hsr, &l, 1);
+	if (res != KSI_OK) goto cleanup;
+
+	/* Avoid allocating a new hash object for every node. */
+	res = builder->hsr->closeExisting(builder->hsr, out);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+int KSI_FlatTreeBuilder_new(KSI_CTX *ctx, KSI_HashAlgorithm algo, int leafLevel, KSI_FlatTreeBuilder **builder) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_FlatTreeBuilder *tmp = NULL;
+
+	if (ctx == NULL || !KSI_IS_VALID_TREE_LEVEL(leafLevel) || builder == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	KSI_ERR_clearErrors(ctx);
+
+	if (!KSI_isHashAlgorithmSupported(algo)) {
+		KSI_pushError(ctx, res = KSI_UNAVAILABLE_HASH_ALGORITHM, NULL);
+		goto cleanup;
+	}
+
+	if (!KSI_isHashAlgorithmTrusted(algo)) {
+		KSI_pushError(ctx, res = KSI_UNTRUSTED_HASH_ALGORITHM, NULL);
+		goto cleanup;
+	}
+
+	tmp = KSI_new(KSI_FlatTreeBuilder);
+	if (tmp == NULL) {
+		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
+		goto cleanup;
+	}
+
+	tmp->ctx = ctx;
+	tmp->ref = 1;
+	tmp->algo = algo;
+	tmp->leafLevel = (unsigned)leafLevel;
+	tmp->levels_count = 0;
+	tmp->spine_count = 0;
+	tmp->hsr = NULL;
+	memset(tmp->levels, 0, sizeof(tmp->levels));
+
+	res = KSI_DataHasher_open(ctx, algo, &tmp->hsr);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	*builder = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_FlatTreeBuilder_free(tmp);
+
+	return res;
+}
+
+void KSI_FlatTreeBuilder_free(KSI_FlatTreeBuilder *builder) {
+	if (builder != NULL && KSI_REF_DECREMENT(builder) == 0) {
+		size_t i;
+
+		for (i = 0; i < builder->levels_count; i++) {
+			KSI_free(builder->levels[i].buf);
+		}
+
+		KSI_DataHasher_free(builder->hsr);
+		KSI_free(builder);
+	}
+}
+
+int KSI_FlatTreeBuilder_addDataHash(KSI_FlatTreeBuilder *builder, KSI_DataHash *hsh, size_t *index) {
+	int res = KSI_UNKNOWN_ERROR;
+	const unsigned char *imprint = NULL;
+	size_t imprint_len = 0;
+	size_t height = 0;
+	size_t leafIndex;
+	KSI_DataHash node;
+
+	if (builder == NULL || hsh == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	KSI_ERR_clearErrors(builder->ctx);
+
+	if (builder->spine_count > 0) {
+		KSI_pushError(builder->ctx, res = KSI_INVALID_STATE, "The tree has been finished, new leafs may not be added.");
+		goto cleanup;
+	}
+
+	res = KSI_DataHash_getImprint(hsh, &imprint, &imprint_len);
+	if (res != KSI_OK) {
+		KSI_pushError(builder->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	leafIndex = builder->levels[0].count;
+
+	res = flatAppend(builder, 0, imprint, imprint_len);
+	if (res != KSI_OK) {
+		KSI_pushError(builder->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	/* Join the complete pairs as long as possible. */
+	while (builder->levels[height].count % 2 == 0) {
+		struct KSI_FlatTreeLevel_st *lvl = &builder->levels[height];
+
+		res = flatJoin(builder,
+				flatNode(builder, height, lvl->count - 2), lvl->stride,
+				flatNode(builder, height, lvl->count - 1), lvl->stride,
+				builder->leafLevel + (unsigned)height + 1, &node);
+		if (res != KSI_OK) {
+			KSI_pushError(builder->ctx, res, NULL);
+			goto cleanup;
+		}
+
+		height++;
+
+		res = flatAppend(builder, height, node.imprint, node.imprint_length);
+		if (res != KSI_OK) {
+			KSI_pushError(builder->ctx, res, NULL);
+			goto cleanup;
+		}
+	}
+
+	if (index != NULL) *index = leafIndex;
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+int KSI_FlatTreeBuilder_close(KSI_FlatTreeBuilder *builder) {
+	int res = KSI_UNKNOWN_ERROR;
+	size_t height;
+	size_t count = 0;
+	KSI_DataHash node;
+
+	if (builder == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	KSI_ERR_clearErrors(builder->ctx);
+
+	if (builder->spine_count > 0) {
+		res = KSI_OK;
+		goto cleanup;
+	}
+
+	if (builder->levels[0].count == 0) {
+		KSI_pushError(builder->ctx, res = KSI_INVALID_STATE, "The tree has no leafs.");
+		goto cleanup;
+	}
+
+	/* Join the roots of the complete subtrees, lowest first, as #KSI_TreeBuilder_close does. */
+	for (height = 0; height < builder->levels_count; height++) {
+		struct KSI_FlatTreeLevel_st *lvl = &builder->levels[height];
+		struct KSI_FlatTreeSpine_st *sp = &builder->spine[count];
+		unsigned level = builder->leafLevel + (unsigned)height;
+
+		if (lvl->count % 2 == 0) continue;
+
+		sp->height = height;
+
+		if (count == 0) {
+			memcpy(sp->imprint, flatNode(builder, height, lvl->count - 1), lvl->stride);
+			sp->imprint_len = lvl->stride;
+			sp->level = level;
+		} else {
+			struct KSI_FlatTreeSpine_st *prev = &builder->spine[count - 1];
+
+			sp->level = (level > prev->level ? level : prev->level) + 1;
+
+			res = flatJoin(builder, flatNode(builder, height, lvl->count - 1), lvl->stride, prev->imprint, prev->imprint_len, sp->level, &node);
+			if (res != KSI_OK) {
+				KSI_pushError(builder->ctx, res, NULL);
+				goto cleanup;
+			}
+
+			memcpy(sp->imprint, node.imprint, node.imprint_length);
+			sp->imprint_len = node.imprint_length;
+		}
+
+		count++;
+	}
+
+	builder->spine_count = count;
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+int KSI_FlatTreeBuilder_getRootHash(KSI_FlatTreeBuilder *builder, KSI_DataHash **hsh, int *level) {
+	int res = KSI_UNKNOWN_ERROR;
+	struct KSI_FlatTreeSpine_st *root = NULL;
+
+	if (builder == NULL || hsh == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	KSI_ERR_clearErrors(builder->ctx);
+
+	if (builder->spine_count == 0) {
+		KSI_pushError(builder->ctx, res = KSI_INVALID_STATE, "The tree is not closed.");
+		goto cleanup;
+	}
+
+	root = &builder->spine[builder->spine_count - 1];
+
+	res = KSI_DataHash_fromImprint(builder->ctx, root->imprint, root->imprint_len, hsh);
+	if (res != KSI_OK) {
+		KSI_pushError(builder->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	if (level != NULL) *level = (int)root->level;
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+/**
+ * Sibling hash values are shared between the chains of neighbouring leafs, this cache
+ * keeps the last sibling per height, so consecutive leafs reuse the same object.
+ */
+struct KSI_FlatTreeSiblingCache_st {
+	KSI_DataHash *hash[KSI_TREE_BUILDER_STACK_LEN];
+	size_t index[KSI_TREE_BUILDER_STACK_LEN];
+};
+
+static int flatSibling(KSI_FlatTreeBuilder *builder, struct KSI_FlatTreeSiblingCache_st *cache, size_t height, size_t index, KSI_DataHash **hsh) {
+	int res = KSI_UNKNOWN_ERROR;
+
+	if (cache->hash[height] == NULL || cache->index[height] != index) {
+		KSI_DataHash_free(cache->hash[height]);
+		cache->hash[height] = NULL;
+
+		res = KSI_DataHash_fromImprint(builder->ctx, flatNode(builder, height, index), builder->levels[height].stride, &cache->hash[height]);
+		if (res != KSI_OK) goto cleanup;
+
+		cache->index[height] = index;
+	}
+
+	*hsh = KSI_DataHash_ref(cache->hash[height]);
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+static int flatAppendLink(KSI_CTX *ctx, KSI_LIST(KSI_HashChainLink) *links, bool isLeft, KSI_DataHash *sibling, unsigned levelGap) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_HashChainLink *link = NULL;
+	KSI_Integer *levelCorrection = NULL;
+
+	res = KSI_HashChainLink_new(ctx, &link);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_HashChainLink_setIsLeft(link, isLeft);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_HashChainLink_setImprint(link, sibling);
+	if (res != KSI_OK) goto cleanup;
+	sibling = NULL;
+
+	if (levelGap > 0) {
+		res = KSI_Integer_new(ctx, levelGap, &levelCorrection);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_HashChainLink_setLevelCorrection(link, levelCorrection);
+		if (res != KSI_OK) goto cleanup;
+
+		levelCorrection = NULL;
+	}
+
+	res = KSI_HashChainLinkList_append(links, link);
+	if (res != KSI_OK) goto cleanup;
+	link = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_DataHash_free(sibling);
+	KSI_Integer_free(levelCorrection);
+	KSI_HashChainLink_free(link);
+
+	return res;
+}
+
+static int flatGetChain(KSI_FlatTreeBuilder *builder, struct KSI_FlatTreeSiblingCache_st *cache, size_t leafIndex, KSI_AggregationHashChain **chain) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_AggregationHashChain *tmp = NULL;
+	KSI_LIST(KSI_HashChainLink) *links = NULL;
+	KSI_DataHash *hsh = NULL;
+	KSI_Integer *algoId = NULL;
+	size_t height = 0;
+	size_t index = leafIndex;
+	size_t sp = 0;
+	unsigned level;
+
+	if (leafIndex >= builder->levels[0].count) {
+		KSI_pushError(builder->ctx, res = KSI_INVALID_ARGUMENT, "Leaf index out of range.");
+		goto cleanup;
+	}
+
+	res = KSI_HashChainLinkList_new(&links);
+	if (res != KSI_OK) {
+		KSI_pushError(builder->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	/* Walk up the complete subtree containing the leaf. */
+	while (height + 1 < builder->levels_count && index / 2 < builder->levels[height + 1].count) {
+		res = flatSibling(builder, cache, height, index ^ 1, &hsh);
+		if (res != KSI_OK) {
+			KSI_pushError(builder->ctx, res, NULL);
+			goto cleanup;
+		}
+
+		res = flatAppendLink(builder->ctx, links, (index & 1) == 0, hsh, 0);
+		hsh = NULL;
+		if (res != KSI_OK) {
+			KSI_pushError(builder->ctx, res, NULL);
+			goto cleanup;
+		}
+
+		index /= 2;
+		height++;
+	}
+
+	/* Find the position of the subtree root in the spine. */
+	while (sp < builder->spine_count && builder->spine[sp].height != height) sp++;
+	if (sp == builder->spine_count) {
+		KSI_pushError(builder->ctx, res = KSI_INVALID_STATE, "Inconsistent tree.");
+		goto cleanup;
+	}
+
+	level = builder->leafLevel + (unsigned)height;
+
+	/* Except for the lowest subtree, the subtree root is the left child of the spine node. */
+	if (sp > 0) {
+		struct KSI_FlatTreeSpine_st *prev = &builder->spine[sp - 1];
+
+		res = KSI_DataHash_fromImprint(builder->ctx, prev->imprint, prev->imprint_len, &hsh);
+		if (res != KSI_OK) {
+			KSI_pushError(builder->ctx, res, NULL);
+			goto cleanup;
+		}
+
+		res = flatAppendLink(builder->ctx, links, true, hsh, builder->spine[sp].level - level - 1);
+		hsh = NULL;
+		if (res != KSI_OK) {
+			KSI_pushError(builder->ctx, res, NULL);
+			goto cleanup;
+		}
+	}
+
+	level = builder->spine[sp].level;
+
+	/* The rest of the spine nodes are right children. */
+	for (sp++; sp < builder->spine_count; sp++) {
+		struct KSI_FlatTreeSpine_st *cur = &builder->spine[sp];
+		struct KSI_FlatTreeLevel_st *lvl = &builder->levels[cur->height];
+
+		res = flatSibling(builder, cache, cur->height, lvl->count - 1, &hsh);
+		if (res != KSI_OK) {
+			KSI_pushError(builder->ctx, res, NULL);
+			goto cleanup;
+		}
+
+		res = flatAppendLink(builder->ctx, links, false, hsh, cur->level - level - 1);
+		hsh = NULL;
+		if (res != KSI_OK) {
+			KSI_pushError(builder->ctx, res, NULL);
+			goto cleanup;
+		}
+
+		level = cur->level;
+	}
+
+	res = KSI_AggregationHashChain_new(builder->ctx, &tmp);
+	if (res != KSI_OK) {
+		KSI_pushError(builder->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_AggregationHashChain_setChain(tmp, links);
+	if (res != KSI_OK) {
+		KSI_pushError(builder->ctx, res, NULL);
+		goto cleanup;
+	}
+	links = NULL;
+
+	res = KSI_DataHash_fromImprint(builder->ctx, flatNode(builder, 0, leafIndex), builder->levels[0].stride, &hsh);
+	if (res != KSI_OK) {
+		KSI_pushError(builder->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_AggregationHashChain_setInputHash(tmp, hsh);
+	if (res != KSI_OK) {
+		KSI_pushError(builder->ctx, res, NULL);
+		goto cleanup;
+	}
+	hsh = NULL;
+
+	res = KSI_Integer_new(builder->ctx, builder->algo, &algoId);
+	if (res != KSI_OK) {
+		KSI_pushError(builder->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_AggregationHashChain_setAggrHashId(tmp, algoId);
+	if (res != KSI_OK) {
+		KSI_pushError(builder->ctx, res, NULL);
+		goto cleanup;
+	}
+	algoId = NULL;
+
+	*chain = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_Integer_free(algoId);
+	KSI_DataHash_free(hsh);
+	KSI_HashChainLinkList_free(links);
+	KSI_AggregationHashChain_free(tmp);
+
+	return res;
+}
+
+static void flatSiblingCache_clear(struct KSI_FlatTreeSiblingCache_st *cache) {
+	size_t i;
+	for (i = 0; i < KSI_TREE_BUILDER_STACK_LEN; i++) {
+		KSI_DataHash_free(cache->hash[i]);
+		cache->hash[i] = NULL;
+	}
+}
+
+int KSI_FlatTreeBuilder_getAggregationChain(KSI_FlatTreeBuilder *builder, size_t index, KSI_AggregationHashChain **chain) {
+	int res = KSI_UNKNOWN_ERROR;
+	struct KSI_FlatTreeSiblingCache_st cache;
+
+	memset(&cache, 0, sizeof(cache));
+
+	if (builder == NULL || chain == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	KSI_ERR_clearErrors(builder->ctx);
+
+	if (builder->spine_count == 0) {
+		KSI_pushError(builder->ctx, res = KSI_INVALID_STATE, "The tree is not closed.");
+		goto cleanup;
+	}
+
+	res = flatGetChain(builder, &cache, index, chain);
+	if (res != KSI_OK) {
+		KSI_pushError(builder->ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	flatSiblingCache_clear(&cache);
+
+	return res;
+}
+
+int KSI_FlatTreeBuilder_forEachChain(KSI_FlatTreeBuilder *builder, KSI_FlatTreeChainCallback fn, void *c) {
+	int res = KSI_UNKNOWN_ERROR;
+	struct KSI_FlatTreeSiblingCache_st cache;
+	KSI_AggregationHashChain *chain = NULL;
+	size_t i;
+
+	memset(&cache, 0, sizeof(cache));
+
+	if (builder == NULL || fn == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	KSI_ERR_clearErrors(builder->ctx);
+
+	if (builder->spine_count == 0) {
+		KSI_pushError(builder->ctx, res = KSI_INVALID_STATE, "The tree is not closed.");
+		goto cleanup;
+	}
+
+	for (i = 0; i < builder->levels[0].count; i++) {
+		res = flatGetChain(builder, &cache, i, &chain);
+		if (res != KSI_OK) {
+			KSI_pushError(builder->ctx, res, NULL);
+			goto cleanup;
+		}
+
+		/* The ownership of the chain is passed to the callback. */
+		res = fn(c, i, chain);
+		chain = NULL;
+		if (res != KSI_OK) {
+			KSI_pushError(builder->ctx, res, NULL);
+			goto cleanup;
+		}
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_AggregationHashChain_free(chain);
+	flatSiblingCache_clear(&cache);
+
+	return res;
+}
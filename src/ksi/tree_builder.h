@@ -72,6 +72,8 @@ struct KSI_TreeBuilderLeafProcessor_st {
 	 * \param[in]	c		The processor context.
 	 * \param[out]	out		Output value, if the function creates a new node - output may be NULL.
 	 * \return On success returns KSI_OK, otherwise a status code is returned (see #KSI_StatusCode).
+	 * \note If the output node has the input node as its left child, it is used as the joined
+	 * node as is. This lets a processor supply a hash value it has already calculated.
 	 */
 	int (*fn)(KSI_TreeNode *in, void *c, KSI_TreeNode **out);
 	/** The processor context. */
@@ -213,6 +215,109 @@ int KSI_TreeBuilder_addMetaData(KSI_TreeBuilder *builder, KSI_MetaData *metaData
  */
 int KSI_TreeBuilder_close(KSI_TreeBuilder *builder);
 
+/**
+ * Callback for receiving the aggregation chains of several leafs.
+ * \param[in]	c			The callback context.
+ * \param[in]	index		Index of the leaf in the input list.
+ * \param[in]	chain		The aggregation chain of the leaf; the callee is responsible for freeing it.
+ * \return On success returns KSI_OK, otherwise a status code is returned (see #KSI_StatusCode).
+ */
+typedef int (*KSI_TreeLeafChainCallback)(void *c, size_t index, KSI_AggregationHashChain *chain);
+
+/**
+ * Generates the aggregation hash chains for all the leafs in the list. Compared to calling
+ * #KSI_TreeLeafHandle_getAggregationChain for every leaf, the links shared with the previous
+ * leaf in the list are computed only once, so passing the leafs in the order they were added
+ * is the most efficient.
+ * \param[in]	builder		The closed builder.
+ * \param[in]	leafs		List of the leaf handles of this builder.
+ * \param[in]	fn			Callback receiving the chains in the order of the list.
+ * \param[in]	c			Callback context.
+ * \return On success returns KSI_OK, otherwise a status code is returned (see #KSI_StatusCode).
+ */
+int KSI_TreeBuilder_getAggregationChains(KSI_TreeBuilder *builder, KSI_LIST(KSI_TreeLeafHandle) *leafs, KSI_TreeLeafChainCallback fn, void *c);
+
+/**
+ * A compact alternative to #KSI_TreeBuilder for large trees with uniform leafs. The nodes are
+ * stored as fixed width imprints in contiguous per-height arrays and referenced by index, so no
+ * per-node objects are allocated. The resulting tree and aggregation chains are identical to
+ * the ones created by #KSI_TreeBuilder for the same input. Leaf processors and meta-data leafs
+ * are not supported.
+ */
+typedef struct KSI_FlatTreeBuilder_st KSI_FlatTreeBuilder;
+
+/**
+ * Callback for receiving the aggregation chains of all the leafs.
+ * \param[in]	c			The callback context.
+ * \param[in]	index		Index of the leaf.
+ * \param[in]	chain		The aggregation chain of the leaf; the callee is responsible for freeing it.
+ * \return On success returns KSI_OK, otherwise a status code is returned (see #KSI_StatusCode).
+ */
+typedef int (*KSI_FlatTreeChainCallback)(void *c, size_t index, KSI_AggregationHashChain *chain);
+
+/**
+ * Constructor for the #KSI_FlatTreeBuilder object.
+ * \param[in]	ctx			KSI context.
+ * \param[in]	algo		Algorithm used for the internal nodes.
+ * \param[in]	leafLevel	The level of all the leafs.
+ * \param[out]	builder		Pointer to the receiving pointer.
+ * \return On success returns KSI_OK, otherwise a status code is returned (see #KSI_StatusCode).
+ * \see #KSI_FlatTreeBuilder_free
+ */
+int KSI_FlatTreeBuilder_new(KSI_CTX *ctx, KSI_HashAlgorithm algo, int leafLevel, KSI_FlatTreeBuilder **builder);
+
+/**
+ * Destructor for the #KSI_FlatTreeBuilder object.
+ * \param[in]	builder		Pointer to the object.
+ */
+void KSI_FlatTreeBuilder_free(KSI_FlatTreeBuilder *builder);
+
+/**
+ * Adds a new leaf to the tree. All the leafs must have the same hash algorithm.
+ * \param[in]	builder		The builder.
+ * \param[in]	hsh			The data hash of the leaf.
+ * \param[out]	index		Index of the leaf, may be NULL.
+ * \return On success returns KSI_OK, otherwise a status code is returned (see #KSI_StatusCode).
+ */
+int KSI_FlatTreeBuilder_addDataHash(KSI_FlatTreeBuilder *builder, KSI_DataHash *hsh, size_t *index);
+
+/**
+ * This function finalizes the building of the tree. After calling this function no more leafs
+ * may be added.
+ * \param[in]	builder		The builder.
+ * \return On success returns KSI_OK, otherwise a status code is returned (see #KSI_StatusCode).
+ */
+int KSI_FlatTreeBuilder_close(KSI_FlatTreeBuilder *builder);
+
+/**
+ * Returns the root hash value and level of a closed tree.
+ * \param[in]	builder		The builder.
+ * \param[out]	hsh			Pointer to the receiving pointer.
+ * \param[out]	level		The level of the root node, may be NULL.
+ * \return On success returns KSI_OK, otherwise a status code is returned (see #KSI_StatusCode).
+ */
+int KSI_FlatTreeBuilder_getRootHash(KSI_FlatTreeBuilder *builder, KSI_DataHash **hsh, int *level);
+
+/**
+ * Generates the aggregation hash chain of a single leaf of a closed tree.
+ * \param[in]	builder		The builder.
+ * \param[in]	index		Index of the leaf.
+ * \param[out]	chain		Pointer to the receiving pointer.
+ * \return On success returns KSI_OK, otherwise a status code is returned (see #KSI_StatusCode).
+ * \see #KSI_AggregationHashChain_free.
+ */
+int KSI_FlatTreeBuilder_getAggregationChain(KSI_FlatTreeBuilder *builder, size_t index, KSI_AggregationHashChain **chain);
+
+/**
+ * Generates the aggregation hash chains of all the leafs of a closed tree in a single sweep,
+ * the sibling hash values shared by neighbouring leafs are created only once.
+ * \param[in]	builder		The builder.
+ * \param[in]	fn			Callback receiving the chains in the order of the leafs.
+ * \param[in]	c			Callback context.
+ * \return On success returns KSI_OK, otherwise a status code is returned (see #KSI_StatusCode).
+ */
+int KSI_FlatTreeBuilder_forEachChain(KSI_FlatTreeBuilder *builder, KSI_FlatTreeChainCallback fn, void *c);
+
 /**
  * @}
  */
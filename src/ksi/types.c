@@ -28,6 +28,8 @@
 #include "pkitruststore.h"
 #include "net.h"
 #include "tlv_element.h"
+#include "fast_tlv.h"
+#include "net_impl.h"
 #include "impl/meta_data_impl.h"
 #include "impl/meta_data_element_impl.h"
 
@@ -192,7 +194,7 @@ KSI_IMPLEMENT_REF(KSI_MetaData);
  * KSI_MetaData
  */
 void KSI_MetaDataElement_free(KSI_MetaDataElement *t) {
-	if (t != NULL && --t->ref == 0) {
+	if (t != NULL && KSI_REF_DECREMENT(t) == 0) {
 		KSI_TlvElement_free(t->impl);
 		KSI_Utf8String_free(t->DEPRECATED_clientId);
 		KSI_Utf8String_free(t->DEPRECATED_machineId);
@@ -473,7 +475,7 @@ cleanup:
 static int KSI_MetaData_toMetaDataElement(KSI_MetaData *in, KSI_MetaDataElement **out) {
 	int res = KSI_UNKNOWN_ERROR;
 	KSI_MetaDataElement *tmp = NULL;
-	unsigned char buf[0xffff + 4];
+	const unsigned char *buf = NULL;
 	size_t len;
 
 	if (in == NULL || out == NULL) {
@@ -484,10 +486,11 @@ static int KSI_MetaData_toMetaDataElement(KSI_MetaData *in, KSI_MetaDataElement
 	res = KSI_MetaDataElement_new(in->ctx, &tmp);
 	if (res != KSI_OK) goto cleanup;
 
-	res = in->serializePayload(in, buf, sizeof(buf), &len);
+	res = in->getPayload(in, &buf, &len);
 	if (res != KSI_OK) goto cleanup;
 
-	tmp->impl->ptr = buf;
+	/* The detach below makes a private copy of the payload. */
+	tmp->impl->ptr = (unsigned char *)buf;
 	tmp->impl->ftlv.dat_len = len;
 
 	res = KSI_TlvElement_detach(tmp->impl);
@@ -505,19 +508,28 @@ cleanup:
 	return res;
 }
 
-static int KSI_MetaData_serializePayload(KSI_MetaData *t, unsigned char *buf, size_t buf_size, size_t *buf_len) {
+static int KSI_MetaData_getPayload(KSI_MetaData *t, const unsigned char **buf, size_t *buf_len) {
 	int res = KSI_UNKNOWN_ERROR;
 	KSI_MetaDataElement *mdEl = NULL;
 	KSI_TlvElement *padding = NULL;
+	unsigned char *raw = NULL;
 	size_t len;
 	static unsigned char padEven[] = { 0x01, 0x01 };
 	static unsigned char padOdd[] = { 0x01 };
 
-	if (t == NULL || (buf == NULL && buf_size != 0)) {
+	if (t == NULL || buf == NULL || buf_len == NULL) {
 		res = KSI_INVALID_ARGUMENT;
 		goto cleanup;
 	}
 
+	/* The payload does not change unless one of the setters is called. */
+	if (t->raw != NULL) {
+		*buf = t->raw;
+		*buf_len = t->raw_len;
+		res = KSI_OK;
+		goto cleanup;
+	}
+
 	res = KSI_MetaDataElement_new(t->ctx, &mdEl);
 	if (res != KSI_OK) goto cleanup;
 
@@ -594,24 +606,80 @@ static int KSI_MetaData_serializePayload(KSI_MetaData *t, unsigned char *buf, si
 		padding->ftlv.dat_len = sizeof(padOdd);
 	}
 
-	res = KSI_TlvElement_serialize(mdEl->impl, buf, buf_size, buf_len, KSI_TLV_OPT_NO_HEADER);
+	/* Recalculate the length with the padding. */
+	res = KSI_TlvElement_serialize(mdEl->impl, NULL, 0, &len, KSI_TLV_OPT_NO_HEADER);
 	if (res != KSI_OK) goto cleanup;
 
+	raw = KSI_malloc(len);
+	if (raw == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	res = KSI_TlvElement_serialize(mdEl->impl, raw, len, &t->raw_len, KSI_TLV_OPT_NO_HEADER);
+	if (res != KSI_OK) goto cleanup;
+
+	t->raw = raw;
+	raw = NULL;
+
+	*buf = t->raw;
+	*buf_len = t->raw_len;
+
 	res = KSI_OK;
 
 cleanup:
 
+	KSI_free(raw);
 	KSI_MetaDataElement_free(mdEl);
 	KSI_TlvElement_free(padding);
 	return res;
 }
 
+static int KSI_MetaData_serializePayload(KSI_MetaData *t, unsigned char *buf, size_t buf_size, size_t *buf_len) {
+	int res = KSI_UNKNOWN_ERROR;
+	const unsigned char *raw = NULL;
+	size_t len;
+
+	if (t == NULL || (buf == NULL && buf_size != 0) || buf_len == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	res = KSI_MetaData_getPayload(t, &raw, &len);
+	if (res != KSI_OK) goto cleanup;
+
+	if (buf != NULL) {
+		if (len > buf_size) {
+			res = KSI_BUFFER_OVERFLOW;
+			goto cleanup;
+		}
+		memcpy(buf, raw, len);
+	}
+
+	*buf_len = len;
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+static void KSI_MetaData_clearPayload(KSI_MetaData *t) {
+	if (t != NULL) {
+		KSI_free(t->raw);
+		t->raw = NULL;
+		t->raw_len = 0;
+	}
+}
+
 void KSI_MetaData_free(KSI_MetaData *t) {
-	if (t != NULL && --t->ref == 0) {
+	if (t != NULL && KSI_REF_DECREMENT(t) == 0) {
 		KSI_Utf8String_free(t->clientId);
 		KSI_Utf8String_free(t->machineId);
 		KSI_Integer_free(t->reqTimeInMicros);
 		KSI_Integer_free(t->sequenceNr);
+		KSI_free(t->raw);
 		KSI_free(t);
 	}
 }
@@ -637,8 +705,11 @@ int KSI_MetaData_new(KSI_CTX *ctx, KSI_MetaData **t) {
 	tmp->ref = 1;
 	tmp->reqTimeInMicros = NULL;
 	tmp->sequenceNr = NULL;
+	tmp->raw = NULL;
+	tmp->raw_len = 0;
 	tmp->toMetaDataElement = KSI_MetaData_toMetaDataElement;
 	tmp->serializePayload = KSI_MetaData_serializePayload;
+	tmp->getPayload = KSI_MetaData_getPayload;
 
 	*t = tmp;
 	tmp = NULL;
@@ -673,16 +744,20 @@ cleanup:
 #define VOID_SETTER(var, val, typ) voidSetter((void **)&var, val, (void (*)(void *))typ##_free, (void *(*)(void *))typ##_ref)
 
 int KSI_MetaData_setClientId(KSI_MetaData *t, KSI_Utf8String *clientId) {
+	if (t != NULL) KSI_MetaData_clearPayload(t);
 	return VOID_SETTER(t->clientId, clientId, KSI_Utf8String);
 }
 
 int KSI_MetaData_setMachineId(KSI_MetaData *t, KSI_Utf8String *machineId) {
+	if (t != NULL) KSI_MetaData_clearPayload(t);
 	return VOID_SETTER(t->machineId, machineId, KSI_Utf8String);
 }
 int KSI_MetaData_setSequenceNr(KSI_MetaData *t, KSI_Integer *sequenceNr) {
+	if (t != NULL) KSI_MetaData_clearPayload(t);
 	return VOID_SETTER(t->sequenceNr, sequenceNr, KSI_Integer);
 }
 int KSI_MetaData_setRequestTimeInMicros(KSI_MetaData *t, KSI_Integer *reqTime) {
+	if (t != NULL) KSI_MetaData_clearPayload(t);
 	return VOID_SETTER(t->reqTimeInMicros, reqTime, KSI_Integer);
 }
 
@@ -799,6 +874,49 @@ cleanup:
 	return res;
 }
 
+static int hmacOver(KSI_CTX *ctx, const KSI_HmacHasher *hmacState,
+		const unsigned char *first, size_t first_len,
+		const unsigned char *second, size_t second_len,
+		KSI_DataHash **hmac) {
+	int res;
+	KSI_HmacHasher *hasher = NULL;
+
+	/* The clone only references the prepared key states, the inner one is copied by the first add. */
+	res = KSI_HmacHasher_clone(hmacState, &hasher);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_HmacHasher_add(hasher, first, first_len);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	if (second != NULL) {
+		res = KSI_HmacHasher_add(hasher, second, second_len);
+		if (res != KSI_OK) {
+			KSI_pushError(ctx, res, NULL);
+			goto cleanup;
+		}
+	}
+
+	res = KSI_HmacHasher_close(hasher, hmac);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_HmacHasher_free(hasher);
+
+	return res;
+}
+
 static int pdu_calculateHmac(KSI_CTX* ctx, void* pdu,
 		int (*getHeader)(void*, KSI_Header**),
 		int (*getResponse)(void*, void**),
@@ -807,7 +925,7 @@ static int pdu_calculateHmac(KSI_CTX* ctx, void* pdu,
 		int (*getRequest_raw)(void*, KSI_OctetString**),
 		int reqTag,	int respTag,
 		const KSI_TlvTemplate *reqTemplate, const KSI_TlvTemplate *respTemplate,
-		KSI_HashAlgorithm algo_id, const char *key, KSI_DataHash **hmac) {
+		const KSI_HmacHasher *hmacState, KSI_DataHash **hmac) {
 	int res;
 	KSI_Header *header = NULL;
 	const unsigned char *raw_header = NULL;
@@ -816,14 +934,13 @@ static int pdu_calculateHmac(KSI_CTX* ctx, void* pdu,
 	size_t payload_len;
 	void *request = NULL;
 	void *response = NULL;
-	unsigned char *buf = NULL;
 	KSI_DataHash *tmp = NULL;
 
 	bool freeRawHeader = false;
 	bool freeRawPayload = false;
 
 	KSI_ERR_clearErrors(ctx);
-	if (ctx == NULL || pdu == NULL || key == NULL || hmac == NULL) {
+	if (ctx == NULL || pdu == NULL || hmacState == NULL || hmac == NULL) {
 		KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
 		goto cleanup;
 	}
@@ -880,16 +997,7 @@ static int pdu_calculateHmac(KSI_CTX* ctx, void* pdu,
 		goto cleanup;
 	}
 
-	buf = KSI_malloc(payload_len + header_len);
-	if (buf == NULL) {
-		KSI_pushError(ctx, res = KSI_OUT_OF_MEMORY, NULL);
-		goto cleanup;
-	}
-
-	memcpy(buf, raw_header, header_len);
-	memcpy(buf+header_len, raw_payload, payload_len);
-
-	res = KSI_HMAC_create(header->ctx, algo_id, key, buf, header_len + payload_len, &tmp);
+	res = hmacOver(ctx, hmacState, raw_header, header_len, raw_payload, payload_len, &tmp);
 	if (res != KSI_OK) {
 		KSI_pushError(ctx, res, NULL);
 		goto cleanup;
@@ -904,7 +1012,6 @@ cleanup:
 
 	if (freeRawHeader) KSI_free((void *)raw_header);
 	if (freeRawPayload)	KSI_free((void *)raw_payload);
-	KSI_free(buf);
 	KSI_DataHash_free(tmp);
 
 	return res;
@@ -918,7 +1025,7 @@ static int pdu_calculateHmac_v2(KSI_CTX* ctx, void* pdu,
 		int (*getRequest_raw)(void*, KSI_OctetString**),
 		int reqTag,	int respTag,
 		const KSI_TlvTemplate *reqTemplate, const KSI_TlvTemplate *respTemplate,
-		KSI_HashAlgorithm algo_id, const char *key, KSI_DataHash **hmac) {
+		KSI_HashAlgorithm algo_id, const KSI_HmacHasher *hmacState, KSI_DataHash **hmac) {
 	int res;
 	KSI_Header *header = NULL;
 	size_t payload_len;
@@ -929,7 +1036,7 @@ static int pdu_calculateHmac_v2(KSI_CTX* ctx, void* pdu,
 	bool freeRawPayload = false;
 
 	KSI_ERR_clearErrors(ctx);
-	if (ctx == NULL || pdu == NULL || key == NULL || hmac == NULL) {
+	if (ctx == NULL || pdu == NULL || hmacState == NULL || hmac == NULL) {
 		KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
 		goto cleanup;
 	}
@@ -980,7 +1087,7 @@ static int pdu_calculateHmac_v2(KSI_CTX* ctx, void* pdu,
 		goto cleanup;
 	}
 
-	res = KSI_HMAC_create(ctx, algo_id, key, raw_payload, payload_len - KSI_getHashLength(algo_id), &tmp);
+	res = hmacOver(ctx, hmacState, raw_payload, payload_len - KSI_getHashLength(algo_id), NULL, 0, &tmp);
 	if (res != KSI_OK) {
 		KSI_pushError(ctx, res, "Failed to calculate HMAC from serialized PDU.");
 		goto cleanup;
@@ -998,7 +1105,72 @@ cleanup:
 	return res;
 }
 
-int KSI_ExtendPdu_calculateHmac(KSI_ExtendPdu *t, KSI_HashAlgorithm algo_id, const char *key, KSI_DataHash **hmac){
+int KSI_Pdu_updateSerializedHmac(KSI_CTX *ctx, int version, KSI_HashAlgorithm algo_id, const KSI_HmacHasher *hmacState, unsigned char *raw, size_t raw_len) {
+	int res;
+	KSI_FTLV ftlv;
+	KSI_DataHash *tmp = NULL;
+	const unsigned char *digest = NULL;
+	size_t digest_len = 0;
+	size_t hash_len;
+	size_t hmac_tlv_len;
+
+	KSI_ERR_clearErrors(ctx);
+	if (ctx == NULL || hmacState == NULL || raw == NULL) {
+		KSI_pushError(ctx, res = KSI_INVALID_ARGUMENT, NULL);
+		goto cleanup;
+	}
+
+	/* The HMAC is the last element: a TLV8 header, the algorithm id and the digest. */
+	hash_len = KSI_getHashLength(algo_id);
+	hmac_tlv_len = hash_len + 3;
+	if (hash_len == 0 || raw_len < hmac_tlv_len || raw[raw_len - hmac_tlv_len] != 0x1f || raw[raw_len - hash_len - 1] != (unsigned char)algo_id) {
+		KSI_pushError(ctx, res = KSI_INVALID_FORMAT, "Serialized PDU does not end with an HMAC.");
+		goto cleanup;
+	}
+
+	if (version == KSI_PDU_VERSION_1) {
+		/* Version 1 authenticates the concatenation of the header and the payload. */
+		res = KSI_FTLV_memRead(raw, raw_len, &ftlv);
+		if (res != KSI_OK) {
+			KSI_pushError(ctx, res, NULL);
+			goto cleanup;
+		}
+
+		res = hmacOver(ctx, hmacState, raw + ftlv.hdr_len, raw_len - ftlv.hdr_len - hmac_tlv_len, NULL, 0, &tmp);
+	} else if (version == KSI_PDU_VERSION_2) {
+		/* Version 2 authenticates everything up to the digest itself. */
+		res = hmacOver(ctx, hmacState, raw, raw_len - hash_len, NULL, 0, &tmp);
+	} else {
+		res = KSI_INVALID_FORMAT;
+	}
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	res = KSI_DataHash_extract(tmp, NULL, &digest, &digest_len);
+	if (res != KSI_OK) {
+		KSI_pushError(ctx, res, NULL);
+		goto cleanup;
+	}
+
+	if (digest_len != hash_len) {
+		KSI_pushError(ctx, res = KSI_UNKNOWN_ERROR, "HMAC length mismatch.");
+		goto cleanup;
+	}
+
+	memcpy(raw + raw_len - hash_len, digest, hash_len);
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_DataHash_free(tmp);
+
+	return res;
+}
+
+int KSI_ExtendPdu_calculateHmacWithHasher(KSI_ExtendPdu *t, KSI_HashAlgorithm algo_id, const KSI_HmacHasher *hmacState, KSI_DataHash **hmac) {
 	int res = KSI_OK;
 	if (t == NULL || t->ctx == NULL)
 		return KSI_INVALID_ARGUMENT;
@@ -1011,7 +1183,7 @@ int KSI_ExtendPdu_calculateHmac(KSI_ExtendPdu *t, KSI_HashAlgorithm algo_id, con
 								(int (*)(void*, void**))KSI_ExtendPdu_getRequest,
 								(int (*)(void*, KSI_OctetString**))KSI_ExtendReq_getRaw,
 								0x301,0x302, KSI_TLV_TEMPLATE(KSI_ExtendReq),KSI_TLV_TEMPLATE(KSI_ExtendResp),
-								algo_id, key, hmac);
+								hmacState, hmac);
 	} else if (t->ctx->flags[KSI_CTX_FLAG_EXT_PDU_VER] == KSI_PDU_VERSION_2) {
 		res = pdu_calculateHmac_v2(t->ctx, (void*)t,
 								(int (*)(void*, KSI_Header**))KSI_ExtendPdu_getHeader,
@@ -1020,7 +1192,7 @@ int KSI_ExtendPdu_calculateHmac(KSI_ExtendPdu *t, KSI_HashAlgorithm algo_id, con
 								(int (*)(void*, void**))KSI_ExtendPdu_getRequest,
 								(int (*)(void*, KSI_OctetString**))KSI_ExtendPdu_getRaw,
 								0x320,0x321, KSI_TLV_TEMPLATE(KSI_ExtendReqPdu),KSI_TLV_TEMPLATE(KSI_ExtendRespPdu),
-								algo_id, key, hmac);
+								algo_id, hmacState, hmac);
 	} else {
 		res = KSI_INVALID_FORMAT;
 	}
@@ -1028,6 +1200,27 @@ int KSI_ExtendPdu_calculateHmac(KSI_ExtendPdu *t, KSI_HashAlgorithm algo_id, con
 	return res;
 }
 
+int KSI_ExtendPdu_calculateHmac(KSI_ExtendPdu *t, KSI_HashAlgorithm algo_id, const char *key, KSI_DataHash **hmac){
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_HmacHasher *hasher = NULL;
+
+	if (t == NULL || t->ctx == NULL || key == NULL || hmac == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	res = KSI_HmacHasher_open(t->ctx, algo_id, key, &hasher);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_ExtendPdu_calculateHmacWithHasher(t, algo_id, hasher, hmac);
+
+cleanup:
+
+	KSI_HmacHasher_free(hasher);
+
+	return res;
+}
+
 int KSI_ExtendPdu_updateHmac(KSI_ExtendPdu *pdu, KSI_HashAlgorithm algo_id, const char *key) {
 	int res;
 	KSI_DataHash *hmac = NULL;
@@ -1061,14 +1254,14 @@ cleanup:
 	return res;
 }
 
-int KSI_ExtendReq_enclose(KSI_ExtendReq *req, char *loginId, char *key, KSI_ExtendPdu **pdu) {
+static int extendReq_encloseUnsigned(KSI_ExtendReq *req, const char *loginId, KSI_HashAlgorithm algo_id, KSI_ExtendPdu **pdu) {
 	int res;
 	KSI_ExtendPdu *tmp = NULL;
 	KSI_Header *hdr = NULL;
 	KSI_DataHash *hash = NULL;
 	size_t loginLen;
 
-	if (req == NULL || loginId == NULL || key == NULL || pdu == NULL) {
+	if (req == NULL || loginId == NULL || pdu == NULL) {
 		res = KSI_INVALID_ARGUMENT;
 		goto cleanup;
 	}
@@ -1102,17 +1295,43 @@ int KSI_ExtendReq_enclose(KSI_ExtendReq *req, char *loginId, char *key, KSI_Exte
 	}
 
 	/* Create and append initial empty HMAC. */
-	res = KSI_DataHash_createZero(req->ctx, KSI_getHashAlgorithmByName("default"), &hash);
+	res = KSI_DataHash_createZero(req->ctx, algo_id, &hash);
 	if (res != KSI_OK) goto cleanup;
 
 	tmp->hmac = hash;
 	hash = NULL;
 
+	*pdu = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	/* Make sure we won't free the request. */
+	KSI_ExtendPdu_setRequest(tmp, NULL);
+	KSI_ExtendPdu_free(tmp);
+	KSI_Header_free(hdr);
+
+	return res;
+}
+
+int KSI_ExtendReq_enclose(KSI_ExtendReq *req, char *loginId, char *key, KSI_ExtendPdu **pdu) {
+	int res;
+	KSI_ExtendPdu *tmp = NULL;
+
+	if (req == NULL || loginId == NULL || key == NULL || pdu == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	res = extendReq_encloseUnsigned(req, loginId, KSI_getHashAlgorithmByName("default"), &tmp);
+	if (res != KSI_OK) goto cleanup;
+
 	/* Calculate the HMAC using the provided key and the default hash algorithm. */
 	res = KSI_ExtendPdu_updateHmac(tmp, KSI_getHashAlgorithmByName("default"), key);
 	if (res != KSI_OK) goto cleanup;
 
-
 	*pdu = tmp;
 	tmp = NULL;
 
@@ -1123,7 +1342,42 @@ cleanup:
 	/* Make sure we won't free the request. */
 	KSI_ExtendPdu_setRequest(tmp, NULL);
 	KSI_ExtendPdu_free(tmp);
-	KSI_Header_free(hdr);
+
+	return res;
+}
+
+int KSI_ExtendReq_serializeWithHmac(KSI_ExtendReq *req, const char *loginId, KSI_HashAlgorithm algo_id, const KSI_HmacHasher *hmacState, unsigned char **raw, size_t *raw_len) {
+	int res;
+	KSI_ExtendPdu *tmp = NULL;
+	unsigned char *tmpRaw = NULL;
+	size_t tmpRaw_len = 0;
+
+	if (req == NULL || loginId == NULL || hmacState == NULL || raw == NULL || raw_len == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	res = extendReq_encloseUnsigned(req, loginId, algo_id, &tmp);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_ExtendPdu_serialize(tmp, &tmpRaw, &tmpRaw_len);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Pdu_updateSerializedHmac(req->ctx, req->ctx->flags[KSI_CTX_FLAG_EXT_PDU_VER], algo_id, hmacState, tmpRaw, tmpRaw_len);
+	if (res != KSI_OK) goto cleanup;
+
+	*raw = tmpRaw;
+	*raw_len = tmpRaw_len;
+	tmpRaw = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	/* Make sure we won't free the request. */
+	KSI_ExtendPdu_setRequest(tmp, NULL);
+	KSI_ExtendPdu_free(tmp);
+	KSI_free(tmpRaw);
 
 	return res;
 }
@@ -1284,7 +1538,7 @@ cleanup:
 	return res;
 }
 
-int KSI_AggregationPdu_calculateHmac(KSI_AggregationPdu *t, KSI_HashAlgorithm algo_id, const char *key, KSI_DataHash **hmac){
+int KSI_AggregationPdu_calculateHmacWithHasher(KSI_AggregationPdu *t, KSI_HashAlgorithm algo_id, const KSI_HmacHasher *hmacState, KSI_DataHash **hmac) {
 	int res = KSI_OK;
 	if (t == NULL || t->ctx == NULL)
 		return KSI_INVALID_ARGUMENT;
@@ -1297,7 +1551,7 @@ int KSI_AggregationPdu_calculateHmac(KSI_AggregationPdu *t, KSI_HashAlgorithm al
 				(int (*)(void*, void**))KSI_AggregationPdu_getRequest,
 				(int (*)(void*, KSI_OctetString**))KSI_AggregationReq_getRaw,
 				0x201,0x202, KSI_TLV_TEMPLATE(KSI_AggregationReq),KSI_TLV_TEMPLATE(KSI_AggregationResp),
-				algo_id, key, hmac);
+				hmacState, hmac);
 	} else if (t->ctx->flags[KSI_CTX_FLAG_AGGR_PDU_VER] == KSI_PDU_VERSION_2) {
 		res = pdu_calculateHmac_v2(t->ctx, (void*)t,
 				(int (*)(void*, KSI_Header**))KSI_AggregationPdu_getHeader,
@@ -1306,7 +1560,7 @@ int KSI_AggregationPdu_calculateHmac(KSI_AggregationPdu *t, KSI_HashAlgorithm al
 				(int (*)(void*, void**))KSI_AggregationPdu_getRequest,
 				(int (*)(void*, KSI_OctetString**))KSI_AggregationPdu_getRaw,
 				0x220,0x221, KSI_TLV_TEMPLATE(KSI_AggregationReqPdu),KSI_TLV_TEMPLATE(KSI_AggregationRespPdu),
-				algo_id, key, hmac);
+				algo_id, hmacState, hmac);
 	} else {
 		res = KSI_INVALID_FORMAT;
 	}
@@ -1314,6 +1568,27 @@ int KSI_AggregationPdu_calculateHmac(KSI_AggregationPdu *t, KSI_HashAlgorithm al
 	return res;
 }
 
+int KSI_AggregationPdu_calculateHmac(KSI_AggregationPdu *t, KSI_HashAlgorithm algo_id, const char *key, KSI_DataHash **hmac){
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_HmacHasher *hasher = NULL;
+
+	if (t == NULL || t->ctx == NULL || key == NULL || hmac == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	res = KSI_HmacHasher_open(t->ctx, algo_id, key, &hasher);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_AggregationPdu_calculateHmacWithHasher(t, algo_id, hasher, hmac);
+
+cleanup:
+
+	KSI_HmacHasher_free(hasher);
+
+	return res;
+}
+
 int KSI_AggregationPdu_updateHmac(KSI_AggregationPdu *pdu, KSI_HashAlgorithm algo_id, const char *key) {
 	int res;
 	KSI_DataHash *hmac = NULL;
@@ -1347,14 +1622,14 @@ cleanup:
 	return res;
 }
 
-int KSI_AggregationReq_enclose(KSI_AggregationReq *req, char *loginId, char *key, KSI_AggregationPdu **pdu) {
+static int aggregationReq_encloseUnsigned(KSI_AggregationReq *req, const char *loginId, KSI_HashAlgorithm algo_id, KSI_AggregationPdu **pdu) {
 	int res;
 	KSI_AggregationPdu *tmp = NULL;
 	KSI_Header *hdr = NULL;
 	KSI_DataHash *hash = NULL;
 	size_t loginLen;
 
-	if (req == NULL || loginId == NULL || key == NULL || pdu == NULL) {
+	if (req == NULL || loginId == NULL || pdu == NULL) {
 		res = KSI_INVALID_ARGUMENT;
 		goto cleanup;
 	}
@@ -1388,12 +1663,40 @@ int KSI_AggregationReq_enclose(KSI_AggregationReq *req, char *loginId, char *key
 	}
 
 	/* Create and append initial empty HMAC. */
-	res = KSI_DataHash_createZero(req->ctx, KSI_getHashAlgorithmByName("default"), &hash);
+	res = KSI_DataHash_createZero(req->ctx, algo_id, &hash);
 	if (res != KSI_OK) goto cleanup;
 
 	tmp->hmac = hash;
 	hash = NULL;
 
+	*pdu = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	/* Make sure we won't free the request. */
+	KSI_AggregationPdu_setRequest(tmp, NULL);
+	KSI_AggregationPdu_free(tmp);
+
+	KSI_Header_free(hdr);
+
+	return res;
+}
+
+int KSI_AggregationReq_enclose(KSI_AggregationReq *req, char *loginId, char *key, KSI_AggregationPdu **pdu) {
+	int res;
+	KSI_AggregationPdu *tmp = NULL;
+
+	if (req == NULL || loginId == NULL || key == NULL || pdu == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	res = aggregationReq_encloseUnsigned(req, loginId, KSI_getHashAlgorithmByName("default"), &tmp);
+	if (res != KSI_OK) goto cleanup;
+
 	/* Calculate the HMAC using the provided key and the default hash algorithm. */
 	res = KSI_AggregationPdu_updateHmac(tmp, KSI_getHashAlgorithmByName("default"), key);
 	if (res != KSI_OK) goto cleanup;
@@ -1409,7 +1712,41 @@ cleanup:
 	KSI_AggregationPdu_setRequest(tmp, NULL);
 	KSI_AggregationPdu_free(tmp);
 
-	KSI_Header_free(hdr);
+	return res;
+}
+
+int KSI_AggregationReq_serializeWithHmac(KSI_AggregationReq *req, const char *loginId, KSI_HashAlgorithm algo_id, const KSI_HmacHasher *hmacState, unsigned char **raw, size_t *raw_len) {
+	int res;
+	KSI_AggregationPdu *tmp = NULL;
+	unsigned char *tmpRaw = NULL;
+	size_t tmpRaw_len = 0;
+
+	if (req == NULL || loginId == NULL || hmacState == NULL || raw == NULL || raw_len == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	res = aggregationReq_encloseUnsigned(req, loginId, algo_id, &tmp);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_AggregationPdu_serialize(tmp, &tmpRaw, &tmpRaw_len);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Pdu_updateSerializedHmac(req->ctx, req->ctx->flags[KSI_CTX_FLAG_AGGR_PDU_VER], algo_id, hmacState, tmpRaw, tmpRaw_len);
+	if (res != KSI_OK) goto cleanup;
+
+	*raw = tmpRaw;
+	*raw_len = tmpRaw_len;
+	tmpRaw = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	/* Make sure we won't free the request. */
+	KSI_AggregationPdu_setRequest(tmp, NULL);
+	KSI_AggregationPdu_free(tmp);
+	KSI_free(tmpRaw);
 
 	return res;
 }
@@ -1487,7 +1824,7 @@ int KSI_AggregationPdu_serialize(const KSI_AggregationPdu *t, unsigned char **ra
 	} else if (t->ctx->flags[KSI_CTX_FLAG_AGGR_PDU_VER] == KSI_PDU_VERSION_2) {
 		if (t->request != NULL || t->confRequest != NULL || t->ackRequest != NULL) {
 			res = KSI_TlvTemplate_serializeObject(t->ctx, t, 0x220, 0, 0, KSI_TLV_TEMPLATE(KSI_AggregationReqPdu), raw, len);
-		} else if (t->response != NULL || t->confResponse != NULL || t->ackResponse != NULL) {
+		} else if (t->response != NULL || t->confResponse != NULL || t->ackResponse != NULL || t->error != NULL) {
 			res = KSI_TlvTemplate_serializeObject(t->ctx, t, 0x221, 0, 0, KSI_TLV_TEMPLATE(KSI_AggregationRespPdu), raw, len);
 		} else {
 			res = KSI_INVALID_FORMAT;
@@ -63,7 +63,7 @@ KSI_IMPLEMENT_LIST(KSI_OctetString, KSI_OctetString_free);
  * KSI_OctetString
  */
 void KSI_OctetString_free(KSI_OctetString *o) {
-	if (o != NULL && --o->ref == 0) {
+	if (o != NULL && KSI_REF_DECREMENT(o) == 0) {
 		KSI_free(o->data);
 		KSI_free(o);
 	}
@@ -324,7 +324,7 @@ cleanup:
  * Utf8String
  */
 void KSI_Utf8String_free(KSI_Utf8String *o) {
-	if (o != NULL && --o->ref == 0) {
+	if (o != NULL && KSI_REF_DECREMENT(o) == 0) {
 		KSI_free(o->value);
 		KSI_free(o);
 	}
@@ -541,7 +541,7 @@ cleanup:
 }
 
 void KSI_Integer_free(KSI_Integer *o) {
-	if (o != NULL && !o->staticAlloc && --o->ref == 0) {
+	if (o != NULL && !o->staticAlloc && KSI_REF_DECREMENT(o) == 0) {
 		KSI_free(o);
 	}
 }
@@ -58,6 +58,8 @@ int typ##_toTlv(KSI_CTX *ctx, typ *o, unsigned tag, int isNonCritical, int isFor
 	 * Increases the inner reference count of that object.
 	 * \param[in]	o		Pointer to \ref typ
 	 * \return Returns the input pointer on success or \c NULL on error.
+	 * \note When the library is configured with \c --enable-atomic-refcount, the reference
+	 * counter is updated atomically and the reference may be released by another thread.
 	 * \see \ref typ##_free
 	 */ \
 	typ *typ##_ref(typ *o)
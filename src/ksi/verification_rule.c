@@ -17,6 +17,8 @@
  * reserves and retains all trademark rights.
  */
 
+#include <string.h>
+
 #include "verification_rule.h"
 #include "policy_impl.h"
 #include "policy.h"
@@ -30,6 +32,8 @@
 #include "ctx_impl.h"
 #include "verification.h"
 #include "impl/meta_data_element_impl.h"
+#include "rootcache.h"
+#include "extcache.h"
 
 #define VERIFICATION_RULE_NAME __FUNCTION__
 
@@ -59,6 +63,8 @@ static int getRfc3161OutputHash(const KSI_Signature *sig, KSI_DataHash **outputH
 static int getExtendedCalendarHashChain(KSI_VerificationContext *info, KSI_Integer *pubTime, KSI_CalendarHashChain **extCalHashChain);
 static int initPublicationsFile(KSI_VerificationContext *info);
 static int initAggregationOutputHash(KSI_VerificationContext *info);
+static int getCalendarRootHash(KSI_VerificationContext *info, KSI_DataHash **rootHash);
+static int getNearestPublication(KSI_VerificationContext *info, KSI_Integer *pubTime, KSI_PublicationRecord **pubRec);
 static int extendingPermittedVerification(KSI_VerificationContext *info, KSI_RuleVerificationResult *result, const KSI_VerificationStep step, const char *rule);
 
 
@@ -613,6 +619,7 @@ int KSI_VerificationRule_AggregationHashChainConsistency(KSI_VerificationContext
 	KSI_CTX *ctx = NULL;
 	KSI_Signature *sig = NULL;
 	VerificationTempData *tempData = NULL;
+	VerificationMemo *memo = NULL;
 	const KSI_VerificationStep step = KSI_VERIFY_AGGRCHAIN_INTERNALLY;
 
 	if (result == NULL) {
@@ -649,6 +656,14 @@ int KSI_VerificationRule_AggregationHashChainConsistency(KSI_VerificationContext
 	}
 	level = (int)info->docAggrLevel;
 
+	/* The chains have already been verified by a previous policy. */
+	memo = VerificationTempData_getMemo(info);
+	if (memo->aggregationChainVerified && tempData->aggregationOutputHash != NULL) {
+		VERIFICATION_RESULT_OK(step);
+		res = KSI_OK;
+		goto cleanup;
+	}
+
 	/* Aggregate all the aggregation chains. */
 	for (i = 0; i < KSI_AggregationHashChainList_length(sig->aggregationChainList); i++) {
 		const KSI_AggregationHashChain* aggregationChain = NULL;
@@ -702,6 +717,7 @@ int KSI_VerificationRule_AggregationHashChainConsistency(KSI_VerificationContext
 	}
 	tempData->aggregationOutputHash = hsh;
 	hsh = NULL;
+	memo->aggregationChainVerified = 1;
 
 	VERIFICATION_RESULT_OK(step);
 	res = KSI_OK;
@@ -1164,7 +1180,7 @@ int KSI_VerificationRule_CalendarAuthenticationRecordAggregationHash(KSI_Verific
 	KSI_LOG_info(ctx, "Verify calendar hash chain authentication record.");
 
 	/* Calculate the root hash value. */
-	res = KSI_CalendarHashChain_aggregate(sig->calendarChain, &rootHash);
+	res = getCalendarRootHash(info, &rootHash);
 	if (res != KSI_OK) {
 		VERIFICATION_RESULT_ERR(KSI_VER_RES_NA, KSI_VER_ERR_GEN_2, KSI_VERIFY_NONE);
 		KSI_pushError(ctx, res, NULL);
@@ -1296,7 +1312,7 @@ int KSI_VerificationRule_SignaturePublicationRecordPublicationHash(KSI_Verificat
 	KSI_LOG_info(ctx, "Verify calendar hash chain publication hash consistency.");
 
 	/* Calculate calendar aggregation root hash value. */
-	res = KSI_CalendarHashChain_aggregate(sig->calendarChain, &rootHash);
+	res = getCalendarRootHash(info, &rootHash);
 	if (res != KSI_OK) {
 		VERIFICATION_RESULT_ERR(KSI_VER_RES_NA, KSI_VER_ERR_GEN_2, KSI_VERIFY_NONE);
 		KSI_pushError(ctx, res, NULL);
@@ -1793,7 +1809,7 @@ int KSI_VerificationRule_ExtendedSignatureCalendarChainRootHash(KSI_Verification
 		goto cleanup;
 	}
 
-	res = KSI_CalendarHashChain_aggregate(sig->calendarChain, &rootHash);
+	res = getCalendarRootHash(info, &rootHash);
 	if (res != KSI_OK) {
 		VERIFICATION_RESULT_ERR(KSI_VER_RES_NA, KSI_VER_ERR_GEN_2, KSI_VERIFY_NONE);
 		KSI_pushError(ctx, res, NULL);
@@ -1858,56 +1874,45 @@ cleanup:
 	return res;
 }
 
-static int initExtendedCalendarHashChain(KSI_VerificationContext *info, KSI_Integer *endTime) {
+static int getCalendarRootHash(KSI_VerificationContext *info, KSI_DataHash **rootHash) {
 	int res = KSI_UNKNOWN_ERROR;
-	KSI_CTX *ctx = NULL;
-	KSI_Signature *sig = NULL;
-	KSI_Integer *startTime = NULL;
-	KSI_ExtendReq *req = NULL;
-	KSI_RequestHandle *handle = NULL;
-	KSI_ExtendResp *resp = NULL;
-	KSI_Integer *status = NULL;
-	KSI_CalendarHashChain *tmp = NULL;
-	KSI_AggregationHashChain *aggr = NULL;
-	VerificationTempData *tempData = NULL;
-	KSI_Integer *respReqId = NULL;
-	KSI_Integer *reqReqId = NULL;
+	VerificationMemo *memo = NULL;
 
-	if (info == NULL || info->ctx == NULL || info->signature == NULL) {
+	if (info == NULL || info->signature == NULL || rootHash == NULL) {
 		res = KSI_INVALID_ARGUMENT;
 		goto cleanup;
 	}
 
-
-	ctx = info->ctx;
-	sig = info->signature;
-	KSI_ERR_clearErrors(ctx);
-
-	tempData = info->tempData;
-	if (tempData == NULL) {
-		KSI_pushError(ctx, res = KSI_INVALID_STATE, "Verification context not properly initialized.");
+	memo = VerificationTempData_getMemo(info);
+	if (memo == NULL) {
+		res = KSI_CalendarHashChain_aggregate(info->signature->calendarChain, rootHash);
 		goto cleanup;
 	}
 
-	/* Extract start time. */
-	if (sig->calendarChain != NULL) {
-		res = KSI_CalendarHashChain_getAggregationTime(sig->calendarChain, &startTime);
-		if (res != KSI_OK) {
-			KSI_pushError(ctx,res, NULL);
-			goto cleanup;
-		}
-	} else {
-		/* Take the first aggregation hash chain, as all of the chain should have the same value for "aggregation time". */
-		res = (KSI_AggregationHashChainList_elementAt(sig->aggregationChainList, 0, &aggr));
+	if (memo->calendarRootHash == NULL) {
+		res = KSI_CalendarHashChain_aggregate(info->signature->calendarChain, &memo->calendarRootHash);
 		if (res != KSI_OK) goto cleanup;
-
-		res = KSI_AggregationHashChain_getAggregationTime(aggr, &startTime);
-		if (res != KSI_OK) {
-			KSI_pushError(ctx,res, NULL);
-			goto cleanup;
-		}
 	}
 
+	*rootHash = KSI_DataHash_ref(memo->calendarRootHash);
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+static int requestExtendedCalendarHashChain(KSI_CTX *ctx, KSI_Integer *startTime, KSI_Integer *endTime, KSI_CalendarHashChain **chain) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_ExtendReq *req = NULL;
+	KSI_RequestHandle *handle = NULL;
+	KSI_ExtendResp *resp = NULL;
+	KSI_Integer *status = NULL;
+	KSI_CalendarHashChain *tmp = NULL;
+	KSI_Integer *respReqId = NULL;
+	KSI_Integer *reqReqId = NULL;
+
 	/* Clone the start time object. */
 	KSI_Integer_ref(startTime);
 
@@ -1975,10 +1980,7 @@ static int initExtendedCalendarHashChain(KSI_VerificationContext *info, KSI_Inte
 		goto cleanup;
 	}
 
-	if (tempData->calendarChain != NULL) {
-		KSI_CalendarHashChain_free(tempData->calendarChain);
-	}
-	tempData->calendarChain = tmp;
+	*chain = tmp;
 	tmp = NULL;
 
 	res = KSI_OK;
@@ -1993,9 +1995,92 @@ cleanup:
 	return res;
 }
 
+static int initExtendedCalendarHashChain(KSI_VerificationContext *info, KSI_Integer *endTime) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_CTX *ctx = NULL;
+	KSI_Signature *sig = NULL;
+	KSI_Integer *startTime = NULL;
+	KSI_CalendarHashChain *tmp = NULL;
+	KSI_AggregationHashChain *aggr = NULL;
+	VerificationTempData *tempData = NULL;
+	int claimed = 0;
+
+	if (info == NULL || info->ctx == NULL || info->signature == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+
+	ctx = info->ctx;
+	sig = info->signature;
+	KSI_ERR_clearErrors(ctx);
+
+	tempData = info->tempData;
+	if (tempData == NULL) {
+		KSI_pushError(ctx, res = KSI_INVALID_STATE, "Verification context not properly initialized.");
+		goto cleanup;
+	}
+
+	/* Extract start time. */
+	if (sig->calendarChain != NULL) {
+		res = KSI_CalendarHashChain_getAggregationTime(sig->calendarChain, &startTime);
+		if (res != KSI_OK) {
+			KSI_pushError(ctx,res, NULL);
+			goto cleanup;
+		}
+	} else {
+		/* Take the first aggregation hash chain, as all of the chain should have the same value for "aggregation time". */
+		res = (KSI_AggregationHashChainList_elementAt(sig->aggregationChainList, 0, &aggr));
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_AggregationHashChain_getAggregationTime(aggr, &startTime);
+		if (res != KSI_OK) {
+			KSI_pushError(ctx,res, NULL);
+			goto cleanup;
+		}
+	}
+
+	/* Extending to the head of the calendar gives a different result every second. */
+	if (endTime != NULL && ctx->extChainCache != NULL) {
+		res = KSI_ExtendedChainCache_get(ctx->extChainCache, ctx, KSI_Integer_getUInt64(startTime), KSI_Integer_getUInt64(endTime), &tmp, &claimed);
+		if (res != KSI_OK) {
+			KSI_pushError(ctx, res, NULL);
+			goto cleanup;
+		}
+	}
+
+	if (tmp == NULL) {
+		res = requestExtendedCalendarHashChain(ctx, startTime, endTime, &tmp);
+		if (res != KSI_OK) goto cleanup;
+
+		if (claimed) {
+			KSI_ExtendedChainCache_add(ctx->extChainCache, ctx, KSI_Integer_getUInt64(startTime), KSI_Integer_getUInt64(endTime), tmp);
+			claimed = 0;
+		}
+	}
+
+	if (tempData->calendarChain != NULL) {
+		KSI_CalendarHashChain_free(tempData->calendarChain);
+	}
+	tempData->calendarChain = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+	/* Let the other threads waiting for the chain retry. */
+	if (claimed) KSI_ExtendedChainCache_release(ctx->extChainCache, KSI_Integer_getUInt64(startTime), KSI_Integer_getUInt64(endTime));
+	KSI_CalendarHashChain_free(tmp);
+
+	return res;
+}
+
 static int getExtendedCalendarHashChain(KSI_VerificationContext *info, KSI_Integer *pubTime, KSI_CalendarHashChain **chain) {
 	int res = KSI_UNKNOWN_ERROR;
 	VerificationTempData *tempData = NULL;
+	VerificationMemo *memo = NULL;
+	KSI_uint64_t endTime;
+	size_t i;
 
 	if (info == NULL || info->ctx == NULL || info->signature == NULL || chain == NULL) {
 		res = KSI_INVALID_ARGUMENT;
@@ -2010,9 +2095,28 @@ static int getExtendedCalendarHashChain(KSI_VerificationContext *info, KSI_Integ
 
 	/* Check if signature has been already extended */
 	if (tempData->calendarChain == NULL) {
-		/* Extend the signature to the publication time as attached calendar chain, or to head if time is NULL */
-		res = initExtendedCalendarHashChain(info, pubTime);
-		if (res != KSI_OK) goto cleanup;
+		memo = VerificationTempData_getMemo(info);
+		endTime = (pubTime != NULL) ? KSI_Integer_getUInt64(pubTime) : 0;
+
+		/* A previous policy may have already extended the signature to the same time. */
+		for (i = 0; i < memo->extendedChains_count; i++) {
+			if (memo->extendedChainTimes[i] == endTime) {
+				tempData->calendarChain = KSI_CalendarHashChain_ref(memo->extendedChains[i]);
+				break;
+			}
+		}
+
+		if (tempData->calendarChain == NULL) {
+			/* Extend the signature to the publication time as attached calendar chain, or to head if time is NULL */
+			res = initExtendedCalendarHashChain(info, pubTime);
+			if (res != KSI_OK) goto cleanup;
+
+			if (memo->extendedChains_count < VERIFICATION_MEMO_EXT_CHAINS) {
+				memo->extendedChains[memo->extendedChains_count] = KSI_CalendarHashChain_ref(tempData->calendarChain);
+				memo->extendedChainTimes[memo->extendedChains_count] = endTime;
+				memo->extendedChains_count++;
+			}
+		}
 	}
 
 	*chain = tempData->calendarChain;
@@ -2281,6 +2385,50 @@ cleanup:
 	return res;
 }
 
+static int getNearestPublication(KSI_VerificationContext *info, KSI_Integer *pubTime, KSI_PublicationRecord **pubRec) {
+	int res = KSI_UNKNOWN_ERROR;
+	VerificationTempData *tempData = NULL;
+	VerificationMemo *memo = NULL;
+	KSI_PublicationRecord *tmp = NULL;
+
+	if (info == NULL || info->tempData == NULL || pubTime == NULL || pubRec == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	tempData = info->tempData;
+	memo = VerificationTempData_getMemo(info);
+
+	/* Several rules of a policy look up the same publication. */
+	if (memo->nearestPublication != NULL && memo->nearestPublicationFile == tempData->publicationsFile &&
+			memo->nearestPublicationTime == KSI_Integer_getUInt64(pubTime)) {
+		*pubRec = KSI_PublicationRecord_ref(memo->nearestPublication);
+		res = KSI_OK;
+		goto cleanup;
+	}
+
+	res = KSI_PublicationsFile_getNearestPublication(tempData->publicationsFile, pubTime, &tmp);
+	if (res != KSI_OK) goto cleanup;
+
+	if (tmp != NULL) {
+		KSI_PublicationRecord_free(memo->nearestPublication);
+		memo->nearestPublication = KSI_PublicationRecord_ref(tmp);
+		memo->nearestPublicationFile = tempData->publicationsFile;
+		memo->nearestPublicationTime = KSI_Integer_getUInt64(pubTime);
+	}
+
+	*pubRec = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_PublicationRecord_free(tmp);
+
+	return res;
+}
+
 static int initPublicationsFile(KSI_VerificationContext *info) {
 	int res = KSI_UNKNOWN_ERROR;
 	VerificationTempData *tempData = NULL;
@@ -2414,10 +2562,112 @@ cleanup:
 	return res;
 }
 
+static int useRootCache(KSI_VerificationContext *info) {
+	VerificationTempData *tempData = info->tempData;
+
+	/* The cached roots are only valid for the publications file of the context. */
+	return tempData != NULL && tempData->publicationsFile != NULL && tempData->publicationsFile == info->ctx->publicationsFile;
+}
+
+static int addProofField(KSI_DataHasher *hsr, const void *data, size_t data_len) {
+	int res = KSI_UNKNOWN_ERROR;
+	unsigned char len[4];
+
+	/* Length prefix keeps the field boundaries unambiguous. */
+	len[0] = (unsigned char)(data_len >> 24);
+	len[1] = (unsigned char)(data_len >> 16);
+	len[2] = (unsigned char)(data_len >> 8);
+	len[3] = (unsigned char)data_len;
+
+	res = KSI_DataHasher_add(hsr, len, sizeof(len));
+	if (res != KSI_OK) goto cleanup;
+
+	if (data_len > 0) {
+		res = KSI_DataHasher_add(hsr, data, data_len);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+/* Digest of the exact inputs of the PKI check: the raw publication data bytes, signature value, certificate id and signature type. */
+static int getAuthRecProofHash(KSI_CTX *ctx, const KSI_CalendarAuthRec *authRec, KSI_DataHash **proof) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_DataHasher *hsr = NULL;
+	unsigned char *raw = NULL;
+	size_t raw_len = 0;
+	KSI_OctetString *sigValue = NULL;
+	KSI_OctetString *certId = NULL;
+	KSI_Utf8String *sigType = NULL;
+	const unsigned char *ptr = NULL;
+	size_t ptr_len = 0;
+	const char *str = NULL;
+
+	if (authRec->pubData == NULL || authRec->pubData->baseTlv == NULL || authRec->signatureData == NULL) {
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	res = KSI_TLV_serialize(authRec->pubData->baseTlv, &raw, &raw_len);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_PKISignedData_getSignatureValue(authRec->signatureData, &sigValue);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_PKISignedData_getCertId(authRec->signatureData, &certId);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_PKISignedData_getSigType(authRec->signatureData, &sigType);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_DataHasher_open(ctx, KSI_HASHALG_SHA2_256, &hsr);
+	if (res != KSI_OK) goto cleanup;
+
+	res = addProofField(hsr, raw, raw_len);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_OctetString_extract(sigValue, &ptr, &ptr_len);
+	if (res != KSI_OK) goto cleanup;
+
+	res = addProofField(hsr, ptr, ptr_len);
+	if (res != KSI_OK) goto cleanup;
+
+	ptr = NULL;
+	ptr_len = 0;
+	if (certId != NULL) {
+		res = KSI_OctetString_extract(certId, &ptr, &ptr_len);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	res = addProofField(hsr, ptr, ptr_len);
+	if (res != KSI_OK) goto cleanup;
+
+	str = KSI_Utf8String_cstr(sigType);
+	res = addProofField(hsr, str, str != NULL ? strlen(str) : 0);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_DataHasher_close(hsr, proof);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_DataHasher_free(hsr);
+	KSI_free(raw);
+
+	return res;
+}
+
 int KSI_VerificationRule_CalendarAuthenticationRecordSignatureVerification(KSI_VerificationContext *info, KSI_RuleVerificationResult *result) {
 	int res = KSI_UNKNOWN_ERROR;
 	KSI_CTX *ctx = NULL;
 	KSI_Signature *sig = NULL;
+	KSI_DataHash *proof = NULL;
 	KSI_OctetString *certId = NULL;
 	KSI_PKICertificate *cert = NULL;
 	KSI_OctetString *signatureValue = NULL;
@@ -2481,6 +2731,16 @@ int KSI_VerificationRule_CalendarAuthenticationRecordSignatureVerification(KSI_V
 		goto cleanup;
 	}
 
+	/* The same calendar root may already have been proven with the very same authentication record signature. */
+	if (useRootCache(info) && getAuthRecProofHash(ctx, sig->calendarAuthRec, &proof) == KSI_OK) {
+		if (KSI_CalendarRootCache_contains(ctx->rootCache, sig->calendarAuthRec->pubData, KSI_CALENDAR_ROOT_PROOF_AUTHREC, proof)) {
+			KSI_LOG_info(ctx, "Calendar authentication record signature already verified.");
+			VERIFICATION_RESULT_OK(step);
+			res = KSI_OK;
+			goto cleanup;
+		}
+	}
+
 	res = KSI_PublicationsFile_getPKICertificateById(tempData->publicationsFile, certId, &cert);
 	if (res != KSI_OK) {
 		VERIFICATION_RESULT_ERR(KSI_VER_RES_NA, KSI_VER_ERR_GEN_2, KSI_VERIFY_NONE);
@@ -2532,11 +2792,15 @@ int KSI_VerificationRule_CalendarAuthenticationRecordSignatureVerification(KSI_V
 		goto cleanup;
 	}
 
+	if (proof != NULL) {
+		KSI_CalendarRootCache_add(ctx->rootCache, sig->calendarAuthRec->pubData, KSI_CALENDAR_ROOT_PROOF_AUTHREC, proof);
+	}
 
 	VERIFICATION_RESULT_OK(step);
 	res = KSI_OK;
 
 cleanup:
+	KSI_DataHash_free(proof);
 	KSI_free(rawData);
 
 	return res;
@@ -2589,6 +2853,13 @@ int KSI_VerificationRule_PublicationsFileContainsSignaturePublication(KSI_Verifi
 		goto cleanup;
 	}
 
+	if (useRootCache(info) && KSI_CalendarRootCache_contains(ctx->rootCache, sig->publication->publishedData, KSI_CALENDAR_ROOT_PROOF_PUBFILE, NULL)) {
+		KSI_LOG_info(ctx, "Signature publication already found in publications file.");
+		VERIFICATION_RESULT_OK(step);
+		res = KSI_OK;
+		goto cleanup;
+	}
+
 	res = KSI_PublicationsFile_findPublication(tempData->publicationsFile, sig->publication, &pubRec);
 	if (res != KSI_OK) {
 		VERIFICATION_RESULT_ERR(KSI_VER_RES_NA, KSI_VER_ERR_GEN_2, KSI_VERIFY_NONE);
@@ -2602,6 +2873,9 @@ int KSI_VerificationRule_PublicationsFileContainsSignaturePublication(KSI_Verifi
 		goto cleanup;
 	}
 
+	if (useRootCache(info)) {
+		KSI_CalendarRootCache_add(ctx->rootCache, sig->publication->publishedData, KSI_CALENDAR_ROOT_PROOF_PUBFILE, NULL);
+	}
 
 	VERIFICATION_RESULT_OK(step);
 	res = KSI_OK;
@@ -2673,7 +2947,7 @@ int KSI_VerificationRule_PublicationsFileContainsSuitablePublication(KSI_Verific
 		goto cleanup;
 	}
 
-	res = KSI_PublicationsFile_getNearestPublication(tempData->publicationsFile, tempTime, &pubRec);
+	res = getNearestPublication(info, tempTime, &pubRec);
 	if (res != KSI_OK) {
 		VERIFICATION_RESULT_ERR(KSI_VER_RES_NA, KSI_VER_ERR_GEN_2, KSI_VERIFY_NONE);
 		KSI_pushError(ctx, res, NULL);
@@ -2798,7 +3072,7 @@ int KSI_VerificationRule_PublicationsFilePublicationHashMatchesExtenderResponse(
 		goto cleanup;
 	}
 
-	res = KSI_PublicationsFile_getNearestPublication(tempData->publicationsFile, sigPubTime, &pubRec);
+	res = getNearestPublication(info, sigPubTime, &pubRec);
 	if (res != KSI_OK) {
 		VERIFICATION_RESULT_ERR(KSI_VER_RES_NA, KSI_VER_ERR_GEN_2, KSI_VERIFY_NONE);
 		KSI_pushError(ctx, res, NULL);
@@ -2919,7 +3193,7 @@ int KSI_VerificationRule_PublicationsFilePublicationTimeMatchesExtenderResponse(
 		goto cleanup;
 	}
 
-	res = KSI_PublicationsFile_getNearestPublication(tempData->publicationsFile, sigPubTime, &pubRec);
+	res = getNearestPublication(info, sigPubTime, &pubRec);
 	if (res != KSI_OK) {
 		VERIFICATION_RESULT_ERR(KSI_VER_RES_NA, KSI_VER_ERR_GEN_2, KSI_VERIFY_NONE);
 		KSI_pushError(ctx, res, NULL);
@@ -3031,7 +3305,7 @@ int KSI_VerificationRule_PublicationsFileExtendedSignatureInputHash(KSI_Verifica
 		goto cleanup;
 	}
 
-	res = KSI_PublicationsFile_getNearestPublication(tempData->publicationsFile, sigPubTime, &pubRec);
+	res = getNearestPublication(info, sigPubTime, &pubRec);
 	if (res != KSI_OK) {
 		VERIFICATION_RESULT_ERR(KSI_VER_RES_NA, KSI_VER_ERR_GEN_2, KSI_VERIFY_NONE);
 		KSI_pushError(ctx, res, NULL);
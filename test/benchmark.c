@@ -0,0 +1,1067 @@
+/*
+ * Copyright 2013-2016 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <time.h>
+#endif
+
+#include <ksi/ksi.h>
+#include <ksi/tree_builder.h>
+#include <ksi/blocksigner.h>
+#include <ksi/multi_signature.h>
+#include <ksi/pkitruststore.h>
+#include <ksi/compatibility.h>
+#include <ksi/net_file.h>
+#include <ksi/hmac.h>
+
+#define BENCH_USER "anon"
+#define BENCH_PASS "anon"
+
+#define BENCH_SIGNATURE_FILE          "resource/tlv/ok-sig-2014-04-30.1.ksig"
+#define BENCH_EXTENDED_SIGNATURE_FILE "resource/tlv/ok-sig-2014-04-30.1-extended.ksig"
+#define BENCH_OTHER_SIGNATURE_FILE    "resource/tlv/ok-sig-2014-06-2-extended.ksig"
+#define BENCH_EXT_RESPONSE_FILE       "resource/tlv/ok-sig-2014-04-30.1-extend_response.tlv"
+#define BENCH_AGGR_RESPONSE_FILE      "resource/tlv/ok-aggr-resp-1460631424.tlv"
+#define BENCH_PUBLICATIONS_FILE       "resource/tlv/publications.tlv"
+#define BENCH_CERT_FILE               "resource/tlv/mock.crt"
+
+/* The leafs matching the canned aggregation response. */
+static const char *blockInput[] = { "test1", "test2", "test3", "test4", "test5", "test6", "test7", NULL };
+
+#define MAX_LEAFS 4096
+#define MAX_SAMPLES 1000
+/* With fewer samples the nearest-rank P99 is the maximum. */
+#define MIN_P99_SAMPLES 100
+#define MAX_ITERATIONS 10000000
+
+/** Resources shared by all the benchmarks. */
+typedef struct BenchState_st {
+	KSI_CTX *ksi;
+	/* Input data for the hash benchmarks. */
+	unsigned char *data;
+	size_t data_len;
+	KSI_DataHash *leafs[MAX_LEAFS];
+	/* Masking input for the block signer and a context shared by several threads. */
+	KSI_OctetString *iv;
+	KSI_CTX *sharedKsi;
+	/* HMAC computation opened with the service password, as prepared by the endpoints. */
+	KSI_HmacHasher *hmac;
+	unsigned char *sigRaw;
+	size_t sigRaw_len;
+	KSI_Signature *sig;
+	KSI_Signature *extSig;
+	unsigned char *pubRaw;
+	size_t pubRaw_len;
+	KSI_PublicationsFile *pubFile;
+	KSI_Integer *pubTime;
+	KSI_PublicationData *userPub;
+	KSI_MultiSignature *ms;
+	KSI_DataHash *msHash;
+	/* Contexts reading the canned service responses. */
+	KSI_CTX *extKsi;
+	KSI_CTX *aggrKsi;
+	char extPath[2048];
+	char aggrPath[2048];
+} BenchState;
+
+typedef int (*BenchFn)(BenchState *state, size_t param);
+
+typedef struct Benchmark_st {
+	const char *name;
+	BenchFn fn;
+	size_t param;
+} Benchmark;
+
+/** Statistics of a single benchmark in nanoseconds per operation. */
+typedef struct BenchResult_st {
+	const char *name;
+	size_t iterations;
+	double min;
+	double mean;
+	double p50;
+	double p90;
+	double p99;
+	double max;
+} BenchResult;
+
+/** A result loaded from the baseline file. */
+typedef struct BaselineEntry_st {
+	char name[128];
+	double p50;
+} BaselineEntry;
+
+static const char *resourceRoot = ".";
+
+static const char *resourcePath(const char *resource) {
+	static char buf[2][2048];
+	static int next = 0;
+	next ^= 1;
+	KSI_snprintf(buf[next], sizeof(buf[next]), "%s/%s", resourceRoot, resource);
+	return buf[next];
+}
+
+static const char *resourceUri(const char *resource) {
+	static char buf[2048];
+	KSI_snprintf(buf, sizeof(buf), "file://%s", resourcePath(resource));
+	return buf;
+}
+
+/* Monotonic time in nanoseconds. */
+static double nowNs(void) {
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER count;
+	if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (double)count.QuadPart * 1e9 / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+#endif
+}
+
+static int readFile(const char *fileName, unsigned char **raw, size_t *raw_len) {
+	int res = KSI_UNKNOWN_ERROR;
+	FILE *f = NULL;
+	unsigned char *buf = NULL;
+	long len;
+
+	f = fopen(fileName, "rb");
+	if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0) {
+		fprintf(stderr, "%s: Unable to open file.\n", fileName);
+		res = KSI_IO_ERROR;
+		goto cleanup;
+	}
+
+	buf = KSI_malloc((size_t)len + 1);
+	if (buf == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	if (fread(buf, 1, (size_t)len, f) != (size_t)len) {
+		fprintf(stderr, "%s: Unable to read file.\n", fileName);
+		res = KSI_IO_ERROR;
+		goto cleanup;
+	}
+
+	*raw = buf;
+	*raw_len = (size_t)len;
+	buf = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	if (f != NULL) fclose(f);
+	KSI_free(buf);
+
+	return res;
+}
+
+/* Creates a context trusting the test publications file, as in the unit tests. */
+static int createContext(KSI_CTX **ksi) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_CTX *tmp = NULL;
+	KSI_PKITruststore *pki = NULL;
+
+	const KSI_CertConstraint pubFileCertConstr[] = {
+			{ KSI_CERT_EMAIL, "publications@guardtime.com"},
+			{ NULL, NULL }
+	};
+
+	res = KSI_CTX_new(&tmp);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_CTX_setDefaultPubFileCertConstraints(tmp, pubFileCertConstr);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_CTX_setPublicationUrl(tmp, resourceUri(BENCH_PUBLICATIONS_FILE));
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_PKITruststore_new(tmp, 0, &pki);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_PKITruststore_addLookupFile(pki, resourcePath(BENCH_CERT_FILE));
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_CTX_setPKITruststore(tmp, pki);
+	if (res != KSI_OK) goto cleanup;
+	pki = NULL;
+
+	*ksi = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_PKITruststore_free(pki);
+	KSI_CTX_free(tmp);
+
+	return res;
+}
+
+/* Gives the context a new client serving the canned responses. The request ids of a new
+ * client start from the beginning, so the response matches the first request again. */
+static int setFileClient(KSI_CTX *ksi, const char *aggrPath, const char *extPath) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_NetworkClient *client = NULL;
+
+	res = KSI_FsClient_new(ksi, &client);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_FsClient_setPublicationUrl(client, resourcePath(BENCH_PUBLICATIONS_FILE));
+	if (res != KSI_OK) goto cleanup;
+
+	if (aggrPath != NULL) {
+		res = KSI_FsClient_setAggregator(client, aggrPath, BENCH_USER, BENCH_PASS);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	if (extPath != NULL) {
+		res = KSI_FsClient_setExtender(client, extPath, BENCH_USER, BENCH_PASS);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	res = KSI_CTX_setNetworkProvider(ksi, client);
+	if (res != KSI_OK) goto cleanup;
+	client = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_NetworkClient_free(client);
+
+	return res;
+}
+
+static int initState(BenchState *state) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_PublicationRecord *pubRec = NULL;
+	KSI_Signature *sig = NULL;
+	size_t i;
+
+	res = createContext(&state->ksi);
+	if (res != KSI_OK) goto cleanup;
+
+	res = createContext(&state->extKsi);
+	if (res != KSI_OK) goto cleanup;
+	KSI_snprintf(state->extPath, sizeof(state->extPath), "%s", resourcePath(BENCH_EXT_RESPONSE_FILE));
+
+	res = createContext(&state->aggrKsi);
+	if (res != KSI_OK) goto cleanup;
+	KSI_snprintf(state->aggrPath, sizeof(state->aggrPath), "%s", resourcePath(BENCH_AGGR_RESPONSE_FILE));
+
+	state->data_len = 1 << 20;
+	state->data = KSI_malloc(state->data_len);
+	if (state->data == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+	for (i = 0; i < state->data_len; i++) {
+		state->data[i] = (unsigned char)(i * 31 + 7);
+	}
+
+	for (i = 0; i < MAX_LEAFS; i++) {
+		res = KSI_DataHash_create(state->ksi, &i, sizeof(i), KSI_HASHALG_SHA2_256, &state->leafs[i]);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	res = KSI_OctetString_new(state->ksi, state->data, 32, &state->iv);
+	if (res != KSI_OK) goto cleanup;
+
+	res = createContext(&state->sharedKsi);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_CTX_setFlag(state->sharedKsi, KSI_CTX_FLAG_SHARED, (void *)1);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_HmacHasher_open(state->ksi, KSI_HASHALG_SHA2_256, BENCH_PASS, &state->hmac);
+	if (res != KSI_OK) goto cleanup;
+
+	res = readFile(resourcePath(BENCH_SIGNATURE_FILE), &state->sigRaw, &state->sigRaw_len);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Signature_parse(state->ksi, state->sigRaw, state->sigRaw_len, &state->sig);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Signature_fromFile(state->ksi, resourcePath(BENCH_EXTENDED_SIGNATURE_FILE), &state->extSig);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Signature_getPublicationRecord(state->extSig, &pubRec);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_PublicationRecord_getPublishedData(pubRec, &state->userPub);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_PublicationData_getTime(state->userPub, &state->pubTime);
+	if (res != KSI_OK) goto cleanup;
+
+	res = readFile(resourcePath(BENCH_PUBLICATIONS_FILE), &state->pubRaw, &state->pubRaw_len);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_PublicationsFile_parse(state->ksi, state->pubRaw, state->pubRaw_len, &state->pubFile);
+	if (res != KSI_OK) goto cleanup;
+
+	/* A container of a few signatures for the lookup and serialization. */
+	res = KSI_MultiSignature_new(state->ksi, &state->ms);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_MultiSignature_add(state->ms, state->sig);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_MultiSignature_add(state->ms, state->extSig);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Signature_fromFile(state->ksi, resourcePath(BENCH_OTHER_SIGNATURE_FILE), &sig);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_MultiSignature_add(state->ms, sig);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Signature_getDocumentHash(state->sig, &state->msHash);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_OK;
+
+cleanup:
+
+	if (res != KSI_OK && state->ksi != NULL) KSI_ERR_statusDump(state->ksi, stderr);
+	KSI_Signature_free(sig);
+
+	return res;
+}
+
+static void cleanState(BenchState *state) {
+	size_t i;
+
+	for (i = 0; i < MAX_LEAFS; i++) {
+		KSI_DataHash_free(state->leafs[i]);
+	}
+	KSI_OctetString_free(state->iv);
+	KSI_HmacHasher_free(state->hmac);
+	KSI_free(state->data);
+	KSI_free(state->sigRaw);
+	KSI_free(state->pubRaw);
+	KSI_Signature_free(state->sig);
+	KSI_Signature_free(state->extSig);
+	KSI_PublicationsFile_free(state->pubFile);
+	KSI_MultiSignature_free(state->ms);
+	KSI_CTX_free(state->extKsi);
+	KSI_CTX_free(state->aggrKsi);
+	KSI_CTX_free(state->sharedKsi);
+	KSI_CTX_free(state->ksi);
+}
+
+static int benchHash(BenchState *state, size_t len) {
+	int res;
+	KSI_DataHash *hsh = NULL;
+
+	res = KSI_DataHash_create(state->ksi, state->data, len, KSI_HASHALG_SHA2_256, &hsh);
+	KSI_DataHash_free(hsh);
+
+	return res;
+}
+
+/* Derives the key state for every message. */
+static int benchHmacKey(BenchState *state, size_t len) {
+	int res;
+	KSI_DataHash *hmac = NULL;
+
+	res = KSI_HMAC_create(state->ksi, KSI_HASHALG_SHA2_256, BENCH_PASS, state->data, len, &hmac);
+	KSI_DataHash_free(hmac);
+
+	return res;
+}
+
+/* Continues from the prepared key state, as the requests and responses are authenticated. */
+static int benchHmacPrepared(BenchState *state, size_t len) {
+	int res;
+	KSI_HmacHasher *hasher = NULL;
+	KSI_DataHash *hmac = NULL;
+
+	res = KSI_HmacHasher_clone(state->hmac, &hasher);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_HmacHasher_add(hasher, state->data, len);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_HmacHasher_close(hasher, &hmac);
+
+cleanup:
+
+	KSI_DataHash_free(hmac);
+	KSI_HmacHasher_free(hasher);
+
+	return res;
+}
+
+static int benchTree(BenchState *state, size_t leafs) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_TreeBuilder *builder = NULL;
+	size_t i;
+
+	res = KSI_TreeBuilder_new(state->ksi, KSI_HASHALG_SHA2_256, &builder);
+	if (res != KSI_OK) goto cleanup;
+
+	for (i = 0; i < leafs; i++) {
+		res = KSI_TreeBuilder_addDataHash(builder, state->leafs[i], 0, NULL);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	res = KSI_TreeBuilder_close(builder);
+
+cleanup:
+
+	KSI_TreeBuilder_free(builder);
+
+	return res;
+}
+
+static int benchFlatTree(BenchState *state, size_t leafs) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_FlatTreeBuilder *builder = NULL;
+	size_t i;
+
+	res = KSI_FlatTreeBuilder_new(state->ksi, KSI_HASHALG_SHA2_256, 0, &builder);
+	if (res != KSI_OK) goto cleanup;
+
+	for (i = 0; i < leafs; i++) {
+		res = KSI_FlatTreeBuilder_addDataHash(builder, state->leafs[i], NULL);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	res = KSI_FlatTreeBuilder_close(builder);
+
+cleanup:
+
+	KSI_FlatTreeBuilder_free(builder);
+
+	return res;
+}
+
+/* Aggregates the block and signs the root with the canned aggregator response. */
+static int benchBlockSigner(BenchState *state, size_t param) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_BlockSigner *bs = NULL;
+	KSI_MultiSignature *ms = NULL;
+	KSI_DataHash *hsh = NULL;
+	size_t i;
+
+	res = setFileClient(state->aggrKsi, state->aggrPath, NULL);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_BlockSigner_new(state->aggrKsi, KSI_HASHALG_SHA1, NULL, NULL, &bs);
+	if (res != KSI_OK) goto cleanup;
+
+	for (i = 0; blockInput[i] != NULL; i++) {
+		res = KSI_DataHash_create(state->aggrKsi, blockInput[i], strlen(blockInput[i]), KSI_HASHALG_SHA2_256, &hsh);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_BlockSigner_add(bs, hsh);
+		if (res != KSI_OK) goto cleanup;
+
+		KSI_DataHash_free(hsh);
+		hsh = NULL;
+	}
+
+	res = KSI_BlockSigner_close(bs, param ? &ms : NULL);
+
+cleanup:
+
+	KSI_DataHash_free(hsh);
+	KSI_MultiSignature_free(ms);
+	KSI_BlockSigner_free(bs);
+
+	return res;
+}
+
+#define BLOCK_MASKED 1
+#define BLOCK_SHARED 2
+
+/* Aggregates a large block the way #KSI_BlockSigner_close does before signing the root. The
+ * canned aggregator response only matches the small unmasked block, so the root is not signed. */
+static int benchBlockAggregate(BenchState *state, size_t flags) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_CTX *ksi = (flags & BLOCK_SHARED) ? state->sharedKsi : state->ksi;
+	KSI_BlockSigner *bs = NULL;
+	KSI_DataHash *prevLeaf = NULL;
+	size_t i;
+
+	if (flags & BLOCK_MASKED) {
+		res = KSI_BlockSigner_new(ksi, KSI_HASHALG_SHA2_256, state->leafs[0], state->iv, &bs);
+	} else {
+		res = KSI_BlockSigner_new(ksi, KSI_HASHALG_SHA2_256, NULL, NULL, &bs);
+	}
+	if (res != KSI_OK) goto cleanup;
+
+	for (i = 0; i < MAX_LEAFS; i++) {
+		res = KSI_BlockSigner_add(bs, state->leafs[i]);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	/* Waits until all the leafs are in the tree. */
+	res = KSI_BlockSigner_getPrevLeaf(bs, &prevLeaf);
+
+cleanup:
+
+	KSI_DataHash_free(prevLeaf);
+	KSI_BlockSigner_free(bs);
+
+	return res;
+}
+
+static int benchSignatureParse(BenchState *state, size_t verify) {
+	int res;
+	KSI_Signature *sig = NULL;
+
+	res = KSI_Signature_parseWithPolicy(state->ksi, state->sigRaw, state->sigRaw_len,
+			verify ? KSI_VERIFICATION_POLICY_INTERNAL : KSI_VERIFICATION_POLICY_EMPTY, NULL, &sig);
+	KSI_Signature_free(sig);
+
+	return res;
+}
+
+static int benchSignatureSerialize(BenchState *state, size_t param) {
+	int res;
+	unsigned char *raw = NULL;
+	size_t raw_len = 0;
+
+	res = KSI_Signature_serialize(state->sig, &raw, &raw_len);
+	KSI_free(raw);
+
+	return res;
+}
+
+static int benchSignatureClone(BenchState *state, size_t param) {
+	int res;
+	KSI_Signature *sig = NULL;
+
+	res = KSI_Signature_clone(state->sig, &sig);
+	KSI_Signature_free(sig);
+
+	return res;
+}
+
+enum {
+	VERIFY_INTERNAL,
+	VERIFY_CALENDAR,
+	VERIFY_KEY,
+	VERIFY_PUBFILE,
+	VERIFY_USERPUB,
+	VERIFY_GENERAL
+};
+
+/* Verifies a signature with the policy, all the inputs are local files. */
+static int benchVerify(BenchState *state, size_t policy) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_VerificationContext context;
+	KSI_PolicyVerificationResult *result = NULL;
+	const KSI_Policy *pol = NULL;
+
+	res = KSI_VerificationContext_init(&context, state->ksi);
+	if (res != KSI_OK) goto cleanup;
+
+	context.signature = state->extSig;
+
+	switch (policy) {
+		case VERIFY_INTERNAL:
+			pol = KSI_VERIFICATION_POLICY_INTERNAL;
+			context.signature = state->sig;
+			break;
+		case VERIFY_CALENDAR:
+			pol = KSI_VERIFICATION_POLICY_CALENDAR_BASED;
+			context.ctx = state->extKsi;
+			/* Replacing the client also drops the cached chain, so every iteration is extended. */
+			res = setFileClient(state->extKsi, NULL, state->extPath);
+			if (res != KSI_OK) goto cleanup;
+			break;
+		case VERIFY_KEY:
+			pol = KSI_VERIFICATION_POLICY_KEY_BASED;
+			context.signature = state->sig;
+			context.userPublicationsFile = state->pubFile;
+			break;
+		case VERIFY_PUBFILE:
+			pol = KSI_VERIFICATION_POLICY_PUBLICATIONS_FILE_BASED;
+			context.userPublicationsFile = state->pubFile;
+			break;
+		case VERIFY_USERPUB:
+			pol = KSI_VERIFICATION_POLICY_USER_PUBLICATION_BASED;
+			context.userPublication = state->userPub;
+			break;
+		default:
+			pol = KSI_VERIFICATION_POLICY_GENERAL;
+			context.userPublicationsFile = state->pubFile;
+			break;
+	}
+
+	res = KSI_SignatureVerifier_verify(pol, &context, &result);
+	if (res != KSI_OK) goto cleanup;
+
+	if (result->finalResult.resultCode != KSI_VER_RES_OK) {
+		res = KSI_VERIFICATION_FAILURE;
+		goto cleanup;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_PolicyVerificationResult_free(result);
+	KSI_VerificationContext_clean(&context);
+
+	return res;
+}
+
+static int benchPubFileParse(BenchState *state, size_t param) {
+	int res;
+	KSI_PublicationsFile *pubFile = NULL;
+
+	res = KSI_PublicationsFile_parse(state->ksi, state->pubRaw, state->pubRaw_len, &pubFile);
+	KSI_PublicationsFile_free(pubFile);
+
+	return res;
+}
+
+static int benchPubFileLookup(BenchState *state, size_t nearest) {
+	int res;
+	KSI_PublicationRecord *rec = NULL;
+
+	if (nearest) {
+		res = KSI_PublicationsFile_getNearestPublication(state->pubFile, state->pubTime, &rec);
+	} else {
+		res = KSI_PublicationsFile_getPublicationDataByTime(state->pubFile, state->pubTime, &rec);
+	}
+	if (res == KSI_OK && rec == NULL) res = KSI_INVALID_STATE;
+
+	return res;
+}
+
+static int benchMultiSigAdd(BenchState *state, size_t param) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_MultiSignature *ms = NULL;
+
+	res = KSI_MultiSignature_new(state->ksi, &ms);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_MultiSignature_add(ms, state->sig);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_MultiSignature_add(ms, state->extSig);
+
+cleanup:
+
+	KSI_MultiSignature_free(ms);
+
+	return res;
+}
+
+static int benchMultiSigGet(BenchState *state, size_t param) {
+	int res;
+	KSI_Signature *sig = NULL;
+
+	res = KSI_MultiSignature_get(state->ms, state->msHash, &sig);
+	KSI_Signature_free(sig);
+
+	return res;
+}
+
+static int benchMultiSigSerialize(BenchState *state, size_t param) {
+	int res;
+	unsigned char *raw = NULL;
+	size_t raw_len = 0;
+
+	res = KSI_MultiSignature_serialize(state->ms, &raw, &raw_len);
+	KSI_free(raw);
+
+	return res;
+}
+
+static const Benchmark benchmarks[] = {
+	{ "hash/sha256/64",                 benchHash,                64 },
+	{ "hash/sha256/4096",               benchHash,                4096 },
+	{ "hash/sha256/1048576",            benchHash,                1 << 20 },
+	{ "hmac/key/64",                    benchHmacKey,             64 },
+	{ "hmac/key/1024",                  benchHmacKey,             1024 },
+	{ "hmac/prepared/64",               benchHmacPrepared,        64 },
+	{ "hmac/prepared/1024",             benchHmacPrepared,        1024 },
+	{ "tree/build/16",                  benchTree,                16 },
+	{ "tree/build/256",                 benchTree,                256 },
+	{ "tree/build/4096",                benchTree,                4096 },
+	{ "tree/flat/16",                   benchFlatTree,            16 },
+	{ "tree/flat/256",                  benchFlatTree,            256 },
+	{ "tree/flat/4096",                 benchFlatTree,            4096 },
+	{ "blocksigner/close",              benchBlockSigner,         0 },
+	{ "blocksigner/close_multisig",     benchBlockSigner,         1 },
+	{ "blocksigner/add/4096",           benchBlockAggregate,      0 },
+	{ "blocksigner/add_masked/4096",    benchBlockAggregate,      BLOCK_MASKED },
+	{ "blocksigner/add_masked_mt/4096", benchBlockAggregate,      BLOCK_MASKED | BLOCK_SHARED },
+	{ "signature/parse",                benchSignatureParse,      0 },
+	{ "signature/parse_verify",         benchSignatureParse,      1 },
+	{ "signature/serialize",            benchSignatureSerialize,  0 },
+	{ "signature/clone",                benchSignatureClone,      0 },
+	{ "verify/internal",                benchVerify,              VERIFY_INTERNAL },
+	{ "verify/calendar",                benchVerify,              VERIFY_CALENDAR },
+	{ "verify/key",                     benchVerify,              VERIFY_KEY },
+	{ "verify/publications_file",       benchVerify,              VERIFY_PUBFILE },
+	{ "verify/user_publication",        benchVerify,              VERIFY_USERPUB },
+	{ "verify/general",                 benchVerify,              VERIFY_GENERAL },
+	{ "pubfile/parse",                  benchPubFileParse,        0 },
+	{ "pubfile/lookup",                 benchPubFileLookup,       0 },
+	{ "pubfile/nearest",                benchPubFileLookup,       1 },
+	{ "multisig/add",                   benchMultiSigAdd,         0 },
+	{ "multisig/get",                   benchMultiSigGet,         0 },
+	{ "multisig/serialize",             benchMultiSigSerialize,   0 },
+	{ NULL, NULL, 0 }
+};
+
+static int compareDouble(const void *a, const void *b) {
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of the sorted samples. */
+static double percentile(const double *sorted, size_t len, double p) {
+	size_t rank = (size_t)(p / 100.0 * (double)len + 0.999999);
+	if (rank < 1) rank = 1;
+	if (rank > len) rank = len;
+	return sorted[rank - 1];
+}
+
+/* Times a sample of the given number of iterations in nanoseconds. */
+static int runSample(const Benchmark *bench, BenchState *state, size_t iterations, double *ns) {
+	int res = KSI_OK;
+	double start;
+	size_t i;
+
+	start = nowNs();
+	for (i = 0; i < iterations && res == KSI_OK; i++) {
+		res = bench->fn(state, bench->param);
+	}
+	*ns = nowNs() - start;
+
+	return res;
+}
+
+static int runBenchmark(const Benchmark *bench, BenchState *state, size_t warmup, size_t samples, double minSampleNs, BenchResult *result) {
+	int res = KSI_UNKNOWN_ERROR;
+	double times[MAX_SAMPLES];
+	double ns = 0;
+	double sum = 0;
+	size_t iterations = 1;
+	size_t i;
+
+	/* Grow the number of iterations until a sample is long enough for the timer. */
+	for (;;) {
+		res = runSample(bench, state, iterations, &ns);
+		if (res != KSI_OK) goto cleanup;
+
+		if (ns >= minSampleNs || iterations >= MAX_ITERATIONS) break;
+		iterations = ns > 0 && minSampleNs / ns < 10 ? (size_t)(iterations * (minSampleNs / ns) * 1.2) + 1 : iterations * 10;
+		if (iterations > MAX_ITERATIONS) iterations = MAX_ITERATIONS;
+	}
+
+	for (i = 0; i < warmup; i++) {
+		res = runSample(bench, state, iterations, &ns);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	for (i = 0; i < samples; i++) {
+		res = runSample(bench, state, iterations, &ns);
+		if (res != KSI_OK) goto cleanup;
+
+		times[i] = ns / (double)iterations;
+		sum += times[i];
+	}
+
+	qsort(times, samples, sizeof(double), compareDouble);
+
+	result->name = bench->name;
+	result->iterations = iterations;
+	result->min = times[0];
+	result->mean = sum / (double)samples;
+	result->p50 = percentile(times, samples, 50);
+	result->p90 = percentile(times, samples, 90);
+	result->p99 = percentile(times, samples, 99);
+	result->max = times[samples - 1];
+
+	res = KSI_OK;
+
+cleanup:
+
+	return res;
+}
+
+static int writeJson(const char *fileName, const BenchResult *results, size_t results_len, size_t warmup, size_t samples, double minSampleMs) {
+	FILE *f = NULL;
+	size_t i;
+
+	f = fopen(fileName, "w");
+	if (f == NULL) {
+		fprintf(stderr, "%s: Unable to open output file.\n", fileName);
+		return KSI_IO_ERROR;
+	}
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"version\": \"%s\",\n", KSI_getVersion());
+	fprintf(f, "  \"warmup\": %lu,\n", (unsigned long)warmup);
+	fprintf(f, "  \"samples\": %lu,\n", (unsigned long)samples);
+	fprintf(f, "  \"min_sample_ms\": %g,\n", minSampleMs);
+	fprintf(f, "  \"benchmarks\": [\n");
+	for (i = 0; i < results_len; i++) {
+		/* One benchmark per line keeps the baselines easy to diff. */
+		fprintf(f, "    {\"name\": \"%s\", \"iterations\": %lu, \"min_ns\": %.1f, \"mean_ns\": %.1f, \"p50_ns\": %.1f, \"p90_ns\": %.1f, \"p99_ns\": %.1f, \"max_ns\": %.1f}%s\n",
+				results[i].name, (unsigned long)results[i].iterations, results[i].min, results[i].mean,
+				results[i].p50, results[i].p90, results[i].p99, results[i].max, i + 1 < results_len ? "," : "");
+	}
+	fprintf(f, "  ]\n");
+	fprintf(f, "}\n");
+
+	fclose(f);
+
+	return KSI_OK;
+}
+
+/* Reads the names and medians from a file written by #writeJson. */
+static int readBaseline(const char *fileName, BaselineEntry **entries, size_t *entries_len) {
+	int res = KSI_UNKNOWN_ERROR;
+	unsigned char *raw = NULL;
+	size_t raw_len = 0;
+	BaselineEntry *tmp = NULL;
+	size_t tmp_len = 0;
+	size_t tmp_size = 0;
+	char *ptr = NULL;
+	char *end = NULL;
+	char *p50 = NULL;
+
+	res = readFile(fileName, &raw, &raw_len);
+	if (res != KSI_OK) goto cleanup;
+	raw[raw_len] = '\0';
+
+	for (ptr = strstr((char *)raw, "\"name\": \""); ptr != NULL; ptr = strstr(end, "\"name\": \"")) {
+		ptr += strlen("\"name\": \"");
+		end = strchr(ptr, '"');
+		if (end == NULL) break;
+
+		p50 = strstr(end, "\"p50_ns\": ");
+		if (p50 == NULL) break;
+
+		if (tmp_len == tmp_size) {
+			BaselineEntry *grown = NULL;
+
+			tmp_size = tmp_size == 0 ? 32 : tmp_size * 2;
+			grown = KSI_calloc(tmp_size, sizeof(BaselineEntry));
+			if (grown == NULL) {
+				res = KSI_OUT_OF_MEMORY;
+				goto cleanup;
+			}
+			if (tmp != NULL) memcpy(grown, tmp, tmp_len * sizeof(BaselineEntry));
+			KSI_free(tmp);
+			tmp = grown;
+		}
+
+		KSI_snprintf(tmp[tmp_len].name, sizeof(tmp[tmp_len].name), "%.*s", (int)(end - ptr), ptr);
+		tmp[tmp_len].p50 = atof(p50 + strlen("\"p50_ns\": "));
+		tmp_len++;
+	}
+
+	*entries = tmp;
+	*entries_len = tmp_len;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_free(raw);
+	KSI_free(tmp);
+
+	return res;
+}
+
+/* Compares the medians and returns the number of regressions. */
+static size_t compareResults(const BenchResult *results, size_t results_len, const BaselineEntry *baseline, size_t baseline_len, double threshold) {
+	size_t regressions = 0;
+	size_t i;
+	size_t j;
+
+	printf("\n%-30s %14s %14s %9s\n", "BENCHMARK", "BASELINE ns", "CURRENT ns", "CHANGE");
+	for (i = 0; i < results_len; i++) {
+		double change;
+		const char *verdict = "";
+
+		for (j = 0; j < baseline_len; j++) {
+			if (strcmp(baseline[j].name, results[i].name) == 0) break;
+		}
+
+		if (j == baseline_len || baseline[j].p50 <= 0) {
+			printf("%-30s %14s %14.1f %9s\n", results[i].name, "-", results[i].p50, "new");
+			continue;
+		}
+
+		change = (results[i].p50 / baseline[j].p50 - 1.0) * 100.0;
+		if (change > threshold) {
+			verdict = "  REGRESSION";
+			regressions++;
+		} else if (change < -threshold) {
+			verdict = "  improved";
+		}
+
+		printf("%-30s %14.1f %14.1f %+8.1f%%%s\n", results[i].name, baseline[j].p50, results[i].p50, change, verdict);
+	}
+
+	return regressions;
+}
+
+static void printHelp(const char *exec) {
+	fprintf(stderr, "Usage:\n"
+			"  %s [options] <path to test root>\n"
+			"\n"
+			"Options:\n"
+			"  -f <filter>     Run only the benchmarks whose name contains <filter>.\n"
+			"  -w <samples>    Number of warmup samples (default 3).\n"
+			"  -r <samples>    Number of measured samples (default %d, max %d).\n"
+			"  -m <ms>         Minimum duration of a sample in milliseconds (default 5).\n"
+			"  -o <file>       Write the results as JSON.\n"
+			"  -c <file>       Compare the medians with a baseline written with -o.\n"
+			"  -t <percent>    Regression threshold for -c (default 10).\n"
+			"  -l              List the benchmarks.\n", exec, MIN_P99_SAMPLES, MAX_SAMPLES);
+}
+
+int main(int argc, char **argv) {
+	int res = KSI_UNKNOWN_ERROR;
+	BenchState state;
+	BenchResult results[sizeof(benchmarks) / sizeof(benchmarks[0])];
+	size_t results_len = 0;
+	BaselineEntry *baseline = NULL;
+	size_t baseline_len = 0;
+	const char *filter = NULL;
+	const char *outFile = NULL;
+	const char *baselineFile = NULL;
+	size_t warmup = 3;
+	size_t samples = MIN_P99_SAMPLES;
+	double minSampleMs = 5;
+	double threshold = 10;
+	size_t regressions = 0;
+	size_t i;
+	int list = 0;
+	int arg;
+
+	memset(&state, 0, sizeof(state));
+
+	for (arg = 1; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (strcmp(argv[arg], "-l") == 0) {
+			list = 1;
+		} else if (arg + 1 >= argc) {
+			break;
+		} else if (strcmp(argv[arg], "-f") == 0) {
+			filter = argv[++arg];
+		} else if (strcmp(argv[arg], "-w") == 0) {
+			warmup = (size_t)atoi(argv[++arg]);
+		} else if (strcmp(argv[arg], "-r") == 0) {
+			samples = (size_t)atoi(argv[++arg]);
+		} else if (strcmp(argv[arg], "-m") == 0) {
+			minSampleMs = atof(argv[++arg]);
+		} else if (strcmp(argv[arg], "-o") == 0) {
+			outFile = argv[++arg];
+		} else if (strcmp(argv[arg], "-c") == 0) {
+			baselineFile = argv[++arg];
+		} else if (strcmp(argv[arg], "-t") == 0) {
+			threshold = atof(argv[++arg]);
+		} else {
+			break;
+		}
+	}
+
+	if (list) {
+		for (i = 0; benchmarks[i].name != NULL; i++) {
+			printf("%s\n", benchmarks[i].name);
+		}
+		res = KSI_OK;
+		goto cleanup;
+	}
+
+	if (arg + 1 != argc || samples == 0 || samples > MAX_SAMPLES) {
+		printHelp(argv[0]);
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+	resourceRoot = argv[arg];
+
+	if (samples < MIN_P99_SAMPLES) {
+		fprintf(stderr, "Warning: with less than %d samples P99 is the maximum.\n", MIN_P99_SAMPLES);
+	}
+
+	if (baselineFile != NULL) {
+		res = readBaseline(baselineFile, &baseline, &baseline_len);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	res = initState(&state);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Unable to load the benchmark resources from '%s'.\n", resourceRoot);
+		goto cleanup;
+	}
+
+	printf("%-30s %10s %12s %12s %12s %12s %12s\n", "BENCHMARK", "ITERATIONS", "MIN ns", "MEAN ns", "P50 ns", "P90 ns", "P99 ns");
+	for (i = 0; benchmarks[i].name != NULL; i++) {
+		BenchResult *r = &results[results_len];
+
+		if (filter != NULL && strstr(benchmarks[i].name, filter) == NULL) continue;
+
+		res = runBenchmark(&benchmarks[i], &state, warmup, samples, minSampleMs * 1e6, r);
+		if (res != KSI_OK) {
+			fprintf(stderr, "%s: Benchmark failed (%s).\n", benchmarks[i].name, KSI_getErrorString(res));
+			goto cleanup;
+		}
+
+		printf("%-30s %10lu %12.1f %12.1f %12.1f %12.1f %12.1f\n", r->name, (unsigned long)r->iterations, r->min, r->mean, r->p50, r->p90, r->p99);
+		results_len++;
+	}
+
+	if (outFile != NULL) {
+		res = writeJson(outFile, results, results_len, warmup, samples, minSampleMs);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	if (baselineFile != NULL) {
+		regressions = compareResults(results, results_len, baseline, baseline_len, threshold);
+		printf("\n%lu regression(s) over %g%%.\n", (unsigned long)regressions, threshold);
+	}
+
+	res = regressions == 0 ? KSI_OK : KSI_UNKNOWN_ERROR;
+
+cleanup:
+
+	KSI_free(baseline);
+	cleanState(&state);
+
+	/* The status codes do not fit into the exit code. */
+	return res == KSI_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
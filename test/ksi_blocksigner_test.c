@@ -25,6 +25,7 @@
 #include "all_tests.h"
 #include "../src/ksi/ctx_impl.h"
 #include "../src/ksi/net_http_impl.h"
+#include "../src/ksi/impl/meta_data_impl.h"
 
 extern KSI_CTX *ctx;
 
@@ -148,6 +149,91 @@ static void testMultiSig(CuTest *tc) {
 #undef TEST_AGGR_RESPONSE_FILE
 }
 
+static void testMultiSigAsync(CuTest *tc) {
+#define TEST_AGGR_RESPONSE_FILE  "resource/tlv/ok-aggr-resp-1460631424.tlv"
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_CTX *signCtx = NULL;
+	KSI_BlockSigner *bs = NULL;
+	KSI_BlockSigner *next = NULL;
+	KSI_BlockSignerHandle *hndl = NULL;
+	KSI_MultiSignature *ms = NULL;
+	size_t i;
+	KSI_DataHash *hsh = NULL;
+	KSI_Signature *sig = NULL;
+
+	res = KSITest_CTX_clone(&signCtx);
+	CuAssert(tc, "Unable to create signing context.", res == KSI_OK && signCtx != NULL);
+
+	res = KSI_CTX_setAggregator(signCtx, getFullResourcePathUri(TEST_AGGR_RESPONSE_FILE), TEST_USER, TEST_PASS);
+	CuAssert(tc, "Unable to set aggregator file URI.", res == KSI_OK);
+
+	res = KSI_BlockSigner_new(ctx, KSI_HASHALG_SHA1, NULL, NULL, &bs);
+	CuAssert(tc, "Unable to create block signer instance.", res == KSI_OK && bs != NULL);
+
+	/* Keep the handle of the first leaf. */
+	for (i = 0; input_data[i] != NULL; i++) {
+		res = KSI_DataHash_create(ctx, input_data[i], strlen(input_data[i]), KSI_HASHALG_SHA2_256, &hsh);
+		CuAssert(tc, "Unable to create data hash.", res == KSI_OK && hsh != NULL);
+
+		res = KSI_BlockSigner_addLeaf(bs, hsh, 0, NULL, i == 0 ? &hndl : NULL);
+		CuAssert(tc, "Unable to add leaf to the block signer.", res == KSI_OK);
+
+		KSI_DataHash_free(hsh);
+		hsh = NULL;
+	}
+
+	res = KSI_BlockSigner_closeAsync(bs, ctx, &next);
+	CuAssert(tc, "Signing with the context of the block signer should not be allowed.", res == KSI_INVALID_ARGUMENT && next == NULL);
+
+	res = KSI_BlockSigner_closeAsync(bs, signCtx, &next);
+	CuAssert(tc, "Unable to close block signer asynchronously.", res == KSI_OK && next != NULL);
+
+	/* Fill the next block while the previous one is being signed. */
+	addInput(tc, next, 0);
+
+	res = KSI_BlockSigner_closeAsync(bs, signCtx, NULL);
+	CuAssert(tc, "Block signer should not be closed twice.", res == KSI_INVALID_STATE);
+
+	/* The handle waits for the signature implicitly. */
+	res = KSI_BlockSignerHandle_getSignature(hndl, &sig);
+	CuAssert(tc, "Unable to extract signature from the handle.", res == KSI_OK && sig != NULL);
+
+	res = KSI_Signature_verifyDocument(sig, ctx, (void *)input_data[0], strlen(input_data[0]));
+	CuAssert(tc, "Unable to verify the input data.", res == KSI_OK);
+
+	KSI_Signature_free(sig);
+	sig = NULL;
+
+	res = KSI_BlockSigner_wait(bs, &ms);
+	CuAssert(tc, "Unable to wait for the block signature.", res == KSI_OK && ms != NULL);
+
+	/* Lets loop over all the inputs and try to verify them. */
+	for (i = 0; input_data[i] != NULL; i++) {
+		res = KSI_DataHash_create(ctx, input_data[i], strlen(input_data[i]), KSI_HASHALG_SHA2_256, &hsh);
+		CuAssert(tc, "Unable to create data hash.", res == KSI_OK && hsh != NULL);
+
+		res = KSI_MultiSignature_get(ms, hsh, &sig);
+		CuAssert(tc, "Unable to extract signature from the multi signature container.", res == KSI_OK && sig != NULL);
+
+		res = KSI_Signature_verifyDocument(sig, ctx, (void *)input_data[i], strlen(input_data[i]));
+		CuAssert(tc, "Unable to verify the input data.", res == KSI_OK);
+
+		KSI_Signature_free(sig);
+		sig = NULL;
+
+		KSI_DataHash_free(hsh);
+		hsh = NULL;
+	}
+
+	KSI_DataHash_free(hsh);
+	KSI_BlockSignerHandle_free(hndl);
+	KSI_MultiSignature_free(ms);
+	KSI_BlockSigner_free(next);
+	KSI_BlockSigner_free(bs);
+	KSI_CTX_free(signCtx);
+#undef TEST_AGGR_RESPONSE_FILE
+}
+
 static void testMedaData(CuTest *tc) {
 #define TEST_AGGR_RESPONSE_FILE  "resource/tlv/test_meta_data_response.tlv"
 	int res = KSI_UNKNOWN_ERROR;
@@ -221,6 +307,169 @@ static void testMedaData(CuTest *tc) {
 #undef TEST_AGGR_RESPONSE_FILE
 }
 
+struct SignatureCollectCtx {
+	KSI_BlockSignerHandle **hndl;
+	char **clientId;
+	size_t count;
+};
+
+static int collectSignature(void *c, KSI_BlockSignerHandle *handle, KSI_Signature *sig) {
+	int res = KSI_UNKNOWN_ERROR;
+	struct SignatureCollectCtx *col = c;
+	char expId[0xff];
+	char *id = NULL;
+
+	/* The signatures must arrive in the order of the leafs. */
+	if (col->hndl[col->count] != handle) {
+		res = KSI_INVALID_STATE;
+		goto cleanup;
+	}
+
+	res = KSI_verifySignature(ctx, sig);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Signature_getSignerIdentity(sig, &id);
+	if (res != KSI_OK) goto cleanup;
+
+	KSI_snprintf(expId, sizeof(expId), "%s :: %s", "GT :: GT :: release test :: anon http", col->clientId[col->count]);
+	if (strcmp(id, expId)) {
+		res = KSI_VERIFICATION_FAILURE;
+		goto cleanup;
+	}
+
+	col->count++;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_free(id);
+	KSI_Signature_free(sig);
+
+	return res;
+}
+
+static void testMetaDataGetSignatures(CuTest *tc) {
+#define TEST_AGGR_RESPONSE_FILE  "resource/tlv/test_meta_data_response.tlv"
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_BlockSigner *bs = NULL;
+	KSI_MetaData *md = NULL;
+	char data[] = "LAPTOP";
+	char *clientId[] = { "Alice", "Bob", "Claire", NULL };
+	size_t i;
+	KSI_DataHash *hsh = NULL;
+	KSI_BlockSignerHandle *hndl[] = {NULL, NULL, NULL};
+	struct SignatureCollectCtx col;
+
+	res = KSI_DataHash_create(ctx, data, strlen(data), KSI_HASHALG_SHA2_256, &hsh);
+	CuAssert(tc, "Unable to create data hash.", res == KSI_OK && hsh != NULL);
+
+	res = KSI_BlockSigner_new(ctx, KSI_HASHALG_SHA2_256, NULL, NULL, &bs);
+	CuAssert(tc, "Unable to create block signer instance.", res == KSI_OK && bs != NULL);
+
+	for (i = 0; clientId[i] != NULL; i++) {
+		res = createMetaData(clientId[i], &md);
+		CuAssert(tc, "Unable to create meta-data.", res == KSI_OK && md != NULL);
+
+		res = KSI_BlockSigner_addLeaf(bs, hsh, 0, md, &hndl[i]);
+		CuAssert(tc, "Unable to add leaf to the block signer.", res == KSI_OK && hndl[i] != NULL);
+
+		KSI_MetaData_free(md);
+		md = NULL;
+	}
+
+	col.hndl = hndl;
+	col.clientId = clientId;
+	col.count = 0;
+
+	res = KSI_BlockSigner_getSignatures(bs, collectSignature, &col);
+	CuAssert(tc, "Signatures may not be extracted before closing.", res == KSI_INVALID_STATE && col.count == 0);
+
+	res = KSI_CTX_setAggregator(ctx, getFullResourcePathUri(TEST_AGGR_RESPONSE_FILE), TEST_USER, TEST_PASS);
+	CuAssert(tc, "Unable to set aggregator file URI.", res == KSI_OK);
+
+	res = KSI_BlockSigner_close(bs, NULL);
+	CuAssert(tc, "Unable to close the blocksigner.", res == KSI_OK);
+
+	res = KSI_BlockSigner_getSignatures(bs, collectSignature, &col);
+	CuAssert(tc, "Unable to extract the signatures.", res == KSI_OK && col.count == i);
+
+	for (i = 0; clientId[i] != NULL; i++) {
+		KSI_BlockSignerHandle_free(hndl[i]);
+	}
+
+	KSI_DataHash_free(hsh);
+	KSI_BlockSigner_free(bs);
+#undef TEST_AGGR_RESPONSE_FILE
+}
+
+static void testMetaDataPayloadAfterSetter(CuTest *tc) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_MetaData *md = NULL;
+	KSI_MetaDataElement *el = NULL;
+	KSI_Utf8String *cId = NULL;
+	KSI_Integer *seqNr = NULL;
+	unsigned char first[1024];
+	size_t first_len = 0;
+	unsigned char second[1024];
+	size_t second_len = 0;
+
+	res = createMetaData("Alice", &md);
+	CuAssert(tc, "Unable to create meta-data.", res == KSI_OK && md != NULL);
+
+	/* Serializing the payload caches it. */
+	res = md->serializePayload(md, first, sizeof(first), &first_len);
+	CuAssert(tc, "Unable to serialize meta-data.", res == KSI_OK && first_len > 0);
+
+	res = md->serializePayload(md, second, sizeof(second), &second_len);
+	CuAssert(tc, "Cached payload does not match.", res == KSI_OK && second_len == first_len && !memcmp(first, second, first_len));
+
+	res = KSI_Utf8String_new(ctx, "Bob", 4, &cId);
+	CuAssert(tc, "Unable to create client id.", res == KSI_OK && cId != NULL);
+
+	res = KSI_MetaData_setClientId(md, cId);
+	CuAssert(tc, "Unable to set client id.", res == KSI_OK);
+
+	res = md->serializePayload(md, second, sizeof(second), &second_len);
+	CuAssert(tc, "Unable to serialize meta-data.", res == KSI_OK);
+	CuAssert(tc, "Stale payload after changing the client id.", second_len != first_len || memcmp(first, second, first_len));
+
+	res = md->toMetaDataElement(md, &el);
+	CuAssert(tc, "Unable to convert meta-data.", res == KSI_OK && el != NULL);
+
+	KSI_Utf8String_free(cId);
+	cId = NULL;
+
+	res = KSI_MetaDataElement_getClientId(el, &cId);
+	CuAssert(tc, "Client id does not match the new value.", res == KSI_OK && cId != NULL && !strcmp(KSI_Utf8String_cstr(cId), "Bob"));
+	cId = NULL;
+
+	KSI_MetaDataElement_free(el);
+	el = NULL;
+
+	res = KSI_Integer_new(ctx, 42, &seqNr);
+	CuAssert(tc, "Unable to create sequence number.", res == KSI_OK && seqNr != NULL);
+
+	res = KSI_MetaData_setSequenceNr(md, seqNr);
+	CuAssert(tc, "Unable to set sequence number.", res == KSI_OK);
+
+	KSI_Integer_free(seqNr);
+	seqNr = NULL;
+
+	res = md->serializePayload(md, first, sizeof(first), &first_len);
+	CuAssert(tc, "Unable to serialize meta-data.", res == KSI_OK);
+	CuAssert(tc, "Stale payload after setting the sequence number.", second_len != first_len || memcmp(first, second, first_len));
+
+	res = md->toMetaDataElement(md, &el);
+	CuAssert(tc, "Unable to convert meta-data.", res == KSI_OK && el != NULL);
+
+	res = KSI_MetaDataElement_getSequenceNr(el, &seqNr);
+	CuAssert(tc, "Sequence number does not match the new value.", res == KSI_OK && seqNr != NULL && KSI_Integer_getUInt64(seqNr) == 42);
+
+	KSI_MetaDataElement_free(el);
+	KSI_MetaData_free(md);
+}
+
 static void testSingle(CuTest *tc) {
 #define TEST_AGGR_RESPONSE_FILE  "resource/tlv/ok-sig-2014-07-01.1-aggr_response.tlv"
 	int res = KSI_UNKNOWN_ERROR;
@@ -381,6 +630,157 @@ static void testMaskingMultiSig(CuTest *tc) {
 #undef TEST_AGGR_RESPONSE_FILE
 }
 
+/* Signs the test input as a masked block with the canned aggregator response. */
+static void closeMaskedBlock(CuTest *tc, KSI_CTX *bsCtx, KSI_MultiSignature **ms) {
+#define TEST_AGGR_RESPONSE_FILE  "resource/tlv/ok-sig-2016-05-09.1-lvl4.ksig"
+	static const unsigned char diceRolls[] = {0xd5, 0x58, 0xaf, 0xfa, 0x80, 0x67, 0xf4, 0x2c, 0xd9, 0x48, 0x36, 0x21, 0xd1, 0xab,
+			0xae, 0x23, 0xed, 0xd6, 0xca, 0x04, 0x72, 0x7e, 0xcf, 0xc7, 0xdb, 0xc7, 0x6b, 0xde, 0x34, 0x77, 0x1e, 0x53};
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_BlockSigner *bs = NULL;
+	KSI_DataHash *zero = NULL;
+	KSI_OctetString *iv = NULL;
+
+	res = KSI_DataHash_createZero(bsCtx, KSI_HASHALG_SHA2_512, &zero);
+	CuAssert(tc, "Unable to create zero hash.", res == KSI_OK && zero != NULL);
+
+	res = KSI_OctetString_new(bsCtx, diceRolls, sizeof(diceRolls), &iv);
+	CuAssert(tc, "Unable to create initial vector.", res == KSI_OK && iv != NULL);
+
+	res = KSI_BlockSigner_new(bsCtx, KSI_HASHALG_SHA1, zero, iv, &bs);
+	CuAssert(tc, "Unable to create block signer instance with masking.", res == KSI_OK && bs != NULL);
+
+	addInput(tc, bs, 0);
+
+	res = KSI_CTX_setAggregator(bsCtx, getFullResourcePathUri(TEST_AGGR_RESPONSE_FILE), "anon", "anon");
+	CuAssert(tc, "Unable to set aggregator file URI.", res == KSI_OK);
+
+	res = KSI_BlockSigner_close(bs, ms);
+	CuAssert(tc, "Unable to close block signer and extract multi signature.", res == KSI_OK && *ms != NULL);
+
+	KSI_BlockSigner_free(bs);
+	KSI_OctetString_free(iv);
+	KSI_DataHash_free(zero);
+#undef TEST_AGGR_RESPONSE_FILE
+}
+
+static void testMaskingSharedContext(CuTest *tc) {
+	static const unsigned char diceRolls[] = {0xd5, 0x58, 0xaf, 0xfa, 0x80, 0x67, 0xf4, 0x2c, 0xd9, 0x48, 0x36, 0x21, 0xd1, 0xab,
+			0xae, 0x23, 0xed, 0xd6, 0xca, 0x04, 0x72, 0x7e, 0xcf, 0xc7, 0xdb, 0xc7, 0x6b, 0xde, 0x34, 0x77, 0x1e, 0x53};
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_CTX *shared = NULL;
+	KSI_BlockSigner *bs = NULL;
+	KSI_BlockSigner *sharedBs = NULL;
+	KSI_DataHash *zero = NULL;
+	KSI_OctetString *iv = NULL;
+	KSI_DataHash *hsh = NULL;
+	KSI_DataHash *prevLeaf = NULL;
+	KSI_DataHash *sharedPrevLeaf = NULL;
+	KSI_MetaData *md = NULL;
+	KSI_MultiSignature *ms = NULL;
+	KSI_MultiSignature *sharedMs = NULL;
+	KSI_Signature *sig = NULL;
+	KSI_Signature *sharedSig = NULL;
+	unsigned char *raw = NULL;
+	size_t raw_len = 0;
+	unsigned char *sharedRaw = NULL;
+	size_t sharedRaw_len = 0;
+	size_t i;
+
+	res = KSITest_CTX_clone(&shared);
+	CuAssert(tc, "Unable to create new context.", res == KSI_OK && shared != NULL);
+
+	res = KSI_CTX_setFlag(shared, KSI_CTX_FLAG_SHARED, (void*)1);
+	CuAssert(tc, "Unable to share the context.", res == KSI_OK);
+
+	/* The masks are calculated by a separate thread, the signatures must not differ. */
+	closeMaskedBlock(tc, ctx, &ms);
+	closeMaskedBlock(tc, shared, &sharedMs);
+
+	for (i = 0; input_data[i] != NULL; i++) {
+		res = KSI_DataHash_create(ctx, input_data[i], strlen(input_data[i]), KSI_HASHALG_SHA2_256, &hsh);
+		CuAssert(tc, "Unable to create data hash.", res == KSI_OK && hsh != NULL);
+
+		res = KSI_MultiSignature_get(ms, hsh, &sig);
+		CuAssert(tc, "Unable to extract signature from the multi signature container.", res == KSI_OK && sig != NULL);
+
+		res = KSI_MultiSignature_get(sharedMs, hsh, &sharedSig);
+		CuAssert(tc, "Unable to extract signature from the multi signature container.", res == KSI_OK && sharedSig != NULL);
+
+		res = KSI_Signature_serialize(sig, &raw, &raw_len);
+		CuAssert(tc, "Unable to serialize signature.", res == KSI_OK && raw != NULL);
+
+		res = KSI_Signature_serialize(sharedSig, &sharedRaw, &sharedRaw_len);
+		CuAssert(tc, "Unable to serialize signature.", res == KSI_OK && sharedRaw != NULL);
+
+		CuAssert(tc, "Signature mismatch.", raw_len == sharedRaw_len && !memcmp(raw, sharedRaw, raw_len));
+
+		KSI_free(raw);
+		raw = NULL;
+		KSI_free(sharedRaw);
+		sharedRaw = NULL;
+		KSI_Signature_free(sig);
+		sig = NULL;
+		KSI_Signature_free(sharedSig);
+		sharedSig = NULL;
+		KSI_DataHash_free(hsh);
+		hsh = NULL;
+	}
+
+	res = KSI_DataHash_createZero(ctx, KSI_HASHALG_SHA2_256, &zero);
+	CuAssert(tc, "Unable to create zero hash.", res == KSI_OK && zero != NULL);
+
+	res = KSI_OctetString_new(ctx, diceRolls, sizeof(diceRolls), &iv);
+	CuAssert(tc, "Unable to create initial vector.", res == KSI_OK && iv != NULL);
+
+	res = KSI_BlockSigner_new(ctx, KSI_HASHALG_SHA2_256, zero, iv, &bs);
+	CuAssert(tc, "Unable to create block signer instance with masking.", res == KSI_OK && bs != NULL);
+
+	res = KSI_BlockSigner_new(shared, KSI_HASHALG_SHA2_256, zero, iv, &sharedBs);
+	CuAssert(tc, "Unable to create block signer instance with masking.", res == KSI_OK && sharedBs != NULL);
+
+	res = createMetaData("Client", &md);
+	CuAssert(tc, "Unable to create metadata.", res == KSI_OK && md != NULL);
+
+	/* A block longer than the queue of the mask stage, some of the leafs with meta-data. */
+	for (i = 0; i < 3000; i++) {
+		res = KSI_DataHash_create(ctx, &i, sizeof(i), KSI_HASHALG_SHA2_256, &hsh);
+		CuAssert(tc, "Unable to create data hash.", res == KSI_OK && hsh != NULL);
+
+		res = KSI_BlockSigner_addLeaf(bs, hsh, 0, (i % 500 == 0) ? md : NULL, NULL);
+		CuAssert(tc, "Unable to add data hash to the block signer.", res == KSI_OK);
+
+		res = KSI_BlockSigner_addLeaf(sharedBs, hsh, 0, (i % 500 == 0) ? md : NULL, NULL);
+		CuAssert(tc, "Unable to add data hash to the block signer.", res == KSI_OK);
+
+		KSI_DataHash_free(hsh);
+		hsh = NULL;
+
+		if (i % 1000 == 999) {
+			res = KSI_BlockSigner_getPrevLeaf(bs, &prevLeaf);
+			CuAssert(tc, "Unable to get the previous leaf.", res == KSI_OK && prevLeaf != NULL);
+
+			res = KSI_BlockSigner_getPrevLeaf(sharedBs, &sharedPrevLeaf);
+			CuAssert(tc, "Unable to get the previous leaf.", res == KSI_OK && sharedPrevLeaf != NULL);
+
+			CuAssert(tc, "Masked leaf value mismatch.", KSI_DataHash_equals(prevLeaf, sharedPrevLeaf));
+
+			KSI_DataHash_free(prevLeaf);
+			prevLeaf = NULL;
+			KSI_DataHash_free(sharedPrevLeaf);
+			sharedPrevLeaf = NULL;
+		}
+	}
+
+	KSI_MultiSignature_free(ms);
+	KSI_MultiSignature_free(sharedMs);
+	KSI_MetaData_free(md);
+	KSI_BlockSigner_free(bs);
+	KSI_BlockSigner_free(sharedBs);
+	KSI_OctetString_free(iv);
+	KSI_DataHash_free(zero);
+	KSI_CTX_free(shared);
+}
+
 static void testMaskingWithMetaDataMultiSig(CuTest *tc) {
 #define TEST_AGGR_RESPONSE_FILE  "resource/tlv/test_meta_data_masking.tlv"
 	static const unsigned char diceRolls[] = {0xd5, 0x58, 0xaf, 0xfa, 0x80, 0x67, 0xf4, 0x2c, 0xd9, 0x48, 0x36, 0x21, 0xd1, 0xab,
@@ -496,6 +896,88 @@ static void testMaskingInput(CuTest *tc) {
 	KSI_DataHash_free(zero);
 }
 
+static void testMaskingPrevLeaf(CuTest *tc) {
+	static const unsigned char diceRolls[] = {0xd5, 0x58, 0xaf, 0xfa, 0x80, 0x67, 0xf4, 0x2c, 0xd9, 0x48, 0x36, 0x21, 0xd1, 0xab,
+			0xae, 0x23, 0xed, 0xd6, 0xca, 0x04, 0x72, 0x7e, 0xcf, 0xc7, 0xdb, 0xc7, 0x6b, 0xde, 0x34, 0x77, 0x1e, 0x53};
+	int res;
+	KSI_BlockSigner *bs = NULL;
+	KSI_OctetString *iv = NULL;
+	KSI_DataHash *zero = NULL;
+	KSI_DataHash *expected = NULL;
+	KSI_DataHash *actual = NULL;
+	KSI_DataHash *hsh = NULL;
+	KSI_DataHash *mask = NULL;
+	KSI_DataHasher *hsr = NULL;
+	unsigned char lvl = 1;
+	size_t i;
+
+	res = KSI_DataHash_createZero(ctx, KSI_HASHALG_SHA2_256, &zero);
+	CuAssert(tc, "Unable to create zero hash.", res == KSI_OK && zero != NULL);
+
+	res = KSI_OctetString_new(ctx, diceRolls, sizeof(diceRolls), &iv);
+	CuAssert(tc, "Unable to create initial vector.", res == KSI_OK && iv != NULL);
+
+	res = KSI_BlockSigner_new(ctx, KSI_HASHALG_SHA2_256, zero, iv, &bs);
+	CuAssert(tc, "Unable to create block signer instance with masking.", res == KSI_OK && bs != NULL);
+
+	expected = KSI_DataHash_ref(zero);
+
+	for (i = 0; input_data[i] != NULL; i++) {
+		res = KSI_DataHash_create(ctx, input_data[i], strlen(input_data[i]), KSI_HASHALG_SHA2_256, &hsh);
+		CuAssert(tc, "Unable to create data hash.", res == KSI_OK && hsh != NULL);
+
+		/* Calculate the expected masked leaf value: H(H(prevLeaf || iv) || hash || 1). */
+		res = KSI_DataHasher_open(ctx, KSI_HASHALG_SHA2_256, &hsr);
+		CuAssert(tc, "Unable to open hasher.", res == KSI_OK && hsr != NULL);
+		KSI_DataHasher_addImprint(hsr, expected);
+		KSI_DataHasher_addOctetString(hsr, iv);
+		res = KSI_DataHasher_close(hsr, &mask);
+		CuAssert(tc, "Unable to calculate the mask.", res == KSI_OK && mask != NULL);
+
+		KSI_DataHasher_reset(hsr);
+		KSI_DataHasher_addImprint(hsr, mask);
+		KSI_DataHasher_addImprint(hsr, hsh);
+		KSI_DataHasher_add(hsr, &lvl, 1);
+		KSI_DataHash_free(expected);
+		expected = NULL;
+		res = KSI_DataHasher_close(hsr, &expected);
+		CuAssert(tc, "Unable to calculate the leaf.", res == KSI_OK && expected != NULL);
+
+		res = KSI_BlockSigner_add(bs, hsh);
+		CuAssert(tc, "Unable to add data hash to the block signer.", res == KSI_OK);
+
+		/* Hold on to the value of every other leaf, it must not change afterwards. */
+		KSI_DataHash_free(actual);
+		actual = NULL;
+		res = KSI_BlockSigner_getPrevLeaf(bs, &actual);
+		CuAssert(tc, "Unable to get the previous leaf.", res == KSI_OK && actual != NULL);
+		CuAssert(tc, "Masked leaf value mismatch.", KSI_DataHash_equals(expected, actual));
+		if (i % 2 == 0) {
+			KSI_DataHash_free(actual);
+			actual = NULL;
+		}
+
+		KSI_DataHasher_free(hsr);
+		hsr = NULL;
+		KSI_DataHash_free(mask);
+		mask = NULL;
+		KSI_DataHash_free(hsh);
+		hsh = NULL;
+	}
+
+	/* The initial previous leaf is owned by the caller and must not be overwritten. */
+	res = KSI_DataHash_createZero(ctx, KSI_HASHALG_SHA2_256, &hsh);
+	CuAssert(tc, "Unable to create zero hash.", res == KSI_OK && hsh != NULL);
+	CuAssert(tc, "The initial previous leaf was modified.", KSI_DataHash_equals(zero, hsh));
+
+	KSI_DataHash_free(hsh);
+	KSI_DataHash_free(actual);
+	KSI_DataHash_free(expected);
+	KSI_BlockSigner_free(bs);
+	KSI_OctetString_free(iv);
+	KSI_DataHash_free(zero);
+}
+
 static void preTest(void) {
 	ctx->netProvider->requestCount = 0;
 }
@@ -507,12 +989,17 @@ CuSuite* KSITest_Blocksigner_getSuite(void) {
 
 	SUITE_ADD_TEST(suite, testFreeBeforeClose);
 	SUITE_ADD_TEST(suite, testMultiSig);
+	SUITE_ADD_TEST(suite, testMultiSigAsync);
 	SUITE_ADD_TEST(suite, testMedaData);
+	SUITE_ADD_TEST(suite, testMetaDataGetSignatures);
+	SUITE_ADD_TEST(suite, testMetaDataPayloadAfterSetter);
 	SUITE_ADD_TEST(suite, testSingle);
 	SUITE_ADD_TEST(suite, testReset);
 	SUITE_ADD_TEST(suite, testMaskingMultiSig);
+	SUITE_ADD_TEST(suite, testMaskingSharedContext);
 	SUITE_ADD_TEST(suite, testMaskingWithMetaDataMultiSig);
 	SUITE_ADD_TEST(suite, testMaskingInput);
+	SUITE_ADD_TEST(suite, testMaskingPrevLeaf);
 
 	return suite;
 }
@@ -173,6 +173,294 @@ static void TestCtxFlags(CuTest *tc) {
 	res = KSI_CTX_setFlag(ctx, KSI_CTX_FLAG_EXT_PDU_VER, (void*)KSI_EXTENDING_PDU_VERSION);
 	CuAssert(tc, "Unable to set extending PDU version.", res == KSI_OK && ctx->flags[KSI_CTX_FLAG_EXT_PDU_VER] == KSI_EXTENDING_PDU_VERSION);
 
+	CuAssert(tc, "Extended chain cache should be disabled by default.", ctx->extChainCache == NULL);
+
+	res = KSI_CTX_setFlag(ctx, KSI_CTX_FLAG_EXTENDED_CHAIN_CACHE, (void*)2);
+	CuAssert(tc, "Invalid flag value accepted.", res == KSI_INVALID_ARGUMENT && ctx->extChainCache == NULL);
+
+	res = KSI_CTX_setFlag(ctx, KSI_CTX_FLAG_EXTENDED_CHAIN_CACHE, (void*)1);
+	CuAssert(tc, "Unable to enable extended chain cache.", res == KSI_OK && ctx->extChainCache != NULL);
+
+	res = KSI_CTX_setFlag(ctx, KSI_CTX_FLAG_EXTENDED_CHAIN_CACHE, (void*)0);
+	CuAssert(tc, "Unable to disable extended chain cache.", res == KSI_OK && ctx->extChainCache == NULL);
+
+	CuAssert(tc, "File mapping should be disabled by default.", ctx->flags[KSI_CTX_FLAG_MAP_FILES] == 0);
+
+	res = KSI_CTX_setFlag(ctx, KSI_CTX_FLAG_MAP_FILES, (void*)2);
+	CuAssert(tc, "Invalid flag value accepted.", res == KSI_INVALID_ARGUMENT && ctx->flags[KSI_CTX_FLAG_MAP_FILES] == 0);
+
+	res = KSI_CTX_setFlag(ctx, KSI_CTX_FLAG_MAP_FILES, (void*)1);
+	CuAssert(tc, "Unable to enable file mapping.", res == KSI_OK && ctx->flags[KSI_CTX_FLAG_MAP_FILES] == 1);
+
+	res = KSI_CTX_setFlag(ctx, KSI_CTX_FLAG_MAP_FILES, (void*)0);
+	CuAssert(tc, "Unable to disable file mapping.", res == KSI_OK && ctx->flags[KSI_CTX_FLAG_MAP_FILES] == 0);
+
+	KSI_CTX_free(ctx);
+}
+
+static int sharedCtxWorker(void *arg) {
+	KSI_CTX *ctx = arg;
+	int ksi_error = -1;
+	char buf[1024];
+
+	KSI_ERR_clearErrors(ctx);
+	KSI_ERR_push(ctx, KSI_OUT_OF_MEMORY, 0, __FILE__, __LINE__, "Error: worker.");
+
+	if (KSI_ERR_getBaseErrorMessage(ctx, buf, sizeof(buf), &ksi_error, NULL) != KSI_OK) return KSI_UNKNOWN_ERROR;
+	if (strcmp(buf, "Error: worker.") != 0 || ksi_error != KSI_OUT_OF_MEMORY) return KSI_UNKNOWN_ERROR;
+
+	return KSI_OK;
+}
+
+static void TestSharedCtxErrors(CuTest *tc) {
+	int res;
+	int result = KSI_UNKNOWN_ERROR;
+	KSI_CTX *ctx = NULL;
+	KSI_Thread *thread = NULL;
+	int ksi_error = -1;
+	char buf[1024];
+
+	res = KSITest_CTX_clone(&ctx);
+	CuAssert(tc, "Unable to create KSI context.", res == KSI_OK && ctx != NULL);
+
+	res = KSI_CTX_setFlag(ctx, KSI_CTX_FLAG_SHARED, (void*)1);
+	CuAssert(tc, "Unable to share the context.", res == KSI_OK && ctx->flags[KSI_CTX_FLAG_SHARED] == 1);
+
+	res = KSI_CTX_setFlag(ctx, KSI_CTX_FLAG_SHARED, (void*)0);
+	CuAssert(tc, "Shared context turned back to unshared.", res == KSI_INVALID_ARGUMENT && ctx->flags[KSI_CTX_FLAG_SHARED] == 1);
+
+	res = KSI_Thread_start(ctx, sharedCtxWorker, ctx, &thread);
+	CuAssert(tc, "Unable to start the worker thread.", res == KSI_OK && thread != NULL);
+
+	KSI_ERR_clearErrors(ctx);
+	KSI_ERR_push(ctx, KSI_INVALID_ARGUMENT, 0, __FILE__, __LINE__, "Error: main.");
+
+	res = KSI_Thread_join(thread, &result);
+	CuAssert(tc, "Worker did not see its own errors.", res == KSI_OK && result == KSI_OK);
+
+	res = KSI_ERR_getBaseErrorMessage(ctx, buf, sizeof(buf), &ksi_error, NULL);
+	CuAssert(tc, "Errors of the worker leaked to the main thread.", res == KSI_OK && strcmp(buf, "Error: main.") == 0 && ksi_error == KSI_INVALID_ARGUMENT);
+
+	KSI_Thread_free(thread);
+	KSI_CTX_free(ctx);
+}
+
+typedef struct {
+	KSI_CTX *ctx;
+	KSI_PublicationsFile *pubFile;
+} PubFileWorker;
+
+static int pubFileWorker(void *arg) {
+	PubFileWorker *w = arg;
+	return KSI_receivePublicationsFile(w->ctx, &w->pubFile);
+}
+
+static void TestSharedCtxPublicationsFile(CuTest *tc) {
+	int res;
+	int result;
+	KSI_CTX *ctx = NULL;
+	KSI_Thread *thread[2] = {NULL, NULL};
+	PubFileWorker worker[2];
+	KSI_PublicationsFile *pubFile = NULL;
+	int i;
+
+	res = KSITest_CTX_clone(&ctx);
+	CuAssert(tc, "Unable to create KSI context.", res == KSI_OK && ctx != NULL);
+
+	res = KSI_CTX_setFlag(ctx, KSI_CTX_FLAG_SHARED, (void*)1);
+	CuAssert(tc, "Unable to share the context.", res == KSI_OK);
+
+	res = KSI_CTX_setPublicationUrl(ctx, getFullResourcePathUri("resource/tlv/publications.tlv"));
+	CuAssert(tc, "Unable to set publications file URL.", res == KSI_OK);
+
+	/* The threads start with no counters, so they are set up while the file is being loaded. */
+	for (i = 0; i < 2; i++) {
+		worker[i].ctx = ctx;
+		worker[i].pubFile = NULL;
+		res = KSI_Thread_start(ctx, pubFileWorker, &worker[i], &thread[i]);
+		CuAssert(tc, "Unable to start the worker thread.", res == KSI_OK && thread[i] != NULL);
+	}
+
+	res = KSI_receivePublicationsFile(ctx, &pubFile);
+	CuAssert(tc, "Unable to receive publications file.", res == KSI_OK && pubFile != NULL);
+
+	for (i = 0; i < 2; i++) {
+		result = KSI_UNKNOWN_ERROR;
+		res = KSI_Thread_join(thread[i], &result);
+		CuAssert(tc, "Worker was unable to receive publications file.", res == KSI_OK && result == KSI_OK);
+		CuAssert(tc, "Publications file was loaded more than once.", worker[i].pubFile == pubFile);
+
+		KSI_PublicationsFile_free(worker[i].pubFile);
+		KSI_Thread_free(thread[i]);
+	}
+
+	KSI_PublicationsFile_free(pubFile);
+	KSI_CTX_free(ctx);
+}
+
+typedef struct {
+	int count;
+	int last_level;
+	char last[64];
+} TestLogSink;
+
+static int testLogSink(void *logCtx, int level, const char *message) {
+	TestLogSink *sink = logCtx;
+	sink->count++;
+	sink->last_level = level;
+	strncpy(sink->last, message, sizeof(sink->last) - 1);
+	return KSI_OK;
+}
+
+static void TestAsyncLogger(CuTest *tc) {
+	int res;
+	KSI_CTX *ctx = NULL;
+	KSI_AsyncLogger *logger = NULL;
+	TestLogSink sink;
+	int i;
+
+	memset(&sink, 0, sizeof(sink));
+
+	res = KSITest_CTX_clone(&ctx);
+	CuAssert(tc, "Unable to create KSI context.", res == KSI_OK && ctx != NULL);
+
+	res = KSI_AsyncLogger_new(ctx, 4, testLogSink, &sink, &logger);
+	CuAssert(tc, "Unable to create async logger.", res == KSI_OK && logger != NULL);
+
+	res = KSI_CTX_setLoggerCallback(ctx, KSI_LOG_AsyncLogger, logger);
+	CuAssert(tc, "Unable to set logger callback.", res == KSI_OK);
+
+	res = KSI_CTX_setLogLevel(ctx, KSI_LOG_INFO);
+	CuAssert(tc, "Unable to set log level.", res == KSI_OK);
+
+	CuAssert(tc, "Debug level should be disabled.", !KSI_LOG_isEnabled(ctx, KSI_LOG_DEBUG));
+	CuAssert(tc, "Info level should be enabled.", KSI_LOG_isEnabled(ctx, KSI_LOG_INFO));
+
+	for (i = 0; i < 100; i++) {
+		res = KSI_LOG_debug(ctx, "Debug message %d.", i);
+		CuAssert(tc, "Disabled logging failed.", res == KSI_OK);
+	}
+
+	res = KSI_LOG_logBlob(ctx, KSI_LOG_DEBUG, "Blob", (unsigned char *)"ab", 2);
+	CuAssert(tc, "Disabled blob logging failed.", res == KSI_OK);
+
+	res = KSI_LOG_info(ctx, "Info message.");
+	CuAssert(tc, "Info logging failed.", res == KSI_OK);
+
+	res = KSI_CTX_setLoggerCallback(ctx, NULL, NULL);
+	CuAssert(tc, "Unable to detach the logger.", res == KSI_OK);
+
+	/* Waits for the pending messages. */
+	KSI_AsyncLogger_free(logger);
+
+	CuAssert(tc, "Unexpected number of messages written.", sink.count == 1);
+	CuAssert(tc, "Unexpected message written.", sink.last_level == KSI_LOG_INFO && strcmp(sink.last, "Info message.") == 0);
+
+	KSI_CTX_free(ctx);
+}
+
+static void TestCounters(CuTest *tc) {
+	int res;
+	KSI_CTX *ctx = NULL;
+	KSI_DataHash *hsh = NULL;
+	KSI_Signature *sig = NULL;
+	KSI_Counters *counters = NULL;
+	const char *ruleName = NULL;
+	KSI_uint64_t executed = 0;
+	KSI_uint64_t sent = 1;
+	FILE *f = NULL;
+
+	res = KSITest_CTX_clone(&ctx);
+	CuAssert(tc, "Unable to create KSI context.", res == KSI_OK && ctx != NULL);
+
+	res = KSI_DataHash_create(ctx, "abc", 3, KSI_HASHALG_SHA2_256, &hsh);
+	CuAssert(tc, "Unable to create hash.", res == KSI_OK && hsh != NULL);
+
+	res = KSI_Signature_fromFile(ctx, getFullResourcePath("resource/tlv/ok-sig-2014-04-30.1.ksig"), &sig);
+	CuAssert(tc, "Unable to read signature from file.", res == KSI_OK && sig != NULL);
+
+	res = KSI_CTX_getCounters(ctx, &counters);
+	CuAssert(tc, "Unable to get counters.", res == KSI_OK && counters != NULL);
+
+	CuAssert(tc, "Hash not counted.", KSI_Counters_getHashCount(counters, KSI_HASHALG_SHA2_256) > 0);
+	CuAssert(tc, "Hashed bytes not counted.", KSI_Counters_get(counters, KSI_COUNTER_HASHED_BYTES) >= 3);
+	CuAssert(tc, "Parsed TLV not counted.", KSI_Counters_get(counters, KSI_COUNTER_TLV_PARSED) > 0);
+
+	res = KSI_Counters_getService(counters, KSI_COUNTER_SERVICE_AGGREGATOR, &sent, NULL, NULL, NULL);
+	CuAssert(tc, "Unexpected aggregator requests.", res == KSI_OK && sent == 0);
+
+	CuAssert(tc, "Verification rules not counted.", KSI_Counters_getRuleCount(counters) > 0);
+	res = KSI_Counters_getRule(counters, 0, &ruleName, &executed, NULL);
+	CuAssert(tc, "Unable to get rule counters.", res == KSI_OK && ruleName != NULL && executed > 0);
+
+	f = tmpfile();
+	CuAssert(tc, "Unable to create temporary file.", f != NULL);
+
+	res = KSI_Counters_writePrometheus(counters, f);
+	CuAssert(tc, "Unable to write counters.", res == KSI_OK && ftell(f) > 0);
+
+	fclose(f);
+	KSI_Counters_free(counters);
+	KSI_Signature_free(sig);
+	KSI_DataHash_free(hsh);
+	KSI_CTX_free(ctx);
+}
+
+typedef struct TraceSink_st {
+	int started;
+	int ended;
+	int phase;
+	KSI_uint64_t last;
+	int ordered;
+} TraceSink;
+
+static void traceToSink(void *c, int phase, int event, KSI_uint64_t requestId, KSI_uint64_t timestamp) {
+	TraceSink *sink = c;
+
+	if (timestamp < sink->last) sink->ordered = 0;
+	sink->last = timestamp;
+
+	if (event == KSI_TRACE_START) {
+		sink->started++;
+		sink->phase = phase;
+	} else if (phase == sink->phase && requestId == 0) {
+		sink->ended++;
+	}
+}
+
+static void TestTrace(CuTest *tc) {
+	int res;
+	KSI_CTX *ctx = NULL;
+	KSI_Signature *sig = NULL;
+	TraceSink sink;
+
+	memset(&sink, 0, sizeof(sink));
+	sink.ordered = 1;
+
+	res = KSITest_CTX_clone(&ctx);
+	CuAssert(tc, "Unable to create KSI context.", res == KSI_OK && ctx != NULL);
+
+	res = KSI_CTX_setTraceCallback(ctx, traceToSink, &sink);
+	CuAssert(tc, "Unable to set trace callback.", res == KSI_OK);
+
+	res = KSI_Signature_fromFile(ctx, getFullResourcePath("resource/tlv/ok-sig-2014-04-30.1.ksig"), &sig);
+	CuAssert(tc, "Unable to read signature from file.", res == KSI_OK && sig != NULL);
+
+	CuAssert(tc, "Verification not traced.", sink.started > 0 && sink.phase == KSI_TRACE_VERIFY);
+	CuAssert(tc, "Unmatched trace events.", sink.started == sink.ended);
+	CuAssert(tc, "Trace timestamps not monotonic.", sink.ordered);
+
+	res = KSI_CTX_setTraceCallback(ctx, NULL, NULL);
+	CuAssert(tc, "Unable to clear trace callback.", res == KSI_OK);
+
+	KSI_Signature_free(sig);
+	sig = NULL;
+
+	res = KSI_Signature_fromFile(ctx, getFullResourcePath("resource/tlv/ok-sig-2014-04-30.1.ksig"), &sig);
+	CuAssert(tc, "Unable to read signature from file.", res == KSI_OK && sig != NULL);
+	CuAssert(tc, "Trace callback called after clearing.", sink.started == sink.ended && sink.ended == 1);
+
+	KSI_Signature_free(sig);
 	KSI_CTX_free(ctx);
 }
 
@@ -185,6 +473,11 @@ CuSuite* KSITest_CTX_getSuite(void)
 	SUITE_ADD_TEST(suite, TestErrorsToString);
 	SUITE_ADD_TEST(suite, TestGetBaseError);
 	SUITE_ADD_TEST(suite, TestCtxFlags);
+	SUITE_ADD_TEST(suite, TestSharedCtxErrors);
+	SUITE_ADD_TEST(suite, TestSharedCtxPublicationsFile);
+	SUITE_ADD_TEST(suite, TestAsyncLogger);
+	SUITE_ADD_TEST(suite, TestCounters);
+	SUITE_ADD_TEST(suite, TestTrace);
 
 	return suite;
 }
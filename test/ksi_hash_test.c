@@ -22,6 +22,7 @@
 
 #include "cutest/CuTest.h"
 #include "all_tests.h"
+#include "../src/ksi/internal.h"
 
 extern KSI_CTX *ctx;
 
@@ -476,6 +477,236 @@ static void test_free_without_close(CuTest *tc) {
 	KSI_DataHasher_free(hsr);
 }
 
+/* Concurrent reference updates are only safe with atomic reference counters. */
+#ifdef KSI_ATOMIC_REFCOUNT
+#  define SHARED_REF_THREADS 8
+#else
+#  define SHARED_REF_THREADS 1
+#endif
+#define SHARED_REF_ROUNDS 10000
+
+static int sharedHashWorker(void *arg) {
+	KSI_DataHash *hsh = arg;
+	KSI_HashAlgorithm algo_id = KSI_HASHALG_INVALID;
+	int res = KSI_OK;
+	size_t i;
+
+	for (i = 0; i < SHARED_REF_ROUNDS && res == KSI_OK; i++) {
+		KSI_DataHash *ref = KSI_DataHash_ref(hsh);
+
+		res = KSI_DataHash_getHashAlg(ref, &algo_id);
+		if (res == KSI_OK && algo_id != KSI_HASHALG_SHA2_256) res = KSI_UNKNOWN_ERROR;
+		KSI_DataHash_free(ref);
+	}
+
+	/* Release the reference taken for the thread. */
+	KSI_DataHash_free(hsh);
+
+	return res;
+}
+
+static void TestSharedHashRef(CuTest *tc) {
+	int res;
+	KSI_DataHash *hsh = NULL;
+	KSI_DataHash *expected = NULL;
+	KSI_Thread *thread[SHARED_REF_THREADS];
+	size_t i;
+
+	KSI_ERR_clearErrors(ctx);
+
+	memset(thread, 0, sizeof(thread));
+
+	res = KSI_DataHash_create(ctx, "data", 4, KSI_HASHALG_SHA2_256, &hsh);
+	KSITest_assertCreateCall(tc, "Unable to create data hash", res, hsh);
+
+	res = KSI_DataHash_create(ctx, "data", 4, KSI_HASHALG_SHA2_256, &expected);
+	KSITest_assertCreateCall(tc, "Unable to create data hash", res, expected);
+
+	for (i = 0; i < SHARED_REF_THREADS; i++) {
+		res = KSI_Thread_start(ctx, sharedHashWorker, KSI_DataHash_ref(hsh), &thread[i]);
+		CuAssert(tc, "Unable to start the worker thread.", res == KSI_OK && thread[i] != NULL);
+	}
+
+	for (i = 0; i < SHARED_REF_THREADS; i++) {
+		int result = KSI_UNKNOWN_ERROR;
+
+		res = KSI_Thread_join(thread[i], &result);
+		CuAssert(tc, "Worker thread failed.", res == KSI_OK && result == KSI_OK);
+
+		KSI_Thread_free(thread[i]);
+	}
+
+	/* The workers have released their references, the hash must still be intact. */
+	CuAssert(tc, "Shared hash did not survive the workers.", KSI_DataHash_equals(hsh, expected));
+
+	KSI_DataHash_free(expected);
+	KSI_DataHash_free(hsh);
+}
+
+static void testHashFile(CuTest *tc, KSI_CTX *hashCtx, size_t len, long offset) {
+	int res;
+	unsigned char *data = NULL;
+	KSI_DataHasher *hsr = NULL;
+	KSI_DataHash *expected = NULL;
+	KSI_DataHash *hsh = NULL;
+	FILE *f = NULL;
+	size_t i;
+
+	KSI_ERR_clearErrors(hashCtx);
+
+	data = KSI_malloc(len);
+	CuAssert(tc, "Out of memory.", data != NULL);
+	for (i = 0; i < len; i++) data[i] = (unsigned char)(i * 7 + i / 4096);
+
+	f = tmpfile();
+	CuAssert(tc, "Unable to create temporary file.", f != NULL);
+	CuAssert(tc, "Unable to write temporary file.", fwrite(data, 1, len, f) == len && fflush(f) == 0);
+	CuAssert(tc, "Unable to seek temporary file.", fseek(f, offset, SEEK_SET) == 0);
+
+	res = KSI_DataHash_create(hashCtx, data + offset, len - offset, KSI_HASHALG_SHA2_256, &expected);
+	KSITest_assertCreateCall(tc, "Unable to create data hash", res, expected);
+
+	res = KSI_DataHasher_open(hashCtx, KSI_HASHALG_SHA2_256, &hsr);
+	KSITest_assertCreateCall(tc, "Unable to create data hasher", res, hsr);
+
+	res = KSI_DataHasher_addFile(hsr, fileno(f));
+	CuAssert(tc, "Unable to hash file.", res == KSI_OK);
+
+	res = KSI_DataHasher_close(hsr, &hsh);
+	KSITest_assertCreateCall(tc, "Unable to close data hasher", res, hsh);
+
+	CuAssert(tc, "File hash mismatch.", KSI_DataHash_equals(expected, hsh));
+
+	fclose(f);
+	KSI_DataHash_free(hsh);
+	KSI_DataHash_free(expected);
+	KSI_DataHasher_free(hsr);
+	KSI_free(data);
+}
+
+static void TestHashFile(CuTest *tc) {
+	testHashFile(tc, ctx, 0, 0);
+	testHashFile(tc, ctx, 1000, 0);
+	/* Larger than a read block, starting at an unaligned offset. */
+	testHashFile(tc, ctx, (3 << 20) + 123, 5);
+	/* Ends exactly at a read block boundary. */
+	testHashFile(tc, ctx, 2 << 20, 0);
+}
+
+static void TestHashFileMapped(CuTest *tc) {
+	int res;
+	KSI_CTX *mapCtx = NULL;
+
+	res = KSITest_CTX_clone(&mapCtx);
+	CuAssert(tc, "Unable to create new context.", res == KSI_OK && mapCtx != NULL);
+
+	/* Large regular files are mapped instead of being read ahead. */
+	res = KSI_CTX_setFlag(mapCtx, KSI_CTX_FLAG_MAP_FILES, (void*)1);
+	CuAssert(tc, "Unable to enable file mapping.", res == KSI_OK);
+
+	testHashFile(tc, mapCtx, 1000, 0);
+	testHashFile(tc, mapCtx, (3 << 20) + 123, 5);
+
+	KSI_CTX_free(mapCtx);
+}
+
+static void TestHashFileByName(CuTest *tc) {
+	int res;
+	KSI_DataHash *hsh = NULL;
+	KSI_DataHash *expected = NULL;
+	unsigned char buf[0xffff];
+	size_t buf_len;
+	FILE *f = NULL;
+
+	KSI_ERR_clearErrors(ctx);
+
+	f = fopen(getFullResourcePath("resource/tlv/ok-sig-2014-04-30.1.ksig"), "rb");
+	CuAssert(tc, "Unable to open file.", f != NULL);
+	buf_len = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+
+	res = KSI_DataHash_create(ctx, buf, buf_len, KSI_HASHALG_SHA2_256, &expected);
+	KSITest_assertCreateCall(tc, "Unable to create data hash", res, expected);
+
+	res = KSI_DataHash_createFromFile(ctx, getFullResourcePath("resource/tlv/ok-sig-2014-04-30.1.ksig"), KSI_HASHALG_SHA2_256, &hsh);
+	KSITest_assertCreateCall(tc, "Unable to hash file", res, hsh);
+
+	CuAssert(tc, "File hash mismatch.", KSI_DataHash_equals(expected, hsh));
+
+	KSI_DataHash_free(hsh);
+	hsh = NULL;
+
+	res = KSI_DataHash_createFromFile(ctx, getFullResourcePath("resource/tlv/no-such-file"), KSI_HASHALG_SHA2_256, &hsh);
+	CuAssert(tc, "Hashing a missing file did not fail.", res == KSI_IO_ERROR && hsh == NULL);
+
+	KSI_DataHash_free(expected);
+}
+
+typedef struct FileHashResults_st {
+	KSI_DataHash *hsh[3];
+	int status[3];
+	size_t count;
+	int ordered;
+} FileHashResults;
+
+static int collectFileHash(void *c, size_t index, int status, KSI_DataHash *hsh) {
+	FileHashResults *results = c;
+
+	if (index != results->count) results->ordered = 0;
+	results->hsh[results->count] = hsh;
+	results->status[results->count] = status;
+	results->count++;
+
+	return KSI_OK;
+}
+
+static void TestHashFiles(CuTest *tc) {
+	int res;
+	KSI_CTX *sharedCtx = NULL;
+	KSI_DataHash *expected = NULL;
+	FileHashResults results;
+	char names[3][1024];
+	char *fileNames[3];
+	size_t workers;
+	size_t i;
+
+	KSI_strncpy(names[0], getFullResourcePath("resource/tlv/ok-sig-2014-04-30.1.ksig"), sizeof(names[0]));
+	KSI_strncpy(names[1], getFullResourcePath("resource/tlv/no-such-file"), sizeof(names[1]));
+	KSI_strncpy(names[2], getFullResourcePath("resource/tlv/ok-sig-2014-04-30.1.ksig"), sizeof(names[2]));
+	for (i = 0; i < 3; i++) fileNames[i] = names[i];
+
+	res = KSI_DataHash_createFromFile(ctx, fileNames[0], KSI_HASHALG_SHA2_256, &expected);
+	KSITest_assertCreateCall(tc, "Unable to hash file", res, expected);
+
+	memset(&results, 0, sizeof(results));
+	res = KSI_DataHash_createFromFiles(ctx, fileNames, 3, KSI_HASHALG_SHA2_256, 2, collectFileHash, &results);
+	CuAssert(tc, "Worker threads allowed with an unshared context.", res == KSI_INVALID_STATE && results.count == 0);
+
+	res = KSITest_CTX_clone(&sharedCtx);
+	CuAssert(tc, "Unable to create KSI context.", res == KSI_OK && sharedCtx != NULL);
+
+	res = KSI_CTX_setFlag(sharedCtx, KSI_CTX_FLAG_SHARED, (void *)1);
+	CuAssert(tc, "Unable to share the context.", res == KSI_OK);
+
+	for (workers = 0; workers <= 4; workers += 2) {
+		memset(&results, 0, sizeof(results));
+		results.ordered = 1;
+
+		res = KSI_DataHash_createFromFiles(sharedCtx, fileNames, 3, KSI_HASHALG_SHA2_256, workers, collectFileHash, &results);
+		CuAssert(tc, "Unable to hash files.", res == KSI_OK);
+		CuAssert(tc, "Unexpected number of results.", results.count == 3 && results.ordered);
+
+		CuAssert(tc, "File hash mismatch.", results.status[0] == KSI_OK && KSI_DataHash_equals(expected, results.hsh[0]));
+		CuAssert(tc, "Missing file not reported.", results.status[1] == KSI_IO_ERROR && results.hsh[1] == NULL);
+		CuAssert(tc, "File hash mismatch.", results.status[2] == KSI_OK && KSI_DataHash_equals(expected, results.hsh[2]));
+
+		for (i = 0; i < 3; i++) KSI_DataHash_free(results.hsh[i]);
+	}
+
+	KSI_DataHash_free(expected);
+	KSI_CTX_free(sharedCtx);
+}
+
 CuSuite* KSITest_Hash_getSuite(void) {
 	CuSuite* suite = CuSuiteNew();
 
@@ -493,6 +724,11 @@ CuSuite* KSITest_Hash_getSuite(void) {
 	SUITE_ADD_TEST(suite, testAllHashing);
 	SUITE_ADD_TEST(suite, testReset);
 	SUITE_ADD_TEST(suite, test_free_without_close);
+	SUITE_ADD_TEST(suite, TestSharedHashRef);
+	SUITE_ADD_TEST(suite, TestHashFile);
+	SUITE_ADD_TEST(suite, TestHashFileMapped);
+	SUITE_ADD_TEST(suite, TestHashFileByName);
+	SUITE_ADD_TEST(suite, TestHashFiles);
 
 	return suite;
 }
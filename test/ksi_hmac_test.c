@@ -289,6 +289,62 @@ static void TestParallelHashing(CuTest* tc) {
 	KSI_DataHash_free(hmac2);
 }
 
+static void TestClonePreparedKey(CuTest* tc) {
+	int res;
+	KSI_HmacHasher *prepared = NULL;
+	KSI_HmacHasher *hasher = NULL;
+	KSI_DataHash *hmac = NULL;
+	const char *data = MESSAGE;
+	const char *key = KEY;
+	const char *expected = SHA256_MESSAGE_HMAC;
+	unsigned i;
+
+	KSI_ERR_clearErrors(ctx);
+
+	res = KSI_HmacHasher_open(ctx, KSI_HASHALG_SHA2_256, key, &prepared);
+	CuAssert(tc, "Failed to open HMAC hasher", res == KSI_OK && prepared != NULL);
+
+	/* Every copy of the prepared state must produce the same HMAC. */
+	for (i = 0; i < 3; i++) {
+		res = KSI_HmacHasher_clone(prepared, &hasher);
+		CuAssert(tc, "Failed to clone HMAC hasher", res == KSI_OK && hasher != NULL);
+
+		res = KSI_HmacHasher_add(hasher, data, strlen(data));
+		CuAssert(tc, "Failed to add data", res == KSI_OK);
+
+		res = KSI_HmacHasher_close(hasher, &hmac);
+		CuAssert(tc, "Failed to close HMAC hasher", res == KSI_OK && hmac != NULL);
+
+		res = CompareHmac(hmac, expected);
+		CuAssert(tc, "HMAC mismatch", res == KSI_OK);
+
+		KSI_HmacHasher_free(hasher);
+		hasher = NULL;
+		KSI_DataHash_free(hmac);
+		hmac = NULL;
+	}
+
+	/* Cloning in the middle of a computation continues from the same state. */
+	res = KSI_HmacHasher_add(prepared, data, 4);
+	CuAssert(tc, "Failed to add data", res == KSI_OK);
+
+	res = KSI_HmacHasher_clone(prepared, &hasher);
+	CuAssert(tc, "Failed to clone HMAC hasher", res == KSI_OK && hasher != NULL);
+
+	res = KSI_HmacHasher_add(hasher, data + 4, strlen(data) - 4);
+	CuAssert(tc, "Failed to add data", res == KSI_OK);
+
+	res = KSI_HmacHasher_close(hasher, &hmac);
+	CuAssert(tc, "Failed to close HMAC hasher", res == KSI_OK && hmac != NULL);
+
+	res = CompareHmac(hmac, expected);
+	CuAssert(tc, "HMAC mismatch", res == KSI_OK);
+
+	KSI_HmacHasher_free(prepared);
+	KSI_HmacHasher_free(hasher);
+	KSI_DataHash_free(hmac);
+}
+
 static void TestInvalidParams(CuTest* tc) {
 	int res;
 	KSI_HmacHasher *hasher = NULL;
@@ -372,6 +428,7 @@ CuSuite* KSITest_HMAC_getSuite(void) {
 	SUITE_ADD_TEST(suite, TestAllAlgorithms);
 	SUITE_ADD_TEST(suite, TestSHA512LongKey);
 	SUITE_ADD_TEST(suite, TestParallelHashing);
+	SUITE_ADD_TEST(suite, TestClonePreparedKey);
 	SUITE_ADD_TEST(suite, TestInvalidParams);
 	return suite;
 }
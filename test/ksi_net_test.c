@@ -27,8 +27,20 @@
 #include "../src/ksi/net_uri_impl.h"
 #include "../src/ksi/net_tcp_impl.h"
 #include "ksi/net_uri.h"
+#include "ksi/net_replay.h"
+#include "ksi/net_pool.h"
+#include "ksi/net_tcp.h"
 #include "ksi/tree_builder.h"
 #include "../src/ksi/signature_impl.h"
+#include "../src/ksi/thread.h"
+#include "../src/ksi/fast_tlv.h"
+
+#ifndef _WIN32
+#  include <unistd.h>
+#  include <sys/socket.h>
+#  include <netinet/in.h>
+#  include <arpa/inet.h>
+#endif
 
 extern KSI_CTX *ctx;
 
@@ -444,6 +456,76 @@ static void testAggregationHeader(CuTest* tc) {
 	KSI_RequestHandle_free(handle);
 }
 
+static void testRequestHmac(CuTest* tc) {
+	int res;
+	KSI_DataHash *hsh = NULL;
+	KSI_DataHash *hmac = NULL;
+	KSI_DataHash *expected = NULL;
+	KSI_AggregationReq *req = NULL;
+	KSI_AggregationPdu *pdu = NULL;
+	KSI_RequestHandle *handle = NULL;
+	KSI_HashAlgorithm algo_id;
+	const unsigned char *raw = NULL;
+	size_t raw_len = 0;
+	size_t ver;
+	int i;
+
+	/* The HMAC is computed over the serialized request, check both PDU versions and repeated requests. */
+	for (ver = KSI_PDU_VERSION_1; ver <= KSI_PDU_VERSION_2; ver++) {
+		KSI_ERR_clearErrors(ctx);
+
+		res = KSI_CTX_setFlag(ctx, KSI_CTX_FLAG_AGGR_PDU_VER, (void*)ver);
+		CuAssert(tc, "Unable to set aggregation PDU version.", res == KSI_OK);
+
+		res = KSI_CTX_setAggregator(ctx, "file://dummy", TEST_USER, TEST_PASS);
+		CuAssert(tc, "Unable to set aggregator.", res == KSI_OK);
+
+		for (i = 0; i < 2; i++) {
+			res = KSI_DataHash_fromImprint(ctx, mockImprint, sizeof(mockImprint), &hsh);
+			CuAssert(tc, "Unable to create data hash object from raw imprint", res == KSI_OK && hsh != NULL);
+
+			res = KSI_AggregationReq_new(ctx, &req);
+			CuAssert(tc, "Unable to create aggregation request.", res == KSI_OK && req != NULL);
+
+			res = KSI_AggregationReq_setRequestHash(req, hsh);
+			CuAssert(tc, "Unable to set request data hash.", res == KSI_OK);
+			hsh = NULL;
+
+			res = KSI_sendSignRequest(ctx, req, &handle);
+			CuAssert(tc, "Unable to send request.", res == KSI_OK && handle != NULL);
+
+			res = KSI_RequestHandle_getRequest(handle, &raw, &raw_len);
+			CuAssert(tc, "Unable to get request.", res == KSI_OK && raw != NULL);
+
+			res = KSI_AggregationPdu_parse(ctx, (unsigned char *)raw, raw_len, &pdu);
+			CuAssert(tc, "Unable to parse the request pdu.", res == KSI_OK && pdu != NULL);
+
+			res = KSI_AggregationPdu_getHmac(pdu, &hmac);
+			CuAssert(tc, "Unable to get HMAC from pdu.", res == KSI_OK && hmac != NULL);
+
+			res = KSI_DataHash_getHashAlg(hmac, &algo_id);
+			CuAssert(tc, "Unable to get HMAC algorithm.", res == KSI_OK);
+
+			res = KSI_AggregationPdu_calculateHmac(pdu, algo_id, TEST_PASS, &expected);
+			CuAssert(tc, "Unable to calculate HMAC.", res == KSI_OK && expected != NULL);
+
+			CuAssert(tc, "Request HMAC mismatch.", KSI_DataHash_equals(hmac, expected));
+
+			KSI_DataHash_free(expected);
+			expected = NULL;
+			KSI_AggregationPdu_free(pdu);
+			pdu = NULL;
+			KSI_RequestHandle_free(handle);
+			handle = NULL;
+			KSI_AggregationReq_free(req);
+			req = NULL;
+		}
+	}
+
+	res = KSI_CTX_setFlag(ctx, KSI_CTX_FLAG_AGGR_PDU_VER, (void*)KSI_AGGREGATION_PDU_VERSION);
+	CuAssert(tc, "Unable to restore aggregation PDU version.", res == KSI_OK);
+}
+
 static void testExtendingHeader(CuTest* tc) {
 	int res;
 	KSI_ExtendReq *req = NULL;
@@ -2133,6 +2215,578 @@ static void testAggregationResponseWithResponseAndErrorPayloadInPduV2(CuTest* tc
 #undef TEST_SIGNATURE_FILE
 }
 
+#define TEST_REPLAY_LOG "ksi_net_test_replay.log"
+
+/* Signs with the given network client in place of the network provider of the context. */
+static int signWithClient(KSI_NetworkClient *client, KSI_DataHash *hsh, KSI_Signature **sig) {
+	int res;
+	KSI_NetworkClient *live = ctx->netProvider;
+
+	ctx->netProvider = client;
+	res = KSI_createSignature(ctx, hsh, sig);
+	ctx->netProvider = live;
+
+	return res;
+}
+
+static void recordAndReplaySigning(CuTest *tc, size_t version, const char *responseFile) {
+	int res;
+	KSI_DataHash *hsh = NULL;
+	KSI_DataHash *other = NULL;
+	KSI_Signature *sig = NULL;
+	KSI_NetRecorder *rec = NULL;
+	KSI_NetworkClient *replay = NULL;
+	unsigned char *expected = NULL;
+	size_t expected_len = 0;
+	unsigned char *raw = NULL;
+	size_t raw_len = 0;
+	size_t count = 0;
+	int i;
+
+	KSI_ERR_clearErrors(ctx);
+
+	res = KSI_DataHash_fromImprint(ctx, mockImprint, sizeof(mockImprint), &hsh);
+	CuAssert(tc, "Unable to create data hash object from raw imprint", res == KSI_OK && hsh != NULL);
+
+	res = KSI_CTX_setAggregator(ctx, getFullResourcePathUri(responseFile), TEST_USER, TEST_PASS);
+	CuAssert(tc, "Unable to set aggregator file URI", res == KSI_OK);
+
+	res = KSI_CTX_setFlag(ctx, KSI_CTX_FLAG_AGGR_PDU_VER, (void*)version);
+	CuAssert(tc, "Unable to configure aggregation PDU version.", res == KSI_OK);
+
+	/* Record the session with the canned response. */
+	res = KSI_NetRecorder_new(ctx, TEST_REPLAY_LOG, &rec);
+	CuAssert(tc, "Unable to create network recorder.", res == KSI_OK && rec != NULL);
+
+	res = KSI_NetworkClient_setRecorder(ctx->netProvider, rec);
+	CuAssert(tc, "Unable to set network recorder.", res == KSI_OK);
+
+	res = KSI_createSignature(ctx, hsh, &sig);
+
+	KSI_NetworkClient_setRecorder(ctx->netProvider, NULL);
+	KSI_NetRecorder_free(rec);
+
+	CuAssert(tc, "Unable to sign the hash", res == KSI_OK && sig != NULL);
+
+	res = KSI_Signature_serialize(sig, &expected, &expected_len);
+	CuAssert(tc, "Unable to serialize signature.", res == KSI_OK && expected != NULL && expected_len > 0);
+	KSI_Signature_free(sig);
+	sig = NULL;
+
+	/* Replay the session, the request ids of the new requests differ from the recorded one. */
+	res = KSI_ReplayClient_new(ctx, TEST_REPLAY_LOG, &replay);
+	CuAssert(tc, "Unable to create replay client.", res == KSI_OK && replay != NULL);
+
+	res = KSI_ReplayClient_getCount(replay, &count);
+	CuAssert(tc, "Unexpected number of recorded requests.", res == KSI_OK && count == 1);
+
+	res = KSI_NetworkClient_setAggregatorUser(replay, TEST_USER);
+	CuAssert(tc, "Unable to set aggregator user.", res == KSI_OK);
+
+	res = KSI_NetworkClient_setAggregatorPass(replay, TEST_PASS);
+	CuAssert(tc, "Unable to set aggregator key.", res == KSI_OK);
+
+	for (i = 0; i < 2; i++) {
+		res = signWithClient(replay, hsh, &sig);
+		CuAssert(tc, "Unable to sign the hash with the replayed response.", res == KSI_OK && sig != NULL);
+
+		res = KSI_Signature_serialize(sig, &raw, &raw_len);
+		CuAssert(tc, "Unable to serialize signature.", res == KSI_OK && raw != NULL);
+		CuAssert(tc, "Replayed signature mismatch.", raw_len == expected_len && !memcmp(expected, raw, raw_len));
+
+		KSI_free(raw);
+		raw = NULL;
+		KSI_Signature_free(sig);
+		sig = NULL;
+	}
+
+	/* A request with a different content was not recorded. */
+	res = KSI_DataHash_createZero(ctx, KSI_HASHALG_SHA2_256, &other);
+	CuAssert(tc, "Unable to create data hash.", res == KSI_OK && other != NULL);
+
+	res = signWithClient(replay, other, &sig);
+	CuAssert(tc, "Request should not match the recorded one.", res == KSI_NETWORK_ERROR && sig == NULL);
+
+	res = KSI_CTX_setFlag(ctx, KSI_CTX_FLAG_AGGR_PDU_VER, (void*)KSI_AGGREGATION_PDU_VERSION);
+	CuAssert(tc, "Unable to configure aggregation PDU version.", res == KSI_OK);
+
+	KSI_NetworkClient_free(replay);
+	KSI_DataHash_free(other);
+	KSI_DataHash_free(hsh);
+	KSI_free(expected);
+	remove(TEST_REPLAY_LOG);
+}
+
+static void testRecordAndReplay(CuTest* tc) {
+	recordAndReplaySigning(tc, KSI_PDU_VERSION_1, "resource/tlv/ok-sig-2014-07-01.1-aggr_response.tlv");
+}
+
+static void testRecordAndReplayPduVer2(CuTest* tc) {
+	recordAndReplaySigning(tc, KSI_PDU_VERSION_2, "resource/tlv/ok-sig-2014-07-01.1-aggr_response_v2.tlv");
+}
+
+static void testPoolFailover(CuTest* tc) {
+	int res;
+	KSI_NetworkClient *pool = NULL;
+	KSI_DataHash *hsh = NULL;
+	KSI_Signature *sig = NULL;
+	KSI_uint64_t latency = 0;
+	double errorRate = 0;
+	int healthy = 0;
+
+	KSI_ERR_clearErrors(ctx);
+
+	res = KSI_PoolClient_new(ctx, &pool);
+	CuAssert(tc, "Unable to create pool client.", res == KSI_OK && pool != NULL);
+
+	res = KSI_PoolClient_addAggregator(pool, getFullResourcePathUri("resource/tlv/no-such-file.tlv"), TEST_USER, TEST_PASS);
+	CuAssert(tc, "Unable to add aggregator.", res == KSI_OK);
+
+	res = KSI_PoolClient_addAggregator(pool, getFullResourcePathUri("resource/tlv/ok-sig-2014-07-01.1-aggr_response.tlv"), TEST_USER, TEST_PASS);
+	CuAssert(tc, "Unable to add aggregator.", res == KSI_OK);
+
+	res = KSI_PoolClient_setMaxFailures(pool, 1);
+	CuAssert(tc, "Unable to set max failures.", res == KSI_OK);
+
+	res = KSI_DataHash_fromImprint(ctx, mockImprint, sizeof(mockImprint), &hsh);
+	CuAssert(tc, "Unable to create data hash object from raw imprint", res == KSI_OK && hsh != NULL);
+
+	/* The first endpoint fails and the request is retried on the second one. */
+	res = signWithClient(pool, hsh, &sig);
+	CuAssert(tc, "Unable to sign the hash with the pool.", res == KSI_OK && sig != NULL);
+
+	res = KSI_PoolClient_getEndpointStatus(pool, KSI_COUNTER_SERVICE_AGGREGATOR, 0, NULL, &errorRate, &healthy);
+	CuAssert(tc, "Unable to get endpoint status.", res == KSI_OK);
+	CuAssert(tc, "Failing endpoint should be ejected.", !healthy && errorRate > 0);
+
+	res = KSI_PoolClient_getEndpointStatus(pool, KSI_COUNTER_SERVICE_AGGREGATOR, 1, &latency, &errorRate, &healthy);
+	CuAssert(tc, "Unable to get endpoint status.", res == KSI_OK);
+	CuAssert(tc, "Working endpoint should be healthy.", healthy && errorRate == 0 && latency > 0);
+
+	res = KSI_PoolClient_getEndpointStatus(pool, KSI_COUNTER_SERVICE_AGGREGATOR, 2, NULL, NULL, NULL);
+	CuAssert(tc, "Endpoint index should be out of range.", res == KSI_INVALID_ARGUMENT);
+
+	KSI_Signature_free(sig);
+	KSI_DataHash_free(hsh);
+	KSI_NetworkClient_free(pool);
+}
+
+static void testPoolWithoutWorkingEndpoints(CuTest* tc) {
+	int res;
+	KSI_NetworkClient *pool = NULL;
+	KSI_DataHash *hsh = NULL;
+	KSI_Signature *sig = NULL;
+
+	KSI_ERR_clearErrors(ctx);
+
+	res = KSI_PoolClient_new(ctx, &pool);
+	CuAssert(tc, "Unable to create pool client.", res == KSI_OK && pool != NULL);
+
+	res = KSI_DataHash_fromImprint(ctx, mockImprint, sizeof(mockImprint), &hsh);
+	CuAssert(tc, "Unable to create data hash object from raw imprint", res == KSI_OK && hsh != NULL);
+
+	res = signWithClient(pool, hsh, &sig);
+	CuAssert(tc, "Signing should fail without aggregators.", res == KSI_AGGREGATOR_NOT_CONFIGURED && sig == NULL);
+
+	res = KSI_PoolClient_addAggregator(pool, getFullResourcePathUri("resource/tlv/no-such-file.tlv"), TEST_USER, TEST_PASS);
+	CuAssert(tc, "Unable to add aggregator.", res == KSI_OK);
+
+	res = signWithClient(pool, hsh, &sig);
+	CuAssert(tc, "Signing should fail with a failing aggregator.", res != KSI_OK && sig == NULL);
+
+	KSI_DataHash_free(hsh);
+	KSI_NetworkClient_free(pool);
+}
+
+static void testPoolFailoverOnServiceError(CuTest* tc) {
+	int res;
+	KSI_NetworkClient *pool = NULL;
+	KSI_DataHash *hsh = NULL;
+	KSI_Signature *sig = NULL;
+	KSI_uint64_t latency = 0;
+	double errorRate = 0;
+	int healthy = 0;
+
+	KSI_ERR_clearErrors(ctx);
+
+	res = KSI_PoolClient_new(ctx, &pool);
+	CuAssert(tc, "Unable to create pool client.", res == KSI_OK && pool != NULL);
+
+	res = KSI_PoolClient_addAggregator(pool, getFullResourcePathUri("resource/tlv/aggr_error_pdu_internal.tlv"), TEST_USER, TEST_PASS);
+	CuAssert(tc, "Unable to add aggregator.", res == KSI_OK);
+
+	res = KSI_PoolClient_addAggregator(pool, getFullResourcePathUri("resource/tlv/ok-sig-2014-07-01.1-aggr_response.tlv"), TEST_USER, TEST_PASS);
+	CuAssert(tc, "Unable to add aggregator.", res == KSI_OK);
+
+	res = KSI_PoolClient_setMaxFailures(pool, 1);
+	CuAssert(tc, "Unable to set max failures.", res == KSI_OK);
+
+	res = KSI_DataHash_fromImprint(ctx, mockImprint, sizeof(mockImprint), &hsh);
+	CuAssert(tc, "Unable to create data hash object from raw imprint", res == KSI_OK && hsh != NULL);
+
+	/* An internal error of the first endpoint is not an answer, the request fails over. */
+	res = signWithClient(pool, hsh, &sig);
+	CuAssert(tc, "Unable to sign the hash with the pool.", res == KSI_OK && sig != NULL);
+
+	res = KSI_PoolClient_getEndpointStatus(pool, KSI_COUNTER_SERVICE_AGGREGATOR, 0, &latency, &errorRate, &healthy);
+	CuAssert(tc, "Unable to get endpoint status.", res == KSI_OK);
+	CuAssert(tc, "Endpoint returning an internal error should be ejected.", !healthy && errorRate > 0 && latency == 0);
+
+	res = KSI_PoolClient_getEndpointStatus(pool, KSI_COUNTER_SERVICE_AGGREGATOR, 1, &latency, &errorRate, &healthy);
+	CuAssert(tc, "Unable to get endpoint status.", res == KSI_OK);
+	CuAssert(tc, "Working endpoint should be healthy.", healthy && errorRate == 0 && latency > 0);
+
+	KSI_Signature_free(sig);
+	sig = NULL;
+	KSI_NetworkClient_free(pool);
+	pool = NULL;
+
+	res = KSI_PoolClient_new(ctx, &pool);
+	CuAssert(tc, "Unable to create pool client.", res == KSI_OK && pool != NULL);
+
+	res = KSI_PoolClient_addAggregator(pool, getFullResourcePathUri("resource/tlv/ok_aggr_err_response-1.tlv"), TEST_USER, TEST_PASS);
+	CuAssert(tc, "Unable to add aggregator.", res == KSI_OK);
+
+	res = KSI_PoolClient_addAggregator(pool, getFullResourcePathUri("resource/tlv/ok-sig-2014-07-01.1-aggr_response.tlv"), TEST_USER, TEST_PASS);
+	CuAssert(tc, "Unable to add aggregator.", res == KSI_OK);
+
+	/* A request the service finds invalid is not repeated with the other endpoints. */
+	res = signWithClient(pool, hsh, &sig);
+	CuAssert(tc, "Invalid request should not fail over.", res == KSI_SERVICE_INVALID_PAYLOAD && sig == NULL);
+
+	res = KSI_PoolClient_getEndpointStatus(pool, KSI_COUNTER_SERVICE_AGGREGATOR, 0, &latency, &errorRate, &healthy);
+	CuAssert(tc, "Unable to get endpoint status.", res == KSI_OK);
+	CuAssert(tc, "Rejecting endpoint should stay healthy without a latency sample.", healthy && errorRate == 0 && latency == 0);
+
+	res = KSI_PoolClient_getEndpointStatus(pool, KSI_COUNTER_SERVICE_AGGREGATOR, 1, &latency, NULL, NULL);
+	CuAssert(tc, "Second endpoint should not have been used.", res == KSI_OK && latency == 0);
+
+	KSI_DataHash_free(hsh);
+	KSI_NetworkClient_free(pool);
+}
+
+/* Concurrent reference updates are only safe with atomic reference counters. */
+#ifdef KSI_ATOMIC_REFCOUNT
+#  define SHARED_REF_THREADS 8
+#else
+#  define SHARED_REF_THREADS 1
+#endif
+#define SHARED_REF_ROUNDS 10000
+
+static void countHandleRelease(void *released) {
+	++*(int *)released;
+}
+
+static int sharedHandleWorker(void *arg) {
+	KSI_RequestHandle *handle = arg;
+	size_t i;
+
+	for (i = 0; i < SHARED_REF_ROUNDS; i++) {
+		KSI_RequestHandle_free(KSI_RequestHandle_ref(handle));
+	}
+
+	/* Release the reference taken for the thread. */
+	KSI_RequestHandle_free(handle);
+
+	return KSI_OK;
+}
+
+static void testSharedRequestHandleRef(CuTest* tc) {
+	int res;
+	int released = 0;
+	KSI_RequestHandle *handle = NULL;
+	KSI_Thread *thread[SHARED_REF_THREADS];
+	size_t i;
+
+	KSI_ERR_clearErrors(ctx);
+
+	memset(thread, 0, sizeof(thread));
+
+	res = KSI_RequestHandle_new(ctx, (const unsigned char *)"request", 7, &handle);
+	CuAssert(tc, "Unable to create request handle.", res == KSI_OK && handle != NULL);
+
+	res = KSI_RequestHandle_setImplContext(handle, &released, countHandleRelease);
+	CuAssert(tc, "Unable to set the implementation context.", res == KSI_OK);
+
+	for (i = 0; i < SHARED_REF_THREADS; i++) {
+		res = KSI_Thread_start(ctx, sharedHandleWorker, KSI_RequestHandle_ref(handle), &thread[i]);
+		CuAssert(tc, "Unable to start the worker thread.", res == KSI_OK && thread[i] != NULL);
+	}
+
+	for (i = 0; i < SHARED_REF_THREADS; i++) {
+		int result = KSI_UNKNOWN_ERROR;
+
+		res = KSI_Thread_join(thread[i], &result);
+		CuAssert(tc, "Worker thread failed.", res == KSI_OK && result == KSI_OK);
+
+		KSI_Thread_free(thread[i]);
+	}
+
+	CuAssert(tc, "Request handle released while still referenced.", released == 0);
+
+	KSI_RequestHandle_free(handle);
+	CuAssert(tc, "Request handle not released exactly once.", released == 1);
+}
+
+#ifndef _WIN32
+typedef struct {
+	int listener;
+	const char *responseFile;
+	/** Number of requests to answer. */
+	int count;
+	/** Delay before each response in milliseconds. */
+	unsigned delay;
+} TcpTestServer;
+
+/* Opens a listening socket on an ephemeral loopback port. */
+static int tcpListen(unsigned *port) {
+	int fd;
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+
+	fd = (int)socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 1) != 0 ||
+			getsockname(fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	*port = ntohs(addr.sin_port);
+	return fd;
+}
+
+/* Answers the requests with the contents of the response file, one connection at a time. */
+static int tcpServe(void *arg) {
+	TcpTestServer *srv = arg;
+	int fd;
+	unsigned char buf[0xffff + 4];
+	size_t len = 0;
+	KSI_FTLV ftlv;
+	FILE *f = NULL;
+	int res = KSI_OK;
+	int i;
+
+	for (i = 0; i < srv->count && res == KSI_OK; i++) {
+		res = KSI_NETWORK_ERROR;
+
+		fd = (int)accept(srv->listener, NULL, NULL);
+		if (fd < 0) break;
+
+		if (KSI_FTLV_socketRead(fd, buf, sizeof(buf), &len, &ftlv) == KSI_OK) {
+			if (srv->delay > 0) KSI_Thread_sleep(srv->delay);
+
+			f = fopen(getFullResourcePath(srv->responseFile), "rb");
+			if (f != NULL) {
+				len = fread(buf, 1, sizeof(buf), f);
+				if (send(fd, (char *)buf, len, 0) == (ssize_t)len) res = KSI_OK;
+				fclose(f);
+			}
+		}
+
+		close(fd);
+	}
+
+	return res;
+}
+
+static void testTcpSigning(CuTest* tc) {
+	int res;
+	KSI_NetworkClient *tcp = NULL;
+	KSI_DataHash *hsh = NULL;
+	KSI_Signature *sig = NULL;
+	KSI_Thread *thread = NULL;
+	TcpTestServer srv;
+	unsigned port = 0;
+	int served = KSI_UNKNOWN_ERROR;
+
+	KSI_ERR_clearErrors(ctx);
+
+	srv.responseFile = "resource/tlv/ok-sig-2014-07-01.1-aggr_response.tlv";
+	srv.count = 1;
+	srv.delay = 0;
+	srv.listener = tcpListen(&port);
+	CuAssert(tc, "Unable to open a listening socket.", srv.listener >= 0);
+
+	res = KSI_Thread_start(ctx, tcpServe, &srv, &thread);
+	CuAssert(tc, "Unable to start the server thread.", res == KSI_OK);
+
+	res = KSI_TcpClient_new(ctx, &tcp);
+	CuAssert(tc, "Unable to create tcp client.", res == KSI_OK && tcp != NULL);
+
+	/* The name may also resolve to an IPv6 address nobody listens on. */
+	res = KSI_TcpClient_setAggregator(tcp, "localhost", port, TEST_USER, TEST_PASS);
+	CuAssert(tc, "Unable to set aggregator.", res == KSI_OK);
+
+	res = KSI_TcpClient_setConnectTimeoutSeconds(tcp, 5);
+	CuAssert(tc, "Unable to set connect timeout.", res == KSI_OK);
+
+	res = KSI_DataHash_fromImprint(ctx, mockImprint, sizeof(mockImprint), &hsh);
+	CuAssert(tc, "Unable to create data hash object from raw imprint", res == KSI_OK && hsh != NULL);
+
+	res = signWithClient(tcp, hsh, &sig);
+
+	KSI_Thread_join(thread, &served);
+	KSI_Thread_free(thread);
+	close(srv.listener);
+
+	CuAssert(tc, "Unable to sign the hash over tcp.", res == KSI_OK && sig != NULL);
+	CuAssert(tc, "Server did not answer the request.", served == KSI_OK);
+
+	KSI_Signature_free(sig);
+	KSI_DataHash_free(hsh);
+	KSI_NetworkClient_free(tcp);
+}
+
+static void testTcpConnectionRefused(CuTest* tc) {
+	int res;
+	KSI_NetworkClient *tcp = NULL;
+	KSI_DataHash *hsh = NULL;
+	KSI_Signature *sig = NULL;
+	unsigned port = 0;
+	int fd;
+
+	KSI_ERR_clearErrors(ctx);
+
+	/* Find a port nobody listens on. */
+	fd = tcpListen(&port);
+	CuAssert(tc, "Unable to open a listening socket.", fd >= 0);
+	close(fd);
+
+	res = KSI_TcpClient_new(ctx, &tcp);
+	CuAssert(tc, "Unable to create tcp client.", res == KSI_OK && tcp != NULL);
+
+	res = KSI_TcpClient_setAggregator(tcp, "127.0.0.1", port, TEST_USER, TEST_PASS);
+	CuAssert(tc, "Unable to set aggregator.", res == KSI_OK);
+
+	res = KSI_DataHash_fromImprint(ctx, mockImprint, sizeof(mockImprint), &hsh);
+	CuAssert(tc, "Unable to create data hash object from raw imprint", res == KSI_OK && hsh != NULL);
+
+	res = signWithClient(tcp, hsh, &sig);
+	CuAssert(tc, "Signing must fail when the connection is refused.", res == KSI_NETWORK_ERROR && sig == NULL);
+
+	KSI_DataHash_free(hsh);
+	KSI_NetworkClient_free(tcp);
+}
+
+static void testPoolHedging(CuTest* tc) {
+	int res;
+	KSI_CTX *sctx = NULL;
+	KSI_NetworkClient *pool = NULL;
+	KSI_NetworkClient *plain = NULL;
+	KSI_DataHash *hsh = NULL;
+	KSI_Signature *sig = NULL;
+	KSI_Thread *fastThread = NULL;
+	KSI_Thread *slowThread = NULL;
+	TcpTestServer fast;
+	TcpTestServer slow;
+	unsigned fastPort = 0;
+	unsigned slowPort = 0;
+	char uri[64];
+	size_t hedged = 0;
+	size_t won = 0;
+	int served = KSI_UNKNOWN_ERROR;
+	int i;
+
+	KSI_ERR_clearErrors(ctx);
+
+	/* The attempts run in threads of their own, so the context must be shared. */
+	res = KSI_PoolClient_new(ctx, &plain);
+	CuAssert(tc, "Unable to create pool client.", res == KSI_OK && plain != NULL);
+
+	res = KSI_PoolClient_setHedging(plain, 90, 100);
+	CuAssert(tc, "Hedging must not be enabled without a shared context.", res == KSI_INVALID_STATE);
+
+	KSI_NetworkClient_free(plain);
+
+	res = KSITest_CTX_clone(&sctx);
+	CuAssert(tc, "Unable to create context.", res == KSI_OK && sctx != NULL);
+
+	res = KSI_CTX_setFlag(sctx, KSI_CTX_FLAG_SHARED, (void *)1);
+	CuAssert(tc, "Unable to share the context.", res == KSI_OK);
+
+	fast.responseFile = slow.responseFile = "resource/tlv/ok-sig-2014-07-01.1-aggr_response.tlv";
+	fast.count = 6;
+	fast.delay = 0;
+	slow.count = 1;
+	slow.delay = 1500;
+
+	fast.listener = tcpListen(&fastPort);
+	slow.listener = tcpListen(&slowPort);
+	CuAssert(tc, "Unable to open a listening socket.", fast.listener >= 0 && slow.listener >= 0);
+
+	res = KSI_Thread_start(ctx, tcpServe, &fast, &fastThread);
+	CuAssert(tc, "Unable to start the server thread.", res == KSI_OK);
+
+	res = KSI_Thread_start(ctx, tcpServe, &slow, &slowThread);
+	CuAssert(tc, "Unable to start the server thread.", res == KSI_OK);
+
+	res = KSI_PoolClient_new(sctx, &pool);
+	CuAssert(tc, "Unable to create pool client.", res == KSI_OK && pool != NULL);
+
+	res = KSI_CTX_setNetworkProvider(sctx, pool);
+	CuAssert(tc, "Unable to set the network provider.", res == KSI_OK);
+
+	KSI_snprintf(uri, sizeof(uri), "ksi+tcp://127.0.0.1:%u", fastPort);
+	res = KSI_PoolClient_addAggregator(pool, uri, TEST_USER, TEST_PASS);
+	CuAssert(tc, "Unable to add aggregator.", res == KSI_OK);
+
+	res = KSI_PoolClient_setHedging(pool, 90, 100);
+	CuAssert(tc, "Unable to enable hedging.", res == KSI_OK);
+
+	res = KSI_DataHash_fromImprint(sctx, mockImprint, sizeof(mockImprint), &hsh);
+	CuAssert(tc, "Unable to create data hash object from raw imprint", res == KSI_OK && hsh != NULL);
+
+	/* Measure the response times of the fast aggregator. */
+	for (i = 0; i < 5; i++) {
+		/* The canned response only matches the first request id. */
+		pool->requestCount = 0;
+
+		res = KSI_createSignature(sctx, hsh, &sig);
+		CuAssert(tc, "Unable to sign the hash with the pool.", res == KSI_OK && sig != NULL);
+
+		KSI_Signature_free(sig);
+		sig = NULL;
+	}
+
+	/* The new aggregator is tried first, but the request is hedged to the fast one. */
+	KSI_snprintf(uri, sizeof(uri), "ksi+tcp://127.0.0.1:%u", slowPort);
+	res = KSI_PoolClient_addAggregator(pool, uri, TEST_USER, TEST_PASS);
+	CuAssert(tc, "Unable to add aggregator.", res == KSI_OK);
+
+	pool->requestCount = 0;
+	res = KSI_createSignature(sctx, hsh, &sig);
+	CuAssert(tc, "Unable to sign the hash with a hedged request.", res == KSI_OK && sig != NULL);
+
+	res = KSI_PoolClient_getHedgeStats(pool, &hedged, &won);
+	CuAssert(tc, "Unable to get hedging statistics.", res == KSI_OK);
+	CuAssert(tc, "Request should have been hedged.", hedged == 1 && won == 1);
+
+	KSI_Signature_free(sig);
+	KSI_DataHash_free(hsh);
+
+	/* Waits for the slow response, as the pool is freed with the context. */
+	KSI_CTX_free(sctx);
+
+	KSI_Thread_join(fastThread, &served);
+	CuAssert(tc, "Fast server did not answer the requests.", served == KSI_OK);
+	KSI_Thread_join(slowThread, &served);
+	CuAssert(tc, "Slow server did not answer the request.", served == KSI_OK);
+
+	KSI_Thread_free(fastThread);
+	KSI_Thread_free(slowThread);
+	close(fast.listener);
+	close(slow.listener);
+}
+
+#endif
+
 CuSuite* KSITest_NET_getSuite(void) {
 	CuSuite* suite = CuSuiteNew();
 
@@ -2162,6 +2816,7 @@ CuSuite* KSITest_NET_getSuite(void) {
 	SUITE_ADD_TEST(suite, testSigningInvalidAggrChainReturned);
 	SUITE_ADD_TEST(suite, testAggregationHeader);
 	SUITE_ADD_TEST(suite, testExtendingHeader);
+	SUITE_ADD_TEST(suite, testRequestHmac);
 	SUITE_ADD_TEST(suite, testSigningErrorResponse);
 	SUITE_ADD_TEST(suite, testExtendingErrorResponse);
 	SUITE_ADD_TEST(suite, testUrlSplit);
@@ -2191,6 +2846,17 @@ CuSuite* KSITest_NET_getSuite(void) {
 	SUITE_ADD_TEST(suite, testExtendingResponseWithResponseAndErrorPayloadInPduV2);
 	SUITE_ADD_TEST(suite, testAggregationResponseMultiplePayloadInPduV2);
 	SUITE_ADD_TEST(suite, testAggregationResponseWithResponseAndErrorPayloadInPduV2);
+	SUITE_ADD_TEST(suite, testRecordAndReplay);
+	SUITE_ADD_TEST(suite, testRecordAndReplayPduVer2);
+	SUITE_ADD_TEST(suite, testPoolFailover);
+	SUITE_ADD_TEST(suite, testPoolWithoutWorkingEndpoints);
+	SUITE_ADD_TEST(suite, testPoolFailoverOnServiceError);
+	SUITE_ADD_TEST(suite, testSharedRequestHandleRef);
+#ifndef _WIN32
+	SUITE_ADD_TEST(suite, testTcpSigning);
+	SUITE_ADD_TEST(suite, testTcpConnectionRefused);
+	SUITE_ADD_TEST(suite, testPoolHedging);
+#endif
 
 	return suite;
 }
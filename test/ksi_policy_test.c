@@ -546,6 +546,7 @@ static void TestVerificationResult(CuTest* tc) {
 		policies[i].rules = singleRules[3 - i];
 		policies[i].fallbackPolicy = &policies[i + 1];
 		policies[i].policyName = names[i];
+		policies[i].program = NULL;
 	}
 	policies[3].fallbackPolicy = NULL;
 
@@ -566,6 +567,12 @@ static void TestVerificationResult(CuTest* tc) {
 		CuAssert(tc, "Unexpected policy name", !strcmp(temp->policyName, names[i]));
 	}
 
+	/* The programs of the policies built by hand are kept in the context. */
+	for (i = 0; i < POLICY_NUM_OF_CACHED; i++) {
+		if (ctx->policyCacheRules[i] == policies[0].rules) break;
+	}
+	CuAssert(tc, "Program of the policy not cached.", i < POLICY_NUM_OF_CACHED && ctx->policyCachePrograms[i] != NULL);
+
 	KSI_PolicyVerificationResult_free(result);
 	KSI_Signature_free(context.signature);
 	KSI_VerificationContext_clean(&context);
@@ -629,6 +636,84 @@ static void TestDuplicateResults(CuTest* tc) {
 	KSI_Policy_free(policy);
 }
 
+static void TestPolicyResultDetail(CuTest* tc) {
+	int res;
+	KSI_Policy *policy = NULL;
+	KSI_VerificationContext context;
+	KSI_PolicyVerificationResult *result = NULL;
+
+	static const KSI_Rule naRules[] = {
+		{KSI_RULE_TYPE_BASIC, DUMMY_VERIFIER(KSI_OK, KSI_VER_RES_NA, KSI_VER_ERR_GEN_1)},
+		{KSI_RULE_TYPE_BASIC, NULL}
+	};
+
+	static const KSI_Rule rules[] = {
+		{KSI_RULE_TYPE_BASIC, DUMMY_VERIFIER(KSI_OK, KSI_VER_RES_OK, KSI_VER_ERR_PUB_1)},
+		{KSI_RULE_TYPE_COMPOSITE_OR, naRules},
+		{KSI_RULE_TYPE_BASIC, DUMMY_VERIFIER(KSI_OK, KSI_VER_RES_OK, KSI_VER_ERR_PUB_2)},
+		{KSI_RULE_TYPE_BASIC, NULL}
+	};
+
+	KSI_LOG_debug(ctx, "%s", __FUNCTION__);
+
+	KSI_ERR_clearErrors(ctx);
+	res = KSI_VerificationContext_init(&context, ctx);
+	CuAssert(tc, "Create verification context failed", res == KSI_OK);
+
+	res = KSI_Policy_create(ctx, rules, "Result detail policy", &policy);
+	CuAssert(tc, "Policy creation failed", res == KSI_OK);
+
+	res = KSI_SignatureVerifier_verifyWithDetail(policy, &context, KSI_VER_DETAIL_POLICIES, &result);
+	CuAssert(tc, "Policy verification failed.", res == KSI_OK);
+	CuAssert(tc, "Unexpected final result.", result->finalResult.resultCode == KSI_VER_RES_OK && result->finalResult.errorCode == KSI_VER_ERR_PUB_2);
+	CuAssert(tc, "Rule results collected.", KSI_RuleVerificationResultList_length(result->ruleResults) == 0);
+	CuAssert(tc, "Unexpected number of policy results.", KSI_RuleVerificationResultList_length(result->policyResults) == 1);
+	KSI_PolicyVerificationResult_free(result);
+	result = NULL;
+
+	res = KSI_SignatureVerifier_verifyWithDetail(policy, &context, KSI_VER_DETAIL_RULES, &result);
+	CuAssert(tc, "Policy verification failed.", res == KSI_OK);
+	CuAssert(tc, "Unexpected final result.", result->finalResult.resultCode == KSI_VER_RES_OK && result->finalResult.errorCode == KSI_VER_ERR_PUB_2);
+	CuAssert(tc, "Unexpected number of rule results.", KSI_RuleVerificationResultList_length(result->ruleResults) == 2);
+
+	KSI_PolicyVerificationResult_free(result);
+	KSI_VerificationContext_clean(&context);
+	KSI_Policy_free(policy);
+}
+
+static void TestEmptyCompositeRule(CuTest* tc) {
+	int res;
+	KSI_Policy *policy = NULL;
+	KSI_VerificationContext context;
+	KSI_PolicyVerificationResult *result = NULL;
+
+	static const KSI_Rule emptyRules[] = {
+		{KSI_RULE_TYPE_BASIC, NULL}
+	};
+
+	static const KSI_Rule rules[] = {
+		{KSI_RULE_TYPE_BASIC, DUMMY_VERIFIER(KSI_OK, KSI_VER_RES_OK, KSI_VER_ERR_PUB_1)},
+		{KSI_RULE_TYPE_COMPOSITE_AND, emptyRules},
+		{KSI_RULE_TYPE_BASIC, DUMMY_VERIFIER(KSI_OK, KSI_VER_RES_OK, KSI_VER_ERR_PUB_2)},
+		{KSI_RULE_TYPE_BASIC, NULL}
+	};
+
+	KSI_LOG_debug(ctx, "%s", __FUNCTION__);
+
+	KSI_ERR_clearErrors(ctx);
+	res = KSI_VerificationContext_init(&context, ctx);
+	CuAssert(tc, "Create verification context failed", res == KSI_OK);
+
+	res = KSI_Policy_create(ctx, rules, "Empty composite rule policy", &policy);
+	CuAssert(tc, "Policy creation failed", res == KSI_OK);
+
+	res = KSI_SignatureVerifier_verify(policy, &context, &result);
+	CuAssert(tc, "Empty composite rule accepted.", res == KSI_UNKNOWN_ERROR && result == NULL);
+
+	KSI_VerificationContext_clean(&context);
+	KSI_Policy_free(policy);
+}
+
 static void TestInternalPolicy_FAIL_WithInvalidRfc3161(CuTest* tc) {
 #define TEST_SIGNATURE_FILE "resource/tlv/signature-with-invalid-rfc3161-output-hash.ksig"
 	int res;
@@ -3213,6 +3298,8 @@ CuSuite* KSITest_Policy_getSuite(void) {
 	SUITE_ADD_TEST(suite, TestCompositeRulesPolicy);
 	SUITE_ADD_TEST(suite, TestVerificationResult);
 	SUITE_ADD_TEST(suite, TestDuplicateResults);
+	SUITE_ADD_TEST(suite, TestPolicyResultDetail);
+	SUITE_ADD_TEST(suite, TestEmptyCompositeRule);
 	SUITE_ADD_TEST(suite, TestInternalPolicy_FAIL_WithInvalidRfc3161);
 	SUITE_ADD_TEST(suite, TestInternalPolicy_FAIL_WithInvalidRfc3161AggrTime);
 	SUITE_ADD_TEST(suite, TestInternalPolicy_FAIL_WithInvalidRfc3161ChainIndex);
@@ -26,6 +26,7 @@
 #include "../src/ksi/ctx_impl.h"
 #include "../src/ksi/net_impl.h"
 #include "../src/ksi/tlv.h"
+#include "../src/ksi/hashchain.h"
 
 extern KSI_CTX *ctx;
 
@@ -120,6 +121,37 @@ static void testVerifyLegacySignatureAndDoc(CuTest *tc) {
 #undef TEST_SIGNATURE_FILE
 }
 
+static void testVerifyLegacySignatureAndDocFd(CuTest *tc) {
+#define TEST_SIGNATURE_FILE "resource/tlv/ok-legacy-sig-2014-06.gtts.ksig"
+
+	int res;
+	char doc[] = "This is a test data file.\x0d\x0a";
+	KSI_Signature *sig = NULL;
+	FILE *f = NULL;
+
+	KSI_ERR_clearErrors(ctx);
+
+	res = KSI_Signature_fromFile(ctx, getFullResourcePath(TEST_SIGNATURE_FILE), &sig);
+	CuAssert(tc, "Unable to read signature from file.", res == KSI_OK && sig != NULL);
+
+	f = tmpfile();
+	CuAssert(tc, "Unable to create temporary file.", f != NULL);
+	CuAssert(tc, "Unable to write temporary file.", fwrite(doc, 1, strlen(doc), f) == strlen(doc) && fflush(f) == 0);
+
+	rewind(f);
+	res = KSI_Signature_verifyDocumentFd(sig, ctx, fileno(f));
+	CuAssert(tc, "Failed to verify valid document", res == KSI_OK);
+
+	/* The descriptor is at the end of the file, so an empty document is verified. */
+	res = KSI_Signature_verifyDocumentFd(sig, ctx, fileno(f));
+	CuAssert(tc, "Verification did not fail with expected error.", res == KSI_VERIFICATION_FAILURE);
+
+	fclose(f);
+	KSI_Signature_free(sig);
+
+#undef TEST_SIGNATURE_FILE
+}
+
 static void testVerifyLegacyExtendedSignatureAndDoc(CuTest *tc) {
 #define TEST_SIGNATURE_FILE "resource/tlv/ok-legacy-sig-2014-06-extended.gtts.ksig"
 
@@ -399,6 +431,133 @@ static void testSerializeSignature(CuTest *tc) {
 #undef TEST_SIGNATURE_FILE
 }
 
+static void assertSignatureSerialization(CuTest *tc, KSI_Signature *sig, const unsigned char *raw, size_t raw_len, int equal) {
+	int res;
+	unsigned char *out = NULL;
+	size_t out_len = 0;
+
+	res = KSI_Signature_serialize(sig, &out, &out_len);
+	CuAssert(tc, "Failed to serialize signature", res == KSI_OK && out != NULL);
+
+	if (equal) {
+		CuAssert(tc, "Serialized signature does not match", out_len == raw_len && !memcmp(out, raw, raw_len));
+	} else {
+		CuAssert(tc, "Serialized signature did not change", out_len != raw_len || memcmp(out, raw, raw_len));
+	}
+
+	KSI_free(out);
+}
+
+static void testCloneSignature(CuTest *tc) {
+#define TEST_SIGNATURE_FILE "resource/tlv/ok-sig-2014-04-30.1.ksig"
+#define TEST_EXTENDED_SIGNATURE_FILE "resource/tlv/ok-sig-2014-04-30.1-extended.ksig"
+#define TEST_EXT_RESPONSE_FILE "resource/tlv/ok-sig-2014-04-30.1-extend_response.tlv"
+
+	int res;
+
+	unsigned char in[0x1ffff];
+	size_t in_len = 0;
+
+	unsigned char *out = NULL;
+	size_t out_len = 0;
+
+	FILE *f = NULL;
+
+	KSI_Signature *sig = NULL;
+	KSI_Signature *clone = NULL;
+	KSI_Signature *ext = NULL;
+	KSI_Signature *extFile = NULL;
+	KSI_PublicationRecord *pubRec = NULL;
+	KSI_Integer *to = NULL;
+
+	KSI_ERR_clearErrors(ctx);
+
+	f = fopen(getFullResourcePath(TEST_SIGNATURE_FILE), "rb");
+	CuAssert(tc, "Unable to open signature file.", f != NULL);
+
+	in_len = (unsigned)fread(in, 1, sizeof(in), f);
+	CuAssert(tc, "Nothing read from signature file.", in_len > 0);
+
+	fclose(f);
+
+	res = KSI_Signature_parse(ctx, in, in_len, &sig);
+	CuAssert(tc, "Failed to parse signature", res == KSI_OK && sig != NULL);
+
+	res = KSI_Signature_clone(sig, &clone);
+	CuAssert(tc, "Failed to clone signature", res == KSI_OK && clone != NULL);
+
+	CuAssert(tc, "Base TLV not shared", clone->baseTlv == sig->baseTlv);
+	CuAssert(tc, "Calendar chain not shared", clone->calendarChain == sig->calendarChain);
+	CuAssert(tc, "Aggregation chain list must be owned by the clone", clone->aggregationChainList != sig->aggregationChainList);
+	CuAssert(tc, "Aggregation chain count mismatch",
+			KSI_AggregationHashChainList_length(clone->aggregationChainList) == KSI_AggregationHashChainList_length(sig->aggregationChainList));
+
+	/* The clone must outlive the original. */
+	KSI_Signature_free(sig);
+	sig = NULL;
+
+	res = KSI_Signature_serialize(clone, &out, &out_len);
+	CuAssert(tc, "Failed to serialize signature", res == KSI_OK);
+	CuAssert(tc, "Serialized signature length mismatch", in_len == out_len);
+	CuAssert(tc, "Serialized signature content mismatch", !memcmp(in, out, in_len));
+
+	KSI_free(out);
+	KSI_Signature_free(clone);
+	clone = NULL;
+
+	/* Extending a clone must not change the original. */
+	res = KSI_Signature_parse(ctx, in, in_len, &sig);
+	CuAssert(tc, "Failed to parse signature", res == KSI_OK && sig != NULL);
+
+	res = KSI_Signature_clone(sig, &clone);
+	CuAssert(tc, "Failed to clone signature", res == KSI_OK && clone != NULL);
+
+	res = KSI_CTX_setExtender(ctx, getFullResourcePathUri(TEST_EXT_RESPONSE_FILE), TEST_USER, TEST_PASS);
+	CuAssert(tc, "Unable to set extender file URI.", res == KSI_OK);
+
+	res = KSI_Integer_new(ctx, 1400112000, &to);
+	CuAssert(tc, "Unable to create integer.", res == KSI_OK && to != NULL);
+
+	res = KSI_Signature_extendTo(clone, ctx, to, &ext);
+	CuAssert(tc, "Unable to extend the clone.", res == KSI_OK && ext != NULL);
+
+	assertSignatureSerialization(tc, ext, in, in_len, 0);
+	assertSignatureSerialization(tc, sig, in, in_len, 1);
+	assertSignatureSerialization(tc, clone, in, in_len, 1);
+
+	/* Replacing the calendar chain and the auth records of a clone must not change the original. */
+	res = KSI_Signature_fromFile(ctx, getFullResourcePath(TEST_EXTENDED_SIGNATURE_FILE), &extFile);
+	CuAssert(tc, "Unable to read signature from file.", res == KSI_OK && extFile != NULL);
+
+	res = KSI_Signature_getPublicationRecord(extFile, &pubRec);
+	CuAssert(tc, "Unable to get publication record.", res == KSI_OK && pubRec != NULL && extFile->calendarChain != NULL);
+
+	res = clone->replaceCalendarChain(clone, KSI_CalendarHashChain_ref(extFile->calendarChain));
+	CuAssert(tc, "Unable to replace the calendar chain of the clone.", res == KSI_OK);
+
+	res = KSI_Signature_replacePublicationRecord(clone, KSI_PublicationRecord_ref(pubRec));
+	CuAssert(tc, "Unable to replace the publication record of the clone.", res == KSI_OK);
+
+	assertSignatureSerialization(tc, clone, in, in_len, 0);
+	assertSignatureSerialization(tc, sig, in, in_len, 1);
+
+	/* Serializing the modified clone again must give the same result. */
+	res = KSI_Signature_serialize(clone, &out, &out_len);
+	CuAssert(tc, "Failed to serialize signature", res == KSI_OK);
+	assertSignatureSerialization(tc, clone, out, out_len, 1);
+
+	KSI_free(out);
+	KSI_Integer_free(to);
+	KSI_Signature_free(extFile);
+	KSI_Signature_free(ext);
+	KSI_Signature_free(clone);
+	KSI_Signature_free(sig);
+
+#undef TEST_SIGNATURE_FILE
+#undef TEST_EXTENDED_SIGNATURE_FILE
+#undef TEST_EXT_RESPONSE_FILE
+}
+
 static void testVerifyDocument(CuTest *tc) {
 #define TEST_SIGNATURE_FILE "resource/tlv/ok-sig-2014-04-30.1.ksig"
 
@@ -855,6 +1014,7 @@ CuSuite* KSITest_Signature_getSuite(void) {
 	SUITE_ADD_TEST(suite, testSignatureSigningTime);
 	SUITE_ADD_TEST(suite, testSignatureSigningTimeNoCalendarChain);
 	SUITE_ADD_TEST(suite, testSerializeSignature);
+	SUITE_ADD_TEST(suite, testCloneSignature);
 	SUITE_ADD_TEST(suite, testVerifyDocument);
 	SUITE_ADD_TEST(suite, testVerifyDocumentHash);
 	SUITE_ADD_TEST(suite, testVerifySignatureNew);
@@ -862,6 +1022,7 @@ CuSuite* KSITest_Signature_getSuite(void) {
 	SUITE_ADD_TEST(suite, testVerifySignatureWithUserPublication);
 	SUITE_ADD_TEST(suite, testVerifySignatureExtendedToHead);
 	SUITE_ADD_TEST(suite, testVerifyLegacySignatureAndDoc);
+	SUITE_ADD_TEST(suite, testVerifyLegacySignatureAndDocFd);
 	SUITE_ADD_TEST(suite, testVerifyLegacyExtendedSignatureAndDoc);
 	SUITE_ADD_TEST(suite, testRFC3161WrongChainIndex);
 	SUITE_ADD_TEST(suite, testRFC3161WrongAggreTime);
@@ -24,6 +24,7 @@
 #include "all_tests.h"
 
 #include  <ksi/tree_builder.h>
+#include <ksi/hashchain.h>
 
 extern KSI_CTX *ctx;
 
@@ -123,6 +124,240 @@ static void testGetAggregationChain(CuTest* tc) {
 }
 
 
+struct ChainCompareCtx {
+	KSI_LIST(KSI_TreeLeafHandle) *leafs;
+	size_t count;
+};
+
+static int compareWithSingleChain(void *c, size_t index, KSI_AggregationHashChain *chain) {
+	int res = KSI_UNKNOWN_ERROR;
+	struct ChainCompareCtx *cmp = c;
+	KSI_TreeLeafHandle *handle = NULL;
+	KSI_AggregationHashChain *expected = NULL;
+	KSI_LIST(KSI_HashChainLink) *expLinks = NULL;
+	KSI_LIST(KSI_HashChainLink) *links = NULL;
+	size_t i;
+
+	res = KSI_TreeLeafHandleList_elementAt(cmp->leafs, index, &handle);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_TreeLeafHandle_getAggregationChain(handle, &expected);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_AggregationHashChain_getChain(expected, &expLinks);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_AggregationHashChain_getChain(chain, &links);
+	if (res != KSI_OK) goto cleanup;
+
+	if (KSI_HashChainLinkList_length(expLinks) != KSI_HashChainLinkList_length(links)) {
+		res = KSI_VERIFICATION_FAILURE;
+		goto cleanup;
+	}
+
+	for (i = 0; i < KSI_HashChainLinkList_length(links); i++) {
+		KSI_HashChainLink *expLink = NULL;
+		KSI_HashChainLink *link = NULL;
+		int expIsLeft, isLeft;
+		KSI_DataHash *expImprint = NULL;
+		KSI_DataHash *imprint = NULL;
+		KSI_Integer *expCorr = NULL;
+		KSI_Integer *corr = NULL;
+
+		res = KSI_HashChainLinkList_elementAt(expLinks, i, &expLink);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_HashChainLinkList_elementAt(links, i, &link);
+		if (res != KSI_OK) goto cleanup;
+
+		KSI_HashChainLink_getIsLeft(expLink, &expIsLeft);
+		KSI_HashChainLink_getIsLeft(link, &isLeft);
+		KSI_HashChainLink_getImprint(expLink, &expImprint);
+		KSI_HashChainLink_getImprint(link, &imprint);
+		KSI_HashChainLink_getLevelCorrection(expLink, &expCorr);
+		KSI_HashChainLink_getLevelCorrection(link, &corr);
+
+		if (expIsLeft != isLeft || !KSI_DataHash_equals(expImprint, imprint) || KSI_Integer_compare(expCorr, corr) != 0) {
+			res = KSI_VERIFICATION_FAILURE;
+			goto cleanup;
+		}
+	}
+
+	cmp->count++;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_AggregationHashChain_free(expected);
+	KSI_AggregationHashChain_free(chain);
+
+	return res;
+}
+
+static void testGetAggregationChains(CuTest* tc) {
+	int res;
+	KSI_TreeBuilder *builder = NULL;
+	char *data[] = { "test1", "test2", "test3", "test4", "test5", "test6", "test7", "test8", "test9", "test10", "test11", NULL};
+	KSI_TreeLeafHandle *handle = NULL;
+	size_t i;
+	KSI_DataHash *hsh = NULL;
+	struct ChainCompareCtx cmp;
+
+	cmp.leafs = NULL;
+	cmp.count = 0;
+
+	res = KSI_TreeLeafHandleList_new(&cmp.leafs);
+	CuAssert(tc, "Unable to create leaf handle list.", res == KSI_OK && cmp.leafs != NULL);
+
+	res = KSI_TreeBuilder_new(ctx, KSI_HASHALG_SHA2_256, &builder);
+	CuAssert(tc, "Unable to create tree builder.", res == KSI_OK && builder != NULL);
+
+	for (i = 0; data[i] != NULL; i++) {
+		res = KSI_DataHash_create(ctx, data[i], strlen(data[i]), KSI_HASHALG_SHA1, &hsh);
+		CuAssert(tc, "Unable to create data hash.", res == KSI_OK && hsh != NULL);
+
+		/* Use different levels for the leafs to have level corrections in the chains. */
+		res = KSI_TreeBuilder_addDataHash(builder, hsh, (int)(i % 3), &handle);
+		CuAssert(tc, "Unable to add data hash to the tree builder", res == KSI_OK && handle != NULL);
+
+		res = KSI_TreeLeafHandleList_append(cmp.leafs, handle);
+		CuAssert(tc, "Unable to append the leaf handle.", res == KSI_OK);
+		handle = NULL;
+
+		KSI_DataHash_free(hsh);
+		hsh = NULL;
+	}
+
+	res = KSI_TreeBuilder_getAggregationChains(builder, cmp.leafs, compareWithSingleChain, &cmp);
+	CuAssert(tc, "Chains may not be extracted before closing the tree.", res == KSI_INVALID_STATE);
+
+	res = KSI_TreeBuilder_close(builder);
+	CuAssert(tc, "Unable to close a valid builder.", res == KSI_OK);
+
+	res = KSI_TreeBuilder_getAggregationChains(builder, cmp.leafs, compareWithSingleChain, &cmp);
+	CuAssert(tc, "Bulk aggregation chains differ from single chains.", res == KSI_OK && cmp.count == i);
+
+	KSI_TreeLeafHandleList_free(cmp.leafs);
+	KSI_TreeBuilder_free(builder);
+}
+
+static int compareFlatChain(void *c, size_t index, KSI_AggregationHashChain *chain) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_DataHash *expected = c;
+	KSI_DataHash *root = NULL;
+
+	res = KSI_AggregationHashChain_aggregate(chain, 0, NULL, &root);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_DataHash_equals(expected, root) ? KSI_OK : KSI_VERIFICATION_FAILURE;
+
+cleanup:
+
+	KSI_DataHash_free(root);
+	KSI_AggregationHashChain_free(chain);
+
+	return res;
+}
+
+static void testFlatTreeMatchesTreeBuilder(CuTest* tc) {
+	int res;
+	KSI_TreeBuilder *builder = NULL;
+	KSI_FlatTreeBuilder *flat = NULL;
+	KSI_TreeLeafHandle *handles[33];
+	KSI_DataHash *hsh = NULL;
+	KSI_DataHash *flatRoot = NULL;
+	KSI_AggregationHashChain *chn = NULL;
+	KSI_DataHash *expected = NULL;
+	KSI_DataHash *actual = NULL;
+	int expectedLevel;
+	int actualLevel;
+	int flatLevel;
+	int leafLevel;
+	size_t count;
+	size_t i;
+	size_t index;
+	char buf[32];
+
+	for (leafLevel = 0; leafLevel < 3; leafLevel += 2) {
+		/* A single leaf has an empty aggregation chain, start with two. */
+		for (count = 2; count <= sizeof(handles) / sizeof(*handles); count++) {
+			res = KSI_TreeBuilder_new(ctx, KSI_HASHALG_SHA2_256, &builder);
+			CuAssert(tc, "Unable to create tree builder.", res == KSI_OK && builder != NULL);
+
+			res = KSI_FlatTreeBuilder_new(ctx, KSI_HASHALG_SHA2_256, leafLevel, &flat);
+			CuAssert(tc, "Unable to create flat tree builder.", res == KSI_OK && flat != NULL);
+
+			for (i = 0; i < count; i++) {
+				KSI_snprintf(buf, sizeof(buf), "test%u", (unsigned)i);
+
+				res = KSI_DataHash_create(ctx, buf, strlen(buf), KSI_HASHALG_SHA1, &hsh);
+				CuAssert(tc, "Unable to create data hash.", res == KSI_OK && hsh != NULL);
+
+				res = KSI_TreeBuilder_addDataHash(builder, hsh, leafLevel, &handles[i]);
+				CuAssert(tc, "Unable to add data hash to the tree builder", res == KSI_OK);
+
+				res = KSI_FlatTreeBuilder_addDataHash(flat, hsh, &index);
+				CuAssert(tc, "Unable to add data hash to the flat tree builder", res == KSI_OK && index == i);
+
+				KSI_DataHash_free(hsh);
+				hsh = NULL;
+			}
+
+			res = KSI_TreeBuilder_close(builder);
+			CuAssert(tc, "Unable to close a valid builder.", res == KSI_OK);
+
+			res = KSI_FlatTreeBuilder_close(flat);
+			CuAssert(tc, "Unable to close a valid flat builder.", res == KSI_OK);
+
+			res = KSI_FlatTreeBuilder_getRootHash(flat, &flatRoot, &flatLevel);
+			CuAssert(tc, "Unable to get the flat tree root hash.", res == KSI_OK && flatRoot != NULL);
+			CuAssert(tc, "Root hash mismatch.", KSI_DataHash_equals(builder->rootNode->hash, flatRoot));
+			CuAssert(tc, "Root level mismatch.", (unsigned)flatLevel == builder->rootNode->level);
+
+			for (i = 0; i < count; i++) {
+				res = KSI_TreeLeafHandle_getAggregationChain(handles[i], &chn);
+				CuAssert(tc, "Unable to extract aggregation chain.", res == KSI_OK && chn != NULL);
+
+				res = KSI_AggregationHashChain_aggregate(chn, leafLevel, &expectedLevel, &expected);
+				CuAssert(tc, "Unable to aggregate the aggregation hash chain.", res == KSI_OK && expected != NULL);
+
+				KSI_AggregationHashChain_free(chn);
+				chn = NULL;
+
+				res = KSI_FlatTreeBuilder_getAggregationChain(flat, i, &chn);
+				CuAssert(tc, "Unable to extract flat aggregation chain.", res == KSI_OK && chn != NULL);
+
+				res = KSI_AggregationHashChain_aggregate(chn, leafLevel, &actualLevel, &actual);
+				CuAssert(tc, "Unable to aggregate the flat aggregation hash chain.", res == KSI_OK && actual != NULL);
+
+				CuAssert(tc, "Aggregation chain root mismatch.", KSI_DataHash_equals(expected, actual));
+				CuAssert(tc, "Aggregation chain level mismatch.", expectedLevel == actualLevel && actualLevel == flatLevel);
+
+				KSI_AggregationHashChain_free(chn);
+				chn = NULL;
+				KSI_DataHash_free(expected);
+				expected = NULL;
+				KSI_DataHash_free(actual);
+				actual = NULL;
+				KSI_TreeLeafHandle_free(handles[i]);
+			}
+
+			if (leafLevel == 0) {
+				res = KSI_FlatTreeBuilder_forEachChain(flat, compareFlatChain, flatRoot);
+				CuAssert(tc, "Bulk chain extraction failed.", res == KSI_OK);
+			}
+
+			KSI_DataHash_free(flatRoot);
+			flatRoot = NULL;
+			KSI_FlatTreeBuilder_free(flat);
+			flat = NULL;
+			KSI_TreeBuilder_free(builder);
+			builder = NULL;
+		}
+	}
+}
+
 
 CuSuite* KSITest_TreeBuilder_getSuite(void)
 {
@@ -131,6 +366,8 @@ CuSuite* KSITest_TreeBuilder_getSuite(void)
 	SUITE_ADD_TEST(suite, testCreateTreeBuilder);
 	SUITE_ADD_TEST(suite, testTreeBuilderAddLeafs);
 	SUITE_ADD_TEST(suite, testGetAggregationChain);
+	SUITE_ADD_TEST(suite, testGetAggregationChains);
+	SUITE_ADD_TEST(suite, testFlatTreeMatchesTreeBuilder);
 
 	return suite;
 }
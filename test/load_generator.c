@@ -0,0 +1,460 @@
+/*
+ * Copyright 2013-2016 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+
+/*
+ * Drives the network client of the SDK with aggregation or extending requests
+ * from several threads and reports the throughput and the request latencies.
+ * Meant to be used together with the mock-server, but works with any service.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+#endif
+
+#include <ksi/ksi.h>
+#include <ksi/net.h>
+#include <ksi/compatibility.h>
+
+#include "../src/ksi/ctx_impl.h"
+#include "../src/ksi/internal.h"
+#include "../src/ksi/thread.h"
+
+#define DEFAULT_USER "anon"
+#define DEFAULT_PASS "anon"
+
+#define MAX_BATCH 1024
+
+typedef struct Config_st {
+	const char *aggrUri;
+	const char *extUri;
+	const char *user;
+	const char *pass;
+	size_t threads;
+	size_t requests;
+	size_t batch;
+	double seconds;
+	size_t version;
+	KSI_uint64_t aggrTime;
+	KSI_uint64_t pubTime;
+} Config;
+
+typedef struct Worker_st {
+	const Config *conf;
+	size_t id;
+	KSI_CTX *ksi;
+	KSI_Thread *thread;
+	/* Latencies of the completed requests in milliseconds. */
+	double *latencies;
+	size_t latencies_len;
+	size_t latencies_size;
+	size_t failures;
+	int lastError;
+} Worker;
+
+/* Monotonic time in milliseconds. */
+static double nowMs(void) {
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER count;
+	if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (double)count.QuadPart * 1e3 / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+#endif
+}
+
+static int addLatency(Worker *w, double ms) {
+	if (w->latencies_len == w->latencies_size) {
+		size_t size = w->latencies_size == 0 ? 1024 : 2 * w->latencies_size;
+		double *tmp = realloc(w->latencies, size * sizeof(double));
+		if (tmp == NULL) return KSI_OUT_OF_MEMORY;
+		w->latencies = tmp;
+		w->latencies_size = size;
+	}
+	w->latencies[w->latencies_len++] = ms;
+	return KSI_OK;
+}
+
+static int sendRequest(Worker *w, size_t seq, KSI_RequestHandle **handle, void **request) {
+	int res;
+	KSI_NetworkClient *client = w->ksi->netProvider;
+	KSI_DataHash *hsh = NULL;
+	KSI_AggregationReq *aggrReq = NULL;
+	KSI_ExtendReq *extReq = NULL;
+	KSI_Integer *tm = NULL;
+	char data[64];
+
+	if (w->conf->aggrUri != NULL) {
+		KSI_snprintf(data, sizeof(data), "load-%lu-%lu", (unsigned long)w->id, (unsigned long)seq);
+
+		res = KSI_DataHash_create(w->ksi, data, strlen(data), KSI_HASHALG_SHA2_256, &hsh);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_AggregationReq_new(w->ksi, &aggrReq);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_AggregationReq_setRequestHash(aggrReq, hsh);
+		if (res != KSI_OK) goto cleanup;
+		hsh = NULL;
+
+		res = KSI_NetworkClient_sendSignRequest(client, aggrReq, handle);
+		if (res != KSI_OK) goto cleanup;
+
+		*request = aggrReq;
+		aggrReq = NULL;
+	} else {
+		res = KSI_ExtendReq_new(w->ksi, &extReq);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_Integer_new(w->ksi, w->conf->aggrTime, &tm);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_ExtendReq_setAggregationTime(extReq, tm);
+		if (res != KSI_OK) goto cleanup;
+		tm = NULL;
+
+		if (w->conf->pubTime != 0) {
+			res = KSI_Integer_new(w->ksi, w->conf->pubTime, &tm);
+			if (res != KSI_OK) goto cleanup;
+
+			res = KSI_ExtendReq_setPublicationTime(extReq, tm);
+			if (res != KSI_OK) goto cleanup;
+			tm = NULL;
+		}
+
+		res = KSI_NetworkClient_sendExtendRequest(client, extReq, handle);
+		if (res != KSI_OK) goto cleanup;
+
+		*request = extReq;
+		extReq = NULL;
+	}
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_Integer_free(tm);
+	KSI_DataHash_free(hsh);
+	KSI_AggregationReq_free(aggrReq);
+	KSI_ExtendReq_free(extReq);
+
+	return res;
+}
+
+/* Parses the response and checks it against the request. */
+static int checkResponse(Worker *w, KSI_RequestHandle *handle, void *request) {
+	int res;
+	KSI_AggregationResp *aggrResp = NULL;
+	KSI_ExtendResp *extResp = NULL;
+
+	if (w->conf->aggrUri != NULL) {
+		res = KSI_RequestHandle_getAggregationResponse(handle, &aggrResp);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_AggregationResp_verifyWithRequest(aggrResp, request);
+		if (res != KSI_OK) goto cleanup;
+	} else {
+		res = KSI_RequestHandle_getExtendResponse(handle, &extResp);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_ExtendResp_verifyWithRequest(extResp, request);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+cleanup:
+
+	KSI_AggregationResp_free(aggrResp);
+	KSI_ExtendResp_free(extResp);
+
+	return res;
+}
+
+static void freeRequest(const Worker *w, void *request) {
+	if (w->conf->aggrUri != NULL) {
+		KSI_AggregationReq_free(request);
+	} else {
+		KSI_ExtendReq_free(request);
+	}
+}
+
+static int workerThread(void *arg) {
+	Worker *w = arg;
+	const Config *conf = w->conf;
+	KSI_RequestHandle *handles[MAX_BATCH];
+	void *requests[MAX_BATCH];
+	double deadline = conf->seconds > 0 ? nowMs() + conf->seconds * 1e3 : 0;
+	size_t seq = 0;
+	size_t i;
+
+	memset(handles, 0, sizeof(handles));
+	memset(requests, 0, sizeof(requests));
+
+	while (deadline > 0 ? nowMs() < deadline : seq < conf->requests) {
+		size_t n = conf->batch;
+		double start;
+		double elapsed;
+		int res = KSI_OK;
+
+		if (deadline == 0 && conf->requests - seq < n) n = conf->requests - seq;
+
+		start = nowMs();
+
+		for (i = 0; i < n; i++) {
+			res = sendRequest(w, seq + i, &handles[i], &requests[i]);
+			if (res != KSI_OK) break;
+		}
+
+		if (res == KSI_OK) {
+			res = n == 1 ? KSI_RequestHandle_perform(handles[0]) : KSI_NetworkClient_performAll(w->ksi->netProvider, handles, n);
+		}
+
+		elapsed = nowMs() - start;
+
+		for (i = 0; i < n; i++) {
+			int status = res;
+
+			if (status == KSI_OK) status = handles[i] != NULL ? checkResponse(w, handles[i], requests[i]) : KSI_INVALID_STATE;
+
+			if (status == KSI_OK) {
+				addLatency(w, elapsed);
+			} else {
+				w->failures++;
+				w->lastError = status;
+			}
+
+			KSI_RequestHandle_free(handles[i]);
+			freeRequest(w, requests[i]);
+			handles[i] = NULL;
+			requests[i] = NULL;
+		}
+
+		KSI_ERR_clearErrors(w->ksi);
+		seq += n;
+	}
+
+	return KSI_OK;
+}
+
+static int createContext(const Config *conf, KSI_CTX **ksi) {
+	int res;
+	KSI_CTX *tmp = NULL;
+
+	res = KSI_CTX_new(&tmp);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_CTX_setFlag(tmp, KSI_CTX_FLAG_AGGR_PDU_VER, (void *)conf->version);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_CTX_setFlag(tmp, KSI_CTX_FLAG_EXT_PDU_VER, (void *)conf->version);
+	if (res != KSI_OK) goto cleanup;
+
+	if (conf->aggrUri != NULL) {
+		res = KSI_CTX_setAggregator(tmp, conf->aggrUri, conf->user, conf->pass);
+	} else {
+		res = KSI_CTX_setExtender(tmp, conf->extUri, conf->user, conf->pass);
+	}
+	if (res != KSI_OK) goto cleanup;
+
+	*ksi = tmp;
+	tmp = NULL;
+
+cleanup:
+
+	KSI_CTX_free(tmp);
+
+	return res;
+}
+
+static int compareDouble(const void *a, const void *b) {
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static double percentile(const double *sorted, size_t len, double p) {
+	size_t i = (size_t)(p * (double)(len - 1) + 0.5);
+	return sorted[i < len ? i : len - 1];
+}
+
+static void printHelp(const char *exec) {
+	fprintf(stderr, "Usage:\n"
+			"  %s -a <aggregator uri> | -x <extender uri> [options]\n"
+			"\n"
+			"Options:\n"
+			"  -a <uri>        Send aggregation requests to the given service.\n"
+			"  -x <uri>        Send extending requests to the given service.\n"
+			"  -u <user>       Login id (default '%s').\n"
+			"  -k <key>        HMAC key (default '%s').\n"
+			"  -c <threads>    Number of concurrent client threads (default 4).\n"
+			"  -n <requests>   Number of requests per thread (default 100).\n"
+			"  -d <seconds>    Run for the given time instead of a fixed number of requests.\n"
+			"  -b <batch>      Requests performed together by KSI_NetworkClient_performAll (default 1, max %d).\n"
+			"  -v <version>    PDU version (default 1).\n"
+			"  -T <time>       Aggregation time of the extending requests (default: a minute ago).\n"
+			"  -P <time>       Publication time of the extending requests (default: the latest).\n",
+			exec, DEFAULT_USER, DEFAULT_PASS, MAX_BATCH);
+}
+
+int main(int argc, char **argv) {
+	int res = KSI_UNKNOWN_ERROR;
+	Config conf;
+	Worker *workers = NULL;
+	double *all = NULL;
+	size_t all_len = 0;
+	size_t failures = 0;
+	double start;
+	double elapsed;
+	double sum = 0;
+	size_t i;
+	int arg;
+
+	memset(&conf, 0, sizeof(conf));
+	conf.user = DEFAULT_USER;
+	conf.pass = DEFAULT_PASS;
+	conf.threads = 4;
+	conf.requests = 100;
+	conf.batch = 1;
+	conf.version = KSI_PDU_VERSION_1;
+	conf.aggrTime = (KSI_uint64_t)time(NULL) - 60;
+
+	for (arg = 1; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+		const char *val = argv[arg + 1];
+
+		if (strcmp(argv[arg], "-a") == 0) {
+			conf.aggrUri = val;
+		} else if (strcmp(argv[arg], "-x") == 0) {
+			conf.extUri = val;
+		} else if (strcmp(argv[arg], "-u") == 0) {
+			conf.user = val;
+		} else if (strcmp(argv[arg], "-k") == 0) {
+			conf.pass = val;
+		} else if (strcmp(argv[arg], "-c") == 0) {
+			conf.threads = (size_t)atoi(val);
+		} else if (strcmp(argv[arg], "-n") == 0) {
+			conf.requests = (size_t)atoi(val);
+		} else if (strcmp(argv[arg], "-d") == 0) {
+			conf.seconds = atof(val);
+		} else if (strcmp(argv[arg], "-b") == 0) {
+			conf.batch = (size_t)atoi(val);
+		} else if (strcmp(argv[arg], "-v") == 0) {
+			conf.version = (size_t)atoi(val);
+		} else if (strcmp(argv[arg], "-T") == 0) {
+			conf.aggrTime = (KSI_uint64_t)strtoul(val, NULL, 10);
+		} else if (strcmp(argv[arg], "-P") == 0) {
+			conf.pubTime = (KSI_uint64_t)strtoul(val, NULL, 10);
+		} else {
+			break;
+		}
+	}
+
+	if (arg != argc || (conf.aggrUri == NULL) == (conf.extUri == NULL) || conf.threads == 0 ||
+			conf.batch == 0 || conf.batch > MAX_BATCH || (conf.requests == 0 && conf.seconds <= 0) ||
+			(conf.version != KSI_PDU_VERSION_1 && conf.version != KSI_PDU_VERSION_2)) {
+		printHelp(argv[0]);
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	workers = calloc(conf.threads, sizeof(Worker));
+	if (workers == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	for (i = 0; i < conf.threads; i++) {
+		workers[i].conf = &conf;
+		workers[i].id = i;
+
+		res = createContext(&conf, &workers[i].ksi);
+		if (res != KSI_OK) {
+			fprintf(stderr, "Unable to configure the client (%s).\n", KSI_getErrorString(res));
+			goto cleanup;
+		}
+	}
+
+	start = nowMs();
+	for (i = 0; i < conf.threads; i++) {
+		res = KSI_Thread_start(workers[i].ksi, workerThread, &workers[i], &workers[i].thread);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	for (i = 0; i < conf.threads; i++) {
+		KSI_Thread_join(workers[i].thread, NULL);
+	}
+	elapsed = nowMs() - start;
+
+	for (i = 0; i < conf.threads; i++) {
+		all_len += workers[i].latencies_len;
+		failures += workers[i].failures;
+	}
+
+	all = malloc((all_len > 0 ? all_len : 1) * sizeof(double));
+	if (all == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	all_len = 0;
+	for (i = 0; i < conf.threads; i++) {
+		memcpy(all + all_len, workers[i].latencies, workers[i].latencies_len * sizeof(double));
+		all_len += workers[i].latencies_len;
+		if (workers[i].failures > 0) {
+			fprintf(stderr, "Thread %lu: %lu failed request(s), last error: %s\n", (unsigned long)i,
+					(unsigned long)workers[i].failures, KSI_getErrorString(workers[i].lastError));
+		}
+	}
+
+	qsort(all, all_len, sizeof(double), compareDouble);
+	for (i = 0; i < all_len; i++) sum += all[i];
+
+	printf("Service:      %s\n", conf.aggrUri != NULL ? conf.aggrUri : conf.extUri);
+	printf("Concurrency:  %lu thread(s) x %lu request(s) per batch\n", (unsigned long)conf.threads, (unsigned long)conf.batch);
+	printf("Completed:    %lu request(s), %lu failure(s) in %.3f s\n", (unsigned long)all_len, (unsigned long)failures, elapsed / 1e3);
+	printf("Throughput:   %.1f requests/s\n", elapsed > 0 ? (double)all_len * 1e3 / elapsed : 0.0);
+	if (all_len > 0) {
+		printf("Latency ms:   min %.3f mean %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f\n",
+				all[0], sum / (double)all_len, percentile(all, all_len, 0.5), percentile(all, all_len, 0.9),
+				percentile(all, all_len, 0.99), all[all_len - 1]);
+	}
+
+	res = failures == 0 ? KSI_OK : KSI_UNKNOWN_ERROR;
+
+cleanup:
+
+	if (workers != NULL) {
+		for (i = 0; i < conf.threads; i++) {
+			KSI_Thread_free(workers[i].thread);
+			KSI_CTX_free(workers[i].ksi);
+			free(workers[i].latencies);
+		}
+	}
+	free(workers);
+	free(all);
+
+	/* The status codes do not fit into the exit code. */
+	return res == KSI_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
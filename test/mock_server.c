@@ -0,0 +1,1810 @@
+/*
+ * Copyright 2013-2016 Guardtime, Inc.
+ *
+ * This file is part of the Guardtime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES, CONDITIONS, OR OTHER LICENSES OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ * "Guardtime" and "KSI" are trademarks or registered trademarks of
+ * Guardtime, Inc., and no license to trademarks is granted; Guardtime
+ * reserves and retains all trademark rights.
+ */
+
+/*
+ * A local stand-in for the aggregation and extending services, meant for
+ * measuring the network clients without external services. Both protocols are
+ * served over plain TCP (ksi+tcp://) and HTTP on the loopback interface. The
+ * aggregation requests are collected into rounds and aggregated with
+ * KSI_TreeBuilder. Every round root becomes a leaf of a local hash calendar
+ * which is used for the calendar chains of both the aggregation and the
+ * extending responses. The calendar clock advances at least one second per
+ * round, so with rounds shorter than a second it runs ahead of the wall clock.
+ * The responses are protected with the HMAC of the configured test key. The
+ * signatures are internally consistent, but of course can not be verified
+ * against any real publication.
+ */
+
+#include <stdio.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#ifndef _WIN32
+#  include <unistd.h>
+#  include <sys/types.h>
+#  include <sys/socket.h>
+#  include <sys/select.h>
+#  include <netinet/in.h>
+#  include <arpa/inet.h>
+#  define closesocket(soc) close(soc)
+#  define SD_BOTH SHUT_RDWR
+#else
+#  include <winsock2.h>
+#  include <ws2tcpip.h>
+#endif
+
+#include <ksi/ksi.h>
+#include <ksi/tree_builder.h>
+#include <ksi/hashchain.h>
+#include <ksi/compatibility.h>
+#include <ksi/hmac.h>
+
+#include "../src/ksi/internal.h"
+#include "../src/ksi/fast_tlv.h"
+#include "../src/ksi/thread.h"
+
+#define SERVER_USER "anon"
+#define SERVER_PASS "anon"
+
+#define DEFAULT_TCP_PORT 3333
+#define DEFAULT_HTTP_PORT 8080
+#define DEFAULT_ROUND_MS 100
+
+/* All the calendar values are SHA-256 imprints. */
+#define CAL_ALGO KSI_HASHALG_SHA2_256
+#define CAL_IMPRINT_LEN 33
+
+/* Responses are authenticated with a SHA-256 HMAC. */
+#define HMAC_DIGEST_LEN 32
+
+#define MAX_PDU_LEN (0xffff + 4)
+#define MAX_HTTP_HEADER_LEN 8192
+#define CONN_BUF_LEN (MAX_PDU_LEN + MAX_HTTP_HEADER_LEN)
+#define CTX_POOL_LEN 64
+
+/* Service status codes. */
+#define STATUS_OK 0x00
+#define STATUS_INVALID_REQUEST 0x0101
+#define STATUS_AUTHENTICATION_FAILURE 0x0102
+#define STATUS_INVALID_TIME_RANGE 0x0104
+#define STATUS_TIME_IN_FUTURE 0x0107
+#define STATUS_INTERNAL_ERROR 0x0200
+
+/** Memoized hash value of a calendar subtree. */
+typedef struct CalendarNode_st {
+	KSI_uint64_t lo;
+	KSI_uint64_t r;
+	int used;
+	unsigned char imprint[CAL_IMPRINT_LEN];
+} CalendarNode;
+
+/**
+ * The calendar is a tree over the seconds 0..last, shaped like the calendar
+ * chains expect. Only the seconds with an aggregation round have a real leaf
+ * value, the subtrees without rounds get a value derived from their range.
+ */
+typedef struct Calendar_st {
+	KSI_uint64_t last;
+	/* Round times in increasing order and the matching root imprints. */
+	KSI_uint64_t *times;
+	unsigned char *roots;
+	size_t len;
+	size_t size;
+	/* Open addressing table of the computed subtrees. As new rounds are only
+	 * added after the last second, a computed subtree never changes. */
+	CalendarNode *nodes;
+	size_t nodes_len;
+	size_t nodes_size;
+} Calendar;
+
+/** An aggregation request waiting for the end of the round. */
+typedef struct PendingRequest_st {
+	size_t version;
+	KSI_uint64_t requestId;
+	unsigned char imprint[KSI_MAX_IMPRINT_LEN];
+	size_t imprint_len;
+	int level;
+	unsigned char *response;
+	size_t response_len;
+	int done;
+	struct PendingRequest_st *next;
+} PendingRequest;
+
+typedef struct Server_st Server;
+
+typedef struct Connection_st {
+	Server *srv;
+	int fd;
+	int http;
+	int done;
+	KSI_Thread *thread;
+	unsigned char buf[CONN_BUF_LEN];
+	size_t buf_len;
+	struct Connection_st *next;
+} Connection;
+
+struct Server_st {
+	/* Used only by the main thread. */
+	KSI_CTX *ksi;
+	/* Used only by the round thread. */
+	KSI_CTX *roundKsi;
+	const char *user;
+	const char *pass;
+	unsigned roundMs;
+
+	/* Protects the fields up to the calendar. */
+	KSI_Mutex *lock;
+	KSI_Cond *roundDone;
+	int stop;
+	PendingRequest *head;
+	PendingRequest **tail;
+	KSI_CTX *ctxPool[CTX_POOL_LEN];
+	size_t ctxPool_len;
+	size_t rounds;
+	size_t maxRound;
+	size_t aggrRequests;
+	size_t extRequests;
+	size_t failures;
+
+	KSI_Mutex *calLock;
+	Calendar cal;
+};
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void onSignal(int sig) {
+	(void)sig;
+	interrupted = 1;
+}
+
+static void sleepMs(unsigned ms) {
+#ifdef _WIN32
+	Sleep(ms);
+#else
+	struct timespec ts;
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (long)(ms % 1000) * 1000000;
+	nanosleep(&ts, NULL);
+#endif
+}
+
+static KSI_uint64_t highBit(KSI_uint64_t n) {
+	n |= (n >>  1);
+	n |= (n >>  2);
+	n |= (n >>  4);
+	n |= (n >>  8);
+	n |= (n >> 16);
+	n |= (n >> 32);
+	return n - (n >> 1);
+}
+
+static int hashToImprint(const KSI_DataHash *hsh, unsigned char *imprint) {
+	int res;
+	const unsigned char *imp = NULL;
+	size_t imp_len = 0;
+
+	res = KSI_DataHash_getImprint(hsh, &imp, &imp_len);
+	if (res != KSI_OK) return res;
+
+	if (imp_len != CAL_IMPRINT_LEN) return KSI_INVALID_FORMAT;
+
+	memcpy(imprint, imp, imp_len);
+	return KSI_OK;
+}
+
+static void calendarFree(Calendar *cal) {
+	free(cal->times);
+	free(cal->roots);
+	free(cal->nodes);
+	memset(cal, 0, sizeof(*cal));
+}
+
+/* Returns non-zero, if there is a round in [lo, hi]; \c pos receives the index of the first one. */
+static int calendarFind(const Calendar *cal, KSI_uint64_t lo, KSI_uint64_t hi, size_t *pos) {
+	size_t l = 0;
+	size_t h = cal->len;
+
+	while (l < h) {
+		size_t m = l + (h - l) / 2;
+		if (cal->times[m] < lo) {
+			l = m + 1;
+		} else {
+			h = m;
+		}
+	}
+
+	*pos = l;
+	return l < cal->len && cal->times[l] <= hi;
+}
+
+static CalendarNode *calendarSlot(const Calendar *cal, KSI_uint64_t lo, KSI_uint64_t r) {
+	KSI_uint64_t h = (lo * 2654435761u) ^ (r * 40503u);
+	size_t i = (size_t)(h ^ (h >> 29)) & (cal->nodes_size - 1);
+
+	while (cal->nodes[i].used && (cal->nodes[i].lo != lo || cal->nodes[i].r != r)) {
+		i = (i + 1) & (cal->nodes_size - 1);
+	}
+
+	return &cal->nodes[i];
+}
+
+static int calendarCacheAdd(Calendar *cal, KSI_uint64_t lo, KSI_uint64_t r, const unsigned char *imprint) {
+	CalendarNode *slot = NULL;
+
+	if (2 * (cal->nodes_len + 1) > cal->nodes_size) {
+		CalendarNode *old = cal->nodes;
+		size_t old_size = cal->nodes_size;
+		size_t i;
+
+		cal->nodes_size = old_size == 0 ? 1024 : 2 * old_size;
+		cal->nodes = calloc(cal->nodes_size, sizeof(CalendarNode));
+		if (cal->nodes == NULL) {
+			cal->nodes = old;
+			cal->nodes_size = old_size;
+			return KSI_OUT_OF_MEMORY;
+		}
+
+		for (i = 0; i < old_size; i++) {
+			if (old[i].used) *calendarSlot(cal, old[i].lo, old[i].r) = old[i];
+		}
+		free(old);
+	}
+
+	slot = calendarSlot(cal, lo, r);
+	if (!slot->used) {
+		slot->used = 1;
+		slot->lo = lo;
+		slot->r = r;
+		memcpy(slot->imprint, imprint, CAL_IMPRINT_LEN);
+		cal->nodes_len++;
+	}
+
+	return KSI_OK;
+}
+
+/* Value of a subtree without any rounds. */
+static int calendarFiller(KSI_CTX *ctx, KSI_uint64_t lo, KSI_uint64_t r, unsigned char *imprint) {
+	int res;
+	KSI_DataHasher *hsr = NULL;
+	KSI_DataHash *hsh = NULL;
+	unsigned char buf[16];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		buf[i] = (unsigned char)(lo >> (56 - 8 * i));
+		buf[8 + i] = (unsigned char)(r >> (56 - 8 * i));
+	}
+
+	res = KSI_DataHasher_open(ctx, CAL_ALGO, &hsr);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_DataHasher_add(hsr, "mock-calendar", 13);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_DataHasher_add(hsr, buf, sizeof(buf));
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_DataHasher_close(hsr, &hsh);
+	if (res != KSI_OK) goto cleanup;
+
+	res = hashToImprint(hsh, imprint);
+
+cleanup:
+
+	KSI_DataHash_free(hsh);
+	KSI_DataHasher_free(hsr);
+
+	return res;
+}
+
+/* Value of the subtree over the seconds [lo, lo + r]. */
+static int calendarNode(KSI_CTX *ctx, Calendar *cal, KSI_uint64_t lo, KSI_uint64_t r, unsigned char *imprint) {
+	int res;
+	KSI_DataHasher *hsr = NULL;
+	KSI_DataHash *hsh = NULL;
+	unsigned char left[CAL_IMPRINT_LEN];
+	unsigned char right[CAL_IMPRINT_LEN];
+	unsigned char level = 0xff;
+	CalendarNode *node = NULL;
+	KSI_uint64_t hb;
+	size_t pos;
+
+	if (!calendarFind(cal, lo, lo + r, &pos)) {
+		return calendarFiller(ctx, lo, r, imprint);
+	}
+
+	if (r == 0) {
+		memcpy(imprint, cal->roots + pos * CAL_IMPRINT_LEN, CAL_IMPRINT_LEN);
+		return KSI_OK;
+	}
+
+	if (cal->nodes_size > 0) {
+		node = calendarSlot(cal, lo, r);
+		if (node->used) {
+			memcpy(imprint, node->imprint, CAL_IMPRINT_LEN);
+			return KSI_OK;
+		}
+	}
+
+	hb = highBit(r);
+
+	res = calendarNode(ctx, cal, lo, hb - 1, left);
+	if (res != KSI_OK) goto cleanup;
+
+	res = calendarNode(ctx, cal, lo + hb, r - hb, right);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_DataHasher_open(ctx, CAL_ALGO, &hsr);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_DataHasher_add(hsr, left, sizeof(left));
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_DataHasher_add(hsr, right, sizeof(right));
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_DataHasher_add(hsr, &level, 1);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_DataHasher_close(hsr, &hsh);
+	if (res != KSI_OK) goto cleanup;
+
+	res = hashToImprint(hsh, imprint);
+	if (res != KSI_OK) goto cleanup;
+
+	res = calendarCacheAdd(cal, lo, r, imprint);
+
+cleanup:
+
+	KSI_DataHash_free(hsh);
+	KSI_DataHasher_free(hsr);
+
+	return res;
+}
+
+/* Registers a new round root, the calendar time is returned via \c aggrTime. */
+static int calendarAppend(Calendar *cal, const unsigned char *root, KSI_uint64_t *aggrTime) {
+	KSI_uint64_t now = (KSI_uint64_t)time(NULL);
+	KSI_uint64_t t = now > cal->last ? now : cal->last + 1;
+
+	if (cal->len == cal->size) {
+		size_t size = cal->size == 0 ? 1024 : 2 * cal->size;
+		KSI_uint64_t *times = realloc(cal->times, size * sizeof(KSI_uint64_t));
+		unsigned char *roots = NULL;
+
+		if (times == NULL) return KSI_OUT_OF_MEMORY;
+		cal->times = times;
+
+		roots = realloc(cal->roots, size * CAL_IMPRINT_LEN);
+		if (roots == NULL) return KSI_OUT_OF_MEMORY;
+		cal->roots = roots;
+
+		cal->size = size;
+	}
+
+	cal->times[cal->len] = t;
+	memcpy(cal->roots + cal->len * CAL_IMPRINT_LEN, root, CAL_IMPRINT_LEN);
+	cal->len++;
+	cal->last = t;
+
+	*aggrTime = t;
+	return KSI_OK;
+}
+
+/* Creates the calendar chain from the second \c aggrTime to the root of the calendar at \c pubTime. */
+static int calendarChain(KSI_CTX *ctx, Calendar *cal, KSI_uint64_t aggrTime, KSI_uint64_t pubTime, KSI_CalendarHashChain **chain) {
+	int res;
+	struct {
+		int isLeft;
+		unsigned char imprint[CAL_IMPRINT_LEN];
+	} path[64];
+	size_t path_len = 0;
+	unsigned char leaf[CAL_IMPRINT_LEN];
+	KSI_uint64_t lo = 0;
+	KSI_uint64_t r = pubTime;
+	KSI_uint64_t off = aggrTime;
+	KSI_CalendarHashChain *tmp = NULL;
+	KSI_LIST(KSI_HashChainLink) *links = NULL;
+	KSI_HashChainLink *link = NULL;
+	KSI_DataHash *hsh = NULL;
+	KSI_Integer *tm = NULL;
+
+	/* Walk from the root to the leaf the same way the aggregation time is computed. */
+	while (r > 0) {
+		KSI_uint64_t hb = highBit(r);
+
+		if (off < hb) {
+			path[path_len].isLeft = 1;
+			res = calendarNode(ctx, cal, lo + hb, r - hb, path[path_len].imprint);
+			r = hb - 1;
+		} else {
+			path[path_len].isLeft = 0;
+			res = calendarNode(ctx, cal, lo, hb - 1, path[path_len].imprint);
+			lo += hb;
+			off -= hb;
+			r -= hb;
+		}
+		if (res != KSI_OK) goto cleanup;
+		path_len++;
+	}
+
+	res = calendarNode(ctx, cal, aggrTime, 0, leaf);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_HashChainLinkList_new(&links);
+	if (res != KSI_OK) goto cleanup;
+
+	while (path_len > 0) {
+		path_len--;
+
+		res = KSI_HashChainLink_new(ctx, &link);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_HashChainLink_setIsLeft(link, path[path_len].isLeft);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_DataHash_fromImprint(ctx, path[path_len].imprint, CAL_IMPRINT_LEN, &hsh);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_HashChainLink_setImprint(link, hsh);
+		if (res != KSI_OK) goto cleanup;
+		hsh = NULL;
+
+		res = KSI_HashChainLinkList_append(links, link);
+		if (res != KSI_OK) goto cleanup;
+		link = NULL;
+	}
+
+	res = KSI_CalendarHashChain_new(ctx, &tmp);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_CalendarHashChain_setHashChain(tmp, links);
+	if (res != KSI_OK) goto cleanup;
+	links = NULL;
+
+	res = KSI_DataHash_fromImprint(ctx, leaf, CAL_IMPRINT_LEN, &hsh);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_CalendarHashChain_setInputHash(tmp, hsh);
+	if (res != KSI_OK) goto cleanup;
+	hsh = NULL;
+
+	res = KSI_Integer_new(ctx, pubTime, &tm);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_CalendarHashChain_setPublicationTime(tmp, tm);
+	if (res != KSI_OK) goto cleanup;
+	tm = NULL;
+
+	res = KSI_Integer_new(ctx, aggrTime, &tm);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_CalendarHashChain_setAggregationTime(tmp, tm);
+	if (res != KSI_OK) goto cleanup;
+	tm = NULL;
+
+	*chain = tmp;
+	tmp = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_Integer_free(tm);
+	KSI_DataHash_free(hsh);
+	KSI_HashChainLink_free(link);
+	KSI_HashChainLinkList_free(links);
+	KSI_CalendarHashChain_free(tmp);
+
+	return res;
+}
+
+static int newHeader(KSI_CTX *ctx, const char *user, KSI_Header **hdr) {
+	int res;
+	KSI_Header *tmp = NULL;
+	KSI_Utf8String *loginId = NULL;
+
+	res = KSI_Header_new(ctx, &tmp);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Utf8String_new(ctx, user, strlen(user) + 1, &loginId);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Header_setLoginId(tmp, loginId);
+	if (res != KSI_OK) goto cleanup;
+	loginId = NULL;
+
+	*hdr = tmp;
+	tmp = NULL;
+
+cleanup:
+
+	KSI_Utf8String_free(loginId);
+	KSI_Header_free(tmp);
+
+	return res;
+}
+
+/* Checks the login id and the HMAC of a request PDU. */
+static int checkAuthentication(Server *srv, KSI_Header *hdr, KSI_DataHash *hmac, KSI_DataHash *(*calc)(void *, KSI_HashAlgorithm, const char *), void *pdu) {
+	KSI_Utf8String *loginId = NULL;
+	KSI_HashAlgorithm algo;
+	KSI_DataHash *actual = NULL;
+	int ok = 0;
+
+	if (hdr == NULL || hmac == NULL) goto cleanup;
+
+	if (KSI_Header_getLoginId(hdr, &loginId) != KSI_OK || loginId == NULL) goto cleanup;
+	if (strcmp(KSI_Utf8String_cstr(loginId), srv->user) != 0) goto cleanup;
+
+	if (KSI_DataHash_extract(hmac, &algo, NULL, NULL) != KSI_OK) goto cleanup;
+
+	actual = calc(pdu, algo, srv->pass);
+	ok = actual != NULL && KSI_DataHash_equals(hmac, actual);
+
+cleanup:
+
+	KSI_DataHash_free(actual);
+
+	return ok;
+}
+
+static KSI_DataHash *aggregationHmac(void *pdu, KSI_HashAlgorithm algo, const char *key) {
+	KSI_DataHash *hmac = NULL;
+	KSI_AggregationPdu_calculateHmac(pdu, algo, key, &hmac);
+	return hmac;
+}
+
+static KSI_DataHash *extendHmac(void *pdu, KSI_HashAlgorithm algo, const char *key) {
+	KSI_DataHash *hmac = NULL;
+	KSI_ExtendPdu_calculateHmac(pdu, algo, key, &hmac);
+	return hmac;
+}
+
+/**
+ * Calculates the HMAC of a serialized response PDU which ends with a zero SHA-256 HMAC and
+ * writes it over the zero digest. The HMAC is computed over the serialized bytes, so the
+ * response authenticates exactly the way the client verifies it for both PDU versions.
+ */
+static int signSerialized(KSI_CTX *ctx, size_t version, const char *key, unsigned char *raw, size_t raw_len) {
+	int res;
+	KSI_FTLV ftlv;
+	KSI_DataHash *hmac = NULL;
+	const unsigned char *digest = NULL;
+	size_t digest_len = 0;
+	const unsigned char *data = raw;
+	size_t data_len = raw_len - HMAC_DIGEST_LEN;
+
+	if (raw_len < HMAC_DIGEST_LEN + 3 || raw[raw_len - HMAC_DIGEST_LEN - 3] != 0x1f) {
+		res = KSI_INVALID_FORMAT;
+		goto cleanup;
+	}
+
+	if (version == KSI_PDU_VERSION_1) {
+		/* Version 1 authenticates the header and the payload, without the enclosing TLV header. */
+		res = KSI_FTLV_memRead(raw, raw_len, &ftlv);
+		if (res != KSI_OK) goto cleanup;
+
+		data = raw + ftlv.hdr_len;
+		data_len = raw_len - ftlv.hdr_len - HMAC_DIGEST_LEN - 3;
+	}
+
+	res = KSI_HMAC_create(ctx, KSI_HASHALG_SHA2_256, key, data, data_len, &hmac);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_DataHash_extract(hmac, NULL, &digest, &digest_len);
+	if (res != KSI_OK) goto cleanup;
+
+	if (digest_len != HMAC_DIGEST_LEN) {
+		res = KSI_UNKNOWN_ERROR;
+		goto cleanup;
+	}
+
+	memcpy(raw + raw_len - HMAC_DIGEST_LEN, digest, digest_len);
+
+cleanup:
+
+	KSI_DataHash_free(hmac);
+
+	return res;
+}
+
+/* Encloses the response into a PDU of the given version and serializes it. Takes ownership of \c resp. */
+static int serializeAggregationResponse(Server *srv, KSI_CTX *ctx, size_t version, KSI_AggregationResp *resp, unsigned char **raw, size_t *raw_len) {
+	int res;
+	KSI_AggregationPdu *pdu = NULL;
+	KSI_Header *hdr = NULL;
+	KSI_DataHash *hmac = NULL;
+
+	res = KSI_CTX_setFlag(ctx, KSI_CTX_FLAG_AGGR_PDU_VER, (void *)version);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_AggregationPdu_new(ctx, &pdu);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_AggregationPdu_setResponse(pdu, resp);
+	if (res != KSI_OK) goto cleanup;
+	resp = NULL;
+
+	res = newHeader(ctx, srv->user, &hdr);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_AggregationPdu_setHeader(pdu, hdr);
+	if (res != KSI_OK) goto cleanup;
+	hdr = NULL;
+
+	res = KSI_DataHash_createZero(ctx, KSI_HASHALG_SHA2_256, &hmac);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_AggregationPdu_setHmac(pdu, hmac);
+	if (res != KSI_OK) goto cleanup;
+	hmac = NULL;
+
+	res = KSI_AggregationPdu_serialize(pdu, raw, raw_len);
+	if (res != KSI_OK) goto cleanup;
+
+	res = signSerialized(ctx, version, srv->pass, *raw, *raw_len);
+
+cleanup:
+
+	KSI_DataHash_free(hmac);
+	KSI_Header_free(hdr);
+	KSI_AggregationResp_free(resp);
+	KSI_AggregationPdu_free(pdu);
+
+	return res;
+}
+
+static int serializeExtendResponse(Server *srv, KSI_CTX *ctx, size_t version, KSI_ExtendResp *resp, unsigned char **raw, size_t *raw_len) {
+	int res;
+	KSI_ExtendPdu *pdu = NULL;
+	KSI_Header *hdr = NULL;
+	KSI_DataHash *hmac = NULL;
+
+	res = KSI_CTX_setFlag(ctx, KSI_CTX_FLAG_EXT_PDU_VER, (void *)version);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_ExtendPdu_new(ctx, &pdu);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_ExtendPdu_setResponse(pdu, resp);
+	if (res != KSI_OK) goto cleanup;
+	resp = NULL;
+
+	res = newHeader(ctx, srv->user, &hdr);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_ExtendPdu_setHeader(pdu, hdr);
+	if (res != KSI_OK) goto cleanup;
+	hdr = NULL;
+
+	res = KSI_DataHash_createZero(ctx, KSI_HASHALG_SHA2_256, &hmac);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_ExtendPdu_setHmac(pdu, hmac);
+	if (res != KSI_OK) goto cleanup;
+	hmac = NULL;
+
+	res = KSI_ExtendPdu_serialize(pdu, raw, raw_len);
+	if (res != KSI_OK) goto cleanup;
+
+	res = signSerialized(ctx, version, srv->pass, *raw, *raw_len);
+
+cleanup:
+
+	KSI_DataHash_free(hmac);
+	KSI_Header_free(hdr);
+	KSI_ExtendResp_free(resp);
+	KSI_ExtendPdu_free(pdu);
+
+	return res;
+}
+
+static int aggregationStatusResponse(Server *srv, KSI_CTX *ctx, size_t version, KSI_uint64_t requestId, KSI_uint64_t status, const char *msg, unsigned char **raw, size_t *raw_len) {
+	int res;
+	KSI_AggregationResp *resp = NULL;
+	KSI_Integer *tmp = NULL;
+	KSI_Utf8String *errorMsg = NULL;
+
+	res = KSI_AggregationResp_new(ctx, &resp);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Integer_new(ctx, requestId, &tmp);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_AggregationResp_setRequestId(resp, tmp);
+	if (res != KSI_OK) goto cleanup;
+	tmp = NULL;
+
+	res = KSI_Integer_new(ctx, status, &tmp);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_AggregationResp_setStatus(resp, tmp);
+	if (res != KSI_OK) goto cleanup;
+	tmp = NULL;
+
+	res = KSI_Utf8String_new(ctx, msg, strlen(msg) + 1, &errorMsg);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_AggregationResp_setErrorMsg(resp, errorMsg);
+	if (res != KSI_OK) goto cleanup;
+	errorMsg = NULL;
+
+	res = serializeAggregationResponse(srv, ctx, version, resp, raw, raw_len);
+	resp = NULL;
+
+cleanup:
+
+	KSI_Utf8String_free(errorMsg);
+	KSI_Integer_free(tmp);
+	KSI_AggregationResp_free(resp);
+
+	return res;
+}
+
+static int extendStatusResponse(Server *srv, KSI_CTX *ctx, size_t version, KSI_uint64_t requestId, KSI_uint64_t status, const char *msg, unsigned char **raw, size_t *raw_len) {
+	int res;
+	KSI_ExtendResp *resp = NULL;
+	KSI_Integer *tmp = NULL;
+	KSI_Utf8String *errorMsg = NULL;
+
+	res = KSI_ExtendResp_new(ctx, &resp);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Integer_new(ctx, requestId, &tmp);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_ExtendResp_setRequestId(resp, tmp);
+	if (res != KSI_OK) goto cleanup;
+	tmp = NULL;
+
+	res = KSI_Integer_new(ctx, status, &tmp);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_ExtendResp_setStatus(resp, tmp);
+	if (res != KSI_OK) goto cleanup;
+	tmp = NULL;
+
+	res = KSI_Utf8String_new(ctx, msg, strlen(msg) + 1, &errorMsg);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_ExtendResp_setErrorMsg(resp, errorMsg);
+	if (res != KSI_OK) goto cleanup;
+	errorMsg = NULL;
+
+	res = serializeExtendResponse(srv, ctx, version, resp, raw, raw_len);
+	resp = NULL;
+
+cleanup:
+
+	KSI_Utf8String_free(errorMsg);
+	KSI_Integer_free(tmp);
+	KSI_ExtendResp_free(resp);
+
+	return res;
+}
+
+/**
+ * Answers a request that could not be authenticated with an error PDU. The client looks at the
+ * error before the HMAC of the response, so it reports the status even though the response is
+ * not authenticated with its key. Version 2 error PDUs still carry a header and an HMAC.
+ */
+static int authFailureResponse(Server *srv, KSI_CTX *ctx, int aggregation, size_t version, unsigned char **raw, size_t *raw_len) {
+	int res;
+	KSI_AggregationPdu *aggrPdu = NULL;
+	KSI_ExtendPdu *extPdu = NULL;
+	KSI_ErrorPdu *err = NULL;
+	KSI_Integer *status = NULL;
+	KSI_Utf8String *errorMsg = NULL;
+	KSI_Header *hdr = NULL;
+	KSI_DataHash *hmac = NULL;
+	const char *msg = "The request could not be authenticated.";
+
+	res = KSI_ErrorPdu_new(ctx, &err);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Integer_new(ctx, STATUS_AUTHENTICATION_FAILURE, &status);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_ErrorPdu_setStatus(err, status);
+	if (res != KSI_OK) goto cleanup;
+	status = NULL;
+
+	res = KSI_Utf8String_new(ctx, msg, strlen(msg) + 1, &errorMsg);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_ErrorPdu_setErrorMessage(err, errorMsg);
+	if (res != KSI_OK) goto cleanup;
+	errorMsg = NULL;
+
+	if (version == KSI_PDU_VERSION_2) {
+		res = newHeader(ctx, srv->user, &hdr);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_DataHash_createZero(ctx, KSI_HASHALG_SHA2_256, &hmac);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	if (aggregation) {
+		res = KSI_CTX_setFlag(ctx, KSI_CTX_FLAG_AGGR_PDU_VER, (void *)version);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_AggregationPdu_new(ctx, &aggrPdu);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_AggregationPdu_setError(aggrPdu, err);
+		if (res != KSI_OK) goto cleanup;
+		err = NULL;
+
+		res = KSI_AggregationPdu_setHeader(aggrPdu, hdr);
+		if (res != KSI_OK) goto cleanup;
+		hdr = NULL;
+
+		res = KSI_AggregationPdu_setHmac(aggrPdu, hmac);
+		if (res != KSI_OK) goto cleanup;
+		hmac = NULL;
+
+		res = KSI_AggregationPdu_serialize(aggrPdu, raw, raw_len);
+	} else {
+		res = KSI_CTX_setFlag(ctx, KSI_CTX_FLAG_EXT_PDU_VER, (void *)version);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_ExtendPdu_new(ctx, &extPdu);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_ExtendPdu_setError(extPdu, err);
+		if (res != KSI_OK) goto cleanup;
+		err = NULL;
+
+		res = KSI_ExtendPdu_setHeader(extPdu, hdr);
+		if (res != KSI_OK) goto cleanup;
+		hdr = NULL;
+
+		res = KSI_ExtendPdu_setHmac(extPdu, hmac);
+		if (res != KSI_OK) goto cleanup;
+		hmac = NULL;
+
+		res = KSI_ExtendPdu_serialize(extPdu, raw, raw_len);
+	}
+	if (res != KSI_OK) goto cleanup;
+
+	if (version == KSI_PDU_VERSION_2) {
+		res = signSerialized(ctx, version, srv->pass, *raw, *raw_len);
+	}
+
+cleanup:
+
+	KSI_DataHash_free(hmac);
+	KSI_Header_free(hdr);
+	KSI_Utf8String_free(errorMsg);
+	KSI_Integer_free(status);
+	KSI_ErrorPdu_free(err);
+	KSI_AggregationPdu_free(aggrPdu);
+	KSI_ExtendPdu_free(extPdu);
+
+	return res;
+}
+
+typedef struct RoundState_st {
+	Server *srv;
+	KSI_CTX *ctx;
+	PendingRequest **requests;
+	KSI_Integer *aggrTime;
+	KSI_CalendarHashChain *calChain;
+} RoundState;
+
+static int roundChainCallback(void *c, size_t index, KSI_AggregationHashChain *chain) {
+	int res;
+	RoundState *state = c;
+	PendingRequest *req = state->requests[index];
+	KSI_AggregationResp *resp = NULL;
+	KSI_LIST(KSI_AggregationHashChain) *chains = NULL;
+	KSI_LIST(KSI_Integer) *chainIndex = NULL;
+	KSI_Integer *tmp = NULL;
+	KSI_uint64_t shape;
+
+	res = KSI_AggregationHashChain_setAggregationTime(chain, KSI_Integer_ref(state->aggrTime));
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_AggregationHashChain_calculateShape(chain, &shape);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_IntegerList_new(&chainIndex);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Integer_new(state->ctx, shape, &tmp);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_IntegerList_append(chainIndex, tmp);
+	if (res != KSI_OK) goto cleanup;
+	tmp = NULL;
+
+	res = KSI_AggregationHashChain_setChainIndex(chain, chainIndex);
+	if (res != KSI_OK) goto cleanup;
+	chainIndex = NULL;
+
+	res = KSI_AggregationHashChainList_new(&chains);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_AggregationHashChainList_append(chains, chain);
+	if (res != KSI_OK) goto cleanup;
+	chain = NULL;
+
+	res = KSI_AggregationResp_new(state->ctx, &resp);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_AggregationResp_setAggregationChainList(resp, chains);
+	if (res != KSI_OK) goto cleanup;
+	chains = NULL;
+
+	res = KSI_AggregationResp_setCalendarChain(resp, KSI_CalendarHashChain_ref(state->calChain));
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Integer_new(state->ctx, req->requestId, &tmp);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_AggregationResp_setRequestId(resp, tmp);
+	if (res != KSI_OK) goto cleanup;
+	tmp = NULL;
+
+	res = KSI_Integer_new(state->ctx, STATUS_OK, &tmp);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_AggregationResp_setStatus(resp, tmp);
+	if (res != KSI_OK) goto cleanup;
+	tmp = NULL;
+
+	res = serializeAggregationResponse(state->srv, state->ctx, req->version, resp, &req->response, &req->response_len);
+	resp = NULL;
+
+cleanup:
+
+	KSI_Integer_free(tmp);
+	KSI_IntegerList_free(chainIndex);
+	KSI_AggregationHashChainList_free(chains);
+	KSI_AggregationHashChain_free(chain);
+	KSI_AggregationResp_free(resp);
+
+	return res;
+}
+
+static int aggregateRound(Server *srv, KSI_CTX *ctx, PendingRequest *list, size_t count) {
+	int res;
+	RoundState state;
+	KSI_TreeBuilder *builder = NULL;
+	KSI_LIST(KSI_TreeLeafHandle) *leafs = NULL;
+	KSI_TreeLeafHandle *leaf = NULL;
+	KSI_DataHash *hsh = NULL;
+	unsigned char root[CAL_IMPRINT_LEN];
+	KSI_uint64_t aggrTime = 0;
+	PendingRequest *p = NULL;
+	size_t i;
+
+	memset(&state, 0, sizeof(state));
+	state.srv = srv;
+	state.ctx = ctx;
+
+	state.requests = malloc(count * sizeof(PendingRequest *));
+	if (state.requests == NULL) {
+		res = KSI_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	res = KSI_TreeBuilder_new(ctx, CAL_ALGO, &builder);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_TreeLeafHandleList_new(&leafs);
+	if (res != KSI_OK) goto cleanup;
+
+	for (p = list, i = 0; p != NULL; p = p->next, i++) {
+		state.requests[i] = p;
+
+		res = KSI_DataHash_fromImprint(ctx, p->imprint, p->imprint_len, &hsh);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_TreeBuilder_addDataHash(builder, hsh, p->level, &leaf);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_TreeLeafHandleList_append(leafs, leaf);
+		if (res != KSI_OK) goto cleanup;
+		leaf = NULL;
+
+		KSI_DataHash_free(hsh);
+		hsh = NULL;
+	}
+
+	/* A lonely request still needs a sibling to get a non-empty aggregation chain. */
+	if (count == 1) {
+		res = KSI_DataHash_createZero(ctx, CAL_ALGO, &hsh);
+		if (res != KSI_OK) goto cleanup;
+
+		res = KSI_TreeBuilder_addDataHash(builder, hsh, 0, NULL);
+		if (res != KSI_OK) goto cleanup;
+	}
+
+	res = KSI_TreeBuilder_close(builder);
+	if (res != KSI_OK) goto cleanup;
+
+	res = hashToImprint(builder->rootNode->hash, root);
+	if (res != KSI_OK) goto cleanup;
+
+	KSI_Mutex_lock(srv->calLock);
+	res = calendarAppend(&srv->cal, root, &aggrTime);
+	if (res == KSI_OK) {
+		res = calendarChain(ctx, &srv->cal, aggrTime, aggrTime, &state.calChain);
+	}
+	KSI_Mutex_unlock(srv->calLock);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Integer_new(ctx, aggrTime, &state.aggrTime);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_TreeBuilder_getAggregationChains(builder, leafs, roundChainCallback, &state);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_OK;
+
+cleanup:
+
+	free(state.requests);
+	KSI_Integer_free(state.aggrTime);
+	KSI_CalendarHashChain_free(state.calChain);
+	KSI_DataHash_free(hsh);
+	KSI_TreeLeafHandle_free(leaf);
+	KSI_TreeLeafHandleList_free(leafs);
+	KSI_TreeBuilder_free(builder);
+
+	return res;
+}
+
+static void closeRound(Server *srv, KSI_CTX *ctx) {
+	int res;
+	PendingRequest *list = NULL;
+	PendingRequest *p = NULL;
+	size_t count = 0;
+
+	KSI_Mutex_lock(srv->lock);
+	list = srv->head;
+	srv->head = NULL;
+	srv->tail = &srv->head;
+	KSI_Mutex_unlock(srv->lock);
+
+	if (list == NULL) return;
+
+	for (p = list; p != NULL; p = p->next) count++;
+
+	res = aggregateRound(srv, ctx, list, count);
+	if (res != KSI_OK) {
+		fprintf(stderr, "Aggregation round failed (%s).\n", KSI_getErrorString(res));
+	}
+
+	/* The requests without a response are answered with an internal error. */
+	KSI_Mutex_lock(srv->lock);
+	for (p = list; p != NULL; p = p->next) p->done = 1;
+	srv->rounds++;
+	if (count > srv->maxRound) srv->maxRound = count;
+	KSI_Cond_broadcast(srv->roundDone);
+	KSI_Mutex_unlock(srv->lock);
+
+	KSI_ERR_clearErrors(ctx);
+}
+
+static int roundThread(void *arg) {
+	Server *srv = arg;
+	int stop = 0;
+
+	while (!stop) {
+		sleepMs(srv->roundMs);
+
+		KSI_Mutex_lock(srv->lock);
+		stop = srv->stop;
+		KSI_Mutex_unlock(srv->lock);
+
+		/* The last round after the stop flag releases all the waiting requests. */
+		closeRound(srv, srv->roundKsi);
+	}
+
+	return KSI_OK;
+}
+
+static int handleAggregation(Server *srv, KSI_CTX *ctx, const unsigned char *raw, size_t raw_len, size_t version, unsigned char **resp, size_t *resp_len) {
+	int res;
+	KSI_AggregationPdu *pdu = NULL;
+	KSI_Header *hdr = NULL;
+	KSI_DataHash *hmac = NULL;
+	KSI_AggregationReq *req = NULL;
+	KSI_Integer *requestId = NULL;
+	KSI_Integer *level = NULL;
+	KSI_DataHash *hsh = NULL;
+	const unsigned char *imprint = NULL;
+	size_t imprint_len = 0;
+	PendingRequest pending;
+	KSI_uint64_t id = 0;
+	int stopped = 0;
+
+	memset(&pending, 0, sizeof(pending));
+
+	res = KSI_CTX_setFlag(ctx, KSI_CTX_FLAG_AGGR_PDU_VER, (void *)version);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_AggregationPdu_parse(ctx, raw, raw_len, &pdu);
+	if (res != KSI_OK) goto cleanup;
+
+	KSI_AggregationPdu_getHeader(pdu, &hdr);
+	KSI_AggregationPdu_getHmac(pdu, &hmac);
+	KSI_AggregationPdu_getRequest(pdu, &req);
+	KSI_AggregationReq_getRequestId(req, &requestId);
+	KSI_AggregationReq_getRequestLevel(req, &level);
+	KSI_AggregationReq_getRequestHash(req, &hsh);
+	id = KSI_Integer_getUInt64(requestId);
+
+	if (!checkAuthentication(srv, hdr, hmac, aggregationHmac, pdu)) {
+		res = authFailureResponse(srv, ctx, 1, version, resp, resp_len);
+		goto cleanup;
+	}
+
+	if (req == NULL || requestId == NULL || hsh == NULL || KSI_Integer_getUInt64(level) > 0xff ||
+			KSI_DataHash_getImprint(hsh, &imprint, &imprint_len) != KSI_OK || imprint_len > sizeof(pending.imprint)) {
+		res = aggregationStatusResponse(srv, ctx, version, id, STATUS_INVALID_REQUEST, "Invalid aggregation request.", resp, resp_len);
+		goto cleanup;
+	}
+
+	pending.version = version;
+	pending.requestId = id;
+	pending.level = (int)KSI_Integer_getUInt64(level);
+	memcpy(pending.imprint, imprint, imprint_len);
+	pending.imprint_len = imprint_len;
+
+	/* Join the current round and wait for it to be closed. */
+	KSI_Mutex_lock(srv->lock);
+	if (srv->stop) {
+		stopped = 1;
+	} else {
+		*srv->tail = &pending;
+		srv->tail = &pending.next;
+		while (!pending.done) {
+			KSI_Cond_wait(srv->roundDone, srv->lock);
+		}
+	}
+	KSI_Mutex_unlock(srv->lock);
+
+	if (pending.response == NULL) {
+		res = aggregationStatusResponse(srv, ctx, version, id, STATUS_INTERNAL_ERROR, stopped ? "The server is shutting down." : "Aggregation failed.", resp, resp_len);
+		goto cleanup;
+	}
+
+	*resp = pending.response;
+	*resp_len = pending.response_len;
+	pending.response = NULL;
+
+	res = KSI_OK;
+
+cleanup:
+
+	KSI_free(pending.response);
+	KSI_AggregationPdu_free(pdu);
+
+	return res;
+}
+
+static int handleExtension(Server *srv, KSI_CTX *ctx, const unsigned char *raw, size_t raw_len, size_t version, unsigned char **resp, size_t *resp_len) {
+	int res;
+	KSI_ExtendPdu *pdu = NULL;
+	KSI_Header *hdr = NULL;
+	KSI_DataHash *hmac = NULL;
+	KSI_ExtendReq *req = NULL;
+	KSI_Integer *requestId = NULL;
+	KSI_Integer *aggrTime = NULL;
+	KSI_Integer *pubTime = NULL;
+	KSI_ExtendResp *tmp = NULL;
+	KSI_CalendarHashChain *chain = NULL;
+	KSI_Integer *val = NULL;
+	KSI_uint64_t id = 0;
+	KSI_uint64_t aggrTm;
+	KSI_uint64_t pubTm;
+	KSI_uint64_t last;
+
+	res = KSI_CTX_setFlag(ctx, KSI_CTX_FLAG_EXT_PDU_VER, (void *)version);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_ExtendPdu_parse(ctx, raw, raw_len, &pdu);
+	if (res != KSI_OK) goto cleanup;
+
+	KSI_ExtendPdu_getHeader(pdu, &hdr);
+	KSI_ExtendPdu_getHmac(pdu, &hmac);
+	KSI_ExtendPdu_getRequest(pdu, &req);
+	KSI_ExtendReq_getRequestId(req, &requestId);
+	KSI_ExtendReq_getAggregationTime(req, &aggrTime);
+	KSI_ExtendReq_getPublicationTime(req, &pubTime);
+	id = KSI_Integer_getUInt64(requestId);
+
+	if (!checkAuthentication(srv, hdr, hmac, extendHmac, pdu)) {
+		res = authFailureResponse(srv, ctx, 0, version, resp, resp_len);
+		goto cleanup;
+	}
+
+	if (req == NULL || requestId == NULL || aggrTime == NULL) {
+		res = extendStatusResponse(srv, ctx, version, id, STATUS_INVALID_REQUEST, "Invalid extension request.", resp, resp_len);
+		goto cleanup;
+	}
+
+	KSI_Mutex_lock(srv->calLock);
+	last = srv->cal.last;
+	aggrTm = KSI_Integer_getUInt64(aggrTime);
+	pubTm = pubTime != NULL ? KSI_Integer_getUInt64(pubTime) : last;
+	if (aggrTm == 0 || aggrTm > pubTm || pubTm > last) {
+		res = KSI_OK;
+	} else {
+		res = calendarChain(ctx, &srv->cal, aggrTm, pubTm, &chain);
+	}
+	KSI_Mutex_unlock(srv->calLock);
+	if (res != KSI_OK) goto cleanup;
+
+	if (chain == NULL) {
+		if (pubTm > last) {
+			res = extendStatusResponse(srv, ctx, version, id, STATUS_TIME_IN_FUTURE, "The publication time is in the future.", resp, resp_len);
+		} else {
+			res = extendStatusResponse(srv, ctx, version, id, STATUS_INVALID_TIME_RANGE, "Invalid time range.", resp, resp_len);
+		}
+		goto cleanup;
+	}
+
+	res = KSI_ExtendResp_new(ctx, &tmp);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_ExtendResp_setCalendarHashChain(tmp, chain);
+	if (res != KSI_OK) goto cleanup;
+	chain = NULL;
+
+	res = KSI_Integer_new(ctx, id, &val);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_ExtendResp_setRequestId(tmp, val);
+	if (res != KSI_OK) goto cleanup;
+	val = NULL;
+
+	res = KSI_Integer_new(ctx, STATUS_OK, &val);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_ExtendResp_setStatus(tmp, val);
+	if (res != KSI_OK) goto cleanup;
+	val = NULL;
+
+	res = KSI_Integer_new(ctx, last, &val);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_ExtendResp_setLastTime(tmp, val);
+	if (res != KSI_OK) goto cleanup;
+	val = NULL;
+
+	res = serializeExtendResponse(srv, ctx, version, tmp, resp, resp_len);
+	tmp = NULL;
+
+cleanup:
+
+	KSI_Integer_free(val);
+	KSI_CalendarHashChain_free(chain);
+	KSI_ExtendResp_free(tmp);
+	KSI_ExtendPdu_free(pdu);
+
+	return res;
+}
+
+/* Dispatches a request PDU by its tag. */
+static int handlePdu(Server *srv, KSI_CTX *ctx, const unsigned char *raw, size_t raw_len, unsigned char **resp, size_t *resp_len) {
+	int res;
+	KSI_FTLV ftlv;
+	int extension = 0;
+
+	res = KSI_FTLV_memRead(raw, raw_len, &ftlv);
+	if (res != KSI_OK) goto cleanup;
+
+	switch (ftlv.tag) {
+		case 0x200:
+			res = handleAggregation(srv, ctx, raw, raw_len, KSI_PDU_VERSION_1, resp, resp_len);
+			break;
+		case 0x220:
+			res = handleAggregation(srv, ctx, raw, raw_len, KSI_PDU_VERSION_2, resp, resp_len);
+			break;
+		case 0x300:
+			extension = 1;
+			res = handleExtension(srv, ctx, raw, raw_len, KSI_PDU_VERSION_1, resp, resp_len);
+			break;
+		case 0x320:
+			extension = 1;
+			res = handleExtension(srv, ctx, raw, raw_len, KSI_PDU_VERSION_2, resp, resp_len);
+			break;
+		default:
+			res = KSI_INVALID_FORMAT;
+			break;
+	}
+
+cleanup:
+
+	KSI_Mutex_lock(srv->lock);
+	if (res != KSI_OK) {
+		srv->failures++;
+	} else if (extension) {
+		srv->extRequests++;
+	} else {
+		srv->aggrRequests++;
+	}
+	KSI_Mutex_unlock(srv->lock);
+
+	KSI_ERR_clearErrors(ctx);
+
+	return res;
+}
+
+static int sendAll(int fd, const void *data, size_t len) {
+	const char *ptr = data;
+
+	while (len > 0) {
+		int c = send(fd, ptr, (int)len, 0);
+		if (c <= 0) return KSI_NETWORK_ERROR;
+		ptr += c;
+		len -= (size_t)c;
+	}
+
+	return KSI_OK;
+}
+
+/* Reads more data into the connection buffer. */
+static int readMore(Connection *conn) {
+	int c;
+
+	if (conn->buf_len == sizeof(conn->buf)) return KSI_BUFFER_OVERFLOW;
+
+	c = recv(conn->fd, (char *)conn->buf + conn->buf_len, (int)(sizeof(conn->buf) - conn->buf_len), 0);
+	if (c <= 0) return KSI_NETWORK_ERROR;
+
+	conn->buf_len += (size_t)c;
+	return KSI_OK;
+}
+
+/* Serves the raw TLV requests of a ksi+tcp connection until it is closed. */
+static int serveTcp(Connection *conn, KSI_CTX *ctx) {
+	int res;
+	KSI_FTLV ftlv;
+	size_t count;
+	unsigned char *resp = NULL;
+	size_t resp_len = 0;
+
+	for (;;) {
+		res = KSI_FTLV_socketRead(conn->fd, conn->buf, sizeof(conn->buf), &count, &ftlv);
+		if (res != KSI_OK || count == 0) break;
+
+		res = handlePdu(conn->srv, ctx, conn->buf, count, &resp, &resp_len);
+		if (res != KSI_OK) break;
+
+		res = sendAll(conn->fd, resp, resp_len);
+		if (res != KSI_OK) break;
+
+		KSI_free(resp);
+		resp = NULL;
+	}
+
+	KSI_free(resp);
+
+	return KSI_OK;
+}
+
+static const char *findHeaderEnd(const unsigned char *buf, size_t len) {
+	size_t i;
+	for (i = 3; i < len; i++) {
+		if (buf[i - 3] == '\r' && buf[i - 2] == '\n' && buf[i - 1] == '\r' && buf[i] == '\n') return (const char *)buf + i + 1;
+	}
+	return NULL;
+}
+
+/* Case insensitive lookup of a header value in the NUL terminated header block. */
+static const char *findHeader(const char *headers, const char *name) {
+	size_t name_len = strlen(name);
+	const char *line = strstr(headers, "\r\n");
+
+	while (line != NULL && line[2] != '\r') {
+		size_t i;
+		line += 2;
+		for (i = 0; i < name_len && line[i] != '\0' && tolower((unsigned char)line[i]) == tolower((unsigned char)name[i]); i++);
+		if (i == name_len && line[i] == ':') {
+			line += i + 1;
+			while (*line == ' ' || *line == '\t') line++;
+			return line;
+		}
+		line = strstr(line, "\r\n");
+	}
+
+	return NULL;
+}
+
+static int sendHttpResponse(Connection *conn, const char *status, const unsigned char *body, size_t body_len, int keepAlive) {
+	int res;
+	char hdr[256];
+
+	KSI_snprintf(hdr, sizeof(hdr),
+			"HTTP/1.1 %s\r\n"
+			"Content-Type: application/ksi-response\r\n"
+			"Content-Length: %lu\r\n"
+			"Connection: %s\r\n"
+			"\r\n", status, (unsigned long)body_len, keepAlive ? "keep-alive" : "close");
+
+	res = sendAll(conn->fd, hdr, strlen(hdr));
+	if (res != KSI_OK || body_len == 0) return res;
+
+	return sendAll(conn->fd, body, body_len);
+}
+
+/* Serves the HTTP POST requests of a connection until it is closed. */
+static int serveHttp(Connection *conn, KSI_CTX *ctx) {
+	int res;
+	unsigned char *resp = NULL;
+	size_t resp_len = 0;
+	char headers[MAX_HTTP_HEADER_LEN + 1];
+
+	for (;;) {
+		const char *end = NULL;
+		const char *val = NULL;
+		size_t hdr_len;
+		size_t body_len = 0;
+		int keepAlive;
+
+		while ((end = findHeaderEnd(conn->buf, conn->buf_len)) == NULL) {
+			if (conn->buf_len >= MAX_HTTP_HEADER_LEN) goto cleanup;
+			if (readMore(conn) != KSI_OK) goto cleanup;
+		}
+
+		hdr_len = (size_t)(end - (const char *)conn->buf);
+		if (hdr_len > MAX_HTTP_HEADER_LEN) goto cleanup;
+		memcpy(headers, conn->buf, hdr_len);
+		headers[hdr_len] = '\0';
+
+		keepAlive = strstr(headers, "HTTP/1.0\r\n") == NULL;
+		val = findHeader(headers, "Connection");
+		if (val != NULL && strncmp(val, "close", 5) == 0) keepAlive = 0;
+
+		val = findHeader(headers, "Content-Length");
+		if (val != NULL) body_len = (size_t)strtoul(val, NULL, 10);
+
+		if (strncmp(headers, "POST ", 5) != 0 || body_len == 0 || body_len > MAX_PDU_LEN) {
+			sendHttpResponse(conn, "400 Bad Request", NULL, 0, 0);
+			goto cleanup;
+		}
+
+		val = findHeader(headers, "Expect");
+		if (val != NULL && strncmp(val, "100-continue", 12) == 0) {
+			static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+			if (sendAll(conn->fd, cont, sizeof(cont) - 1) != KSI_OK) goto cleanup;
+		}
+
+		while (conn->buf_len < hdr_len + body_len) {
+			if (readMore(conn) != KSI_OK) goto cleanup;
+		}
+
+		res = handlePdu(conn->srv, ctx, conn->buf + hdr_len, body_len, &resp, &resp_len);
+		if (res != KSI_OK) {
+			sendHttpResponse(conn, "400 Bad Request", NULL, 0, 0);
+			goto cleanup;
+		}
+
+		if (sendHttpResponse(conn, "200 OK", resp, resp_len, keepAlive) != KSI_OK || !keepAlive) goto cleanup;
+
+		KSI_free(resp);
+		resp = NULL;
+
+		/* Keep the beginning of a pipelined request. */
+		conn->buf_len -= hdr_len + body_len;
+		memmove(conn->buf, conn->buf + hdr_len + body_len, conn->buf_len);
+	}
+
+cleanup:
+
+	KSI_free(resp);
+
+	return KSI_OK;
+}
+
+static int connectionThread(void *arg) {
+	Connection *conn = arg;
+	Server *srv = conn->srv;
+	KSI_CTX *ctx = NULL;
+	int res = KSI_OK;
+
+	/* Take a context from the pool. */
+	KSI_Mutex_lock(srv->lock);
+	if (srv->ctxPool_len > 0) ctx = srv->ctxPool[--srv->ctxPool_len];
+	KSI_Mutex_unlock(srv->lock);
+
+	if (ctx == NULL) res = KSI_CTX_new(&ctx);
+
+	if (res == KSI_OK) {
+		if (conn->http) {
+			serveHttp(conn, ctx);
+		} else {
+			serveTcp(conn, ctx);
+		}
+	}
+
+	closesocket(conn->fd);
+
+	KSI_Mutex_lock(srv->lock);
+	if (ctx != NULL && srv->ctxPool_len < CTX_POOL_LEN) {
+		srv->ctxPool[srv->ctxPool_len++] = ctx;
+		ctx = NULL;
+	}
+	conn->done = 1;
+	KSI_Mutex_unlock(srv->lock);
+
+	KSI_CTX_free(ctx);
+
+	return res;
+}
+
+static int listenLoopback(unsigned port, int *fd) {
+	struct sockaddr_in addr;
+	int sock;
+	int on = 1;
+
+	sock = (int)socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0) return KSI_NETWORK_ERROR;
+
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (void *)&on, sizeof(on));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons((unsigned short)port);
+
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, 128) < 0) {
+		closesocket(sock);
+		return KSI_NETWORK_ERROR;
+	}
+
+	*fd = sock;
+	return KSI_OK;
+}
+
+/* Joins and frees the finished connections, or all of them if \c all is set. */
+static void reapConnections(Server *srv, Connection **list, int all) {
+	Connection **pp = list;
+
+	while (*pp != NULL) {
+		Connection *conn = *pp;
+		int done;
+
+		KSI_Mutex_lock(srv->lock);
+		done = conn->done;
+		KSI_Mutex_unlock(srv->lock);
+
+		if (!done && all) {
+			shutdown(conn->fd, SD_BOTH);
+		}
+
+		if (done || all) {
+			KSI_Thread_join(conn->thread, NULL);
+			KSI_Thread_free(conn->thread);
+			*pp = conn->next;
+			free(conn);
+		} else {
+			pp = &conn->next;
+		}
+	}
+}
+
+static int acceptConnection(Server *srv, int listenFd, int http, Connection **list) {
+	int res;
+	Connection *conn = NULL;
+	int fd;
+
+	fd = (int)accept(listenFd, NULL, NULL);
+	if (fd < 0) return KSI_NETWORK_ERROR;
+
+	conn = malloc(sizeof(Connection));
+	if (conn == NULL) {
+		closesocket(fd);
+		return KSI_OUT_OF_MEMORY;
+	}
+
+	conn->srv = srv;
+	conn->fd = fd;
+	conn->http = http;
+	conn->done = 0;
+	conn->thread = NULL;
+	conn->buf_len = 0;
+
+	res = KSI_Thread_start(srv->ksi, connectionThread, conn, &conn->thread);
+	if (res != KSI_OK) {
+		closesocket(fd);
+		free(conn);
+		return res;
+	}
+
+	conn->next = *list;
+	*list = conn;
+
+	return KSI_OK;
+}
+
+static void printHelp(const char *exec) {
+	fprintf(stderr, "Usage:\n"
+			"  %s [options]\n"
+			"\n"
+			"Serves the aggregation and extending protocols on the loopback interface.\n"
+			"\n"
+			"Options:\n"
+			"  -t <port>       Port for ksi+tcp:// requests (default %d, 0 to disable).\n"
+			"  -p <port>       Port for http:// requests (default %d, 0 to disable).\n"
+			"  -i <ms>         Aggregation round interval in milliseconds (default %d).\n"
+			"  -u <user>       Login id of the clients (default '%s').\n"
+			"  -k <key>        HMAC key of the clients (default '%s').\n"
+			"  -d <seconds>    Stop after the given time (default: run until interrupted).\n",
+			exec, DEFAULT_TCP_PORT, DEFAULT_HTTP_PORT, DEFAULT_ROUND_MS, SERVER_USER, SERVER_PASS);
+}
+
+int main(int argc, char **argv) {
+	int res = KSI_UNKNOWN_ERROR;
+	Server srv;
+	KSI_Thread *round = NULL;
+	Connection *connections = NULL;
+	unsigned tcpPort = DEFAULT_TCP_PORT;
+	unsigned httpPort = DEFAULT_HTTP_PORT;
+	int tcpFd = -1;
+	int httpFd = -1;
+	time_t deadline = 0;
+	size_t i;
+	int arg;
+#ifdef _WIN32
+	WSADATA wsaData;
+
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+	memset(&srv, 0, sizeof(srv));
+	srv.user = SERVER_USER;
+	srv.pass = SERVER_PASS;
+	srv.roundMs = DEFAULT_ROUND_MS;
+	srv.tail = &srv.head;
+
+	for (arg = 1; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+		if (strcmp(argv[arg], "-t") == 0) {
+			tcpPort = (unsigned)atoi(argv[arg + 1]);
+		} else if (strcmp(argv[arg], "-p") == 0) {
+			httpPort = (unsigned)atoi(argv[arg + 1]);
+		} else if (strcmp(argv[arg], "-i") == 0) {
+			srv.roundMs = (unsigned)atoi(argv[arg + 1]);
+		} else if (strcmp(argv[arg], "-u") == 0) {
+			srv.user = argv[arg + 1];
+		} else if (strcmp(argv[arg], "-k") == 0) {
+			srv.pass = argv[arg + 1];
+		} else if (strcmp(argv[arg], "-d") == 0) {
+			deadline = time(NULL) + atoi(argv[arg + 1]);
+		} else {
+			break;
+		}
+	}
+
+	if (arg != argc || srv.roundMs == 0 || (tcpPort == 0 && httpPort == 0)) {
+		printHelp(argv[0]);
+		res = KSI_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	res = KSI_CTX_new(&srv.ksi);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_CTX_new(&srv.roundKsi);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Mutex_new(srv.ksi, &srv.lock);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Mutex_new(srv.ksi, &srv.calLock);
+	if (res != KSI_OK) goto cleanup;
+
+	res = KSI_Cond_new(srv.ksi, &srv.roundDone);
+	if (res != KSI_OK) goto cleanup;
+
+	/* The calendar covers the time before the start with filler values. */
+	srv.cal.last = (KSI_uint64_t)time(NULL);
+
+	if (tcpPort != 0) {
+		res = listenLoopback(tcpPort, &tcpFd);
+		if (res != KSI_OK) {
+			fprintf(stderr, "Unable to listen on port %u.\n", tcpPort);
+			goto cleanup;
+		}
+		printf("Listening on ksi+tcp://127.0.0.1:%u\n", tcpPort);
+	}
+
+	if (httpPort != 0) {
+		res = listenLoopback(httpPort, &httpFd);
+		if (res != KSI_OK) {
+			fprintf(stderr, "Unable to listen on port %u.\n", httpPort);
+			goto cleanup;
+		}
+		printf("Listening on http://127.0.0.1:%u\n", httpPort);
+	}
+	fflush(stdout);
+
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+#ifndef _WIN32
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	res = KSI_Thread_start(srv.ksi, roundThread, &srv, &round);
+	if (res != KSI_OK) goto cleanup;
+
+	while (!interrupted && (deadline == 0 || time(NULL) < deadline)) {
+		fd_set fds;
+		struct timeval tv;
+		int maxFd = tcpFd > httpFd ? tcpFd : httpFd;
+
+		FD_ZERO(&fds);
+		if (tcpFd >= 0) FD_SET(tcpFd, &fds);
+		if (httpFd >= 0) FD_SET(httpFd, &fds);
+		tv.tv_sec = 0;
+		tv.tv_usec = 200000;
+
+		if (select(maxFd + 1, &fds, NULL, NULL, &tv) > 0) {
+			if (tcpFd >= 0 && FD_ISSET(tcpFd, &fds)) acceptConnection(&srv, tcpFd, 0, &connections);
+			if (httpFd >= 0 && FD_ISSET(httpFd, &fds)) acceptConnection(&srv, httpFd, 1, &connections);
+		}
+
+		reapConnections(&srv, &connections, 0);
+	}
+
+	KSI_Mutex_lock(srv.lock);
+	srv.stop = 1;
+	KSI_Mutex_unlock(srv.lock);
+
+	KSI_Thread_join(round, NULL);
+	reapConnections(&srv, &connections, 1);
+
+	printf("Rounds: %lu (largest %lu), aggregation requests: %lu, extension requests: %lu, failures: %lu\n",
+			(unsigned long)srv.rounds, (unsigned long)srv.maxRound, (unsigned long)srv.aggrRequests,
+			(unsigned long)srv.extRequests, (unsigned long)srv.failures);
+
+	res = KSI_OK;
+
+cleanup:
+
+	if (tcpFd >= 0) closesocket(tcpFd);
+	if (httpFd >= 0) closesocket(httpFd);
+
+	KSI_Thread_free(round);
+	for (i = 0; i < srv.ctxPool_len; i++) {
+		KSI_CTX_free(srv.ctxPool[i]);
+	}
+	calendarFree(&srv.cal);
+	KSI_Cond_free(srv.roundDone);
+	KSI_Mutex_free(srv.calLock);
+	KSI_Mutex_free(srv.lock);
+	KSI_CTX_free(srv.roundKsi);
+	KSI_CTX_free(srv.ksi);
+
+#ifdef _WIN32
+	WSACleanup();
+#endif
+
+	/* The status codes do not fit into the exit code. */
+	return res == KSI_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -29,8 +29,11 @@
 #include "../src/ksi/ctx_impl.h"
 #include "../src/ksi/net_impl.h"
 #include "../src/ksi/hashchain.h"
-#include "../src/ksi/publicationsfile.h"
+#include "../src/ksi/publicationsfile_impl.h"
 #include "../src/ksi/pkitruststore.h"
+#include "../src/ksi/pkicache.h"
+#include "../src/ksi/extcache.h"
+#include "../src/ksi/tlv.h"
 
 extern KSI_CTX *ctx;
 
@@ -507,6 +510,56 @@ static void testRule_AggregationHashChainConsistency(CuTest *tc) {
 #undef TEST_SIGNATURE_FILE
 }
 
+static void testRule_AggregationHashChainConsistency_memoized(CuTest *tc) {
+#define TEST_SIGNATURE_FILE "resource/tlv/ok-sig-2014-04-30.1.ksig"
+
+	int res = KSI_OK;
+	KSI_VerificationContext verCtx;
+	KSI_RuleVerificationResult verRes;
+	VerificationTempData tempData;
+	KSI_Signature *sig = NULL;
+	KSI_Signature *other = NULL;
+	KSI_DataHash *outputHash = NULL;
+
+	KSI_ERR_clearErrors(ctx);
+
+	res = KSI_VerificationContext_init(&verCtx, ctx);
+	CuAssert(tc, "Unable to create verification context.", res == KSI_OK);
+	memset(&tempData, 0, sizeof(tempData));
+	verCtx.tempData = &tempData;
+
+	res = KSI_Signature_fromFile(ctx, getFullResourcePath(TEST_SIGNATURE_FILE), &sig);
+	CuAssert(tc, "Unable to read signature from file.", res == KSI_OK && sig != NULL);
+	verCtx.signature = sig;
+
+	res = KSI_Signature_fromFile(ctx, getFullResourcePath(TEST_SIGNATURE_FILE), &other);
+	CuAssert(tc, "Unable to read signature from file.", res == KSI_OK && other != NULL);
+
+	res = KSI_VerificationRule_AggregationHashChainConsistency(&verCtx, &verRes);
+	CuAssert(tc, "Signature aggregation hash chain inconsistent.", res == KSI_OK && verRes.resultCode == KSI_VER_RES_OK);
+	CuAssert(tc, "Aggregation hash chain verification not memoized.", tempData.memo.aggregationChainVerified && tempData.aggregationOutputHash != NULL);
+	outputHash = tempData.aggregationOutputHash;
+
+	/* The second verification of the same signature must reuse the result. */
+	TEST_VERIFICATION_STEP_INIT;
+	res = KSI_VerificationRule_AggregationHashChainConsistency(&verCtx, &verRes);
+	CuAssert(tc, "Signature aggregation hash chain inconsistent.", res == KSI_OK && verRes.resultCode == KSI_VER_RES_OK);
+	CuAssert(tc, "Aggregation output hash recalculated.", tempData.aggregationOutputHash == outputHash);
+	TEST_ASSERT_VERIFICATION_STEP_SUCCEEDED(KSI_VERIFY_AGGRCHAIN_INTERNALLY);
+
+	/* The memoized values do not apply to another signature. */
+	verCtx.signature = other;
+	res = KSI_VerificationRule_AggregationHashChainConsistency(&verCtx, &verRes);
+	CuAssert(tc, "Signature aggregation hash chain inconsistent.", res == KSI_OK && verRes.resultCode == KSI_VER_RES_OK);
+	CuAssert(tc, "Memoized values used for another signature.", tempData.memo.signature == other && tempData.aggregationOutputHash != outputHash);
+
+	KSI_VerificationContext_clean(&verCtx);
+	KSI_Signature_free(sig);
+	KSI_Signature_free(other);
+
+#undef TEST_SIGNATURE_FILE
+}
+
 static void testRule_AggregationHashChainConsistency_verifyErrorResult(CuTest *tc) {
 #define TEST_SIGNATURE_FILE "resource/tlv/bad-aggregation-chain.ksig"
 
@@ -2649,6 +2702,259 @@ static void testRule_CalendarAuthenticationRecordSignatureVerification_verifyErr
 #undef TEST_CERT_FILE
 }
 
+static int verifyCalendarAuthRecSignature(KSI_CTX *ctx, const char *sigFile, KSI_PublicationsFile *pubFile, KSI_RuleVerificationResult *verRes) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_VerificationContext verCtx;
+	VerificationTempData tempData;
+
+	res = KSI_VerificationContext_init(&verCtx, ctx);
+	if (res != KSI_OK) goto cleanup;
+	memset(&tempData, 0, sizeof(tempData));
+	verCtx.tempData = &tempData;
+	verCtx.userPublicationsFile = pubFile;
+
+	res = KSI_Signature_fromFile(ctx, getFullResourcePath(sigFile), &verCtx.signature);
+	if (res != KSI_OK) goto cleanup;
+
+	verRes->stepsPerformed = KSI_VERIFY_NONE;
+	verRes->stepsFailed = KSI_VERIFY_NONE;
+	verRes->stepsSuccessful = KSI_VERIFY_NONE;
+
+	res = KSI_VerificationRule_CalendarAuthenticationRecordSignatureVerification(&verCtx, verRes);
+
+cleanup:
+
+	KSI_Signature_free(verCtx.signature);
+	KSI_VerificationContext_clean(&verCtx);
+
+	return res;
+}
+
+static void testRule_CalendarAuthenticationRecordSignatureVerification_cachedResult(CuTest *tc) {
+#define TEST_SIGNATURE_FILE    "resource/tlv/ok-sig-2014-06-2.ksig"
+#define TEST_WRONG_SIG_FILE    "resource/tlv/signature-cal-auth-wrong-signing-value.ksig"
+#define TEST_PUBLICATIONS_FILE "resource/tlv/publications.tlv"
+#define TEST_CERT_FILE         "resource/tlv/mock.crt"
+
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_RuleVerificationResult verRes;
+	KSI_PKITruststore *pki = NULL;
+	KSI_PKIVerificationCache *cache = NULL;
+	KSI_PublicationsFile *pubFile = NULL;
+	const KSI_CertConstraint certCnst[] = {
+		{KSI_CERT_EMAIL, "publications@guardtime.com"},
+		{NULL, NULL}
+	};
+	KSI_CTX *ctx = NULL;
+	int i;
+
+	res = KSITest_CTX_clone(&ctx);
+	CuAssert(tc, "Unable to create new context.", res == KSI_OK && ctx != NULL);
+
+	res = KSI_PublicationsFile_fromFile(ctx, getFullResourcePath(TEST_PUBLICATIONS_FILE), &pubFile);
+	CuAssert(tc, "Unable to read publications file", res == KSI_OK && pubFile != NULL);
+
+	res = KSI_CTX_setDefaultPubFileCertConstraints(ctx, certCnst);
+	CuAssert(tc, "Unable to set cert constraints", res == KSI_OK);
+
+	res = KSI_PKITruststore_new(ctx, 0, &pki);
+	CuAssert(tc, "Unable to get PKI truststore from context.", res == KSI_OK && pki != NULL);
+
+	res = KSI_PKITruststore_addLookupFile(pki, getFullResourcePath(TEST_CERT_FILE));
+	CuAssert(tc, "Unable to read certificate", res == KSI_OK);
+
+	res = KSI_CTX_setPKITruststore(ctx, pki);
+	CuAssert(tc, "Unable to set new PKI truststrore for KSI context.", res == KSI_OK);
+
+	cache = KSI_PKITruststore_getVerificationCache(pki);
+	CuAssert(tc, "Truststore has no verification cache.", cache != NULL);
+
+	/* The second round is served from the verification cache, failed verifications are not cached. */
+	for (i = 0; i < 2; i++) {
+		res = verifyCalendarAuthRecSignature(ctx, TEST_SIGNATURE_FILE, pubFile, &verRes);
+		CuAssert(tc, "Failed to verify calendar authentication record signature", res == KSI_OK && verRes.resultCode == KSI_VER_RES_OK);
+		TEST_ASSERT_VERIFICATION_STEP_SUCCEEDED(KSI_VERIFY_CALAUTHREC_WITH_SIGNATURE);
+		CuAssert(tc, "Unexpected verification cache hit count.", KSI_PKIVerificationCache_getHits(cache) == (size_t)i);
+
+		res = verifyCalendarAuthRecSignature(ctx, TEST_WRONG_SIG_FILE, pubFile, &verRes);
+		CuAssert(tc, "Wrong error result returned", res == KSI_OK && verRes.resultCode == KSI_VER_RES_FAIL && verRes.errorCode == KSI_VER_ERR_KEY_2);
+		TEST_ASSERT_VERIFICATION_STEP_FAILED(KSI_VERIFY_CALAUTHREC_WITH_SIGNATURE);
+		CuAssert(tc, "Failed verification served from the cache.", KSI_PKIVerificationCache_getHits(cache) == (size_t)i);
+	}
+
+	/* Changing the trust anchors invalidates the cache. */
+	res = KSI_PKITruststore_addLookupFile(pki, getFullResourcePath(TEST_CERT_FILE));
+	CuAssert(tc, "Unable to read certificate", res == KSI_OK);
+
+	res = verifyCalendarAuthRecSignature(ctx, TEST_SIGNATURE_FILE, pubFile, &verRes);
+	CuAssert(tc, "Failed to verify calendar authentication record signature", res == KSI_OK && verRes.resultCode == KSI_VER_RES_OK);
+	TEST_ASSERT_VERIFICATION_STEP_SUCCEEDED(KSI_VERIFY_CALAUTHREC_WITH_SIGNATURE);
+	CuAssert(tc, "Stale verification served from the cache.", KSI_PKIVerificationCache_getHits(cache) == 1);
+
+	KSI_PublicationsFile_free(pubFile);
+	KSI_CTX_free(ctx);
+
+#undef TEST_SIGNATURE_FILE
+#undef TEST_WRONG_SIG_FILE
+#undef TEST_PUBLICATIONS_FILE
+#undef TEST_CERT_FILE
+}
+
+static int verifySignatureWithContextPublicationsFile(KSI_CTX *ctx, KSI_Signature *sig,
+		int (*rule)(KSI_VerificationContext *, KSI_RuleVerificationResult *), KSI_RuleVerificationResult *verRes) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_VerificationContext verCtx;
+	VerificationTempData tempData;
+
+	res = KSI_VerificationContext_init(&verCtx, ctx);
+	if (res != KSI_OK) goto cleanup;
+	memset(&tempData, 0, sizeof(tempData));
+	verCtx.tempData = &tempData;
+	verCtx.signature = sig;
+
+	verRes->stepsPerformed = KSI_VERIFY_NONE;
+	verRes->stepsFailed = KSI_VERIFY_NONE;
+	verRes->stepsSuccessful = KSI_VERIFY_NONE;
+
+	res = rule(&verCtx, verRes);
+
+	verCtx.signature = NULL;
+	KSI_VerificationContext_clean(&verCtx);
+
+cleanup:
+
+	return res;
+}
+
+static int verifyWithContextPublicationsFile(KSI_CTX *ctx, const char *sigFile,
+		int (*rule)(KSI_VerificationContext *, KSI_RuleVerificationResult *), KSI_RuleVerificationResult *verRes) {
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_Signature *sig = NULL;
+
+	res = KSI_Signature_fromFile(ctx, getFullResourcePath(sigFile), &sig);
+	if (res != KSI_OK) goto cleanup;
+
+	res = verifySignatureWithContextPublicationsFile(ctx, sig, rule, verRes);
+
+cleanup:
+
+	KSI_Signature_free(sig);
+
+	return res;
+}
+
+static void testRule_CalendarAuthenticationRecordSignatureVerification_trustedRoot(CuTest *tc) {
+#define TEST_SIGNATURE_FILE    "resource/tlv/ok-sig-2014-06-2.ksig"
+#define TEST_WRONG_SIG_FILE    "resource/tlv/signature-cal-auth-wrong-signing-value.ksig"
+#define TEST_PUBLICATIONS_FILE "resource/tlv/publications.tlv"
+
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_RuleVerificationResult verRes;
+	KSI_PublicationsFile *pubFile = NULL;
+	KSI_CTX *ctx = NULL;
+	KSI_Signature *sig = NULL;
+	KSI_LIST(KSI_TLV) *nested = NULL;
+	KSI_TLV *extra = NULL;
+	int i;
+
+	res = KSITest_CTX_clone(&ctx);
+	CuAssert(tc, "Unable to create new context.", res == KSI_OK && ctx != NULL);
+
+	res = KSI_PublicationsFile_fromFile(ctx, getFullResourcePath(TEST_PUBLICATIONS_FILE), &pubFile);
+	CuAssert(tc, "Unable to read publications file", res == KSI_OK && pubFile != NULL);
+
+	res = KSI_CTX_setPublicationsFile(ctx, pubFile);
+	CuAssert(tc, "Unable to set publications file.", res == KSI_OK);
+
+	/* The second round reuses the trusted calendar root, a different signature value must still fail. */
+	for (i = 0; i < 2; i++) {
+		res = verifyWithContextPublicationsFile(ctx, TEST_SIGNATURE_FILE, KSI_VerificationRule_CalendarAuthenticationRecordSignatureVerification, &verRes);
+		CuAssert(tc, "Failed to verify calendar authentication record signature", res == KSI_OK && verRes.resultCode == KSI_VER_RES_OK);
+		TEST_ASSERT_VERIFICATION_STEP_SUCCEEDED(KSI_VERIFY_CALAUTHREC_WITH_SIGNATURE);
+
+		res = verifyWithContextPublicationsFile(ctx, TEST_WRONG_SIG_FILE, KSI_VerificationRule_CalendarAuthenticationRecordSignatureVerification, &verRes);
+		CuAssert(tc, "Wrong error result returned", res == KSI_OK && verRes.resultCode == KSI_VER_RES_FAIL && verRes.errorCode == KSI_VER_ERR_KEY_2);
+		TEST_ASSERT_VERIFICATION_STEP_FAILED(KSI_VERIFY_CALAUTHREC_WITH_SIGNATURE);
+	}
+
+	res = KSI_Signature_fromFile(ctx, getFullResourcePath(TEST_SIGNATURE_FILE), &sig);
+	CuAssert(tc, "Unable to read signature from file.", res == KSI_OK && sig != NULL);
+
+	CuAssert(tc, "Root trusted without the authentication record.",
+			!KSI_CalendarRootCache_contains(ctx->rootCache, sig->calendarAuthRec->pubData, KSI_CALENDAR_ROOT_PROOF_AUTHREC, NULL));
+
+	/* Same parsed publication, but the signed bytes carry an extra non-critical element. */
+	res = KSI_TLV_getNestedList(sig->calendarAuthRec->pubData->baseTlv, &nested);
+	CuAssert(tc, "Unable to parse the publication data.", res == KSI_OK && nested != NULL);
+
+	res = KSI_TLV_new(ctx, 0x1f, 1, 0, &extra);
+	CuAssert(tc, "Unable to create TLV.", res == KSI_OK && extra != NULL);
+
+	res = KSI_TLV_setRawValue(extra, "x", 1);
+	CuAssert(tc, "Unable to set TLV value.", res == KSI_OK);
+
+	res = KSI_TLV_appendNestedTlv(sig->calendarAuthRec->pubData->baseTlv, extra);
+	CuAssert(tc, "Unable to append TLV.", res == KSI_OK);
+	extra = NULL;
+
+	res = verifySignatureWithContextPublicationsFile(ctx, sig, KSI_VerificationRule_CalendarAuthenticationRecordSignatureVerification, &verRes);
+	CuAssert(tc, "Differently encoded record served from the cache.", res == KSI_OK && verRes.resultCode == KSI_VER_RES_FAIL && verRes.errorCode == KSI_VER_ERR_KEY_2);
+	TEST_ASSERT_VERIFICATION_STEP_FAILED(KSI_VERIFY_CALAUTHREC_WITH_SIGNATURE);
+
+	KSI_TLV_free(extra);
+	KSI_Signature_free(sig);
+	KSI_CTX_free(ctx);
+
+#undef TEST_SIGNATURE_FILE
+#undef TEST_WRONG_SIG_FILE
+#undef TEST_PUBLICATIONS_FILE
+}
+
+static void testRule_PublicationsFileContainsSignaturePublication_trustedRoot(CuTest *tc) {
+#define TEST_SIGNATURE_FILE    "resource/tlv/ok-sig-2014-04-30.1-extended.ksig"
+#define TEST_PUBLICATIONS_FILE "resource/tlv/publications.tlv"
+#define TEST_OLD_PUBLICATIONS_FILE "resource/tlv/publications.15042014.tlv"
+
+	int res = KSI_UNKNOWN_ERROR;
+	KSI_RuleVerificationResult verRes;
+	KSI_PublicationsFile *pubFile = NULL;
+	KSI_CTX *ctx = NULL;
+	int i;
+
+	res = KSITest_CTX_clone(&ctx);
+	CuAssert(tc, "Unable to create new context.", res == KSI_OK && ctx != NULL);
+
+	res = KSI_PublicationsFile_fromFile(ctx, getFullResourcePath(TEST_PUBLICATIONS_FILE), &pubFile);
+	CuAssert(tc, "Unable to read publications file", res == KSI_OK && pubFile != NULL);
+
+	res = KSI_CTX_setPublicationsFile(ctx, pubFile);
+	CuAssert(tc, "Unable to set publications file.", res == KSI_OK);
+	pubFile = NULL;
+
+	for (i = 0; i < 2; i++) {
+		res = verifyWithContextPublicationsFile(ctx, TEST_SIGNATURE_FILE, KSI_VerificationRule_PublicationsFileContainsSignaturePublication, &verRes);
+		CuAssert(tc, "Publications file should contain signature publication", res == KSI_OK && verRes.resultCode == KSI_VER_RES_OK);
+		TEST_ASSERT_VERIFICATION_STEP_SUCCEEDED(KSI_VERIFY_PUBLICATION_WITH_PUBFILE);
+	}
+
+	/* Replacing the publications file must drop the trusted roots. */
+	res = KSI_PublicationsFile_fromFile(ctx, getFullResourcePath(TEST_OLD_PUBLICATIONS_FILE), &pubFile);
+	CuAssert(tc, "Unable to read publications file", res == KSI_OK && pubFile != NULL);
+
+	res = KSI_CTX_setPublicationsFile(ctx, pubFile);
+	CuAssert(tc, "Unable to set publications file.", res == KSI_OK);
+
+	res = verifyWithContextPublicationsFile(ctx, TEST_SIGNATURE_FILE, KSI_VerificationRule_PublicationsFileContainsSignaturePublication, &verRes);
+	CuAssert(tc, "Wrong error result returned", res == KSI_OK && verRes.resultCode == KSI_VER_RES_NA && verRes.errorCode == KSI_VER_ERR_GEN_2);
+	TEST_ASSERT_VERIFICATION_STEP_NA(KSI_VERIFY_PUBLICATION_WITH_PUBFILE);
+
+	KSI_CTX_free(ctx);
+
+#undef TEST_SIGNATURE_FILE
+#undef TEST_PUBLICATIONS_FILE
+#undef TEST_OLD_PUBLICATIONS_FILE
+}
+
 static void testRule_PublicationsFileContainsSignaturePublication(CuTest *tc) {
 #define TEST_SIGNATURE_FILE    "resource/tlv/ok-sig-2014-04-30.1-extended.ksig"
 #define TEST_PUBLICATIONS_FILE "resource/tlv/publications.tlv"
@@ -4012,6 +4318,66 @@ static void testRule_UserProvidedPublicationExtendedSignatureInputHash_verifyErr
 #undef TEST_MOCK_IMPRINT
 }
 
+static void testExtendedChainCache(CuTest *tc) {
+#define TEST_SIGNATURE_FILE "resource/tlv/ok-sig-2014-04-30.1.ksig"
+
+	int res;
+	KSI_ExtendedChainCache *cache = NULL;
+	KSI_Signature *sig = NULL;
+	KSI_CalendarHashChain *chain = NULL;
+	KSI_DataHash *expected = NULL;
+	KSI_DataHash *actual = NULL;
+	int claimed = 0;
+
+	KSI_ERR_clearErrors(ctx);
+
+	res = KSI_Signature_fromFile(ctx, getFullResourcePath(TEST_SIGNATURE_FILE), &sig);
+	CuAssert(tc, "Unable to read signature from file.", res == KSI_OK && sig != NULL);
+
+	res = KSI_ExtendedChainCache_new(ctx, &cache);
+	CuAssert(tc, "Unable to create cache.", res == KSI_OK && cache != NULL);
+
+	/* The first lookup must be claimed by the caller. */
+	res = KSI_ExtendedChainCache_get(cache, ctx, 1398866256, 1400112000, &chain, &claimed);
+	CuAssert(tc, "Empty cache returned a chain.", res == KSI_OK && chain == NULL && claimed == 1);
+	KSI_ExtendedChainCache_add(cache, ctx, 1398866256, 1400112000, sig->calendarChain);
+
+	res = KSI_ExtendedChainCache_get(cache, ctx, 1398866256, 1400112000, &chain, &claimed);
+	CuAssert(tc, "Cached chain not returned.", res == KSI_OK && chain != NULL && claimed == 0);
+	CuAssert(tc, "Cached chain is the original object.", chain != sig->calendarChain);
+
+	res = KSI_CalendarHashChain_aggregate(sig->calendarChain, &expected);
+	CuAssert(tc, "Unable to aggregate the calendar chain.", res == KSI_OK);
+	res = KSI_CalendarHashChain_aggregate(chain, &actual);
+	CuAssert(tc, "Unable to aggregate the cached calendar chain.", res == KSI_OK);
+	CuAssert(tc, "Cached chain differs from the original.", KSI_DataHash_equals(expected, actual));
+
+	KSI_CalendarHashChain_free(chain);
+	chain = NULL;
+
+	/* A different publication time is a different entry. */
+	res = KSI_ExtendedChainCache_get(cache, ctx, 1398866256, 1402000000, &chain, &claimed);
+	CuAssert(tc, "Chain returned for a different publication.", res == KSI_OK && chain == NULL && claimed == 1);
+
+	/* A released entry can be claimed again. */
+	KSI_ExtendedChainCache_release(cache, 1398866256, 1402000000);
+	res = KSI_ExtendedChainCache_get(cache, ctx, 1398866256, 1402000000, &chain, &claimed);
+	CuAssert(tc, "Released entry not claimed.", res == KSI_OK && chain == NULL && claimed == 1);
+	KSI_ExtendedChainCache_release(cache, 1398866256, 1402000000);
+
+	KSI_ExtendedChainCache_invalidate(cache);
+	res = KSI_ExtendedChainCache_get(cache, ctx, 1398866256, 1400112000, &chain, &claimed);
+	CuAssert(tc, "Chain returned after invalidation.", res == KSI_OK && chain == NULL && claimed == 1);
+	KSI_ExtendedChainCache_release(cache, 1398866256, 1400112000);
+
+	KSI_DataHash_free(expected);
+	KSI_DataHash_free(actual);
+	KSI_ExtendedChainCache_free(cache);
+	KSI_Signature_free(sig);
+
+#undef TEST_SIGNATURE_FILE
+}
+
 CuSuite* KSITest_VerificationRules_getSuite(void) {
 	CuSuite* suite = CuSuiteNew();
 
@@ -4031,6 +4397,7 @@ CuSuite* KSITest_VerificationRules_getSuite(void) {
 	SUITE_ADD_TEST(suite, testRule_AggregationChainMetaDataVerification_invalidMetaDataNoPadding);
 	SUITE_ADD_TEST(suite, testRule_AggregationChainMetaDataVerification_missingMetaData);
 	SUITE_ADD_TEST(suite, testRule_AggregationHashChainConsistency);
+	SUITE_ADD_TEST(suite, testRule_AggregationHashChainConsistency_memoized);
 	SUITE_ADD_TEST(suite, testRule_AggregationHashChainConsistency_verifyErrorResult);
 	SUITE_ADD_TEST(suite, testRule_AggregationHashChainTimeConsistency);
 	SUITE_ADD_TEST(suite, testRule_AggregationHashChainTimeConsistency_validRfc3161);
@@ -4099,7 +4466,10 @@ CuSuite* KSITest_VerificationRules_getSuite(void) {
 	SUITE_ADD_TEST(suite, testRule_CertificateExistence_verifyErrorResult);
 	SUITE_ADD_TEST(suite, testRule_CalendarAuthenticationRecordSignatureVerification);
 	SUITE_ADD_TEST(suite, testRule_CalendarAuthenticationRecordSignatureVerification_verifyErrorResult);
+	SUITE_ADD_TEST(suite, testRule_CalendarAuthenticationRecordSignatureVerification_cachedResult);
+	SUITE_ADD_TEST(suite, testRule_CalendarAuthenticationRecordSignatureVerification_trustedRoot);
 	SUITE_ADD_TEST(suite, testRule_PublicationsFileContainsSignaturePublication);
+	SUITE_ADD_TEST(suite, testRule_PublicationsFileContainsSignaturePublication_trustedRoot);
 	SUITE_ADD_TEST(suite, testRule_PublicationsFileContainsSignaturePublication_verifyErrorResult);
 	SUITE_ADD_TEST(suite, testRule_PublicationsFileContainsPublication);
 	SUITE_ADD_TEST(suite, testRule_PublicationsFileContainsPublication_verifyErrorResult);
@@ -4130,6 +4500,7 @@ CuSuite* KSITest_VerificationRules_getSuite(void) {
 	SUITE_ADD_TEST(suite, testRule_UserProvidedPublicationTimeMatchesExtendedResponse_verifyErrorResult);
 	SUITE_ADD_TEST(suite, testRule_UserProvidedPublicationExtendedSignatureInputHash);
 	SUITE_ADD_TEST(suite, testRule_UserProvidedPublicationExtendedSignatureInputHash_verifyErrorResult);
+	SUITE_ADD_TEST(suite, testExtendedChainCache);
 
 	return suite;
 }